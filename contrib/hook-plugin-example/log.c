@@ -0,0 +1,41 @@
+/*
+  A simple hook plugin that appends the state of the container to the
+  file specified as the first argument of the hook, e.g.:
+
+  "prestart": [{"path": "/path/to/log.so", "args": ["log.so", "/tmp/hooks.log"]}]
+
+  The plugins are used only with the run.oci.hooks.plugins=1 annotation.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+
+#include "../../src/libcrun/hook_plugin_api.h"
+
+int
+run_oci_hook_version ()
+{
+  return 1;
+}
+
+int
+run_oci_hook_run (struct run_oci_hook_state_s *state, size_t size_state, char **args, char **env)
+{
+  FILE *f;
+
+  (void) env;
+
+  if (size_state < sizeof (*state) || args == NULL || args[0] == NULL || args[1] == NULL)
+    return EINVAL;
+
+  f = fopen (args[1], "a");
+  if (f == NULL)
+    return errno;
+
+  fprintf (f, "%s %s %d %.*s\n", state->id, state->status, (int) state->pid, (int) state->state_len, state->state);
+
+  if (fclose (f) < 0)
+    return errno;
+
+  return 0;
+}
@@ -106,8 +106,9 @@ receive_fd_from_socket (int from)
 int
 main (int argc, char **argv)
 {
-  char buf[8192];
+  static char buf[65536];
   int ret, fd, socket;
+  int use_splice = 1;
   if (argc < 2)
     error (EXIT_FAILURE, 0, "usage %s PATH\n", argv[0]);
 
@@ -142,6 +143,28 @@ main (int argc, char **argv)
 
       while (1)
         {
+          /* Move the data in the kernel when stdout is a pipe.  */
+          if (use_splice)
+            {
+              ret = splice (fd, NULL, 1, NULL, sizeof (buf), SPLICE_F_MOVE);
+              if (ret < 0 && errno == EINTR)
+                continue;
+              if (ret < 0 && errno == EINVAL)
+                {
+                  use_splice = 0;
+                  continue;
+                }
+              if (ret == 0 || (ret < 0 && errno == EIO))
+                break;
+              if (ret < 0)
+                {
+                  error (0, errno, "splice");
+                  close (conn);
+                  break;
+                }
+              continue;
+            }
+
           ret = read (fd, buf, sizeof (buf));
           if (ret == 0)
             break;
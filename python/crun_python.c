@@ -30,6 +30,12 @@ ctr = python_crun.load_from_memory(json.dumps(spec))
 ctx = python_crun.make_context("test-container")
 python_crun.set_verbosity(python_crun.VERBOSITY_ERROR)
 python_crun.run(ctx, ctr)
+
+The *_many functions operate on many containers with a single call and
+without holding the GIL, and return a list of dictionaries:
+
+for r in python_crun.state_many(ctx, ["ctr1", "ctr2"]):
+    print(r['id'], r['error'] or r['status'])
 */
 
 #include <config.h>
@@ -65,7 +71,7 @@ static void
 free_container (PyObject *ptr)
 {
   libcrun_container_t *ctr = PyCapsule_GetPointer (ptr, CONTAINER_OBJ_TAG);
-  free_runtime_spec_schema_config_schema (ctr->container_def);
+  libcrun_container_free (ctr);
 }
 
 static PyObject *
@@ -103,16 +109,21 @@ container_load_from_memory (PyObject *self, PyObject *args)
 }
 
 static void
-free_context (void *ptr)
+free_context (PyObject *ptr)
 {
-  libcrun_context_t *ctx = ptr;
-  char *id = (char *) ctx->id;
-  free (ctx->state_root);
-  free (ctx->notify_socket);
-  free (id);
+  libcrun_context_t *ctx = PyCapsule_GetPointer (ptr, CONTEXT_OBJ_TAG);
+  if (ctx == NULL)
+    return;
+  free ((char *) ctx->id);
+  free ((char *) ctx->bundle);
+  free ((char *) ctx->state_root);
+  free ((char *) ctx->notify_socket);
   free (ctx);
 }
 
+/* Every operation works on its own copy of the context, so the same
+   object can be reused for any number of them, also from different
+   threads.  */
 static PyObject *
 make_context (PyObject *self, PyObject *args, PyObject *kwargs)
 {
@@ -121,24 +132,38 @@ make_context (PyObject *self, PyObject *args, PyObject *kwargs)
   char *state_root = NULL;
   char *notify_socket = NULL;
   static char *kwlist[] =
-    { "id", "state-root", "systemd-cgroup", "notify-socket", "detach", NULL };
+    { "id", "bundle", "state-root", "systemd-cgroup", "notify-socket", "detach", NULL };
   libcrun_context_t *ctx = malloc (sizeof (*ctx));
   if (ctx == NULL)
-    return NULL;
+    return PyErr_NoMemory ();
 
   memset (ctx, 0, sizeof (*ctx));
   ctx->fifo_exec_wait_fd = -1;
+  ctx->start_event_fd = -1;
 
   if (!PyArg_ParseTupleAndKeywords
-      (args, kwargs, "s|sssbsb", kwlist, &id, &bundle, &state_root,
+      (args, kwargs, "s|ssbsb", kwlist, &id, &bundle, &state_root,
        &ctx->systemd_cgroup, &notify_socket, &ctx->detach))
-    return NULL;
+    {
+      free (ctx);
+      return NULL;
+    }
 
   ctx->id = xstrdup (id);
   ctx->bundle = xstrdup (bundle ? bundle : ".");
   ctx->state_root = xstrdup (state_root);
   ctx->notify_socket = xstrdup (notify_socket);
-  return PyCapsule_New (ctx, CONTEXT_OBJ_TAG, NULL);
+  return PyCapsule_New (ctx, CONTEXT_OBJ_TAG, free_context);
+}
+
+static libcrun_context_t *
+get_context (PyObject *obj, libcrun_context_t *copy)
+{
+  libcrun_context_t *ctx = PyCapsule_GetPointer (obj, CONTEXT_OBJ_TAG);
+  if (ctx == NULL)
+    return NULL;
+  memcpy (copy, ctx, sizeof (*copy));
+  return copy;
 }
 
 static PyObject *
@@ -148,13 +173,13 @@ container_run (PyObject *self, PyObject *args)
   PyObject *ctx_obj = NULL;
   PyObject *ctr_obj = NULL;
   libcrun_container_t *ctr;
-  libcrun_context_t *ctx;
+  libcrun_context_t *ctx, ctx_copy;
   int ret;
 
   if (!PyArg_ParseTuple (args, "OO", &ctx_obj, &ctr_obj))
     return NULL;
 
-  ctx = PyCapsule_GetPointer (ctx_obj, CONTEXT_OBJ_TAG);
+  ctx = get_context (ctx_obj, &ctx_copy);
   if (ctx == NULL)
     return NULL;
 
@@ -178,13 +203,13 @@ container_create (PyObject *self, PyObject *args)
   PyObject *ctx_obj = NULL;
   PyObject *ctr_obj = NULL;
   libcrun_container_t *ctr;
-  libcrun_context_t *ctx;
+  libcrun_context_t *ctx, ctx_copy;
   int ret;
 
   if (!PyArg_ParseTuple (args, "OO", &ctx_obj, &ctr_obj))
     return NULL;
 
-  ctx = PyCapsule_GetPointer (ctx_obj, CONTEXT_OBJ_TAG);
+  ctx = get_context (ctx_obj, &ctx_copy);
   if (ctx == NULL)
     return NULL;
 
@@ -195,6 +220,12 @@ container_create (PyObject *self, PyObject *args)
   Py_BEGIN_ALLOW_THREADS;
   ret = libcrun_container_create (ctx, ctr, LIBCRUN_RUN_OPTIONS_PREFORK, &err);
   Py_END_ALLOW_THREADS;
+
+  /* The exec fifo is used only by the container process.  */
+  if (ctx->fifo_exec_wait_fd >= 0)
+    close (ctx->fifo_exec_wait_fd);
+  if (ctx->start_event_fd >= 0)
+    close (ctx->start_event_fd);
   if (ret < 0)
     return set_error (&err);
 
@@ -208,13 +239,13 @@ container_delete (PyObject *self, PyObject *args)
   PyObject *ctx_obj = NULL;
   char *id = NULL;
   bool force;
-  libcrun_context_t *ctx;
+  libcrun_context_t *ctx, ctx_copy;
   int ret;
 
   if (!PyArg_ParseTuple (args, "Osn", &ctx_obj, &id, &force))
     return NULL;
 
-  ctx = PyCapsule_GetPointer (ctx_obj, CONTEXT_OBJ_TAG);
+  ctx = get_context (ctx_obj, &ctx_copy);
   if (ctx == NULL)
     return NULL;
 
@@ -234,13 +265,13 @@ container_kill (PyObject *self, PyObject *args)
   PyObject *ctx_obj = NULL;
   char *id = NULL;
   int signal;
-  libcrun_context_t *ctx;
+  libcrun_context_t *ctx, ctx_copy;
   int ret;
 
   if (!PyArg_ParseTuple (args, "Osi", &ctx_obj, &id, &signal))
     return NULL;
 
-  ctx = PyCapsule_GetPointer (ctx_obj, CONTEXT_OBJ_TAG);
+  ctx = get_context (ctx_obj, &ctx_copy);
   if (ctx == NULL)
     return NULL;
 
@@ -259,13 +290,13 @@ container_start (PyObject *self, PyObject *args)
   libcrun_error_t err;
   PyObject *ctx_obj = NULL;
   char *id = NULL;
-  libcrun_context_t *ctx;
+  libcrun_context_t *ctx, ctx_copy;
   int ret;
 
   if (!PyArg_ParseTuple (args, "Os", &ctx_obj, &id))
     return NULL;
 
-  ctx = PyCapsule_GetPointer (ctx_obj, CONTEXT_OBJ_TAG);
+  ctx = get_context (ctx_obj, &ctx_copy);
   if (ctx == NULL)
     return NULL;
 
@@ -283,7 +314,7 @@ containers_list (PyObject *self, PyObject *args)
 {
   libcrun_error_t err;
   PyObject *ctx_obj = NULL;
-  libcrun_context_t *ctx;
+  libcrun_context_t *ctx, ctx_copy;
   libcrun_container_list_t *containers, *it;
   PyObject *retobj;
   Py_ssize_t i = 0;
@@ -292,7 +323,7 @@ containers_list (PyObject *self, PyObject *args)
   if (!PyArg_ParseTuple (args, "O", &ctx_obj))
     return NULL;
 
-  ctx = PyCapsule_GetPointer (ctx_obj, CONTEXT_OBJ_TAG);
+  ctx = get_context (ctx_obj, &ctx_copy);
   if (ctx == NULL)
     return NULL;
 
@@ -324,7 +355,7 @@ container_status (PyObject *self, PyObject *args)
 {
   libcrun_error_t err;
   PyObject *ctx_obj = NULL;
-  libcrun_context_t *ctx;
+  libcrun_context_t *ctx, ctx_copy;
   char *id = NULL;
   libcrun_container_status_t status;
   cleanup_free char *buffer = NULL;
@@ -334,7 +365,7 @@ container_status (PyObject *self, PyObject *args)
   if (!PyArg_ParseTuple (args, "Os", &ctx_obj, &id))
     return NULL;
 
-  ctx = PyCapsule_GetPointer (ctx_obj, CONTEXT_OBJ_TAG);
+  ctx = get_context (ctx_obj, &ctx_copy);
   if (ctx == NULL)
     return NULL;
 
@@ -358,6 +389,347 @@ container_status (PyObject *self, PyObject *args)
   return PyUnicode_FromString (buffer);
 }
 
+static PyObject *
+error_to_string (libcrun_error_t *err)
+{
+  PyObject *ret;
+
+  if ((*err)->status == 0)
+    ret = PyUnicode_FromString ((*err)->msg);
+  else
+    ret = PyUnicode_FromFormat ("%s: %s", (*err)->msg, strerror ((*err)->status));
+  libcrun_error_release (err);
+  return ret;
+}
+
+/* Build the {"id": ID, "error": MSG} result of a batch operation.  ERR is
+   released.  */
+static PyObject *
+make_batch_result (const char *id, int ret, libcrun_error_t *err)
+{
+  PyObject *error;
+  PyObject *dict;
+
+  if (ret < 0)
+    error = error_to_string (err);
+  else
+    {
+      Py_INCREF (Py_None);
+      error = Py_None;
+    }
+  if (error == NULL)
+    return NULL;
+
+  dict = Py_BuildValue ("{s:s,s:N}", "id", id, "error", error);
+  return dict;
+}
+
+static void
+free_ids (char **ids)
+{
+  char **it;
+
+  for (it = ids; *it; it++)
+    free (*it);
+  free (ids);
+}
+
+/* Copy the strings in the sequence OBJ, so that they can be used after
+   the GIL is released.  */
+static char **
+get_ids (PyObject *obj, size_t *len)
+{
+  PyObject *seq;
+  char **ids;
+  Py_ssize_t i, n;
+
+  seq = PySequence_Fast (obj, "expected a sequence of container ids");
+  if (seq == NULL)
+    return NULL;
+
+  n = PySequence_Fast_GET_SIZE (seq);
+  ids = xmalloc0 (sizeof (char *) * (n + 1));
+  for (i = 0; i < n; i++)
+    {
+      const char *id = PyUnicode_AsUTF8 (PySequence_Fast_GET_ITEM (seq, i));
+      if (id == NULL)
+        {
+          Py_DECREF (seq);
+          free_ids (ids);
+          return NULL;
+        }
+      ids[i] = xstrdup (id);
+    }
+
+  Py_DECREF (seq);
+  *len = n;
+  return ids;
+}
+
+static const char *
+get_dict_string (PyObject *dict, const char *key)
+{
+  PyObject *value = PyDict_GetItemString (dict, key);
+  if (value == NULL || value == Py_None)
+    return NULL;
+  return PyUnicode_AsUTF8 (value);
+}
+
+static void
+free_batch_entries (libcrun_container_batch_entry_t *entries, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      free ((char *) entries[i].id);
+      free ((char *) entries[i].bundle);
+      free ((char *) entries[i].config_file);
+      free ((char *) entries[i].pid_file);
+      free ((char *) entries[i].console_socket);
+      if (entries[i].err)
+        libcrun_error_release (&entries[i].err);
+    }
+  free (entries);
+}
+
+static PyObject *
+containers_create_many (PyObject *self, PyObject *args)
+{
+  libcrun_error_t err;
+  PyObject *ctx_obj = NULL;
+  PyObject *entries_obj = NULL;
+  PyObject *seq = NULL;
+  PyObject *retobj = NULL;
+  libcrun_container_batch_entry_t *entries;
+  libcrun_context_t *ctx, ctx_copy;
+  Py_ssize_t i, n;
+  int ret;
+
+  if (!PyArg_ParseTuple (args, "OO", &ctx_obj, &entries_obj))
+    return NULL;
+
+  ctx = get_context (ctx_obj, &ctx_copy);
+  if (ctx == NULL)
+    return NULL;
+
+  seq = PySequence_Fast (entries_obj, "expected a sequence of dictionaries");
+  if (seq == NULL)
+    return NULL;
+
+  n = PySequence_Fast_GET_SIZE (seq);
+  entries = xmalloc0 (sizeof (*entries) * (n + 1));
+  for (i = 0; i < n; i++)
+    {
+      PyObject *entry = PySequence_Fast_GET_ITEM (seq, i);
+      const char *id, *bundle, *value;
+
+      if (!PyDict_Check (entry))
+        {
+          PyErr_SetString (PyExc_TypeError, "expected a sequence of dictionaries");
+          goto exit;
+        }
+
+      id = get_dict_string (entry, "id");
+      if (id == NULL)
+        {
+          if (!PyErr_Occurred ())
+            PyErr_SetString (PyExc_ValueError, "missing container id");
+          goto exit;
+        }
+      entries[i].id = xstrdup (id);
+
+      /* The batch wants an absolute path to the bundle.  */
+      bundle = get_dict_string (entry, "bundle");
+      if (bundle == NULL && !PyErr_Occurred ())
+        bundle = ctx->bundle;
+      if (bundle == NULL)
+        goto exit;
+      entries[i].bundle = realpath (bundle, NULL);
+      if (entries[i].bundle == NULL)
+        {
+          PyErr_SetFromErrnoWithFilename (PyExc_OSError, bundle);
+          goto exit;
+        }
+
+      value = get_dict_string (entry, "config");
+      entries[i].config_file = xstrdup (value);
+      value = get_dict_string (entry, "pid-file");
+      entries[i].pid_file = xstrdup (value);
+      value = get_dict_string (entry, "console-socket");
+      entries[i].console_socket = xstrdup (value);
+      if (PyErr_Occurred ())
+        goto exit;
+    }
+
+  /* The GIL is kept: the batch changes the working directory of the
+     process for each bundle and uses the global config cache, so it must
+     not run together with other threads.  */
+  ret = libcrun_container_create_batch (ctx, entries, n, &err);
+  if (ret < 0)
+    {
+      set_error (&err);
+      goto exit;
+    }
+
+  retobj = PyList_New (n);
+  if (retobj == NULL)
+    goto exit;
+
+  for (i = 0; i < n; i++)
+    {
+      PyObject *result = make_batch_result (entries[i].id, entries[i].ret, &entries[i].err);
+      if (result == NULL)
+        {
+          Py_CLEAR (retobj);
+          goto exit;
+        }
+      PyList_SET_ITEM (retobj, i, result);
+    }
+
+exit:
+  Py_DECREF (seq);
+  free_batch_entries (entries, n);
+  return retobj;
+}
+
+struct state_result_s
+{
+  libcrun_container_status_t status;
+  const char *state;
+  int running;
+  int ret;
+  libcrun_error_t err;
+};
+
+static PyObject *
+make_state_result (const char *id, struct state_result_s *r)
+{
+  if (r->ret < 0)
+    return make_batch_result (id, r->ret, &r->err);
+
+  return Py_BuildValue ("{s:s,s:s,s:i,s:s,s:s,s:s,s:s,s:O}",
+                        "id", id,
+                        "status", r->state,
+                        "pid", r->running ? r->status.pid : 0,
+                        "bundle", r->status.bundle,
+                        "rootfs", r->status.rootfs,
+                        "created", r->status.created,
+                        "owner", r->status.owner ? r->status.owner : "",
+                        "error", Py_None);
+}
+
+static PyObject *
+containers_state_many (PyObject *self, PyObject *args)
+{
+  PyObject *ctx_obj = NULL;
+  PyObject *ids_obj = NULL;
+  PyObject *retobj = NULL;
+  libcrun_context_t *ctx, ctx_copy;
+  struct state_result_s *results;
+  char **ids;
+  size_t i, n;
+
+  if (!PyArg_ParseTuple (args, "OO", &ctx_obj, &ids_obj))
+    return NULL;
+
+  ctx = get_context (ctx_obj, &ctx_copy);
+  if (ctx == NULL)
+    return NULL;
+
+  ids = get_ids (ids_obj, &n);
+  if (ids == NULL)
+    return NULL;
+
+  results = xmalloc0 (sizeof (*results) * (n + 1));
+
+  Py_BEGIN_ALLOW_THREADS;
+  for (i = 0; i < n; i++)
+    {
+      struct state_result_s *r = &results[i];
+
+      r->err = NULL;
+      r->ret = libcrun_read_container_status (&r->status, ctx->state_root, ids[i], &r->err);
+      if (r->ret >= 0)
+        r->ret = libcrun_get_container_state_string (ids[i], &r->status, ctx->state_root, &r->state, &r->running,
+                                                     &r->err);
+    }
+  Py_END_ALLOW_THREADS;
+
+  retobj = PyList_New (n);
+  for (i = 0; i < n; i++)
+    {
+      if (retobj)
+        {
+          PyObject *result = make_state_result (ids[i], &results[i]);
+          if (result == NULL)
+            Py_CLEAR (retobj);
+          else
+            PyList_SET_ITEM (retobj, i, result);
+        }
+      if (results[i].err)
+        libcrun_error_release (&results[i].err);
+      libcrun_free_container_status (&results[i].status);
+    }
+
+  free (results);
+  free_ids (ids);
+  return retobj;
+}
+
+static PyObject *
+containers_kill_many (PyObject *self, PyObject *args)
+{
+  PyObject *ctx_obj = NULL;
+  PyObject *ids_obj = NULL;
+  PyObject *retobj = NULL;
+  libcrun_context_t *ctx, ctx_copy;
+  libcrun_error_t *errors;
+  int *rets;
+  char **ids;
+  size_t i, n;
+  int signal;
+
+  if (!PyArg_ParseTuple (args, "OOi", &ctx_obj, &ids_obj, &signal))
+    return NULL;
+
+  ctx = get_context (ctx_obj, &ctx_copy);
+  if (ctx == NULL)
+    return NULL;
+
+  ids = get_ids (ids_obj, &n);
+  if (ids == NULL)
+    return NULL;
+
+  rets = xmalloc0 (sizeof (*rets) * (n + 1));
+  errors = xmalloc0 (sizeof (*errors) * (n + 1));
+
+  Py_BEGIN_ALLOW_THREADS;
+  for (i = 0; i < n; i++)
+    rets[i] = libcrun_container_kill (ctx, ids[i], signal, &errors[i]);
+  Py_END_ALLOW_THREADS;
+
+  retobj = PyList_New (n);
+  for (i = 0; i < n; i++)
+    {
+      if (retobj)
+        {
+          PyObject *result = make_batch_result (ids[i], rets[i], &errors[i]);
+          if (result == NULL)
+            Py_CLEAR (retobj);
+          else
+            PyList_SET_ITEM (retobj, i, result);
+        }
+      if (errors[i])
+        libcrun_error_release (&errors[i]);
+    }
+
+  free (errors);
+  free (rets);
+  free_ids (ids);
+  return retobj;
+}
+
 static int
 load_json_file (yajl_val *out, const char *jsondata, struct parser_context *ctx arg_unused, libcrun_error_t *err)
 {
@@ -377,7 +749,7 @@ container_update (PyObject *self, PyObject *args)
 {
   libcrun_error_t err;
   PyObject *ctx_obj = NULL;
-  libcrun_context_t *ctx;
+  libcrun_context_t *ctx, ctx_copy;
   char *id = NULL;
   char *content = NULL;
   yajl_val tree = NULL;
@@ -389,7 +761,7 @@ container_update (PyObject *self, PyObject *args)
   if (!PyArg_ParseTuple (args, "Oss", &ctx_obj, &id, &content))
     return NULL;
 
-  ctx = PyCapsule_GetPointer (ctx_obj, CONTEXT_OBJ_TAG);
+  ctx = get_context (ctx_obj, &ctx_copy);
   if (ctx == NULL)
     return NULL;
 
@@ -476,16 +848,34 @@ set_verbosity (PyObject *self, PyObject *args)
   Py_RETURN_NONE;
 }
 
+static PyObject *
+set_config_cache (PyObject *self, PyObject *args)
+{
+  int enable;
+
+  if (!PyArg_ParseTuple (args, "p", &enable))
+    return NULL;
+
+  libcrun_container_set_config_cache (enable);
+  Py_RETURN_NONE;
+}
+
 static PyMethodDef CrunMethods[] = {
   {"load_from_file", container_load_from_file, METH_VARARGS,
    "Load an OCI container from file."},
   {"load_from_memory", container_load_from_memory, METH_VARARGS,
    "Load an OCI container from memory."},
   {"run", container_run, METH_VARARGS, "Run a container."},
-  {"create", container_run, METH_VARARGS, "Create a container."},
+  {"create", container_create, METH_VARARGS, "Create a container."},
   {"delete", container_delete, METH_VARARGS, "Delete a container."},
   {"kill", container_kill, METH_VARARGS, "Kill a container."},
   {"list", containers_list, METH_VARARGS, "List the containers."},
+  {"create_many", containers_create_many, METH_VARARGS,
+   "Create many containers in one call, return a list of {id, error}."},
+  {"state_many", containers_state_many, METH_VARARGS,
+   "Get the state of many containers as a list of dictionaries."},
+  {"kill_many", containers_kill_many, METH_VARARGS,
+   "Kill many containers in one call, return a list of {id, error}."},
   {"status", container_status, METH_VARARGS,
    "Get the status of a container."},
   {"update", container_update, METH_VARARGS,
@@ -496,6 +886,8 @@ static PyMethodDef CrunMethods[] = {
    "Create a context object."},
   {"set_verbosity", set_verbosity, METH_VARARGS, "Set the logging verbosity."},
   {"get_verbosity", get_verbosity, METH_VARARGS, "Get the logging verbosity."},
+  {"set_config_cache", set_config_cache, METH_VARARGS,
+   "Enable or disable the cache of the parsed configuration files."},
   {"spec", container_spec, METH_VARARGS,
    "Generate a new configuration file."},
   {NULL, NULL, 0, NULL}
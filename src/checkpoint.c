@@ -39,7 +39,12 @@ enum
   OPTION_LEAVE_RUNNING,
   OPTION_TCP_ESTABLISHED,
   OPTION_SHELL_JOB,
-  OPTION_EXT_UNIX_SK
+  OPTION_EXT_UNIX_SK,
+  OPTION_PARENT_PATH,
+  OPTION_PRE_DUMP,
+  OPTION_PAGE_SERVER,
+  OPTION_LAZY_PAGES,
+  OPTION_ARCHIVE
 };
 
 static char doc[] = "OCI runtime";
@@ -53,11 +58,16 @@ static struct argp_option options[]
         { "tcp-established", OPTION_TCP_ESTABLISHED, 0, 0, "allow open tcp connections", 0 },
         { "ext-unix-sk", OPTION_EXT_UNIX_SK, 0, 0, "allow external unix sockets", 0 },
         { "shell-job", OPTION_SHELL_JOB, 0, 0, "allow shell jobs", 0 },
+        { "pre-dump", OPTION_PRE_DUMP, 0, 0, "only checkpoint the container's memory", 0 },
+        { "parent-path", OPTION_PARENT_PATH, "DIR", 0, "path for previous criu image files in pre-dump", 0 },
+        { "page-server", OPTION_PAGE_SERVER, "ADDRESS:PORT", 0, "send the memory pages to a criu page server", 0 },
+        { "lazy-pages", OPTION_LAZY_PAGES, 0, 0, "serve the memory pages on demand to a lazy restore", 0 },
+        { "archive", OPTION_ARCHIVE, "FILE", 0, "write the criu image files to an archive", 0 },
         {
             0,
         } };
 
-static char args_doc[] = "checkpoint CONTAINER";
+static char args_doc[] = "checkpoint CONTAINER [CONTAINER...]";
 
 static error_t
 parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
@@ -91,6 +101,26 @@ parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
       cr_options.shell_job = true;
       break;
 
+    case OPTION_PRE_DUMP:
+      cr_options.pre_dump = true;
+      break;
+
+    case OPTION_PARENT_PATH:
+      cr_options.parent_path = argp_mandatory_argument (arg, state);
+      break;
+
+    case OPTION_PAGE_SERVER:
+      cr_options.page_server = argp_mandatory_argument (arg, state);
+      break;
+
+    case OPTION_LAZY_PAGES:
+      cr_options.lazy_pages = true;
+      break;
+
+    case OPTION_ARCHIVE:
+      cr_options.archive_path = argp_mandatory_argument (arg, state);
+      break;
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -112,7 +142,7 @@ crun_command_checkpoint (struct crun_global_arguments *global_args, int argc, ch
   };
 
   argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, &cr_options);
-  crun_assert_n_args (argc - first_arg, 1, 2);
+  crun_assert_n_args (argc - first_arg, 1, -1);
 
   ret = init_libcrun_context (&crun_context, argv[first_arg], global_args, err);
   if (UNLIKELY (ret < 0))
@@ -132,5 +162,10 @@ crun_command_checkpoint (struct crun_global_arguments *global_args, int argc, ch
       cr_options.image_path = cr_path;
     }
 
+  /* The containers of a pod are checkpointed together.  */
+  if (argc - first_arg > 1)
+    return libcrun_container_checkpoint_many (&crun_context, (const char **) argv + first_arg, argc - first_arg,
+                                              &cr_options, err);
+
   return libcrun_container_checkpoint (&crun_context, argv[first_arg], &cr_options, err);
 }
@@ -23,11 +23,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <yajl/yajl_tree.h>
+#include <yajl/yajl_gen.h>
 
 #include "crun.h"
 #include "libcrun/container.h"
 #include "libcrun/utils.h"
 
+#define YAJL_STR(x) ((const unsigned char *) (x))
+
 enum
 {
   OPTION_CONSOLE_SOCKET = 1000,
@@ -35,11 +44,28 @@ enum
   OPTION_NO_SUBREAPER,
   OPTION_NO_NEW_KEYRING,
   OPTION_PRESERVE_FDS,
-  OPTION_NO_PIVOT
+  OPTION_NO_PIVOT,
+  OPTION_BATCH,
+  OPTION_LISTEN,
+  OPTION_FROM_TEMPLATE,
+  OPTION_HOSTNAME,
+  OPTION_ENV
 };
 
+#define MAX_LISTEN_SOCKETS 16
+
 static const char *bundle = NULL;
 
+static const char *batch_file = NULL;
+
+static const char *listen_addresses[MAX_LISTEN_SOCKETS];
+static size_t listen_addresses_len;
+
+static const char *template_id = NULL;
+static const char *template_hostname = NULL;
+static char **template_env = NULL;
+static size_t template_env_len;
+
 static libcrun_context_t crun_context;
 
 static struct argp_option options[]
@@ -52,6 +78,12 @@ static struct argp_option options[]
         { "pid-file", OPTION_PID_FILE, "FILE", 0, "where to write the PID of the container", 0 },
         { "no-subreaper", OPTION_NO_SUBREAPER, 0, 0, "do not create a subreaper process", 0 },
         { "no-new-keyring", OPTION_NO_NEW_KEYRING, 0, 0, "keep the same session key", 0 },
+        { "batch", OPTION_BATCH, "FILE", 0, "create all the containers listed in FILE", 0 },
+        { "listen", OPTION_LISTEN, "ADDRESS", 0,
+          "listen on ADDRESS and start the container on the first connection", 0 },
+        { "from-template", OPTION_FROM_TEMPLATE, "TEMPLATE", 0, "fork the container from the TEMPLATE container", 0 },
+        { "hostname", OPTION_HOSTNAME, "NAME", 0, "hostname of the container forked from a template", 0 },
+        { "env", OPTION_ENV, "VAR=VALUE", 0, "environment variable for the container forked from a template", 0 },
         {
             0,
         } };
@@ -99,7 +131,32 @@ parse_opt (int key, char *arg, struct argp_state *state)
       crun_context.pid_file = argp_mandatory_argument (arg, state);
       break;
 
+    case OPTION_BATCH:
+      batch_file = argp_mandatory_argument (arg, state);
+      break;
+
+    case OPTION_FROM_TEMPLATE:
+      template_id = argp_mandatory_argument (arg, state);
+      break;
+
+    case OPTION_HOSTNAME:
+      template_hostname = argp_mandatory_argument (arg, state);
+      break;
+
+    case OPTION_ENV:
+      template_env = xrealloc (template_env, sizeof (char *) * (template_env_len + 1));
+      template_env[template_env_len++] = argp_mandatory_argument (arg, state);
+      break;
+
+    case OPTION_LISTEN:
+      if (listen_addresses_len == MAX_LISTEN_SOCKETS)
+        libcrun_fail_with_error (0, "too many listening addresses");
+      listen_addresses[listen_addresses_len++] = argp_mandatory_argument (arg, state);
+      break;
+
     case ARGP_KEY_NO_ARGS:
+      if (batch_file)
+        break;
       libcrun_fail_with_error (0, "please specify a ID for the container");
 
     default:
@@ -111,6 +168,303 @@ parse_opt (int key, char *arg, struct argp_state *state)
 
 static struct argp run_argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
 
+static const char *
+get_batch_string (yajl_val node, const char *key)
+{
+  const char *path[] = { key, NULL };
+  yajl_val v = yajl_tree_get (node, path, yajl_t_string);
+  return v ? YAJL_GET_STRING (v) : NULL;
+}
+
+static void
+print_batch_results (libcrun_container_batch_entry_t *entries, size_t len)
+{
+  const unsigned char *buf = NULL;
+  yajl_gen gen = NULL;
+  size_t i, buf_len;
+
+  gen = yajl_gen_alloc (NULL);
+  if (gen == NULL)
+    libcrun_fail_with_error (0, "yajl_gen_alloc failed");
+
+  yajl_gen_config (gen, yajl_gen_beautify, 1);
+  yajl_gen_config (gen, yajl_gen_validate_utf8, 1);
+  yajl_gen_array_open (gen);
+  for (i = 0; i < len; i++)
+    {
+      const char *id = entries[i].id ? entries[i].id : "";
+
+      yajl_gen_map_open (gen);
+      yajl_gen_string (gen, YAJL_STR ("id"), strlen ("id"));
+      yajl_gen_string (gen, YAJL_STR (id), strlen (id));
+      yajl_gen_string (gen, YAJL_STR ("created"), strlen ("created"));
+      yajl_gen_bool (gen, entries[i].ret >= 0);
+      if (entries[i].ret < 0 && entries[i].err)
+        {
+          yajl_gen_string (gen, YAJL_STR ("error"), strlen ("error"));
+          yajl_gen_string (gen, YAJL_STR (entries[i].err->msg), strlen (entries[i].err->msg));
+        }
+      yajl_gen_map_close (gen);
+    }
+  yajl_gen_array_close (gen);
+
+  if (yajl_gen_get_buf (gen, &buf, &buf_len) == yajl_gen_status_ok)
+    fprintf (stdout, "%s\n", buf);
+  yajl_gen_free (gen);
+}
+
+/* The batch file is a JSON array of objects with the keys "id", "bundle",
+   and the optional "config", "pid-file" and "console-socket".  */
+static int
+create_batch (struct crun_global_arguments *global_args, libcrun_error_t *err)
+{
+  cleanup_free libcrun_container_batch_entry_t *entries = NULL;
+  cleanup_free char **bundles = NULL;
+  cleanup_free char *content = NULL;
+  char err_buffer[256];
+  yajl_val tree = NULL;
+  size_t i, n, len;
+  int ret;
+
+  ret = read_all_file (batch_file, &content, &len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  tree = yajl_tree_parse (content, err_buffer, sizeof (err_buffer));
+  if (UNLIKELY (tree == NULL))
+    return crun_make_error (err, 0, "cannot parse `%s`: %s", batch_file, err_buffer);
+
+  if (! YAJL_IS_ARRAY (tree))
+    {
+      yajl_tree_free (tree);
+      return crun_make_error (err, 0, "`%s` must contain an array", batch_file);
+    }
+
+  n = YAJL_GET_ARRAY (tree)->len;
+  entries = xmalloc0 (sizeof (*entries) * (n + 1));
+  bundles = xmalloc0 (sizeof (char *) * (n + 1));
+  for (i = 0; i < n; i++)
+    {
+      yajl_val node = YAJL_GET_ARRAY (tree)->values[i];
+      const char *b = get_batch_string (node, "bundle");
+
+      entries[i].id = get_batch_string (node, "id");
+      entries[i].config_file = get_batch_string (node, "config");
+      entries[i].pid_file = get_batch_string (node, "pid-file");
+      entries[i].console_socket = get_batch_string (node, "console-socket");
+
+      /* Make sure the bundle is an absolute path.  */
+      if (b && b[0] != '/')
+        {
+          bundles[i] = realpath (b, NULL);
+          if (bundles[i] == NULL)
+            {
+              entries[i].ret = crun_make_error (&entries[i].err, errno, "realpath `%s` failed", b);
+              continue;
+            }
+          b = bundles[i];
+        }
+      entries[i].bundle = b;
+    }
+
+  ret = init_libcrun_context (&crun_context, NULL, global_args, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
+
+  if (getenv ("LISTEN_FDS"))
+    crun_context.preserve_fds += strtoll (getenv ("LISTEN_FDS"), NULL, 10);
+
+  ret = libcrun_container_create_batch (&crun_context, entries, n, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
+
+  print_batch_results (entries, n);
+
+  if (ret > 0)
+    ret = crun_make_error (err, 0, "%d containers could not be created", ret);
+
+exit:
+  for (i = 0; i < n; i++)
+    {
+      crun_error_release (&entries[i].err);
+      free (bundles[i]);
+    }
+  yajl_tree_free (tree);
+  return ret;
+}
+
+/* ADDRESS is either an absolute path for a UNIX socket, or HOST:PORT.  HOST
+   can be empty to listen on all the addresses, and an IPv6 address must be
+   enclosed in [].  */
+static int
+open_listen_socket (const char *address, libcrun_error_t *err)
+{
+  cleanup_free char *host = NULL;
+  struct addrinfo hints = {
+    0,
+  };
+  struct addrinfo *res = NULL;
+  const char *port;
+  int fd, ret, one = 1;
+
+  if (address[0] == '/')
+    {
+      struct sockaddr_un addr = {
+        0,
+      };
+      struct stat st;
+
+      if (strlen (address) >= sizeof (addr.sun_path))
+        return crun_make_error (err, 0, "socket path `%s` too long", address);
+
+      /* Replace only a stale socket, never another kind of file.  */
+      ret = lstat (address, &st);
+      if (ret == 0)
+        {
+          if (! S_ISSOCK (st.st_mode))
+            return crun_make_error (err, EEXIST, "`%s` exists and it is not a socket", address);
+
+          ret = unlink (address);
+          if (UNLIKELY (ret < 0 && errno != ENOENT))
+            return crun_make_error (err, errno, "unlink `%s`", address);
+        }
+      else if (UNLIKELY (errno != ENOENT))
+        return crun_make_error (err, errno, "stat `%s`", address);
+
+      fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (UNLIKELY (fd < 0))
+        return crun_make_error (err, errno, "socket");
+
+      addr.sun_family = AF_UNIX;
+      strcpy (addr.sun_path, address);
+      ret = bind (fd, (struct sockaddr *) &addr, sizeof (addr));
+      if (UNLIKELY (ret < 0))
+        {
+          ret = crun_make_error (err, errno, "bind `%s`", address);
+          close (fd);
+          return ret;
+        }
+    }
+  else
+    {
+      port = strrchr (address, ':');
+      if (port == NULL)
+        return crun_make_error (err, 0, "invalid address `%s`, it must be HOST:PORT", address);
+
+      host = xstrdup (address);
+      host[port - address] = '\0';
+      port++;
+      if (host[0] == '[' && host[strlen (host) - 1] == ']')
+        {
+          host[strlen (host) - 1] = '\0';
+          memmove (host, host + 1, strlen (host));
+        }
+
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_PASSIVE;
+      ret = getaddrinfo (host[0] ? host : NULL, port, &hints, &res);
+      if (UNLIKELY (ret != 0))
+        return crun_make_error (err, 0, "cannot resolve `%s`: %s", address, gai_strerror (ret));
+
+      fd = socket (res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+      if (UNLIKELY (fd < 0))
+        {
+          ret = crun_make_error (err, errno, "socket");
+          freeaddrinfo (res);
+          return ret;
+        }
+
+      setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+      ret = bind (fd, res->ai_addr, res->ai_addrlen);
+      freeaddrinfo (res);
+      if (UNLIKELY (ret < 0))
+        {
+          ret = crun_make_error (err, errno, "bind `%s`", address);
+          close (fd);
+          return ret;
+        }
+    }
+
+  ret = listen (fd, SOMAXCONN);
+  if (UNLIKELY (ret < 0))
+    {
+      ret = crun_make_error (err, errno, "listen `%s`", address);
+      close (fd);
+      return ret;
+    }
+
+  return fd;
+}
+
+/* Open the listening sockets and move them to the first fds after stdio,
+   where the container finds them with LISTEN_FDS.  */
+static int
+open_listen_sockets (int *fds, libcrun_error_t *err)
+{
+  size_t i;
+  int ret;
+
+  if (crun_context.preserve_fds || getenv ("LISTEN_FDS"))
+    return crun_make_error (err, 0, "`--listen` cannot be used with `--preserve-fds` or `LISTEN_FDS`");
+
+  for (i = 0; i < listen_addresses_len; i++)
+    {
+      fds[i] = open_listen_socket (listen_addresses[i], err);
+      if (UNLIKELY (fds[i] < 0))
+        return fds[i];
+    }
+
+  /* Move them first out of the target range, as a socket could already be
+     using one of the target fds.  */
+  for (i = 0; i < listen_addresses_len; i++)
+    {
+      int fd = fcntl (fds[i], F_DUPFD, 3 + MAX_LISTEN_SOCKETS);
+      if (UNLIKELY (fd < 0))
+        return crun_make_error (err, errno, "fcntl");
+      close (fds[i]);
+      fds[i] = fd;
+    }
+
+  for (i = 0; i < listen_addresses_len; i++)
+    {
+      ret = dup2 (fds[i], 3 + i);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "dup2");
+      close (fds[i]);
+      fds[i] = 3 + i;
+    }
+
+  crun_context.preserve_fds = listen_addresses_len;
+  crun_context.listen_fds = listen_addresses_len;
+  return 0;
+}
+
+/* Leave the container in the created state and start it, from a detached
+   process, when the first connection arrives.  */
+static int
+start_on_activity (int *fds, libcrun_error_t *err)
+{
+  int ret, null_fd;
+
+  ret = detach_process ();
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "detach process");
+
+  /* Do not keep the stdio of the caller open.  */
+  null_fd = open ("/dev/null", O_RDWR);
+  if (null_fd >= 0)
+    {
+      dup2 (null_fd, 0);
+      dup2 (null_fd, 1);
+      dup2 (null_fd, 2);
+      if (null_fd > 2)
+        close (null_fd);
+    }
+
+  return libcrun_container_start_on_activity (&crun_context, crun_context.id, fds, listen_addresses_len, err);
+}
+
 int
 crun_command_create (struct crun_global_arguments *global_args, int argc, char **argv, libcrun_error_t *err)
 {
@@ -118,6 +472,7 @@ crun_command_create (struct crun_global_arguments *global_args, int argc, char *
   cleanup_container libcrun_container_t *container = NULL;
   cleanup_free char *bundle_cleanup = NULL;
   cleanup_free char *config_file_cleanup = NULL;
+  int listen_fds[MAX_LISTEN_SOCKETS];
 
   crun_context.preserve_fds = 0;
   /* Check if global handler is configured and pass it down to crun context */
@@ -125,8 +480,34 @@ crun_command_create (struct crun_global_arguments *global_args, int argc, char *
 
   argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, &crun_context);
 
+  if (batch_file)
+    {
+      crun_assert_n_args (argc - first_arg, 0, 0);
+      return create_batch (global_args, err);
+    }
+
   crun_assert_n_args (argc - first_arg, 1, 1);
 
+  if (template_id)
+    {
+      ret = init_libcrun_context (&crun_context, argv[first_arg], global_args, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      return libcrun_container_create_from_template (&crun_context, template_id, template_hostname, template_env,
+                                                     template_env_len, err);
+    }
+
+  if (template_hostname || template_env_len)
+    libcrun_fail_with_error (0, "`--hostname` and `--env` can be used only with `--from-template`");
+
+  if (listen_addresses_len)
+    {
+      ret = open_listen_sockets (listen_fds, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
   /* Make sure the config is an absolute path before changing the directory.  */
   if ((strcmp ("config.json", config_file) != 0))
     {
@@ -169,5 +550,9 @@ crun_command_create (struct crun_global_arguments *global_args, int argc, char *
   if (getenv ("LISTEN_FDS"))
     crun_context.preserve_fds += strtoll (getenv ("LISTEN_FDS"), NULL, 10);
 
-  return libcrun_container_create (&crun_context, container, 0, err);
+  ret = libcrun_container_create (&crun_context, container, 0, err);
+  if (UNLIKELY (ret < 0) || listen_addresses_len == 0)
+    return ret;
+
+  return start_on_activity (listen_fds, err);
 }
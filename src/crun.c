@@ -27,6 +27,9 @@
 
 #include "crun.h"
 #include "libcrun/utils.h"
+#include "libcrun/trace.h"
+#include "libcrun/metrics.h"
+#include "libcrun/custom-handler.h"
 
 /* Commands.  */
 #include "run.h"
@@ -44,6 +47,9 @@
 #include "ps.h"
 #include "checkpoint.h"
 #include "restore.h"
+#include "daemon.h"
+#include "events.h"
+#include "metrics.h"
 
 static struct crun_global_arguments arguments;
 
@@ -65,6 +71,7 @@ init_libcrun_context (libcrun_context_t *con, const char *id, struct crun_global
   con->force_no_cgroup = glob->option_force_no_cgroup;
   con->notify_socket = getenv ("NOTIFY_SOCKET");
   con->fifo_exec_wait_fd = -1;
+  con->start_event_fd = -1;
 
   ret = libcrun_init_logging (&con->output_handler, &con->output_handler_arg, id, glob->log, err);
   if (UNLIKELY (ret < 0))
@@ -103,13 +110,19 @@ enum
   COMMAND_PS,
   COMMAND_CHECKPOINT,
   COMMAND_RESTORE,
+  COMMAND_DAEMON,
+  COMMAND_EVENTS,
+  COMMAND_METRICS,
 };
 
 struct commands_s commands[] = { { COMMAND_CREATE, "create", crun_command_create },
+                                 { COMMAND_DAEMON, "daemon", crun_command_daemon },
                                  { COMMAND_DELETE, "delete", crun_command_delete },
+                                 { COMMAND_EVENTS, "events", crun_command_events },
                                  { COMMAND_EXEC, "exec", crun_command_exec },
                                  { COMMAND_LIST, "list", crun_command_list },
                                  { COMMAND_KILL, "kill", crun_command_kill },
+                                 { COMMAND_METRICS, "metrics", crun_command_metrics },
                                  { COMMAND_PS, "ps", crun_command_ps },
                                  { COMMAND_RUN, "run", crun_command_run },
                                  { COMMAND_SPEC, "spec", crun_command_spec },
@@ -131,10 +144,13 @@ static char doc[] = "\nCOMMANDS:\n"
                     "\tcheckpoint  - checkpoint a container\n"
 #endif
                     "\tcreate      - create a container\n"
+                    "\tdaemon      - serve commands from a UNIX socket\n"
                     "\tdelete      - remove definition for a container\n"
+                    "\tevents      - show the resource usage of containers\n"
                     "\texec        - exec a command in a running container\n"
                     "\tlist        - list known containers\n"
                     "\tkill        - send a signal to the container init process\n"
+                    "\tmetrics     - output the runtime metrics in the Prometheus format\n"
                     "\tps          - show the processes in the container\n"
 #ifdef HAVE_CRIU
                     "\trestore     - restore a container\n"
@@ -167,7 +183,9 @@ enum
   OPTION_LOG,
   OPTION_LOG_FORMAT,
   OPTION_ROOT,
-  OPTION_ROOTLESS
+  OPTION_ROOTLESS,
+  OPTION_TRACE,
+  OPTION_METRICS
 };
 
 const char *argp_program_version = PACKAGE_STRING;
@@ -180,6 +198,9 @@ static struct argp_option options[] = { { "debug", OPTION_DEBUG, 0, 0, "produce
                                         { "log-format", OPTION_LOG_FORMAT, "FORMAT", 0, NULL, 0 },
                                         { "root", OPTION_ROOT, "DIR", 0, NULL, 0 },
                                         { "rootless", OPTION_ROOT, "VALUE", 0, NULL, 0 },
+                                        { "trace", OPTION_TRACE, "FILE", OPTION_ARG_OPTIONAL,
+                                          "trace the container setup phases", 0 },
+                                        { "metrics", OPTION_METRICS, 0, 0, "record the runtime metrics", 0 },
                                         {
                                             0,
                                         } };
@@ -207,12 +228,14 @@ print_version (FILE *stream, struct argp_state *state arg_unused)
 #ifdef HAVE_CRIU
   fprintf (stream, "+CRIU ");
 #endif
-#ifdef HAVE_LIBKRUN
-  fprintf (stream, "+LIBKRUN ");
-#endif
+  libcrun_handler_print_features (stream);
   fprintf (stream, "+YAJL\n");
 }
 
+static bool trace;
+static const char *trace_file;
+static bool metrics;
+
 static error_t
 parse_opt (int key, char *arg, struct argp_state *state)
 {
@@ -268,6 +291,15 @@ parse_opt (int key, char *arg, struct argp_state *state)
       /* Ignored.  So that a runc command line won't fail.  */
       break;
 
+    case OPTION_TRACE:
+      trace = true;
+      trace_file = arg;
+      break;
+
+    case OPTION_METRICS:
+      metrics = true;
+      break;
+
     case ARGP_KEY_NO_ARGS:
       libcrun_fail_with_error (0, "please specify a command");
 
@@ -300,18 +332,23 @@ argp_mandatory_argument (char *arg, struct argp_state *state)
 static struct argp argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
 
 int
-main (int argc, char **argv)
+crun_command_line (int argc, char **argv)
 {
   libcrun_error_t err = NULL;
   int ret, first_argument = 0;
+  const char *trace_env, *metrics_env;
+  uint64_t start = 0;
 
-  argp_program_version_hook = print_version;
-#ifdef HAVE_LIBKRUN
-  if (strcmp (basename (argv[0]), "krun") == 0)
+  trace_env = getenv ("CRUN_TRACE");
+  if (trace_env)
     {
-      arguments.handler = "krun";
+      trace = true;
+      trace_file = trace_env;
     }
-#endif
+
+  metrics_env = getenv ("CRUN_METRICS");
+  if (metrics_env && strcmp (metrics_env, "1") == 0)
+    metrics = true;
 
   argp_parse (&argp, argc, argv, ARGP_IN_ORDER, &first_argument, &arguments);
 
@@ -322,8 +359,57 @@ main (int argc, char **argv)
   if (arguments.debug)
     libcrun_set_verbosity (LIBCRUN_VERBOSITY_WARNING);
 
+  if (trace)
+    {
+      /* Without a file, the summary is the only output.  */
+      if (trace_file == NULL || trace_file[0] == '\0')
+        libcrun_set_verbosity (LIBCRUN_VERBOSITY_WARNING);
+      libcrun_trace_enable ();
+    }
+
+  if (metrics)
+    {
+      libcrun_error_t metrics_err = NULL;
+
+      /* The metrics are best effort, never fail the command for them.  */
+      if (UNLIKELY (libcrun_metrics_open (arguments.root, &metrics_err) < 0))
+        {
+          libcrun_warning ("%s", metrics_err->msg);
+          crun_error_release (&metrics_err);
+          metrics = false;
+        }
+      else
+        start = libcrun_trace_now ();
+    }
+
   ret = command->handler (&arguments, argc - first_argument, argv + first_argument, &err);
+  if (metrics)
+    libcrun_metrics_observe_operation (command->name, libcrun_trace_now () - start, ret < 0);
+  if (trace)
+    {
+      libcrun_error_t trace_err = NULL;
+
+      if (UNLIKELY (libcrun_trace_write (trace_file, &trace_err) < 0))
+        {
+          libcrun_warning ("%s", trace_err->msg);
+          crun_error_release (&trace_err);
+        }
+    }
   if (ret && err)
     libcrun_fail_with_error (err->status, "%s", err->msg);
   return ret;
 }
+
+int
+main (int argc, char **argv)
+{
+  argp_program_version_hook = print_version;
+#ifdef HAVE_LIBKRUN
+  if (strcmp (basename (argv[0]), "krun") == 0)
+    {
+      arguments.handler = "krun";
+    }
+#endif
+
+  return crun_command_line (argc, argv);
+}
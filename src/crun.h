@@ -37,4 +37,5 @@ char *argp_mandatory_argument (char *arg, struct argp_state *state);
 int init_libcrun_context (libcrun_context_t *con, const char *id, struct crun_global_arguments *glob,
                           libcrun_error_t *err);
 void crun_assert_n_args (int n, int min, int max);
+int crun_command_line (int argc, char **argv);
 #endif
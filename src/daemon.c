@@ -0,0 +1,352 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2017, 2018, 2019 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <argp.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "crun.h"
+#include "libcrun/container.h"
+#include "libcrun/utils.h"
+
+/* Maximum size accepted for the payload of a request.  */
+#define DAEMON_MAX_REQUEST_SIZE (1 << 20)
+
+/* Number of file descriptors that come with each request: stdin, stdout and stderr.  */
+#define DAEMON_REQUEST_FDS 3
+
+static char doc[] = "OCI runtime";
+
+static struct argp_option options[] = { {
+    0,
+} };
+
+static char args_doc[] = "daemon SOCKET";
+
+static error_t
+parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
+{
+  switch (key)
+    {
+    case ARGP_KEY_NO_ARGS:
+      libcrun_fail_with_error (0, "please specify the path to the socket");
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+
+  return 0;
+}
+
+static struct argp run_argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
+
+static int
+read_request_header (int fd, uint32_t *len, int *fds, libcrun_error_t *err)
+{
+  char ctrl_buf[CMSG_SPACE (sizeof (int) * DAEMON_REQUEST_FDS)] = {};
+  struct cmsghdr *cmsg;
+  struct msghdr msg = {};
+  struct iovec iov;
+  ssize_t ret;
+
+  iov.iov_base = len;
+  iov.iov_len = sizeof (*len);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl_buf;
+  msg.msg_controllen = sizeof (ctrl_buf);
+
+  ret = TEMP_FAILURE_RETRY (recvmsg (fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "recvmsg");
+  if (UNLIKELY (ret != sizeof (*len)))
+    return crun_make_error (err, 0, "short read for the request header");
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN (sizeof (int) * DAEMON_REQUEST_FDS))
+    return crun_make_error (err, 0, "the request must carry %d file descriptors", DAEMON_REQUEST_FDS);
+
+  memcpy (fds, CMSG_DATA (cmsg), sizeof (int) * DAEMON_REQUEST_FDS);
+  return 0;
+}
+
+static int
+read_request_payload (int fd, char *buffer, size_t len, libcrun_error_t *err)
+{
+  size_t done = 0;
+
+  while (done < len)
+    {
+      ssize_t ret = TEMP_FAILURE_RETRY (read (fd, buffer + done, len - done));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "read request");
+      if (UNLIKELY (ret == 0))
+        return crun_make_error (err, 0, "short read for the request");
+      done += ret;
+    }
+  return 0;
+}
+
+/* Run the command line in a new process, with the file descriptors received
+   from the client as its stdio.  The parent state (the cloned binary, the
+   security modules and capabilities setup) is inherited through fork(2).  */
+static int
+run_request (const char *cwd, int argc, char **argv, int *fds, libcrun_error_t *err)
+{
+  int ret, status = 0;
+  pid_t pid;
+  int i;
+
+  pid = fork ();
+  if (UNLIKELY (pid < 0))
+    return crun_make_error (err, errno, "fork");
+
+  if (pid == 0)
+    {
+      for (i = 0; i < DAEMON_REQUEST_FDS; i++)
+        {
+          if (fds[i] == i)
+            {
+              ret = fcntl (i, F_SETFD, 0);
+              if (UNLIKELY (ret < 0))
+                _exit (EXIT_FAILURE);
+              continue;
+            }
+          if (UNLIKELY (dup2 (fds[i], i) < 0))
+            _exit (EXIT_FAILURE);
+        }
+
+      if (UNLIKELY (chdir (cwd) < 0))
+        libcrun_fail_with_error (errno, "chdir to `%s`", cwd);
+
+      exit (crun_command_line (argc, argv));
+    }
+
+  ret = TEMP_FAILURE_RETRY (waitpid (pid, &status, 0));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "waitpid");
+
+  if (WIFSIGNALED (status))
+    return 128 + WTERMSIG (status);
+
+  return WEXITSTATUS (status);
+}
+
+static int
+handle_request (int fd, libcrun_error_t *err)
+{
+  cleanup_free char *payload = NULL;
+  cleanup_free char **argv = NULL;
+  int fds[DAEMON_REQUEST_FDS] = { -1, -1, -1 };
+  const char *cwd;
+  int32_t exit_status;
+  int argc = 0;
+  uint32_t len;
+  size_t i;
+  char *it;
+  int ret;
+
+  ret = read_request_header (fd, &len, fds, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (len == 0 || len > DAEMON_MAX_REQUEST_SIZE)
+    {
+      ret = crun_make_error (err, 0, "invalid request size %u", len);
+      goto exit;
+    }
+
+  payload = xmalloc (len);
+  ret = read_request_payload (fd, payload, len, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
+
+  if (payload[len - 1] != '\0')
+    {
+      ret = crun_make_error (err, 0, "the request is not NUL terminated");
+      goto exit;
+    }
+
+  /* The payload is the working directory followed by the arguments, each of them NUL terminated.  */
+  argv = xmalloc0 (sizeof (char *) * (len + 2));
+  argv[argc++] = "crun";
+  cwd = payload;
+  for (it = payload + strlen (payload) + 1; it < payload + len; it += strlen (it) + 1)
+    argv[argc++] = it;
+
+  ret = run_request (cwd, argc, argv, fds, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
+
+  exit_status = ret;
+  ret = safe_write (fd, &exit_status, sizeof (exit_status));
+  if (UNLIKELY (ret < 0))
+    ret = crun_make_error (err, errno, "write exit status");
+
+exit:
+  for (i = 0; i < DAEMON_REQUEST_FDS; i++)
+    if (fds[i] >= 0)
+      close (fds[i]);
+  return ret;
+}
+
+/* Accept requests only from the user running the daemon, even if the
+   permissions of the socket were changed.  */
+static int
+check_peer (int fd, libcrun_error_t *err)
+{
+  struct ucred cred;
+  socklen_t len = sizeof (cred);
+  int ret;
+
+  ret = getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "getsockopt `SO_PEERCRED`");
+
+  if (cred.uid != geteuid ())
+    return crun_make_error (err, EPERM, "refuse the request from uid %d", (int) cred.uid);
+
+  return 0;
+}
+
+/* Remove the socket left at PATH by a previous instance.  Fail if another
+   daemon is still listening on it.  */
+static int
+remove_stale_socket (const char *path, libcrun_error_t *err)
+{
+  struct sockaddr_un addr = {
+    0,
+  };
+  cleanup_close int fd = -1;
+  struct stat st;
+  int ret;
+
+  if (lstat (path, &st) < 0 || ! S_ISSOCK (st.st_mode))
+    return 0;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    return crun_make_error (err, 0, "socket path `%s` too long", path);
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "socket");
+
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  ret = TEMP_FAILURE_RETRY (connect (fd, (struct sockaddr *) &addr, sizeof (addr)));
+  if (ret == 0)
+    return crun_make_error (err, EADDRINUSE, "another daemon is listening on `%s`", path);
+  if (errno != ECONNREFUSED)
+    return crun_make_error (err, errno, "connect to `%s`", path);
+
+  ret = unlink (path);
+  if (UNLIKELY (ret < 0 && errno != ENOENT))
+    return crun_make_error (err, errno, "unlink `%s`", path);
+
+  return 0;
+}
+
+int
+crun_command_daemon (struct crun_global_arguments *global_args arg_unused, int argc, char **argv, libcrun_error_t *err)
+{
+  int first_arg = 0, ret;
+  cleanup_close int listen_fd = -1;
+  const char *path;
+  mode_t old_umask;
+
+  argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, NULL);
+  crun_assert_n_args (argc - first_arg, 1, 1);
+
+  path = argv[first_arg];
+
+  ret = libcrun_warmup (err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = remove_stale_socket (path, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  /* Create the socket accessible only by the owner, there must be no
+     window where other users can connect to it.  */
+  old_umask = umask (0077);
+  listen_fd = open_unix_domain_socket (path, 0, err);
+  umask (old_umask);
+  if (UNLIKELY (listen_fd < 0))
+    return listen_fd;
+
+  ret = listen (listen_fd, SOMAXCONN);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "listen on socket");
+
+  /* The processes serving the requests are not waited for.  */
+  signal (SIGCHLD, SIG_IGN);
+
+  for (;;)
+    {
+      cleanup_close int conn = -1;
+      pid_t pid;
+
+      conn = TEMP_FAILURE_RETRY (accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC));
+      if (UNLIKELY (conn < 0))
+        return crun_make_error (err, errno, "accept");
+
+      ret = check_peer (conn, err);
+      if (UNLIKELY (ret < 0))
+        {
+          libcrun_error_write_warning_and_release (stderr, &err);
+          continue;
+        }
+
+      pid = fork ();
+      if (UNLIKELY (pid < 0))
+        {
+          crun_make_error (err, errno, "fork");
+          libcrun_error_write_warning_and_release (stderr, &err);
+          continue;
+        }
+
+      if (pid == 0)
+        {
+          close (listen_fd);
+          signal (SIGCHLD, SIG_DFL);
+
+          ret = handle_request (conn, err);
+          if (UNLIKELY (ret < 0))
+            {
+              libcrun_error_write_warning_and_release (stderr, &err);
+              _exit (EXIT_FAILURE);
+            }
+          _exit (EXIT_SUCCESS);
+        }
+    }
+
+  return 0;
+}
@@ -56,7 +56,7 @@ static struct argp_option options[]
             0,
         } };
 
-static char args_doc[] = "delete CONTAINER";
+static char args_doc[] = "delete CONTAINER...";
 
 static error_t
 parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
@@ -93,7 +93,7 @@ crun_command_delete (struct crun_global_arguments *global_args, int argc, char *
   };
 
   argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, &delete_options);
-  crun_assert_n_args (argc - first_arg, 1, 1);
+  crun_assert_n_args (argc - first_arg, 1, delete_options.regex ? 1 : -1);
 
   ret = init_libcrun_context (&crun_context, argv[first_arg], global_args, err);
   if (UNLIKELY (ret < 0))
@@ -103,6 +103,8 @@ crun_command_delete (struct crun_global_arguments *global_args, int argc, char *
     {
       regex_t re;
       libcrun_container_list_t *list, *it;
+      cleanup_free char **ids = NULL;
+      size_t n_ids = 0, allocated = 0;
 
       ret = regcomp (&re, argv[first_arg], REG_EXTENDED | REG_NOSUB);
       if (UNLIKELY (ret < 0))
@@ -115,15 +117,27 @@ crun_command_delete (struct crun_global_arguments *global_args, int argc, char *
       for (it = list; it; it = it->next)
         if (regexec (&re, it->name, 0, NULL, 0) == 0)
           {
-            ret = libcrun_container_delete (&crun_context, NULL, it->name, delete_options.force, err);
-            if (UNLIKELY (ret < 0))
-              libcrun_error_write_warning_and_release (stderr, &err);
+            if (n_ids == allocated)
+              {
+                allocated = allocated ? allocated * 2 : 16;
+                ids = xrealloc (ids, allocated * sizeof (*ids));
+              }
+            ids[n_ids++] = it->name;
           }
 
+      /* An error was already reported for each container.  */
+      ret = libcrun_container_delete_many (&crun_context, ids, n_ids, delete_options.force, err);
+      if (UNLIKELY (ret < 0))
+        crun_error_release (err);
+
       libcrun_free_containers_list (list);
       regfree (&re);
       return 0;
     }
 
+  if (argc - first_arg > 1)
+    return libcrun_container_delete_many (&crun_context, argv + first_arg, argc - first_arg, delete_options.force,
+                                          err);
+
   return libcrun_container_delete (&crun_context, NULL, argv[first_arg], delete_options.force, err);
 }
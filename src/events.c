@@ -0,0 +1,303 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2017, 2018, 2019 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <argp.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include "crun.h"
+#include "libcrun/container.h"
+#include "libcrun/utils.h"
+#include "libcrun/cgroup.h"
+#include "libcrun/status.h"
+
+static char doc[] = "OCI runtime";
+
+enum
+{
+  OPTION_STATS = 1000,
+  OPTION_INTERVAL,
+};
+
+struct events_options_s
+{
+  bool stats;
+  unsigned long interval;
+};
+
+static struct events_options_s events_options;
+
+static struct argp_option options[]
+    = { { "stats", OPTION_STATS, 0, 0, "print the resource usage of the containers once and exit", 0 },
+        { "interval", OPTION_INTERVAL, "SECONDS", 0, "interval between the stats (default 5)", 0 },
+        {
+            0,
+        } };
+
+static char args_doc[] = "events CONTAINER [CONTAINER...]";
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  char *endptr;
+
+  switch (key)
+    {
+    case ARGP_KEY_NO_ARGS:
+      libcrun_fail_with_error (0, "please specify a ID for the container");
+
+    case OPTION_STATS:
+      events_options.stats = true;
+      break;
+
+    case OPTION_INTERVAL:
+      errno = 0;
+      events_options.interval = strtoul (argp_mandatory_argument (arg, state), &endptr, 10);
+      if (errno != 0 || *endptr != '\0' || events_options.interval == 0)
+        error (EXIT_FAILURE, 0, "invalid interval `%s`", arg);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+
+  return 0;
+}
+
+static struct argp run_argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
+
+struct events_container_s
+{
+  const char *id;
+  libcrun_cgroup_stats_reader_t *reader;
+  libcrun_cgroup_events_t *events;
+};
+
+static void
+events_container_free (struct events_container_s *c)
+{
+  libcrun_cgroup_stats_reader_free (c->reader);
+  libcrun_cgroup_events_free (c->events);
+  free (c);
+}
+
+static void
+print_stats (const char *id, struct libcrun_cgroup_stats_s *stats)
+{
+  printf ("{\"type\":\"stats\",\"id\":\"%s\",\"data\":{"
+          "\"cpu\":{\"usage_usec\":%" PRIu64 ",\"user_usec\":%" PRIu64 ",\"system_usec\":%" PRIu64 "},"
+          "\"memory\":{\"usage\":%" PRIu64 ",\"anon\":%" PRIu64 ",\"file\":%" PRIu64 "},"
+          "\"pids\":{\"current\":%" PRIu64 "},"
+          "\"io\":{\"read_bytes\":%" PRIu64 ",\"write_bytes\":%" PRIu64 "}}}\n",
+          id, stats->cpu_usage_usec, stats->cpu_user_usec, stats->cpu_system_usec, stats->memory_usage,
+          stats->memory_anon, stats->memory_file, stats->pids_current, stats->io_read_bytes, stats->io_write_bytes);
+}
+
+static int
+open_container (libcrun_context_t *crun_context, const char *id, int epollfd, struct events_container_s **out,
+                libcrun_error_t *err)
+{
+  cleanup_container_status libcrun_container_status_t status = {};
+  struct events_container_s *c;
+  struct epoll_event ev;
+  int ret;
+
+  ret = libcrun_read_container_status (&status, crun_context->state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  c = xmalloc0 (sizeof (*c));
+  c->id = id;
+
+  ret = libcrun_cgroup_stats_reader_new (status.cgroup_path, &c->reader, err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  if (epollfd >= 0)
+    {
+      ret = libcrun_is_container_running (&status, err);
+      if (UNLIKELY (ret < 0))
+        goto fail;
+
+      /* Do not follow the PID if it was already reused.  */
+      ret = libcrun_cgroup_events_new (status.cgroup_path, ret ? status.pid : 0, &c->events, err);
+      if (UNLIKELY (ret < 0))
+        goto fail;
+
+      ev.events = EPOLLIN;
+      ev.data.ptr = c;
+      ret = epoll_ctl (epollfd, EPOLL_CTL_ADD, libcrun_cgroup_events_get_fd (c->events), &ev);
+      if (UNLIKELY (ret < 0))
+        {
+          ret = crun_make_error (err, errno, "epoll_ctl");
+          goto fail;
+        }
+    }
+
+  *out = c;
+  return 0;
+
+fail:
+  events_container_free (c);
+  return ret;
+}
+
+static int64_t
+now_ms ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((int64_t) ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Print the stats for all the containers.  The containers that were
+   deleted are not followed anymore.  */
+static int
+print_all_stats (struct events_container_s **containers, size_t *n_containers, libcrun_error_t *err)
+{
+  size_t i = 0;
+  int ret;
+
+  while (i < *n_containers)
+    {
+      struct libcrun_cgroup_stats_s stats;
+
+      ret = libcrun_cgroup_stats_read (containers[i]->reader, &stats, err);
+      if (UNLIKELY (ret < 0))
+        {
+          int errno_ = crun_error_get_errno (err);
+
+          if (events_options.stats || (errno_ != ENOENT && errno_ != ENODEV))
+            return ret;
+
+          crun_error_release (err);
+          events_container_free (containers[i]);
+          containers[i] = containers[--(*n_containers)];
+          continue;
+        }
+
+      print_stats (containers[i]->id, &stats);
+      i++;
+    }
+  return 0;
+}
+
+int
+crun_command_events (struct crun_global_arguments *global_args, int argc, char **argv, libcrun_error_t *err)
+{
+  cleanup_free struct events_container_s **containers = NULL;
+  cleanup_close int epollfd = -1;
+  size_t n_containers = 0;
+  int64_t next_stats;
+  int first_arg;
+  size_t i;
+  int ret;
+  libcrun_context_t crun_context = {
+    0,
+  };
+
+  events_options.interval = 5;
+
+  argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, &events_options);
+  crun_assert_n_args (argc - first_arg, 1, -1);
+
+  ret = init_libcrun_context (&crun_context, argv[first_arg], global_args, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  /* The OOM and exit events are delivered through epoll as they happen,
+     there is no need to poll the state of the containers.  */
+  if (! events_options.stats)
+    {
+      epollfd = epoll_create1 (EPOLL_CLOEXEC);
+      if (UNLIKELY (epollfd < 0))
+        return crun_make_error (err, errno, "epoll_create1");
+    }
+
+  /* The cgroup files are opened only once for each container, and then
+     read again at every interval.  */
+  containers = xmalloc0 (sizeof (*containers) * (argc - first_arg));
+  for (i = first_arg; i < (size_t) argc; i++)
+    {
+      ret = open_container (&crun_context, argv[i], epollfd, &containers[n_containers], err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+      n_containers++;
+    }
+
+  ret = print_all_stats (containers, &n_containers, err);
+  fflush (stdout);
+  if (UNLIKELY (ret < 0) || events_options.stats)
+    goto exit;
+
+  next_stats = now_ms () + events_options.interval * 1000;
+  while (n_containers > 0)
+    {
+      struct epoll_event events[16];
+      int64_t timeout = next_stats - now_ms ();
+      int nr_events;
+
+      nr_events = epoll_wait (epollfd, events, 16, timeout > 0 ? timeout : 0);
+      if (UNLIKELY (nr_events < 0))
+        {
+          if (errno == EINTR)
+            continue;
+          ret = crun_make_error (err, errno, "epoll_wait");
+          goto exit;
+        }
+
+      for (i = 0; i < (size_t) nr_events; i++)
+        {
+          struct events_container_s *c = events[i].data.ptr;
+          int mask;
+
+          ret = libcrun_cgroup_events_read (c->events, &mask, err);
+          if (UNLIKELY (ret < 0))
+            goto exit;
+
+          if (mask & LIBCRUN_CGROUP_EVENT_OOM)
+            printf ("{\"type\":\"oom\",\"id\":\"%s\"}\n", c->id);
+          if (mask & LIBCRUN_CGROUP_EVENT_EXIT)
+            printf ("{\"type\":\"exit\",\"id\":\"%s\"}\n", c->id);
+        }
+
+      if (now_ms () >= next_stats)
+        {
+          ret = print_all_stats (containers, &n_containers, err);
+          if (UNLIKELY (ret < 0))
+            goto exit;
+          next_stats += events_options.interval * 1000;
+        }
+      fflush (stdout);
+    }
+
+  ret = 0;
+
+exit:
+  for (i = 0; i < n_containers; i++)
+    events_container_free (containers[i]);
+  return ret;
+}
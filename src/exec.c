@@ -252,7 +252,7 @@ crun_command_exec (struct crun_global_arguments *global_args, int argc, char **a
       runtime_spec_schema_config_schema_process *process = xmalloc0 (sizeof (*process));
       int i;
 
-      process->args_len = argc;
+      process->args_len = argc - first_arg - 1;
       process->args = xmalloc0 ((argc + 1) * sizeof (*process->args));
       for (i = 0; i < argc - first_arg; i++)
         process->args[i] = xstrdup (argv[first_arg + i + 1]);
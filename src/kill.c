@@ -39,13 +39,15 @@ enum
   OPTION_PID_FILE,
   OPTION_NO_SUBREAPER,
   OPTION_NO_NEW_KEYRING,
-  OPTION_PRESERVE_FDS
+  OPTION_PRESERVE_FDS,
+  OPTION_ALL_CONTAINERS
 };
 
 struct kill_options_s
 {
   bool all;
   bool regex;
+  bool all_containers;
 };
 
 static struct kill_options_s kill_options;
@@ -53,11 +55,12 @@ static struct kill_options_s kill_options;
 static struct argp_option options[]
     = { { "all", 'a', 0, 0, "kill all the processes", 0 },
         { "regex", 'r', 0, 0, "the specified CONTAINER is a regular expression (kill multiple containers)", 0 },
+        { "all-containers", OPTION_ALL_CONTAINERS, 0, 0, "send the signal to all the containers", 0 },
         {
             0,
         } };
 
-static char args_doc[] = "kill CONTAINER [SIGNAL]";
+static char args_doc[] = "kill CONTAINER [SIGNAL]\n--all-containers [SIGNAL]";
 
 static error_t
 parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
@@ -72,7 +75,13 @@ parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
       kill_options.regex = true;
       break;
 
+    case OPTION_ALL_CONTAINERS:
+      kill_options.all_containers = true;
+      break;
+
     case ARGP_KEY_NO_ARGS:
+      if (kill_options.all_containers)
+        break;
       libcrun_fail_with_error (0, "please specify a ID for the container");
 
     default:
@@ -84,6 +93,65 @@ parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
 
 static struct argp run_argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
 
+static int
+parse_signal (const char *arg)
+{
+  int signal;
+
+  if (arg == NULL)
+    return SIGTERM;
+
+  signal = libcrun_str2sig (arg);
+  if (UNLIKELY (signal < 0))
+    libcrun_fail_with_error (0, "unknown signal %s", arg);
+  return signal;
+}
+
+/* Send SIGNAL to all the containers, or only to the ones matching RE when it
+   is not NULL.  The same context is used for all of them.  */
+static void
+kill_containers (libcrun_context_t *crun_context, regex_t *re, int signal, libcrun_error_t *err)
+{
+  libcrun_container_list_t *list, *it;
+  int ret;
+
+  ret = libcrun_get_containers_list (&list, crun_context->state_root, err);
+  if (UNLIKELY (ret < 0))
+    libcrun_fail_with_error (0, "cannot read containers list");
+
+  for (it = list; it; it = it->next)
+    {
+      if (re && regexec (re, it->name, 0, NULL, 0) != 0)
+        continue;
+
+      ret = libcrun_container_kill (crun_context, it->name, signal, err);
+      if (UNLIKELY (ret < 0))
+        libcrun_error_write_warning_and_release (stderr, &err);
+    }
+
+  libcrun_free_containers_list (list);
+}
+
+static int
+kill_all_containers (struct crun_global_arguments *global_args, int argc, char **argv, libcrun_error_t *err)
+{
+  libcrun_context_t crun_context = {
+    0,
+  };
+  int signal, ret;
+
+  crun_assert_n_args (argc, 0, 1);
+
+  ret = init_libcrun_context (&crun_context, NULL, global_args, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  signal = parse_signal (argc > 0 ? argv[0] : NULL);
+
+  kill_containers (&crun_context, NULL, signal, err);
+  return 0;
+}
+
 int
 crun_command_kill (struct crun_global_arguments *global_args, int argc, char **argv, libcrun_error_t *err)
 {
@@ -94,42 +162,27 @@ crun_command_kill (struct crun_global_arguments *global_args, int argc, char **a
   };
 
   argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, &kill_options);
+  if (kill_options.all_containers)
+    return kill_all_containers (global_args, argc - first_arg, argv + first_arg, err);
+
   crun_assert_n_args (argc - first_arg, 1, 2);
 
   ret = init_libcrun_context (&crun_context, argv[first_arg], global_args, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  signal = SIGTERM;
-  if (argc - first_arg > 1)
-    {
-      signal = libcrun_str2sig (argv[first_arg + 1]);
-      if (UNLIKELY (signal < 0))
-        libcrun_fail_with_error (0, "unknown signal %s", argv[first_arg + 1]);
-    }
+  signal = parse_signal (argc - first_arg > 1 ? argv[first_arg + 1] : NULL);
 
   if (kill_options.regex)
     {
       regex_t re;
-      libcrun_container_list_t *list, *it;
 
       ret = regcomp (&re, argv[first_arg], REG_EXTENDED | REG_NOSUB);
       if (UNLIKELY (ret < 0))
         libcrun_fail_with_error (0, "invalid regular expression %s", argv[first_arg]);
 
-      ret = libcrun_get_containers_list (&list, crun_context.state_root, err);
-      if (UNLIKELY (ret < 0))
-        libcrun_fail_with_error (0, "cannot read containers list");
-
-      for (it = list; it; it = it->next)
-        if (regexec (&re, it->name, 0, NULL, 0) == 0)
-          {
-            ret = libcrun_container_kill (&crun_context, it->name, signal, err);
-            if (UNLIKELY (ret < 0))
-              libcrun_error_write_warning_and_release (stderr, &err);
-          }
+      kill_containers (&crun_context, &re, signal, err);
 
-      libcrun_free_containers_list (list);
       regfree (&re);
       return 0;
     }
@@ -37,6 +37,12 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <poll.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
 
 struct symlink_s
 {
@@ -52,6 +58,9 @@ static struct symlink_s cgroup_symlinks[] = { { "cpu", "cpu,cpuacct" },
 
 #define SYSTEMD_PROPERTY_PREFIX "org.systemd.property."
 
+/* How long to wait for the freezer before signalling the processes.  */
+#define KILLALL_FREEZE_TIMEOUT_MS 1000
+
 #ifndef CGROUP2_SUPER_MAGIC
 #  define CGROUP2_SUPER_MAGIC 0x63677270
 #endif
@@ -139,210 +148,299 @@ enum
   CGROUP_IO = 1 << 5,
 };
 
+static const struct
+{
+  const char *name;
+  int value;
+} cgroup_controllers[] = {
+  { "cpu", CGROUP_CPU },     { "io", CGROUP_IO },         { "memory", CGROUP_MEMORY },
+  { "pids", CGROUP_PIDS },   { "cpuset", CGROUP_CPUSET }, { "hugetlb", CGROUP_HUGETLB },
+  { NULL, 0 },
+};
+
+/* Read the list of controllers in the file NAME under DIRFD, either
+   cgroup.controllers or cgroup.subtree_control.  */
 static int
-read_available_controllers (const char *path, libcrun_error_t *err)
+read_controllers_at (int dirfd, const char *path, const char *name, libcrun_error_t *err)
 {
-  cleanup_close int fd;
+  cleanup_close int fd = -1;
   char *saveptr = NULL;
   const char *token;
-  char *controllers;
   int available = 0;
   char buf[256];
   ssize_t ret;
+  size_t i;
 
-  xasprintf (&controllers, "%s/cgroup.controllers", path);
-
-  fd = TEMP_FAILURE_RETRY (open (controllers, O_RDONLY | O_CLOEXEC));
+  fd = TEMP_FAILURE_RETRY (openat (dirfd, name, O_RDONLY | O_CLOEXEC));
   if (UNLIKELY (fd < 0))
-    return crun_make_error (err, errno, "error opening file `%s`", path);
+    return crun_make_error (err, errno, "error opening file `%s/%s`", path, name);
 
   ret = TEMP_FAILURE_RETRY (read (fd, buf, sizeof (buf) - 1));
   if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "error reading from file `%s`", path);
+    return crun_make_error (err, errno, "error reading from file `%s/%s`", path, name);
   buf[ret] = '\0';
 
   for (token = strtok_r (buf, " \n", &saveptr); token; token = strtok_r (NULL, " \n", &saveptr))
-    {
-      if (strcmp (token, "memory") == 0)
-        available |= CGROUP_MEMORY;
-      else if (strcmp (token, "cpu") == 0)
-        available |= CGROUP_CPU;
-      else if (strcmp (token, "cpuset") == 0)
-        available |= CGROUP_CPUSET;
-      else if (strcmp (token, "hugetlb") == 0)
-        available |= CGROUP_HUGETLB;
-      else if (strcmp (token, "pids") == 0)
-        available |= CGROUP_PIDS;
-      else if (strcmp (token, "io") == 0)
-        available |= CGROUP_IO;
-    }
+    for (i = 0; cgroup_controllers[i].name; i++)
+      if (strcmp (token, cgroup_controllers[i].name) == 0)
+        available |= cgroup_controllers[i].value;
+
   return available;
 }
 
 static int
-write_controller_file (const char *path, int controllers_to_enable, libcrun_error_t *err)
+write_controllers (int fd, int controllers, libcrun_error_t *err)
 {
-  cleanup_free char *subtree_control = NULL;
-  cleanup_free char *controllers = NULL;
-  size_t controllers_len = 0;
+  char buf[128];
+  size_t len = 0;
+  size_t i;
   int ret;
 
-  controllers_len = xasprintf (
-      &controllers, "%s %s %s %s %s %s", (controllers_to_enable & CGROUP_CPU) ? "+cpu" : "",
-      (controllers_to_enable & CGROUP_IO) ? "+io" : "", (controllers_to_enable & CGROUP_MEMORY) ? "+memory" : "",
-      (controllers_to_enable & CGROUP_PIDS) ? "+pids" : "", (controllers_to_enable & CGROUP_CPUSET) ? "+cpuset" : "",
-      (controllers_to_enable & CGROUP_HUGETLB) ? "+hugetlb" : "");
+  for (i = 0; cgroup_controllers[i].name; i++)
+    if (controllers & cgroup_controllers[i].value)
+      len += sprintf (buf + len, "%s+%s", len ? " " : "", cgroup_controllers[i].name);
 
-  xasprintf (&subtree_control, "%s/cgroup.subtree_control", path);
-  ret = write_file (subtree_control, controllers, controllers_len, err);
+  ret = TEMP_FAILURE_RETRY (write (fd, buf, len));
   if (UNLIKELY (ret < 0))
-    {
-      char *saveptr = NULL;
-      const char *token;
-      int e;
+    return crun_make_error (err, errno, "write `cgroup.subtree_control`");
+  return 0;
+}
 
-      e = crun_error_get_errno (err);
-      if (e != EPERM && e != EACCES && e != EBUSY && e != ENOENT)
-        return ret;
+/* The cgroups where enabling +cpu failed with EINVAL, because of realtime
+   processes.  They are not tried again by the next creates done by this
+   process, e.g. by a batch create.  */
+static char **cpu_einval_paths;
+static size_t cpu_einval_paths_len;
 
-      /* ENOENT can mean both that the file doesn't exist or the controller is not present.  */
-      if (e == ENOENT)
-        {
-          libcrun_error_t tmp_err = NULL;
-          int exists;
+static bool
+is_cpu_einval_path (const char *path)
+{
+  size_t i;
 
-          exists = crun_path_exists (subtree_control, &tmp_err);
-          if (UNLIKELY (exists < 0))
-            {
-              crun_error_release (&tmp_err);
-              return ret;
-            }
-          /* If the file doesn't exist, then return the original ENOENT.  */
-          if (exists == 0)
-            return ret;
-        }
+  for (i = 0; i < cpu_einval_paths_len; i++)
+    if (strcmp (cpu_einval_paths[i], path) == 0)
+      return true;
+  return false;
+}
 
-      crun_error_release (err);
+static void
+add_cpu_einval_path (const char *path)
+{
+  if (is_cpu_einval_path (path))
+    return;
 
-      /* Fallback to write each one individually.  */
-      for (token = strtok_r (controllers, " ", &saveptr); token; token = strtok_r (NULL, " ", &saveptr))
-        {
-          ret = write_file (subtree_control, token, strlen (token), err);
-          if (ret < 0)
-            crun_error_release (err);
-        }
+  cpu_einval_paths = xrealloc (cpu_einval_paths, (cpu_einval_paths_len + 1) * sizeof (char *));
+  cpu_einval_paths[cpu_einval_paths_len++] = xstrdup (path);
+}
+
+/* Enable CONTROLLERS_TO_ENABLE for the children of the cgroup at DIRFD.
+   The controllers already enabled are not written again, as every write
+   to cgroup.subtree_control takes the cgroup lock in the kernel, even if
+   nothing changes.  Returns the controllers that are enabled.  */
+static int
+write_controller_file_at (int dirfd, const char *path, int controllers_to_enable, libcrun_error_t *err)
+{
+  cleanup_close int fd = -1;
+  int enabled, missing;
+  size_t i;
+  int ret;
+
+  enabled = read_controllers_at (dirfd, path, "cgroup.subtree_control", err);
+  if (UNLIKELY (enabled < 0))
+    return enabled;
+
+  missing = controllers_to_enable & ~enabled;
+  if ((missing & CGROUP_CPU) && is_cpu_einval_path (path))
+    {
+      missing &= ~CGROUP_CPU;
+      controllers_to_enable &= ~CGROUP_CPU;
+    }
+  if (missing == 0)
+    return controllers_to_enable;
+
+  fd = TEMP_FAILURE_RETRY (openat (dirfd, "cgroup.subtree_control", O_WRONLY | O_CLOEXEC));
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "error opening file `%s/cgroup.subtree_control`", path);
+
+  ret = write_controllers (fd, missing, err);
+  if (LIKELY (ret == 0))
+    return controllers_to_enable;
+
+  switch (crun_error_get_errno (err))
+    {
+    /* Enabling +cpu when there are realtime processes fails with EINVAL.  */
+    case EINVAL:
+      if ((missing & CGROUP_CPU) == 0)
+        return ret;
+      break;
+
+    /* ENOENT means the controller is not present.  */
+    case EPERM:
+    case EACCES:
+    case EBUSY:
+    case ENOENT:
+      break;
 
-      /* Refresh what controllers are available.  */
-      return read_available_controllers (path, err);
+    default:
+      return ret;
     }
+  crun_error_release (err);
+
+  /* Fallback to write each one individually.  */
+  for (i = 0; cgroup_controllers[i].name; i++)
+    if (missing & cgroup_controllers[i].value)
+      {
+        ret = write_controllers (fd, cgroup_controllers[i].value, err);
+        if (ret < 0)
+          {
+            if (cgroup_controllers[i].value == CGROUP_CPU && crun_error_get_errno (err) == EINVAL)
+              add_cpu_einval_path (path);
+            crun_error_release (err);
+          }
+      }
 
-  /* All controllers were enabled successfully.  */
-  return controllers_to_enable;
+  /* Refresh what controllers are enabled.  */
+  ret = read_controllers_at (dirfd, path, "cgroup.subtree_control", err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  return ret & controllers_to_enable;
 }
 
 static int
 enable_controllers (const char *path, libcrun_error_t *err)
 {
+  cleanup_close int dirfd = -1;
   cleanup_free char *tmp_path = NULL;
-  char *it;
+  char *it, *next_slash;
   int ret, controllers_to_enable;
 
-  xasprintf (&tmp_path, "%s/", path);
+  dirfd = open (CGROUP_ROOT, O_DIRECTORY | O_PATH | O_CLOEXEC);
+  if (UNLIKELY (dirfd < 0))
+    return crun_make_error (err, errno, "open `%s`", CGROUP_ROOT);
 
-  ret = read_available_controllers (CGROUP_ROOT, err);
+  ret = read_controllers_at (dirfd, CGROUP_ROOT, "cgroup.controllers", err);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  controllers_to_enable = ret;
-
   /* Enable all possible controllers in the root cgroup.  */
-  ret = write_controller_file (CGROUP_ROOT, controllers_to_enable, err);
-  if (UNLIKELY (ret < 0))
-    {
-      /* Enabling +cpu when there are realtime processes fail with EINVAL.  */
-      if ((controllers_to_enable & CGROUP_CPU) && (crun_error_get_errno (err) == EINVAL))
-        {
-          crun_error_release (err);
-          controllers_to_enable &= ~CGROUP_CPU;
-          ret = write_controller_file (CGROUP_ROOT, controllers_to_enable, err);
-        }
-      if (UNLIKELY (ret < 0))
-        return ret;
-    }
+  controllers_to_enable = write_controller_file_at (dirfd, CGROUP_ROOT, ret, err);
+  if (UNLIKELY (controllers_to_enable < 0))
+    return controllers_to_enable;
 
-  for (it = strchr (tmp_path + 1, '/'); it;)
+  tmp_path = xstrdup (path);
+
+  /* Create each level of the path, and enable the controllers for all of them
+     but the last one, using each directory fd to reach the next level.  */
+  for (it = tmp_path; it; it = next_slash)
     {
-      cleanup_free char *cgroup_path = NULL;
-      char *next_slash = strchr (it + 1, '/');
+      int nfd;
 
-      *it = '\0';
+      while (*it == '/')
+        it++;
+      if (*it == '\0')
+        break;
 
-      ret = append_paths (&cgroup_path, err, CGROUP_ROOT, tmp_path, NULL);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      next_slash = strchr (it, '/');
+      if (next_slash)
+        *next_slash = '\0';
 
-      ret = mkdir (cgroup_path, 0755);
+      ret = mkdirat (dirfd, it, 0755);
       if (UNLIKELY (ret < 0 && errno != EEXIST))
-        return crun_make_error (err, errno, "create `%s`", cgroup_path);
+        return crun_make_error (err, errno, "create `%s/%s`", CGROUP_ROOT, tmp_path);
+
+      nfd = openat (dirfd, it, O_DIRECTORY | O_PATH | O_CLOEXEC);
+      if (UNLIKELY (nfd < 0))
+        return crun_make_error (err, errno, "open `%s/%s`", CGROUP_ROOT, tmp_path);
+      close_and_reset (&dirfd);
+      dirfd = nfd;
 
       if (next_slash)
         {
-          ret = write_controller_file (cgroup_path, controllers_to_enable, err);
-          if (UNLIKELY (ret < 0))
-            return ret;
+          char *rest = next_slash + 1;
+
+          /* Skip the separators, to know if there are other levels.  */
+          while (*rest == '/')
+            rest++;
+          if (*rest)
+            {
+              ret = write_controller_file_at (dirfd, tmp_path, controllers_to_enable, err);
+              if (UNLIKELY (ret < 0))
+                return ret;
+              controllers_to_enable = ret;
+            }
+
+          *next_slash = '/';
+          next_slash = rest;
         }
+    }
+  return 0;
+}
+
+/* Read the cpuset file open at FD in *VALUE, that is left to NULL if the
+   file is empty.  There is no fixed limit on the length, as the list of
+   CPUs can be long on big machines.  */
+static int
+read_cpuset_value (int fd, const char *name, char **value, libcrun_error_t *err)
+{
+  cleanup_free char *buffer = NULL;
+  size_t len = 0;
+  int ret;
+
+  ret = read_all_fd (fd, name, &buffer, &len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  while (len > 0 && buffer[len - 1] == '\n')
+    buffer[--len] = '\0';
 
-      *it = '/';
-      it = next_slash;
+  if (len > 0)
+    {
+      *value = buffer;
+      buffer = NULL;
     }
   return 0;
 }
 
 static int
-initialize_cpuset_subsystem_rec (char *path, size_t path_len, char *cpus, char *mems, libcrun_error_t *err)
+initialize_cpuset_subsystem_rec (char *path, size_t path_len, char **cpus, char **mems, libcrun_error_t *err)
 {
   cleanup_close int dirfd = -1;
   cleanup_close int mems_fd = -1;
   cleanup_close int cpus_fd = -1;
   int b_len;
+  int ret;
 
-  dirfd = open (path, O_DIRECTORY | O_RDONLY);
+  dirfd = open (path, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
   if (UNLIKELY (dirfd < 0))
     return crun_make_error (err, errno, "open `%s`", path);
 
-  if (cpus[0] == '\0')
+  if (*cpus == NULL)
     {
-      cpus_fd = openat (dirfd, "cpuset.cpus", O_RDWR);
+      cpus_fd = openat (dirfd, "cpuset.cpus", O_RDWR | O_CLOEXEC);
       if (UNLIKELY (cpus_fd < 0))
         return crun_make_error (err, errno, "open '%s/%s'", path, "cpuset.cpus");
 
-      b_len = TEMP_FAILURE_RETRY (read (cpus_fd, cpus, 256));
-      if (UNLIKELY (b_len < 0))
-        return crun_make_error (err, errno, "read from 'cpuset.cpus'");
-      cpus[b_len] = '\0';
-      if (cpus[0] == '\n')
-        cpus[0] = '\0';
+      ret = read_cpuset_value (cpus_fd, "cpuset.cpus", cpus, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
     }
 
-  if (mems[0] == '\0')
+  if (*mems == NULL)
     {
-      mems_fd = openat (dirfd, "cpuset.mems", O_RDWR);
+      mems_fd = openat (dirfd, "cpuset.mems", O_RDWR | O_CLOEXEC);
       if (UNLIKELY (mems_fd < 0))
         return crun_make_error (err, errno, "open '%s/%s'", path, "cpuset.mems");
 
-      b_len = TEMP_FAILURE_RETRY (read (mems_fd, mems, 256));
-      if (UNLIKELY (b_len < 0))
-        return crun_make_error (err, errno, "read from 'cpuset.mems'");
-      mems[b_len] = '\0';
-      if (mems[0] == '\n')
-        mems[0] = '\0';
+      ret = read_cpuset_value (mems_fd, "cpuset.mems", mems, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
     }
 
-  /* look up in the parent directory.  */
-  if (cpus[0] == '\0' || mems[0] == '\0')
+  /* The walk stops at the first ancestor that is already initialized,
+     usually the slice set up by a previous container.  */
+  if (*cpus == NULL || *mems == NULL)
     {
       size_t parent_path_len;
-      int ret;
 
       for (parent_path_len = path_len - 1; parent_path_len > 1 && path[parent_path_len] != '/'; parent_path_len--)
         ;
@@ -359,16 +457,17 @@ initialize_cpuset_subsystem_rec (char *path, size_t path_len, char *cpus, char *
         }
     }
 
-  if (cpus_fd >= 0)
+  /* Only the values that were missing at this level are written.  */
+  if (cpus_fd >= 0 && *cpus)
     {
-      b_len = TEMP_FAILURE_RETRY (write (cpus_fd, cpus, strlen (cpus)));
+      b_len = TEMP_FAILURE_RETRY (write (cpus_fd, *cpus, strlen (*cpus)));
       if (UNLIKELY (b_len < 0))
         return crun_make_error (err, errno, "write 'cpuset.cpus'");
     }
 
-  if (mems_fd >= 0)
+  if (mems_fd >= 0 && *mems)
     {
-      b_len = TEMP_FAILURE_RETRY (write (mems_fd, mems, strlen (mems)));
+      b_len = TEMP_FAILURE_RETRY (write (mems_fd, *mems, strlen (*mems)));
       if (UNLIKELY (b_len < 0))
         return crun_make_error (err, errno, "write 'cpuset.mems'");
     }
@@ -433,13 +532,54 @@ check_cgroup_v2_controller_available_wrapper (int ret, int cgroup_dirfd, const c
   return ret;
 }
 
+/* Write DATA to the cgroup file NAME under DIRFD, unless the file already
+   has that value.  Writing a cgroup knob is not free even when the value
+   does not change, e.g. memory.max triggers reclaim and cpuset.cpus
+   rebuilds the scheduler domains, so "crun update" with the same values is
+   mostly reads this way.  Write-only files are always written.  */
+static int
+write_cgroup_file_at (int dirfd, const char *name, const void *data, size_t len, libcrun_error_t *err)
+{
+  cleanup_close int fd = -1;
+  char current[256];
+  ssize_t current_len;
+  int ret;
+
+  fd = openat (dirfd, name, O_RDWR | O_CLOEXEC);
+  if (UNLIKELY (fd < 0))
+    return write_file_at (dirfd, name, data, len, err);
+
+  current_len = TEMP_FAILURE_RETRY (read (fd, current, sizeof (current)));
+  if (current_len > 0 && (size_t) current_len < sizeof (current))
+    {
+      size_t data_len = len;
+
+      if (current[current_len - 1] == '\n')
+        current_len--;
+      if (data_len > 0 && ((const char *) data)[data_len - 1] == '\n')
+        data_len--;
+
+      if (data_len > 0 && (size_t) current_len == data_len && memcmp (current, data, data_len) == 0)
+        return len;
+    }
+
+  if (len == 0)
+    return 0;
+
+  ret = TEMP_FAILURE_RETRY (write (fd, data, len));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "writing file `%s`", name);
+
+  return ret;
+}
+
 static int
 write_file_and_check_controllers_at (bool cgroup2, int dirfd, const char *name, const void *data, size_t len,
                                      libcrun_error_t *err)
 {
   int ret;
 
-  ret = write_file_at (dirfd, name, data, len, err);
+  ret = write_cgroup_file_at (dirfd, name, data, len, err);
   if (cgroup2)
     return check_cgroup_v2_controller_available_wrapper (ret, dirfd, name, err);
   return ret;
@@ -449,11 +589,10 @@ static int
 initialize_cpuset_subsystem (const char *path, libcrun_error_t *err)
 {
   cleanup_free char *tmp_path = xstrdup (path);
-  char cpus_buf[257];
-  char mems_buf[257];
+  cleanup_free char *cpus = NULL;
+  cleanup_free char *mems = NULL;
 
-  cpus_buf[0] = mems_buf[0] = '\0';
-  return initialize_cpuset_subsystem_rec (tmp_path, strlen (tmp_path), cpus_buf, mems_buf, err);
+  return initialize_cpuset_subsystem_rec (tmp_path, strlen (tmp_path), &cpus, &mems, err);
 }
 
 static int
@@ -588,35 +727,89 @@ fallback:
   *gid = st.st_gid;
   return ret;
 }
+/* The files listed in /sys/kernel/cgroup/delegate, read once for the
+   process and stored as a sequence of NUL terminated names followed by an
+   empty name.  NULL if the kernel does not provide the list.  */
+static char *delegate_files;
+static bool delegate_files_loaded;
+
+static int
+get_delegate_files (const char **files, libcrun_error_t *err)
+{
+  cleanup_free char *content = NULL;
+  size_t size, i;
+  int ret;
+
+  if (delegate_files_loaded)
+    {
+      *files = delegate_files;
+      return 0;
+    }
+
+  ret = read_all_file ("/sys/kernel/cgroup/delegate", &content, &size, err);
+  if (UNLIKELY (ret < 0))
+    {
+      if (crun_error_get_errno (err) != ENOENT)
+        return ret;
+      crun_error_release (err);
+    }
+  else
+    {
+      size_t len = 0;
+
+      /* Skip empty lines, an empty name ends the list.  */
+      delegate_files = xmalloc (size + 2);
+      for (i = 0; i < size; i++)
+        {
+          if (content[i] != '\n')
+            delegate_files[len++] = content[i];
+          else if (len > 0 && delegate_files[len - 1] != '\0')
+            delegate_files[len++] = '\0';
+        }
+      if (len > 0 && delegate_files[len - 1] != '\0')
+        delegate_files[len++] = '\0';
+      delegate_files[len] = '\0';
+    }
+
+  delegate_files_loaded = true;
+  *files = delegate_files;
+  return 0;
+}
+
 static int
 chown_cgroups (const char *path, uid_t uid, gid_t gid, libcrun_error_t *err)
 {
   cleanup_free char *cgroup_path = NULL;
-  cleanup_free char *delegate = NULL;
   cleanup_close int dfd = -1;
-  size_t delegate_size;
-  char *saveptr = NULL;
-  char *name;
+  const char *files = NULL;
+  const char *name;
+  struct stat st;
   int ret;
 
+  ret = get_delegate_files (&files, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  if (files == NULL)
+    return 0;
+
   ret = append_paths (&cgroup_path, err, CGROUP_ROOT, path, NULL);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  dfd = open (cgroup_path, O_PATH);
+  dfd = open (cgroup_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (UNLIKELY (dfd < 0))
+    return crun_make_error (err, errno, "open `%s`", cgroup_path);
 
-  ret = read_all_file ("/sys/kernel/cgroup/delegate", &delegate, &delegate_size, err);
+  /* The files of a cgroup are owned by who created it, so there is nothing
+     to change when it was created by, or already delegated to, the
+     target user.  */
+  ret = fstatat (dfd, "", &st, AT_EMPTY_PATH);
   if (UNLIKELY (ret < 0))
-    {
-      if (crun_error_get_errno (err) == ENOENT)
-        {
-          crun_error_release (err);
-          return 0;
-        }
-      return ret;
-    }
+    return crun_make_error (err, errno, "fstat `%s`", cgroup_path);
+  if ((uid == (uid_t) -1 || st.st_uid == uid) && (gid == (gid_t) -1 || st.st_gid == gid))
+    return 0;
 
-  for (name = strtok_r (delegate, "\n", &saveptr); name; name = strtok_r (NULL, "\n", &saveptr))
+  for (name = files; *name; name += strlen (name) + 1)
     {
       ret = fchownat (dfd, name, uid, gid, AT_SYMLINK_NOFOLLOW);
       if (UNLIKELY (ret < 0))
@@ -683,7 +876,12 @@ read_proc_cgroup (char *content, char **saveptr, char **id, char **controller_li
 {
   char *it;
 
-  it = strtok_r (content, "\n", saveptr);
+  if (content)
+    *saveptr = content;
+
+  do
+    it = consume_line (saveptr);
+  while (it && *it == '\0');
   if (it == NULL)
     return false;
 
@@ -905,6 +1103,50 @@ libcrun_move_process_to_cgroup (pid_t pid, pid_t init_pid, char *path, libcrun_e
   return enter_cgroup (cgroup_mode, pid, init_pid, path, false, err);
 }
 
+/* Open the cgroup v2 directory of the container init process INIT_PID, so
+   that a process joining the container can be created there directly with
+   CLONE_INTO_CGROUP.  *OUT_FD is set to -1 when it is not possible and the
+   process must be moved with libcrun_move_process_to_cgroup.  */
+int
+libcrun_open_init_cgroup (pid_t init_pid, const char *path, int *out_fd, libcrun_error_t *err)
+{
+  cleanup_free char *init_cgroup = NULL;
+  cleanup_free char *cgroup_path = NULL;
+  int cgroup_mode;
+  int ret;
+
+  *out_fd = -1;
+
+  if (path == NULL || *path == '\0' || init_pid <= 0)
+    return 0;
+
+  cgroup_mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (cgroup_mode < 0))
+    return cgroup_mode;
+
+  if (cgroup_mode != CGROUP_MODE_UNIFIED)
+    return 0;
+
+  ret = read_unified_cgroup_pid (init_pid, &init_cgroup, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  /* Make sure the cgroup is below the initial cgroup specified for the container.  */
+  if (strncmp (path, init_cgroup, strlen (path)))
+    return 0;
+
+  ret = append_paths (&cgroup_path, err, CGROUP_ROOT, init_cgroup, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = open (cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "open `%s`", cgroup_path);
+
+  *out_fd = ret;
+  return 0;
+}
+
 #ifdef HAVE_SYSTEMD
 
 static void
@@ -1101,41 +1343,76 @@ systemd_finalize (struct libcrun_cgroup_args *args, libcrun_error_t *err)
   return 0;
 }
 
+/* Tracks the jobs submitted to systemd.  Several jobs can be pending at the
+   same time, so that the requests are sent back-to-back and only the
+   completions are waited for.  This is used by destroy_systemd_cgroup_scopes()
+   when several containers are deleted together; a scope is always created
+   with a single job, see enter_systemd_cgroup_scope().  */
 struct systemd_job_removed_s
 {
-  const char *path;
+  char **paths;
+  size_t len;
+  size_t terminated;
   const char *op;
-  int terminated;
   libcrun_error_t err;
 };
 
+static void
+systemd_job_removed_free (struct systemd_job_removed_s *data)
+{
+  size_t i;
+
+  for (i = 0; i < data->len; i++)
+    free (data->paths[i]);
+  free (data->paths);
+  data->paths = NULL;
+  data->len = 0;
+  crun_error_release (&data->err);
+}
+
+static void
+systemd_job_add (struct systemd_job_removed_s *data, const char *path)
+{
+  data->paths = xrealloc (data->paths, sizeof (char *) * (data->len + 1));
+  data->paths[data->len++] = xstrdup (path);
+}
+
 static int
 systemd_job_removed (sd_bus_message *m, void *userdata, sd_bus_error *error arg_unused)
 {
   const char *path, *unit, *result;
   uint32_t id;
   int ret;
+  size_t i;
   struct systemd_job_removed_s *d = userdata;
 
   ret = sd_bus_message_read (m, "uoss", &id, &path, &unit, &result);
   if (ret < 0)
     return -1;
 
-  if (strcmp (d->path, path) == 0)
+  for (i = 0; i < d->len; i++)
     {
-      d->terminated = 1;
-      if (strcmp (result, "done") != 0)
+      if (d->paths[i] == NULL || strcmp (d->paths[i], path) != 0)
+        continue;
+
+      free (d->paths[i]);
+      d->paths[i] = NULL;
+      d->terminated++;
+      if (strcmp (result, "done") != 0 && d->err == NULL)
         crun_make_error (&d->err, 0, "error %s systemd unit `%s`: got `%s`", d->op, unit, result);
+      break;
     }
   return 0;
 }
 
 static int
-systemd_check_job_status_setup (sd_bus *bus, struct systemd_job_removed_s *data, libcrun_error_t *err)
+systemd_check_job_status_setup (sd_bus *bus, struct systemd_job_removed_s *data, sd_bus_slot **slot,
+                                libcrun_error_t *err)
 {
   int ret;
 
-  ret = sd_bus_match_signal_async (bus, NULL, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+  /* The bus is shared, so the match must go away together with DATA.  */
+  ret = sd_bus_match_signal_async (bus, slot, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
                                    "org.freedesktop.systemd1.Manager", "JobRemoved", systemd_job_removed, NULL, data);
   if (UNLIKELY (ret < 0))
     return crun_make_error (err, -ret, "sd-bus match signal");
@@ -1143,15 +1420,14 @@ systemd_check_job_status_setup (sd_bus *bus, struct systemd_job_removed_s *data,
   return 0;
 }
 
+/* Wait for all the jobs tracked by DATA.  */
 static int
-systemd_check_job_status (sd_bus *bus, struct systemd_job_removed_s *data, const char *path, const char *op,
-                          libcrun_error_t *err)
+systemd_check_job_status (sd_bus *bus, struct systemd_job_removed_s *data, const char *op, libcrun_error_t *err)
 {
   int sd_err;
 
-  data->path = path;
   data->op = op;
-  while (! data->terminated)
+  while (data->terminated < data->len)
     {
       sd_err = sd_bus_process (bus, NULL);
       if (UNLIKELY (sd_err < 0))
@@ -1168,6 +1444,7 @@ systemd_check_job_status (sd_bus *bus, struct systemd_job_removed_s *data, const
   if (data->err != NULL)
     {
       *err = data->err;
+      data->err = NULL;
       return -1;
     }
 
@@ -1179,7 +1456,7 @@ parse_sd_array (char *s, char **out, char **next, libcrun_error_t *err)
 {
   char endchr;
   char *it, *dest;
-  bool escaped = false;
+  const char *stops;
 
   *out = NULL;
   *next = NULL;
@@ -1194,36 +1471,49 @@ parse_sd_array (char *s, char **out, char **next, libcrun_error_t *err)
   it = s;
   endchr = *it++;
   *out = dest = it;
+  stops = endchr == '"' ? "\"\\" : "'\\";
 
   while (1)
     {
+      /* Copy at once everything up to the next quote or backslash.  */
+      size_t span = strcspn (it, stops);
+
+      if (dest != it)
+        memmove (dest, it, span);
+      dest += span;
+      it += span;
+
       if (*it == '\0')
         return crun_make_error (err, 0, "invalid string `%s`", s);
-      if (*it == endchr && ! escaped)
+
+      /* The character after a backslash is taken as it is.  */
+      if (*it == '\\')
         {
-          *it++ = '\0';
-          while (isspace (*it))
-            it++;
-          if (*it == ',')
-            {
-              *next = ++it;
-              *dest = '\0';
-              return 0;
-            }
+          if (it[1] == '\0')
+            return crun_make_error (err, 0, "invalid string `%s`", s);
+          *dest++ = it[1];
+          it += 2;
+          continue;
+        }
 
-          if (*it == ']' || *it == '\0')
-            {
-              *dest = '\0';
-              return 0;
-            }
+      /* *IT is the closing quote.  */
+      *it++ = '\0';
+      while (isspace (*it))
+        it++;
+      if (*it == ',')
+        {
+          *next = ++it;
+          *dest = '\0';
+          return 0;
+        }
 
-          return crun_make_error (err, 0, "invalid character found `%c`", *it);
+      if (*it == ']' || *it == '\0')
+        {
+          *dest = '\0';
+          return 0;
         }
 
-      escaped = *it == '\\' ? ! escaped : false;
-      if (! escaped)
-        *dest++ = *it;
-      it++;
+      return crun_make_error (err, 0, "invalid character found `%c`", *it);
     }
 
   return 0;
@@ -1414,11 +1704,24 @@ append_systemd_annotation (sd_bus_message *m, const char *name, size_t name_len,
   return crun_make_error (err, errno, "unknown type for `%s`", name);
 }
 
+/* The connection is kept open for the lifetime of the process, so that multiple
+   operations (e.g. a batch of containers) do not connect again each time.
+   An sd-bus connection cannot be used after fork(2), so a child process
+   opens its own.  */
+static sd_bus *shared_bus;
+static pid_t shared_bus_pid;
+
 static int
 open_sd_bus_connection (sd_bus **bus, libcrun_error_t *err)
 {
   int sd_err;
 
+  if (shared_bus && shared_bus_pid == getpid ())
+    {
+      *bus = sd_bus_ref (shared_bus);
+      return 0;
+    }
+
   sd_err = sd_bus_default_user (bus);
   if (sd_err < 0)
     {
@@ -1426,9 +1729,16 @@ open_sd_bus_connection (sd_bus **bus, libcrun_error_t *err)
       if (sd_err < 0)
         return crun_make_error (err, -sd_err, "cannot open sd-bus");
     }
+
+  shared_bus = sd_bus_ref (*bus);
+  shared_bus_pid = getpid ();
   return 0;
 }
 
+/* Create the scope for PID and wait for the job to complete.  There is no
+   asynchronous mode here: the caller moves on with the container setup right
+   after the scope exists, and it needs the cgroup path to do so, so a batch of
+   creates still waits for each StartTransientUnit job in turn.  */
 static int
 enter_systemd_cgroup_scope (runtime_spec_schema_config_linux_resources *resources, json_map_string_string *annotations,
                             const char *scope, const char *slice, pid_t pid, libcrun_error_t *err)
@@ -1440,6 +1750,7 @@ enter_systemd_cgroup_scope (runtime_spec_schema_config_linux_resources *resource
   sd_bus_error error = SD_BUS_ERROR_NULL;
   const char *object;
   struct systemd_job_removed_s job_data = {};
+  sd_bus_slot *slot = NULL;
   int i;
   const char *boolean_opts[10];
 
@@ -1462,7 +1773,7 @@ enter_systemd_cgroup_scope (runtime_spec_schema_config_linux_resources *resource
   if (UNLIKELY (ret < 0))
     goto exit;
 
-  ret = systemd_check_job_status_setup (bus, &job_data, err);
+  ret = systemd_check_job_status_setup (bus, &job_data, &slot, err);
   if (UNLIKELY (ret < 0))
     goto exit;
 
@@ -1576,9 +1887,14 @@ enter_systemd_cgroup_scope (runtime_spec_schema_config_linux_resources *resource
       goto exit;
     }
 
-  ret = systemd_check_job_status (bus, &job_data, object, "creating", err);
+  systemd_job_add (&job_data, object);
+
+  ret = systemd_check_job_status (bus, &job_data, "creating", err);
 
 exit:
+  if (slot)
+    sd_bus_slot_unref (slot);
+  systemd_job_removed_free (&job_data);
   if (bus)
     sd_bus_unref (bus);
   if (m)
@@ -1589,8 +1905,10 @@ exit:
   return ret;
 }
 
+/* Stop all the SCOPES_LEN units in SCOPES.  All the requests are sent before
+   waiting for any of them, so that systemd can process them together.  */
 static int
-destroy_systemd_cgroup_scope (const char *scope, libcrun_error_t *err)
+destroy_systemd_cgroup_scopes (const char **scopes, size_t scopes_len, libcrun_error_t *err)
 {
   sd_bus *bus = NULL;
   sd_bus_message *m = NULL;
@@ -1599,47 +1917,60 @@ destroy_systemd_cgroup_scope (const char *scope, libcrun_error_t *err)
   sd_bus_error error = SD_BUS_ERROR_NULL;
   const char *object;
   struct systemd_job_removed_s job_data = {};
+  sd_bus_slot *slot = NULL;
+  size_t i;
 
   ret = open_sd_bus_connection (&bus, err);
   if (UNLIKELY (ret < 0))
     goto exit;
 
-  ret = systemd_check_job_status_setup (bus, &job_data, err);
+  ret = systemd_check_job_status_setup (bus, &job_data, &slot, err);
   if (UNLIKELY (ret < 0))
     goto exit;
 
-  ret = sd_bus_message_new_method_call (bus, &m, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
-                                        "org.freedesktop.systemd1.Manager", "StopUnit");
-  if (UNLIKELY (ret < 0))
+  for (i = 0; i < scopes_len; i++)
     {
-      ret = crun_make_error (err, -ret, "set up dbus message");
-      goto exit;
-    }
-
-  ret = sd_bus_message_append (m, "ss", scope, "replace");
-  if (UNLIKELY (ret < 0))
-    {
-      ret = crun_make_error (err, -ret, "sd-bus message append");
-      goto exit;
-    }
+      ret = sd_bus_message_new_method_call (bus, &m, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+                                            "org.freedesktop.systemd1.Manager", "StopUnit");
+      if (UNLIKELY (ret < 0))
+        {
+          ret = crun_make_error (err, -ret, "set up dbus message");
+          goto exit;
+        }
 
-  ret = sd_bus_call (bus, m, 0, &error, &reply);
-  if (UNLIKELY (ret < 0))
-    {
-      ret = crun_make_error (err, sd_bus_error_get_errno (&error), "sd-bus call");
-      goto exit;
-    }
+      ret = sd_bus_message_append (m, "ss", scopes[i], "replace");
+      if (UNLIKELY (ret < 0))
+        {
+          ret = crun_make_error (err, -ret, "sd-bus message append");
+          goto exit;
+        }
 
-  ret = sd_bus_message_read (reply, "o", &object);
-  if (UNLIKELY (ret < 0))
-    {
-      ret = crun_make_error (err, -ret, "sd-bus message read");
-      goto exit;
+      ret = sd_bus_call (bus, m, 0, &error, &reply);
+      if (UNLIKELY (ret < 0))
+        {
+          ret = crun_make_error (err, sd_bus_error_get_errno (&error), "sd-bus call");
+          goto exit;
+        }
+
+      ret = sd_bus_message_read (reply, "o", &object);
+      if (UNLIKELY (ret < 0))
+        {
+          ret = crun_make_error (err, -ret, "sd-bus message read");
+          goto exit;
+        }
+
+      systemd_job_add (&job_data, object);
+
+      m = sd_bus_message_unref (m);
+      reply = sd_bus_message_unref (reply);
     }
 
-  ret = systemd_check_job_status (bus, &job_data, object, "removing", err);
+  ret = systemd_check_job_status (bus, &job_data, "removing", err);
 
 exit:
+  if (slot)
+    sd_bus_slot_unref (slot);
+  systemd_job_removed_free (&job_data);
   if (bus)
     sd_bus_unref (bus);
   if (m)
@@ -1650,6 +1981,12 @@ exit:
   return ret;
 }
 
+static int
+destroy_systemd_cgroup_scope (const char *scope, libcrun_error_t *err)
+{
+  return destroy_systemd_cgroup_scopes (&scope, 1, err);
+}
+
 #endif
 
 static int
@@ -1659,24 +1996,21 @@ libcrun_cgroup_enter_no_manager (struct libcrun_cgroup_args *args, libcrun_error
   return 0;
 }
 
+/* Compute the cgroup path for the container in *PATH, and the cgroup
+   where its process is placed in *PROCESS_TARGET_CGROUP.  */
 static int
-libcrun_cgroup_enter_cgroupfs (struct libcrun_cgroup_args *args, libcrun_error_t *err)
+get_cgroupfs_paths (struct libcrun_cgroup_args *args, char **path, char **process_target_cgroup,
+                    libcrun_error_t *err)
 {
   const char *delegate_cgroup = args->delegate_cgroup;
-  cleanup_free char *target_cgroup_cleanup = NULL;
   const char *cgroup_path = args->cgroup_path;
-  const char *process_target_cgroup = NULL;
-  int cgroup_mode = args->cgroup_mode;
-  const char *id = args->id;
-  char **path = args->path;
-  pid_t pid = args->pid;
   int ret;
 
-  if (cgroup_mode != CGROUP_MODE_UNIFIED && args->delegate_cgroup)
+  if (args->cgroup_mode != CGROUP_MODE_UNIFIED && delegate_cgroup)
     return crun_make_error (err, 0, "delegate-cgroup not supported on cgroup v1");
 
   if (cgroup_path == NULL)
-    xasprintf (path, "/%s", id);
+    xasprintf (path, "/%s", args->id);
   else
     {
       if (cgroup_path[0] == '/')
@@ -1686,15 +2020,115 @@ libcrun_cgroup_enter_cgroupfs (struct libcrun_cgroup_args *args, libcrun_error_t
     }
 
   if (delegate_cgroup == NULL)
-    process_target_cgroup = *path;
-  else
     {
-      ret = append_paths (&target_cgroup_cleanup, err, *path, delegate_cgroup, NULL);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      *process_target_cgroup = xstrdup (*path);
+      return 0;
+    }
+
+  ret = append_paths (process_target_cgroup, err, *path, delegate_cgroup, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return 0;
+}
+
+static int do_cgroup_destroy (const char *path, int mode, libcrun_error_t *err);
+
+/* Create the cgroup for the container before its process exists, so that
+   the process can be created directly there with CLONE_INTO_CGROUP.  It is
+   supported only with cgroupfs on cgroup v2.  *DIRFD is set to -1 if it is
+   not possible, and the process is then moved by libcrun_cgroup_enter.
+   Returns 1 if the cgroup was created, and it must be removed with
+   libcrun_cgroup_preenter_cleanup if the process is not created.  */
+int
+libcrun_cgroup_preenter (struct libcrun_cgroup_args *args, int *dirfd, libcrun_error_t *err)
+{
+  cleanup_free char *process_target_cgroup = NULL;
+  cleanup_free char *container_cgroup = NULL;
+  cleanup_free char *cgroup_path = NULL;
+  cleanup_free char *path = NULL;
+  bool created;
+  int ret;
+
+  *dirfd = -1;
+
+  if (args->cgroup_mode != CGROUP_MODE_UNIFIED || args->manager != CGROUP_MANAGER_CGROUPFS)
+    return 0;
+
+  ret = get_cgroupfs_paths (args, &path, &process_target_cgroup, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-      process_target_cgroup = target_cgroup_cleanup;
+  ret = append_paths (&container_cgroup, err, CGROUP_ROOT, path, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = append_paths (&cgroup_path, err, CGROUP_ROOT, process_target_cgroup, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  /* A cgroup that already exists is not removed on errors.  */
+  created = access (container_cgroup, F_OK) < 0;
+
+  ret = enable_controllers (process_target_cgroup, err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  ret = crun_ensure_directory (cgroup_path, 0755, false, err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  ret = open (cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (UNLIKELY (ret < 0))
+    {
+      ret = crun_make_error (err, errno, "open `%s`", cgroup_path);
+      goto fail;
+    }
+
+  *dirfd = ret;
+  return created ? 1 : 0;
+
+fail:
+  if (created)
+    libcrun_cgroup_preenter_cleanup (args);
+  return ret;
+}
+
+/* Remove the cgroup created by libcrun_cgroup_preenter, when the container
+   process could not be created.  Errors are only reported as warnings.  */
+void
+libcrun_cgroup_preenter_cleanup (struct libcrun_cgroup_args *args)
+{
+  cleanup_free char *process_target_cgroup = NULL;
+  cleanup_free char *path = NULL;
+  libcrun_error_t tmp_err = NULL;
+  int ret;
+
+  ret = get_cgroupfs_paths (args, &path, &process_target_cgroup, &tmp_err);
+  if (LIKELY (ret >= 0))
+    ret = do_cgroup_destroy (path, CGROUP_MODE_UNIFIED, &tmp_err);
+  if (UNLIKELY (ret < 0))
+    {
+      libcrun_warning ("cannot remove the cgroup of the container: %s", tmp_err->msg);
+      crun_error_release (&tmp_err);
     }
+}
+
+static int
+libcrun_cgroup_enter_cgroupfs (struct libcrun_cgroup_args *args, libcrun_error_t *err)
+{
+  cleanup_free char *process_target_cgroup = NULL;
+  int cgroup_mode = args->cgroup_mode;
+  pid_t pid = args->pid;
+  int ret;
+
+  ret = get_cgroupfs_paths (args, args->path, &process_target_cgroup, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  /* Already done by libcrun_cgroup_preenter.  */
+  if (args->process_in_cgroup)
+    return 0;
 
   if (cgroup_mode == CGROUP_MODE_UNIFIED)
     {
@@ -1765,6 +2199,9 @@ must_stop_proc (runtime_spec_schema_config_linux_resources *resources)
   return false;
 }
 
+static int update_cgroup_resources (int cgroup_mode, runtime_spec_schema_config_linux_resources *resources,
+                                    char *path, bool new_cgroup, libcrun_error_t *err);
+
 int
 libcrun_cgroup_enter (struct libcrun_cgroup_args *args, libcrun_error_t *err)
 {
@@ -1835,7 +2272,7 @@ libcrun_cgroup_enter (struct libcrun_cgroup_args *args, libcrun_error_t *err)
         }
 
       if (args->resources)
-        return libcrun_update_cgroup_resources (args->cgroup_mode, args->resources, *path, err);
+        return update_cgroup_resources (args->cgroup_mode, args->resources, *path, true, err);
 
       return 0;
     }
@@ -1942,177 +2379,846 @@ libcrun_cgroup_pause_unpause (const char *cgroup_path, const bool pause, libcrun
   return libcrun_cgroup_pause_unpause_with_mode (cgroup_path, cgroup_mode, pause, err);
 }
 
-static int
-read_pids_cgroup (int dfd, bool recurse, pid_t **pids, size_t *n_pids, size_t *allocated, libcrun_error_t *err)
+struct libcrun_cgroup_freezer_s
 {
-  cleanup_close int clean_dfd = dfd;
-  cleanup_close int tasksfd = -1;
-  cleanup_free char *buffer = NULL;
-  char *saveptr = NULL;
-  size_t n_new_pids;
-  size_t len;
-  char *it;
-  int ret;
+  char *state_path;
+  char *events_path;
+  int notify_fd;
+  bool pause;
+};
 
-  tasksfd = openat (dfd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
-  if (tasksfd < 0)
-    return crun_make_error (err, errno, "open cgroup.procs");
+void
+libcrun_cgroup_freezer_free (libcrun_cgroup_freezer_t *freezer)
+{
+  if (freezer == NULL)
+    return;
 
-  ret = read_all_fd (tasksfd, "cgroup.procs", &buffer, &len, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  if (freezer->notify_fd >= 0)
+    close (freezer->notify_fd);
+  free (freezer->state_path);
+  free (freezer->events_path);
+  free (freezer);
+}
 
-  if (len == 0)
-    return 0;
+/* Request the cgroup PATH to be frozen or thawed, without waiting for the
+   kernel to complete the transition.  On cgroup v2, the fd returned by
+   libcrun_cgroup_freezer_get_fd becomes readable when cgroup.events
+   changes.  On cgroup v1 there is no notification and the state must be
+   polled with libcrun_cgroup_freezer_done.  */
+int
+libcrun_cgroup_freezer_start (const char *path, const bool pause, libcrun_cgroup_freezer_t **out,
+                              libcrun_error_t *err)
+{
+  cleanup_free libcrun_cgroup_freezer_t *freezer = NULL;
+  const char *state;
+  int cgroup_mode;
+  int ret;
 
-  for (n_new_pids = 0, it = buffer; it; it = strchr (it + 1, '\n'))
-    n_new_pids++;
+  if (path == NULL || path[0] == '\0')
+    return crun_make_error (err, 0, "cannot %s the container without a cgroup", pause ? "pause" : "resume");
 
-  if (*allocated < *n_pids + n_new_pids + 1)
-    {
-      *allocated = *n_pids + n_new_pids + 1;
-      *pids = xrealloc (*pids, sizeof (pid_t) * *allocated);
-    }
+  cgroup_mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (cgroup_mode < 0))
+    return cgroup_mode;
+
+  freezer = xmalloc0 (sizeof (*freezer));
+  freezer->notify_fd = -1;
+  freezer->pause = pause;
 
-  for (it = strtok_r (buffer, "\n", &saveptr); it; it = strtok_r (NULL, "\n", &saveptr))
+  if (cgroup_mode == CGROUP_MODE_UNIFIED)
     {
-      pid_t pid = strtoul (it, NULL, 10);
+      state = pause ? "1" : "0";
 
-      if (pid > 0)
-        (*pids)[(*n_pids)++] = pid;
-    }
-  (*pids)[*n_pids] = 0;
+      ret = append_paths (&freezer->state_path, err, CGROUP_ROOT, path, "cgroup.freeze", NULL);
+      if (UNLIKELY (ret < 0))
+        goto fail;
 
-  if (recurse)
-    {
-      cleanup_dir DIR *dir = NULL;
-      struct dirent *de;
+      ret = append_paths (&freezer->events_path, err, CGROUP_ROOT, path, "cgroup.events", NULL);
+      if (UNLIKELY (ret < 0))
+        goto fail;
 
-      dir = fdopendir (dfd);
-      if (UNLIKELY (dir == NULL))
-        return crun_make_error (err, errno, "open cgroup sub-directory");
-      /* Now dir owns the dfd descriptor.  */
-      clean_dfd = -1;
+      /* Watch cgroup.events before writing the new state, so that the
+         notification cannot be missed.  */
+      freezer->notify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+      if (UNLIKELY (freezer->notify_fd < 0))
+        {
+          ret = crun_make_error (err, errno, "inotify_init1");
+          goto fail;
+        }
 
-      for (de = readdir (dir); de; de = readdir (dir))
+      ret = inotify_add_watch (freezer->notify_fd, freezer->events_path, IN_MODIFY);
+      if (UNLIKELY (ret < 0))
         {
-          int nfd;
+          ret = crun_make_error (err, errno, "inotify_add_watch `%s`", freezer->events_path);
+          goto fail;
+        }
+    }
+  else
+    {
+      state = pause ? "FROZEN" : "THAWED";
 
-          if (strcmp (de->d_name, ".") == 0 || strcmp (de->d_name, "..") == 0)
-            continue;
+      ret = append_paths (&freezer->state_path, err, CGROUP_ROOT "/freezer", path, "freezer.state", NULL);
+      if (UNLIKELY (ret < 0))
+        goto fail;
+    }
 
-          if (de->d_type != DT_DIR)
-            continue;
+  ret = write_file (freezer->state_path, state, strlen (state), err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
 
-          nfd = openat (dirfd (dir), de->d_name, O_DIRECTORY | O_CLOEXEC);
-          if (UNLIKELY (nfd < 0))
-            return crun_make_error (err, errno, "open cgroup directory %s", de->d_name);
-          ret = read_pids_cgroup (nfd, recurse, pids, n_pids, allocated, err);
-          if (UNLIKELY (ret < 0))
-            return ret;
-        }
-    }
+  *out = freezer;
+  freezer = NULL;
   return 0;
+
+fail:
+  if (freezer->notify_fd >= 0)
+    close (freezer->notify_fd);
+  free (freezer->state_path);
+  free (freezer->events_path);
+  return ret;
 }
 
 int
-libcrun_cgroup_read_pids (const char *path, bool recurse, pid_t **pids, libcrun_error_t *err)
+libcrun_cgroup_freezer_get_fd (libcrun_cgroup_freezer_t *freezer)
 {
-  cleanup_free char *cgroup_path = NULL;
-  size_t n_pids, allocated;
-  int dirfd;
-  int mode;
-  int ret;
-
-  if (path == NULL || *path == '\0')
-    return 0;
+  return freezer->notify_fd;
+}
 
-  mode = libcrun_get_cgroup_mode (err);
-  if (UNLIKELY (mode < 0))
-    return mode;
+/* Return 1 when the transition requested by libcrun_cgroup_freezer_start
+   is complete, 0 if it is still in progress.  */
+int
+libcrun_cgroup_freezer_done (libcrun_cgroup_freezer_t *freezer, libcrun_error_t *err)
+{
+  cleanup_free char *content = NULL;
+  const char *state;
+  int ret;
 
-  switch (mode)
+  if (freezer->events_path)
     {
-    case CGROUP_MODE_UNIFIED:
-      ret = append_paths (&cgroup_path, err, CGROUP_ROOT, path, NULL);
-      if (UNLIKELY (ret < 0))
-        return ret;
-      break;
+      char buffer[sizeof (struct inotify_event) + NAME_MAX + 1];
+      ssize_t r;
 
-    case CGROUP_MODE_HYBRID:
-    case CGROUP_MODE_LEGACY:
-      ret = append_paths (&cgroup_path, err, CGROUP_ROOT "/memory", path, NULL);
+      /* Drain the pending notifications, the state is read below.  */
+      do
+        r = read (freezer->notify_fd, buffer, sizeof (buffer));
+      while (r > 0 || (r < 0 && errno == EINTR));
+
+      ret = read_all_file (freezer->events_path, &content, NULL, err);
       if (UNLIKELY (ret < 0))
         return ret;
-      break;
 
-    default:
-      return crun_make_error (err, 0, "invalid cgroup mode %d", mode);
+      state = freezer->pause ? "frozen 1" : "frozen 0";
+      return strstr (content, state) != NULL ? 1 : 0;
     }
 
-  dirfd = open (cgroup_path, O_DIRECTORY | O_CLOEXEC);
-  if (dirfd < 0)
-    return crun_make_error (err, errno, "open %s", cgroup_path);
+  ret = read_all_file (freezer->state_path, &content, NULL, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-  n_pids = 0;
-  allocated = 0;
+  state = freezer->pause ? "FROZEN" : "THAWED";
+  if (strstr (content, state))
+    return 1;
+
+  /* The cgroup v1 freezer can get stuck in FREEZING if a task could
+     not be frozen, write the state again to retry.  */
+  ret = write_file (freezer->state_path, state, strlen (state), err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return 0;
+}
+
+static int64_t
+freezer_now_ms ()
+{
+  struct timespec ts;
 
-  return read_pids_cgroup (dirfd, recurse, pids, &n_pids, &allocated, err);
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((int64_t) ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
 }
 
+/* Freeze or thaw all the N_PATHS cgroups in PATHS.  All the transitions
+   are requested first and then waited for together, so the total latency
+   is the one of the slowest cgroup instead of the sum of them.  A negative
+   TIMEOUT_MS waits forever.  */
 int
-libcrun_cgroup_killall_signal (const char *path, int signal, libcrun_error_t *err)
+libcrun_cgroup_pause_unpause_many (const char **paths, size_t n_paths, const bool pause, int timeout_ms,
+                                   libcrun_error_t *err)
 {
-  int ret;
+  cleanup_free libcrun_cgroup_freezer_t **freezers = NULL;
+  cleanup_free struct pollfd *fds = NULL;
+  cleanup_free bool *was_paused = NULL;
+  int64_t deadline = 0;
+  size_t pending = 0;
+  size_t started;
   size_t i;
-  cleanup_free pid_t *pids = NULL;
+  int ret = 0;
 
-  if (path == NULL || *path == '\0')
+  if (n_paths == 0)
     return 0;
 
-  ret = libcrun_cgroup_pause_unpause (path, true, err);
-  if (UNLIKELY (ret < 0))
-    crun_error_release (err);
+  freezers = xmalloc0 (sizeof (*freezers) * n_paths);
+  fds = xmalloc0 (sizeof (*fds) * n_paths);
 
-  ret = libcrun_cgroup_read_pids (path, true, &pids, err);
-  if (UNLIKELY (ret < 0))
+  if (pause)
     {
-      if (crun_error_get_errno (err) != ENOENT)
-        return ret;
+      int cgroup_mode;
 
-      /* If the file doesn't exist then the container was already killed.  */
-      crun_error_release (err);
+      cgroup_mode = libcrun_get_cgroup_mode (err);
+      if (UNLIKELY (cgroup_mode < 0))
+        return cgroup_mode;
+
+      /* Remember the cgroups that are already frozen, they must stay
+         frozen if the pause fails.  */
+      was_paused = xmalloc0 (sizeof (*was_paused) * n_paths);
+      for (i = 0; i < n_paths; i++)
+        {
+          libcrun_error_t tmp_err = NULL;
+
+          if (UNLIKELY (libcrun_cgroup_is_container_paused (paths[i], cgroup_mode, &was_paused[i], &tmp_err) < 0))
+            crun_error_release (&tmp_err);
+        }
     }
 
-  for (i = 0; pids && pids[i]; i++)
+  for (started = 0; started < n_paths; started++)
     {
-      ret = kill (pids[i], signal);
-      if (UNLIKELY (ret < 0 && errno != ESRCH))
-        return crun_make_error (err, errno, "kill process %d", pids[i]);
+      ret = libcrun_cgroup_freezer_start (paths[started], pause, &freezers[started], err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
     }
 
-  ret = libcrun_cgroup_pause_unpause (path, false, err);
-  if (UNLIKELY (ret < 0))
-    crun_error_release (err);
+  if (timeout_ms >= 0)
+    deadline = freezer_now_ms () + timeout_ms;
 
-  return 0;
-}
+  for (;;)
+    {
+      bool need_polling = false;
+      size_t n_fds = 0;
+      int poll_timeout;
+
+      pending = 0;
+      for (i = 0; i < n_paths; i++)
+        {
+          if (freezers[i] == NULL)
+            continue;
+
+          ret = libcrun_cgroup_freezer_done (freezers[i], err);
+          if (UNLIKELY (ret < 0))
+            goto exit;
+          if (ret > 0)
+            {
+              libcrun_cgroup_freezer_free (freezers[i]);
+              freezers[i] = NULL;
+              continue;
+            }
+
+          pending++;
+          if (freezers[i]->notify_fd < 0)
+            need_polling = true;
+          else
+            {
+              fds[n_fds].fd = freezers[i]->notify_fd;
+              fds[n_fds].events = POLLIN;
+              fds[n_fds].revents = 0;
+              n_fds++;
+            }
+        }
+
+      if (pending == 0)
+        break;
+
+      poll_timeout = need_polling ? 10 : -1;
+      if (timeout_ms >= 0)
+        {
+          int64_t left = deadline - freezer_now_ms ();
+
+          if (left <= 0)
+            {
+              ret = crun_make_error (err, ETIMEDOUT, "timeout waiting for %zu cgroup(s) to be %s", pending,
+                                     pause ? "frozen" : "thawed");
+              goto exit;
+            }
+          if (poll_timeout < 0 || left < poll_timeout)
+            poll_timeout = (int) left;
+        }
+
+      ret = poll (fds, n_fds, poll_timeout);
+      if (UNLIKELY (ret < 0 && errno != EINTR))
+        {
+          ret = crun_make_error (err, errno, "poll");
+          goto exit;
+        }
+    }
+
+  ret = 0;
+
+exit:
+  for (i = 0; i < n_paths; i++)
+    libcrun_cgroup_freezer_free (freezers[i]);
+
+  /* Do not leave some of the containers frozen when the pause fails: thaw
+     all the cgroups where the freeze was requested, unless they were
+     already frozen.  The thaw is not waited for.  */
+  if (UNLIKELY (ret < 0) && pause)
+    {
+      for (i = 0; i < started; i++)
+        {
+          libcrun_cgroup_freezer_t *freezer = NULL;
+          libcrun_error_t tmp_err = NULL;
+
+          if (was_paused[i])
+            continue;
+
+          if (UNLIKELY (libcrun_cgroup_freezer_start (paths[i], false, &freezer, &tmp_err) < 0))
+            {
+              libcrun_warning ("cannot thaw the cgroup `%s`: %s", paths[i], tmp_err->msg);
+              crun_error_release (&tmp_err);
+              continue;
+            }
+          libcrun_cgroup_freezer_free (freezer);
+        }
+    }
+  return ret;
+}
 
+static int
+read_pids_cgroup (int dfd, bool recurse, struct crun_read_buffer_s *buffer, pid_t **pids, size_t *n_pids,
+                  size_t *allocated, libcrun_error_t *err)
+{
+  cleanup_close int clean_dfd = dfd;
+  cleanup_close int tasksfd = -1;
+  char *cursor;
+  size_t n_new_pids;
+  size_t len;
+  char *it;
+  int ret;
+
+  tasksfd = openat (dfd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+  if (tasksfd < 0)
+    return crun_make_error (err, errno, "open cgroup.procs");
+
+  ret = read_all_fd_buffer (tasksfd, "cgroup.procs", buffer, &len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (len == 0)
+    return 0;
+
+  n_new_pids = count_chars (buffer->data, len, '\n') + 1;
+
+  if (*allocated < *n_pids + n_new_pids + 1)
+    {
+      *allocated = *allocated * 2;
+      if (*allocated < *n_pids + n_new_pids + 1)
+        *allocated = *n_pids + n_new_pids + 1;
+      *pids = xrealloc (*pids, sizeof (pid_t) * *allocated);
+    }
+
+  cursor = buffer->data;
+  for (it = consume_line (&cursor); it; it = consume_line (&cursor))
+    {
+      uint64_t pid;
+
+      if (parse_uint64 (it, &pid) && pid > 0 && pid <= INT_MAX)
+        (*pids)[(*n_pids)++] = (pid_t) pid;
+    }
+  (*pids)[*n_pids] = 0;
+
+  if (recurse)
+    {
+      cleanup_dir DIR *dir = NULL;
+      struct dirent *de;
+
+      dir = fdopendir (dfd);
+      if (UNLIKELY (dir == NULL))
+        return crun_make_error (err, errno, "open cgroup sub-directory");
+      /* Now dir owns the dfd descriptor.  */
+      clean_dfd = -1;
+
+      for (de = readdir (dir); de; de = readdir (dir))
+        {
+          int nfd;
+
+          if (strcmp (de->d_name, ".") == 0 || strcmp (de->d_name, "..") == 0)
+            continue;
+
+          if (de->d_type != DT_DIR)
+            continue;
+
+          nfd = openat (dirfd (dir), de->d_name, O_DIRECTORY | O_CLOEXEC);
+          if (UNLIKELY (nfd < 0))
+            return crun_make_error (err, errno, "open cgroup directory %s", de->d_name);
+          ret = read_pids_cgroup (nfd, recurse, buffer, pids, n_pids, allocated, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+        }
+    }
+  return 0;
+}
+
+int
+libcrun_cgroup_read_pids (const char *path, bool recurse, pid_t **pids, libcrun_error_t *err)
+{
+  cleanup_read_buffer struct crun_read_buffer_s buffer = {
+    NULL,
+  };
+  cleanup_free char *cgroup_path = NULL;
+  size_t n_pids, allocated;
+  int dirfd;
+  int mode;
+  int ret;
+
+  if (path == NULL || *path == '\0')
+    return 0;
+
+  mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (mode < 0))
+    return mode;
+
+  switch (mode)
+    {
+    case CGROUP_MODE_UNIFIED:
+      ret = append_paths (&cgroup_path, err, CGROUP_ROOT, path, NULL);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      break;
+
+    case CGROUP_MODE_HYBRID:
+    case CGROUP_MODE_LEGACY:
+      ret = append_paths (&cgroup_path, err, CGROUP_ROOT "/memory", path, NULL);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      break;
+
+    default:
+      return crun_make_error (err, 0, "invalid cgroup mode %d", mode);
+    }
+
+  dirfd = open (cgroup_path, O_DIRECTORY | O_CLOEXEC);
+  if (dirfd < 0)
+    return crun_make_error (err, errno, "open %s", cgroup_path);
+
+  n_pids = 0;
+  allocated = 0;
+
+  return read_pids_cgroup (dirfd, recurse, &buffer, pids, &n_pids, &allocated, err);
+}
+
+enum
+{
+  STATS_FILE_CPU = 0,
+  STATS_FILE_CPU_TIMES,
+  STATS_FILE_MEMORY_USAGE,
+  STATS_FILE_MEMORY_STAT,
+  STATS_FILE_PIDS,
+  STATS_FILE_IO,
+  STATS_FILES
+};
+
+struct stats_file_s
+{
+  const char *controller;
+  const char *name;
+};
+
+static const struct stats_file_s stats_files_unified[STATS_FILES] = {
+  [STATS_FILE_CPU] = { "", "cpu.stat" },
+  [STATS_FILE_CPU_TIMES] = { NULL, NULL },
+  [STATS_FILE_MEMORY_USAGE] = { "", "memory.current" },
+  [STATS_FILE_MEMORY_STAT] = { "", "memory.stat" },
+  [STATS_FILE_PIDS] = { "", "pids.current" },
+  [STATS_FILE_IO] = { "", "io.stat" },
+};
+
+static const struct stats_file_s stats_files_legacy[STATS_FILES] = {
+  [STATS_FILE_CPU] = { "cpuacct", "cpuacct.usage" },
+  [STATS_FILE_CPU_TIMES] = { "cpuacct", "cpuacct.stat" },
+  [STATS_FILE_MEMORY_USAGE] = { "memory", "memory.usage_in_bytes" },
+  [STATS_FILE_MEMORY_STAT] = { "memory", "memory.stat" },
+  [STATS_FILE_PIDS] = { "pids", "pids.current" },
+  [STATS_FILE_IO] = { "blkio", "blkio.throttle.io_service_bytes" },
+};
+
+struct libcrun_cgroup_stats_reader_s
+{
+  int cgroup_mode;
+  int fds[STATS_FILES];
+  char *buffer;
+  size_t buffer_size;
+};
+
+void
+libcrun_cgroup_stats_reader_free (libcrun_cgroup_stats_reader_t *reader)
+{
+  size_t i;
+
+  if (reader == NULL)
+    return;
+
+  for (i = 0; i < STATS_FILES; i++)
+    if (reader->fds[i] >= 0)
+      close (reader->fds[i]);
+
+  free (reader->buffer);
+  free (reader);
+}
+
+/* Open the files used by libcrun_cgroup_stats_read once, so that every
+   following read costs only a pread for each file.  The files of the
+   controllers that are not enabled are skipped.  */
+int
+libcrun_cgroup_stats_reader_new (const char *path, libcrun_cgroup_stats_reader_t **out, libcrun_error_t *err)
+{
+  const struct stats_file_s *files;
+  libcrun_cgroup_stats_reader_t *reader;
+  int cgroup_mode;
+  size_t i;
+  int ret;
+
+  if (path == NULL || *path == '\0')
+    return crun_make_error (err, 0, "the container is not using cgroups");
+
+  cgroup_mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (cgroup_mode < 0))
+    return cgroup_mode;
+
+  files = cgroup_mode == CGROUP_MODE_UNIFIED ? stats_files_unified : stats_files_legacy;
+
+  reader = xmalloc0 (sizeof (*reader));
+  reader->cgroup_mode = cgroup_mode;
+  reader->buffer_size = 4096;
+  reader->buffer = xmalloc (reader->buffer_size);
+  for (i = 0; i < STATS_FILES; i++)
+    reader->fds[i] = -1;
+
+  for (i = 0; i < STATS_FILES; i++)
+    {
+      cleanup_free char *file_path = NULL;
+
+      if (files[i].name == NULL)
+        continue;
+
+      ret = append_paths (&file_path, err, CGROUP_ROOT, files[i].controller, path, files[i].name, NULL);
+      if (UNLIKELY (ret < 0))
+        goto fail;
+
+      reader->fds[i] = open (file_path, O_RDONLY | O_CLOEXEC);
+      if (reader->fds[i] < 0)
+        {
+          if (errno == ENOENT)
+            continue;
+
+          ret = crun_make_error (err, errno, "open `%s`", file_path);
+          goto fail;
+        }
+    }
+
+  *out = reader;
+  return 0;
+
+fail:
+  libcrun_cgroup_stats_reader_free (reader);
+  return ret;
+}
+
+/* Read the whole content of the stats file FILE in the reusable buffer.
+   CONTENT is set to NULL if the file is not available.  */
+static int
+read_stats_file (libcrun_cgroup_stats_reader_t *reader, int file, char **content, libcrun_error_t *err)
+{
+  ssize_t r;
+
+  *content = NULL;
+  if (reader->fds[file] < 0)
+    return 0;
+
+  for (;;)
+    {
+      r = TEMP_FAILURE_RETRY (pread (reader->fds[file], reader->buffer, reader->buffer_size - 1, 0));
+      if (UNLIKELY (r < 0))
+        return crun_make_error (err, errno, "read cgroup stats file");
+
+      if ((size_t) r < reader->buffer_size - 1)
+        break;
+
+      reader->buffer_size *= 2;
+      reader->buffer = xrealloc (reader->buffer, reader->buffer_size);
+    }
+
+  reader->buffer[r] = '\0';
+  *content = reader->buffer;
+  return 0;
+}
+
+static int
+read_stats_value (libcrun_cgroup_stats_reader_t *reader, int file, uint64_t *value, libcrun_error_t *err)
+{
+  char *content;
+  int ret;
+
+  ret = read_stats_file (reader, file, &content, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (content)
+    *value = strtoull (content, NULL, 10);
+  return 0;
+}
+
+/* Parse the "KEY VALUE" lines in CONTENT, and store the values only for
+   the keys listed in KEYS.  */
+static void
+parse_stats_keys (char *content, const char **keys, uint64_t **values)
+{
+  char *saveptr = NULL;
+  char *line;
+  size_t i;
+
+  for (line = strtok_r (content, "\n", &saveptr); line; line = strtok_r (NULL, "\n", &saveptr))
+    {
+      char *sep = strchr (line, ' ');
+
+      if (sep == NULL)
+        continue;
+      *sep = '\0';
+
+      for (i = 0; keys[i]; i++)
+        if (strcmp (line, keys[i]) == 0)
+          {
+            *values[i] = strtoull (sep + 1, NULL, 10);
+            break;
+          }
+    }
+}
+
+/* Sum the read and written bytes for all the devices.  */
+static void
+parse_stats_io (char *content, int cgroup_mode, struct libcrun_cgroup_stats_s *stats)
+{
+  char *saveptr = NULL;
+  char *line;
+
+  for (line = strtok_r (content, "\n", &saveptr); line; line = strtok_r (NULL, "\n", &saveptr))
+    {
+      char *saveptr_fields = NULL;
+      char *field;
+
+      /* The first field is always the device.  */
+      field = strtok_r (line, " ", &saveptr_fields);
+      if (field == NULL)
+        continue;
+
+      if (cgroup_mode != CGROUP_MODE_UNIFIED)
+        {
+          /* MAJOR:MINOR OPERATION VALUE  */
+          const char *op = strtok_r (NULL, " ", &saveptr_fields);
+          const char *value = strtok_r (NULL, " ", &saveptr_fields);
+
+          if (op == NULL || value == NULL)
+            continue;
+          if (strcmp (op, "Read") == 0)
+            stats->io_read_bytes += strtoull (value, NULL, 10);
+          else if (strcmp (op, "Write") == 0)
+            stats->io_write_bytes += strtoull (value, NULL, 10);
+          continue;
+        }
+
+      /* MAJOR:MINOR rbytes=VALUE wbytes=VALUE ...  */
+      for (field = strtok_r (NULL, " ", &saveptr_fields); field; field = strtok_r (NULL, " ", &saveptr_fields))
+        {
+          if (has_prefix (field, "rbytes="))
+            stats->io_read_bytes += strtoull (field + 7, NULL, 10);
+          else if (has_prefix (field, "wbytes="))
+            stats->io_write_bytes += strtoull (field + 7, NULL, 10);
+        }
+    }
+}
+
+int
+libcrun_cgroup_stats_read (libcrun_cgroup_stats_reader_t *reader, struct libcrun_cgroup_stats_s *stats,
+                           libcrun_error_t *err)
+{
+  bool unified = reader->cgroup_mode == CGROUP_MODE_UNIFIED;
+  char *content;
+  int ret;
+
+  memset (stats, 0, sizeof (*stats));
+
+  if (unified)
+    {
+      const char *keys[] = { "usage_usec", "user_usec", "system_usec", NULL };
+      uint64_t *values[] = { &stats->cpu_usage_usec, &stats->cpu_user_usec, &stats->cpu_system_usec };
+
+      ret = read_stats_file (reader, STATS_FILE_CPU, &content, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      if (content)
+        parse_stats_keys (content, keys, values);
+    }
+  else
+    {
+      const char *keys[] = { "user", "system", NULL };
+      uint64_t *values[] = { &stats->cpu_user_usec, &stats->cpu_system_usec };
+      long ticks = sysconf (_SC_CLK_TCK);
+
+      ret = read_stats_value (reader, STATS_FILE_CPU, &stats->cpu_usage_usec, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      stats->cpu_usage_usec /= 1000;
+
+      /* cpuacct.stat reports the times in USER_HZ.  */
+      ret = read_stats_file (reader, STATS_FILE_CPU_TIMES, &content, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      if (content && ticks > 0)
+        {
+          parse_stats_keys (content, keys, values);
+          stats->cpu_user_usec = stats->cpu_user_usec * 1000000 / ticks;
+          stats->cpu_system_usec = stats->cpu_system_usec * 1000000 / ticks;
+        }
+    }
+
+  ret = read_stats_value (reader, STATS_FILE_MEMORY_USAGE, &stats->memory_usage, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = read_stats_file (reader, STATS_FILE_MEMORY_STAT, &content, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  if (content)
+    {
+      const char *keys_unified[] = { "anon", "file", NULL };
+      const char *keys_legacy[] = { "rss", "cache", NULL };
+      uint64_t *values[] = { &stats->memory_anon, &stats->memory_file };
+
+      parse_stats_keys (content, unified ? keys_unified : keys_legacy, values);
+    }
+
+  ret = read_stats_value (reader, STATS_FILE_PIDS, &stats->pids_current, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = read_stats_file (reader, STATS_FILE_IO, &content, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  if (content)
+    parse_stats_io (content, reader->cgroup_mode, stats);
+
+  return 0;
+}
+
+/* Kill all the processes in the cgroup with cgroup.kill.  It returns 1 on
+   success and 0 if it is not supported.  */
+static int
+cgroup_kill_file (const char *path, libcrun_error_t *err)
+{
+  cleanup_free char *kill_path = NULL;
+  cleanup_close int fd = -1;
+  int cgroup_mode;
+  int ret;
+
+  cgroup_mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (cgroup_mode < 0))
+    return cgroup_mode;
+
+  if (cgroup_mode != CGROUP_MODE_UNIFIED)
+    return 0;
+
+  ret = append_paths (&kill_path, err, CGROUP_ROOT, path, "cgroup.kill", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  fd = open (kill_path, O_WRONLY | O_CLOEXEC);
+  if (UNLIKELY (fd < 0))
+    {
+      /* Either the kernel has no cgroup.kill or the cgroup is already gone,
+         in both cases let the slow path deal with it.  */
+      if (errno == ENOENT)
+        return 0;
+      return crun_make_error (err, errno, "open `%s`", kill_path);
+    }
+
+  ret = TEMP_FAILURE_RETRY (write (fd, "1", 1));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "write `%s`", kill_path);
+
+  return 1;
+}
+
+int
+libcrun_cgroup_killall_signal (const char *path, int signal, libcrun_error_t *err)
+{
+  int ret;
+  size_t i;
+  cleanup_free pid_t *pids = NULL;
+
+  if (path == NULL || *path == '\0')
+    return 0;
+
+  /* cgroup.kill kills the whole subtree in the kernel, without having to
+     freeze the cgroup and iterate its processes.  */
+  if (signal == SIGKILL)
+    {
+      ret = cgroup_kill_file (path, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      if (ret > 0)
+        return 0;
+    }
+
+  /* Wait for the freezer to settle before reading the PIDs, so that no
+     process can fork while they are signalled.  */
+  ret = libcrun_cgroup_pause_unpause_many (&path, 1, true, KILLALL_FREEZE_TIMEOUT_MS, err);
+  if (UNLIKELY (ret < 0))
+    crun_error_release (err);
+
+  ret = libcrun_cgroup_read_pids (path, true, &pids, err);
+  if (UNLIKELY (ret < 0))
+    {
+      if (crun_error_get_errno (err) != ENOENT)
+        return ret;
+
+      /* If the file doesn't exist then the container was already killed.  */
+      crun_error_release (err);
+    }
+
+  for (i = 0; pids && pids[i]; i++)
+    {
+      ret = kill (pids[i], signal);
+      if (UNLIKELY (ret < 0 && errno != ESRCH))
+        return crun_make_error (err, errno, "kill process %d", pids[i]);
+    }
+
+  ret = libcrun_cgroup_pause_unpause (path, false, err);
+  if (UNLIKELY (ret < 0))
+    crun_error_release (err);
+
+  return 0;
+}
+
+/* Remove all the cgroups under DFD, depth first.  The processes found in
+   the cgroups that cannot be removed are killed.  It takes ownership of
+   DFD.  */
 static int
 rmdir_all_fd (int dfd)
 {
   cleanup_dir DIR *dir = NULL;
   struct dirent *next;
+  bool failed = false;
 
   dir = fdopendir (dfd);
   if (dir == NULL)
-    return -1;
+    {
+      close (dfd);
+      return -1;
+    }
 
   dfd = dirfd (dir);
 
   for (next = readdir (dir); next; next = readdir (dir))
     {
       const char *name = next->d_name;
+      int child_dfd;
       int ret;
 
       if (name[0] == '.' && name[1] == '\0')
@@ -2124,44 +3230,65 @@ rmdir_all_fd (int dfd)
         continue;
 
       ret = unlinkat (dfd, name, AT_REMOVEDIR);
-      if (ret < 0 && errno == EBUSY)
+      if (ret == 0 || errno == ENOENT)
+        continue;
+      if (errno != EBUSY)
         {
-          cleanup_free pid_t *pids = NULL;
-          libcrun_error_t tmp_err = NULL;
-          size_t i, n_pids = 0, allocated = 0;
-          cleanup_close int child_dfd = -1;
-          int child_dfd_clone;
+          failed = true;
+          continue;
+        }
 
-          child_dfd = openat (dfd, name, O_DIRECTORY | O_CLOEXEC);
-          if (child_dfd < 0)
-            return child_dfd;
+      child_dfd = openat (dfd, name, O_DIRECTORY | O_CLOEXEC);
+      if (child_dfd < 0)
+        {
+          if (errno != ENOENT)
+            failed = true;
+          continue;
+        }
 
-          /* read_pids_cgroup takes ownership for the fd, so dup it.  */
-          child_dfd_clone = dup (child_dfd);
-          if (LIKELY (child_dfd_clone >= 0))
-            {
-              ret = read_pids_cgroup (child_dfd_clone, true, &pids, &n_pids, &allocated, &tmp_err);
-              if (UNLIKELY (ret < 0))
-                {
-                  crun_error_release (&tmp_err);
-                  continue;
-                }
-            }
+      {
+        cleanup_read_buffer struct crun_read_buffer_s buffer = {
+          NULL,
+        };
+        cleanup_free pid_t *pids = NULL;
+        libcrun_error_t tmp_err = NULL;
+        size_t i, n_pids = 0, allocated = 0;
+        int child_dfd_clone;
+
+        /* read_pids_cgroup takes ownership for the fd, so dup it.  */
+        child_dfd_clone = dup (child_dfd);
+        if (LIKELY (child_dfd_clone >= 0))
+          {
+            ret = read_pids_cgroup (child_dfd_clone, true, &buffer, &pids, &n_pids, &allocated, &tmp_err);
+            if (UNLIKELY (ret < 0))
+              crun_error_release (&tmp_err);
+          }
 
-          for (i = 0; i < n_pids; i++)
-            kill (pids[i], SIGKILL);
+        for (i = 0; i < n_pids; i++)
+          kill (pids[i], SIGKILL);
+      }
 
-          return rmdir_all_fd (child_dfd);
+      ret = rmdir_all_fd (child_dfd);
+      child_dfd = -1;
+      if (ret < 0)
+        {
+          failed = true;
+          continue;
         }
+
+      ret = unlinkat (dfd, name, AT_REMOVEDIR);
+      if (ret < 0 && errno != ENOENT)
+        failed = true;
     }
-  return 0;
+
+  return failed ? -1 : 0;
 }
 
 static int
 rmdir_all (const char *path)
 {
   int ret;
-  cleanup_close int dfd = open (path, O_DIRECTORY | O_CLOEXEC);
+  int dfd = open (path, O_DIRECTORY | O_CLOEXEC);
   if (UNLIKELY (dfd < 0))
     return dfd;
 
@@ -2172,6 +3299,70 @@ rmdir_all (const char *path)
   return rmdir (path);
 }
 
+/* Wait up to TIMEOUT_MS milliseconds for the cgroup v2 at CGROUP_PATH to
+   have no processes left in its subtree.  The kernel notifies changes to
+   cgroup.events with POLLPRI, so there is no need to poll the directory
+   with rmdir.  It returns 1 if the cgroup is empty or gone, and 0 if it is
+   still populated or the state cannot be read.  */
+static int
+wait_cgroup_empty (const char *cgroup_path, int timeout_ms)
+{
+  cleanup_free char *events_path = NULL;
+  libcrun_error_t tmp_err = NULL;
+  cleanup_close int fd = -1;
+  struct timespec deadline;
+  int ret;
+
+  ret = append_paths (&events_path, &tmp_err, cgroup_path, "cgroup.events", NULL);
+  if (UNLIKELY (ret < 0))
+    {
+      crun_error_release (&tmp_err);
+      return 0;
+    }
+
+  fd = open (events_path, O_RDONLY | O_CLOEXEC);
+  if (UNLIKELY (fd < 0))
+    return errno == ENOENT ? 1 : 0;
+
+  clock_gettime (CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+  for (;;)
+    {
+      struct pollfd pfd = {
+        .fd = fd,
+        .events = POLLPRI,
+      };
+      struct timespec now;
+      char buffer[256];
+      long remaining;
+      ssize_t len;
+
+      len = TEMP_FAILURE_RETRY (pread (fd, buffer, sizeof (buffer) - 1, 0));
+      if (UNLIKELY (len < 0))
+        return errno == ENODEV ? 1 : 0;
+      buffer[len] = '\0';
+
+      if (strstr (buffer, "populated 0") != NULL)
+        return 1;
+
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      remaining = (deadline.tv_sec - now.tv_sec) * 1000L + (deadline.tv_nsec - now.tv_nsec) / 1000000L;
+      if (remaining <= 0)
+        return 0;
+
+      ret = poll (&pfd, 1, (int) remaining);
+      if (UNLIKELY (ret < 0 && errno != EINTR))
+        return 0;
+    }
+}
+
 int
 libcrun_cgroup_killall (const char *path, libcrun_error_t *err)
 {
@@ -2198,6 +3389,10 @@ do_cgroup_destroy (const char *path, int mode, libcrun_error_t *err)
           ret = rmdir (cgroup_path);
           if (ret < 0 && errno == EBUSY)
             {
+              /* The processes were already killed, wait for them to be gone
+                 before removing the whole tree in one pass.  */
+              wait_cgroup_empty (cgroup_path, 1000);
+
               ret = rmdir_all (cgroup_path);
               if (ret < 0)
                 repeat = true;
@@ -2258,11 +3453,83 @@ do_cgroup_destroy (const char *path, int mode, libcrun_error_t *err)
 
           nanosleep (&req, NULL);
 
-          ret = libcrun_cgroup_killall (path, err);
+          ret = libcrun_cgroup_killall (path, err);
+          if (UNLIKELY (ret < 0))
+            crun_error_release (err);
+        }
+  } while (repeat);
+
+  return 0;
+}
+
+/* Destroy the N cgroups at PATHS, SCOPES and MANAGERS are the systemd
+   scope and the cgroup manager of each of them.  The processes in all the
+   cgroups are killed first, and the systemd scopes are stopped together,
+   so that the destroys do not wait one for the other.  */
+int
+libcrun_cgroup_destroy_many (const char **paths, const char **scopes, const int *managers, size_t n,
+                             libcrun_error_t *err)
+{
+  size_t i;
+  int ret;
+  int mode;
+
+  mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (mode < 0))
+    return mode;
+
+  for (i = 0; i < n; i++)
+    {
+      if (paths[i] == NULL || paths[i][0] == '\0')
+        continue;
+
+      ret = libcrun_cgroup_killall (paths[i], err);
+      if (UNLIKELY (ret < 0))
+        crun_error_release (err);
+    }
+
+#ifdef HAVE_SYSTEMD
+  {
+    cleanup_free const char **systemd_scopes = xmalloc0 (sizeof (char *) * (n + 1));
+    size_t n_scopes = 0;
+
+    for (i = 0; i < n; i++)
+      if (managers[i] == CGROUP_MANAGER_SYSTEMD && scopes[i] && paths[i] && paths[i][0] != '\0')
+        systemd_scopes[n_scopes++] = scopes[i];
+
+    if (n_scopes > 0)
+      {
+        ret = destroy_systemd_cgroup_scopes (systemd_scopes, n_scopes, err);
+        if (UNLIKELY (ret < 0))
+          crun_error_release (err);
+      }
+  }
+#else
+  (void) scopes;
+  (void) managers;
+#endif
+
+  for (i = 0; i < n; i++)
+    {
+      if (paths[i] == NULL || paths[i][0] == '\0')
+        continue;
+
+      if (mode == CGROUP_MODE_UNIFIED)
+        {
+          cleanup_free char *cgroup_path = NULL;
+
+          ret = append_paths (&cgroup_path, err, CGROUP_ROOT, paths[i], NULL);
           if (UNLIKELY (ret < 0))
-            crun_error_release (err);
+            return ret;
+
+          /* Drop the references to the cached device programs.  */
+          libcrun_ebpf_release_cgroup (cgroup_path);
         }
-  } while (repeat);
+
+      ret = do_cgroup_destroy (paths[i], mode, err);
+      if (UNLIKELY (ret < 0))
+        crun_error_release (err);
+    }
 
   return 0;
 }
@@ -2270,38 +3537,12 @@ do_cgroup_destroy (const char *path, int mode, libcrun_error_t *err)
 int
 libcrun_cgroup_destroy (const char *id, const char *path, const char *scope, int manager, libcrun_error_t *err)
 {
-  int ret;
-  int mode;
-
   (void) id;
-  (void) manager;
-  (void) scope;
 
   if (path == NULL || *path == '\0')
     return 0;
 
-  mode = libcrun_get_cgroup_mode (err);
-  if (UNLIKELY (mode < 0))
-    return mode;
-
-  ret = libcrun_cgroup_killall (path, err);
-  if (UNLIKELY (ret < 0))
-    crun_error_release (err);
-
-#ifdef HAVE_SYSTEMD
-  if (manager == CGROUP_MANAGER_SYSTEMD)
-    {
-      ret = destroy_systemd_cgroup_scope (scope, err);
-      if (UNLIKELY (ret < 0))
-        crun_error_release (err);
-    }
-#endif
-
-  ret = do_cgroup_destroy (path, mode, err);
-  if (UNLIKELY (ret < 0))
-    crun_error_release (err);
-
-  return 0;
+  return libcrun_cgroup_destroy_many (&path, &scope, &manager, 1, err);
 }
 
 /* The parser generates different structs but they are really all the same.  */
@@ -2373,7 +3614,7 @@ write_blkio_resources (int dirfd, bool cgroup2, runtime_spec_schema_config_linux
       uint32_t val = blkio->weight;
 
       len = sprintf (fmt_buf, "%" PRIu32, val);
-      ret = write_file_at (dirfd, cgroup2 ? "io.bfq.weight" : "blkio.weight", fmt_buf, len, err);
+      ret = write_cgroup_file_at (dirfd, cgroup2 ? "io.bfq.weight" : "blkio.weight", fmt_buf, len, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -2382,7 +3623,7 @@ write_blkio_resources (int dirfd, bool cgroup2, runtime_spec_schema_config_linux
       if (cgroup2)
         return crun_make_error (err, 0, "cannot set leaf_weight with cgroupv2");
       len = sprintf (fmt_buf, "%d", blkio->leaf_weight);
-      ret = write_file_at (dirfd, "blkio.leaf_weight", fmt_buf, len, err);
+      ret = write_cgroup_file_at (dirfd, "blkio.leaf_weight", fmt_buf, len, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -2510,7 +3751,7 @@ write_network_resources (int dirfd_netclass, int dirfd_netprio, runtime_spec_sch
   if (net->class_id)
     {
       len = sprintf (fmt_buf, "%d", net->class_id);
-      ret = write_file_at (dirfd_netclass, "net_cls.classid", fmt_buf, len, err);
+      ret = write_cgroup_file_at (dirfd_netclass, "net_cls.classid", fmt_buf, len, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -2631,19 +3872,87 @@ write_devices_resources_v1 (int dirfd, runtime_spec_schema_defs_linux_device_cgr
   return 0;
 }
 
+struct default_dev_s
+{
+  char type;
+  int major;
+  int minor;
+  const char *access;
+};
+
+static bool
+is_deny_all_devices_rule (runtime_spec_schema_defs_linux_device_cgroup *dev)
+{
+  if (dev->allow || dev->major_present || dev->minor_present)
+    return false;
+  if (dev->type != NULL && dev->type[0] != 'a')
+    return false;
+  return dev->access != NULL && strchr (dev->access, 'r') && strchr (dev->access, 'w') && strchr (dev->access, 'm');
+}
+
+/* Use a BPF hash map for the device rules, so that the program does not
+   grow with the number of rules and an update changes only the map.  It is
+   possible when the rules, after the last one that denies everything, only
+   allow devices.  It returns 1 if the rules were installed and 0 if the
+   linear program must be used instead.  */
+static int
+write_devices_resources_v2_map (int dirfd, const struct default_dev_s *default_devices, size_t n_default_devices,
+                                runtime_spec_schema_defs_linux_device_cgroup **devs, size_t devs_len,
+                                libcrun_error_t *err)
+{
+  cleanup_free struct bpf_dev_map *map = NULL;
+  size_t i, first = 0;
+  int ret;
+
+  /* A rule that denies everything hides all the rules before it.  */
+  for (i = 0; i < devs_len; i++)
+    if (is_deny_all_devices_rule (devs[i]))
+      first = i + 1;
+
+  for (i = first; i < devs_len; i++)
+    if (! devs[i]->allow)
+      return 0;
+
+  map = bpf_dev_map_new ();
+
+  for (i = 0; i < n_default_devices; i++)
+    {
+      ret = bpf_dev_map_add (&map, default_devices[i].access, default_devices[i].type, default_devices[i].major,
+                             default_devices[i].minor);
+      if (ret < 0)
+        return 0;
+    }
+
+  for (i = first; i < devs_len; i++)
+    {
+      char type = 'a';
+      int minor = -1, major = -1;
+      if (devs[i]->type != NULL)
+        type = devs[i]->type[0];
+
+      if (devs[i]->major_present)
+        major = devs[i]->major;
+      if (devs[i]->minor_present)
+        minor = devs[i]->minor;
+
+      ret = bpf_dev_map_add (&map, devs[i]->access, type, major, minor);
+      if (ret < 0)
+        return 0;
+    }
+
+  ret = libcrun_ebpf_load_dev_map (map, dirfd, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return 1;
+}
+
 static int
 write_devices_resources_v2_internal (int dirfd, runtime_spec_schema_defs_linux_device_cgroup **devs, size_t devs_len,
                                      libcrun_error_t *err)
 {
   int i, ret;
   cleanup_free struct bpf_program *program = NULL;
-  struct default_dev_s
-  {
-    char type;
-    int major;
-    int minor;
-    const char *access;
-  };
   struct default_dev_s default_devices[] = {
     { 'c', -1, -1, "m" },
     { 'b', -1, -1, "m" },
@@ -2659,6 +3968,14 @@ write_devices_resources_v2_internal (int dirfd, runtime_spec_schema_defs_linux_d
     { 'c', 10, 200, "rwm" },
   };
 
+  ret = write_devices_resources_v2_map (dirfd, default_devices, sizeof (default_devices) / sizeof (default_devices[0]),
+                                        devs, devs_len, err);
+  if (ret > 0)
+    return 0;
+  /* If the map cannot be used, e.g. on older kernels, try with the linear program.  */
+  if (ret < 0)
+    crun_error_release (err);
+
   program = bpf_program_new (2048);
 
   program = bpf_program_init_dev (program, err);
@@ -2800,7 +4117,8 @@ write_memory (int dirfd, bool cgroup2, runtime_spec_schema_config_linux_resource
 
   limit_buf_len = cg_itoa (limit_buf, memory->limit, cgroup2);
 
-  return write_file_at (dirfd, cgroup2 ? "memory.max" : "memory.limit_in_bytes", limit_buf, limit_buf_len, err);
+  return write_cgroup_file_at (dirfd, cgroup2 ? "memory.max" : "memory.limit_in_bytes", limit_buf, limit_buf_len,
+                               err);
 }
 
 static int
@@ -2877,7 +4195,7 @@ write_memory_resources (int dirfd, bool cgroup2, runtime_spec_schema_config_linu
         return crun_make_error (err, 0, "cannot set kernel memory with cgroupv2");
 
       len = sprintf (fmt_buf, "%" PRIu64, memory->kernel);
-      ret = write_file_at (dirfd, "memory.kmem.limit_in_bytes", fmt_buf, len, err);
+      ret = write_cgroup_file_at (dirfd, "memory.kmem.limit_in_bytes", fmt_buf, len, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -2895,7 +4213,7 @@ write_memory_resources (int dirfd, bool cgroup2, runtime_spec_schema_config_linu
       if (cgroup2)
         return crun_make_error (err, 0, "cannot disable OOM killer with cgroupv2");
 
-      ret = write_file_at (dirfd, "memory.oom_control", "1", 1, err);
+      ret = write_cgroup_file_at (dirfd, "memory.oom_control", "1", 1, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -2905,7 +4223,7 @@ write_memory_resources (int dirfd, bool cgroup2, runtime_spec_schema_config_linu
         return crun_make_error (err, 0, "cannot set kernel TCP with cgroupv2");
 
       len = sprintf (fmt_buf, "%" PRIu64, memory->kernel_tcp);
-      ret = write_file_at (dirfd, "memory.kmem.tcp.limit_in_bytes", fmt_buf, len, err);
+      ret = write_cgroup_file_at (dirfd, "memory.kmem.tcp.limit_in_bytes", fmt_buf, len, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -2915,7 +4233,7 @@ write_memory_resources (int dirfd, bool cgroup2, runtime_spec_schema_config_linu
         return crun_make_error (err, 0, "cannot set memory swappiness with cgroupv2");
 
       len = sprintf (fmt_buf, "%" PRIu64, memory->swappiness);
-      ret = write_file_at (dirfd, "memory.swappiness", fmt_buf, len, err);
+      ret = write_cgroup_file_at (dirfd, "memory.swappiness", fmt_buf, len, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -2976,7 +4294,7 @@ write_cpu_resources (int dirfd_cpu, bool cgroup2, runtime_spec_schema_config_lin
       else
         {
           len = sprintf (fmt_buf, "%" PRIu64, cpu->period);
-          ret = write_file_at (dirfd_cpu, "cpu.cfs_period_us", fmt_buf, len, err);
+          ret = write_cgroup_file_at (dirfd_cpu, "cpu.cfs_period_us", fmt_buf, len, err);
           if (UNLIKELY (ret < 0))
             return ret;
         }
@@ -2988,7 +4306,7 @@ write_cpu_resources (int dirfd_cpu, bool cgroup2, runtime_spec_schema_config_lin
       else
         {
           len = sprintf (fmt_buf, "%" PRIu64, cpu->quota);
-          ret = write_file_at (dirfd_cpu, "cpu.cfs_quota_us", fmt_buf, len, err);
+          ret = write_cgroup_file_at (dirfd_cpu, "cpu.cfs_quota_us", fmt_buf, len, err);
           if (UNLIKELY (ret < 0))
             return ret;
         }
@@ -2998,7 +4316,7 @@ write_cpu_resources (int dirfd_cpu, bool cgroup2, runtime_spec_schema_config_lin
       if (cgroup2)
         return crun_make_error (err, 0, "realtime period not supported on cgroupv2");
       len = sprintf (fmt_buf, "%" PRIu64, cpu->realtime_period);
-      ret = write_file_at (dirfd_cpu, "cpu.rt_period_us", fmt_buf, len, err);
+      ret = write_cgroup_file_at (dirfd_cpu, "cpu.rt_period_us", fmt_buf, len, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -3007,7 +4325,7 @@ write_cpu_resources (int dirfd_cpu, bool cgroup2, runtime_spec_schema_config_lin
       if (cgroup2)
         return crun_make_error (err, 0, "realtime runtime not supported on cgroupv2");
       len = sprintf (fmt_buf, "%" PRIu64, cpu->realtime_runtime);
-      ret = write_file_at (dirfd_cpu, "cpu.rt_runtime_us", fmt_buf, len, err);
+      ret = write_cgroup_file_at (dirfd_cpu, "cpu.rt_runtime_us", fmt_buf, len, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -3216,18 +4534,33 @@ update_cgroup_v1_resources (runtime_spec_schema_config_linux_resources *resource
 }
 
 static int
-write_unified_resources (int cgroup_dirfd, runtime_spec_schema_config_linux_resources *resources, libcrun_error_t *err)
+write_unified_resources (int cgroup_dirfd, runtime_spec_schema_config_linux_resources *resources, bool new_cgroup,
+                         libcrun_error_t *err)
 {
+  cleanup_write_batch struct crun_write_batch_s batch = {};
   size_t i;
   int ret;
 
   for (i = 0; i < resources->unified->len; i++)
     {
-      size_t len;
-
       if (strchr (resources->unified->keys[i], '/'))
         return crun_make_error (err, 0, "key `%s` must be a file name without any slash", resources->unified->keys[i]);
 
+      crun_write_batch_add (&batch, cgroup_dirfd, resources->unified->keys[i], resources->unified->values[i],
+                            strlen (resources->unified->values[i]));
+    }
+
+  /* A new cgroup has none of the values yet, so write them together instead
+     of checking each of them first.  The resources are written by the crun
+     process, never by the container init, so the batch can be used.  The
+     keys written by the batch are not written again, the others are written
+     one by one in the same order to report the error with the missing
+     controller, if any.  */
+  i = new_cgroup ? crun_write_batch_flush (&batch) : 0;
+  for (; i < resources->unified->len; i++)
+    {
+      size_t len;
+
       len = strlen (resources->unified->values[i]);
       ret = write_file_and_check_controllers_at (true, cgroup_dirfd, resources->unified->keys[i],
                                                  resources->unified->values[i], len, err);
@@ -3239,7 +4572,8 @@ write_unified_resources (int cgroup_dirfd, runtime_spec_schema_config_linux_reso
 }
 
 static int
-update_cgroup_v2_resources (runtime_spec_schema_config_linux_resources *resources, char *path, libcrun_error_t *err)
+update_cgroup_v2_resources (runtime_spec_schema_config_linux_resources *resources, char *path, bool new_cgroup,
+                            libcrun_error_t *err)
 {
   cleanup_free char *cgroup_path = NULL;
   cleanup_close int cgroup_dirfd = -1;
@@ -3303,7 +4637,7 @@ update_cgroup_v2_resources (runtime_spec_schema_config_linux_resources *resource
   /* Write unified resources if any.  They have higher precedence and override any previous setting.  */
   if (resources->unified)
     {
-      ret = write_unified_resources (cgroup_dirfd, resources, err);
+      ret = write_unified_resources (cgroup_dirfd, resources, new_cgroup, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -3311,9 +4645,9 @@ update_cgroup_v2_resources (runtime_spec_schema_config_linux_resources *resource
   return 0;
 }
 
-int
-libcrun_update_cgroup_resources (int cgroup_mode, runtime_spec_schema_config_linux_resources *resources, char *path,
-                                 libcrun_error_t *err)
+static int
+update_cgroup_resources (int cgroup_mode, runtime_spec_schema_config_linux_resources *resources, char *path,
+                         bool new_cgroup, libcrun_error_t *err)
 {
   if (path == NULL)
     {
@@ -3340,7 +4674,7 @@ libcrun_update_cgroup_resources (int cgroup_mode, runtime_spec_schema_config_lin
   switch (cgroup_mode)
     {
     case CGROUP_MODE_UNIFIED:
-      return update_cgroup_v2_resources (resources, path, err);
+      return update_cgroup_v2_resources (resources, path, new_cgroup, err);
 
     case CGROUP_MODE_LEGACY:
     case CGROUP_MODE_HYBRID:
@@ -3351,6 +4685,13 @@ libcrun_update_cgroup_resources (int cgroup_mode, runtime_spec_schema_config_lin
     }
 }
 
+int
+libcrun_update_cgroup_resources (int cgroup_mode, runtime_spec_schema_config_linux_resources *resources, char *path,
+                                 libcrun_error_t *err)
+{
+  return update_cgroup_resources (cgroup_mode, resources, path, false, err);
+}
+
 int
 libcrun_cgroup_has_oom (const char *path, int cgroup_mode, libcrun_error_t *err)
 {
@@ -3426,3 +4767,346 @@ libcrun_cgroup_has_oom (const char *path, int cgroup_mode, libcrun_error_t *err)
 
   return 0;
 }
+
+struct libcrun_cgroup_events_s
+{
+  int cgroup_mode;
+  int epollfd;
+  /* inotify on cgroup v2, eventfd registered for the OOM notifications on cgroup v1.  */
+  int notify_fd;
+  /* memory.events on cgroup v2, memory.oom_control on cgroup v1.  */
+  int memory_fd;
+  /* cgroup.events, only on cgroup v2.  */
+  int cgroup_events_fd;
+  int pidfd;
+  uint64_t oom_count;
+  bool exited;
+};
+
+static int
+syscall_pidfd_open (pid_t pid, unsigned int flags)
+{
+#if defined __NR_pidfd_open
+  return (int) syscall (__NR_pidfd_open, pid, flags);
+#else
+  (void) pid;
+  (void) flags;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+void
+libcrun_cgroup_events_free (libcrun_cgroup_events_t *events)
+{
+  if (events == NULL)
+    return;
+
+  if (events->epollfd >= 0)
+    close (events->epollfd);
+  if (events->notify_fd >= 0)
+    close (events->notify_fd);
+  if (events->memory_fd >= 0)
+    close (events->memory_fd);
+  if (events->cgroup_events_fd >= 0)
+    close (events->cgroup_events_fd);
+  if (events->pidfd >= 0)
+    close (events->pidfd);
+  free (events);
+}
+
+/* Read the value of KEY from the "KEY VALUE" lines of FD.  */
+static int
+read_events_counter (int fd, const char *key, uint64_t *value, libcrun_error_t *err)
+{
+  char buffer[1024];
+  size_t key_len = strlen (key);
+  char *it;
+  ssize_t r;
+
+  *value = 0;
+
+  r = TEMP_FAILURE_RETRY (pread (fd, buffer, sizeof (buffer) - 1, 0));
+  if (UNLIKELY (r < 0))
+    return crun_make_error (err, errno, "read cgroup events");
+  buffer[r] = '\0';
+
+  it = buffer;
+  while (it && *it)
+    {
+      if (strncmp (it, key, key_len) == 0 && it[key_len] == ' ')
+        {
+          *value = strtoull (it + key_len + 1, NULL, 10);
+          break;
+        }
+
+      it = strchr (it, '\n');
+      if (it)
+        it++;
+    }
+
+  return 0;
+}
+
+static int
+events_epoll_add (libcrun_cgroup_events_t *events, int fd, libcrun_error_t *err)
+{
+  struct epoll_event ev = {
+    .events = EPOLLIN,
+    .data.fd = fd,
+  };
+  int ret;
+
+  ret = epoll_ctl (events->epollfd, EPOLL_CTL_ADD, fd, &ev);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "epoll_ctl");
+  return 0;
+}
+
+static int
+open_cgroup_events_unified (libcrun_cgroup_events_t *events, const char *path, libcrun_error_t *err)
+{
+  cleanup_free char *memory_events = NULL;
+  cleanup_free char *cgroup_events = NULL;
+  int ret;
+
+  ret = append_paths (&memory_events, err, CGROUP_ROOT, path, "memory.events", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = append_paths (&cgroup_events, err, CGROUP_ROOT, path, "cgroup.events", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  events->notify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (UNLIKELY (events->notify_fd < 0))
+    return crun_make_error (err, errno, "inotify_init1");
+
+  events->cgroup_events_fd = open (cgroup_events, O_RDONLY | O_CLOEXEC);
+  if (UNLIKELY (events->cgroup_events_fd < 0))
+    return crun_make_error (err, errno, "open `%s`", cgroup_events);
+
+  ret = inotify_add_watch (events->notify_fd, cgroup_events, IN_MODIFY);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "inotify_add_watch `%s`", cgroup_events);
+
+  /* The memory controller might not be enabled for the cgroup.  */
+  events->memory_fd = open (memory_events, O_RDONLY | O_CLOEXEC);
+  if (events->memory_fd < 0)
+    {
+      if (errno == ENOENT)
+        return 0;
+      return crun_make_error (err, errno, "open `%s`", memory_events);
+    }
+
+  ret = inotify_add_watch (events->notify_fd, memory_events, IN_MODIFY);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "inotify_add_watch `%s`", memory_events);
+
+  return read_events_counter (events->memory_fd, "oom", &events->oom_count, err);
+}
+
+static int
+open_cgroup_events_legacy (libcrun_cgroup_events_t *events, const char *path, libcrun_error_t *err)
+{
+  cleanup_free char *oom_control = NULL;
+  cleanup_free char *event_control = NULL;
+  cleanup_close int event_control_fd = -1;
+  char buffer[64];
+  int ret;
+
+  ret = append_paths (&oom_control, err, CGROUP_ROOT, "memory", path, "memory.oom_control", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = append_paths (&event_control, err, CGROUP_ROOT, "memory", path, "cgroup.event_control", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  events->memory_fd = open (oom_control, O_RDONLY | O_CLOEXEC);
+  if (events->memory_fd < 0)
+    {
+      if (errno == ENOENT)
+        return 0;
+      return crun_make_error (err, errno, "open `%s`", oom_control);
+    }
+
+  events->notify_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (UNLIKELY (events->notify_fd < 0))
+    return crun_make_error (err, errno, "eventfd");
+
+  event_control_fd = open (event_control, O_WRONLY | O_CLOEXEC);
+  if (UNLIKELY (event_control_fd < 0))
+    return crun_make_error (err, errno, "open `%s`", event_control);
+
+  ret = snprintf (buffer, sizeof (buffer), "%d %d", events->notify_fd, events->memory_fd);
+  ret = TEMP_FAILURE_RETRY (write (event_control_fd, buffer, ret));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "write `%s`", event_control);
+
+  return read_events_counter (events->memory_fd, "oom_kill", &events->oom_count, err);
+}
+
+/* Watch for the OOM events in the cgroup PATH and for the exit of the
+   process PID, if it is not 0.  The events are notified without polling
+   through the fd returned by libcrun_cgroup_events_get_fd.  */
+int
+libcrun_cgroup_events_new (const char *path, pid_t pid, libcrun_cgroup_events_t **out, libcrun_error_t *err)
+{
+  libcrun_cgroup_events_t *events;
+  int ret;
+
+  if (path == NULL || *path == '\0')
+    return crun_make_error (err, 0, "the container is not using cgroups");
+
+  events = xmalloc0 (sizeof (*events));
+  events->epollfd = -1;
+  events->notify_fd = -1;
+  events->memory_fd = -1;
+  events->cgroup_events_fd = -1;
+  events->pidfd = -1;
+
+  events->cgroup_mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (events->cgroup_mode < 0))
+    {
+      ret = events->cgroup_mode;
+      goto fail;
+    }
+
+  events->epollfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (UNLIKELY (events->epollfd < 0))
+    {
+      ret = crun_make_error (err, errno, "epoll_create1");
+      goto fail;
+    }
+
+  if (events->cgroup_mode == CGROUP_MODE_UNIFIED)
+    ret = open_cgroup_events_unified (events, path, err);
+  else
+    ret = open_cgroup_events_legacy (events, path, err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  if (events->notify_fd >= 0)
+    {
+      ret = events_epoll_add (events, events->notify_fd, err);
+      if (UNLIKELY (ret < 0))
+        goto fail;
+    }
+
+  /* Without pidfd support, the exit is detected only on cgroup v2 when the
+     cgroup becomes empty.  */
+  if (pid > 0)
+    {
+      events->pidfd = syscall_pidfd_open (pid, 0);
+      if (events->pidfd >= 0)
+        {
+          ret = events_epoll_add (events, events->pidfd, err);
+          if (UNLIKELY (ret < 0))
+            goto fail;
+        }
+    }
+
+  *out = events;
+  return 0;
+
+fail:
+  libcrun_cgroup_events_free (events);
+  return ret;
+}
+
+int
+libcrun_cgroup_events_get_fd (libcrun_cgroup_events_t *events)
+{
+  return events->epollfd;
+}
+
+/* Collect the events notified since the last call, and store them in MASK
+   as LIBCRUN_CGROUP_EVENT_* flags.  Each kind of event is reported once for
+   each notification.  */
+int
+libcrun_cgroup_events_read (libcrun_cgroup_events_t *events, int *mask, libcrun_error_t *err)
+{
+  bool exited = false;
+  int ret;
+
+  *mask = 0;
+
+  if (events->notify_fd >= 0)
+    {
+      char buffer[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+      ssize_t r;
+
+      do
+        r = read (events->notify_fd, buffer, sizeof (buffer));
+      while (r > 0 || (r < 0 && errno == EINTR));
+      if (UNLIKELY (r < 0 && errno != EAGAIN))
+        return crun_make_error (err, errno, "read cgroup notifications");
+    }
+
+  if (events->memory_fd >= 0)
+    {
+      const char *key = events->cgroup_mode == CGROUP_MODE_UNIFIED ? "oom" : "oom_kill";
+      uint64_t count;
+
+      ret = read_events_counter (events->memory_fd, key, &count, err);
+      if (UNLIKELY (ret < 0))
+        {
+          /* The cgroup was removed.  */
+          if (crun_error_get_errno (err) != ENODEV)
+            return ret;
+          crun_error_release (err);
+          close_and_reset (&events->memory_fd);
+          exited = true;
+        }
+      else if (count > events->oom_count)
+        {
+          events->oom_count = count;
+          *mask |= LIBCRUN_CGROUP_EVENT_OOM;
+        }
+    }
+
+  if (events->exited)
+    return 0;
+
+  if (events->pidfd >= 0)
+    {
+      struct pollfd pfd = {
+        .fd = events->pidfd,
+        .events = POLLIN,
+      };
+
+      if (poll (&pfd, 1, 0) > 0)
+        exited = true;
+    }
+
+  if (! exited && events->cgroup_events_fd >= 0)
+    {
+      uint64_t populated;
+
+      ret = read_events_counter (events->cgroup_events_fd, "populated", &populated, err);
+      if (UNLIKELY (ret < 0))
+        {
+          if (crun_error_get_errno (err) != ENODEV)
+            return ret;
+          crun_error_release (err);
+          populated = 0;
+        }
+      if (populated == 0)
+        exited = true;
+    }
+
+  if (exited)
+    {
+      events->exited = true;
+      *mask |= LIBCRUN_CGROUP_EVENT_EXIT;
+
+      /* The pidfd stays readable, do not report it again.  */
+      if (events->pidfd >= 0)
+        close_and_reset (&events->pidfd);
+      if (events->cgroup_events_fd >= 0)
+        close_and_reset (&events->cgroup_events_fd);
+    }
+
+  return 0;
+}
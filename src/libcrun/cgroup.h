@@ -20,6 +20,7 @@
 
 #include "container.h"
 #include <unistd.h>
+#include <stdint.h>
 
 #ifndef CGROUP_ROOT
 #  define CGROUP_ROOT "/sys/fs/cgroup"
@@ -54,6 +55,8 @@ struct libcrun_cgroup_args
   const char *id;
   const char *systemd_subgroup;
   const char *delegate_cgroup;
+  /* The process was created in the cgroup with CLONE_INTO_CGROUP.  */
+  bool process_in_cgroup;
 };
 
 LIBCRUN_PUBLIC int libcrun_get_cgroup_mode (libcrun_error_t *err);
@@ -61,6 +64,8 @@ LIBCRUN_PUBLIC int libcrun_cgroup_killall_signal (const char *path, int signal,
 LIBCRUN_PUBLIC int libcrun_cgroup_killall (const char *path, libcrun_error_t *err);
 LIBCRUN_PUBLIC int libcrun_cgroup_destroy (const char *id, const char *path, const char *scope, int manager,
                                            libcrun_error_t *err);
+LIBCRUN_PUBLIC int libcrun_cgroup_destroy_many (const char **paths, const char **scopes, const int *managers,
+                                                size_t n, libcrun_error_t *err);
 LIBCRUN_PUBLIC int libcrun_move_process_to_cgroup (pid_t pid, pid_t init_pid, char *path, libcrun_error_t *err);
 LIBCRUN_PUBLIC int libcrun_update_cgroup_resources (int cgroup_mode,
                                                     runtime_spec_schema_config_linux_resources *resources, char *path,
@@ -68,10 +73,67 @@ LIBCRUN_PUBLIC int libcrun_update_cgroup_resources (int cgroup_mode,
 LIBCRUN_PUBLIC int libcrun_cgroup_is_container_paused (const char *cgroup_path, int cgroup_mode, bool *paused,
                                                        libcrun_error_t *err);
 LIBCRUN_PUBLIC int libcrun_cgroup_pause_unpause (const char *path, const bool pause, libcrun_error_t *err);
+
+typedef struct libcrun_cgroup_freezer_s libcrun_cgroup_freezer_t;
+
+LIBCRUN_PUBLIC int libcrun_cgroup_freezer_start (const char *path, const bool pause, libcrun_cgroup_freezer_t **freezer,
+                                                 libcrun_error_t *err);
+LIBCRUN_PUBLIC int libcrun_cgroup_freezer_get_fd (libcrun_cgroup_freezer_t *freezer);
+LIBCRUN_PUBLIC int libcrun_cgroup_freezer_done (libcrun_cgroup_freezer_t *freezer, libcrun_error_t *err);
+LIBCRUN_PUBLIC void libcrun_cgroup_freezer_free (libcrun_cgroup_freezer_t *freezer);
+LIBCRUN_PUBLIC int libcrun_cgroup_pause_unpause_many (const char **paths, size_t n_paths, const bool pause,
+                                                      int timeout_ms, libcrun_error_t *err);
 LIBCRUN_PUBLIC int libcrun_cgroup_read_pids (const char *path, bool recurse, pid_t **pids, libcrun_error_t *err);
 
+/* Resource usage of a cgroup.  The values of the controllers that are not
+   enabled are set to 0.  */
+struct libcrun_cgroup_stats_s
+{
+  uint64_t cpu_usage_usec;
+  uint64_t cpu_user_usec;
+  uint64_t cpu_system_usec;
+  uint64_t memory_usage;
+  uint64_t memory_anon;
+  uint64_t memory_file;
+  uint64_t pids_current;
+  uint64_t io_read_bytes;
+  uint64_t io_write_bytes;
+};
+
+typedef struct libcrun_cgroup_stats_reader_s libcrun_cgroup_stats_reader_t;
+
+LIBCRUN_PUBLIC int libcrun_cgroup_stats_reader_new (const char *path, libcrun_cgroup_stats_reader_t **reader,
+                                                    libcrun_error_t *err);
+LIBCRUN_PUBLIC int libcrun_cgroup_stats_read (libcrun_cgroup_stats_reader_t *reader,
+                                              struct libcrun_cgroup_stats_s *stats, libcrun_error_t *err);
+LIBCRUN_PUBLIC void libcrun_cgroup_stats_reader_free (libcrun_cgroup_stats_reader_t *reader);
+
+enum
+{
+  LIBCRUN_CGROUP_EVENT_OOM = 1 << 0,
+  LIBCRUN_CGROUP_EVENT_EXIT = 1 << 1,
+};
+
+typedef struct libcrun_cgroup_events_s libcrun_cgroup_events_t;
+
+LIBCRUN_PUBLIC int libcrun_cgroup_events_new (const char *path, pid_t pid, libcrun_cgroup_events_t **events,
+                                              libcrun_error_t *err);
+LIBCRUN_PUBLIC int libcrun_cgroup_events_get_fd (libcrun_cgroup_events_t *events);
+LIBCRUN_PUBLIC int libcrun_cgroup_events_read (libcrun_cgroup_events_t *events, int *mask, libcrun_error_t *err);
+LIBCRUN_PUBLIC void libcrun_cgroup_events_free (libcrun_cgroup_events_t *events);
+
+static inline void
+cleanup_cgroup_eventsp (libcrun_cgroup_events_t **events)
+{
+  libcrun_cgroup_events_free (*events);
+}
+#define cleanup_cgroup_events __attribute__ ((cleanup (cleanup_cgroup_eventsp)))
+
 int libcrun_cgroup_enter (struct libcrun_cgroup_args *args, libcrun_error_t *err);
+int libcrun_cgroup_preenter (struct libcrun_cgroup_args *args, int *dirfd, libcrun_error_t *err);
+void libcrun_cgroup_preenter_cleanup (struct libcrun_cgroup_args *args);
 int libcrun_cgroups_create_symlinks (int dirfd, libcrun_error_t *err);
+int libcrun_open_init_cgroup (pid_t init_pid, const char *path, int *out_fd, libcrun_error_t *err);
 
 int parse_sd_array (char *s, char **out, char **next, libcrun_error_t *err);
 
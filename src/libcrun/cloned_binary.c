@@ -96,9 +96,13 @@ int memfd_create(const char *name, unsigned int flags)
 #endif
 
 #define CLONED_BINARY_ENV "_LIBCONTAINER_CLONED_BINARY"
+#define CLONED_BINARY_FD_ENV "CRUN_CLONED_BINARY_FD"
 #define CRUN_MEMFD_COMMENT "crun_cloned:/proc/self/exe"
 #define CRUN_MEMFD_SEALS \
 	(F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+/* The seals that make the content of a memfd immutable.  */
+#define CRUN_MEMFD_CONTENT_SEALS \
+	(F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
 
 /*
  * Verify whether we are currently in a self-cloned program (namely, is
@@ -262,7 +266,100 @@ enum {
 #  endif
 #endif
 
-static int make_execfd(int *fdtype)
+/*
+ * The memfd name records the identity of the binary it was copied from, so
+ * that a sealed copy handed over by a supervisor can be checked without
+ * comparing its content.
+ */
+static int get_memfd_comment(int binfd, char *buf, size_t len)
+{
+	struct stat statbuf = {};
+
+	if (fstat(binfd, &statbuf) < 0)
+		return -1;
+	if (snprintf(buf, len, CRUN_MEMFD_COMMENT ":%llx:%llx:%lld.%09ld:%lld",
+		     (unsigned long long) statbuf.st_dev,
+		     (unsigned long long) statbuf.st_ino,
+		     (long long) statbuf.st_mtim.tv_sec, statbuf.st_mtim.tv_nsec,
+		     (long long) statbuf.st_size) >= (int) len)
+		return -1;
+	return 0;
+}
+
+/*
+ * Check whether CLONED_BINARY_FD_ENV points to a sealed memfd holding a copy
+ * of /proc/self/exe, as created by a previous invocation.  A supervisor can
+ * grab it from /proc/$PID/exe of a running crun and pass it down, so that the
+ * binary is not copied again for every invocation.
+ */
+static int get_cached_execfd(void)
+{
+	int fd, binfd, seals, ret = -1;
+	char *env, *end;
+	char comment[NAME_MAX] = {0};
+	char expected[PATH_MAX] = {0};
+	char link[PATH_MAX] = {0};
+	char fdpath[PATH_MAX] = {0};
+	struct stat statbuf = {}, fdstat = {};
+	ssize_t len;
+	long v;
+
+	env = getenv(CLONED_BINARY_FD_ENV);
+	if (!env || *env == '\0')
+		return -1;
+
+	/* Do not leak it to the processes we create.  */
+	unsetenv(CLONED_BINARY_FD_ENV);
+
+	errno = 0;
+	v = strtol(env, &end, 10);
+	if (errno || *end != '\0' || v < 3 || v > INT_MAX)
+		return -1;
+	fd = (int) v;
+
+	/*
+	 * Only trust a copy that nobody can modify anymore.  F_SEAL_WRITE, unlike
+	 * F_SEAL_FUTURE_WRITE, also guarantees that there is no writable mapping
+	 * left, since it cannot be added while one exists.
+	 */
+	seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & CRUN_MEMFD_CONTENT_SEALS) != CRUN_MEMFD_CONTENT_SEALS)
+		return -1;
+
+	binfd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+	if (binfd < 0)
+		return -1;
+	if (get_memfd_comment(binfd, comment, sizeof(comment)) < 0)
+		goto out;
+	if (fstat(binfd, &statbuf) < 0)
+		goto out;
+
+	if (snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", fd) < 0)
+		goto out;
+	len = readlink(fdpath, link, sizeof(link) - 1);
+	if (len < 0)
+		goto out;
+	link[len] = '\0';
+
+	/* The link looks like "/memfd:NAME (deleted)".  */
+	if (snprintf(expected, sizeof(expected), "/memfd:%s (deleted)", comment) < 0)
+		goto out;
+	if (strcmp(link, expected) != 0)
+		goto out;
+
+	if (fstat(fd, &fdstat) < 0 || fdstat.st_size != statbuf.st_size)
+		goto out;
+
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+		goto out;
+
+	ret = fd;
+out:
+	close(binfd);
+	return ret;
+}
+
+static int make_execfd(int *fdtype, const char *comment)
 {
 	int fd = -1;
 	char template[PATH_MAX] = {0};
@@ -279,7 +376,7 @@ static int make_execfd(int *fdtype)
 	 * assumptions about STATEDIR.
 	 */
 	*fdtype = EFD_MEMFD;
-	fd = memfd_create(CRUN_MEMFD_COMMENT, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	fd = memfd_create(comment, MFD_CLOEXEC | MFD_ALLOW_SEALING);
 	if (fd >= 0)
 		return fd;
 	if (errno != ENOSYS && errno != EINVAL)
@@ -456,6 +553,7 @@ static int clone_binary(void)
 	struct stat statbuf = {};
 	ssize_t sent = 0;
 	int fdtype = EFD_NONE;
+	char comment[NAME_MAX] = CRUN_MEMFD_COMMENT;
 
 	/*
 	 * Before we resort to copying, let's try creating an ro-binfd in one shot
@@ -469,13 +567,18 @@ static int clone_binary(void)
 	 * Dammit, that didn't work -- time to copy the binary to a safe place we
 	 * can seal the contents.
 	 */
-	execfd = make_execfd(&fdtype);
-	if (execfd < 0 || fdtype == EFD_NONE)
-		return -ENOTRECOVERABLE;
-
 	binfd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
 	if (binfd < 0)
-		goto error;
+		return -EIO;
+
+	if (get_memfd_comment(binfd, comment, sizeof(comment)) < 0)
+		strcpy(comment, CRUN_MEMFD_COMMENT);
+
+	execfd = make_execfd(&fdtype, comment);
+	if (execfd < 0 || fdtype == EFD_NONE) {
+		close(binfd);
+		return -ENOTRECOVERABLE;
+	}
 
 	if (fstat(binfd, &statbuf) < 0)
 		goto error_binfd;
@@ -522,7 +625,10 @@ int ensure_cloned_binary(void)
 	if (fetchve(&argv) < 0)
 		return -EINVAL;
 
-	execfd = clone_binary();
+	/* Reuse a sealed copy if we got one, otherwise create it.  */
+	execfd = get_cached_execfd();
+	if (execfd < 0)
+		execfd = clone_binary();
 	if (execfd < 0)
 		return -EIO;
 
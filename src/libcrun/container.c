@@ -24,6 +24,7 @@
 #include "utils.h"
 #include "seccomp.h"
 #include "seccomp_notify.h"
+#include "hook_plugin.h"
 #include <stdbool.h>
 #include <argp.h>
 #include <unistd.h>
@@ -37,18 +38,21 @@
 #include "linux.h"
 #include "terminal.h"
 #include "cgroup.h"
+#include "event_loop.h"
+#include "trace.h"
+#include "custom-handler.h"
 #include <sys/prctl.h>
 #include <sys/signalfd.h>
-#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <grp.h>
-
-#ifdef HAVE_DLOPEN
-#  include <dlfcn.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#ifdef HAVE_MALLOC_TRIM
+#  include <malloc.h>
 #endif
-
-#ifdef HAVE_LIBKRUN
-#  include <libkrun.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
 #endif
 
 #ifdef HAVE_SYSTEMD
@@ -60,13 +64,23 @@
 
 #define YAJL_STR(x) ((const unsigned char *) (x))
 
+#ifndef MADV_PAGEOUT
+#  define MADV_PAGEOUT 21
+#endif
+
 enum
 {
   SYNC_SOCKET_SYNC_MESSAGE,
   SYNC_SOCKET_ERROR_MESSAGE,
   SYNC_SOCKET_WARNING_MESSAGE,
+  SYNC_SOCKET_TRACE_MESSAGE,
 };
 
+#define SYNC_SOCKET_MESSAGE_SIZE 512
+
+/* How long libcrun_container_pause_unpause_many waits for the freezer.  */
+#define PAUSE_TIMEOUT_MS 10000
+
 struct container_entrypoint_s
 {
   libcrun_container_t *container;
@@ -84,17 +98,24 @@ struct container_entrypoint_s
   int hooks_out_fd;
   int hooks_err_fd;
 
+  /* Listening socket of a template container, see wait_for_start.  */
+  int template_socket;
+
   /* If specified, it is called instead of
      execve.  */
   int (*exec_func) (void *container, void *arg, const char *pathname, char *const argv[]);
   void *exec_func_arg;
+
+  /* Set when the container runs with a custom handler.  */
+  struct custom_handler_s *custom_handler;
+  void *custom_handler_cookie;
 };
 
 struct sync_socket_message_s
 {
   int type;
   int error_value;
-  char message[512];
+  char message[SYNC_SOCKET_MESSAGE_SIZE];
 };
 
 typedef runtime_spec_schema_defs_hook hook;
@@ -422,6 +443,37 @@ sync_socket_wait_sync (libcrun_context_t *context, int fd, bool flush, libcrun_e
     }
 }
 
+/* Send the phases traced by the container init to the parent, as many
+   events as fit in each SYNC_SOCKET_TRACE_MESSAGE.  */
+static int
+sync_socket_send_trace (int fd, libcrun_error_t *err)
+{
+  const size_t per_message = SYNC_SOCKET_MESSAGE_SIZE / sizeof (struct libcrun_trace_event_s);
+  const struct libcrun_trace_event_s *events;
+  struct sync_socket_message_s msg;
+  size_t n, i;
+  int ret;
+
+  if (fd < 0 || ! libcrun_trace_active)
+    return 0;
+
+  n = libcrun_trace_get_events (&events);
+  for (i = 0; i < n; i += per_message)
+    {
+      size_t count = n - i < per_message ? n - i : per_message;
+      size_t len = count * sizeof (struct libcrun_trace_event_s);
+
+      msg.type = SYNC_SOCKET_TRACE_MESSAGE;
+      msg.error_value = 0;
+      memcpy (msg.message, events + i, len);
+
+      ret = TEMP_FAILURE_RETRY (write (fd, &msg, SYNC_SOCKET_MESSAGE_LEN (msg, len)));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "write to sync socket");
+    }
+  return 0;
+}
+
 static int
 sync_socket_send_sync (int fd, bool flush_errors, libcrun_error_t *err)
 {
@@ -516,11 +568,165 @@ libcrun_container_load_from_memory (const char *json, libcrun_error_t *err)
   return make_container (container_def);
 }
 
-libcrun_container_t *
-libcrun_container_load_from_file (const char *path, libcrun_error_t *err)
+/* Cache of the parsed configuration files, used when enabled with
+   libcrun_container_set_config_cache.  An entry is returned only if the
+   file still has the same device, inode, modification time and size.
+   The parsed configuration is shared by all the containers loaded from
+   the entry, and it is freed only once no container uses it.  */
+
+#define CONFIG_CACHE_MAX_ENTRIES 64
+
+struct config_cache_entry_s
+{
+  struct config_cache_entry_s *next;
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  off_t size;
+  runtime_spec_schema_config_schema *container_def;
+  /* Number of containers using CONTAINER_DEF.  */
+  size_t users;
+  /* Whether the entry can still be returned by a lookup.  */
+  bool valid;
+};
+
+static struct config_cache_entry_s *config_cache;
+static size_t config_cache_valid_entries;
+static bool config_cache_enabled;
+
+static void
+config_cache_invalidate (struct config_cache_entry_s *entry)
+{
+  if (! entry->valid)
+    return;
+  entry->valid = false;
+  config_cache_valid_entries--;
+}
+
+/* Free the invalid entries that are not used anymore.  */
+static void
+config_cache_collect (void)
+{
+  struct config_cache_entry_s **it = &config_cache;
+
+  while (*it)
+    {
+      struct config_cache_entry_s *entry = *it;
+
+      if (entry->valid || entry->users)
+        {
+          it = &entry->next;
+          continue;
+        }
+
+      *it = entry->next;
+      free_runtime_spec_schema_config_schema (entry->container_def);
+      free (entry->path);
+      free (entry);
+    }
+}
+
+/* Returns true if CONTAINER_DEF is owned by the cache.  */
+static bool
+config_cache_release (runtime_spec_schema_config_schema *container_def)
+{
+  struct config_cache_entry_s *it;
+
+  for (it = config_cache; it; it = it->next)
+    if (it->container_def == container_def)
+      {
+        it->users--;
+        config_cache_collect ();
+        return true;
+      }
+
+  return false;
+}
+
+static libcrun_container_t *
+config_cache_load (const char *path, libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *container_def;
+  struct config_cache_entry_s *it, *entry, *last_valid = NULL;
+  cleanup_free char *oci_error = NULL;
+  struct stat st;
+
+  if (UNLIKELY (stat (path, &st) < 0))
+    {
+      crun_make_error (err, errno, "stat `%s`", path);
+      return NULL;
+    }
+
+  for (it = config_cache; it; it = it->next)
+    {
+      if (! it->valid || strcmp (it->path, path))
+        continue;
+
+      if (it->dev == st.st_dev && it->ino == st.st_ino && it->size == st.st_size
+          && it->mtime.tv_sec == st.st_mtim.tv_sec && it->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+          it->users++;
+          return make_container (it->container_def);
+        }
+
+      config_cache_invalidate (it);
+      break;
+    }
+
+  container_def = runtime_spec_schema_config_schema_parse_file (path, NULL, &oci_error);
+  if (container_def == NULL)
+    {
+      config_cache_collect ();
+      crun_make_error (err, 0, "load `%s`: %s", path, oci_error);
+      return NULL;
+    }
+
+  entry = xmalloc0 (sizeof (*entry));
+  entry->path = xstrdup (path);
+  entry->dev = st.st_dev;
+  entry->ino = st.st_ino;
+  entry->mtime = st.st_mtim;
+  entry->size = st.st_size;
+  entry->container_def = container_def;
+  entry->users = 1;
+  entry->valid = true;
+  entry->next = config_cache;
+  config_cache = entry;
+
+  if (++config_cache_valid_entries > CONFIG_CACHE_MAX_ENTRIES)
+    {
+      for (it = config_cache; it; it = it->next)
+        if (it->valid)
+          last_valid = it;
+      config_cache_invalidate (last_valid);
+    }
+  config_cache_collect ();
+
+  return make_container (container_def);
+}
+
+void
+libcrun_container_set_config_cache (bool enable)
+{
+  struct config_cache_entry_s *it;
+
+  config_cache_enabled = enable;
+  if (enable)
+    return;
+
+  for (it = config_cache; it; it = it->next)
+    config_cache_invalidate (it);
+  config_cache_collect ();
+}
+
+/* Parse PATH without the cache and the tracing, which are not thread safe.  */
+static libcrun_container_t *
+container_parse_file (const char *path, libcrun_error_t *err)
 {
   runtime_spec_schema_config_schema *container_def;
   cleanup_free char *oci_error = NULL;
+
   container_def = runtime_spec_schema_config_schema_parse_file (path, NULL, &oci_error);
   if (container_def == NULL)
     {
@@ -530,13 +736,27 @@ libcrun_container_load_from_file (const char *path, libcrun_error_t *err)
   return make_container (container_def);
 }
 
+libcrun_container_t *
+libcrun_container_load_from_file (const char *path, libcrun_error_t *err)
+{
+  libcrun_container_t *container;
+  uint64_t trace_start = libcrun_trace_begin ();
+
+  if (config_cache_enabled)
+    container = config_cache_load (path, err);
+  else
+    container = container_parse_file (path, err);
+  libcrun_trace_end ("load-config", trace_start);
+  return container;
+}
+
 void
 libcrun_container_free (libcrun_container_t *ctr)
 {
   if (ctr == NULL)
     return;
 
-  if (ctr->container_def)
+  if (ctr->container_def && ! config_cache_release (ctr->container_def))
     free_runtime_spec_schema_config_schema (ctr->container_def);
   free (ctr);
 }
@@ -577,6 +797,24 @@ unblock_signals (libcrun_error_t *err)
   return 0;
 }
 
+/* Initialize the state that does not depend on the container configuration,
+   so that processes forked from the caller find it already set up.  */
+int
+libcrun_warmup (libcrun_error_t *err)
+{
+  int ret;
+
+  ret = libcrun_initialize_apparmor (err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = libcrun_initialize_selinux (err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return libcrun_init_caps (err);
+}
+
 /* must be used on the host before pivot_root(2).  */
 static int
 initialize_security (runtime_spec_schema_config_schema_process *proc, libcrun_error_t *err)
@@ -604,24 +842,18 @@ initialize_security (runtime_spec_schema_config_schema_process *proc, libcrun_er
   return 0;
 }
 
+/* Build in *OUT the state of the container that is passed to the hooks
+   on their stdin.  */
 static int
-do_hooks (runtime_spec_schema_config_schema *def, pid_t pid, const char *id, bool keep_going, const char *cwd,
-          const char *status, hook **hooks, size_t hooks_len, int out_fd, int err_fd, libcrun_error_t *err)
+get_hooks_state (runtime_spec_schema_config_schema *def, pid_t pid, const char *id, const char *cwd,
+                 const char *status, char **out, size_t *out_len, libcrun_error_t *err)
 {
   size_t i, stdin_len;
-  int r, ret;
+  int r;
   char *stdin = NULL;
-  cleanup_free char *cwd_allocated = NULL;
   const char *rootfs = def->root ? def->root->path : "";
   yajl_gen gen = NULL;
 
-  if (cwd == NULL)
-    {
-      cwd = cwd_allocated = getcwd (NULL, 0);
-      if (cwd == NULL)
-        OOM ();
-    }
-
   gen = yajl_gen_alloc (NULL);
   if (gen == NULL)
     return crun_make_error (err, 0, "yajl_gen_alloc failed");
@@ -714,12 +946,90 @@ do_hooks (runtime_spec_schema_config_schema *def, pid_t pid, const char *id, boo
   if (UNLIKELY (r != yajl_gen_status_ok))
     goto yajl_error;
 
-  ret = 0;
+  *out = xmalloc (stdin_len + 1);
+  memcpy (*out, stdin, stdin_len);
+  (*out)[stdin_len] = '\0';
+  *out_len = stdin_len;
+
+  yajl_gen_free (gen);
+  return 0;
+
+yajl_error:
+  if (gen)
+    yajl_gen_free (gen);
+  return yajl_error_to_crun_error (r, err);
+}
+
+/* The hooks of a stage are run concurrently when the annotation
+   run.oci.hooks.parallel=1 is set.  */
+static bool
+hooks_run_in_parallel (runtime_spec_schema_config_schema *def)
+{
+  size_t i;
+
+  if (def->annotations == NULL)
+    return false;
+
+  for (i = 0; i < def->annotations->len; i++)
+    if (strcmp (def->annotations->keys[i], "run.oci.hooks.parallel") == 0)
+      return strcmp (def->annotations->values[i], "0") != 0;
+
+  return false;
+}
+
+/* Hook plugins are loaded in the crun process, so they must be enabled
+   explicitly with the run.oci.hooks.plugins annotation.  */
+static bool
+hooks_plugins_enabled (runtime_spec_schema_config_schema *def)
+{
+  size_t i;
+
+  if (def->annotations == NULL)
+    return false;
+
+  for (i = 0; i < def->annotations->len; i++)
+    if (strcmp (def->annotations->keys[i], "run.oci.hooks.plugins") == 0)
+      return strcmp (def->annotations->values[i], "0") != 0;
+
+  return false;
+}
+
+/* Run the hook plugin HOOK, see hook_plugin_api.h.  */
+static int
+run_hook_plugin (hook *hook, pid_t pid, const char *id, const char *status, const char *cwd, char *state,
+                 size_t state_len, int out_fd, int err_fd, libcrun_error_t *err)
+{
+  struct run_oci_hook_state_s hook_state = {
+    .id = id,
+    .status = status,
+    .pid = pid,
+    .bundle = cwd,
+    .state = state,
+    .state_len = state_len,
+    .out_fd = out_fd,
+    .err_fd = err_fd,
+  };
+
+  return libcrun_run_hook_plugin (hook->path, hook->args, hook->env, hook->timeout, &hook_state, err);
+}
+
+static int
+run_hooks_in_parallel (bool keep_going, bool plugins, pid_t pid, const char *id, const char *status, const char *cwd,
+                       char *state, size_t state_len, hook **hooks, size_t hooks_len, int out_fd, int err_fd,
+                       libcrun_error_t *err)
+{
+  cleanup_free struct run_process_s *procs = xmalloc0 (sizeof (struct run_process_s) * hooks_len);
+  size_t i, n_procs = 0;
+  int ret;
 
+  /* The plugins run in this process, so they run one after the other
+     before the processes are started.  */
   for (i = 0; i < hooks_len; i++)
     {
-      ret = run_process_with_stdin_timeout_envp (hooks[i]->path, hooks[i]->args, cwd, hooks[i]->timeout, hooks[i]->env,
-                                                 stdin, stdin_len, out_fd, err_fd, err);
+      if (! plugins || ! libcrun_hook_is_plugin (hooks[i]->path))
+        continue;
+
+      ret = run_hook_plugin (hooks[i], pid, id, status, cwd, state, state_len, out_fd, err_fd, err);
       if (UNLIKELY (ret != 0))
         {
           if (keep_going)
@@ -727,118 +1037,129 @@ do_hooks (runtime_spec_schema_config_schema *def, pid_t pid, const char *id, boo
           else
             {
               libcrun_error (0, "error executing hook `%s` (exit code: %d)", hooks[i]->path, ret);
-              break;
+              return ret;
             }
         }
     }
 
-  if (gen)
-    yajl_gen_free (gen);
-
-  return ret;
-
-yajl_error:
-  if (gen)
-    yajl_gen_free (gen);
-  return yajl_error_to_crun_error (r, err);
-}
+  for (i = 0; i < hooks_len; i++)
+    {
+      if (plugins && libcrun_hook_is_plugin (hooks[i]->path))
+        continue;
 
-#if HAVE_DLOPEN && HAVE_LIBKRUN
-static int
-libkrun_do_exec (void *container, void *arg, const char *pathname, char *const argv[])
-{
-  runtime_spec_schema_config_schema *def = ((libcrun_container_t *) container)->container_def;
-  int32_t (*krun_create_ctx) ();
-  int (*krun_start_enter) (uint32_t ctx_id);
-  int32_t (*krun_set_vm_config) (uint32_t ctx_id, uint8_t num_vcpus, uint32_t ram_mib);
-  int32_t (*krun_set_root) (uint32_t ctx_id, const char *root_path);
-  int32_t (*krun_set_workdir) (uint32_t ctx_id, const char *workdir_path);
-  int32_t (*krun_set_exec) (uint32_t ctx_id, const char *exec_path, char *const argv[], char *const envp[]);
-  void *handle = arg;
-  uint32_t num_vcpus, ram_mib;
-  int32_t ctx_id, ret;
-  cpu_set_t set;
-
-  krun_create_ctx = dlsym (handle, "krun_create_ctx");
-  krun_start_enter = dlsym (handle, "krun_start_enter");
-  krun_set_vm_config = dlsym (handle, "krun_set_vm_config");
-  krun_set_root = dlsym (handle, "krun_set_root");
-  krun_set_workdir = dlsym (handle, "krun_set_workdir");
-  krun_set_exec = dlsym (handle, "krun_set_exec");
-  if (krun_create_ctx == NULL || krun_start_enter == NULL || krun_set_vm_config == NULL || krun_set_root == NULL
-      || krun_set_exec == NULL)
-    {
-      fprintf (stderr, "could not find symbol in `libkrun.so`");
-      dlclose (handle);
-      return -1;
+      procs[n_procs].path = hooks[i]->path;
+      procs[n_procs].args = hooks[i]->args;
+      procs[n_procs].envp = hooks[i]->env;
+      procs[n_procs].timeout = hooks[i]->timeout;
+      n_procs++;
     }
 
-  /* If sched_getaffinity fails, default to 1 vcpu.  */
-  num_vcpus = 1;
-  /* If no memory limit is specified, default to 2G.  */
-  ram_mib = 2 * 1024;
-
-  if (def && def->linux && def->linux->resources && def->linux->resources->memory
-      && def->linux->resources->memory->limit_present)
-    ram_mib = def->linux->resources->memory->limit / (1024 * 1024);
+  if (n_procs == 0)
+    return 0;
 
-  CPU_ZERO (&set);
-  if (sched_getaffinity (getpid (), sizeof (set), &set) == 0)
-    num_vcpus = CPU_COUNT (&set);
+  ret = run_processes_with_stdin_timeout_envp (procs, n_procs, cwd, state, state_len, out_fd, err_fd, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-  ctx_id = krun_create_ctx ();
-  if (UNLIKELY (ctx_id < 0))
-    error (EXIT_FAILURE, -ret, "could not create krun context");
+  /* Report the failures in the order of the hooks.  */
+  for (i = 0; i < n_procs; i++)
+    {
+      if (procs[i].timed_out)
+        {
+          if (keep_going)
+            libcrun_warning ("timeout expired for `%s`", procs[i].path);
+          else
+            return crun_make_error (err, 0, "timeout expired for `%s`", procs[i].path);
+        }
+      else if (UNLIKELY (procs[i].exit_code != 0))
+        {
+          if (keep_going)
+            libcrun_warning ("error executing hook `%s` (exit code: %d)", procs[i].path, procs[i].exit_code);
+          else
+            {
+              libcrun_error (0, "error executing hook `%s` (exit code: %d)", procs[i].path, procs[i].exit_code);
+              return procs[i].exit_code;
+            }
+        }
+    }
 
-  ret = krun_set_vm_config (ctx_id, num_vcpus, ram_mib);
-  if (UNLIKELY (ret < 0))
-    error (EXIT_FAILURE, -ret, "could not set krun vm configuration");
+  return 0;
+}
 
-  ret = krun_set_root (ctx_id, "/");
-  if (UNLIKELY (ret < 0))
-    error (EXIT_FAILURE, -ret, "could not set krun root");
+static int
+run_hooks (runtime_spec_schema_config_schema *def, bool keep_going, pid_t pid, const char *id, const char *status,
+           const char *cwd, char *state, size_t state_len, hook **hooks, size_t hooks_len, int out_fd, int err_fd,
+           libcrun_error_t *err)
+{
+  cleanup_free char *cwd_allocated = NULL;
+  bool plugins = hooks_plugins_enabled (def);
+  size_t i;
+  int ret = 0;
 
-  if (krun_set_workdir && def && def->process && def->process->cwd)
+  if (cwd == NULL)
     {
-      ret = krun_set_workdir (ctx_id, def->process->cwd);
-      if (UNLIKELY (ret < 0))
-        error (EXIT_FAILURE, -ret, "could not set krun working directory");
+      cwd = cwd_allocated = getcwd (NULL, 0);
+      if (cwd == NULL)
+        OOM ();
     }
 
-  ret = krun_set_exec (ctx_id, pathname, &argv[1], NULL);
-  if (UNLIKELY (ret < 0))
-    error (EXIT_FAILURE, -ret, "could not set krun executable");
+  if (hooks_len > 1 && hooks_run_in_parallel (def))
+    return run_hooks_in_parallel (keep_going, plugins, pid, id, status, cwd, state, state_len, hooks, hooks_len, out_fd,
+                                  err_fd, err);
+
+  for (i = 0; i < hooks_len; i++)
+    {
+      if (plugins && libcrun_hook_is_plugin (hooks[i]->path))
+        ret = run_hook_plugin (hooks[i], pid, id, status, cwd, state, state_len, out_fd, err_fd, err);
+      else
+        ret = run_process_with_stdin_timeout_envp (hooks[i]->path, hooks[i]->args, cwd, hooks[i]->timeout,
+                                                   hooks[i]->env, state, state_len, out_fd, err_fd, err);
+      if (UNLIKELY (ret != 0))
+        {
+          if (keep_going)
+            libcrun_warning ("error executing hook `%s` (exit code: %d)", hooks[i]->path, ret);
+          else
+            {
+              libcrun_error (0, "error executing hook `%s` (exit code: %d)", hooks[i]->path, ret);
+              break;
+            }
+        }
+    }
 
-  return krun_start_enter (ctx_id);
+  return ret;
 }
-#endif
 
 static int
-libcrun_configure_libkrun (struct container_entrypoint_s *args, libcrun_error_t *err)
+do_hooks (runtime_spec_schema_config_schema *def, pid_t pid, const char *id, bool keep_going, const char *cwd,
+          const char *status, hook **hooks, size_t hooks_len, int out_fd, int err_fd, libcrun_error_t *err)
 {
-#if HAVE_DLOPEN && HAVE_LIBKRUN
-  void *handle;
-#endif
+  cleanup_free char *cwd_allocated = NULL;
+  cleanup_free char *state = NULL;
+  size_t state_len = 0;
+  int ret;
 
-#if HAVE_DLOPEN && HAVE_LIBKRUN
-  handle = dlopen ("libkrun.so", RTLD_NOW);
-  if (handle == NULL)
-    return crun_make_error (err, 0, "could not load `libkrun.so`: %s", dlerror ());
+  if (cwd == NULL)
+    {
+      cwd = cwd_allocated = getcwd (NULL, 0);
+      if (cwd == NULL)
+        OOM ();
+    }
 
-  args->exec_func = libkrun_do_exec;
-  args->exec_func_arg = handle;
+  ret = get_hooks_state (def, pid, id, cwd, status, &state, &state_len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-  return 0;
-#else
-  (void) args;
-  return crun_make_error (err, ENOTSUP, "libkrun or dlopen not present");
-#endif
+  return run_hooks (def, keep_going, pid, id, status, cwd, state, state_len, hooks, hooks_len, out_fd, err_fd, err);
 }
 
 static int
 libcrun_configure_handler (struct container_entrypoint_s *args, libcrun_error_t *err)
 {
+  struct custom_handler_s *handler;
   const char *annotation;
+  const char *name;
+  int ret;
+
   annotation = find_annotation (args->container, "run.oci.handler");
 
   /* Fail with EACCESS if global handler is already configured and there was a attempt to override it via spec. */
@@ -847,27 +1168,47 @@ libcrun_configure_handler (struct container_entrypoint_s *args, libcrun_error_t
       return crun_make_error (err, EACCES, "invalid attempt to override already configured global handler: %s", args->context->handler);
     }
 
-    /* In selection order global_handler takes more priority over handler configured via spec annotations. */
-    /* Check if crun is being invoked as krun via global_handler. */
-#if HAVE_DLOPEN && HAVE_LIBKRUN
-  if (args->context->handler != NULL && (strcmp (args->context->handler, "krun") == 0))
-    {
-      return libcrun_configure_libkrun (args, err);
-    }
-#endif
+  /* In selection order global_handler takes more priority over handler configured via spec annotations.  */
+  name = args->context->handler ? args->context->handler : annotation;
 
   /* Do nothing: no annotations or global_handler configured */
-  if (annotation == NULL)
+  if (name == NULL)
     return 0;
 
-  if (strcmp (annotation, "krun") == 0)
+  handler = libcrun_find_handler (name);
+  if (handler == NULL)
     {
-      /* set global_handler equivalent to "krun" so that we can mount kvm device */
-      args->context->handler = annotation;
-      return libcrun_configure_libkrun (args, err);
+      /* A global handler that is not available in this build is ignored, e.g. when crun is invoked as krun
+         without libkrun support.  */
+      if (annotation == NULL)
+        return 0;
+
+      if (strcmp (annotation, "krun") == 0)
+        return crun_make_error (err, ENOTSUP, "libkrun or dlopen not present");
+
+      return crun_make_error (err, EINVAL, "invalid handler specified `%s`", annotation);
     }
 
-  return crun_make_error (err, EINVAL, "invalid handler specified `%s`", annotation);
+  ret = handler->load (&args->custom_handler_cookie, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  args->custom_handler = handler;
+  args->exec_func = handler->exec_func;
+  args->exec_func_arg = args->custom_handler_cookie;
+
+  return 0;
+}
+
+/* Give the custom handler, if any, a chance to configure the container at PHASE.  */
+static int
+configure_custom_handler (struct container_entrypoint_s *args, enum handler_configure_phase phase,
+                          libcrun_error_t *err)
+{
+  if (args->custom_handler == NULL || args->custom_handler->configure_container == NULL)
+    return 0;
+
+  return args->custom_handler->configure_container (args->custom_handler_cookie, phase, args->container, err);
 }
 
 static int
@@ -1062,6 +1403,15 @@ exit:
   return yajl_error_to_crun_error (r, err);
 }
 
+/* The init process stops and waits for crun only when there are hooks
+   to run with the mounts in place.  Otherwise sync 2 is not sent and sync 3
+   only tells the init that the seccomp profile is ready.  */
+static bool
+need_prestart_sync (runtime_spec_schema_config_schema *def)
+{
+  return def->hooks && (def->hooks->prestart_len || def->hooks->create_runtime_len);
+}
+
 static int
 send_sync_cb (void *data, libcrun_error_t *err)
 {
@@ -1077,6 +1427,69 @@ send_sync_cb (void *data, libcrun_error_t *err)
   return sync_socket_wait_sync (NULL, sync_socket_fd, false, err);
 }
 
+/* Apply seccomp, when it doesn't need no_new_privs, move to the final user
+   namespace and set the capabilities of the container process.  */
+static int
+container_init_drop_privileges (struct container_entrypoint_s *entrypoint_args, pid_t own_pid, char *notify_socket,
+                                libcrun_error_t *err)
+{
+  libcrun_container_t *container = entrypoint_args->container;
+  runtime_spec_schema_config_schema *def = container->container_def;
+  runtime_spec_schema_config_schema_process_capabilities *capabilities;
+  int no_new_privs;
+  int ret;
+
+  if (def->process && ! def->process->no_new_privileges)
+    {
+      char **seccomp_flags = NULL;
+      size_t seccomp_flags_len = 0;
+      cleanup_free char *seccomp_fd_payload = NULL;
+      size_t seccomp_fd_payload_len = 0;
+
+      if (def->linux && def->linux->seccomp)
+        {
+          seccomp_flags = def->linux->seccomp->flags;
+          seccomp_flags_len = def->linux->seccomp->flags_len;
+        }
+
+      if (entrypoint_args->seccomp_receiver_fd >= 0)
+        {
+          ret = get_seccomp_receiver_fd_payload (container, "creating", own_pid, &seccomp_fd_payload, &seccomp_fd_payload_len, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+        }
+
+      ret = libcrun_apply_seccomp (entrypoint_args->seccomp_fd, entrypoint_args->seccomp_receiver_fd,
+                                   seccomp_fd_payload, seccomp_fd_payload_len, seccomp_flags, seccomp_flags_len, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      close_and_reset (&entrypoint_args->seccomp_fd);
+      close_and_reset (&entrypoint_args->seccomp_receiver_fd);
+    }
+
+  if (entrypoint_args->container->use_intermediate_userns)
+    {
+      ret = libcrun_create_final_userns (entrypoint_args->container, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  capabilities = def->process ? def->process->capabilities : NULL;
+  no_new_privs = def->process ? def->process->no_new_privileges : 1;
+  ret = libcrun_set_caps (capabilities, container->container_uid, container->container_gid, no_new_privs, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (notify_socket)
+    {
+      if (putenv (notify_socket) < 0)
+        return crun_make_error (err, errno, "putenv `%s`", notify_socket);
+    }
+
+  return 0;
+}
+
 /* Initialize the environment where the container process runs.
    It is used by the container init process.  */
 static int
@@ -1089,19 +1502,39 @@ container_init_setup (void *args, pid_t own_pid, char *notify_socket, int sync_s
   cleanup_close int console_socket = -1;
   cleanup_close int console_socketpair = -1;
   runtime_spec_schema_config_schema *def = container->container_def;
-  runtime_spec_schema_config_schema_process_capabilities *capabilities;
   cleanup_free char *rootfs = NULL;
-  int no_new_privs;
+  uint64_t trace_start;
 
   ret = libcrun_configure_handler (args, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
+  trace_start = libcrun_trace_begin ();
   ret = initialize_security (def->process, err);
   if (UNLIKELY (ret < 0))
     return ret;
+  libcrun_trace_end ("initialize-security", trace_start);
 
+  trace_start = libcrun_trace_begin ();
   ret = libcrun_configure_network (container, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  libcrun_trace_end ("configure-network", trace_start);
+
+  /* The network and the sysctls do not depend on the cgroup, so they are
+     configured while the parent moves the process to the cgroup.  */
+  trace_start = libcrun_trace_begin ();
+  ret = libcrun_set_sysctl (container, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  libcrun_trace_end ("sysctl", trace_start);
+
+  /* /sys is still the host one, so the nodes of the cpuset can be looked up.  */
+  ret = libcrun_set_numa_placement (container, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = libcrun_set_memory_policy (container, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
@@ -1130,24 +1563,20 @@ container_init_setup (void *args, pid_t own_pid, char *notify_socket, int sync_s
   if (has_terminal && entrypoint_args->context->console_socket)
     console_socket = entrypoint_args->console_socket_fd;
 
-  ret = libcrun_set_sysctl (container, err);
+  ret = configure_custom_handler (entrypoint_args, HANDLER_CONFIGURE_BEFORE_MOUNTS, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  /* sync 2 and 3 are sent as part of libcrun_set_mounts.  */
-  ret = libcrun_set_mounts (container, rootfs, send_sync_cb, &sync_socket, err);
+  /* sync 2 and 3 are sent as part of libcrun_set_mounts when there are hooks to run.  */
+  trace_start = libcrun_trace_begin ();
+  ret = libcrun_set_mounts (container, rootfs, need_prestart_sync (def) ? send_sync_cb : NULL, &sync_socket, err);
   if (UNLIKELY (ret < 0))
     return ret;
+  libcrun_trace_end ("mounts", trace_start);
 
-#if HAVE_DLOPEN && HAVE_LIBKRUN
-  /* explicitly configure kvm device if binary is invoked as krun */
-  if (entrypoint_args->context->handler != NULL && (strcmp (entrypoint_args->context->handler, "krun") == 0))
-    {
-      ret = libcrun_create_kvm_device (container, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
-    }
-#endif
+  ret = configure_custom_handler (entrypoint_args, HANDLER_CONFIGURE_AFTER_MOUNTS, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
   if (def->hooks && def->hooks->create_container_len)
     {
@@ -1196,6 +1625,20 @@ container_init_setup (void *args, pid_t own_pid, char *notify_socket, int sync_s
           return crun_make_error (err, errno, "putenv `%s`", def->process->env[i]);
     }
 
+  /* The listening sockets are the first preserved fds, see sd_listen_fds(3).  */
+  if (entrypoint_args->context->listen_fds > 0)
+    {
+      char value[32];
+
+      sprintf (value, "%d", entrypoint_args->context->listen_fds);
+      if (UNLIKELY (setenv ("LISTEN_FDS", value, 1) < 0))
+        return crun_make_error (err, errno, "setenv `LISTEN_FDS`");
+
+      sprintf (value, "%d", getpid ());
+      if (UNLIKELY (setenv ("LISTEN_PID", value, 1) < 0))
+        return crun_make_error (err, errno, "setenv `LISTEN_PID`");
+    }
+
   if (getenv ("HOME") == NULL)
     {
       ret = set_home_env (container->container_uid);
@@ -1264,58 +1707,24 @@ container_init_setup (void *args, pid_t own_pid, char *notify_socket, int sync_s
         return ret;
     }
 
-  if (def->process && def->process->user)
-    umask (def->process->user->umask_present ? def->process->user->umask : 0022);
-
-  if (def->process && ! def->process->no_new_privileges)
-    {
-      char **seccomp_flags = NULL;
-      size_t seccomp_flags_len = 0;
-      cleanup_free char *seccomp_fd_payload = NULL;
-      size_t seccomp_fd_payload_len = 0;
-
-      if (def->linux && def->linux->seccomp)
-        {
-          seccomp_flags = def->linux->seccomp->flags;
-          seccomp_flags_len = def->linux->seccomp->flags_len;
-        }
-
-      if (entrypoint_args->seccomp_receiver_fd >= 0)
-        {
-          ret = get_seccomp_receiver_fd_payload (container, "creating", own_pid, &seccomp_fd_payload, &seccomp_fd_payload_len, err);
-          if (UNLIKELY (ret < 0))
-            return ret;
-        }
-
-      ret = libcrun_apply_seccomp (entrypoint_args->seccomp_fd, entrypoint_args->seccomp_receiver_fd,
-                                   seccomp_fd_payload, seccomp_fd_payload_len, seccomp_flags, seccomp_flags_len, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
-
-      close_and_reset (&entrypoint_args->seccomp_fd);
-      close_and_reset (&entrypoint_args->seccomp_receiver_fd);
-    }
-
-  if (entrypoint_args->container->use_intermediate_userns)
+  if (! need_prestart_sync (def))
     {
-      ret = libcrun_create_final_userns (entrypoint_args->container, err);
+      /* sync 3.  Wait only here, so the profile is generated while the mounts are done.  */
+      ret = sync_socket_wait_sync (NULL, sync_socket, false, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
 
-  capabilities = def->process ? def->process->capabilities : NULL;
-  no_new_privs = def->process ? def->process->no_new_privileges : 1;
-  ret = libcrun_set_caps (capabilities, container->container_uid, container->container_gid, no_new_privs, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  if (def->process && def->process->user)
+    umask (def->process->user->umask_present ? def->process->user->umask : 0022);
 
-  if (notify_socket)
-    {
-      if (putenv (notify_socket) < 0)
-        return crun_make_error (err, errno, "putenv `%s`", notify_socket);
-    }
+  /* A template forks the new containers while it waits to be started, and
+     they still need the privileges to create their own namespaces.  The
+     template and the new containers drop them once started.  */
+  if (entrypoint_args->template_socket >= 0)
+    return 0;
 
-  return 0;
+  return container_init_drop_privileges (entrypoint_args, own_pid, notify_socket, err);
 }
 
 static int
@@ -1344,94 +1753,410 @@ open_hooks_output (libcrun_container_t *container, int *out_fd, int *err_fd, lib
   return 0;
 }
 
-/* Entrypoint to the container.  */
+static bool
+is_template (libcrun_container_t *container)
+{
+  const char *annotation = find_annotation (container, "run.oci.template");
+
+  return annotation && strcmp (annotation, "true") == 0;
+}
+
+static char *
+get_template_socket_path (const char *state_root, const char *id)
+{
+  cleanup_free char *dir = libcrun_get_state_directory (state_root, id);
+  char *path = NULL;
+
+  xasprintf (&path, "%s/template.sock", dir);
+  return path;
+}
+
 static int
-container_init (void *args, char *notify_socket, int sync_socket, libcrun_error_t *err)
+open_template_socket (const char *state_root, const char *id, libcrun_error_t *err)
 {
-  struct container_entrypoint_s *entrypoint_args = args;
+  cleanup_free char *path = get_template_socket_path (state_root, id);
+  cleanup_close int fd = -1;
   int ret;
-  runtime_spec_schema_config_schema *def = entrypoint_args->container->container_def;
-  cleanup_free const char *exec_path = NULL;
-  __attribute__ ((unused)) cleanup_free char *notify_socket_cleanup = notify_socket;
-  pid_t own_pid = 0;
 
-  entrypoint_args->sync_socket = sync_socket;
+  fd = open_unix_domain_socket (path, 0, err);
+  if (UNLIKELY (fd < 0))
+    return fd;
 
-  crun_set_output_handler (log_write_to_sync_socket, args, false);
+  ret = listen (fd, SOMAXCONN);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "listen on `%s`", path);
 
-  /* sync receive own pid.  */
-  ret = TEMP_FAILURE_RETRY (read (sync_socket, &own_pid, sizeof (own_pid)));
-  if (UNLIKELY (ret != sizeof (own_pid)))
-    {
-      if (ret >= 0)
-        errno = 0;
-      return crun_make_error (err, errno, "read from sync socket");
-    }
+  ret = fd;
+  fd = -1;
+  return ret;
+}
 
-  ret = container_init_setup (args, own_pid, notify_socket, sync_socket, &exec_path, err);
-  if (UNLIKELY (ret < 0))
-    {
-      /* If it fails to write the error using the sync socket, then fallback
-         to stderr.  */
-      if (sync_socket_write_error (sync_socket, err) < 0)
-        return ret;
+/* Maximum size of the request sent to a template: the hostname and the
+   environment variables of the new container.  */
+#define TEMPLATE_REQUEST_MAX_SIZE (64 * 1024)
+/* The exec fifo and the stdio of the new container.  */
+#define TEMPLATE_REQUEST_FDS 4
 
-      crun_error_release (err);
-      return ret;
-    }
+static int
+send_template_request (int conn, int *fds, const char *payload, size_t payload_len, libcrun_error_t *err)
+{
+  char ctrl_buf[CMSG_SPACE (sizeof (int) * TEMPLATE_REQUEST_FDS)] = {};
+  struct iovec iov = { .iov_base = (void *) payload, .iov_len = payload_len };
+  struct msghdr msg = {};
+  struct cmsghdr *cmsg;
+  int ret;
 
-  entrypoint_args->sync_socket = -1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl_buf;
+  msg.msg_controllen = sizeof (ctrl_buf);
 
-  ret = unblock_signals (err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (int) * TEMPLATE_REQUEST_FDS);
+  memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * TEMPLATE_REQUEST_FDS);
 
-  /* sync 4.  */
-  ret = sync_socket_send_sync (sync_socket, false, err);
+  ret = TEMP_FAILURE_RETRY (sendmsg (conn, &msg, 0));
   if (UNLIKELY (ret < 0))
-    return ret;
+    return crun_make_error (err, errno, "sendmsg");
+  return 0;
+}
 
-  close_and_reset (&sync_socket);
+static int
+receive_template_request (int conn, int *fds, char **payload, size_t *payload_len, libcrun_error_t *err)
+{
+  char ctrl_buf[CMSG_SPACE (sizeof (int) * TEMPLATE_REQUEST_FDS)] = {};
+  cleanup_free char *buffer = xmalloc (TEMPLATE_REQUEST_MAX_SIZE + 1);
+  struct iovec iov = { .iov_base = buffer, .iov_len = TEMPLATE_REQUEST_MAX_SIZE };
+  struct msghdr msg = {};
+  struct cmsghdr *cmsg;
+  ssize_t ret;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl_buf;
+  msg.msg_controllen = sizeof (ctrl_buf);
+
+  ret = TEMP_FAILURE_RETRY (recvmsg (conn, &msg, MSG_CMSG_CLOEXEC));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "recvmsg");
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN (sizeof (int) * TEMPLATE_REQUEST_FDS))
+    return crun_make_error (err, 0, "invalid request to the template");
+  memcpy (fds, CMSG_DATA (cmsg), sizeof (int) * TEMPLATE_REQUEST_FDS);
+
+  buffer[ret] = '\0';
+  *payload_len = ret;
+  *payload = buffer;
+  buffer = NULL;
+  return 0;
+}
 
-  if (entrypoint_args->context->fifo_exec_wait_fd >= 0)
-    {
-      char buffer[1];
-      fd_set read_set;
-      cleanup_close int fd = entrypoint_args->context->fifo_exec_wait_fd;
-      entrypoint_args->context->fifo_exec_wait_fd = -1;
+/* Set up the process for the new container created from a template.  */
+static int
+template_setup_instance (struct container_entrypoint_s *entrypoint_args, int conn, int *fds, const char *payload,
+                         size_t payload_len, libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = entrypoint_args->container->container_def;
+  const char *it;
+  int flags = 0;
+  size_t i;
+  pid_t pid;
+  int ret;
 
-      FD_ZERO (&read_set);
-      FD_SET (fd, &read_set);
-      do
+  if (def->linux)
+    for (i = 0; i < def->linux->namespaces_len; i++)
+      if (def->linux->namespaces[i]->path == NULL)
         {
-          ret = select (fd + 1, &read_set, NULL, NULL, NULL);
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "select");
+          int value = libcrun_find_namespace (def->linux->namespaces[i]->type);
+          if (value > 0)
+            flags |= value & (CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWUTS | CLONE_NEWIPC);
+        }
 
-          ret = TEMP_FAILURE_RETRY (read (fd, buffer, sizeof (buffer)));
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "read from the exec fifo");
-      } while (ret == 0);
+  /* Each container gets its own copy of the mounts of the template, where
+     it can mount its own /proc.  The rootfs is read-only, so nothing is
+     written to the tree shared with the template.  */
+  ret = unshare (flags | CLONE_NEWNS);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "unshare");
+
+  ret = mount (NULL, "/", NULL, MS_REC | MS_SLAVE, NULL);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "make `/` slave");
 
-      close_and_reset (&entrypoint_args->context->fifo_exec_wait_fd);
+  /* The new PID namespace is used by the children.  */
+  pid = fork ();
+  if (UNLIKELY (pid < 0))
+    return crun_make_error (err, errno, "fork");
+  if (pid)
+    _exit (EXIT_SUCCESS);
+
+  if (flags & CLONE_NEWPID)
+    {
+      ret = libcrun_template_instance_mount_proc (entrypoint_args->container, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
     }
 
-  crun_set_output_handler (log_write_to_stderr, NULL, false);
+  if (flags & CLONE_NEWNET)
+    {
+      ret = libcrun_configure_network (entrypoint_args->container, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
 
-  if (def->process && def->process->no_new_privileges)
+  it = payload;
+  if (it[0])
     {
-      char **seccomp_flags = NULL;
-      size_t seccomp_flags_len = 0;
-      cleanup_free char *seccomp_fd_payload = NULL;
-      size_t seccomp_fd_payload_len = 0;
+      if ((flags & CLONE_NEWUTS) == 0)
+        return crun_make_error (err, 0, "cannot set the hostname without a new UTS namespace");
 
-      if (def->linux && def->linux->seccomp)
-        {
-          seccomp_flags = def->linux->seccomp->flags;
-          seccomp_flags_len = def->linux->seccomp->flags_len;
-        }
+      ret = sethostname (it, strlen (it));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "sethostname");
+    }
+  for (it += strlen (it) + 1; it < payload + payload_len; it += strlen (it) + 1)
+    if (it[0] && putenv (xstrdup (it)) < 0)
+      return crun_make_error (err, errno, "putenv `%s`", it);
 
-      if (entrypoint_args->seccomp_receiver_fd >= 0)
+  for (i = 1; i < TEMPLATE_REQUEST_FDS; i++)
+    {
+      ret = dup2 (fds[i], i - 1);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "dup2");
+      close (fds[i]);
+    }
+
+  /* The client gets the PID of the new process from the credentials.  */
+  ret = TEMP_FAILURE_RETRY (write (conn, "1", 1));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "write to the template client");
+
+  return 0;
+}
+
+/* Create a new container from the template waiting to be started: fork a
+   process that gets its own PID, network, UTS and IPC namespaces, when the
+   template has them, and a copy of the mounts of the template.  The request
+   on CONN has the exec fifo for the new container, its stdio and a payload
+   with the hostname followed by the environment variables.
+   Returns 0 in the template process and 1 in the new container process,
+   where *FIFO_FD and *EVENT_FD are replaced with the ones of the new
+   container.  */
+static int
+template_fork_instance (struct container_entrypoint_s *entrypoint_args, int conn, int *fifo_fd, int *event_fd,
+                        libcrun_error_t *err)
+{
+  int fds[TEMPLATE_REQUEST_FDS] = { -1, -1, -1, -1 };
+  cleanup_free char *payload = NULL;
+  size_t payload_len, i;
+  pid_t pid;
+  int ret;
+
+  ret = receive_template_request (conn, fds, &payload, &payload_len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  pid = fork ();
+  if (pid != 0)
+    {
+      for (i = 0; i < TEMPLATE_REQUEST_FDS; i++)
+        close (fds[i]);
+      if (UNLIKELY (pid < 0))
+        return crun_make_error (err, errno, "fork");
+      return 0;
+    }
+
+  /* The client notices the failure from the closed connection.  */
+  ret = template_setup_instance (entrypoint_args, conn, fds, payload, payload_len, err);
+  if (UNLIKELY (ret < 0))
+    {
+      crun_error_release (err);
+      _exit (EXIT_FAILURE);
+    }
+
+  close_and_reset (fifo_fd);
+  close_and_reset (event_fd);
+  *fifo_fd = fds[0];
+  return 1;
+}
+
+/* Wait until the container is started, either through the start event or
+   by writing to the exec fifo.  A template also handles the requests to
+   create new containers meanwhile.  */
+static int
+wait_for_start (struct container_entrypoint_s *entrypoint_args, libcrun_error_t *err)
+{
+  cleanup_close int fd = entrypoint_args->context->fifo_exec_wait_fd;
+  cleanup_close int event_fd = entrypoint_args->context->start_event_fd;
+  cleanup_close int template_fd = entrypoint_args->template_socket;
+  char buffer[1];
+  int ret;
+
+  entrypoint_args->context->fifo_exec_wait_fd = -1;
+  entrypoint_args->context->start_event_fd = -1;
+  entrypoint_args->template_socket = -1;
+
+  while (1)
+    {
+      struct timeval timeout = {
+        .tv_sec = 1,
+      };
+      fd_set read_set;
+      int max_fd = fd;
+
+      FD_ZERO (&read_set);
+      FD_SET (fd, &read_set);
+      if (event_fd >= 0)
+        FD_SET (event_fd, &read_set);
+      if (template_fd >= 0)
+        FD_SET (template_fd, &read_set);
+      if (event_fd > max_fd)
+        max_fd = event_fd;
+      if (template_fd > max_fd)
+        max_fd = template_fd;
+
+      /* The template wakes up periodically to reap the processes it created.  */
+      ret = select (max_fd + 1, &read_set, NULL, NULL, template_fd >= 0 ? &timeout : NULL);
+      if (UNLIKELY (ret < 0))
+        {
+          if (errno == EINTR)
+            continue;
+          return crun_make_error (err, errno, "select");
+        }
+
+      if (template_fd >= 0)
+        while (waitpid (-1, NULL, WNOHANG) > 0)
+          ;
+
+      if (ret == 0)
+        continue;
+
+      if (event_fd >= 0 && FD_ISSET (event_fd, &read_set))
+        return 0;
+
+      if (template_fd >= 0 && FD_ISSET (template_fd, &read_set))
+        {
+          cleanup_close int conn = accept4 (template_fd, NULL, NULL, SOCK_CLOEXEC);
+
+          if (UNLIKELY (conn < 0))
+            continue;
+
+          ret = template_fork_instance (entrypoint_args, conn, &fd, &event_fd, err);
+          if (UNLIKELY (ret < 0))
+            crun_error_release (err);
+          if (ret == 1)
+            close_and_reset (&template_fd);
+          continue;
+        }
+
+      if (FD_ISSET (fd, &read_set))
+        {
+          ret = TEMP_FAILURE_RETRY (read (fd, buffer, sizeof (buffer)));
+          if (ret > 0)
+            return 0;
+
+          /* The fifo is non blocking: with nothing written yet, keep waiting
+             instead of leaving the loop.  */
+          if (ret < 0 && errno == EAGAIN)
+            continue;
+          if (UNLIKELY (ret < 0))
+            return crun_make_error (err, errno, "read from the exec fifo");
+        }
+    }
+}
+
+/* Entrypoint to the container.  */
+static int
+container_init (void *args, char *notify_socket, int sync_socket, libcrun_error_t *err)
+{
+  struct container_entrypoint_s *entrypoint_args = args;
+  int ret;
+  runtime_spec_schema_config_schema *def = entrypoint_args->container->container_def;
+  cleanup_free const char *exec_path = NULL;
+  __attribute__ ((unused)) cleanup_free char *notify_socket_cleanup = notify_socket;
+  pid_t own_pid = 0;
+  bool template = entrypoint_args->template_socket >= 0;
+
+  entrypoint_args->sync_socket = sync_socket;
+
+  /* The events recorded so far belong to the parent process.  */
+  libcrun_trace_reset (LIBCRUN_TRACE_TRACK_INIT);
+
+  crun_set_output_handler (log_write_to_sync_socket, args, false);
+
+  /* sync receive own pid.  */
+  ret = TEMP_FAILURE_RETRY (read (sync_socket, &own_pid, sizeof (own_pid)));
+  if (UNLIKELY (ret != sizeof (own_pid)))
+    {
+      if (ret >= 0)
+        errno = 0;
+      return crun_make_error (err, errno, "read from sync socket");
+    }
+
+  ret = container_init_setup (args, own_pid, notify_socket, sync_socket, &exec_path, err);
+  if (UNLIKELY (ret < 0))
+    {
+      /* If it fails to write the error using the sync socket, then fallback
+         to stderr.  */
+      if (sync_socket_write_error (sync_socket, err) < 0)
+        return ret;
+
+      crun_error_release (err);
+      return ret;
+    }
+
+  entrypoint_args->sync_socket = -1;
+
+  ret = unblock_signals (err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = sync_socket_send_trace (sync_socket, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  /* sync 4.  */
+  ret = sync_socket_send_sync (sync_socket, false, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  close_and_reset (&sync_socket);
+
+  if (entrypoint_args->context->fifo_exec_wait_fd >= 0)
+    {
+      ret = wait_for_start (entrypoint_args, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  crun_set_output_handler (log_write_to_stderr, NULL, false);
+
+  /* Both the template and the containers forked from it get here.  */
+  if (template)
+    {
+      ret = container_init_drop_privileges (entrypoint_args, own_pid, notify_socket, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  if (def->process && def->process->no_new_privileges)
+    {
+      char **seccomp_flags = NULL;
+      size_t seccomp_flags_len = 0;
+      cleanup_free char *seccomp_fd_payload = NULL;
+      size_t seccomp_fd_payload_len = 0;
+
+      if (def->linux && def->linux->seccomp)
+        {
+          seccomp_flags = def->linux->seccomp->flags;
+          seccomp_flags_len = def->linux->seccomp->flags_len;
+        }
+
+      if (entrypoint_args->seccomp_receiver_fd >= 0)
         {
           ret = get_seccomp_receiver_fd_payload (entrypoint_args->container, "creating", own_pid, &seccomp_fd_payload, &seccomp_fd_payload_len, err);
           if (UNLIKELY (ret < 0))
@@ -1484,9 +2209,136 @@ container_init (void *args, char *notify_socket, int sync_socket, libcrun_error_
   return crun_make_error (err, errno, "exec container process `%s`", exec_path);
 }
 
+/* Sections of the configuration for load_config_sections_from_file.  */
+enum
+{
+  CONFIG_SECTION_ROOT = 1 << 0,
+  CONFIG_SECTION_HOOKS = 1 << 1,
+  CONFIG_SECTION_ANNOTATIONS = 1 << 2,
+  /* linux, except linux.seccomp.  */
+  CONFIG_SECTION_LINUX = 1 << 3,
+};
+
+/* What is needed to run the hooks and to kill or delete a container.  */
+#define CONFIG_SECTIONS_LIFECYCLE \
+  (CONFIG_SECTION_ROOT | CONFIG_SECTION_HOOKS | CONFIG_SECTION_ANNOTATIONS | CONFIG_SECTION_LINUX)
+
+/* Load the configuration at PATH, building only the SECTIONS of it.  The
+   file is tokenized once, and the other sections, e.g. the mounts, the
+   process and the seccomp profile, are skipped.  The returned container
+   must be used only for what is in SECTIONS.  If SECTIONS is 0, or the
+   cache is enabled, the whole configuration is loaded.  */
+static libcrun_container_t *
+load_config_sections_from_file (const char *path, unsigned int sections, libcrun_error_t *err)
+{
+  const char *root_path[] = { "root", NULL };
+  const char *hooks_path[] = { "hooks", NULL };
+  const char *annotations_path[] = { "annotations", NULL };
+  const char *linux_path[] = { "linux", NULL };
+  runtime_spec_schema_config_schema *container_def = NULL;
+  struct parser_context ctx = { 0, stderr };
+  cleanup_free char *content = NULL;
+  parser_error parser_err = NULL;
+  libcrun_container_t *container = NULL;
+  uint64_t trace_start;
+  yajl_val tree = NULL;
+  yajl_val v;
+  size_t len;
+  int ret;
+
+  if (sections == 0 || config_cache_enabled)
+    return libcrun_container_load_from_file (path, err);
+
+  trace_start = libcrun_trace_begin ();
+
+  ret = read_all_file (path, &content, &len, err);
+  if (UNLIKELY (ret < 0))
+    return NULL;
+
+  ret = parse_json_file (&tree, content, &ctx, err);
+  if (UNLIKELY (ret < 0))
+    {
+      crun_error_wrap (err, "load `%s`", path);
+      return NULL;
+    }
+
+  container_def = xmalloc0 (sizeof (*container_def));
+
+  v = yajl_tree_get (tree, root_path, yajl_t_object);
+  if ((sections & CONFIG_SECTION_ROOT) && v)
+    {
+      container_def->root = make_runtime_spec_schema_config_schema_root (v, &ctx, &parser_err);
+      if (UNLIKELY (container_def->root == NULL))
+        goto fail;
+    }
+
+  v = yajl_tree_get (tree, hooks_path, yajl_t_object);
+  if ((sections & CONFIG_SECTION_HOOKS) && v)
+    {
+      container_def->hooks = make_runtime_spec_schema_config_schema_hooks (v, &ctx, &parser_err);
+      if (UNLIKELY (container_def->hooks == NULL))
+        goto fail;
+    }
+
+  v = yajl_tree_get (tree, annotations_path, yajl_t_object);
+  if ((sections & CONFIG_SECTION_ANNOTATIONS) && v)
+    {
+      container_def->annotations = make_json_map_string_string (v, &ctx, &parser_err);
+      if (UNLIKELY (container_def->annotations == NULL))
+        goto fail;
+    }
+
+  v = yajl_tree_get (tree, linux_path, yajl_t_object);
+  if ((sections & CONFIG_SECTION_LINUX) && v)
+    {
+      bool hidden = false;
+      size_t i;
+
+      /* The seccomp profile is usually the biggest section, hide it from
+         the parser by moving it past the end of the object.  */
+      for (i = 0; i < v->u.object.len; i++)
+        if (strcmp (v->u.object.keys[i], "seccomp") == 0)
+          {
+            const char *key = v->u.object.keys[i];
+            yajl_val value = v->u.object.values[i];
+            size_t last = v->u.object.len - 1;
+
+            v->u.object.keys[i] = v->u.object.keys[last];
+            v->u.object.values[i] = v->u.object.values[last];
+            v->u.object.keys[last] = key;
+            v->u.object.values[last] = value;
+            v->u.object.len--;
+            hidden = true;
+            break;
+          }
+
+      container_def->linux = make_runtime_spec_schema_config_linux (v, &ctx, &parser_err);
+
+      /* Restore it, so that it is freed with the tree.  */
+      if (hidden)
+        v->u.object.len++;
+
+      if (UNLIKELY (container_def->linux == NULL))
+        goto fail;
+    }
+
+  container = make_container (container_def);
+  container_def = NULL;
+
+fail:
+  libcrun_trace_end ("load-config", trace_start);
+  if (container == NULL)
+    crun_make_error (err, 0, "load `%s`: %s", path, parser_err ? parser_err : "invalid configuration");
+  if (container_def)
+    free_runtime_spec_schema_config_schema (container_def);
+  free (parser_err);
+  yajl_tree_free (tree);
+  return container;
+}
+
 static int
 read_container_config_from_state (libcrun_container_t **container, const char *state_root, const char *id,
-                                  libcrun_error_t *err)
+                                  unsigned int sections, libcrun_error_t *err)
 {
   cleanup_free char *config_file = NULL;
   cleanup_free char *dir = NULL;
@@ -1502,7 +2354,7 @@ read_container_config_from_state (libcrun_container_t **container, const char *s
   if (UNLIKELY (ret < 0))
     return ret;
 
-  *container = libcrun_container_load_from_file (config_file, err);
+  *container = load_config_sections_from_file (config_file, sections, err);
   if (*container == NULL)
     return crun_make_error (err, 0, "error loading `%s`", config_file);
 
@@ -1520,7 +2372,8 @@ run_poststop_hooks (libcrun_context_t *context, libcrun_container_t *container,
     {
       if (container == NULL)
         {
-          ret = read_container_config_from_state (&container_cleanup, state_root, id, err);
+          ret = read_container_config_from_state (&container_cleanup, state_root, id, CONFIG_SECTIONS_LIFECYCLE,
+                                                 err);
           if (UNLIKELY (ret < 0))
             return ret;
           container = container_cleanup;
@@ -1536,7 +2389,8 @@ run_poststop_hooks (libcrun_context_t *context, libcrun_container_t *container,
 
       if (container == NULL)
         {
-          ret = read_container_config_from_state (&container_cleanup, state_root, id, err);
+          ret = read_container_config_from_state (&container_cleanup, state_root, id, CONFIG_SECTIONS_LIFECYCLE,
+                                                 err);
           if (UNLIKELY (ret < 0))
             return ret;
           container = container_cleanup;
@@ -1570,9 +2424,12 @@ has_new_pid_namespace (runtime_spec_schema_config_schema *def)
   return false;
 }
 
+/* Delete the container ID.  With FORCE and KILLALL, its processes are killed
+   first.  DESTROY_CGROUP is false when the caller already destroyed the
+   cgroup of the container.  */
 static int
 container_delete_internal (libcrun_context_t *context, runtime_spec_schema_config_schema *def, const char *id,
-                           bool force, bool killall, libcrun_error_t *err)
+                           bool force, bool killall, bool destroy_cgroup, libcrun_error_t *err)
 {
   int ret;
   cleanup_container_status libcrun_container_status_t status = {};
@@ -1609,7 +2466,7 @@ container_delete_internal (libcrun_context_t *context, runtime_spec_schema_confi
         {
           if (def == NULL)
             {
-              ret = read_container_config_from_state (&container, state_root, id, err);
+              ret = read_container_config_from_state (&container, state_root, id, CONFIG_SECTIONS_LIFECYCLE, err);
               if (UNLIKELY (ret < 0))
                 return ret;
 
@@ -1639,7 +2496,7 @@ container_delete_internal (libcrun_context_t *context, runtime_spec_schema_confi
         }
     }
 
-  if (status.cgroup_path)
+  if (destroy_cgroup && status.cgroup_path)
     {
       int manager;
 
@@ -1653,6 +2510,10 @@ container_delete_internal (libcrun_context_t *context, runtime_spec_schema_confi
   if (UNLIKELY (ret < 0))
     crun_error_write_warning_and_release (context->output_handler_arg, &err);
 
+  ret = libcrun_userns_pool_release (state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    crun_error_write_warning_and_release (context->output_handler_arg, &err);
+
   return libcrun_container_delete_status (state_root, id, err);
 }
 
@@ -1660,43 +2521,201 @@ int
 libcrun_container_delete (libcrun_context_t *context, runtime_spec_schema_config_schema *def, const char *id,
                           bool force, libcrun_error_t *err)
 {
-  return container_delete_internal (context, def, id, force, true, err);
+  return container_delete_internal (context, def, id, force, true, true, err);
 }
 
-int
-libcrun_container_kill (libcrun_context_t *context, const char *id, int signal, libcrun_error_t *err)
+/* Kill the processes of the container ID, if it is still running, and load
+   its configuration in *CONTAINER.  If only the init process is killed,
+   *PIDFD is set to a pidfd for it, or -1 if it cannot be waited for.
+   Returns 1 if the processes were killed and STATUS was read.  */
+static int
+kill_container_for_delete (libcrun_context_t *context, const char *id, libcrun_container_status_t *status,
+                           libcrun_container_t **container, int *pidfd, libcrun_error_t *err)
 {
   int ret;
-  const char *state_root = context->state_root;
-  cleanup_container_status libcrun_container_status_t status = {};
 
-  ret = libcrun_read_container_status (&status, state_root, id, err);
+  *pidfd = -1;
+
+  ret = libcrun_read_container_status (status, context->state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    {
+      /* Let the delete report it.  */
+      crun_error_release (err);
+      return 0;
+    }
+
+  ret = read_container_config_from_state (container, context->state_root, id, CONFIG_SECTIONS_LIFECYCLE, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  return libcrun_kill_linux (&status, signal, err);
+  if (has_new_pid_namespace ((*container)->container_def))
+    {
+      ret = libcrun_kill_linux_with_pidfd (status, SIGKILL, pidfd, err);
+      if (UNLIKELY (ret < 0))
+        {
+          if (crun_error_get_errno (err) != ESRCH)
+            return ret;
+          crun_error_release (err);
+        }
+    }
+  else if (status->cgroup_path)
+    {
+      ret = libcrun_cgroup_killall (status->cgroup_path, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+  return 1;
 }
 
-int
-libcrun_container_kill_all (libcrun_context_t *context, const char *id, int signal, libcrun_error_t *err)
+/* Wait for the processes behind the N_FDS pidfds in FDS to exit.  A pidfd
+   becomes readable when the process exits.  Give up after a while, the
+   cgroups are destroyed anyway.  The pidfds are closed.  */
+static void
+wait_for_pidfds (struct pollfd *fds, size_t n_fds)
 {
+  size_t i, pending;
   int ret;
-  const char *state_root = context->state_root;
-  cleanup_container_status libcrun_container_status_t status = {};
 
-  ret = libcrun_read_container_status (&status, state_root, id, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  for (pending = n_fds; pending > 0;)
+    {
+      ret = poll (fds, n_fds, 10000);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        break;
 
-  ret = libcrun_cgroup_killall_signal (status.cgroup_path, signal, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
-  return 0;
+      for (i = 0; i < n_fds; i++)
+        if (fds[i].fd >= 0 && fds[i].revents)
+          {
+            close (fds[i].fd);
+            fds[i].fd = -1;
+            pending--;
+          }
+    }
+
+  for (i = 0; i < n_fds; i++)
+    if (fds[i].fd >= 0)
+      close (fds[i].fd);
 }
 
-static int
-write_container_status (libcrun_container_t *container, libcrun_context_t *context, pid_t pid, char *cgroup_path,
-                        char *scope, char *created, libcrun_error_t *err)
+/* Delete the N_IDS containers in IDS.  With FORCE, the processes of all the
+   containers are killed first and the init processes are waited for all
+   together, then all the cgroups are destroyed together, so the systemd
+   scopes are stopped with a single wait.  A container that cannot be killed
+   this way goes through the whole delete, that kills its processes again.
+   An error for a container is reported as a warning and does not stop the
+   others, the return value is the first error.  */
+int
+libcrun_container_delete_many (libcrun_context_t *context, char **ids, size_t n_ids, bool force, libcrun_error_t *err)
+{
+  cleanup_free libcrun_container_t **containers = NULL;
+  cleanup_free libcrun_container_status_t *statuses = NULL;
+  cleanup_free bool *killed = NULL;
+  size_t i;
+  int ret, first_error = 0;
+
+  containers = xmalloc0 (sizeof (*containers) * (n_ids + 1));
+  statuses = xmalloc0 (sizeof (*statuses) * (n_ids + 1));
+  killed = xmalloc0 (sizeof (*killed) * (n_ids + 1));
+
+  if (force)
+    {
+      cleanup_free struct pollfd *fds = xmalloc0 (sizeof (*fds) * (n_ids + 1));
+      cleanup_free const char **paths = xmalloc0 (sizeof (char *) * (n_ids + 1));
+      cleanup_free const char **scopes = xmalloc0 (sizeof (char *) * (n_ids + 1));
+      cleanup_free int *managers = xmalloc0 (sizeof (int) * (n_ids + 1));
+      size_t n_fds = 0, n_paths = 0;
+
+      for (i = 0; i < n_ids; i++)
+        {
+          int pidfd;
+
+          ret = kill_container_for_delete (context, ids[i], &statuses[i], &containers[i], &pidfd, err);
+          if (UNLIKELY (ret < 0))
+            crun_error_write_warning_and_release (context->output_handler_arg, &err);
+          killed[i] = ret > 0;
+
+          if (pidfd >= 0)
+            {
+              fds[n_fds].fd = pidfd;
+              fds[n_fds].events = POLLIN;
+              n_fds++;
+            }
+        }
+
+      wait_for_pidfds (fds, n_fds);
+
+      for (i = 0; i < n_ids; i++)
+        if (killed[i] && statuses[i].cgroup_path)
+          {
+            paths[n_paths] = statuses[i].cgroup_path;
+            scopes[n_paths] = statuses[i].scope;
+            managers[n_paths] = statuses[i].systemd_cgroup ? CGROUP_MANAGER_SYSTEMD : CGROUP_MANAGER_CGROUPFS;
+            n_paths++;
+          }
+
+      ret = libcrun_cgroup_destroy_many (paths, scopes, managers, n_paths, err);
+      if (UNLIKELY (ret < 0))
+        crun_error_write_warning_and_release (context->output_handler_arg, &err);
+    }
+
+  for (i = 0; i < n_ids; i++)
+    {
+      runtime_spec_schema_config_schema *def = containers[i] ? containers[i]->container_def : NULL;
+
+      /* Kill again, and destroy the cgroup, only the containers that were
+         not already handled above.  */
+      ret = container_delete_internal (context, def, ids[i], force, ! killed[i], ! killed[i], err);
+      if (UNLIKELY (ret < 0))
+        {
+          if (first_error == 0)
+            first_error = crun_error_get_errno (err) ? -crun_error_get_errno (err) : -1;
+          crun_error_write_warning_and_release (context->output_handler_arg, &err);
+        }
+      libcrun_container_free (containers[i]);
+      libcrun_free_container_status (&statuses[i]);
+    }
+
+  if (UNLIKELY (first_error < 0))
+    return crun_make_error (err, -first_error, "could not delete all the containers");
+
+  return 0;
+}
+
+int
+libcrun_container_kill (libcrun_context_t *context, const char *id, int signal, libcrun_error_t *err)
+{
+  int ret;
+  const char *state_root = context->state_root;
+  cleanup_container_status libcrun_container_status_t status = {};
+
+  ret = libcrun_read_container_status (&status, state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return libcrun_kill_linux (&status, signal, err);
+}
+
+int
+libcrun_container_kill_all (libcrun_context_t *context, const char *id, int signal, libcrun_error_t *err)
+{
+  int ret;
+  const char *state_root = context->state_root;
+  cleanup_container_status libcrun_container_status_t status = {};
+
+  ret = libcrun_read_container_status (&status, state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = libcrun_cgroup_killall_signal (status.cgroup_path, signal, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  return 0;
+}
+
+static int
+write_container_status (libcrun_container_t *container, libcrun_context_t *context, pid_t pid, char *cgroup_path,
+                        char *scope, char *created, libcrun_error_t *err)
 {
   cleanup_free char *cwd = getcwd (NULL, 0);
   cleanup_free char *owner = get_user_name (geteuid ());
@@ -1711,7 +2730,8 @@ write_container_status (libcrun_container_t *container, libcrun_context_t *conte
                                         .owner = owner,
                                         .systemd_cgroup = context->systemd_cgroup,
                                         .detached = context->detach,
-                                        .external_descriptors = external_descriptors };
+                                        .external_descriptors = external_descriptors,
+                                        .start_fd = context->start_event_fd > 0 ? context->start_event_fd : 0 };
   if (cwd == NULL)
     OOM ();
   return libcrun_write_container_status (context->state_root, context->id, &status, err);
@@ -1778,1274 +2798,2793 @@ handle_notify_socket (int notify_socketfd, libcrun_error_t *err)
 #endif
 }
 
-static int
-wait_for_process (pid_t pid, libcrun_context_t *context, int terminal_fd, int notify_socket, int container_ready_fd,
-                  int seccomp_notify_fd, const char *seccomp_notify_plugins, libcrun_error_t *err)
+struct wait_for_process_s
 {
-  cleanup_close int epollfd = -1;
-  cleanup_close int signalfd = -1;
-  int ret, container_exit_code = 0, last_process;
-  sigset_t mask;
-  int fds[10];
-  int levelfds[10];
-  int levelfds_len = 0;
-  int fds_len = 0;
-  cleanup_seccomp_notify_context struct seccomp_notify_context_s *seccomp_notify_ctx = NULL;
+  pid_t pid;
+  libcrun_context_t *context;
+  int terminal_fd;
+  int container_exit_code;
+  libcrun_console_relay_t *console_relay;
+  struct seccomp_notify_context_s *seccomp_notify_ctx;
+  libcrun_cgroup_events_t *cgroup_events;
+  int cgroup_events_failures;
+  libcrun_container_t *container;
+};
 
-  container_exit_code = 0;
+/* Stop watching the cgroup events after this many consecutive read failures,
+   so that a persistent error does not keep the level-triggered source busy.  */
+#define CGROUP_EVENTS_MAX_FAILURES 8
 
-  if (context->pid_file)
-    {
-      char buf[12];
-      size_t buf_len = sprintf (buf, "%d", pid);
-      ret = write_file_with_flags (context->pid_file, O_CREAT | O_TRUNC, buf, buf_len, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
-    }
+static int
+handle_terminal_input (libcrun_event_loop_t *loop arg_unused, int fd, void *arg, libcrun_error_t *err)
+{
+  struct wait_for_process_s *w = arg;
+  int ret;
 
-  /* Also exit if there is nothing more to wait for.  */
-  if (context->detach && notify_socket < 0)
-    return 0;
+  ret = copy_from_fd_to_fd (fd, w->terminal_fd, 0, err);
+  if (UNLIKELY (ret < 0))
+    return crun_error_wrap (err, "copy to terminal fd");
+  return 0;
+}
 
-  if (container_ready_fd >= 0)
-    {
-      ret = 0;
-      TEMP_FAILURE_RETRY (write (container_ready_fd, &ret, sizeof (ret)));
-      close_and_reset (&container_ready_fd);
-    }
+static int
+handle_terminal_output (libcrun_event_loop_t *loop arg_unused, int fd, void *arg arg_unused, libcrun_error_t *err)
+{
+  int ret;
 
-  sigfillset (&mask);
-  ret = sigprocmask (SIG_BLOCK, &mask, NULL);
+  ret = set_blocking_fd (fd, 0, err);
   if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "sigprocmask");
+    return crun_error_wrap (err, "set terminal fd not blocking");
 
-  signalfd = create_signalfd (&mask, err);
-  if (UNLIKELY (signalfd < 0))
-    return signalfd;
+  ret = copy_from_fd_to_fd (fd, 1, 1, err);
+  if (UNLIKELY (ret < 0))
+    return crun_error_wrap (err, "copy from terminal fd");
 
-  ret = reap_subprocesses (pid, &container_exit_code, &last_process, err);
+  ret = set_blocking_fd (fd, 1, err);
   if (UNLIKELY (ret < 0))
-    return ret;
+    return crun_error_wrap (err, "set terminal fd blocking");
+  return 0;
+}
 
-  if (last_process)
-    return container_exit_code;
+static int
+handle_console_relay (libcrun_event_loop_t *loop arg_unused, int fd arg_unused, void *arg, libcrun_error_t *err)
+{
+  struct wait_for_process_s *w = arg;
 
-  if (seccomp_notify_fd >= 0)
-    {
-      cleanup_free char *state_root = NULL;
-      cleanup_free char *oci_config_path = NULL;
+  return libcrun_console_relay_pump (w->console_relay, err);
+}
 
-      struct libcrun_load_seccomp_notify_conf_s conf;
-      memset (&conf, 0, sizeof conf);
+static int
+handle_seccomp_notify (libcrun_event_loop_t *loop arg_unused, int fd, void *arg, libcrun_error_t *err)
+{
+  struct wait_for_process_s *w = arg;
 
-      state_root = libcrun_get_state_directory (context->state_root, context->id);
-      if (UNLIKELY (state_root == NULL))
-        return crun_make_error (err, 0, "cannot get state directory");
+  return libcrun_seccomp_notify_plugins (w->seccomp_notify_ctx, fd, err);
+}
 
-      ret = append_paths (&oci_config_path, err, state_root, "config.json", NULL);
-      if (UNLIKELY (ret < 0))
-        return ret;
+static int
+handle_cgroup_events (libcrun_event_loop_t *loop, int fd, void *arg, libcrun_error_t *err)
+{
+  struct wait_for_process_s *w = arg;
+  int mask;
+  int ret;
 
-      conf.runtime_root_path = state_root;
-      conf.name = context->id;
-      conf.bundle_path = context->bundle;
-      conf.oci_config_path = oci_config_path;
+  /* The cgroup events are only informative: a failure to read them must not
+     stop the supervision of the container process.  */
+  ret = libcrun_cgroup_events_read (w->cgroup_events, &mask, err);
+  if (UNLIKELY (ret < 0))
+    {
+      libcrun_warning ("cannot read the cgroup events: %s", (*err)->msg);
+      crun_error_release (err);
 
-      ret = set_blocking_fd (seccomp_notify_fd, 0, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      if (++w->cgroup_events_failures >= CGROUP_EVENTS_MAX_FAILURES)
+        {
+          libcrun_warning ("stop watching the cgroup events");
+          ret = libcrun_event_loop_remove (loop, fd, err);
+          if (UNLIKELY (ret < 0))
+            libcrun_error_write_warning_and_release (stderr, &err);
+        }
+      return 0;
+    }
+  w->cgroup_events_failures = 0;
+  if (mask & LIBCRUN_CGROUP_EVENT_OOM)
+    libcrun_warning ("OOM: the OOM killer was invoked in the container cgroup");
+  return 0;
+}
 
-      ret = libcrun_load_seccomp_notify_plugins (&seccomp_notify_ctx, seccomp_notify_plugins, &conf, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+static int
+handle_notify_socket_event (libcrun_event_loop_t *loop, int fd, void *arg, libcrun_error_t *err)
+{
+  struct wait_for_process_s *w = arg;
+  int ret;
 
-      fds[fds_len++] = seccomp_notify_fd;
-    }
+  ret = handle_notify_socket (fd, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  if (ret && w->context->detach)
+    libcrun_event_loop_stop (loop, 0);
+  return 0;
+}
 
-  fds[fds_len++] = signalfd;
-  if (notify_socket >= 0)
-    fds[fds_len++] = notify_socket;
-  if (terminal_fd >= 0)
-    {
-      fds[fds_len++] = 0;
-      levelfds[levelfds_len++] = terminal_fd;
-    }
-  fds[fds_len++] = -1;
-  levelfds[levelfds_len++] = -1;
+static int
+handle_signal (libcrun_event_loop_t *loop, int fd, void *arg, libcrun_error_t *err)
+{
+  struct wait_for_process_s *w = arg;
+  struct signalfd_siginfo si;
+  int ret, last_process;
+  ssize_t res;
 
-  epollfd = epoll_helper (fds, levelfds, err);
-  if (UNLIKELY (epollfd < 0))
-    return epollfd;
+  res = TEMP_FAILURE_RETRY (read (fd, &si, sizeof (si)));
+  if (UNLIKELY (res < 0))
+    return crun_make_error (err, errno, "read from signalfd");
 
-  while (1)
+  if (si.ssi_signo != SIGCHLD)
     {
-      struct signalfd_siginfo si;
-      ssize_t res;
-      struct epoll_event events[10];
-      int i, nr_events;
+      /* Send any other signal to the child process.  */
+      kill (w->pid, si.ssi_signo);
+      return 0;
+    }
+
+  ret = reap_subprocesses (w->pid, &w->container_exit_code, &last_process, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  if (last_process)
+    libcrun_event_loop_stop (loop, w->container_exit_code);
+  return 0;
+}
 
-      nr_events = TEMP_FAILURE_RETRY (epoll_wait (epollfd, events, 10, -1));
-      if (UNLIKELY (nr_events < 0))
-        return crun_make_error (err, errno, "epoll_wait");
+/* Release as much memory as possible before the monitor goes idle: give
+   back the free heap and ask the kernel to reclaim the pages mapped only
+   by this process.  The pages shared with other processes, e.g. the text
+   of the libraries, are left untouched by MADV_PAGEOUT.  Anonymous pages
+   go only to swap, so without swap only the file backed pages are
+   reclaimed.  This runs once: the pages faulted in later to handle the
+   events stay resident.  */
+static void
+shrink_monitor_memory (void)
+{
+  char *maps = NULL;
+  libcrun_error_t tmp_err = NULL;
+  char *saveptr = NULL;
+  char *line;
+  size_t len;
+  int ret;
 
-      for (i = 0; i < nr_events; i++)
+  ret = read_all_file ("/proc/self/maps", &maps, &len, &tmp_err);
+  if (UNLIKELY (ret < 0))
+    crun_error_release (&tmp_err);
+  else
+    {
+      for (line = strtok_r (maps, "\n", &saveptr); line; line = strtok_r (NULL, "\n", &saveptr))
         {
-          if (events[i].data.fd == 0)
-            {
-              ret = copy_from_fd_to_fd (0, terminal_fd, 0, err);
-              if (UNLIKELY (ret < 0))
-                return crun_error_wrap (err, "copy to terminal fd");
-            }
-          else if (events[i].data.fd == seccomp_notify_fd)
-            {
-              ret = libcrun_seccomp_notify_plugins (seccomp_notify_ctx, seccomp_notify_fd, err);
-              if (UNLIKELY (ret < 0))
-                return ret;
-            }
-          else if (events[i].data.fd == terminal_fd)
-            {
-              ret = set_blocking_fd (terminal_fd, 0, err);
-              if (UNLIKELY (ret < 0))
-                return crun_error_wrap (err, "set terminal fd not blocking");
+          unsigned long start, end;
 
-              ret = copy_from_fd_to_fd (terminal_fd, 1, 1, err);
-              if (UNLIKELY (ret < 0))
-                return crun_error_wrap (err, "copy from terminal fd");
+          /* The stack is in use, and the special mappings cannot be reclaimed.  */
+          if (strstr (line, "[stack]") || strstr (line, "[v"))
+            continue;
 
-              ret = set_blocking_fd (terminal_fd, 1, err);
-              if (UNLIKELY (ret < 0))
-                return crun_error_wrap (err, "set terminal fd blocking");
-            }
-          else if (events[i].data.fd == notify_socket)
-            {
-              ret = handle_notify_socket (notify_socket, err);
-              if (UNLIKELY (ret < 0))
-                return ret;
-              if (ret && context->detach)
-                return 0;
-            }
-          else if (events[i].data.fd == signalfd)
-            {
-              res = TEMP_FAILURE_RETRY (read (signalfd, &si, sizeof (si)));
-              if (UNLIKELY (res < 0))
-                return crun_make_error (err, errno, "read from signalfd");
-              if (si.ssi_signo == SIGCHLD)
-                {
-                  ret = reap_subprocesses (pid, &container_exit_code, &last_process, err);
-                  if (UNLIKELY (ret < 0))
-                    return ret;
-                  if (last_process)
-                    return container_exit_code;
-                }
-              else
-                {
-                  /* Send any other signal to the child process.  */
-                  ret = kill (pid, si.ssi_signo);
-                }
-            }
-          else
-            {
-              return crun_make_error (err, 0, "unknown fd from epoll_wait");
-            }
+          if (sscanf (line, "%lx-%lx", &start, &end) != 2)
+            continue;
+
+          /* Errors are ignored, it is only an optimization.  */
+          (void) madvise ((void *) start, end - start, MADV_PAGEOUT);
         }
     }
 
-  return 0;
+  /* Freed before the heap is trimmed.  */
+  free (maps);
+
+#ifdef HAVE_MALLOC_TRIM
+  malloc_trim (0);
+#endif
 }
 
-static void
-flush_fd_to_err (libcrun_context_t *context, int terminal_fd)
+/* The monitor of a container running in the foreground can serve the exec
+   requests for it, when the run.oci.exec_server annotation is set.  A
+   request is a 32 bits length carrying the stdin, stdout and stderr of the
+   client as SCM_RIGHTS, followed by the process JSON.  The reply is the 32
+   bits exit status of the process, or -1 followed by the error message.  */
+#define EXEC_SERVER_SOCKET "exec.sock"
+#define EXEC_SERVER_MAX_REQUEST_SIZE (1 << 20)
+#define EXEC_SERVER_REQUEST_FDS 3
+
+static int container_exec_internal (libcrun_context_t *context, libcrun_container_t *container,
+                                    libcrun_container_status_t *status,
+                                    runtime_spec_schema_config_schema_process *process, libcrun_error_t *err);
+
+static int
+read_exec_request (int fd, char **payload, int *fds, libcrun_error_t *err)
 {
-  char buf[256];
-  int flags;
-  if (terminal_fd < 0 || stderr == NULL)
-    return;
+  char ctrl_buf[CMSG_SPACE (sizeof (int) * EXEC_SERVER_REQUEST_FDS)] = {};
+  struct cmsghdr *cmsg;
+  struct msghdr msg = {};
+  struct iovec iov;
+  uint32_t len;
+  size_t done = 0;
+  ssize_t ret;
+
+  iov.iov_base = &len;
+  iov.iov_len = sizeof (len);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl_buf;
+  msg.msg_controllen = sizeof (ctrl_buf);
+
+  ret = TEMP_FAILURE_RETRY (recvmsg (fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "recvmsg");
+  if (UNLIKELY (ret != sizeof (len)))
+    return crun_make_error (err, 0, "short read for the exec request header");
 
-  flags = fcntl (terminal_fd, F_GETFL, 0);
-  if (flags == -1)
-    return;
-  if (fcntl (terminal_fd, F_SETFL, flags | O_NONBLOCK) < 0)
-    return;
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN (sizeof (int) * EXEC_SERVER_REQUEST_FDS))
+    return crun_make_error (err, 0, "the exec request must carry %d file descriptors", EXEC_SERVER_REQUEST_FDS);
+  memcpy (fds, CMSG_DATA (cmsg), sizeof (int) * EXEC_SERVER_REQUEST_FDS);
 
-  for (;;)
+  if (UNLIKELY (len == 0 || len > EXEC_SERVER_MAX_REQUEST_SIZE))
+    return crun_make_error (err, 0, "invalid exec request size `%u`", len);
+
+  *payload = xmalloc (len + 1);
+  while (done < len)
     {
-      int ret = TEMP_FAILURE_RETRY (read (terminal_fd, buf, sizeof (buf) - 1));
-      if (ret <= 0)
-        break;
-      buf[ret] = '\0';
-      if (context->output_handler)
-        context->output_handler (0, buf, false, context->output_handler_arg);
+      ret = TEMP_FAILURE_RETRY (read (fd, *payload + done, len - done));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "read exec request");
+      if (UNLIKELY (ret == 0))
+        return crun_make_error (err, 0, "short read for the exec request");
+      done += ret;
     }
-  (void) fcntl (terminal_fd, F_SETFL, flags);
-  fflush (stderr);
-  fsync (1);
-  fsync (2);
+  (*payload)[len] = '\0';
+  return 0;
 }
 
+/* Run the process requested on CONN with the stdio received from the client.
+   It is called in a new process forked from the monitor, so the container
+   configuration is already in memory.  */
 static int
-cleanup_watch (libcrun_context_t *context, runtime_spec_schema_config_schema *def, const char *cgroup_path, int cgroup_mode, pid_t init_pid, int sync_socket, int terminal_fd, libcrun_error_t *err)
+serve_exec_request (libcrun_context_t *context, libcrun_container_t *container, int conn, libcrun_error_t *err)
 {
-  const char *oom_message = NULL;
-  libcrun_error_t tmp_err = NULL;
-  int ret;
-
-  if (init_pid)
-    {
-      /* Try to detect whether the cgroup has a OOM.  */
-      if (cgroup_path != NULL && cgroup_path[0])
-        {
-          int has_oom;
+  cleanup_container_status libcrun_container_status_t status = {};
+  runtime_spec_schema_config_schema_process *process = NULL;
+  struct parser_context ctx = { 0, stderr };
+  libcrun_context_t exec_context = *context;
+  int fds[EXEC_SERVER_REQUEST_FDS] = { -1, -1, -1 };
+  cleanup_free char *payload = NULL;
+  parser_error parser_err = NULL;
+  yajl_val tree = NULL;
+  int i, ret;
 
-          has_oom = libcrun_cgroup_has_oom (cgroup_path, cgroup_mode, &tmp_err);
-          if (has_oom > 0)
-            oom_message = "OOM: the memory limit could be too low";
-          else if (has_oom < 0)
-            {
-              /* If the detection has failed for any reason, e.g. the cgroup was
-                 already deleted by the time it was checked, just ignore the
-                 failure.  */
-              crun_error_release (&tmp_err);
-            }
-        }
-      /* If the OOM wasn't detected, look into the static configuration.  */
-      if (oom_message == NULL && is_memory_limit_too_low (def))
-        oom_message = "the memory limit could be too low";
+  ret = read_exec_request (conn, &payload, fds, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
 
-      kill (init_pid, SIGKILL);
-      TEMP_FAILURE_RETRY (waitpid (init_pid, NULL, 0));
+  ret = parse_json_file (&tree, payload, &ctx, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
+
+  process = make_runtime_spec_schema_config_schema_process (tree, &ctx, &parser_err);
+  if (UNLIKELY (process == NULL))
+    {
+      ret = crun_make_error (err, 0, "cannot parse the exec request: %s", parser_err ? parser_err : "unknown error");
+      goto exit;
     }
 
-  ret = sync_socket_wait_sync (context, sync_socket, true, &tmp_err);
-  if (UNLIKELY (ret < 0))
+  if (UNLIKELY (process->args_len == 0))
     {
-      crun_error_release (err);
-      *err = tmp_err;
+      ret = crun_make_error (err, 0, "the exec request has no `args`");
+      goto exit;
+    }
+  if (UNLIKELY (process->terminal))
+    {
+      ret = crun_make_error (err, 0, "the exec server does not allocate terminals");
+      goto exit;
     }
 
-  if (terminal_fd >= 0)
-    flush_fd_to_err (context, terminal_fd);
+  for (i = 0; i < EXEC_SERVER_REQUEST_FDS; i++)
+    {
+      if (UNLIKELY (dup2 (fds[i], i) < 0))
+        {
+          ret = crun_make_error (err, errno, "dup2");
+          goto exit;
+        }
+    }
 
-  if (oom_message)
-    return crun_error_wrap (err, "%s", oom_message);
+  ret = libcrun_read_container_status (&status, context->state_root, context->id, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
 
-  return -1;
+  /* Whatever the monitor was started with, the new process is waited for
+     and gets only its stdio.  */
+  exec_context.detach = false;
+  exec_context.console_socket = NULL;
+  exec_context.pid_file = NULL;
+  exec_context.preserve_fds = 0;
+
+  ret = container_exec_internal (&exec_context, container, &status, process, err);
+
+exit:
+  for (i = 0; i < EXEC_SERVER_REQUEST_FDS; i++)
+    if (fds[i] >= 0)
+      close (fds[i]);
+  free (parser_err);
+  if (tree)
+    yajl_tree_free (tree);
+  if (process)
+    free_runtime_spec_schema_config_schema_process (process);
+  return ret;
 }
 
 static int
-open_seccomp_output (const char *id, int *fd, bool readonly, const char *state_root, libcrun_error_t *err)
+handle_exec_server (libcrun_event_loop_t *loop arg_unused, int fd, void *arg, libcrun_error_t *err arg_unused)
 {
-  int ret;
-  cleanup_free char *dest_path = NULL;
-  cleanup_free char *dir = NULL;
-
-  dir = libcrun_get_state_directory (state_root, id);
-  if (UNLIKELY (dir == NULL))
-    return crun_make_error (err, 0, "cannot get state directory");
+  struct wait_for_process_s *w = arg;
+  cleanup_close int conn = -1;
+  struct ucred cred;
+  socklen_t cred_len = sizeof (cred);
+  pid_t pid;
 
-  ret = append_paths (&dest_path, err, dir, "seccomp.bpf", NULL);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  /* Nothing that goes wrong with a request must stop the monitor.  */
+  conn = TEMP_FAILURE_RETRY (accept4 (fd, NULL, NULL, SOCK_CLOEXEC));
+  if (UNLIKELY (conn < 0))
+    {
+      libcrun_warning ("exec server: accept: %s", strerror (errno));
+      return 0;
+    }
 
-  *fd = -1;
-  if (readonly)
+  if (UNLIKELY (getsockopt (conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0))
     {
-      ret = TEMP_FAILURE_RETRY (open (dest_path, O_RDONLY));
-      if (UNLIKELY (ret < 0))
-        {
-          if (errno == ENOENT)
-            return 0;
-          return crun_make_error (err, errno, "open seccomp.bpf");
-        }
-      *fd = ret;
+      libcrun_warning ("exec server: get peer credentials: %s", strerror (errno));
+      return 0;
     }
-  else
+  if (cred.uid != 0 && cred.uid != geteuid ())
     {
-      ret = TEMP_FAILURE_RETRY (open (dest_path, O_RDWR | O_CREAT, 0700));
-      if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "open seccomp.bpf");
-      *fd = ret;
+      libcrun_warning ("exec server: refusing request from uid `%d`", (int) cred.uid);
+      return 0;
     }
 
-  return 0;
-}
+  pid = fork ();
+  if (UNLIKELY (pid < 0))
+    {
+      libcrun_warning ("exec server: fork: %s", strerror (errno));
+      return 0;
+    }
 
-/* Find the uid:gid that is mapped to root inside the container user namespace.  */
-void
-get_root_in_the_userns (runtime_spec_schema_config_schema *def, uid_t host_uid, gid_t host_gid, uid_t *uid,
-                        gid_t *gid)
-{
-  *uid = -1;
-  *gid = -1;
+  /* The monitor reaps the process once it exits, like any other child
+     that is not the container.  */
+  if (pid == 0)
+    {
+      libcrun_error_t tmp_err = NULL;
+      pid_t own_pid = getpid ();
+      int32_t exit_status;
+      int ret;
 
-  /* Not root in the namespace.  */
-  if (host_uid)
-    return;
+      close (fd);
 
-  if (def->linux && def->linux->uid_mappings)
-    {
-      size_t i;
+      ret = serve_exec_request (w->context, w->container, conn, &tmp_err);
 
-      for (i = 0; i < def->linux->uid_mappings_len; i++)
-        if (def->linux->uid_mappings[i]->container_id == 0)
-          {
-            *uid = def->linux->uid_mappings[i]->host_id;
-            break;
-          }
-    }
-  if (def->linux && def->linux->gid_mappings)
-    {
-      size_t i;
+      /* The exec'ed process failed before calling execv and came back here.  */
+      if (getpid () != own_pid)
+        {
+          if (tmp_err)
+            libcrun_fail_with_error (tmp_err->status, "%s", tmp_err->msg);
+          _exit (EXIT_FAILURE);
+        }
 
-      for (i = 0; i < def->linux->gid_mappings_len; i++)
-        if (def->linux->gid_mappings[i]->container_id == 0)
-          {
-            *gid = def->linux->gid_mappings[i]->host_id;
-            break;
-          }
+      exit_status = ret < 0 ? -1 : ret;
+      safe_write (conn, &exit_status, sizeof (exit_status));
+      if (ret < 0 && tmp_err)
+        safe_write (conn, tmp_err->msg, strlen (tmp_err->msg));
+      _exit (EXIT_SUCCESS);
     }
 
-  /* If the uid and the gid are not changed, do not attempt any chown.  */
-  if (*uid == host_uid && *gid == host_gid)
-    *uid = *gid = -1;
+  return 0;
 }
 
-static const char *
-find_delegate_cgroup (libcrun_container_t *container)
+/* Start listening for exec requests in the state directory of the container.
+   It is not an error if the socket cannot be created, the clients fall back
+   to joining the container themselves.  */
+static int
+open_exec_server (libcrun_context_t *context, libcrun_container_t *container)
 {
+  cleanup_free char *dir = NULL;
+  cleanup_free char *path = NULL;
+  libcrun_error_t tmp_err = NULL;
   const char *annotation;
+  cleanup_close int fd = -1;
+  int ret;
 
-  annotation = find_annotation (container, "run.oci.delegate-cgroup");
-  if (annotation)
+  annotation = find_annotation (container, "run.oci.exec_server");
+  if (annotation == NULL || strcmp (annotation, "true") != 0 || context->detach)
+    return -1;
+
+  dir = libcrun_get_state_directory (context->state_root, context->id);
+  if (UNLIKELY (dir == NULL))
+    return -1;
+
+  ret = append_paths (&path, &tmp_err, dir, EXEC_SERVER_SOCKET, NULL);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  fd = open_unix_domain_socket (path, 0, &tmp_err);
+  if (UNLIKELY (fd < 0))
+    goto fail;
+
+  ret = chmod (path, 0600);
+  if (UNLIKELY (ret < 0))
     {
-      if (annotation[0] == '\0')
-        return NULL;
-      return annotation;
+      crun_make_error (&tmp_err, errno, "chmod `%s`", path);
+      goto fail;
     }
 
-  return NULL;
-}
-
-static const char *
-find_systemd_subgroup (libcrun_container_t *container, int cgroup_mode)
-{
-  const char *annotation;
+  ret = fcntl (fd, F_SETFD, FD_CLOEXEC);
+  if (UNLIKELY (ret < 0))
+    {
+      crun_make_error (&tmp_err, errno, "fcntl");
+      goto fail;
+    }
 
-  annotation = find_annotation (container, "run.oci.systemd.subgroup");
-  if (annotation)
+  ret = listen (fd, SOMAXCONN);
+  if (UNLIKELY (ret < 0))
     {
-      if (annotation[0] == '\0')
-        return NULL;
-      return annotation;
+      crun_make_error (&tmp_err, errno, "listen on `%s`", path);
+      goto fail;
     }
 
-  if (cgroup_mode == CGROUP_MODE_UNIFIED)
-    return "container";
+  ret = fd;
+  fd = -1;
+  return ret;
 
-  return NULL;
+fail:
+  libcrun_warning ("cannot start the exec server: %s", tmp_err->msg);
+  crun_error_release (&tmp_err);
+  return -1;
 }
 
-static int
-get_seccomp_receiver_fd (libcrun_container_t *container, int *fd, int *self_receiver_fd, const char **plugins,
-                         libcrun_error_t *err)
+static void
+close_exec_server (libcrun_context_t *context, int *fd)
 {
-  const char *tmp;
-  runtime_spec_schema_config_schema *def = container->container_def;
-
-  *fd = -1;
-  *self_receiver_fd = -1;
-
-  tmp = find_annotation (container, "run.oci.seccomp.plugins");
-  if (tmp)
-    {
-      int fds[2];
-      int ret;
-
-      ret = create_socket_pair (fds, err);
-      if (UNLIKELY (ret < 0))
-        return crun_error_wrap (err, "create socket pair");
+  cleanup_free char *dir = NULL;
 
-      *fd = fds[0];
-      *self_receiver_fd = fds[1];
-      *plugins = tmp;
-    }
+  close_and_reset (fd);
 
-  if (def && def->linux && def->linux->seccomp && def->linux->seccomp->listener_path)
-    tmp = def->linux->seccomp->listener_path;
-  else
-    tmp = find_annotation (container, "run.oci.seccomp.receiver");
-  if (tmp == NULL)
-    tmp = getenv ("RUN_OCI_SECCOMP_RECEIVER");
-  if (tmp)
+  dir = libcrun_get_state_directory (context->state_root, context->id);
+  if (dir)
     {
-      if (tmp[0] != '/')
-        return crun_make_error (err, 0, "the seccomp receiver `%s` is not an absolute path", tmp);
+      cleanup_free char *path = NULL;
 
-      *fd = open_unix_domain_client_socket (tmp, 0, err);
-      if (UNLIKELY (*fd < 0))
-        return crun_error_wrap (err, "open seccomp receiver");
+      if (LIKELY (xasprintf (&path, "%s/%s", dir, EXEC_SERVER_SOCKET) >= 0))
+        unlink (path);
     }
-
-  return 0;
 }
 
 static int
-libcrun_container_run_internal (libcrun_container_t *container, libcrun_context_t *context, int container_ready_fd,
-                                libcrun_error_t *err)
+wait_for_process (pid_t pid, libcrun_context_t *context, int terminal_fd, int notify_socket, int container_ready_fd,
+                  int seccomp_notify_fd, const char *seccomp_notify_plugins, const char *cgroup_path,
+                  bool shrink_memory, libcrun_container_t *container, int exec_server_fd, libcrun_error_t *err)
 {
-  runtime_spec_schema_config_schema *def = container->container_def;
-  int ret;
-  pid_t pid;
-  int detach = context->detach;
-  cleanup_free char *cgroup_path = NULL;
-  cleanup_free char *scope = NULL;
-  cleanup_close int terminal_fd = -1;
-  cleanup_terminal void *orig_terminal = NULL;
-  cleanup_close int sync_socket = -1;
-  cleanup_close int notify_socket = -1;
-  cleanup_close int socket_pair_0 = -1;
-  cleanup_close int socket_pair_1 = -1;
-  cleanup_close int seccomp_fd = -1;
-  cleanup_close int console_socket_fd = -1;
-  cleanup_close int hooks_out_fd = -1;
-  cleanup_close int hooks_err_fd = -1;
-  cleanup_close int own_seccomp_receiver_fd = -1;
-  cleanup_close int seccomp_notify_fd = -1;
-  const char *seccomp_notify_plugins = NULL;
-  int cgroup_mode, cgroup_manager;
-  char created[35];
-  uid_t root_uid = -1;
-  gid_t root_gid = -1;
-  struct container_entrypoint_s container_args = {
-    .container = container,
+  cleanup_cgroup_events libcrun_cgroup_events_t *cgroup_events = NULL;
+  cleanup_event_loop libcrun_event_loop_t *loop = NULL;
+  cleanup_console_relay libcrun_console_relay_t *console_relay = NULL;
+  cleanup_close int signalfd = -1;
+  int ret, last_process;
+  sigset_t mask;
+  cleanup_seccomp_notify_context struct seccomp_notify_context_s *seccomp_notify_ctx = NULL;
+  struct wait_for_process_s w = {
+    .pid = pid,
     .context = context,
-    .terminal_socketpair = { -1, -1 },
-    .console_socket_fd = -1,
-    .hooks_out_fd = -1,
-    .hooks_err_fd = -1,
-    .seccomp_receiver_fd = -1,
-    .exec_func = context->exec_func,
-    .exec_func_arg = context->exec_func_arg,
+    .terminal_fd = terminal_fd,
+    .container_exit_code = 0,
+    .container = container,
   };
 
-  if (def->hooks
-      && (def->hooks->prestart_len || def->hooks->poststart_len || def->hooks->create_runtime_len
-          || def->hooks->create_container_len || def->hooks->start_container_len))
+  if (context->pid_file)
     {
-      ret = open_hooks_output (container, &hooks_out_fd, &hooks_err_fd, err);
+      char buf[12];
+      size_t buf_len = sprintf (buf, "%d", pid);
+      ret = write_file_with_flags (context->pid_file, O_CREAT | O_TRUNC, buf, buf_len, err);
       if (UNLIKELY (ret < 0))
         return ret;
-      container_args.hooks_out_fd = hooks_out_fd;
-      container_args.hooks_err_fd = hooks_err_fd;
     }
 
-  container->context = context;
+  /* Also exit if there is nothing more to wait for.  */
+  if (context->detach && notify_socket < 0)
+    return 0;
 
-  if (! detach || context->notify_socket)
+  if (container_ready_fd >= 0)
     {
-      ret = prctl (PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0);
-      if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "set child subreaper");
+      ret = 0;
+      TEMP_FAILURE_RETRY (write (container_ready_fd, &ret, sizeof (ret)));
+      close_and_reset (&container_ready_fd);
     }
 
-  if (! context->no_new_keyring)
+  sigfillset (&mask);
+  ret = sigprocmask (SIG_BLOCK, &mask, NULL);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "sigprocmask");
+
+  signalfd = create_signalfd (&mask, err);
+  if (UNLIKELY (signalfd < 0))
+    return signalfd;
+
+  ret = reap_subprocesses (pid, &w.container_exit_code, &last_process, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (last_process)
+    return w.container_exit_code;
+
+  ret = libcrun_event_loop_new (&loop, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (seccomp_notify_fd >= 0)
     {
-      const char *label = NULL;
+      cleanup_free char *state_root = NULL;
+      cleanup_free char *oci_config_path = NULL;
 
-      if (def->process)
-        label = def->process->selinux_label;
+      struct libcrun_load_seccomp_notify_conf_s conf;
+      memset (&conf, 0, sizeof conf);
 
-      ret = libcrun_create_keyring (container->context->id, label, err);
+      state_root = libcrun_get_state_directory (context->state_root, context->id);
+      if (UNLIKELY (state_root == NULL))
+        return crun_make_error (err, 0, "cannot get state directory");
+
+      ret = append_paths (&oci_config_path, err, state_root, "config.json", NULL);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      conf.runtime_root_path = state_root;
+      conf.name = context->id;
+      conf.bundle_path = context->bundle;
+      conf.oci_config_path = oci_config_path;
+
+      ret = set_blocking_fd (seccomp_notify_fd, 0, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = libcrun_load_seccomp_notify_plugins (&seccomp_notify_ctx, seccomp_notify_plugins, &conf, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      w.seccomp_notify_ctx = seccomp_notify_ctx;
+
+      ret = libcrun_event_loop_add (loop, seccomp_notify_fd, false, handle_seccomp_notify, &w, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
 
-  if (def->process && def->process->terminal && ! detach && context->console_socket == NULL)
+  /* Report the OOM events as soon as they happen.  The exit of the
+     container is already notified by SIGCHLD.  */
+  if (cgroup_path != NULL && cgroup_path[0] != '\0')
     {
-      container_args.has_terminal_socket_pair = 1;
-      ret = create_socket_pair (container_args.terminal_socketpair, err);
-      if (UNLIKELY (ret < 0))
-        return crun_error_wrap (err, "create terminal socket");
+      libcrun_error_t tmp_err = NULL;
 
-      socket_pair_0 = container_args.terminal_socketpair[0];
-      socket_pair_1 = container_args.terminal_socketpair[1];
+      ret = libcrun_cgroup_events_new (cgroup_path, 0, &cgroup_events, &tmp_err);
+      if (UNLIKELY (ret < 0))
+        crun_error_release (&tmp_err);
+      else
+        {
+          w.cgroup_events = cgroup_events;
+          ret = libcrun_event_loop_add (loop, libcrun_cgroup_events_get_fd (cgroup_events), false,
+                                        handle_cgroup_events, &w, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+        }
     }
 
-  ret = block_signals (err);
+  ret = libcrun_event_loop_add (loop, signalfd, false, handle_signal, &w, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  if (def->linux && (def->linux->seccomp || find_annotation (container, "run.oci.seccomp_bpf_data")))
+  if (notify_socket >= 0)
     {
-      ret = open_seccomp_output (context->id, &seccomp_fd, false, context->state_root, err);
+      ret = libcrun_event_loop_add (loop, notify_socket, false, handle_notify_socket_event, &w, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
-  container_args.seccomp_fd = seccomp_fd;
 
-  if (seccomp_fd >= 0)
+  if (exec_server_fd >= 0)
     {
-      ret = get_seccomp_receiver_fd (container, &container_args.seccomp_receiver_fd, &own_seccomp_receiver_fd,
-                                     &seccomp_notify_plugins, err);
+      ret = libcrun_event_loop_add (loop, exec_server_fd, false, handle_exec_server, &w, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
 
-  if (context->console_socket)
+  if (terminal_fd >= 0)
     {
-      console_socket_fd = open_unix_domain_client_socket (context->console_socket, 0, err);
-      if (UNLIKELY (console_socket_fd < 0))
-        return crun_error_wrap (err, "open console socket");
-      container_args.console_socket_fd = console_socket_fd;
-    }
-
-  cgroup_mode = libcrun_get_cgroup_mode (err);
-  if (UNLIKELY (cgroup_mode < 0))
-    return cgroup_mode;
+      ret = libcrun_event_loop_add (loop, 0, false, handle_terminal_input, &w, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
 
-  pid = libcrun_run_linux_container (container, container_init, &container_args, &sync_socket, err);
-  if (UNLIKELY (pid < 0))
-    return pid;
+      if (context->console_log)
+        {
+          ret = libcrun_console_relay_new (terminal_fd, context->console_log, context->console_log_size,
+                                           &console_relay, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+          w.console_relay = console_relay;
 
-  if (context->fifo_exec_wait_fd < 0 && context->notify_socket)
-    {
-      /* Do not open the notify socket here on "create".  "start" will take care of it.  */
-      ret = get_notify_fd (context, container, &notify_socket, err);
+          ret = libcrun_event_loop_add (loop, terminal_fd, true, handle_console_relay, &w, err);
+        }
+      else
+        ret = libcrun_event_loop_add (loop, terminal_fd, true, handle_terminal_output, &w, err);
       if (UNLIKELY (ret < 0))
-        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+        return ret;
     }
 
-  if (container_args.terminal_socketpair[1] >= 0)
-    close_and_reset (&socket_pair_1);
-
-  cgroup_manager = CGROUP_MANAGER_CGROUPFS;
-  if (context->systemd_cgroup)
-    cgroup_manager = CGROUP_MANAGER_SYSTEMD;
-  else if (context->force_no_cgroup)
-    cgroup_manager = CGROUP_MANAGER_DISABLED;
+  if (shrink_memory)
+    shrink_monitor_memory ();
 
-  /* If we are root (either on the host or in a namespace), then chown the cgroup to root in the container user
-   * namespace.  */
-  get_root_in_the_userns (def, container->host_uid, container->host_gid, &root_uid, &root_gid);
+  return libcrun_event_loop_run (loop, err);
+}
 
-  {
-    struct libcrun_cgroup_args cg = {
-      .resources = def->linux ? def->linux->resources : NULL,
-      .annotations = def->annotations,
-      .cgroup_mode = cgroup_mode,
-      .path = &cgroup_path,
-      .scope = &scope,
-      .cgroup_path = def->linux ? def->linux->cgroups_path : "",
-      .manager = cgroup_manager,
-      .pid = pid,
-      .root_uid = root_uid,
-      .root_gid = root_gid,
-      .id = context->id,
-      .systemd_subgroup = find_systemd_subgroup (container, cgroup_mode),
-      .delegate_cgroup = find_delegate_cgroup (container),
-    };
+static void
+flush_fd_to_err (libcrun_context_t *context, int terminal_fd)
+{
+  char buf[256];
+  int flags;
+  if (terminal_fd < 0 || stderr == NULL)
+    return;
 
-    ret = libcrun_cgroup_enter (&cg, err);
-    if (UNLIKELY (ret < 0))
-      return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-  }
+  flags = fcntl (terminal_fd, F_GETFL, 0);
+  if (flags == -1)
+    return;
+  if (fcntl (terminal_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return;
 
-  /* sync send own pid.  */
-  ret = TEMP_FAILURE_RETRY (write (sync_socket, &pid, sizeof (pid)));
-  if (UNLIKELY (ret != sizeof (pid)))
+  for (;;)
     {
-      if (ret >= 0)
-        errno = 0;
-      crun_make_error (err, errno, "write to sync socket");
-      return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+      int ret = TEMP_FAILURE_RETRY (read (terminal_fd, buf, sizeof (buf) - 1));
+      if (ret <= 0)
+        break;
+      buf[ret] = '\0';
+      if (context->output_handler)
+        context->output_handler (0, buf, false, context->output_handler_arg);
     }
+  (void) fcntl (terminal_fd, F_SETFL, flags);
+  fflush (stderr);
+  fsync (1);
+  fsync (2);
+}
 
-  /* sync 1.  */
-  ret = sync_socket_send_sync (sync_socket, true, err);
-  if (UNLIKELY (ret < 0))
-    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-
-  /* sync 2.  */
-  ret = sync_socket_wait_sync (context, sync_socket, false, err);
-  if (UNLIKELY (ret < 0))
-    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-
-  /* The container is waiting that we write back.  In this phase we can launch the
-     prestart hooks.  */
-  if (def->hooks && def->hooks->prestart_len)
-    {
-      ret = do_hooks (def, pid, context->id, false, NULL, "created", (hook **) def->hooks->prestart,
-                      def->hooks->prestart_len, hooks_out_fd, hooks_err_fd, err);
-      if (UNLIKELY (ret != 0))
-        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-    }
-  if (def->hooks && def->hooks->create_runtime_len)
-    {
-      ret = do_hooks (def, pid, context->id, false, NULL, "created", (hook **) def->hooks->create_runtime,
-                      def->hooks->create_runtime_len, hooks_out_fd, hooks_err_fd, err);
-      if (UNLIKELY (ret != 0))
-        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-    }
+static int
+cleanup_watch (libcrun_context_t *context, runtime_spec_schema_config_schema *def, const char *cgroup_path, int cgroup_mode, pid_t init_pid, int sync_socket, int terminal_fd, libcrun_error_t *err)
+{
+  const char *oom_message = NULL;
+  libcrun_error_t tmp_err = NULL;
+  int ret;
 
-  if (seccomp_fd >= 0)
+  if (init_pid)
     {
-      unsigned int seccomp_gen_options = 0;
-      const char *annotation;
-
-      annotation = find_annotation (container, "run.oci.seccomp_fail_unknown_syscall");
-      if (annotation && strcmp (annotation, "0") != 0)
-        seccomp_gen_options = LIBCRUN_SECCOMP_FAIL_UNKNOWN_SYSCALL;
-
-      if ((annotation = find_annotation (container, "run.oci.seccomp_bpf_data")) != NULL)
+      /* Try to detect whether the cgroup has a OOM.  */
+      if (cgroup_path != NULL && cgroup_path[0])
         {
-          cleanup_free char *bpf_data = NULL;
-          size_t size = 0;
-          size_t in_size;
-          int consumed;
-
-          in_size = strlen (annotation);
-          bpf_data = xmalloc (in_size + 1);
-
-          consumed = base64_decode (annotation, in_size, bpf_data, in_size, &size);
-          if (UNLIKELY (consumed != (int) in_size))
-            {
-              ret = crun_make_error (err, 0, "invalid seccomp BPF data");
-              return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-            }
+          int has_oom;
 
-          ret = safe_write (seccomp_fd, bpf_data, (ssize_t) size);
-          if (UNLIKELY (ret < 0))
+          has_oom = libcrun_cgroup_has_oom (cgroup_path, cgroup_mode, &tmp_err);
+          if (has_oom > 0)
+            oom_message = "OOM: the memory limit could be too low";
+          else if (has_oom < 0)
             {
-              crun_make_error (err, 0, "write to seccomp fd");
-              return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+              /* If the detection has failed for any reason, e.g. the cgroup was
+                 already deleted by the time it was checked, just ignore the
+                 failure.  */
+              crun_error_release (&tmp_err);
             }
         }
-      else
-        {
-          ret = libcrun_generate_seccomp (container, seccomp_fd, seccomp_gen_options, err);
-          if (UNLIKELY (ret < 0))
-            return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-        }
-      close_and_reset (&seccomp_fd);
+      /* If the OOM wasn't detected, look into the static configuration.  */
+      if (oom_message == NULL && is_memory_limit_too_low (def))
+        oom_message = "the memory limit could be too low";
+
+      kill (init_pid, SIGKILL);
+      TEMP_FAILURE_RETRY (waitpid (init_pid, NULL, 0));
     }
 
-  /* sync 3.  */
-  ret = sync_socket_send_sync (sync_socket, true, err);
+  ret = sync_socket_wait_sync (context, sync_socket, true, &tmp_err);
   if (UNLIKELY (ret < 0))
-    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-
-  if (def->process && def->process->terminal && ! detach && context->console_socket == NULL)
     {
-      terminal_fd = receive_fd_from_socket (socket_pair_0, err);
-      if (UNLIKELY (terminal_fd < 0))
-        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+      crun_error_release (err);
+      *err = tmp_err;
+    }
 
-      close_and_reset (&socket_pair_0);
+  if (terminal_fd >= 0)
+    flush_fd_to_err (context, terminal_fd);
 
-      ret = libcrun_setup_terminal_ptmx (terminal_fd, &orig_terminal, err);
-      if (UNLIKELY (ret < 0))
-        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-    }
+  if (oom_message)
+    return crun_error_wrap (err, "%s", oom_message);
 
-  /* sync 4.  */
-  ret = sync_socket_wait_sync (context, sync_socket, false, err);
-  if (UNLIKELY (ret < 0))
-    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+  return -1;
+}
 
-  ret = close_and_reset (&sync_socket);
-  if (UNLIKELY (ret < 0))
-    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+static int
+open_seccomp_output (const char *id, int *fd, bool readonly, const char *state_root, libcrun_error_t *err)
+{
+  int ret;
+  cleanup_free char *dest_path = NULL;
+  cleanup_free char *dir = NULL;
 
-  get_current_timestamp (created);
-  ret = write_container_status (container, context, pid, cgroup_path, scope, created, err);
+  dir = libcrun_get_state_directory (state_root, id);
+  if (UNLIKELY (dir == NULL))
+    return crun_make_error (err, 0, "cannot get state directory");
+
+  ret = append_paths (&dest_path, err, dir, "seccomp.bpf", NULL);
   if (UNLIKELY (ret < 0))
-    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+    return ret;
 
-  /* Run poststart hooks here only if the container is created using "run".  For create+start, the
-     hooks will be executed as part of the start command.  */
-  if (context->fifo_exec_wait_fd < 0 && def->hooks && def->hooks->poststart_len)
+  *fd = -1;
+  if (readonly)
     {
-      ret = do_hooks (def, pid, context->id, true, NULL, "running", (hook **) def->hooks->poststart,
-                      def->hooks->poststart_len, hooks_out_fd, hooks_err_fd, err);
+      ret = TEMP_FAILURE_RETRY (open (dest_path, O_RDONLY));
       if (UNLIKELY (ret < 0))
-        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+        {
+          if (errno == ENOENT)
+            return 0;
+          return crun_make_error (err, errno, "open seccomp.bpf");
+        }
+      *fd = ret;
     }
-
-  /* Let's receive the seccomp notify fd and handle it as part of wait_for_process().  */
-  if (own_seccomp_receiver_fd >= 0)
+  else
     {
-      seccomp_notify_fd = receive_fd_from_socket (own_seccomp_receiver_fd, err);
-      if (UNLIKELY (seccomp_notify_fd < 0))
-        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
-
-      ret = close_and_reset (&own_seccomp_receiver_fd);
+      ret = TEMP_FAILURE_RETRY (open (dest_path, O_RDWR | O_CREAT, 0700));
       if (UNLIKELY (ret < 0))
-        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+        return crun_make_error (err, errno, "open seccomp.bpf");
+      *fd = ret;
     }
 
-  ret = wait_for_process (pid, context, terminal_fd, notify_socket, container_ready_fd, seccomp_notify_fd,
-                          seccomp_notify_plugins, err);
-  if (! context->detach)
+  return 0;
+}
+
+/* Find the uid:gid that is mapped to root inside the container user namespace.  */
+void
+get_root_in_the_userns (runtime_spec_schema_config_schema *def, uid_t host_uid, gid_t host_gid, uid_t *uid,
+                        gid_t *gid)
+{
+  *uid = -1;
+  *gid = -1;
+
+  /* Not root in the namespace.  */
+  if (host_uid)
+    return;
+
+  if (def->linux && def->linux->uid_mappings)
     {
-      libcrun_error_t tmp_err = NULL;
-      cleanup_watch (context, def, cgroup_path, cgroup_mode, 0, sync_socket, terminal_fd, &tmp_err);
-      crun_error_release (&tmp_err);
+      size_t i;
+
+      for (i = 0; i < def->linux->uid_mappings_len; i++)
+        if (def->linux->uid_mappings[i]->container_id == 0)
+          {
+            *uid = def->linux->uid_mappings[i]->host_id;
+            break;
+          }
+    }
+  if (def->linux && def->linux->gid_mappings)
+    {
+      size_t i;
+
+      for (i = 0; i < def->linux->gid_mappings_len; i++)
+        if (def->linux->gid_mappings[i]->container_id == 0)
+          {
+            *gid = def->linux->gid_mappings[i]->host_id;
+            break;
+          }
     }
 
-  return ret;
+  /* If the uid and the gid are not changed, do not attempt any chown.  */
+  if (*uid == host_uid && *gid == host_gid)
+    *uid = *gid = -1;
 }
 
-static int
-check_config_file (runtime_spec_schema_config_schema *def, libcrun_context_t *context, libcrun_error_t *err)
+static const char *
+find_delegate_cgroup (libcrun_container_t *container)
 {
-  if (UNLIKELY (def->linux == NULL))
-    return crun_make_error (err, 0, "invalid config file, no 'linux' block specified");
-  if (context->exec_func == NULL)
+  const char *annotation;
+
+  annotation = find_annotation (container, "run.oci.delegate-cgroup");
+  if (annotation)
     {
-      if (UNLIKELY (def->root == NULL))
-        return crun_make_error (err, 0, "invalid config file, no 'root' block specified");
-      if (UNLIKELY (def->mounts == NULL))
-        return crun_make_error (err, 0, "invalid config file, no 'mounts' block specified");
+      if (annotation[0] == '\0')
+        return NULL;
+      return annotation;
     }
-  return 0;
+
+  return NULL;
 }
 
-static int
-libcrun_copy_config_file (const char *id, const char *state_root, const char *config_file, const char *config_file_content, libcrun_error_t *err)
+static const char *
+find_systemd_subgroup (libcrun_container_t *container, int cgroup_mode)
 {
-  int ret;
-  cleanup_free char *dest_path = NULL;
-  cleanup_free char *dir = NULL;
-  cleanup_free char *buffer = NULL;
-  size_t len;
+  const char *annotation;
 
-  dir = libcrun_get_state_directory (state_root, id);
-  if (UNLIKELY (dir == NULL))
-    return crun_make_error (err, 0, "cannot get state directory");
+  annotation = find_annotation (container, "run.oci.systemd.subgroup");
+  if (annotation)
+    {
+      if (annotation[0] == '\0')
+        return NULL;
+      return annotation;
+    }
 
-  ret = append_paths (&dest_path, err, dir, "config.json", NULL);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  if (cgroup_mode == CGROUP_MODE_UNIFIED)
+    return "container";
 
-  if (config_file == NULL && config_file_content == NULL)
-    return crun_make_error (err, 0, "config file not specified");
+  return NULL;
+}
 
-  if (config_file == NULL)
+static int
+get_seccomp_receiver_fd (libcrun_container_t *container, int *fd, int *self_receiver_fd, const char **plugins,
+                         libcrun_error_t *err)
+{
+  const char *tmp;
+  runtime_spec_schema_config_schema *def = container->container_def;
+
+  *fd = -1;
+  *self_receiver_fd = -1;
+
+  tmp = find_annotation (container, "run.oci.seccomp.plugins");
+  if (tmp)
     {
-      ret = write_file (dest_path, config_file_content, strlen (config_file_content), err);
+      int fds[2];
+      int ret;
+
+      ret = create_socket_pair (fds, err);
       if (UNLIKELY (ret < 0))
-        return ret;
+        return crun_error_wrap (err, "create socket pair");
+
+      *fd = fds[0];
+      *self_receiver_fd = fds[1];
+      *plugins = tmp;
     }
+
+  if (def && def->linux && def->linux->seccomp && def->linux->seccomp->listener_path)
+    tmp = def->linux->seccomp->listener_path;
   else
+    tmp = find_annotation (container, "run.oci.seccomp.receiver");
+  if (tmp == NULL)
+    tmp = getenv ("RUN_OCI_SECCOMP_RECEIVER");
+  if (tmp)
     {
-      ret = read_all_file (config_file, &buffer, &len, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      if (tmp[0] != '/')
+        return crun_make_error (err, 0, "the seccomp receiver `%s` is not an absolute path", tmp);
 
-      ret = write_file (dest_path, buffer, len, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      *fd = open_unix_domain_client_socket (tmp, 0, err);
+      if (UNLIKELY (*fd < 0))
+        return crun_error_wrap (err, "open seccomp receiver");
     }
 
   return 0;
 }
 
+/* The seccomp profile generated in a separate thread, so that it runs at
+   the same time as the prestart hooks.  */
+struct seccomp_generator_s
+{
+  libcrun_container_t *container;
+  int fd;
+  unsigned int options;
+  char *cache_dir;
+  int ret;
+  libcrun_error_t err;
+#ifdef HAVE_PTHREAD
+  bool started;
+  pthread_t thread;
+#endif
+};
+
+static void *
+seccomp_generator_run (void *arg)
+{
+  struct seccomp_generator_s *gen = arg;
+
+  gen->ret = libcrun_generate_seccomp (gen->container, gen->fd, gen->options, gen->cache_dir, &gen->err);
+  return NULL;
+}
+
+/* Start the generation in a thread if WAIT_FOR_HOOKS is set and threads are
+   available, otherwise generate the profile now.  */
 static void
-force_delete_container_status (libcrun_context_t *context, runtime_spec_schema_config_schema *def)
+seccomp_generator_start (struct seccomp_generator_s *gen, bool wait_for_hooks)
+{
+#ifdef HAVE_PTHREAD
+  if (wait_for_hooks && pthread_create (&gen->thread, NULL, seccomp_generator_run, gen) == 0)
+    {
+      gen->started = true;
+      return;
+    }
+#endif
+  seccomp_generator_run (gen);
+}
+
+static int
+seccomp_generator_wait (struct seccomp_generator_s *gen, libcrun_error_t *err)
+{
+#ifdef HAVE_PTHREAD
+  if (gen->started)
+    {
+      pthread_join (gen->thread, NULL);
+      gen->started = false;
+    }
+#endif
+  if (UNLIKELY (gen->ret < 0))
+    {
+      *err = gen->err;
+      gen->err = NULL;
+      gen->ret = 0;
+      return -1;
+    }
+  return 0;
+}
+
+static void
+cleanup_seccomp_generatorp (struct seccomp_generator_s *gen)
 {
   libcrun_error_t tmp_err = NULL;
-  container_delete_internal (context, def, context->id, true, false, &tmp_err);
-  crun_error_release (&tmp_err);
+
+  /* Never leave the thread running on the error paths.  */
+  if (seccomp_generator_wait (gen, &tmp_err) < 0)
+    crun_error_release (&tmp_err);
+  free (gen->cache_dir);
 }
+#define cleanup_seccomp_generator __attribute__ ((cleanup (cleanup_seccomp_generatorp)))
 
-int
-libcrun_container_run (libcrun_context_t *context, libcrun_container_t *container, unsigned int options,
-                       libcrun_error_t *err)
+static int
+libcrun_container_run_internal (libcrun_container_t *container, libcrun_context_t *context, int container_ready_fd,
+                                libcrun_error_t *err)
 {
   runtime_spec_schema_config_schema *def = container->container_def;
   int ret;
+  pid_t pid;
+  uint64_t trace_start;
+  uint64_t seccomp_trace_start = 0;
   int detach = context->detach;
-  int container_ret_status[2];
-  cleanup_close int pipefd0 = -1;
-  cleanup_close int pipefd1 = -1;
-  libcrun_error_t tmp_err = NULL;
-
-  container->context = context;
-
-  ret = check_config_file (def, context, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
-
-  if (def->oci_version && strstr (def->oci_version, "1.0") == NULL)
-    return crun_make_error (err, 0, "unknown version specified");
+  cleanup_free char *cgroup_path = NULL;
+  cleanup_free char *scope = NULL;
+  cleanup_close int terminal_fd = -1;
+  cleanup_terminal void *orig_terminal = NULL;
+  cleanup_close int sync_socket = -1;
+  cleanup_close int notify_socket = -1;
+  cleanup_close int socket_pair_0 = -1;
+  cleanup_close int socket_pair_1 = -1;
+  cleanup_close int seccomp_fd = -1;
+  cleanup_close int console_socket_fd = -1;
+  cleanup_close int hooks_out_fd = -1;
+  cleanup_close int hooks_err_fd = -1;
+  cleanup_close int own_seccomp_receiver_fd = -1;
+  cleanup_close int seccomp_notify_fd = -1;
+  /* Declared after seccomp_fd, so that the thread is joined before the fd is closed.  */
+  cleanup_seccomp_generator struct seccomp_generator_s seccomp_gen = {
+    .container = container,
+    .fd = -1,
+  };
+  bool seccomp_generating = false;
+  const char *seccomp_notify_plugins = NULL;
+  const char *light_monitor;
+  int exec_server_fd;
+  int cgroup_mode, cgroup_manager;
+  char created[35];
+  uid_t root_uid = -1;
+  gid_t root_gid = -1;
+  cleanup_close int template_socket = -1;
+  struct container_entrypoint_s container_args = {
+    .container = container,
+    .context = context,
+    .terminal_socketpair = { -1, -1 },
+    .console_socket_fd = -1,
+    .hooks_out_fd = -1,
+    .hooks_err_fd = -1,
+    .seccomp_receiver_fd = -1,
+    .template_socket = -1,
+    .exec_func = context->exec_func,
+    .exec_func_arg = context->exec_func_arg,
+  };
+
+  if (def->hooks
+      && (def->hooks->prestart_len || def->hooks->poststart_len || def->hooks->create_runtime_len
+          || def->hooks->create_container_len || def->hooks->start_container_len))
+    {
+      ret = open_hooks_output (container, &hooks_out_fd, &hooks_err_fd, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      container_args.hooks_out_fd = hooks_out_fd;
+      container_args.hooks_err_fd = hooks_err_fd;
+    }
+
+  container->context = context;
+
+  if (! detach || context->notify_socket)
+    {
+      ret = prctl (PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "set child subreaper");
+    }
+
+  if (! context->no_new_keyring)
+    {
+      const char *label = NULL;
+
+      if (def->process)
+        label = def->process->selinux_label;
+
+      ret = libcrun_create_keyring (container->context->id, label, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  if (def->process && def->process->terminal && ! detach && context->console_socket == NULL)
+    {
+      container_args.has_terminal_socket_pair = 1;
+      ret = create_socket_pair (container_args.terminal_socketpair, err);
+      if (UNLIKELY (ret < 0))
+        return crun_error_wrap (err, "create terminal socket");
+
+      socket_pair_0 = container_args.terminal_socketpair[0];
+      socket_pair_1 = container_args.terminal_socketpair[1];
+    }
+
+  ret = block_signals (err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (def->linux && (def->linux->seccomp || find_annotation (container, "run.oci.seccomp_bpf_data")))
+    {
+      ret = open_seccomp_output (context->id, &seccomp_fd, false, context->state_root, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+  container_args.seccomp_fd = seccomp_fd;
+
+  if (seccomp_fd >= 0)
+    {
+      ret = get_seccomp_receiver_fd (container, &container_args.seccomp_receiver_fd, &own_seccomp_receiver_fd,
+                                     &seccomp_notify_plugins, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  if (context->console_socket)
+    {
+      console_socket_fd = open_unix_domain_client_socket (context->console_socket, 0, err);
+      if (UNLIKELY (console_socket_fd < 0))
+        return crun_error_wrap (err, "open console socket");
+      container_args.console_socket_fd = console_socket_fd;
+    }
+
+  if (context->fifo_exec_wait_fd >= 0 && is_template (container))
+    {
+      /* The containers forked from the template share its rootfs.  */
+      if (def->root == NULL || ! def->root->readonly)
+        return crun_make_error (err, EINVAL, "a template container requires a read-only rootfs");
+
+      template_socket = open_template_socket (context->state_root, context->id, err);
+      if (UNLIKELY (template_socket < 0))
+        return template_socket;
+      container_args.template_socket = template_socket;
+    }
+
+  cgroup_mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (cgroup_mode < 0))
+    return cgroup_mode;
+
+  cgroup_manager = CGROUP_MANAGER_CGROUPFS;
+  if (context->systemd_cgroup)
+    cgroup_manager = CGROUP_MANAGER_SYSTEMD;
+  else if (context->force_no_cgroup)
+    cgroup_manager = CGROUP_MANAGER_DISABLED;
+
+  /* If we are root (either on the host or in a namespace), then chown the cgroup to root in the container user
+   * namespace.  */
+  get_root_in_the_userns (def, container->host_uid, container->host_gid, &root_uid, &root_gid);
+
+  {
+    struct libcrun_cgroup_args cg = {
+      .resources = def->linux ? def->linux->resources : NULL,
+      .annotations = def->annotations,
+      .cgroup_mode = cgroup_mode,
+      .path = &cgroup_path,
+      .scope = &scope,
+      .cgroup_path = def->linux ? def->linux->cgroups_path : "",
+      .manager = cgroup_manager,
+      .root_uid = root_uid,
+      .root_gid = root_gid,
+      .id = context->id,
+      .systemd_subgroup = find_systemd_subgroup (container, cgroup_mode),
+      .delegate_cgroup = find_delegate_cgroup (container),
+    };
+    cleanup_close int cgroup_dirfd = -1;
+    libcrun_error_t tmp_err = NULL;
+    bool cgroup_created;
+
+    /* Failures are reported by libcrun_cgroup_enter, that is used when the
+       process cannot be created in the cgroup.  */
+    ret = libcrun_cgroup_preenter (&cg, &cgroup_dirfd, &tmp_err);
+    if (UNLIKELY (ret < 0))
+      crun_error_release (&tmp_err);
+    cgroup_created = ret > 0;
+
+    trace_start = libcrun_trace_begin ();
+    pid = libcrun_run_linux_container (container, container_init, &container_args, cgroup_dirfd,
+                                       &cg.process_in_cgroup, &sync_socket, err);
+    if (UNLIKELY (pid < 0))
+      {
+        /* libcrun_cgroup_enter did not run, nothing else knows about the cgroup.  */
+        if (cgroup_created)
+          libcrun_cgroup_preenter_cleanup (&cg);
+        return pid;
+      }
+    libcrun_trace_end ("create-process", trace_start);
+
+    close_and_reset (&cgroup_dirfd);
+
+    if (context->fifo_exec_wait_fd < 0 && context->notify_socket)
+      {
+        /* Do not open the notify socket here on "create".  "start" will take care of it.  */
+        ret = get_notify_fd (context, container, &notify_socket, err);
+        if (UNLIKELY (ret < 0))
+          return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+      }
+
+    if (container_args.terminal_socketpair[1] >= 0)
+      close_and_reset (&socket_pair_1);
+
+    cg.pid = pid;
+    trace_start = libcrun_trace_begin ();
+    ret = libcrun_cgroup_enter (&cg, err);
+    if (UNLIKELY (ret < 0))
+      return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+    libcrun_trace_end ("cgroup-enter", trace_start);
+  }
+
+  /* sync send own pid.  */
+  ret = TEMP_FAILURE_RETRY (write (sync_socket, &pid, sizeof (pid)));
+  if (UNLIKELY (ret != sizeof (pid)))
+    {
+      if (ret >= 0)
+        errno = 0;
+      crun_make_error (err, errno, "write to sync socket");
+      return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+    }
+
+  /* sync 1.  */
+  ret = sync_socket_send_sync (sync_socket, true, err);
+  if (UNLIKELY (ret < 0))
+    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+
+  /* The seccomp profile is generated while the container sets up the mounts
+     and the hooks run; it is read by the container only after sync 3.  */
+  if (seccomp_fd >= 0)
+    {
+      unsigned int seccomp_gen_options = 0;
+      const char *annotation;
+
+      annotation = find_annotation (container, "run.oci.seccomp_fail_unknown_syscall");
+      if (annotation && strcmp (annotation, "0") != 0)
+        seccomp_gen_options = LIBCRUN_SECCOMP_FAIL_UNKNOWN_SYSCALL;
+
+      annotation = find_annotation (container, "run.oci.seccomp_optimize");
+      if (annotation && strcmp (annotation, "0") == 0)
+        seccomp_gen_options |= LIBCRUN_SECCOMP_SKIP_OPTIMIZE;
+
+      if ((annotation = find_annotation (container, "run.oci.seccomp_bpf_data")) != NULL)
+        {
+          cleanup_free char *bpf_data = NULL;
+          size_t size = 0;
+          size_t in_size;
+          int consumed;
+
+          in_size = strlen (annotation);
+          bpf_data = xmalloc (in_size + 1);
+
+          consumed = base64_decode (annotation, in_size, bpf_data, in_size, &size);
+          if (UNLIKELY (consumed != (int) in_size))
+            {
+              ret = crun_make_error (err, 0, "invalid seccomp BPF data");
+              return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+            }
+
+          ret = safe_write (seccomp_fd, bpf_data, (ssize_t) size);
+          if (UNLIKELY (ret < 0))
+            {
+              crun_make_error (err, 0, "write to seccomp fd");
+              return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+            }
+        }
+      else
+        {
+          annotation = find_annotation (container, "run.oci.seccomp_cache");
+          if (annotation == NULL || strcmp (annotation, "0") != 0)
+            {
+              ret = libcrun_get_cache_directory (context->state_root, "seccomp", &seccomp_gen.cache_dir, err);
+              if (UNLIKELY (ret < 0))
+                crun_error_release (err);
+            }
+
+          /* With hooks, the profile is generated in a thread while the hooks
+             run.  The trace records the time until it is ready.  */
+          seccomp_gen.fd = seccomp_fd;
+          seccomp_gen.options = seccomp_gen_options;
+          seccomp_generating = true;
+          seccomp_trace_start = libcrun_trace_begin ();
+          seccomp_generator_start (&seccomp_gen, need_prestart_sync (def));
+        }
+    }
+
+  /* If there are hooks, the container stops after the mounts and waits that we
+     write back.  In this phase we can launch the prestart hooks.  */
+  if (need_prestart_sync (def))
+    {
+      cleanup_free char *hooks_state = NULL;
+      cleanup_free char *cwd = NULL;
+      size_t hooks_state_len = 0;
+
+      cwd = getcwd (NULL, 0);
+      if (cwd == NULL)
+        OOM ();
+
+      /* Both the stages see the same state.  It is prepared before waiting
+         for the container, as it depends only on the pid.  */
+      ret = get_hooks_state (def, pid, context->id, cwd, "created", &hooks_state, &hooks_state_len, err);
+      if (UNLIKELY (ret < 0))
+        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+
+      /* sync 2.  */
+      trace_start = libcrun_trace_begin ();
+      ret = sync_socket_wait_sync (context, sync_socket, false, err);
+      if (UNLIKELY (ret < 0))
+        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+      libcrun_trace_end ("wait-init-1", trace_start);
+
+      if (def->hooks->prestart_len)
+        {
+          ret = run_hooks (def, false, pid, context->id, "created", cwd, hooks_state, hooks_state_len,
+                           (hook **) def->hooks->prestart, def->hooks->prestart_len, hooks_out_fd, hooks_err_fd,
+                           err);
+          if (UNLIKELY (ret != 0))
+            return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+        }
+      if (def->hooks->create_runtime_len)
+        {
+          ret = run_hooks (def, false, pid, context->id, "created", cwd, hooks_state, hooks_state_len,
+                           (hook **) def->hooks->create_runtime, def->hooks->create_runtime_len, hooks_out_fd,
+                           hooks_err_fd, err);
+          if (UNLIKELY (ret != 0))
+            return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+        }
+    }
+
+  if (seccomp_generating)
+    {
+      ret = seccomp_generator_wait (&seccomp_gen, err);
+      if (UNLIKELY (ret < 0))
+        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+      libcrun_trace_end ("seccomp", seccomp_trace_start);
+    }
+  close_and_reset (&seccomp_fd);
+
+  /* sync 3.  */
+  ret = sync_socket_send_sync (sync_socket, true, err);
+  if (UNLIKELY (ret < 0))
+    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+
+  if (def->process && def->process->terminal && ! detach && context->console_socket == NULL)
+    {
+      terminal_fd = receive_fd_from_socket (socket_pair_0, err);
+      if (UNLIKELY (terminal_fd < 0))
+        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+
+      close_and_reset (&socket_pair_0);
+
+      ret = libcrun_setup_terminal_ptmx (terminal_fd, &orig_terminal, err);
+      if (UNLIKELY (ret < 0))
+        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+    }
+
+  /* sync 4.  */
+  trace_start = libcrun_trace_begin ();
+  ret = sync_socket_wait_sync (context, sync_socket, false, err);
+  if (UNLIKELY (ret < 0))
+    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+  libcrun_trace_end ("wait-init-2", trace_start);
+
+  ret = close_and_reset (&sync_socket);
+  if (UNLIKELY (ret < 0))
+    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+
+  get_current_timestamp (created);
+  ret = write_container_status (container, context, pid, cgroup_path, scope, created, err);
+  if (UNLIKELY (ret < 0))
+    return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+
+  /* Run poststart hooks here only if the container is created using "run".  For create+start, the
+     hooks will be executed as part of the start command.  */
+  if (context->fifo_exec_wait_fd < 0 && def->hooks && def->hooks->poststart_len)
+    {
+      trace_start = libcrun_trace_begin ();
+      ret = do_hooks (def, pid, context->id, true, NULL, "running", (hook **) def->hooks->poststart,
+                      def->hooks->poststart_len, hooks_out_fd, hooks_err_fd, err);
+      if (UNLIKELY (ret < 0))
+        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+      libcrun_trace_end ("poststart-hooks", trace_start);
+    }
+
+  /* Let's receive the seccomp notify fd and handle it as part of wait_for_process().  */
+  if (own_seccomp_receiver_fd >= 0)
+    {
+      seccomp_notify_fd = receive_fd_from_socket (own_seccomp_receiver_fd, err);
+      if (UNLIKELY (seccomp_notify_fd < 0))
+        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+
+      ret = close_and_reset (&own_seccomp_receiver_fd);
+      if (UNLIKELY (ret < 0))
+        return cleanup_watch (context, def, cgroup_path, cgroup_mode, pid, sync_socket, terminal_fd, err);
+    }
+
+  exec_server_fd = open_exec_server (context, container);
+
+  light_monitor = find_annotation (container, "run.oci.light_monitor");
+  ret = wait_for_process (pid, context, terminal_fd, notify_socket, container_ready_fd, seccomp_notify_fd,
+                          seccomp_notify_plugins, cgroup_path, light_monitor && strcmp (light_monitor, "true") == 0,
+                          container, exec_server_fd, err);
+  if (exec_server_fd >= 0)
+    close_exec_server (context, &exec_server_fd);
+  if (! context->detach)
+    {
+      libcrun_error_t tmp_err = NULL;
+      cleanup_watch (context, def, cgroup_path, cgroup_mode, 0, sync_socket, terminal_fd, &tmp_err);
+      crun_error_release (&tmp_err);
+    }
+
+  return ret;
+}
+
+static int
+check_config_file (runtime_spec_schema_config_schema *def, libcrun_context_t *context, libcrun_error_t *err)
+{
+  if (UNLIKELY (def->linux == NULL))
+    return crun_make_error (err, 0, "invalid config file, no 'linux' block specified");
+  if (context->exec_func == NULL)
+    {
+      if (UNLIKELY (def->root == NULL))
+        return crun_make_error (err, 0, "invalid config file, no 'root' block specified");
+      if (UNLIKELY (def->mounts == NULL))
+        return crun_make_error (err, 0, "invalid config file, no 'mounts' block specified");
+    }
+  return 0;
+}
+
+static int
+libcrun_copy_config_file (const char *id, const char *state_root, const char *config_file, const char *config_file_content, libcrun_error_t *err)
+{
+  int ret;
+  cleanup_free char *dest_path = NULL;
+  cleanup_free char *dir = NULL;
+  cleanup_free char *buffer = NULL;
+  size_t len;
+
+  dir = libcrun_get_state_directory (state_root, id);
+  if (UNLIKELY (dir == NULL))
+    return crun_make_error (err, 0, "cannot get state directory");
+
+  ret = append_paths (&dest_path, err, dir, "config.json", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (config_file == NULL && config_file_content == NULL)
+    return crun_make_error (err, 0, "config file not specified");
+
+  if (config_file == NULL)
+    {
+      ret = write_file (dest_path, config_file_content, strlen (config_file_content), err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+  else
+    {
+      ret = read_all_file (config_file, &buffer, &len, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = write_file (dest_path, buffer, len, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  return 0;
+}
+
+static void
+force_delete_container_status (libcrun_context_t *context, runtime_spec_schema_config_schema *def)
+{
+  libcrun_error_t tmp_err = NULL;
+  container_delete_internal (context, def, context->id, true, false, true, &tmp_err);
+  crun_error_release (&tmp_err);
+}
+
+int
+libcrun_container_run (libcrun_context_t *context, libcrun_container_t *container, unsigned int options,
+                       libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+  int ret;
+  int detach = context->detach;
+  int container_ret_status[2];
+  cleanup_close int pipefd0 = -1;
+  cleanup_close int pipefd1 = -1;
+  libcrun_error_t tmp_err = NULL;
+
+  container->context = context;
+
+  ret = check_config_file (def, context, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (def->oci_version && strstr (def->oci_version, "1.0") == NULL)
+    return crun_make_error (err, 0, "unknown version specified");
+
+  if (def->process && def->process->terminal && detach && context->console_socket == NULL)
+    return crun_make_error (err, 0, "use --console-socket with --detach when a terminal is used");
+
+  ret = libcrun_status_check_directories (context->state_root, context->id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (! detach && (options & LIBCRUN_RUN_OPTIONS_PREFORK) == 0)
+    {
+      ret = libcrun_copy_config_file (context->id, context->state_root, context->config_file, context->config_file_content, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = libcrun_container_run_internal (container, context, -1, err);
+      force_delete_container_status (context, def);
+      return ret;
+    }
+
+  ret = pipe (container_ret_status);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "pipe");
+  pipefd0 = container_ret_status[0];
+  pipefd1 = container_ret_status[1];
+
+  ret = fork ();
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fork");
+  if (ret)
+    {
+      int status;
+      close_and_reset (&pipefd1);
+
+      TEMP_FAILURE_RETRY (waitpid (ret, &status, 0));
+
+      ret = TEMP_FAILURE_RETRY (read (pipefd0, &status, sizeof (status)));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "invalid read from sync pipe");
+
+      if (status < 0)
+        {
+          int errno_;
+          char buf[512];
+          ret = TEMP_FAILURE_RETRY (read (pipefd0, &errno_, sizeof (errno_)));
+          if (UNLIKELY (ret < 0))
+            return crun_make_error (err, errno, "invalid read from sync pipe");
+
+          ret = TEMP_FAILURE_RETRY (read (pipefd0, buf, sizeof (buf) - 1));
+          if (UNLIKELY (ret < 0))
+            return crun_make_error (err, errno, "invalid read from sync pipe");
+          buf[ret] = '\0';
+
+          return crun_make_error (err, errno_, "%s", buf);
+        }
+
+      return status;
+    }
+
+  close_and_reset (&pipefd0);
+
+  /* forked process.  */
+  ret = detach_process ();
+  if (UNLIKELY (ret < 0))
+    libcrun_fail_with_error (errno, "detach process");
+
+  ret = libcrun_copy_config_file (context->id, context->state_root, context->config_file, context->config_file_content, &tmp_err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  ret = libcrun_container_run_internal (container, context, -1, &tmp_err);
+  TEMP_FAILURE_RETRY (write (pipefd1, &ret, sizeof (ret)));
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  exit (EXIT_SUCCESS);
+fail:
+
+  force_delete_container_status (context, def);
+  if (tmp_err)
+    {
+      TEMP_FAILURE_RETRY (write (pipefd1, &(tmp_err->status), sizeof (tmp_err->status)));
+      TEMP_FAILURE_RETRY (write (pipefd1, tmp_err->msg, strlen (tmp_err->msg) + 1));
+      crun_error_release (&tmp_err);
+    }
+
+  exit (EXIT_FAILURE);
+}
+
+int
+libcrun_container_create (libcrun_context_t *context, libcrun_container_t *container, unsigned int options,
+                          libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+  int ret;
+  int container_ready_pipe[2];
+  cleanup_close int pipefd0 = -1;
+  cleanup_close int pipefd1 = -1;
+  cleanup_close int exec_fifo_fd = -1;
+  context->detach = 1;
+
+  container->context = context;
+
+  if (def->oci_version && strstr (def->oci_version, "1.0") == NULL)
+    return crun_make_error (err, 0, "unknown version specified");
+
+  ret = check_config_file (def, context, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (def->process && def->process->terminal && context->console_socket == NULL)
+    return crun_make_error (err, 0, "use --console-socket with create when a terminal is used");
+
+  ret = libcrun_status_check_directories (context->state_root, context->id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  exec_fifo_fd = libcrun_status_create_exec_fifo (context->state_root, context->id, err);
+  if (UNLIKELY (exec_fifo_fd < 0))
+    return exec_fifo_fd;
+
+  context->fifo_exec_wait_fd = exec_fifo_fd;
+  exec_fifo_fd = -1;
+
+  /* Faster alternative to the exec fifo, the start command gets it from the
+     container process with pidfd_getfd(2).  */
+  context->start_event_fd = libcrun_status_create_start_event ();
+
+  if ((options & LIBCRUN_RUN_OPTIONS_PREFORK) == 0)
+    {
+      ret = libcrun_copy_config_file (context->id, context->state_root, context->config_file, context->config_file_content, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      ret = libcrun_container_run_internal (container, context, -1, err);
+      if (UNLIKELY (ret < 0))
+        force_delete_container_status (context, def);
+      return ret;
+    }
+
+  ret = pipe (container_ready_pipe);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "pipe");
+  pipefd0 = container_ready_pipe[0];
+  pipefd1 = container_ready_pipe[1];
+
+  ret = fork ();
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fork");
+  if (ret)
+    {
+      int exit_code;
+      close_and_reset (&pipefd1);
+
+      TEMP_FAILURE_RETRY (waitpid (ret, NULL, 0));
+
+      ret = TEMP_FAILURE_RETRY (read (pipefd0, &exit_code, sizeof (exit_code)));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "waiting for container to be ready");
+      if (ret > 0)
+        {
+          if (exit_code != 0)
+            {
+              libcrun_error_t tmp_err = NULL;
+              libcrun_container_delete (context, def, context->id, true, &tmp_err);
+              crun_error_release (err);
+            }
+          return -exit_code;
+        }
+      return 1;
+    }
+
+  /* forked process.  */
+  ret = detach_process ();
+  if (UNLIKELY (ret < 0))
+    libcrun_fail_with_error (errno, "detach process");
+
+  ret = libcrun_copy_config_file (context->id, context->state_root, context->config_file, context->config_file_content, err);
+  if (UNLIKELY (ret < 0))
+    libcrun_fail_with_error (errno, "copy config file");
+
+  ret = libcrun_container_run_internal (container, context, pipefd1, err);
+  if (UNLIKELY (ret < 0))
+    {
+      force_delete_container_status (context, def);
+      libcrun_error ((*err)->status, "%s", (*err)->msg);
+      crun_set_output_handler (log_write_to_stderr, NULL, false);
+    }
+
+  TEMP_FAILURE_RETRY (write (pipefd1, &ret, sizeof (ret)));
+  exit (ret ? EXIT_FAILURE : 0);
+}
+
+/* Create the container CONTEXT->ID from the template TEMPLATE_ID, a
+   container created with the run.oci.template annotation and not started
+   yet.  The new container process is forked by the template, so it
+   skips the whole setup.  It has the configuration of the template, only
+   the HOSTNAME, if not NULL, and the N_ENV variables in ENV are changed.
+   It is left in the created state and gets its own cgroup.  */
+int
+libcrun_container_create_from_template (libcrun_context_t *context, const char *template_id, const char *hostname,
+                                        char **env, size_t n_env, libcrun_error_t *err)
+{
+  cleanup_container_status libcrun_container_status_t template_status = {};
+  cleanup_container libcrun_container_t *container = NULL;
+  const char *state_root = context->state_root;
+  runtime_spec_schema_config_schema *def;
+  cleanup_free char *template_dir = NULL;
+  cleanup_free char *config_path = NULL;
+  cleanup_free char *socket_path = NULL;
+  cleanup_free char *payload = NULL;
+  cleanup_free char *cgroup_path = NULL;
+  cleanup_free char *scope = NULL;
+  cleanup_close int fifo_fd = -1;
+  cleanup_close int conn = -1;
+  char ctrl_buf[CMSG_SPACE (sizeof (struct ucred))] = {};
+  struct iovec iov;
+  struct msghdr msg = {};
+  struct cmsghdr *cmsg;
+  struct ucred cred;
+  size_t payload_len, i;
+  int fds[TEMPLATE_REQUEST_FDS];
+  int cgroup_mode, one = 1;
+  uid_t root_uid = -1;
+  gid_t root_gid = -1;
+  char created[35];
+  char buffer[1];
+  int ret;
+
+  ret = libcrun_read_container_status (&template_status, state_root, template_id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = libcrun_status_has_read_exec_fifo (state_root, template_id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  if (ret == 0)
+    return crun_make_error (err, 0, "the template `%s` is not in the created state", template_id);
+
+  ret = read_container_config_from_state (&container, state_root, template_id, 0, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  def = container->container_def;
+
+  if (! is_template (container))
+    return crun_make_error (err, 0, "the container `%s` is not a template", template_id);
+
+  payload_len = (hostname ? strlen (hostname) : 0) + 1;
+  for (i = 0; i < n_env; i++)
+    payload_len += strlen (env[i]) + 1;
+  if (payload_len > TEMPLATE_REQUEST_MAX_SIZE)
+    return crun_make_error (err, 0, "too many environment variables");
+  payload = xmalloc (payload_len);
+  payload_len = sprintf (payload, "%s", hostname ? hostname : "") + 1;
+  for (i = 0; i < n_env; i++)
+    payload_len += sprintf (payload + payload_len, "%s", env[i]) + 1;
+
+  ret = libcrun_status_check_directories (state_root, context->id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  fifo_fd = libcrun_status_create_exec_fifo (state_root, context->id, err);
+  if (UNLIKELY (fifo_fd < 0))
+    {
+      ret = fifo_fd;
+      goto fail;
+    }
+
+  template_dir = libcrun_get_state_directory (state_root, template_id);
+  ret = append_paths (&config_path, err, template_dir, "config.json", NULL);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  ret = libcrun_copy_config_file (context->id, state_root, config_path, NULL, err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  socket_path = get_template_socket_path (state_root, template_id);
+  conn = open_unix_domain_client_socket (socket_path, 0, err);
+  if (UNLIKELY (conn < 0))
+    {
+      ret = conn;
+      goto fail;
+    }
+
+  /* The PID of the new process is received with its credentials.  */
+  ret = setsockopt (conn, SOL_SOCKET, SO_PASSCRED, &one, sizeof (one));
+  if (UNLIKELY (ret < 0))
+    {
+      ret = crun_make_error (err, errno, "setsockopt SO_PASSCRED");
+      goto fail;
+    }
+
+  fds[0] = fifo_fd;
+  fds[1] = 0;
+  fds[2] = 1;
+  fds[3] = 2;
+  ret = send_template_request (conn, fds, payload, payload_len, err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  iov.iov_base = buffer;
+  iov.iov_len = sizeof (buffer);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl_buf;
+  msg.msg_controllen = sizeof (ctrl_buf);
+  ret = TEMP_FAILURE_RETRY (recvmsg (conn, &msg, 0));
+  if (UNLIKELY (ret <= 0))
+    {
+      ret = crun_make_error (err, ret < 0 ? errno : 0, "the template `%s` could not create the container", template_id);
+      goto fail;
+    }
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if (UNLIKELY (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS))
+    {
+      ret = crun_make_error (err, 0, "no credentials received from the template `%s`", template_id);
+      goto fail;
+    }
+  memcpy (&cred, CMSG_DATA (cmsg), sizeof (cred));
+
+  container->context = context;
+
+  cgroup_mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (cgroup_mode < 0))
+    {
+      ret = cgroup_mode;
+      goto fail_kill;
+    }
+
+  get_root_in_the_userns (def, container->host_uid, container->host_gid, &root_uid, &root_gid);
+
+  {
+    struct libcrun_cgroup_args cg = {
+      .resources = def->linux ? def->linux->resources : NULL,
+      .annotations = def->annotations,
+      .cgroup_mode = cgroup_mode,
+      .path = &cgroup_path,
+      .scope = &scope,
+      /* Do not reuse the cgroup of the template.  */
+      .cgroup_path = "",
+      .manager = context->systemd_cgroup ? CGROUP_MANAGER_SYSTEMD
+                 : context->force_no_cgroup ? CGROUP_MANAGER_DISABLED
+                                            : CGROUP_MANAGER_CGROUPFS,
+      .pid = cred.pid,
+      .root_uid = root_uid,
+      .root_gid = root_gid,
+      .id = context->id,
+      .systemd_subgroup = find_systemd_subgroup (container, cgroup_mode),
+      .delegate_cgroup = find_delegate_cgroup (container),
+    };
+
+    ret = libcrun_cgroup_enter (&cg, err);
+    if (UNLIKELY (ret < 0))
+      goto fail_kill;
+  }
+
+  get_current_timestamp (created);
+  ret = write_container_status (container, context, cred.pid, cgroup_path, scope, created, err);
+  if (UNLIKELY (ret < 0))
+    goto fail_kill;
+
+  if (context->pid_file)
+    {
+      char pid_buf[16];
+
+      sprintf (pid_buf, "%d", cred.pid);
+      ret = write_file_with_flags (context->pid_file, O_CREAT | O_TRUNC, pid_buf, strlen (pid_buf), err);
+      if (UNLIKELY (ret < 0))
+        goto fail_kill;
+    }
+
+  return 0;
+
+fail_kill:
+  kill (cred.pid, SIGKILL);
+fail:
+  {
+    libcrun_error_t tmp_err = NULL;
+
+    libcrun_container_delete_status (state_root, context->id, &tmp_err);
+    crun_error_release (&tmp_err);
+  }
+  return ret;
+}
+
+struct batch_config_s
+{
+  char *path;
+  char *content;
+};
+
+static const char *
+get_batch_config_content (struct batch_config_s *configs, size_t *configs_len, const char *path, libcrun_error_t *err)
+{
+  cleanup_free char *content = NULL;
+  size_t i, len;
+  int ret;
+
+  for (i = 0; i < *configs_len; i++)
+    if (strcmp (configs[i].path, path) == 0)
+      return configs[i].content;
+
+  ret = read_all_file (path, &content, &len, err);
+  if (UNLIKELY (ret < 0))
+    return NULL;
+
+  configs[*configs_len].path = xstrdup (path);
+  configs[*configs_len].content = content;
+  content = NULL;
+  return configs[(*configs_len)++].content;
+}
+
+static int
+create_batch_entry (libcrun_context_t *context, libcrun_container_batch_entry_t *entry, struct batch_config_s *configs,
+                    size_t *configs_len, libcrun_error_t *err)
+{
+  cleanup_container libcrun_container_t *container = NULL;
+  cleanup_free char *config_path = NULL;
+  libcrun_context_t entry_context;
+  const char *content;
+  int ret;
+
+  if (entry->id == NULL)
+    return crun_make_error (err, 0, "missing container id");
+
+  if (entry->bundle == NULL || entry->bundle[0] != '/')
+    return crun_make_error (err, 0, "the bundle for `%s` must be an absolute path", entry->id);
+
+  if (entry->config_file && entry->config_file[0] == '/')
+    config_path = xstrdup (entry->config_file);
+  else
+    {
+      ret = append_paths (&config_path, err, entry->bundle, entry->config_file ? entry->config_file : "config.json",
+                          NULL);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  /* Containers in the same batch often share the configuration file, read it only once.  */
+  content = get_batch_config_content (configs, configs_len, config_path, err);
+  if (UNLIKELY (content == NULL))
+    return -1;
+
+  container = libcrun_container_load_from_memory (content, err);
+  if (UNLIKELY (container == NULL))
+    return -1;
+
+  /* The rootfs and the mounts are relative to the bundle.  */
+  ret = chdir (entry->bundle);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "chdir `%s`", entry->bundle);
+
+  memcpy (&entry_context, context, sizeof (entry_context));
+  entry_context.id = entry->id;
+  entry_context.bundle = entry->bundle;
+  entry_context.config_file = NULL;
+  entry_context.config_file_content = content;
+  entry_context.pid_file = entry->pid_file;
+  entry_context.console_socket = entry->console_socket;
+  entry_context.fifo_exec_wait_fd = -1;
+  entry_context.start_event_fd = -1;
+
+  ret = libcrun_container_create (&entry_context, container, 0, err);
+
+  /* The exec fifo is used only by the container process, do not leak it to the next ones.  */
+  if (entry_context.fifo_exec_wait_fd >= 0)
+    close_and_reset (&entry_context.fifo_exec_wait_fd);
+  if (entry_context.start_event_fd >= 0)
+    close_and_reset (&entry_context.start_event_fd);
+
+  return ret;
+}
+
+/* Create all the containers in ENTRIES from a single process, so that the
+   process setup and the configuration parsing are done once.  The outcome of
+   each creation is stored in the entry.  Returns the number of containers
+   that could not be created, or a negative value if the working directory
+   cannot be restored.  */
+int
+libcrun_container_create_batch (libcrun_context_t *context, libcrun_container_batch_entry_t *entries, size_t len,
+                                libcrun_error_t *err)
+{
+  struct batch_config_s *configs;
+  cleanup_close int cwd_fd = -1;
+  size_t i, configs_len = 0;
+  int failed = 0;
+  int ret;
+
+  cwd_fd = open (".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (UNLIKELY (cwd_fd < 0))
+    return crun_make_error (err, errno, "open current directory");
+
+  configs = xmalloc0 (sizeof (*configs) * (len + 1));
+
+  for (i = 0; i < len; i++)
+    {
+      if (entries[i].ret < 0)
+        {
+          failed++;
+          continue;
+        }
+      entries[i].err = NULL;
+      entries[i].ret = create_batch_entry (context, &entries[i], configs, &configs_len, &entries[i].err);
+      if (entries[i].ret < 0)
+        failed++;
+    }
+
+  for (i = 0; i < configs_len; i++)
+    {
+      free (configs[i].path);
+      free (configs[i].content);
+    }
+  free (configs);
+
+  ret = fchdir (cwd_fd);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fchdir");
+
+  return failed;
+}
+
+int
+libcrun_container_start (libcrun_context_t *context, const char *id, libcrun_error_t *err)
+{
+  cleanup_container libcrun_container_t *container = NULL;
+  const char *state_root = context->state_root;
+  runtime_spec_schema_config_schema *def;
+  libcrun_container_status_t status = {};
+  cleanup_close int fd = -1;
+  int ret;
+
+  ret = libcrun_read_container_status (&status, state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = libcrun_is_container_running (&status, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (! ret)
+    return crun_make_error (err, 0, "container `%s` is not running", id);
+
+  ret = read_container_config_from_state (&container, state_root, id, CONFIG_SECTIONS_LIFECYCLE, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (context->notify_socket)
+    {
+      ret = get_notify_fd (context, container, &fd, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  ret = libcrun_status_write_start_event (&status, context->state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  if (ret == 0)
+    {
+      ret = libcrun_status_write_exec_fifo (context->state_root, id, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  def = container->container_def;
+
+  if (context->notify_socket)
+    {
+      if (fd >= 0)
+        {
+          fd_set read_set;
+
+          while (1)
+            {
+              struct timeval timeout = {
+                .tv_sec = 0,
+                .tv_usec = 10000,
+              };
+              FD_ZERO (&read_set);
+              FD_SET (fd, &read_set);
+
+              ret = select (fd + 1, &read_set, NULL, NULL, &timeout);
+              if (UNLIKELY (ret < 0))
+                return ret;
+              if (ret)
+                {
+                  ret = handle_notify_socket (fd, err);
+                  if (UNLIKELY (ret < 0))
+                    return ret;
+                  if (ret)
+                    break;
+                }
+              else
+                {
+                  ret = libcrun_is_container_running (&status, err);
+                  if (UNLIKELY (ret < 0))
+                    return ret;
+                  if (! ret)
+                    return 0;
+                }
+            }
+        }
+    }
+
+  /* The container is considered running only after we got the notification from the
+     notify_socket, if any.  */
+  if (def->hooks && def->hooks->poststart_len)
+    {
+      cleanup_close int hooks_out_fd = -1;
+      cleanup_close int hooks_err_fd = -1;
+
+      ret = open_hooks_output (container, &hooks_out_fd, &hooks_err_fd, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = do_hooks (def, status.pid, context->id, true, status.bundle, "running", (hook **) def->hooks->poststart,
+                      def->hooks->poststart_len, hooks_out_fd, hooks_err_fd, err);
+      if (UNLIKELY (ret < 0))
+        crun_error_release (err);
+    }
+
+  return 0;
+}
+
+/* Wait until there is a pending connection on one of the N_FDS listening
+   sockets in FDS, then start the container ID.  The sockets are not
+   accepted, the container gets them through LISTEN_FDS.  Returns 0 without
+   starting it if the container exits or is started in the meanwhile.  */
+int
+libcrun_container_start_on_activity (libcrun_context_t *context, const char *id, int *fds, size_t n_fds,
+                                     libcrun_error_t *err)
+{
+  cleanup_container_status libcrun_container_status_t status = {};
+  cleanup_free struct pollfd *pfds = NULL;
+  size_t i;
+  int ret;
+
+  ret = libcrun_read_container_status (&status, context->state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  pfds = xmalloc0 (sizeof (*pfds) * (n_fds + 1));
+  for (i = 0; i < n_fds; i++)
+    {
+      pfds[i].fd = fds[i];
+      pfds[i].events = POLLIN;
+    }
+
+  while (1)
+    {
+      ret = poll (pfds, n_fds, 1000);
+      if (UNLIKELY (ret < 0))
+        {
+          if (errno == EINTR)
+            continue;
+          return crun_make_error (err, errno, "poll");
+        }
+      if (ret > 0)
+        break;
+
+      /* Nothing to do anymore if the container was deleted or started.  */
+      ret = libcrun_is_container_running (&status, err);
+      if (UNLIKELY (ret <= 0))
+        return ret;
+
+      ret = libcrun_status_has_read_exec_fifo (context->state_root, id, err);
+      if (UNLIKELY (ret <= 0))
+        return ret;
+    }
+
+  return libcrun_container_start (context, id, err);
+}
+
+int
+libcrun_get_container_state_string (const char *id, libcrun_container_status_t *status, const char *state_root,
+                                    const char **container_status, int *running, libcrun_error_t *err)
+{
+  int ret, has_fifo = 0;
+  bool paused = false;
+
+  ret = libcrun_is_container_running (status, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  *running = ret;
+
+  if (*running)
+    {
+      ret = libcrun_status_has_read_exec_fifo (state_root, id, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      has_fifo = ret;
+    }
+
+  if (*running && ! has_fifo)
+    {
+      int cgroup_mode;
+
+      cgroup_mode = libcrun_get_cgroup_mode (err);
+      if (UNLIKELY (cgroup_mode < 0))
+        return cgroup_mode;
+
+      ret = libcrun_cgroup_is_container_paused (status->cgroup_path, cgroup_mode, &paused, err);
+      if (UNLIKELY (ret < 0))
+        {
+          /*
+            The cgroup might have been cleaned up by the time we try to read it, ignore both
+            ENOENT and ENODEV:
+            - ENOENT: if the open(CGROUP_PATH) fails because the cgroup was deleted.
+            - ENODEV: if the cgroup is deleted between the open and reading the freeze status.
+          */
+
+          errno = crun_error_get_errno (err);
+          if (errno == ENOENT || errno == ENODEV)
+            {
+              crun_error_release (err);
+              *container_status = "stopped";
+              return 0;
+            }
+
+          return ret;
+        }
+    }
+
+  if (! *running)
+    *container_status = "stopped";
+  else if (has_fifo)
+    *container_status = "created";
+  else if (paused)
+    *container_status = "paused";
+  else
+    *container_status = "running";
+
+  return 0;
+}
+
+/* Everything needed to print the state of a container.  It is collected
+   separately from the JSON generation, so that it can be done by several
+   threads for crun state --all.  */
+struct container_state_s
+{
+  const char *id;
+  libcrun_container_status_t *status;
+  libcrun_container_status_t read_status;
+  const char *container_status;
+  int running;
+  libcrun_container_t *container;
+  libcrun_error_t err;
+  int ret;
+};
+
+/* Fill STATE for the container STATE->ID.  If STATE->STATUS is NULL, the
+   status file is read first.  THREADED is set when it runs in a worker
+   thread.  */
+static int
+container_state_load (struct container_state_s *state, const char *state_root, bool threaded, libcrun_error_t *err)
+{
+  cleanup_free char *config_file = NULL;
+  cleanup_free char *dir = NULL;
+  int ret;
+
+  if (state->status == NULL)
+    {
+      ret = libcrun_read_container_status (&state->read_status, state_root, state->id, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      state->status = &state->read_status;
+    }
+
+  ret = libcrun_get_container_state_string (state->id, state->status, state_root, &state->container_status,
+                                            &state->running, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  dir = libcrun_get_state_directory (state_root, state->id);
+  if (UNLIKELY (dir == NULL))
+    return crun_make_error (err, 0, "cannot get state directory");
+
+  ret = append_paths (&config_file, err, dir, "config.json", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (threaded)
+    state->container = container_parse_file (config_file, err);
+  else
+    state->container = libcrun_container_load_from_file (config_file, err);
+  if (UNLIKELY (state->container == NULL))
+    return crun_make_error (err, 0, "error loading config.json");
+
+  return 0;
+}
+
+static void
+container_state_free (struct container_state_s *state)
+{
+  libcrun_container_free (state->container);
+  state->container = NULL;
+  libcrun_free_container_status (&state->read_status);
+  crun_error_release (&state->err);
+}
+
+/* Add to GEN the state loaded by container_state_load.  */
+static void
+container_state_emit (yajl_gen gen, struct container_state_s *state)
+{
+  const char *const OCI_CONFIG_VERSION = "1.0.0";
+  const char *container_status = state->container_status;
+  libcrun_container_status_t *status = state->status;
+  libcrun_container_t *container = state->container;
+  const char *id = state->id;
+  int running = state->running;
+  size_t i;
+
+  yajl_gen_map_open (gen);
+  yajl_gen_string (gen, YAJL_STR ("ociVersion"), strlen ("ociVersion"));
+  yajl_gen_string (gen, YAJL_STR (OCI_CONFIG_VERSION), strlen (OCI_CONFIG_VERSION));
+
+  yajl_gen_string (gen, YAJL_STR ("id"), strlen ("id"));
+  yajl_gen_string (gen, YAJL_STR (id), strlen (id));
+
+  yajl_gen_string (gen, YAJL_STR ("pid"), strlen ("pid"));
+  yajl_gen_integer (gen, running ? status->pid : 0);
+
+  yajl_gen_string (gen, YAJL_STR ("status"), strlen ("status"));
+  yajl_gen_string (gen, YAJL_STR (container_status), strlen (container_status));
+
+  yajl_gen_string (gen, YAJL_STR ("bundle"), strlen ("bundle"));
+  yajl_gen_string (gen, YAJL_STR (status->bundle), strlen (status->bundle));
+
+  yajl_gen_string (gen, YAJL_STR ("rootfs"), strlen ("rootfs"));
+  yajl_gen_string (gen, YAJL_STR (status->rootfs), strlen (status->rootfs));
+
+  yajl_gen_string (gen, YAJL_STR ("created"), strlen ("created"));
+  yajl_gen_string (gen, YAJL_STR (status->created), strlen (status->created));
+
+  yajl_gen_string (gen, YAJL_STR ("owner"), strlen ("owner"));
+  yajl_gen_string (gen, YAJL_STR (status->owner), strlen (status->owner));
+
+  if (container->container_def->annotations && container->container_def->annotations->len)
+    {
+      yajl_gen_string (gen, YAJL_STR ("annotations"), strlen ("annotations"));
+      yajl_gen_map_open (gen);
+      for (i = 0; i < container->container_def->annotations->len; i++)
+        {
+          const char *key = container->container_def->annotations->keys[i];
+          const char *val = container->container_def->annotations->values[i];
+          yajl_gen_string (gen, YAJL_STR (key), strlen (key));
+          yajl_gen_string (gen, YAJL_STR (val), strlen (val));
+        }
+      yajl_gen_map_close (gen);
+    }
+
+  yajl_gen_map_close (gen);
+}
+
+/* Add to GEN the state of the container ID.  Nothing is added on errors.  */
+static int
+container_state_gen (yajl_gen gen, const char *state_root, const char *id, libcrun_container_status_t *status,
+                     libcrun_error_t *err)
+{
+  struct container_state_s state = {
+    .id = id,
+    .status = status,
+  };
+  int ret;
+
+  ret = container_state_load (&state, state_root, false, err);
+  if (LIKELY (ret >= 0))
+    container_state_emit (gen, &state);
+  container_state_free (&state);
+  return ret;
+}
 
-  if (def->process && def->process->terminal && detach && context->console_socket == NULL)
-    return crun_make_error (err, 0, "use --console-socket with --detach when a terminal is used");
+int
+libcrun_container_state (libcrun_context_t *context, const char *id, FILE *out, libcrun_error_t *err)
+{
+  libcrun_container_status_t status = {};
+  const char *state_root = context->state_root;
+  yajl_gen gen = NULL;
+  const unsigned char *buf;
+  int ret = 0;
+  size_t len;
 
-  ret = libcrun_status_check_directories (context->state_root, context->id, err);
+  ret = libcrun_read_container_status (&status, state_root, id, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  if (! detach && (options & LIBCRUN_RUN_OPTIONS_PREFORK) == 0)
+  gen = yajl_gen_alloc (NULL);
+  if (gen == NULL)
     {
-      ret = libcrun_copy_config_file (context->id, context->state_root, context->config_file, context->config_file_content, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
-
-      ret = libcrun_container_run_internal (container, context, -1, err);
-      force_delete_container_status (context, def);
-      return ret;
+      ret = crun_make_error (err, 0, "yajl_gen_alloc failed");
+      goto exit;
     }
 
-  ret = pipe (container_ret_status);
-  if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "pipe");
-  pipefd0 = container_ret_status[0];
-  pipefd1 = container_ret_status[1];
+  yajl_gen_config (gen, yajl_gen_beautify, 1);
+  yajl_gen_config (gen, yajl_gen_validate_utf8, 1);
 
-  ret = fork ();
+  ret = container_state_gen (gen, state_root, id, &status, err);
   if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "fork");
-  if (ret)
+    goto exit;
+
+  if (yajl_gen_get_buf (gen, &buf, &len) != yajl_gen_status_ok)
     {
-      int status;
-      close_and_reset (&pipefd1);
+      ret = crun_make_error (err, 0, "error generating JSON");
+      goto exit;
+    }
 
-      TEMP_FAILURE_RETRY (waitpid (ret, &status, 0));
+  fprintf (out, "%s\n", buf);
 
-      ret = TEMP_FAILURE_RETRY (read (pipefd0, &status, sizeof (status)));
-      if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "invalid read from sync pipe");
+exit:
+  if (gen)
+    yajl_gen_free (gen);
+  libcrun_free_container_status (&status);
+  return ret;
+}
 
-      if (status < 0)
-        {
-          int errno_;
-          char buf[512];
-          ret = TEMP_FAILURE_RETRY (read (pipefd0, &errno_, sizeof (errno_)));
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "invalid read from sync pipe");
+/* Print the state of all the containers as a JSON array.  The list of the
+   containers and their status come from the status index when it is
+   available.  Containers whose state cannot be read are skipped with a
+   warning.  */
+struct container_state_all_s
+{
+  const char *state_root;
+  struct container_state_s *states;
+  size_t len;
+  size_t next;
+  bool threaded;
+};
 
-          ret = TEMP_FAILURE_RETRY (read (pipefd0, buf, sizeof (buf) - 1));
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "invalid read from sync pipe");
-          buf[ret] = '\0';
+static void *
+container_state_all_worker (void *arg)
+{
+  struct container_state_all_s *all = arg;
 
-          return crun_make_error (err, errno_, "%s", buf);
-        }
+  for (;;)
+    {
+      size_t i = __atomic_fetch_add (&all->next, 1, __ATOMIC_RELAXED);
+      struct container_state_s *state;
 
-      return status;
+      if (i >= all->len)
+        break;
+
+      state = &all->states[i];
+      state->ret = container_state_load (state, all->state_root, all->threaded, &state->err);
     }
 
-  close_and_reset (&pipefd0);
+  return NULL;
+}
 
-  /* forked process.  */
-  ret = detach_process ();
-  if (UNLIKELY (ret < 0))
-    libcrun_fail_with_error (errno, "detach process");
+/* Spread the loading over threads only with many containers, the thread
+   creation is not worth it otherwise.  */
+#define STATE_ALL_PARALLEL_MIN 16
+#define STATE_ALL_MAX_WORKERS 4
+
+/* Load the state of all the containers in ALL.  Each container costs a
+   liveness check, which reads /proc/PID/stat unless kill(2) already tells
+   the process is gone, and the parsing of its config.json, plus a status
+   file read when the index is not available.  These are independent, so
+   they are done by a pool of threads, while the JSON is generated later in
+   the original order by the caller.  pidfds would not save the /proc read:
+   pidfd_open(2) succeeds for a recycled pid too, so the start time must be
+   checked anyway.  */
+static void
+container_state_all_load (struct container_state_all_s *all)
+{
+#ifdef HAVE_PTHREAD
+  pthread_t threads[STATE_ALL_MAX_WORKERS];
+  size_t n_threads = 0;
+  size_t i;
 
-  ret = libcrun_copy_config_file (context->id, context->state_root, context->config_file, context->config_file_content, &tmp_err);
-  if (UNLIKELY (ret < 0))
-    goto fail;
+  if (all->len >= STATE_ALL_PARALLEL_MIN)
+    {
+      long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      size_t n_workers = cpus > STATE_ALL_MAX_WORKERS ? STATE_ALL_MAX_WORKERS : (cpus > 1 ? cpus : 1);
+      libcrun_error_t tmp_err = NULL;
 
-  ret = libcrun_container_run_internal (container, context, -1, &tmp_err);
-  TEMP_FAILURE_RETRY (write (pipefd1, &ret, sizeof (ret)));
-  if (UNLIKELY (ret < 0))
-    goto fail;
+      /* Cache the cgroup mode before the workers need it.  */
+      if (UNLIKELY (libcrun_get_cgroup_mode (&tmp_err) < 0))
+        crun_error_release (&tmp_err);
 
-  exit (EXIT_SUCCESS);
-fail:
+      all->threaded = n_workers > 1;
 
-  force_delete_container_status (context, def);
-  if (tmp_err)
-    {
-      TEMP_FAILURE_RETRY (write (pipefd1, &(tmp_err->status), sizeof (tmp_err->status)));
-      TEMP_FAILURE_RETRY (write (pipefd1, tmp_err->msg, strlen (tmp_err->msg) + 1));
-      crun_error_release (&tmp_err);
+      /* The calling thread is a worker too.  */
+      for (i = 1; i < n_workers; i++)
+        {
+          if (pthread_create (&threads[n_threads], NULL, container_state_all_worker, all) != 0)
+            break;
+          n_threads++;
+        }
     }
+#endif
 
-  exit (EXIT_FAILURE);
+  container_state_all_worker (all);
+
+#ifdef HAVE_PTHREAD
+  for (i = 0; i < n_threads; i++)
+    pthread_join (threads[i], NULL);
+#endif
 }
 
 int
-libcrun_container_create (libcrun_context_t *context, libcrun_container_t *container, unsigned int options,
-                          libcrun_error_t *err)
+libcrun_container_state_all (libcrun_context_t *context, FILE *out, libcrun_error_t *err)
 {
-  runtime_spec_schema_config_schema *def = container->container_def;
+  struct container_state_all_s all = {
+    .state_root = context->state_root,
+  };
+  libcrun_container_list_t *list = NULL, *it;
+  yajl_gen gen = NULL;
+  const unsigned char *buf;
+  size_t len, i;
   int ret;
-  int container_ready_pipe[2];
-  cleanup_close int pipefd0 = -1;
-  cleanup_close int pipefd1 = -1;
-  cleanup_close int exec_fifo_fd = -1;
-  context->detach = 1;
-
-  container->context = context;
-
-  if (def->oci_version && strstr (def->oci_version, "1.0") == NULL)
-    return crun_make_error (err, 0, "unknown version specified");
-
-  ret = check_config_file (def, context, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
-
-  if (def->process && def->process->terminal && context->console_socket == NULL)
-    return crun_make_error (err, 0, "use --console-socket with create when a terminal is used");
 
-  ret = libcrun_status_check_directories (context->state_root, context->id, err);
+  ret = libcrun_get_containers_list (&list, all.state_root, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  exec_fifo_fd = libcrun_status_create_exec_fifo (context->state_root, context->id, err);
-  if (UNLIKELY (exec_fifo_fd < 0))
-    return exec_fifo_fd;
-
-  context->fifo_exec_wait_fd = exec_fifo_fd;
-  exec_fifo_fd = -1;
+  for (it = list; it; it = it->next)
+    all.len++;
 
-  if ((options & LIBCRUN_RUN_OPTIONS_PREFORK) == 0)
+  /* The status comes from the index when it is available.  */
+  all.states = xmalloc0 (sizeof (*all.states) * (all.len + 1));
+  for (i = 0, it = list; it; it = it->next, i++)
     {
-      ret = libcrun_copy_config_file (context->id, context->state_root, context->config_file, context->config_file_content, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
-      ret = libcrun_container_run_internal (container, context, -1, err);
-      if (UNLIKELY (ret < 0))
-        force_delete_container_status (context, def);
-      return ret;
+      all.states[i].id = it->name;
+      all.states[i].status = it->status;
     }
 
-  ret = pipe (container_ready_pipe);
-  if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "pipe");
-  pipefd0 = container_ready_pipe[0];
-  pipefd1 = container_ready_pipe[1];
+  container_state_all_load (&all);
 
-  ret = fork ();
-  if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "fork");
-  if (ret)
+  gen = yajl_gen_alloc (NULL);
+  if (gen == NULL)
     {
-      int exit_code;
-      close_and_reset (&pipefd1);
+      ret = crun_make_error (err, 0, "yajl_gen_alloc failed");
+      goto exit;
+    }
 
-      TEMP_FAILURE_RETRY (waitpid (ret, NULL, 0));
+  yajl_gen_config (gen, yajl_gen_beautify, 1);
+  yajl_gen_config (gen, yajl_gen_validate_utf8, 1);
 
-      ret = TEMP_FAILURE_RETRY (read (pipefd0, &exit_code, sizeof (exit_code)));
-      if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "waiting for container to be ready");
-      if (ret > 0)
+  yajl_gen_array_open (gen);
+  for (i = 0; i < all.len; i++)
+    {
+      if (UNLIKELY (all.states[i].ret < 0))
         {
-          if (exit_code != 0)
-            {
-              libcrun_error_t tmp_err = NULL;
-              libcrun_container_delete (context, def, context->id, true, &tmp_err);
-              crun_error_release (err);
-            }
-          return -exit_code;
+          libcrun_error_t *state_err = &all.states[i].err;
+
+          libcrun_error_write_warning_and_release (stderr, &state_err);
+          continue;
         }
-      return 1;
+      container_state_emit (gen, &all.states[i]);
     }
+  yajl_gen_array_close (gen);
 
-  /* forked process.  */
-  ret = detach_process ();
-  if (UNLIKELY (ret < 0))
-    libcrun_fail_with_error (errno, "detach process");
+  if (yajl_gen_get_buf (gen, &buf, &len) != yajl_gen_status_ok)
+    {
+      ret = crun_make_error (err, 0, "error generating JSON");
+      goto exit;
+    }
 
-  ret = libcrun_copy_config_file (context->id, context->state_root, context->config_file, context->config_file_content, err);
-  if (UNLIKELY (ret < 0))
-    libcrun_fail_with_error (errno, "copy config file");
+  fprintf (out, "%s\n", buf);
+  ret = 0;
 
-  ret = libcrun_container_run_internal (container, context, pipefd1, err);
-  if (UNLIKELY (ret < 0))
+exit:
+  if (gen)
+    yajl_gen_free (gen);
+  for (i = 0; i < all.len; i++)
+    container_state_free (&all.states[i]);
+  free (all.states);
+  libcrun_free_containers_list (list);
+  return ret;
+}
+
+static int
+gen_string_array (yajl_gen gen, const char *key, char **values, size_t len)
+{
+  size_t i;
+  int r;
+
+  r = yajl_gen_string (gen, YAJL_STR (key), strlen (key));
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    return r;
+
+  r = yajl_gen_array_open (gen);
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    return r;
+
+  /* The arrays built by the callers are also NULL terminated, and LEN can
+     count more entries than they really have.  */
+  for (i = 0; i < len && values[i]; i++)
     {
-      force_delete_container_status (context, def);
-      libcrun_error ((*err)->status, "%s", (*err)->msg);
-      crun_set_output_handler (log_write_to_stderr, NULL, false);
+      r = yajl_gen_string (gen, YAJL_STR (values[i]), strlen (values[i]));
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        return r;
     }
 
-  TEMP_FAILURE_RETRY (write (pipefd1, &ret, sizeof (ret)));
-  exit (ret ? EXIT_FAILURE : 0);
+  return yajl_gen_array_close (gen);
 }
 
-int
-libcrun_container_start (libcrun_context_t *context, const char *id, libcrun_error_t *err)
+static int
+gen_string_field (yajl_gen gen, const char *key, const char *value)
 {
-  cleanup_container libcrun_container_t *container = NULL;
-  const char *state_root = context->state_root;
-  runtime_spec_schema_config_schema *def;
-  libcrun_container_status_t status = {};
-  cleanup_close int fd = -1;
-  int ret;
+  int r;
 
-  ret = libcrun_read_container_status (&status, state_root, id, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  r = yajl_gen_string (gen, YAJL_STR (key), strlen (key));
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    return r;
 
-  ret = libcrun_is_container_running (&status, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  return yajl_gen_string (gen, YAJL_STR (value), strlen (value));
+}
 
-  if (! ret)
-    return crun_make_error (err, 0, "container `%s` is not running", id);
+/* Encode the fields of PROCESS that the exec server honours.  */
+static int
+get_exec_request (runtime_spec_schema_config_schema_process *process, char **out, size_t *out_len,
+                  libcrun_error_t *err)
+{
+  const unsigned char *buf = NULL;
+  yajl_gen gen = NULL;
+  size_t i, buf_len;
+  int r;
 
-  ret = read_container_config_from_state (&container, state_root, id, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  gen = yajl_gen_alloc (NULL);
+  if (gen == NULL)
+    return crun_make_error (err, 0, "yajl_gen_alloc failed");
+
+  r = yajl_gen_map_open (gen);
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    goto yajl_error;
+
+  r = gen_string_array (gen, "args", process->args, process->args_len);
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    goto yajl_error;
 
-  if (context->notify_socket)
+  if (process->env_len)
     {
-      ret = get_notify_fd (context, container, &fd, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      r = gen_string_array (gen, "env", process->env, process->env_len);
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
     }
 
-  ret = libcrun_status_write_exec_fifo (context->state_root, id, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  r = gen_string_field (gen, "cwd", process->cwd ? process->cwd : "/");
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    goto yajl_error;
 
-  def = container->container_def;
+  if (process->selinux_label)
+    {
+      r = gen_string_field (gen, "selinuxLabel", process->selinux_label);
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
+    }
 
-  if (context->notify_socket)
+  if (process->apparmor_profile)
     {
-      if (fd >= 0)
-        {
-          fd_set read_set;
+      r = gen_string_field (gen, "apparmorProfile", process->apparmor_profile);
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
+    }
 
-          while (1)
-            {
-              struct timeval timeout = {
-                .tv_sec = 0,
-                .tv_usec = 10000,
-              };
-              FD_ZERO (&read_set);
-              FD_SET (fd, &read_set);
+  r = yajl_gen_string (gen, YAJL_STR ("noNewPrivileges"), strlen ("noNewPrivileges"));
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    goto yajl_error;
 
-              ret = select (fd + 1, &read_set, NULL, NULL, &timeout);
-              if (UNLIKELY (ret < 0))
-                return ret;
-              if (ret)
-                {
-                  ret = handle_notify_socket (fd, err);
-                  if (UNLIKELY (ret < 0))
-                    return ret;
-                  if (ret)
-                    break;
-                }
-              else
-                {
-                  ret = libcrun_is_container_running (&status, err);
-                  if (UNLIKELY (ret < 0))
-                    return ret;
-                  if (! ret)
-                    return 0;
-                }
-            }
-        }
-    }
+  r = yajl_gen_bool (gen, process->no_new_privileges);
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    goto yajl_error;
 
-  /* The container is considered running only after we got the notification from the
-     notify_socket, if any.  */
-  if (def->hooks && def->hooks->poststart_len)
+  if (process->user)
     {
-      cleanup_close int hooks_out_fd = -1;
-      cleanup_close int hooks_err_fd = -1;
-
-      ret = open_hooks_output (container, &hooks_out_fd, &hooks_err_fd, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      r = yajl_gen_string (gen, YAJL_STR ("user"), strlen ("user"));
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
 
-      ret = do_hooks (def, status.pid, context->id, true, status.bundle, "running", (hook **) def->hooks->poststart,
-                      def->hooks->poststart_len, hooks_out_fd, hooks_err_fd, err);
-      if (UNLIKELY (ret < 0))
-        crun_error_release (err);
-    }
+      r = yajl_gen_map_open (gen);
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
 
-  return 0;
-}
+      r = yajl_gen_string (gen, YAJL_STR ("uid"), strlen ("uid"));
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
 
-int
-libcrun_get_container_state_string (const char *id, libcrun_container_status_t *status, const char *state_root,
-                                    const char **container_status, int *running, libcrun_error_t *err)
-{
-  int ret, has_fifo = 0;
-  bool paused = false;
+      r = yajl_gen_integer (gen, process->user->uid);
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
 
-  ret = libcrun_is_container_running (status, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
-  *running = ret;
+      r = yajl_gen_string (gen, YAJL_STR ("gid"), strlen ("gid"));
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
 
-  if (*running)
-    {
-      ret = libcrun_status_has_read_exec_fifo (state_root, id, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
-      has_fifo = ret;
-    }
+      r = yajl_gen_integer (gen, process->user->gid);
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
 
-  if (*running && ! has_fifo)
-    {
-      int cgroup_mode;
+      if (process->user->umask_present)
+        {
+          r = yajl_gen_string (gen, YAJL_STR ("umask"), strlen ("umask"));
+          if (UNLIKELY (r != yajl_gen_status_ok))
+            goto yajl_error;
 
-      cgroup_mode = libcrun_get_cgroup_mode (err);
-      if (UNLIKELY (cgroup_mode < 0))
-        return cgroup_mode;
+          r = yajl_gen_integer (gen, process->user->umask);
+          if (UNLIKELY (r != yajl_gen_status_ok))
+            goto yajl_error;
+        }
 
-      ret = libcrun_cgroup_is_container_paused (status->cgroup_path, cgroup_mode, &paused, err);
-      if (UNLIKELY (ret < 0))
+      if (process->user->additional_gids_len)
         {
-          /*
-            The cgroup might have been cleaned up by the time we try to read it, ignore both
-            ENOENT and ENODEV:
-            - ENOENT: if the open(CGROUP_PATH) fails because the cgroup was deleted.
-            - ENODEV: if the cgroup is deleted between the open and reading the freeze status.
-          */
+          r = yajl_gen_string (gen, YAJL_STR ("additionalGids"), strlen ("additionalGids"));
+          if (UNLIKELY (r != yajl_gen_status_ok))
+            goto yajl_error;
 
-          errno = crun_error_get_errno (err);
-          if (errno == ENOENT || errno == ENODEV)
+          r = yajl_gen_array_open (gen);
+          if (UNLIKELY (r != yajl_gen_status_ok))
+            goto yajl_error;
+
+          for (i = 0; i < process->user->additional_gids_len; i++)
             {
-              crun_error_release (err);
-              *container_status = "stopped";
-              return 0;
+              r = yajl_gen_integer (gen, process->user->additional_gids[i]);
+              if (UNLIKELY (r != yajl_gen_status_ok))
+                goto yajl_error;
             }
 
-          return ret;
+          r = yajl_gen_array_close (gen);
+          if (UNLIKELY (r != yajl_gen_status_ok))
+            goto yajl_error;
         }
+
+      r = yajl_gen_map_close (gen);
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
     }
 
-  if (! *running)
-    *container_status = "stopped";
-  else if (has_fifo)
-    *container_status = "created";
-  else if (paused)
-    *container_status = "paused";
-  else
-    *container_status = "running";
+  r = yajl_gen_map_close (gen);
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    goto yajl_error;
+
+  r = yajl_gen_get_buf (gen, &buf, &buf_len);
+  if (UNLIKELY (r != yajl_gen_status_ok))
+    goto yajl_error;
+
+  *out = xmalloc (buf_len + 1);
+  memcpy (*out, buf, buf_len);
+  (*out)[buf_len] = '\0';
+  *out_len = buf_len;
 
+  yajl_gen_free (gen);
   return 0;
+
+yajl_error:
+  if (gen)
+    yajl_gen_free (gen);
+  return yajl_error_to_crun_error (r, err);
 }
 
-int
-libcrun_container_state (libcrun_context_t *context, const char *id, FILE *out, libcrun_error_t *err)
+static int
+send_exec_request (int fd, const char *payload, size_t len, libcrun_error_t *err)
 {
-  const char *const OCI_CONFIG_VERSION = "1.0.0";
-  libcrun_container_status_t status = {};
-  const char *state_root = context->state_root;
-  const char *container_status = NULL;
-  yajl_gen gen = NULL;
-  const unsigned char *buf;
-  int ret = 0;
-  int running;
-  size_t len;
-
-  ret = libcrun_read_container_status (&status, state_root, id, err);
+  char ctrl_buf[CMSG_SPACE (sizeof (int) * EXEC_SERVER_REQUEST_FDS)] = {};
+  int fds[EXEC_SERVER_REQUEST_FDS] = { 0, 1, 2 };
+  uint32_t header = len;
+  struct cmsghdr *cmsg;
+  struct msghdr msg = {};
+  struct iovec iov;
+  ssize_t ret;
+
+  iov.iov_base = &header;
+  iov.iov_len = sizeof (header);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl_buf;
+  msg.msg_controllen = sizeof (ctrl_buf);
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+  memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+  ret = TEMP_FAILURE_RETRY (sendmsg (fd, &msg, 0));
   if (UNLIKELY (ret < 0))
-    return ret;
+    return crun_make_error (err, errno, "sendmsg");
 
-  ret = libcrun_get_container_state_string (id, &status, state_root, &container_status, &running, err);
+  ret = safe_write (fd, payload, len);
   if (UNLIKELY (ret < 0))
-    goto exit;
-
-  ret = 0;
-  gen = yajl_gen_alloc (NULL);
-  if (gen == NULL)
-    return crun_make_error (err, 0, "yajl_gen_alloc failed");
-
-  yajl_gen_config (gen, yajl_gen_beautify, 1);
-  yajl_gen_config (gen, yajl_gen_validate_utf8, 1);
-
-  yajl_gen_map_open (gen);
-  yajl_gen_string (gen, YAJL_STR ("ociVersion"), strlen ("ociVersion"));
-  yajl_gen_string (gen, YAJL_STR (OCI_CONFIG_VERSION), strlen (OCI_CONFIG_VERSION));
+    return crun_make_error (err, errno, "write exec request");
 
-  yajl_gen_string (gen, YAJL_STR ("id"), strlen ("id"));
-  yajl_gen_string (gen, YAJL_STR (id), strlen (id));
+  return 0;
+}
 
-  yajl_gen_string (gen, YAJL_STR ("pid"), strlen ("pid"));
-  yajl_gen_integer (gen, running ? status.pid : 0);
+/* Hand PROCESS to the exec server of the container monitor, if there is one
+   listening and the request needs nothing that only a new crun process can
+   provide: a terminal, different capabilities or rlimits, extra file
+   descriptors, a pid file or a detached process.  SERVED tells whether the
+   request was sent; when it is false the caller runs the process itself.  */
+static int
+exec_through_exec_server (libcrun_context_t *context, const char *id,
+                          runtime_spec_schema_config_schema_process *process, bool *served, libcrun_error_t *err)
+{
+  cleanup_free char *dir = NULL;
+  cleanup_free char *path = NULL;
+  cleanup_free char *payload = NULL;
+  cleanup_free char *reply = NULL;
+  libcrun_error_t tmp_err = NULL;
+  size_t payload_len, reply_len = 0;
+  cleanup_close int fd = -1;
+  int32_t exit_status;
+  struct stat st;
+  int ret;
 
-  yajl_gen_string (gen, YAJL_STR ("status"), strlen ("status"));
-  yajl_gen_string (gen, YAJL_STR (container_status), strlen (container_status));
+  *served = false;
 
-  yajl_gen_string (gen, YAJL_STR ("bundle"), strlen ("bundle"));
-  yajl_gen_string (gen, YAJL_STR (status.bundle), strlen (status.bundle));
+  if (context->detach || context->console_socket || context->pid_file || context->preserve_fds
+      || process->terminal || process->capabilities || process->rlimits_len || process->args_len == 0)
+    return 0;
 
-  yajl_gen_string (gen, YAJL_STR ("rootfs"), strlen ("rootfs"));
-  yajl_gen_string (gen, YAJL_STR (status.rootfs), strlen (status.rootfs));
+  dir = libcrun_get_state_directory (context->state_root, id);
+  if (UNLIKELY (dir == NULL))
+    return 0;
 
-  yajl_gen_string (gen, YAJL_STR ("created"), strlen ("created"));
-  yajl_gen_string (gen, YAJL_STR (status.created), strlen (status.created));
+  ret = append_paths (&path, err, dir, EXEC_SERVER_SOCKET, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-  yajl_gen_string (gen, YAJL_STR ("owner"), strlen ("owner"));
-  yajl_gen_string (gen, YAJL_STR (status.owner), strlen (status.owner));
+  if (lstat (path, &st) < 0 || ! S_ISSOCK (st.st_mode))
+    return 0;
 
-  {
-    size_t i;
-    cleanup_free char *config_file = NULL;
-    cleanup_container libcrun_container_t *container = NULL;
-    cleanup_free char *dir = NULL;
+  /* A monitor that is gone leaves nobody listening.  */
+  fd = open_unix_domain_client_socket (path, 0, &tmp_err);
+  if (UNLIKELY (fd < 0))
+    {
+      crun_error_release (&tmp_err);
+      return 0;
+    }
 
-    dir = libcrun_get_state_directory (state_root, id);
-    if (UNLIKELY (dir == NULL))
-      {
-        ret = crun_make_error (err, 0, "cannot get state directory");
-        goto exit;
-      }
+  ret = get_exec_request (process, &payload, &payload_len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-    ret = append_paths (&config_file, err, dir, "config.json", NULL);
-    if (UNLIKELY (ret < 0))
-      return ret;
+  *served = true;
 
-    container = libcrun_container_load_from_file (config_file, err);
-    if (UNLIKELY (container == NULL))
-      {
-        ret = crun_make_error (err, 0, "error loading config.json");
-        goto exit;
-      }
+  ret = send_exec_request (fd, payload, payload_len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-    if (container->container_def->annotations && container->container_def->annotations->len)
-      {
-        yajl_gen_string (gen, YAJL_STR ("annotations"), strlen ("annotations"));
-        yajl_gen_map_open (gen);
-        for (i = 0; i < container->container_def->annotations->len; i++)
-          {
-            const char *key = container->container_def->annotations->keys[i];
-            const char *val = container->container_def->annotations->values[i];
-            yajl_gen_string (gen, YAJL_STR (key), strlen (key));
-            yajl_gen_string (gen, YAJL_STR (val), strlen (val));
-          }
-        yajl_gen_map_close (gen);
-      }
-  }
+  ret = read_all_fd (fd, "exec server reply", &reply, &reply_len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-  yajl_gen_map_close (gen);
+  if (UNLIKELY (reply_len < sizeof (exit_status)))
+    return crun_make_error (err, 0, "the exec server closed the connection");
 
-  if (yajl_gen_get_buf (gen, &buf, &len) != yajl_gen_status_ok)
+  memcpy (&exit_status, reply, sizeof (exit_status));
+  if (exit_status < 0)
     {
-      ret = crun_make_error (err, 0, "error generating JSON");
-      goto exit;
+      if (reply_len == sizeof (exit_status))
+        return crun_make_error (err, 0, "the exec server failed to run the process");
+      return crun_make_error (err, 0, "%.*s", (int) (reply_len - sizeof (exit_status)), reply + sizeof (exit_status));
     }
 
-  fprintf (out, "%s\n", buf);
-
-exit:
-  if (gen)
-    yajl_gen_free (gen);
-  libcrun_free_container_status (&status);
-  return ret;
+  return exit_status;
 }
 
-int
-libcrun_container_exec (libcrun_context_t *context, const char *id, runtime_spec_schema_config_schema_process *process,
-                        libcrun_error_t *err)
+/* Run PROCESS in the running CONTAINER described by STATUS.  */
+static int
+container_exec_internal (libcrun_context_t *context, libcrun_container_t *container,
+                         libcrun_container_status_t *status, runtime_spec_schema_config_schema_process *process,
+                         libcrun_error_t *err)
 {
-  int container_status, ret;
+  int ret;
   pid_t pid;
-  libcrun_container_status_t status = {};
-  const char *state_root = context->state_root;
   cleanup_close int terminal_fd = -1;
   cleanup_close int seccomp_fd = -1;
   cleanup_terminal void *orig_terminal = NULL;
-  cleanup_free char *config_file = NULL;
-  cleanup_container libcrun_container_t *container = NULL;
-  cleanup_free char *dir = NULL;
   cleanup_free const char *exec_path = NULL;
   int container_ret_status[2];
   cleanup_close int pipefd0 = -1;
@@ -3054,32 +5593,9 @@ libcrun_container_exec (libcrun_context_t *context, const char *id, runtime_spec
   cleanup_close int own_seccomp_receiver_fd = -1;
   cleanup_close int seccomp_notify_fd = -1;
   const char *seccomp_notify_plugins = NULL;
+  struct libcrun_numa_placement_s numa_placement;
   char b;
 
-  ret = libcrun_read_container_status (&status, state_root, id, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
-
-  ret = libcrun_is_container_running (&status, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
-  container_status = ret;
-
-  dir = libcrun_get_state_directory (state_root, id);
-  if (UNLIKELY (dir == NULL))
-    return crun_make_error (err, 0, "cannot get state directory");
-
-  ret = append_paths (&config_file, err, dir, "config.json", NULL);
-  if (UNLIKELY (ret < 0))
-    return ret;
-
-  container = libcrun_container_load_from_file (config_file, err);
-  if (container == NULL)
-    return crun_make_error (err, 0, "error loading config.json");
-
-  if (container_status == 0)
-    return crun_make_error (err, 0, "the container `%s` is not running.", id);
-
   ret = block_signals (err);
   if (UNLIKELY (ret < 0))
     return ret;
@@ -3122,7 +5638,13 @@ libcrun_container_exec (libcrun_context_t *context, const char *id, runtime_spec
   if (UNLIKELY (ret < 0))
     return ret;
 
-  pid = libcrun_join_process (container, status.pid, &status, context->detach, process->terminal ? &terminal_fd : NULL,
+  /* Computed here, as the child cannot rely on /sys once it joined the
+     container mount namespace, and applied only in the child.  */
+  ret = libcrun_get_numa_placement (container, &numa_placement, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  pid = libcrun_join_process (container, status->pid, status, context->detach, process->terminal ? &terminal_fd : NULL,
                               err);
   if (UNLIKELY (pid < 0))
     return pid;
@@ -3190,6 +5712,14 @@ libcrun_container_exec (libcrun_context_t *context, const char *id, runtime_spec
       if (UNLIKELY (libcrun_set_apparmor_profile (process, err) < 0))
         libcrun_fail_with_error ((*err)->status, "%s", (*err)->msg);
 
+      if (UNLIKELY (libcrun_apply_numa_placement (&numa_placement, err) < 0))
+        libcrun_fail_with_error ((*err)->status, "%s", (*err)->msg);
+
+      /* Before the capabilities are dropped, PR_SET_MEMORY_MERGE needs
+         CAP_SYS_RESOURCE.  */
+      if (UNLIKELY (libcrun_set_memory_policy (container, err) < 0))
+        libcrun_fail_with_error ((*err)->status, "%s", (*err)->msg);
+
       if (container->container_def->linux && container->container_def->linux->seccomp)
         {
           seccomp_flags = container->container_def->linux->seccomp->flags;
@@ -3348,13 +5878,57 @@ libcrun_container_exec (libcrun_context_t *context, const char *id, runtime_spec
           if (UNLIKELY (ret < 0))
             return ret;
         }
-      ret = wait_for_process (pid, context, terminal_fd, -1, -1, seccomp_notify_fd, seccomp_notify_plugins, err);
+      ret = wait_for_process (pid, context, terminal_fd, -1, -1, seccomp_notify_fd, seccomp_notify_plugins, NULL,
+                              false, NULL, -1, err);
     }
 
   flush_fd_to_err (context, terminal_fd);
   return ret;
 }
 
+int
+libcrun_container_exec (libcrun_context_t *context, const char *id, runtime_spec_schema_config_schema_process *process,
+                        libcrun_error_t *err)
+{
+  int container_status, ret;
+  bool served;
+  cleanup_container_status libcrun_container_status_t status = {};
+  const char *state_root = context->state_root;
+  cleanup_free char *config_file = NULL;
+  cleanup_container libcrun_container_t *container = NULL;
+  cleanup_free char *dir = NULL;
+
+  ret = exec_through_exec_server (context, id, process, &served, err);
+  if (served)
+    return ret;
+
+  ret = libcrun_read_container_status (&status, state_root, id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = libcrun_is_container_running (&status, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  container_status = ret;
+
+  dir = libcrun_get_state_directory (state_root, id);
+  if (UNLIKELY (dir == NULL))
+    return crun_make_error (err, 0, "cannot get state directory");
+
+  ret = append_paths (&config_file, err, dir, "config.json", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  container = libcrun_container_load_from_file (config_file, err);
+  if (container == NULL)
+    return crun_make_error (err, 0, "error loading config.json");
+
+  if (container_status == 0)
+    return crun_make_error (err, 0, "the container `%s` is not running.", id);
+
+  return container_exec_internal (context, container, &status, process, err);
+}
+
 int
 libcrun_container_exec_process_file (libcrun_context_t *context, const char *id, const char *path, libcrun_error_t *err)
 {
@@ -3475,6 +6049,48 @@ libcrun_container_unpause (libcrun_context_t *context, const char *id, libcrun_e
   return libcrun_container_unpause_linux (&status, err);
 }
 
+/* Pause or resume all the N_IDS containers in IDS at once, and wait for
+   the freezer to complete the transition in each of them.  */
+int
+libcrun_container_pause_unpause_many (libcrun_context_t *context, const char **ids, size_t n_ids, const bool pause,
+                                      libcrun_error_t *err)
+{
+  const char *state_root = context->state_root;
+  libcrun_container_status_t *statuses;
+  cleanup_free const char **paths = NULL;
+  size_t i;
+  int ret;
+
+  statuses = xmalloc0 (sizeof (*statuses) * (n_ids + 1));
+  paths = xmalloc0 (sizeof (*paths) * (n_ids + 1));
+
+  for (i = 0; i < n_ids; i++)
+    {
+      ret = libcrun_read_container_status (&statuses[i], state_root, ids[i], err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+
+      ret = libcrun_is_container_running (&statuses[i], err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+      if (ret == 0)
+        {
+          ret = crun_make_error (err, 0, "the container `%s` is not running", ids[i]);
+          goto exit;
+        }
+
+      paths[i] = statuses[i].cgroup_path;
+    }
+
+  ret = libcrun_cgroup_pause_unpause_many (paths, n_ids, pause, PAUSE_TIMEOUT_MS, err);
+
+exit:
+  for (i = 0; i < n_ids; i++)
+    libcrun_free_container_status (&statuses[i]);
+  free (statuses);
+  return ret;
+}
+
 int
 libcrun_container_checkpoint (libcrun_context_t *context, const char *id, libcrun_checkpoint_restore_t *cr_options,
                               libcrun_error_t *err)
@@ -3494,15 +6110,16 @@ libcrun_container_checkpoint (libcrun_context_t *context, const char *id, libcru
   if (ret == 0)
     return crun_make_error (err, errno, "the container `%s` is not running", id);
 
-  ret = read_container_config_from_state (&container, state_root, id, err);
+  ret = read_container_config_from_state (&container, state_root, id, 0, err);
   if (UNLIKELY (ret < 0))
     return ret;
   ret = libcrun_container_checkpoint_linux (&status, container, cr_options, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
-  if (! cr_options->leave_running)
-    return container_delete_internal (context, NULL, id, true, true, err);
+  /* A pre-dump leaves the container running, the final dump follows later.  */
+  if (! cr_options->leave_running && ! cr_options->pre_dump)
+    return container_delete_internal (context, NULL, id, true, true, true, err);
 
   return 0;
 }
@@ -3620,3 +6237,316 @@ libcrun_container_restore (libcrun_context_t *context, const char *id, libcrun_c
 
   return 0;
 }
+
+/* Run FN for each of the N_IDS containers in IDS at the same time, each
+   one in its own process, and wait for all of them.  The processes report
+   their own errors, the return value only tells whether any failed.  */
+static int
+run_for_each_container_in_parallel (libcrun_context_t *context, const char **ids, size_t n_ids,
+                                    int (*fn) (libcrun_context_t *, const char *, size_t, void *, libcrun_error_t *),
+                                    void *arg, const char *what, libcrun_error_t *err)
+{
+  cleanup_free pid_t *pids = NULL;
+  size_t i, failed = 0;
+  int ret;
+
+  pids = xmalloc0 (sizeof (*pids) * (n_ids + 1));
+  for (i = 0; i < n_ids; i++)
+    {
+      pids[i] = fork ();
+      if (UNLIKELY (pids[i] < 0))
+        {
+          libcrun_warning ("fork for `%s`: %s", ids[i], strerror (errno));
+          failed++;
+          continue;
+        }
+      if (pids[i] == 0)
+        {
+          libcrun_error_t tmp_err = NULL;
+
+          ret = fn (context, ids[i], i, arg, &tmp_err);
+          if (UNLIKELY (ret < 0))
+            {
+              libcrun_warning ("%s `%s`: %s", what, ids[i], tmp_err->msg);
+              crun_error_release (&tmp_err);
+            }
+          _exit (ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+
+  for (i = 0; i < n_ids; i++)
+    {
+      int wait_status;
+
+      if (pids[i] <= 0)
+        continue;
+
+      ret = TEMP_FAILURE_RETRY (waitpid (pids[i], &wait_status, 0));
+      if (UNLIKELY (ret < 0 || ! WIFEXITED (wait_status) || WEXITSTATUS (wait_status) != 0))
+        failed++;
+    }
+
+  if (UNLIKELY (failed))
+    return crun_make_error (err, 0, "%s failed for %zu of %zu containers", what, failed, n_ids);
+
+  return 0;
+}
+
+struct checkpoint_many_s
+{
+  libcrun_container_status_t *statuses;
+  libcrun_container_t **containers;
+  libcrun_checkpoint_restore_t *cr_options;
+};
+
+/* Each container is dumped to the directory named as its ID under the
+   image path, and the same for the work and the parent paths.  */
+static int
+checkpoint_one_of_many (libcrun_context_t *context arg_unused, const char *id, size_t i, void *arg,
+                        libcrun_error_t *err)
+{
+  struct checkpoint_many_s *data = arg;
+  libcrun_checkpoint_restore_t cr_options = *data->cr_options;
+  cleanup_free char *image_path = NULL;
+  cleanup_free char *work_path = NULL;
+  cleanup_free char *parent_path = NULL;
+  int ret;
+
+  ret = append_paths (&image_path, err, cr_options.image_path, id, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  cr_options.image_path = image_path;
+
+  if (cr_options.work_path)
+    {
+      ret = append_paths (&work_path, err, cr_options.work_path, id, NULL);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = crun_ensure_directory (work_path, 0700, false, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      cr_options.work_path = work_path;
+    }
+
+  /* CRIU looks up a relative parent path from the images directory, that
+     is now one level deeper.  */
+  if (cr_options.parent_path)
+    {
+      xasprintf (&parent_path, "%s%s/%s", cr_options.parent_path[0] == '/' ? "" : "../", cr_options.parent_path, id);
+      cr_options.parent_path = parent_path;
+    }
+
+  return libcrun_container_checkpoint_linux (&data->statuses[i], data->containers[i], &cr_options, err);
+}
+
+/* Checkpoint all the N_IDS containers in IDS, for example the containers
+   of a pod.  They are frozen together, so that the checkpoint is
+   consistent across them, and then dumped in parallel.  */
+int
+libcrun_container_checkpoint_many (libcrun_context_t *context, const char **ids, size_t n_ids,
+                                   libcrun_checkpoint_restore_t *cr_options, libcrun_error_t *err)
+{
+  const char *state_root = context->state_root;
+  libcrun_container_status_t *statuses;
+  libcrun_container_t **containers;
+  cleanup_free const char **paths = NULL;
+  struct checkpoint_many_s data;
+  bool keep_running = cr_options->leave_running || cr_options->pre_dump;
+  size_t i, n_paths = 0;
+  int ret, cgroup_mode;
+
+  if (UNLIKELY (cr_options->image_path == NULL))
+    return crun_make_error (err, 0, "image path not set");
+
+  /* Each container needs its own archive, page server and lazy pages daemon.  */
+  if (UNLIKELY (cr_options->archive_path || cr_options->page_server || cr_options->lazy_pages))
+    return crun_make_error (err, 0, "archives and page servers are not supported with more than one container");
+
+  cgroup_mode = libcrun_get_cgroup_mode (err);
+  if (UNLIKELY (cgroup_mode < 0))
+    return cgroup_mode;
+
+  statuses = xmalloc0 (sizeof (*statuses) * (n_ids + 1));
+  containers = xmalloc0 (sizeof (*containers) * (n_ids + 1));
+  paths = xmalloc0 (sizeof (*paths) * (n_ids + 1));
+
+  for (i = 0; i < n_ids; i++)
+    {
+      bool paused = false;
+
+      ret = libcrun_read_container_status (&statuses[i], state_root, ids[i], err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+
+      ret = libcrun_is_container_running (&statuses[i], err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+      if (ret == 0)
+        {
+          ret = crun_make_error (err, 0, "the container `%s` is not running", ids[i]);
+          goto exit;
+        }
+
+      ret = read_container_config_from_state (&containers[i], state_root, ids[i], 0, err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+
+      /* A container that is already paused stays paused.  */
+      ret = libcrun_cgroup_is_container_paused (statuses[i].cgroup_path, cgroup_mode, &paused, err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+      if (! paused)
+        paths[n_paths++] = statuses[i].cgroup_path;
+    }
+
+  ret = crun_ensure_directory (cr_options->image_path, 0700, false, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
+
+  if (cr_options->work_path)
+    {
+      ret = crun_ensure_directory (cr_options->work_path, 0700, false, err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+    }
+
+  /* CRIU leaves the cgroups frozen as it finds them.  */
+  ret = libcrun_cgroup_pause_unpause_many (paths, n_paths, true, PAUSE_TIMEOUT_MS, err);
+  if (UNLIKELY (ret < 0))
+    goto exit;
+
+  data.statuses = statuses;
+  data.containers = containers;
+  data.cr_options = cr_options;
+  ret = run_for_each_container_in_parallel (context, ids, n_ids, checkpoint_one_of_many, &data, "checkpoint", err);
+
+  /* Also thaw the cgroups of the dumped containers, so that the processes
+     killed by CRIU can exit.  The cgroup might be gone already.  */
+  if (ret < 0 || ! keep_running)
+    {
+      libcrun_error_t tmp_err = NULL;
+
+      if (UNLIKELY (libcrun_cgroup_pause_unpause_many (paths, n_paths, false, PAUSE_TIMEOUT_MS, &tmp_err) < 0))
+        crun_error_release (&tmp_err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+    }
+  else
+    {
+      ret = libcrun_cgroup_pause_unpause_many (paths, n_paths, false, PAUSE_TIMEOUT_MS, err);
+      if (UNLIKELY (ret < 0))
+        goto exit;
+    }
+
+  if (! keep_running)
+    {
+      for (i = 0; i < n_ids; i++)
+        {
+          ret = container_delete_internal (context, NULL, ids[i], true, true, true, err);
+          if (UNLIKELY (ret < 0))
+            goto exit;
+        }
+    }
+
+  ret = 0;
+
+exit:
+  for (i = 0; i < n_ids; i++)
+    {
+      libcrun_free_container_status (&statuses[i]);
+      libcrun_container_free (containers[i]);
+    }
+  free (statuses);
+  free (containers);
+  return ret;
+}
+
+struct restore_many_s
+{
+  const char *image_path;
+  const char *work_path;
+  libcrun_checkpoint_restore_t *cr_options;
+};
+
+static int
+restore_one_of_many (libcrun_context_t *context, const char *id, size_t i arg_unused, void *arg, libcrun_error_t *err)
+{
+  struct restore_many_s *data = arg;
+  libcrun_checkpoint_restore_t cr_options = *data->cr_options;
+  libcrun_context_t container_context = *context;
+  cleanup_free char *image_path = NULL;
+  cleanup_free char *work_path = NULL;
+  cleanup_free char *bundle = NULL;
+  int ret;
+
+  ret = append_paths (&bundle, err, context->bundle, id, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  /* The configuration is read from the current directory.  */
+  ret = chdir (bundle);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "chdir `%s`", bundle);
+
+  ret = append_paths (&image_path, err, data->image_path, id, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+  cr_options.image_path = image_path;
+
+  if (data->work_path)
+    {
+      ret = append_paths (&work_path, err, data->work_path, id, NULL);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      cr_options.work_path = work_path;
+    }
+
+  /* The restored processes are children of this process, that exits now.  */
+  cr_options.detach = true;
+
+  container_context.id = id;
+  container_context.bundle = bundle;
+  return libcrun_container_restore (&container_context, id, &cr_options, err);
+}
+
+/* Restore in parallel all the N_IDS containers in IDS checkpointed by
+   libcrun_container_checkpoint_many.  The bundle of each container is
+   the directory named as its ID under CONTEXT->BUNDLE.  */
+int
+libcrun_container_restore_many (libcrun_context_t *context, const char **ids, size_t n_ids,
+                                libcrun_checkpoint_restore_t *cr_options, libcrun_error_t *err)
+{
+  cleanup_free char *image_path = NULL;
+  cleanup_free char *work_path = NULL;
+  struct restore_many_s data;
+
+  if (UNLIKELY (cr_options->image_path == NULL))
+    return crun_make_error (err, 0, "image path not set");
+
+  if (UNLIKELY (cr_options->archive_path || cr_options->lazy_pages || cr_options->console_socket
+                || context->pid_file))
+    return crun_make_error (err, 0,
+                            "archives, lazy pages, console sockets and pid files are not supported with more "
+                            "than one container");
+
+  if (UNLIKELY (context->bundle == NULL || context->bundle[0] != '/'))
+    return crun_make_error (err, 0, "the bundle path must be absolute");
+
+  /* The paths must not depend on the current directory, that changes.  */
+  image_path = realpath (cr_options->image_path, NULL);
+  if (UNLIKELY (image_path == NULL))
+    return crun_make_error (err, errno, "realpath `%s`", cr_options->image_path);
+
+  if (cr_options->work_path)
+    {
+      work_path = realpath (cr_options->work_path, NULL);
+      if (UNLIKELY (work_path == NULL))
+        return crun_make_error (err, errno, "realpath `%s`", cr_options->work_path);
+    }
+
+  data.image_path = image_path;
+  data.work_path = work_path;
+  data.cr_options = cr_options;
+  return run_for_each_container_in_parallel (context, ids, n_ids, restore_one_of_many, &data, "restore", err);
+}
@@ -34,12 +34,17 @@ struct libcrun_context_s
   const char *pid_file;
   const char *notify_socket;
   const char *handler;
+  const char *console_log;
+  size_t console_log_size;
   int preserve_fds;
+  /* Number of the preserved fds that are listening sockets passed with LISTEN_FDS.  */
+  int listen_fds;
 
   crun_output_handler output_handler;
   void *output_handler_arg;
 
   int fifo_exec_wait_fd;
+  int start_event_fd;
 
   bool systemd_cgroup;
   bool detach;
@@ -84,7 +89,12 @@ struct libcrun_checkpoint_restore_s
 {
   char *image_path;
   char *work_path;
+  char *parent_path;
+  char *page_server;
+  char *archive_path;
   bool leave_running;
+  bool pre_dump;
+  bool lazy_pages;
   bool tcp_established;
   bool shell_job;
   bool ext_unix_sk;
@@ -99,12 +109,21 @@ LIBCRUN_PUBLIC libcrun_container_t *libcrun_container_load_from_memory (const ch
 
 LIBCRUN_PUBLIC void libcrun_container_free (libcrun_container_t *);
 
+LIBCRUN_PUBLIC void libcrun_container_set_config_cache (bool enable);
+
 LIBCRUN_PUBLIC int libcrun_container_run (libcrun_context_t *context, libcrun_container_t *container,
                                           unsigned int options, libcrun_error_t *error);
 
 LIBCRUN_PUBLIC int libcrun_container_delete (libcrun_context_t *context, runtime_spec_schema_config_schema *def,
                                              const char *id, bool force, libcrun_error_t *err);
 
+LIBCRUN_PUBLIC int libcrun_container_create_from_template (libcrun_context_t *context, const char *template_id,
+                                                           const char *hostname, char **env, size_t n_env,
+                                                           libcrun_error_t *err);
+
+LIBCRUN_PUBLIC int libcrun_container_delete_many (libcrun_context_t *context, char **ids, size_t n_ids, bool force,
+                                                  libcrun_error_t *err);
+
 LIBCRUN_PUBLIC int libcrun_container_kill (libcrun_context_t *context, const char *id, int signal,
                                            libcrun_error_t *err);
 
@@ -114,11 +133,36 @@ LIBCRUN_PUBLIC int libcrun_container_kill_all (libcrun_context_t *context, const
 LIBCRUN_PUBLIC int libcrun_container_create (libcrun_context_t *context, libcrun_container_t *container,
                                              unsigned int options, libcrun_error_t *err);
 
+struct libcrun_container_batch_entry_s
+{
+  const char *id;
+  /* Absolute path to the bundle.  */
+  const char *bundle;
+  /* Relative to the bundle if not absolute, config.json if NULL.  */
+  const char *config_file;
+  const char *pid_file;
+  const char *console_socket;
+
+  /* Outcome of the creation, set by libcrun_container_create_batch.  An
+     entry that already has ret < 0 is skipped and counted as failed.  */
+  int ret;
+  libcrun_error_t err;
+};
+typedef struct libcrun_container_batch_entry_s libcrun_container_batch_entry_t;
+
+LIBCRUN_PUBLIC int libcrun_container_create_batch (libcrun_context_t *context, libcrun_container_batch_entry_t *entries,
+                                                   size_t len, libcrun_error_t *err);
+
 LIBCRUN_PUBLIC int libcrun_container_start (libcrun_context_t *context, const char *id, libcrun_error_t *err);
 
+LIBCRUN_PUBLIC int libcrun_container_start_on_activity (libcrun_context_t *context, const char *id, int *fds,
+                                                        size_t n_fds, libcrun_error_t *err);
+
 LIBCRUN_PUBLIC int libcrun_container_state (libcrun_context_t *context, const char *id, FILE *out,
                                             libcrun_error_t *err);
 
+LIBCRUN_PUBLIC int libcrun_container_state_all (libcrun_context_t *context, FILE *out, libcrun_error_t *err);
+
 LIBCRUN_PUBLIC int libcrun_get_container_state_string (const char *id, libcrun_container_status_t *status,
                                                        const char *state_root, const char **container_status,
                                                        int *running, libcrun_error_t *err);
@@ -137,16 +181,27 @@ LIBCRUN_PUBLIC int libcrun_container_update_from_file (libcrun_context_t *contex
 
 LIBCRUN_PUBLIC int libcrun_container_spec (bool root, FILE *out, libcrun_error_t *err);
 
+LIBCRUN_PUBLIC int libcrun_warmup (libcrun_error_t *err);
+
 LIBCRUN_PUBLIC int libcrun_container_pause (libcrun_context_t *context, const char *id, libcrun_error_t *err);
 
 LIBCRUN_PUBLIC int libcrun_container_unpause (libcrun_context_t *context, const char *id, libcrun_error_t *err);
 
+LIBCRUN_PUBLIC int libcrun_container_pause_unpause_many (libcrun_context_t *context, const char **ids, size_t n_ids,
+                                                         const bool pause, libcrun_error_t *err);
+
 LIBCRUN_PUBLIC int libcrun_container_checkpoint (libcrun_context_t *context, const char *id,
                                                  libcrun_checkpoint_restore_t *cr_options, libcrun_error_t *err);
 
 LIBCRUN_PUBLIC int libcrun_container_restore (libcrun_context_t *context, const char *id,
                                               libcrun_checkpoint_restore_t *cr_options, libcrun_error_t *err);
 
+LIBCRUN_PUBLIC int libcrun_container_checkpoint_many (libcrun_context_t *context, const char **ids, size_t n_ids,
+                                                      libcrun_checkpoint_restore_t *cr_options, libcrun_error_t *err);
+
+LIBCRUN_PUBLIC int libcrun_container_restore_many (libcrun_context_t *context, const char **ids, size_t n_ids,
+                                                   libcrun_checkpoint_restore_t *cr_options, libcrun_error_t *err);
+
 // Not part of the public API, just a method in container.c we need to access from linux.c
 void get_root_in_the_userns (runtime_spec_schema_config_schema *def, uid_t host_uid, gid_t host_gid,
                              uid_t *uid, gid_t *gid);
@@ -28,6 +28,13 @@
 #  include <sys/stat.h>
 #  include <sys/mount.h>
 #  include <fcntl.h>
+#  include <dirent.h>
+#  include <stddef.h>
+#  include <inttypes.h>
+#  include <sys/sendfile.h>
+#  ifdef HAVE_ZSTD
+#    include <zstd.h>
+#  endif
 
 #  include "container.h"
 #  include "linux.h"
@@ -36,6 +43,7 @@
 #  include "cgroup.h"
 
 #  define CRIU_CHECKPOINT_LOG_FILE "dump.log"
+#  define CRIU_PRE_DUMP_LOG_FILE "pre-dump.log"
 #  define CRIU_RESTORE_LOG_FILE "restore.log"
 #  define DESCRIPTORS_FILENAME "descriptors.json"
 
@@ -206,6 +214,556 @@ checkpoint_cgroup_v1_mount (runtime_spec_schema_config_schema *def, libcrun_erro
   return 0;
 }
 
+/* A checkpoint archive is a tar file holding the files of the images
+ * directory.  When crun is built with zstd, the archive is compressed
+ * while it is written, so the images are read only once.  */
+#  define ARCHIVE_BLOCK_SIZE 512
+#  define ARCHIVE_BUFFER_SIZE (128 * 1024)
+
+struct archive_header_s
+{
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char checksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char padding[12];
+};
+
+struct image_archive_s
+{
+  int fd;
+  char *buffer;
+  size_t buffer_pos;
+  size_t buffer_len;
+  bool eof;
+#  ifdef HAVE_ZSTD
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+#  endif
+};
+
+static void
+cleanup_image_archivep (struct image_archive_s *a)
+{
+#  ifdef HAVE_ZSTD
+  ZSTD_freeCCtx (a->cctx);
+  ZSTD_freeDCtx (a->dctx);
+#  endif
+  free (a->buffer);
+  if (a->fd >= 0)
+    close (a->fd);
+}
+
+#  define cleanup_image_archive __attribute__ ((cleanup (cleanup_image_archivep)))
+
+#  ifdef HAVE_ZSTD
+static int
+archive_compress (struct image_archive_s *a, const void *data, size_t len, ZSTD_EndDirective mode,
+                  libcrun_error_t *err)
+{
+  ZSTD_inBuffer in = { data, len, 0 };
+  size_t remaining;
+
+  do
+    {
+      ZSTD_outBuffer out = { a->buffer, ARCHIVE_BUFFER_SIZE, 0 };
+
+      remaining = ZSTD_compressStream2 (a->cctx, &out, &in, mode);
+      if (UNLIKELY (ZSTD_isError (remaining)))
+        return crun_make_error (err, 0, "compress checkpoint archive: %s", ZSTD_getErrorName (remaining));
+
+      if (out.pos > 0 && UNLIKELY (safe_write (a->fd, a->buffer, out.pos) < 0))
+        return crun_make_error (err, errno, "write checkpoint archive");
+  } while (mode == ZSTD_e_end ? remaining > 0 : in.pos < in.size);
+
+  return 0;
+}
+#  endif
+
+static int
+archive_write (struct image_archive_s *a, const void *data, size_t len, libcrun_error_t *err)
+{
+#  ifdef HAVE_ZSTD
+  if (a->cctx)
+    return archive_compress (a, data, len, ZSTD_e_continue, err);
+#  endif
+  if (UNLIKELY (safe_write (a->fd, data, len) < 0))
+    return crun_make_error (err, errno, "write checkpoint archive");
+  return 0;
+}
+
+static int
+archive_write_padding (struct image_archive_s *a, uint64_t size, libcrun_error_t *err)
+{
+  static const char zeros[ARCHIVE_BLOCK_SIZE];
+  size_t padding = (ARCHIVE_BLOCK_SIZE - size % ARCHIVE_BLOCK_SIZE) % ARCHIVE_BLOCK_SIZE;
+
+  if (padding == 0)
+    return 0;
+  return archive_write (a, zeros, padding, err);
+}
+
+static int
+archive_write_file_content (struct image_archive_s *a, int fd, uint64_t size, libcrun_error_t *err)
+{
+#  ifdef HAVE_ZSTD
+  if (a->cctx)
+    {
+      cleanup_free char *chunk = xmalloc (ARCHIVE_BUFFER_SIZE);
+
+      while (size > 0)
+        {
+          ssize_t r;
+          int ret;
+
+          r = TEMP_FAILURE_RETRY (read (fd, chunk, size < ARCHIVE_BUFFER_SIZE ? size : ARCHIVE_BUFFER_SIZE));
+          if (UNLIKELY (r < 0))
+            return crun_make_error (err, errno, "read checkpoint image");
+          if (UNLIKELY (r == 0))
+            return crun_make_error (err, 0, "checkpoint image truncated while writing the archive");
+
+          ret = archive_compress (a, chunk, r, ZSTD_e_continue, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+          size -= r;
+        }
+      return 0;
+    }
+#  endif
+
+  /* Without compression the data is moved with sendfile, and it is not
+   * copied through user space.  */
+  while (size > 0)
+    {
+      ssize_t r;
+
+      r = TEMP_FAILURE_RETRY (sendfile (a->fd, fd, NULL, size < (1 << 30) ? size : (1 << 30)));
+      if (UNLIKELY (r < 0))
+        return crun_make_error (err, errno, "write checkpoint archive");
+      if (UNLIKELY (r == 0))
+        return crun_make_error (err, 0, "checkpoint image truncated while writing the archive");
+      size -= r;
+    }
+  return 0;
+}
+
+static void
+archive_set_number (char *field, size_t len, uint64_t value)
+{
+  size_t i;
+
+  if ((value >> (3 * (len - 1))) == 0)
+    {
+      snprintf (field, len, "%0*" PRIo64, (int) len - 1, value);
+      return;
+    }
+
+  /* Use the GNU base-256 encoding for values that do not fit the octal field,
+   * memory images can be larger than 8GB.  */
+  for (i = len - 1; i > 0; i--)
+    {
+      field[i] = (char) (value & 0xff);
+      value >>= 8;
+    }
+  field[0] = (char) 0x80;
+}
+
+static uint64_t
+archive_get_number (const char *field, size_t len)
+{
+  uint64_t value = 0;
+  size_t i;
+
+  if (((unsigned char) field[0]) & 0x80)
+    {
+      for (i = 1; i < len; i++)
+        value = (value << 8) | (unsigned char) field[i];
+      return value;
+    }
+
+  for (i = 0; i < len && field[i] == ' '; i++)
+    ;
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    value = (value << 3) | (field[i] - '0');
+  return value;
+}
+
+static unsigned int
+archive_header_checksum (struct archive_header_s *header)
+{
+  const unsigned char *p = (const unsigned char *) header;
+  unsigned int sum = 0;
+  size_t i;
+
+  for (i = 0; i < sizeof (*header); i++)
+    {
+      if (i >= offsetof (struct archive_header_s, checksum)
+          && i < offsetof (struct archive_header_s, checksum) + sizeof (header->checksum))
+        sum += ' ';
+      else
+        sum += p[i];
+    }
+  return sum;
+}
+
+static int
+archive_write_file (struct image_archive_s *a, int dirfd, const char *name, libcrun_error_t *err)
+{
+  struct archive_header_s header;
+  cleanup_close int fd = -1;
+  struct stat st;
+  int ret;
+
+  if (UNLIKELY (strlen (name) >= sizeof (header.name)))
+    return crun_make_error (err, 0, "checkpoint image name too long `%s`", name);
+
+  fd = openat (dirfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "open checkpoint image `%s`", name);
+
+  ret = fstat (fd, &st);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "stat checkpoint image `%s`", name);
+
+  memset (&header, 0, sizeof (header));
+  strcpy (header.name, name);
+  archive_set_number (header.mode, sizeof (header.mode), st.st_mode & 07777);
+  archive_set_number (header.uid, sizeof (header.uid), 0);
+  archive_set_number (header.gid, sizeof (header.gid), 0);
+  archive_set_number (header.size, sizeof (header.size), st.st_size);
+  archive_set_number (header.mtime, sizeof (header.mtime), st.st_mtime);
+  header.typeflag = '0';
+  memcpy (header.magic, "ustar", 6);
+  memcpy (header.version, "00", 2);
+  snprintf (header.checksum, sizeof (header.checksum), "%06o", archive_header_checksum (&header));
+  header.checksum[7] = ' ';
+
+  ret = archive_write (a, &header, sizeof (header), err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = archive_write_file_content (a, fd, st.st_size, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return archive_write_padding (a, st.st_size, err);
+}
+
+static int
+export_checkpoint_images (int image_fd, const char *archive_path, libcrun_error_t *err)
+{
+  cleanup_image_archive struct image_archive_s a = { .fd = -1 };
+  static const char end_of_archive[ARCHIVE_BLOCK_SIZE * 2];
+  cleanup_dir DIR *dir = NULL;
+  struct stat archive_st;
+  struct dirent *de;
+  int dfd;
+  int ret;
+
+  a.fd = open (archive_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (UNLIKELY (a.fd < 0))
+    return crun_make_error (err, errno, "open checkpoint archive `%s`", archive_path);
+
+  ret = fstat (a.fd, &archive_st);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "stat checkpoint archive `%s`", archive_path);
+
+  a.buffer = xmalloc (ARCHIVE_BUFFER_SIZE);
+#  ifdef HAVE_ZSTD
+  a.cctx = ZSTD_createCCtx ();
+  if (UNLIKELY (a.cctx == NULL))
+    OOM ();
+#  endif
+
+  dfd = dup (image_fd);
+  if (UNLIKELY (dfd < 0))
+    return crun_make_error (err, errno, "dup checkpoint directory");
+
+  dir = fdopendir (dfd);
+  if (UNLIKELY (dir == NULL))
+    {
+      close (dfd);
+      return crun_make_error (err, errno, "fdopendir checkpoint directory");
+    }
+  rewinddir (dir);
+
+  for (de = readdir (dir); de; de = readdir (dir))
+    {
+      struct stat st;
+
+      if (strcmp (de->d_name, ".") == 0 || strcmp (de->d_name, "..") == 0)
+        continue;
+
+      ret = fstatat (dirfd (dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "stat checkpoint image `%s`", de->d_name);
+
+      /* CRIU only writes regular files.  Skip the archive itself if it is
+       * created in the images directory.  */
+      if (! S_ISREG (st.st_mode) || (st.st_dev == archive_st.st_dev && st.st_ino == archive_st.st_ino))
+        continue;
+
+      ret = archive_write_file (&a, dirfd (dir), de->d_name, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  ret = archive_write (&a, end_of_archive, sizeof (end_of_archive), err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+#  ifdef HAVE_ZSTD
+  ret = archive_compress (&a, NULL, 0, ZSTD_e_end, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+#  endif
+
+  ret = close (a.fd);
+  a.fd = -1;
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "close checkpoint archive `%s`", archive_path);
+
+  return 0;
+}
+
+static ssize_t
+archive_fill (struct image_archive_s *a, libcrun_error_t *err)
+{
+  ssize_t r;
+
+  if (a->buffer_pos < a->buffer_len)
+    return a->buffer_len - a->buffer_pos;
+  if (a->eof)
+    return 0;
+
+  r = TEMP_FAILURE_RETRY (read (a->fd, a->buffer, ARCHIVE_BUFFER_SIZE));
+  if (UNLIKELY (r < 0))
+    return crun_make_error (err, errno, "read checkpoint archive");
+  if (r == 0)
+    a->eof = true;
+
+  a->buffer_pos = 0;
+  a->buffer_len = r;
+  return r;
+}
+
+static int
+archive_read (struct image_archive_s *a, void *data, size_t len, libcrun_error_t *err)
+{
+  char *dst = data;
+
+  while (len > 0)
+    {
+      ssize_t r;
+      size_t n;
+
+      r = archive_fill (a, err);
+      if (UNLIKELY (r < 0))
+        return r;
+
+#  ifdef HAVE_ZSTD
+      if (a->dctx)
+        {
+          ZSTD_outBuffer out = { dst, len, 0 };
+          ZSTD_inBuffer in = { a->buffer, a->buffer_len, a->buffer_pos };
+          size_t zret;
+
+          zret = ZSTD_decompressStream (a->dctx, &out, &in);
+          if (UNLIKELY (ZSTD_isError (zret)))
+            return crun_make_error (err, 0, "decompress checkpoint archive: %s", ZSTD_getErrorName (zret));
+          a->buffer_pos = in.pos;
+
+          if (UNLIKELY (out.pos == 0 && r == 0))
+            return crun_make_error (err, 0, "checkpoint archive truncated");
+
+          dst += out.pos;
+          len -= out.pos;
+          continue;
+        }
+#  endif
+
+      if (UNLIKELY (r == 0))
+        return crun_make_error (err, 0, "checkpoint archive truncated");
+
+      n = len < (size_t) r ? len : (size_t) r;
+      memcpy (dst, a->buffer + a->buffer_pos, n);
+      a->buffer_pos += n;
+      dst += n;
+      len -= n;
+    }
+  return 0;
+}
+
+/* Copy SIZE bytes from the archive to FD, or skip them if FD is -1.  */
+static int
+archive_copy (struct image_archive_s *a, int fd, uint64_t size, libcrun_error_t *err)
+{
+  cleanup_free char *chunk = xmalloc (ARCHIVE_BUFFER_SIZE);
+  int ret;
+
+  while (size > 0)
+    {
+      size_t n = size < ARCHIVE_BUFFER_SIZE ? size : ARCHIVE_BUFFER_SIZE;
+
+      ret = archive_read (a, chunk, n, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      if (fd >= 0 && UNLIKELY (safe_write (fd, chunk, n) < 0))
+        return crun_make_error (err, errno, "write checkpoint image");
+
+      size -= n;
+    }
+  return 0;
+}
+
+static int
+import_checkpoint_images (const char *archive_path, int image_fd, libcrun_error_t *err)
+{
+  cleanup_image_archive struct image_archive_s a = { .fd = -1 };
+  const unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+  static const char zeros[ARCHIVE_BLOCK_SIZE];
+  int ret;
+
+  a.fd = open (archive_path, O_RDONLY | O_CLOEXEC);
+  if (UNLIKELY (a.fd < 0))
+    return crun_make_error (err, errno, "open checkpoint archive `%s`", archive_path);
+
+  a.buffer = xmalloc (ARCHIVE_BUFFER_SIZE);
+
+  /* Read enough to detect whether the archive is compressed.  */
+  while (a.buffer_len < sizeof (zstd_magic) && ! a.eof)
+    {
+      ssize_t r;
+
+      r = TEMP_FAILURE_RETRY (read (a.fd, a.buffer + a.buffer_len, ARCHIVE_BUFFER_SIZE - a.buffer_len));
+      if (UNLIKELY (r < 0))
+        return crun_make_error (err, errno, "read checkpoint archive `%s`", archive_path);
+      if (r == 0)
+        a.eof = true;
+      a.buffer_len += r;
+    }
+
+  if (a.buffer_len >= sizeof (zstd_magic) && memcmp (a.buffer, zstd_magic, sizeof (zstd_magic)) == 0)
+    {
+#  ifdef HAVE_ZSTD
+      a.dctx = ZSTD_createDCtx ();
+      if (UNLIKELY (a.dctx == NULL))
+        OOM ();
+#  else
+      return crun_make_error (err, 0, "checkpoint archive `%s` is compressed with zstd, not supported", archive_path);
+#  endif
+    }
+
+  for (;;)
+    {
+      struct archive_header_s header;
+      cleanup_close int fd = -1;
+      char name[sizeof (header.name) + 1];
+      uint64_t checksum;
+      uint64_t size;
+
+      ret = archive_read (&a, &header, sizeof (header), err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      /* An empty block marks the end of the archive.  */
+      if (memcmp (&header, zeros, sizeof (header)) == 0)
+        break;
+
+      checksum = archive_get_number (header.checksum, sizeof (header.checksum));
+      if (UNLIKELY (checksum != archive_header_checksum (&header)))
+        return crun_make_error (err, 0, "invalid checksum in checkpoint archive `%s`", archive_path);
+
+      size = archive_get_number (header.size, sizeof (header.size));
+
+      if (header.typeflag == '0' || header.typeflag == '\0')
+        {
+          const char *file_name = name;
+
+          memcpy (name, header.name, sizeof (header.name));
+          name[sizeof (header.name)] = '\0';
+          if (has_prefix (file_name, "./"))
+            file_name += 2;
+
+          /* The images directory is flat, do not allow to write anywhere else.  */
+          if (UNLIKELY (header.prefix[0] != '\0' || file_name[0] == '\0' || strchr (file_name, '/') != NULL
+                        || strcmp (file_name, "..") == 0))
+            return crun_make_error (err, 0, "invalid file name in checkpoint archive `%s`", archive_path);
+
+          fd = openat (image_fd, file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+          if (UNLIKELY (fd < 0))
+            return crun_make_error (err, errno, "open checkpoint image `%s`", file_name);
+        }
+
+      ret = archive_copy (&a, fd, size, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = archive_copy (&a, -1, (ARCHIVE_BLOCK_SIZE - size % ARCHIVE_BLOCK_SIZE) % ARCHIVE_BLOCK_SIZE, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  return 0;
+}
+
+/* Key used for a namespace that is joined from a path, and that is
+   therefore not dumped by CRIU but recorded as external.  */
+static const char *
+get_external_namespace_key (int value)
+{
+  switch (value)
+    {
+    case CLONE_NEWNET:
+      return "extRootNetNS";
+
+    case CLONE_NEWPID:
+      return "extRootPidNS";
+
+    default:
+      return NULL;
+    }
+}
+
+static int
+set_page_server (const char *page_server, libcrun_error_t *err)
+{
+  cleanup_free char *address = NULL;
+  char *sep, *endptr;
+  long port;
+  int ret;
+
+  address = xstrdup (page_server);
+  sep = strrchr (address, ':');
+  if (UNLIKELY (sep == NULL || sep == address))
+    return crun_make_error (err, 0, "invalid page server `%s`, expected ADDRESS:PORT", page_server);
+  *sep = '\0';
+
+  errno = 0;
+  port = strtol (sep + 1, &endptr, 10);
+  if (UNLIKELY (errno != 0 || *endptr != '\0' || endptr == sep + 1 || port <= 0 || port > 65535))
+    return crun_make_error (err, 0, "invalid page server port `%s`", sep + 1);
+
+  ret = criu_set_page_server_address_port (address, port);
+  if (UNLIKELY (ret != 0))
+    return crun_make_error (err, 0, "error setting CRIU page server to %s\n", page_server);
+
+  return 0;
+}
+
 int
 libcrun_container_checkpoint_linux_criu (libcrun_container_status_t *status, libcrun_container_t *container,
                                          libcrun_checkpoint_restore_t *cr_options, libcrun_error_t *err)
@@ -214,7 +772,6 @@ libcrun_container_checkpoint_linux_criu (libcrun_container_status_t *status, lib
   cleanup_free char *descriptors_path = NULL;
   cleanup_free char *freezer_path = NULL;
   cleanup_close int descriptors_fd = -1;
-  cleanup_free char *external = NULL;
   cleanup_free char *path = NULL;
   cleanup_close int image_fd = -1;
   cleanup_close int work_fd = -1;
@@ -242,6 +799,15 @@ libcrun_container_checkpoint_linux_criu (libcrun_container_status_t *status, lib
    * possible to detect (via the library) which CRIU version is
    * actually being used. This needs to be added to CRIU upstream. */
 
+#  ifndef HAVE_CRIU_PRE_DUMP
+  if (cr_options->pre_dump)
+    return crun_make_error (err, 0, "pre-dump is not supported by the CRIU library");
+#  endif
+
+  /* A pre-dump cannot be restored, it is only used as parent for the next dump.  */
+  if (UNLIKELY (cr_options->pre_dump && cr_options->archive_path != NULL))
+    return crun_make_error (err, 0, "a checkpoint archive cannot be created for a pre-dump");
+
   ret = criu_init_opts ();
   if (UNLIKELY (ret < 0))
     return crun_make_error (err, 0, "CRIU init failed with %d\n", ret);
@@ -352,24 +918,30 @@ libcrun_container_checkpoint_linux_criu (libcrun_container_status_t *status, lib
    *
    * CRIU expects the information about an external namespace like this:
    * --external net[<inode>]:<key>
-   * For key we are using the string: 'extRootNetNS'. */
+   * For key we are using the string: 'extRootNetNS'.
+   *
+   * The same is done for a PID namespace joined from a path, as the
+   * containers of a pod do with the namespace of the infra container. */
 
   for (i = 0; i < def->linux->namespaces_len; i++)
     {
+      const char *key;
       int value = libcrun_find_namespace (def->linux->namespaces[i]->type);
       if (UNLIKELY (value < 0))
         return crun_make_error (err, 0, "invalid namespace type: `%s`", def->linux->namespaces[i]->type);
 
-      if (value == CLONE_NEWNET && def->linux->namespaces[i]->path != NULL)
+      key = get_external_namespace_key (value);
+      if (key != NULL && def->linux->namespaces[i]->path != NULL)
         {
+          cleanup_free char *external = NULL;
           struct stat statbuf;
+
           ret = stat (def->linux->namespaces[i]->path, &statbuf);
           if (UNLIKELY (ret < 0))
             return crun_make_error (err, errno, "unable to stat(): `%s`", def->linux->namespaces[i]->path);
 
-          xasprintf (&external, "net[%ld]:extRootNetNS", statbuf.st_ino);
+          xasprintf (&external, "%s[%ld]:%s", value == CLONE_NEWNET ? "net" : "pid", statbuf.st_ino, key);
           criu_add_external (external);
-          break;
         }
     }
 
@@ -400,8 +972,51 @@ libcrun_container_checkpoint_linux_criu (libcrun_container_status_t *status, lib
   criu_set_orphan_pts_master (true);
   criu_set_manage_cgroups (true);
 
+  /* A pre-dump, or a dump on top of a previous pre-dump, only copies
+   * the pages that changed since the parent images were written.  The
+   * parent path is interpreted by CRIU relative to the images directory. */
+  if (cr_options->parent_path != NULL)
+    {
+      ret = criu_set_parent_images (cr_options->parent_path);
+      if (UNLIKELY (ret != 0))
+        return crun_make_error (err, 0, "error setting CRIU parent images to %s\n", cr_options->parent_path);
+    }
+  if (cr_options->pre_dump || cr_options->parent_path != NULL)
+    criu_set_track_mem (true);
+
+  /* Stream the memory pages to a remote page server instead of writing them
+   * to the images directory.  With lazy pages, CRIU keeps the pages on this
+   * side and serves them while the restored container faults them in.  */
+  if (cr_options->page_server != NULL)
+    {
+      ret = set_page_server (cr_options->page_server, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+  if (cr_options->lazy_pages)
+    {
+      if (UNLIKELY (cr_options->page_server == NULL))
+        return crun_make_error (err, 0, "lazy pages requires a page server address");
+      criu_set_lazy_pages (true);
+    }
+
   /* Set up logging. */
   criu_set_log_level (4);
+
+#  ifdef HAVE_CRIU_PRE_DUMP
+  if (cr_options->pre_dump)
+    {
+      criu_set_log_file (CRIU_PRE_DUMP_LOG_FILE);
+      ret = criu_pre_dump ();
+      if (UNLIKELY (ret != 0))
+        return crun_make_error (err, 0,
+                                "CRIU pre-dump failed %d\n"
+                                "Please check CRIU logfile %s/%s\n",
+                                ret, cr_options->work_path, CRIU_PRE_DUMP_LOG_FILE);
+      return 0;
+    }
+#  endif
+
   criu_set_log_file (CRIU_CHECKPOINT_LOG_FILE);
   ret = criu_dump ();
   if (UNLIKELY (ret != 0))
@@ -410,6 +1025,9 @@ libcrun_container_checkpoint_linux_criu (libcrun_container_status_t *status, lib
                             "Please check CRIU logfile %s/%s\n",
                             ret, cr_options->work_path, CRIU_CHECKPOINT_LOG_FILE);
 
+  if (cr_options->archive_path != NULL)
+    return export_checkpoint_images (image_fd, cr_options->archive_path, err);
+
   return 0;
 }
 
@@ -494,6 +1112,7 @@ libcrun_container_restore_linux_criu (libcrun_container_status_t *status, libcru
 {
   runtime_spec_schema_config_schema *def = container->container_def;
   cleanup_close int inherit_fd = -1;
+  cleanup_close int inherit_pidns_fd = -1;
   cleanup_close int image_fd = -1;
   cleanup_free char *root = NULL;
   cleanup_close int work_fd = -1;
@@ -511,10 +1130,25 @@ libcrun_container_restore_linux_criu (libcrun_container_status_t *status, libcru
   if (UNLIKELY (cr_options->image_path == NULL))
     return crun_make_error (err, 0, "image path not set\n");
 
+  if (cr_options->archive_path != NULL)
+    {
+      ret = mkdir (cr_options->image_path, 0700);
+      if (UNLIKELY ((ret == -1) && (errno != EEXIST)))
+        return crun_make_error (err, errno, "error creating checkpoint directory %s\n", cr_options->image_path);
+    }
+
   image_fd = open (cr_options->image_path, O_DIRECTORY);
   if (UNLIKELY (image_fd == -1))
     return crun_make_error (err, errno, "error opening checkpoint directory %s\n", cr_options->image_path);
 
+  /* Unpack the archive created by the checkpoint into the images directory.  */
+  if (cr_options->archive_path != NULL)
+    {
+      ret = import_checkpoint_images (cr_options->archive_path, image_fd, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
   criu_set_images_dir_fd (image_fd);
 
   /* Load descriptors.json to tell CRIU where those FDs should be connected to. */
@@ -642,22 +1276,37 @@ libcrun_container_restore_linux_criu (libcrun_container_status_t *status, libcru
    * CRIU to restore the process into that network namespace.
    * CRIU expects the information about the network namespace like this:
    * --inherit-fd fd[<fd>]:<key>
-   * The <key> needs to be the same as during checkpointing (extRootNetNS). */
+   * The <key> needs to be the same as during checkpointing (extRootNetNS).
+   * The same is done for the PID namespace. */
   for (i = 0; i < def->linux->namespaces_len; i++)
     {
+      const char *key;
+      int fd;
       int value = libcrun_find_namespace (def->linux->namespaces[i]->type);
       if (UNLIKELY (value < 0))
         return crun_make_error (err, 0, "invalid namespace type: `%s`", def->linux->namespaces[i]->type);
 
-      if (value == CLONE_NEWNET && def->linux->namespaces[i]->path != NULL)
-        {
-          inherit_fd = open (def->linux->namespaces[i]->path, O_RDONLY);
-          if (UNLIKELY (inherit_fd < 0))
-            return crun_make_error (err, errno, "unable to open(): `%s`", def->linux->namespaces[i]->path);
+      key = get_external_namespace_key (value);
+      if (key == NULL || def->linux->namespaces[i]->path == NULL)
+        continue;
 
-          criu_add_inherit_fd (inherit_fd, "extRootNetNS");
-          break;
+      /* Not O_CLOEXEC, the descriptor is inherited by CRIU.  */
+      fd = open (def->linux->namespaces[i]->path, O_RDONLY);
+      if (UNLIKELY (fd < 0))
+        return crun_make_error (err, errno, "unable to open(): `%s`", def->linux->namespaces[i]->path);
+
+      if (value == CLONE_NEWNET)
+        {
+          close_and_reset (&inherit_fd);
+          inherit_fd = fd;
         }
+      else
+        {
+          close_and_reset (&inherit_pidns_fd);
+          inherit_pidns_fd = fd;
+        }
+
+      criu_add_inherit_fd (fd, key);
     }
 
   /* Tell CRIU if cgroup v1 needs to be handled. */
@@ -675,6 +1324,10 @@ libcrun_container_restore_linux_criu (libcrun_container_status_t *status, libcru
   criu_set_orphan_pts_master (true);
   criu_set_manage_cgroups (true);
 
+  /* The memory pages are not read from the images, they are provided later
+   * on demand through userfaultfd by a `criu lazy-pages` daemon.  */
+  criu_set_lazy_pages (cr_options->lazy_pages);
+
   criu_set_log_level (4);
   criu_set_log_file (CRIU_RESTORE_LOG_FILE);
   ret = criu_restore_child ();
@@ -0,0 +1,60 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <config.h>
+#include "custom-handler.h"
+#include <string.h>
+
+#if HAVE_DLOPEN && HAVE_LIBKRUN
+extern struct custom_handler_s handler_libkrun;
+#endif
+#if HAVE_DLOPEN && HAVE_WASMEDGE
+extern struct custom_handler_s handler_wasmedge;
+#endif
+
+static struct custom_handler_s *static_handlers[] = {
+#if HAVE_DLOPEN && HAVE_LIBKRUN
+  &handler_libkrun,
+#endif
+#if HAVE_DLOPEN && HAVE_WASMEDGE
+  &handler_wasmedge,
+#endif
+  NULL,
+};
+
+struct custom_handler_s *
+libcrun_find_handler (const char *name)
+{
+  size_t i;
+
+  for (i = 0; static_handlers[i]; i++)
+    if (strcmp (static_handlers[i]->name, name) == 0)
+      return static_handlers[i];
+
+  return NULL;
+}
+
+void
+libcrun_handler_print_features (FILE *out)
+{
+  size_t i;
+
+  for (i = 0; static_handlers[i]; i++)
+    fprintf (out, "+%s ", static_handlers[i]->feature_string);
+}
@@ -0,0 +1,58 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CUSTOM_HANDLER_H
+#define CUSTOM_HANDLER_H
+
+#include <config.h>
+#include <stdio.h>
+#include "container.h"
+#include "error.h"
+
+enum handler_configure_phase
+{
+  HANDLER_CONFIGURE_BEFORE_MOUNTS = 1,
+  HANDLER_CONFIGURE_AFTER_MOUNTS,
+};
+
+/* A handler runs the container payload in the container init process,
+   instead of the execve of process.args.  It is selected either with the
+   global handler (e.g. when crun is invoked as krun) or with the
+   run.oci.handler annotation.  */
+struct custom_handler_s
+{
+  const char *name;
+  /* Printed by crun --version.  */
+  const char *feature_string;
+
+  /* Called in the container init process before the container is set up.
+     COOKIE is passed to the other callbacks.  */
+  int (*load) (void **cookie, libcrun_error_t *err);
+
+  /* Replace the execve of the container process, it returns only on errors.  */
+  int (*exec_func) (void *container, void *cookie, const char *pathname, char *const argv[]);
+
+  /* Optional, called before and after the mounts are done in the container rootfs.  */
+  int (*configure_container) (void *cookie, enum handler_configure_phase phase, libcrun_container_t *container,
+                              libcrun_error_t *err);
+};
+
+struct custom_handler_s *libcrun_find_handler (const char *name);
+
+LIBCRUN_PUBLIC void libcrun_handler_print_features (FILE *out);
+
+#endif
@@ -24,6 +24,10 @@
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <dirent.h>
 
 #ifdef HAVE_EBPF
 #  include <linux/bpf.h>
@@ -81,8 +85,56 @@ struct bpf_program
 
 #  define BPF_EXIT_INSN() \
     ((struct bpf_insn){ .code = BPF_JMP | BPF_EXIT, .dst_reg = 0, .src_reg = 0, .off = 0, .imm = 0 })
+
+#  define BPF_ALU32_REG(OP, DST, SRC) \
+    ((struct bpf_insn){ .code = BPF_ALU | BPF_OP (OP) | BPF_X, .dst_reg = DST, .src_reg = SRC, .off = 0, .imm = 0 })
+
+#  define BPF_ALU64_IMM(OP, DST, IMM) \
+    ((struct bpf_insn){ .code = BPF_ALU64 | BPF_OP (OP) | BPF_K, .dst_reg = DST, .src_reg = 0, .off = 0, .imm = IMM })
+
+#  define BPF_STX_MEM(SIZE, DST, SRC, OFF) \
+    ((struct bpf_insn){                    \
+        .code = BPF_STX | BPF_SIZE (SIZE) | BPF_MEM, .dst_reg = DST, .src_reg = SRC, .off = OFF, .imm = 0 })
+
+#  define BPF_ST_MEM(SIZE, DST, OFF, IMM) \
+    ((struct bpf_insn){                   \
+        .code = BPF_ST | BPF_SIZE (SIZE) | BPF_MEM, .dst_reg = DST, .src_reg = 0, .off = OFF, .imm = IMM })
+
+#  define BPF_LD_MAP_FD(DST, MAP_FD)                                                                             \
+    ((struct bpf_insn){                                                                                          \
+        .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = DST, .src_reg = BPF_PSEUDO_MAP_FD, .off = 0, .imm = MAP_FD }), \
+        ((struct bpf_insn){ .code = 0, .dst_reg = 0, .src_reg = 0, .off = 0, .imm = 0 })
+
+#  define BPF_EMIT_CALL(FUNC) \
+    ((struct bpf_insn){ .code = BPF_JMP | BPF_CALL, .dst_reg = 0, .src_reg = 0, .off = 0, .imm = FUNC })
 #endif
 
+#define DEV_MAP_NAME "crun_devices"
+#define DEV_MAP_WILDCARD UINT32_MAX
+#define DEV_MAP_MIN_ENTRIES 64
+
+struct bpf_dev_map_key
+{
+  uint32_t type;
+  uint32_t major;
+  uint32_t minor;
+};
+
+struct bpf_dev_map_entry
+{
+  struct bpf_dev_map_key key;
+  uint32_t access;
+};
+
+/* The allowed devices, used to fill the BPF hash map looked up by the
+   program generated with bpf_dev_map_program.  */
+struct bpf_dev_map
+{
+  size_t allocated;
+  size_t used;
+  struct bpf_dev_map_entry entries[];
+};
+
 #ifdef HAVE_EBPF
 static size_t
 bpf_program_instructions (struct bpf_program *program)
@@ -438,27 +490,36 @@ ebpf_attach_program (int fd, int dirfd, libcrun_error_t *err)
 #endif
 }
 
-int
-libcrun_ebpf_load (struct bpf_program *program, int dirfd, const char *pin, libcrun_error_t *err)
+#ifdef HAVE_EBPF
+/* Kernels older than 5.11 charge BPF objects to RLIMIT_MEMLOCK and fail
+   with EPERM once it is exceeded, newer ones use the memory cgroup.  So
+   the limit is raised only after such a failure.  */
+static int
+ebpf_retry_with_memlock (int cmd, union bpf_attr *attr)
 {
-#ifndef HAVE_EBPF
-  (void) dirfd;
-  (void) program;
-  (void) pin;
-  (void) ebpf_attach_program;
-
-  return crun_make_error (err, 0, "eBPF not supported");
-#else
-  cleanup_close int fd = -1;
-  union bpf_attr attr;
   struct rlimit limit;
   int ret;
 
+  ret = bpf (cmd, attr, sizeof (*attr));
+  if (ret >= 0 || errno != EPERM)
+    return ret;
+
   limit.rlim_cur = RLIM_INFINITY;
   limit.rlim_max = RLIM_INFINITY;
-  ret = setrlimit (RLIMIT_MEMLOCK, &limit);
-  if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "setrlimit (RLIM_MEMLOCK)");
+  if (setrlimit (RLIMIT_MEMLOCK, &limit) < 0)
+    {
+      errno = EPERM;
+      return -1;
+    }
+
+  return bpf (cmd, attr, sizeof (*attr));
+}
+
+static int
+ebpf_load_program (struct bpf_program *program, libcrun_error_t *err)
+{
+  union bpf_attr attr;
+  int fd;
 
   memset (&attr, 0, sizeof (attr));
   attr.prog_type = BPF_PROG_TYPE_CGROUP_DEVICE;
@@ -467,7 +528,7 @@ libcrun_ebpf_load (struct bpf_program *program, int dirfd, const char *pin, libc
   attr.license = (uint64_t) "GPL";
 
   /* First try without log.  */
-  fd = bpf (BPF_PROG_LOAD, &attr, sizeof (attr));
+  fd = ebpf_retry_with_memlock (BPF_PROG_LOAD, &attr);
   if (fd < 0)
     {
       const size_t log_size = 8192;
@@ -483,19 +544,245 @@ libcrun_ebpf_load (struct bpf_program *program, int dirfd, const char *pin, libc
         return crun_make_error (err, errno, "bpf create `%s`", log);
     }
 
+  return fd;
+}
+
+#  define PROGRAMS_CACHE_DIR "/sys/fs/bpf/crun"
+
+/* Each cached program has its own directory under PROGRAMS_CACHE_DIR.  The
+   program is pinned there as "prog", and every cgroup that uses it adds a
+   reference, pinned as "cg-INODE" with the inode of the cgroup.  The
+   reference is removed when the cgroup is destroyed, together with the
+   whole directory once no reference is left.  */
+#  define CACHED_PROGRAM_NAME "prog"
+
+/* Directory in bpffs where a program with the same instructions as PROGRAM
+   is cached.  The name is derived from the FNV-1a hash and the length of
+   the instructions, the instructions themselves are compared when the
+   program is looked up.  */
+static char *
+get_cached_program_dir (struct bpf_program *program)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  char *path = NULL;
+  size_t i;
+
+  for (i = 0; i < program->used; i++)
+    {
+      hash ^= (unsigned char) program->program[i];
+      hash *= 0x100000001b3ULL;
+    }
+
+  xasprintf (&path, "%s/dev-%016" PRIx64 "-%zu", PROGRAMS_CACHE_DIR, hash, bpf_program_instructions (program));
+  return path;
+}
+
+/* Get the program cached in DIR, or -1 if there is none or if it is not
+   exactly PROGRAM.  The device programs are not rewritten by the verifier,
+   so the translated instructions are the same that were loaded.  If the
+   kernel does not report them, the cache is not used.  */
+static int
+get_cached_program (const char *dir, struct bpf_program *program)
+{
+  cleanup_free char *insns = xmalloc (program->used);
+  cleanup_free char *path = NULL;
+  struct bpf_prog_info info;
+  union bpf_attr attr;
+  int fd, ret;
+
+  xasprintf (&path, "%s/%s", dir, CACHED_PROGRAM_NAME);
+
+  memset (&attr, 0, sizeof (attr));
+  attr.pathname = (uint64_t) path;
+  fd = bpf (BPF_OBJ_GET, &attr, sizeof (attr));
+  if (fd < 0)
+    return -1;
+
+  memset (&info, 0, sizeof (info));
+  info.xlated_prog_len = program->used;
+  info.xlated_prog_insns = (uint64_t) insns;
+  memset (&attr, 0, sizeof (attr));
+  attr.info.bpf_fd = fd;
+  attr.info.info_len = sizeof (info);
+  attr.info.info = (uint64_t) &info;
+  ret = bpf (BPF_OBJ_GET_INFO_BY_FD, &attr, sizeof (attr));
+  if (ret < 0 || info.type != BPF_PROG_TYPE_CGROUP_DEVICE || info.xlated_prog_len != program->used
+      || memcmp (insns, program->program, program->used) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+}
+
+static int
+pin_program (int fd, const char *path)
+{
+  union bpf_attr attr;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.pathname = (uint64_t) path;
+  attr.bpf_fd = fd;
+  return bpf (BPF_OBJ_PIN, &attr, sizeof (attr));
+}
+
+/* Pin the program FD in DIR, so that other containers with the same rules
+   can use it without loading it again.  Failures are not fatal, bpffs
+   might not be mounted.  */
+static void
+cache_program (int fd, const char *dir)
+{
+  cleanup_free char *path = NULL;
+
+  if (mkdir (PROGRAMS_CACHE_DIR, 0700) < 0 && errno != EEXIST)
+    return;
+  if (mkdir (dir, 0700) < 0 && errno != EEXIST)
+    return;
+
+  xasprintf (&path, "%s/%s", dir, CACHED_PROGRAM_NAME);
+
+  /* If it fails with EEXIST, another container pinned it first.  */
+  (void) pin_program (fd, path);
+}
+
+/* Record that the cgroup at CGROUP_DIRFD uses the program FD cached in DIR.  */
+static void
+add_cached_program_ref (int fd, const char *dir, int cgroup_dirfd)
+{
+  cleanup_free char *path = NULL;
+  struct stat st;
+
+  if (fstat (cgroup_dirfd, &st) < 0)
+    return;
+
+  xasprintf (&path, "%s/cg-%ju", dir, (uintmax_t) st.st_ino);
+
+  /* The cgroup might already use a program from the same directory.  */
+  unlink (path);
+
+  (void) pin_program (fd, path);
+}
+#endif
+
+/* Drop the references of the cgroup at CGROUP_PATH to the cached programs,
+   and remove the programs that are not used anymore.  It must be called
+   before the cgroup is removed.  */
+void
+libcrun_ebpf_release_cgroup (const char *cgroup_path)
+{
+#ifndef HAVE_EBPF
+  (void) cgroup_path;
+#else
+  cleanup_dir DIR *cache = NULL;
+  char ref[64];
+  struct dirent *de;
+  struct stat st;
+
+  if (stat (cgroup_path, &st) < 0)
+    return;
+
+  cache = opendir (PROGRAMS_CACHE_DIR);
+  if (cache == NULL)
+    return;
+
+  snprintf (ref, sizeof (ref), "cg-%ju", (uintmax_t) st.st_ino);
+
+  for (de = readdir (cache); de; de = readdir (cache))
+    {
+      cleanup_close int entry_fd = -1;
+      cleanup_dir DIR *entry = NULL;
+      struct dirent *it;
+      bool in_use = false;
+
+      if (de->d_name[0] == '.')
+        continue;
+
+      entry_fd = openat (dirfd (cache), de->d_name, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+      if (entry_fd < 0)
+        continue;
+
+      if (unlinkat (entry_fd, ref, 0) < 0)
+        continue;
+
+      entry = fdopendir (entry_fd);
+      if (entry == NULL)
+        continue;
+      /* Now owned by ENTRY.  */
+      entry_fd = -1;
+
+      for (it = readdir (entry); it; it = readdir (entry))
+        if (has_prefix (it->d_name, "cg-"))
+          {
+            in_use = true;
+            break;
+          }
+
+      if (in_use)
+        continue;
+
+      /* A container that gets the program concurrently already has a file
+         descriptor for it.  If it adds its reference before the directory
+         is removed, rmdir fails and the directory is removed together with
+         that reference.  */
+      unlinkat (dirfd (entry), CACHED_PROGRAM_NAME, 0);
+      unlinkat (dirfd (cache), de->d_name, AT_REMOVEDIR);
+    }
+#endif
+}
+
+int
+libcrun_ebpf_load (struct bpf_program *program, int dirfd, const char *pin, libcrun_error_t *err)
+{
+#ifndef HAVE_EBPF
+  (void) dirfd;
+  (void) program;
+  (void) pin;
+  (void) ebpf_attach_program;
+
+  return crun_make_error (err, 0, "eBPF not supported");
+#else
+  cleanup_free char *cache_dir = NULL;
+  cleanup_close int fd = -1;
+  int ret;
+
+  /* Containers with the same device rules share the same program, so the
+     verifier runs only for the first of them.  */
+  cache_dir = get_cached_program_dir (program);
+  fd = get_cached_program (cache_dir, program);
+  if (fd >= 0)
+    {
+      ret = ebpf_attach_program (fd, dirfd, err);
+      if (LIKELY (ret == 0))
+        goto attached;
+
+      /* The same program cannot be attached twice to a cgroup, the kernel
+         fails with EINVAL when it is already attached together with other
+         programs.  Whatever the reason, use a private copy.  */
+      crun_error_release (err);
+      close_and_reset (&fd);
+    }
+
+  fd = ebpf_load_program (program, err);
+  if (UNLIKELY (fd < 0))
+    return fd;
+
   ret = ebpf_attach_program (fd, dirfd, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
+  cache_program (fd, cache_dir);
+
+attached:
+
+  add_cached_program_ref (fd, cache_dir, dirfd);
+
   /* Optionally pin the program to the specified path.  */
   if (pin)
     {
       unlink (pin);
 
-      memset (&attr, 0, sizeof (attr));
-      attr.pathname = (uint64_t) pin;
-      attr.bpf_fd = fd;
-      ret = bpf (BPF_OBJ_PIN, &attr, sizeof (attr));
+      ret = pin_program (fd, pin);
       if (ret < 0)
         return crun_make_error (err, errno, "bpf pin to `%s`", pin);
     }
@@ -503,3 +790,396 @@ libcrun_ebpf_load (struct bpf_program *program, int dirfd, const char *pin, libc
   return 0;
 #endif
 }
+
+struct bpf_dev_map *
+bpf_dev_map_new (void)
+{
+  struct bpf_dev_map *map = xmalloc (sizeof (struct bpf_dev_map) + sizeof (struct bpf_dev_map_entry) * 16);
+
+  map->allocated = 16;
+  map->used = 0;
+
+  return map;
+}
+
+/* Add a rule that allows ACCESS to the device.  Rules for the same device
+   are merged only when the access of one of them includes the other, as a
+   request must be allowed entirely by a single rule.  It returns -1 if the
+   rule cannot be represented in the map.  */
+int
+bpf_dev_map_add (struct bpf_dev_map **map, const char *access, char type, int major, int minor)
+{
+#ifdef HAVE_EBPF
+  struct bpf_dev_map_key key;
+  uint32_t bpf_access = 0;
+  size_t i;
+
+  if (type == 'a')
+    {
+      int ret;
+
+      ret = bpf_dev_map_add (map, access, 'b', major, minor);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      return bpf_dev_map_add (map, access, 'c', major, minor);
+    }
+
+  for (i = 0; access[i]; i++)
+    {
+      switch (access[i])
+        {
+        case 'r':
+          bpf_access |= BPF_DEVCG_ACC_READ;
+          break;
+
+        case 'w':
+          bpf_access |= BPF_DEVCG_ACC_WRITE;
+          break;
+
+        case 'm':
+          bpf_access |= BPF_DEVCG_ACC_MKNOD;
+          break;
+        }
+    }
+
+  memset (&key, 0, sizeof (key));
+  key.type = type == 'b' ? BPF_DEVCG_DEV_BLOCK : BPF_DEVCG_DEV_CHAR;
+  key.major = major >= 0 ? (uint32_t) major : DEV_MAP_WILDCARD;
+  key.minor = minor >= 0 ? (uint32_t) minor : DEV_MAP_WILDCARD;
+
+  for (i = 0; i < (*map)->used; i++)
+    {
+      struct bpf_dev_map_entry *entry = &(*map)->entries[i];
+
+      if (memcmp (&entry->key, &key, sizeof (key)) != 0)
+        continue;
+
+      if ((entry->access & bpf_access) == bpf_access)
+        return 0;
+      if ((entry->access & bpf_access) == entry->access)
+        {
+          entry->access = bpf_access;
+          return 0;
+        }
+      return -1;
+    }
+
+  if ((*map)->used == (*map)->allocated)
+    {
+      (*map)->allocated *= 2;
+      *map = xrealloc (*map, sizeof (struct bpf_dev_map) + sizeof (struct bpf_dev_map_entry) * (*map)->allocated);
+    }
+
+  (*map)->entries[(*map)->used].key = key;
+  (*map)->entries[(*map)->used].access = bpf_access;
+  (*map)->used++;
+  return 0;
+#else
+  (void) map;
+  (void) access;
+  (void) type;
+  (void) major;
+  (void) minor;
+  return -1;
+#endif
+}
+
+#ifdef HAVE_EBPF
+/* Generate a program that looks up the device in the map MAP_FD as
+   type:major:minor, type:major:*, type:*:minor and type:*:*, and allows
+   the access if one of the entries found includes it.  Its size does not
+   depend on the number of rules.  */
+static struct bpf_program *
+bpf_dev_map_program (int map_fd)
+{
+  struct bpf_program *program = bpf_program_new (1024);
+  struct bpf_insn pre_insn[] = {
+    /* access -> R6.  */
+    BPF_LDX_MEM (BPF_W, BPF_REG_6, BPF_REG_1, 0),
+    BPF_ALU32_IMM (BPF_RSH, BPF_REG_6, 16),
+
+    /* type -> R7.  */
+    BPF_LDX_MEM (BPF_W, BPF_REG_7, BPF_REG_1, 0),
+    BPF_ALU32_IMM (BPF_AND, BPF_REG_7, 0xFFFF),
+
+    /* major -> R8.  */
+    BPF_LDX_MEM (BPF_W, BPF_REG_8, BPF_REG_1, 4),
+
+    /* minor -> R9.  */
+    BPF_LDX_MEM (BPF_W, BPF_REG_9, BPF_REG_1, 8),
+
+    /* The key is stored on the stack at R10 - 16.  */
+    BPF_STX_MEM (BPF_W, BPF_REG_10, BPF_REG_7, -16),
+  };
+  struct bpf_insn post_insn[] = {
+    BPF_MOV64_IMM (BPF_REG_0, 0),
+    BPF_EXIT_INSN (),
+  };
+  int i;
+
+  program = bpf_program_append (program, pre_insn, sizeof (pre_insn));
+
+  for (i = 0; i < 4; i++)
+    {
+      const bool wildcard_major = i >= 2;
+      const bool wildcard_minor = i % 2 == 1;
+      struct bpf_insn major_insn[] = { wildcard_major ? BPF_ST_MEM (BPF_W, BPF_REG_10, -12, (int) DEV_MAP_WILDCARD)
+                                                      : BPF_STX_MEM (BPF_W, BPF_REG_10, BPF_REG_8, -12) };
+      struct bpf_insn minor_insn[] = { wildcard_minor ? BPF_ST_MEM (BPF_W, BPF_REG_10, -8, (int) DEV_MAP_WILDCARD)
+                                                      : BPF_STX_MEM (BPF_W, BPF_REG_10, BPF_REG_9, -8) };
+      struct bpf_insn lookup_insn[] = {
+        BPF_LD_MAP_FD (BPF_REG_1, map_fd),
+        BPF_MOV64_REG (BPF_REG_2, BPF_REG_10),
+        BPF_ALU64_IMM (BPF_ADD, BPF_REG_2, -16),
+        BPF_EMIT_CALL (BPF_FUNC_map_lookup_elem),
+
+        /* if (entry == NULL) goto next_lookup.  */
+        BPF_JMP_IMM (BPF_JEQ, BPF_REG_0, 0, 5),
+
+        /* if ((entry->access & request.access) != request.access) goto next_lookup.  */
+        BPF_LDX_MEM (BPF_W, BPF_REG_1, BPF_REG_0, 0),
+        BPF_ALU32_REG (BPF_AND, BPF_REG_1, BPF_REG_6),
+        BPF_JMP_REG (BPF_JNE, BPF_REG_1, BPF_REG_6, 2),
+
+        BPF_MOV64_IMM (BPF_REG_0, 1),
+        BPF_EXIT_INSN (),
+      };
+
+      program = bpf_program_append (program, major_insn, sizeof (major_insn));
+      program = bpf_program_append (program, minor_insn, sizeof (minor_insn));
+      program = bpf_program_append (program, lookup_insn, sizeof (lookup_insn));
+    }
+
+  return bpf_program_append (program, post_insn, sizeof (post_insn));
+}
+
+static int
+dev_map_contains (struct bpf_dev_map *map, const struct bpf_dev_map_key *key)
+{
+  size_t i;
+
+  for (i = 0; i < map->used; i++)
+    if (memcmp (&map->entries[i].key, key, sizeof (*key)) == 0)
+      return 1;
+  return 0;
+}
+
+static int
+dev_map_fill (int map_fd, struct bpf_dev_map *map, libcrun_error_t *err)
+{
+  union bpf_attr attr;
+  size_t i;
+  int ret;
+
+  for (i = 0; i < map->used; i++)
+    {
+      memset (&attr, 0, sizeof (attr));
+      attr.map_fd = map_fd;
+      attr.key = (uint64_t) &map->entries[i].key;
+      attr.value = (uint64_t) &map->entries[i].access;
+      attr.flags = BPF_ANY;
+
+      ret = bpf (BPF_MAP_UPDATE_ELEM, &attr, sizeof (attr));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "bpf map update");
+    }
+  return 0;
+}
+
+/* Find the devices map used by the program attached to the cgroup DIRFD,
+   if it was generated by bpf_dev_map_program.  Its capacity is stored in
+   *MAX_ENTRIES.  *MAP_FD is set to -1 if there is no such map.  */
+static int
+find_dev_map (int dirfd, int *map_fd, size_t *max_entries, libcrun_error_t *err)
+{
+  cleanup_free uint32_t *progs = NULL;
+  cleanup_close int prog_fd = -1;
+  cleanup_close int fd = -1;
+  struct bpf_prog_info prog_info;
+  struct bpf_map_info map_info;
+  union bpf_attr attr;
+  uint32_t map_ids[2];
+  size_t n_progs = 0;
+  int ret;
+
+  *map_fd = -1;
+
+  ret = read_all_progs (dirfd, &progs, &n_progs, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (n_progs != 1)
+    return 0;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.prog_id = progs[0];
+  prog_fd = bpf (BPF_PROG_GET_FD_BY_ID, &attr, sizeof (attr));
+  if (UNLIKELY (prog_fd < 0))
+    return 0;
+
+  memset (&prog_info, 0, sizeof (prog_info));
+  prog_info.nr_map_ids = 2;
+  prog_info.map_ids = (uint64_t) map_ids;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.info.bpf_fd = prog_fd;
+  attr.info.info_len = sizeof (prog_info);
+  attr.info.info = (uint64_t) &prog_info;
+  ret = bpf (BPF_OBJ_GET_INFO_BY_FD, &attr, sizeof (attr));
+  if (UNLIKELY (ret < 0) || prog_info.nr_map_ids != 1)
+    return 0;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.map_id = map_ids[0];
+  fd = bpf (BPF_MAP_GET_FD_BY_ID, &attr, sizeof (attr));
+  if (UNLIKELY (fd < 0))
+    return 0;
+
+  memset (&map_info, 0, sizeof (map_info));
+  memset (&attr, 0, sizeof (attr));
+  attr.info.bpf_fd = fd;
+  attr.info.info_len = sizeof (map_info);
+  attr.info.info = (uint64_t) &map_info;
+  ret = bpf (BPF_OBJ_GET_INFO_BY_FD, &attr, sizeof (attr));
+  if (UNLIKELY (ret < 0))
+    return 0;
+
+  if (map_info.type != BPF_MAP_TYPE_HASH || map_info.key_size != sizeof (struct bpf_dev_map_key)
+      || map_info.value_size != sizeof (uint32_t) || strcmp (map_info.name, DEV_MAP_NAME) != 0)
+    return 0;
+
+  *max_entries = map_info.max_entries;
+  *map_fd = fd;
+  fd = -1;
+  return 0;
+}
+
+/* Replace the content of the map MAP_FD, that can hold MAX_ENTRIES, with
+   MAP.  The new entries are added before the old ones are removed, each
+   entry is replaced atomically and no request is denied while the map is
+   updated.  For this reason, the map must have room for both the old and
+   the new entries at the same time.  Returns 0 if it has not, and the map
+   is left unchanged, or 1 if the map was updated.  */
+static int
+dev_map_update (int map_fd, size_t max_entries, struct bpf_dev_map *map, libcrun_error_t *err)
+{
+  cleanup_free struct bpf_dev_map_key *stale = NULL;
+  struct bpf_dev_map_key key, next_key;
+  size_t n_stale = 0, allocated = 0;
+  union bpf_attr attr;
+  bool first = true;
+  size_t i;
+  int ret;
+
+  for (;;)
+    {
+      memset (&attr, 0, sizeof (attr));
+      attr.map_fd = map_fd;
+      attr.key = first ? 0 : (uint64_t) &key;
+      attr.next_key = (uint64_t) &next_key;
+
+      ret = bpf (BPF_MAP_GET_NEXT_KEY, &attr, sizeof (attr));
+      if (ret < 0)
+        {
+          if (errno == ENOENT)
+            break;
+          return crun_make_error (err, errno, "bpf map get next key");
+        }
+
+      first = false;
+      key = next_key;
+
+      if (dev_map_contains (map, &key))
+        continue;
+
+      if (n_stale == allocated)
+        {
+          allocated = allocated ? allocated * 2 : 16;
+          stale = xrealloc (stale, sizeof (*stale) * allocated);
+        }
+      stale[n_stale++] = key;
+    }
+
+  if (map->used + n_stale > max_entries)
+    return 0;
+
+  ret = dev_map_fill (map_fd, map, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  for (i = 0; i < n_stale; i++)
+    {
+      memset (&attr, 0, sizeof (attr));
+      attr.map_fd = map_fd;
+      attr.key = (uint64_t) &stale[i];
+
+      ret = bpf (BPF_MAP_DELETE_ELEM, &attr, sizeof (attr));
+      if (UNLIKELY (ret < 0 && errno != ENOENT))
+        return crun_make_error (err, errno, "bpf map delete");
+    }
+
+  return 1;
+}
+#endif
+
+/* Install the device rules in MAP for the cgroup DIRFD.  If the program
+   already attached to the cgroup uses a devices map, the map is updated
+   in place and no new program goes through the verifier.  */
+int
+libcrun_ebpf_load_dev_map (struct bpf_dev_map *map, int dirfd, libcrun_error_t *err)
+{
+#ifndef HAVE_EBPF
+  (void) map;
+  (void) dirfd;
+
+  return crun_make_error (err, 0, "eBPF not supported");
+#else
+  cleanup_free struct bpf_program *program = NULL;
+  cleanup_close int map_fd = -1;
+  cleanup_close int fd = -1;
+  size_t max_entries = 0;
+  union bpf_attr attr;
+  int ret;
+
+  ret = find_dev_map (dirfd, &map_fd, &max_entries, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (map_fd >= 0)
+    {
+      ret = dev_map_update (map_fd, max_entries, map, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      if (ret > 0)
+        return 0;
+
+      /* The map is too small, replace the program with a new one.  */
+      close_and_reset (&map_fd);
+    }
+
+  memset (&attr, 0, sizeof (attr));
+  attr.map_type = BPF_MAP_TYPE_HASH;
+  attr.key_size = sizeof (struct bpf_dev_map_key);
+  attr.value_size = sizeof (uint32_t);
+  /* Leave room for the rules added by a later update.  */
+  attr.max_entries = map->used * 2 > DEV_MAP_MIN_ENTRIES ? map->used * 2 : DEV_MAP_MIN_ENTRIES;
+  strcpy (attr.map_name, DEV_MAP_NAME);
+
+  map_fd = ebpf_retry_with_memlock (BPF_MAP_CREATE, &attr);
+  if (UNLIKELY (map_fd < 0))
+    return crun_make_error (err, errno, "bpf map create");
+
+  ret = dev_map_fill (map_fd, map, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  program = bpf_dev_map_program (map_fd);
+
+  fd = ebpf_load_program (program, err);
+  if (UNLIKELY (fd < 0))
+    return fd;
+
+  return ebpf_attach_program (fd, dirfd, err);
+#endif
+}
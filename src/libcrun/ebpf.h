@@ -38,5 +38,13 @@ struct bpf_program *bpf_program_append_dev (struct bpf_program *program, const c
 struct bpf_program *bpf_program_complete_dev (struct bpf_program *program, libcrun_error_t *err);
 
 int libcrun_ebpf_load (struct bpf_program *program, int dirfd, const char *pin, libcrun_error_t *err);
+void libcrun_ebpf_release_cgroup (const char *cgroup_path);
+
+struct bpf_dev_map;
+
+struct bpf_dev_map *bpf_dev_map_new (void);
+int bpf_dev_map_add (struct bpf_dev_map **map, const char *access, char type, int major, int minor);
+
+int libcrun_ebpf_load_dev_map (struct bpf_dev_map *map, int dirfd, libcrun_error_t *err);
 
 #endif
@@ -33,8 +33,6 @@
 #  include <systemd/sd-journal.h>
 #endif
 
-#define YAJL_STR(x) ((const unsigned char *) (x))
-
 enum
 {
   LOG_FORMAT_TEXT = 0,
@@ -241,6 +239,21 @@ libcrun_init_logging (crun_output_handler *new_output_handler, void **new_output
   return 0;
 }
 
+/* Do not call isatty for each message, the log stream rarely changes.  */
+static bool
+stream_is_tty (FILE *stream)
+{
+  static FILE *cached_stream;
+  static bool cached_is_tty;
+
+  if (stream != cached_stream)
+    {
+      cached_is_tty = isatty (fileno (stream));
+      cached_stream = stream;
+    }
+  return cached_is_tty;
+}
+
 void
 log_write_to_stream (int errno_, const char *msg, bool warning, void *arg)
 {
@@ -248,7 +261,7 @@ log_write_to_stream (int errno_, const char *msg, bool warning, void *arg)
     0,
   };
   FILE *stream = arg;
-  int tty = isatty (fileno (stream));
+  bool tty = stream_is_tty (stream);
   const char *color_begin = "";
   const char *color_end = "";
 
@@ -265,6 +278,10 @@ log_write_to_stream (int errno_, const char *msg, bool warning, void *arg)
     fprintf (stream, "%s%s%s: %s%s\n", color_begin, timestamp, msg, strerror (errno_), color_end);
   else
     fprintf (stream, "%s%s%s%s\n", color_begin, timestamp, msg, color_end);
+
+  /* Write each message immediately, so that nothing is left in the stream
+     buffer to be duplicated by a fork or lost by _exit.  */
+  fflush (stream);
 }
 
 void
@@ -321,68 +338,145 @@ crun_set_output_handler (crun_output_handler handler, void *arg, bool log_to_std
   log_also_to_stderr = log_to_stderr;
 }
 
-static char *
-make_json_error (const char *msg, int errno_, bool warning)
+/* Buffer used to format a log line.  It starts on the stack and moves to
+   the heap only for lines that do not fit.  */
+struct log_buffer_s
 {
-  const char *level = warning ? "warning" : "error";
-  const unsigned char *buf = NULL;
-  yajl_gen gen = NULL;
-  char *ret = NULL;
-  size_t buf_len;
-  timestamp_t timestamp = {
-    0,
-  };
+  char *data;
+  size_t len;
+  size_t size;
+  bool allocated;
+};
+
+static void
+log_buffer_append (struct log_buffer_s *b, const char *data, size_t len)
+{
+  if (b->len + len + 1 > b->size)
+    {
+      size_t new_size = (b->len + len + 1) * 2;
 
-  gen = yajl_gen_alloc (NULL);
-  if (gen == NULL)
-    return NULL;
+      if (b->allocated)
+        b->data = xrealloc (b->data, new_size);
+      else
+        {
+          char *data = xmalloc (new_size);
 
-  get_timestamp (&timestamp, "");
+          memcpy (data, b->data, b->len);
+          b->data = data;
+          b->allocated = true;
+        }
+      b->size = new_size;
+    }
 
-  yajl_gen_map_open (gen);
+  memcpy (b->data + b->len, data, len);
+  b->len += len;
+  b->data[b->len] = '\0';
+}
 
-  yajl_gen_string (gen, YAJL_STR ("msg"), strlen ("msg"));
-  if (errno_ == 0)
-    yajl_gen_string (gen, YAJL_STR (msg), strlen (msg));
-  else
+static void
+log_buffer_append_json_escaped (struct log_buffer_s *b, const char *str)
+{
+  const char *run = str;
+  const char *it;
+
+  for (it = str; *it; it++)
     {
-      cleanup_free char *tmp = NULL;
+      unsigned char c = *it;
+      char escaped[8];
 
-      xasprintf (&tmp, "%s: %s", msg, strerror (errno_));
-      yajl_gen_string (gen, YAJL_STR (tmp), strlen (tmp));
-    }
+      if (c >= 0x20 && c != '"' && c != '\\')
+        continue;
 
-  yajl_gen_string (gen, YAJL_STR ("level"), strlen ("level"));
-  yajl_gen_string (gen, YAJL_STR (level), strlen (level));
+      log_buffer_append (b, run, it - run);
+      run = it + 1;
 
-  yajl_gen_string (gen, YAJL_STR ("time"), strlen ("time"));
-  yajl_gen_string (gen, YAJL_STR (timestamp), strlen (timestamp));
+      switch (c)
+        {
+        case '"':
+          log_buffer_append (b, "\\\"", 2);
+          break;
+
+        case '\\':
+          log_buffer_append (b, "\\\\", 2);
+          break;
 
-  yajl_gen_map_close (gen);
+        case '\n':
+          log_buffer_append (b, "\\n", 2);
+          break;
 
-  yajl_gen_get_buf (gen, &buf, &buf_len);
-  if (buf)
-    ret = strdup ((const char *) buf);
+        case '\r':
+          log_buffer_append (b, "\\r", 2);
+          break;
 
-  yajl_gen_free (gen);
+        case '\t':
+          log_buffer_append (b, "\\t", 2);
+          break;
 
-  return ret;
+        default:
+          snprintf (escaped, sizeof (escaped), "\\u%04x", c);
+          log_buffer_append (b, escaped, 6);
+          break;
+        }
+    }
+  log_buffer_append (b, run, it - run);
 }
 
+/* Encode the message directly, without a yajl generator, so that no memory
+   is allocated for the usual short messages.  */
+static void
+make_json_error (struct log_buffer_s *b, const char *msg, int errno_, bool warning)
+{
+  const char *level = warning ? "warning" : "error";
+  timestamp_t timestamp = {
+    0,
+  };
+
+  get_timestamp (&timestamp, "");
+
+  log_buffer_append (b, "{\"msg\":\"", 8);
+  log_buffer_append_json_escaped (b, msg);
+  if (errno_)
+    {
+      log_buffer_append (b, ": ", 2);
+      log_buffer_append_json_escaped (b, strerror (errno_));
+    }
+  log_buffer_append (b, "\",\"level\":\"", 11);
+  log_buffer_append (b, level, strlen (level));
+  log_buffer_append (b, "\",\"time\":\"", 10);
+  log_buffer_append (b, timestamp, strlen (timestamp));
+  log_buffer_append (b, "\"}", 2);
+}
+
+#define LOG_BUFFER_SIZE 1024
+
 static void
 write_log (int errno_, bool warning, const char *msg, va_list args_list)
 {
+  char output_buffer[LOG_BUFFER_SIZE];
+  char json_buffer[LOG_BUFFER_SIZE];
+  cleanup_free char *allocated = NULL;
+  const char *output = output_buffer;
+  va_list args_copy;
   int ret;
-  cleanup_free char *output = NULL;
-  cleanup_free char *json = NULL;
 
   if (warning && output_verbosity < LIBCRUN_VERBOSITY_WARNING)
     return;
 
-  ret = vasprintf (&output, msg, args_list);
+  /* Most messages fit in the buffer on the stack.  */
+  va_copy (args_copy, args_list);
+  ret = vsnprintf (output_buffer, sizeof (output_buffer), msg, args_copy);
+  va_end (args_copy);
   if (UNLIKELY (ret < 0))
     OOM ();
 
+  if ((size_t) ret >= sizeof (output_buffer))
+    {
+      ret = vasprintf (&allocated, msg, args_list);
+      if (UNLIKELY (ret < 0))
+        OOM ();
+      output = allocated;
+    }
+
   if (log_also_to_stderr)
     log_write_to_stderr (errno_, output, warning, NULL);
 
@@ -393,11 +487,19 @@ write_log (int errno_, bool warning, const char *msg, va_list args_list)
       break;
 
     case LOG_FORMAT_JSON:
-      json = make_json_error (output, errno_, warning);
-      if (json)
-        output_handler (0, json, warning, output_handler_arg);
-      else
-        output_handler (errno_, output, warning, output_handler_arg);
+      {
+        struct log_buffer_s json = {
+          .data = json_buffer,
+          .len = 0,
+          .size = sizeof (json_buffer),
+          .allocated = false,
+        };
+
+        make_json_error (&json, output, errno_, warning);
+        output_handler (0, json.data, warning, output_handler_arg);
+        if (json.allocated)
+          free (json.data);
+      }
       break;
     }
 }
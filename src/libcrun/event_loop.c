@@ -0,0 +1,233 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <config.h>
+#include "event_loop.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define EVENT_LOOP_MAX_EVENTS 16
+
+struct event_handler_s
+{
+  struct event_handler_s *next;
+  libcrun_event_loop_cb cb;
+  void *arg;
+  int fd;
+  bool owned;
+  bool timer;
+  bool removed;
+};
+
+struct libcrun_event_loop_s
+{
+  int epollfd;
+  struct event_handler_s *handlers;
+  bool stopped;
+  int exit_code;
+};
+
+int
+libcrun_event_loop_new (libcrun_event_loop_t **out, libcrun_error_t *err)
+{
+  libcrun_event_loop_t *loop;
+  int epollfd;
+
+  epollfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (UNLIKELY (epollfd < 0))
+    return crun_make_error (err, errno, "epoll_create1");
+
+  loop = xmalloc0 (sizeof (*loop));
+  loop->epollfd = epollfd;
+  *out = loop;
+  return 0;
+}
+
+void
+libcrun_event_loop_free (libcrun_event_loop_t *loop)
+{
+  struct event_handler_s *it, *next;
+
+  if (loop == NULL)
+    return;
+
+  for (it = loop->handlers; it; it = next)
+    {
+      next = it->next;
+      if (it->owned && it->fd >= 0)
+        close (it->fd);
+      free (it);
+    }
+  close (loop->epollfd);
+  free (loop);
+}
+
+static int
+event_loop_add_handler (libcrun_event_loop_t *loop, int fd, bool edge_triggered, bool owned,
+                        libcrun_event_loop_cb cb, void *arg, libcrun_error_t *err)
+{
+  struct event_handler_s *handler;
+  struct epoll_event ev;
+  int ret;
+
+  handler = xmalloc0 (sizeof (*handler));
+  handler->cb = cb;
+  handler->arg = arg;
+  handler->fd = fd;
+  handler->owned = owned;
+
+  ev.events = EPOLLIN | (edge_triggered ? EPOLLET : 0);
+  ev.data.ptr = handler;
+  ret = epoll_ctl (loop->epollfd, EPOLL_CTL_ADD, fd, &ev);
+  if (UNLIKELY (ret < 0))
+    {
+      free (handler);
+      return crun_make_error (err, errno, "epoll_ctl add '%d'", fd);
+    }
+
+  handler->next = loop->handlers;
+  loop->handlers = handler;
+  return 0;
+}
+
+int
+libcrun_event_loop_add (libcrun_event_loop_t *loop, int fd, bool edge_triggered, libcrun_event_loop_cb cb, void *arg,
+                        libcrun_error_t *err)
+{
+  return event_loop_add_handler (loop, fd, edge_triggered, false, cb, arg, err);
+}
+
+int
+libcrun_event_loop_remove (libcrun_event_loop_t *loop, int fd, libcrun_error_t *err)
+{
+  struct event_handler_s *it;
+  int ret;
+
+  for (it = loop->handlers; it; it = it->next)
+    {
+      if (it->removed || it->fd != fd)
+        continue;
+
+      ret = epoll_ctl (loop->epollfd, EPOLL_CTL_DEL, fd, NULL);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "epoll_ctl del '%d'", fd);
+
+      /* The handler is released with the loop, as there might be pending
+         events for it in the current epoll_wait batch.  */
+      it->removed = true;
+      if (it->owned)
+        close_and_reset (&it->fd);
+      return 0;
+    }
+
+  return crun_make_error (err, ENOENT, "fd '%d' not registered", fd);
+}
+
+int
+libcrun_event_loop_add_timer (libcrun_event_loop_t *loop, int interval_ms, bool repeat, libcrun_event_loop_cb cb,
+                              void *arg, libcrun_error_t *err)
+{
+  struct itimerspec spec = {};
+  int fd;
+  int ret;
+
+  fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "timerfd_create");
+
+  spec.it_value.tv_sec = interval_ms / 1000;
+  spec.it_value.tv_nsec = (interval_ms % 1000) * 1000000L;
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+    spec.it_value.tv_nsec = 1;
+  if (repeat)
+    spec.it_interval = spec.it_value;
+
+  ret = timerfd_settime (fd, 0, &spec, NULL);
+  if (UNLIKELY (ret < 0))
+    {
+      ret = crun_make_error (err, errno, "timerfd_settime");
+      close (fd);
+      return ret;
+    }
+
+  ret = event_loop_add_handler (loop, fd, false, true, cb, arg, err);
+  if (UNLIKELY (ret < 0))
+    {
+      close (fd);
+      return ret;
+    }
+
+  loop->handlers->timer = true;
+  return fd;
+}
+
+void
+libcrun_event_loop_stop (libcrun_event_loop_t *loop, int exit_code)
+{
+  loop->stopped = true;
+  loop->exit_code = exit_code;
+}
+
+int
+libcrun_event_loop_run (libcrun_event_loop_t *loop, libcrun_error_t *err)
+{
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  int i, nr_events;
+  int ret;
+
+  while (! loop->stopped)
+    {
+      nr_events = TEMP_FAILURE_RETRY (epoll_wait (loop->epollfd, events, EVENT_LOOP_MAX_EVENTS, -1));
+      if (UNLIKELY (nr_events < 0))
+        return crun_make_error (err, errno, "epoll_wait");
+
+      for (i = 0; i < nr_events && ! loop->stopped; i++)
+        {
+          struct event_handler_s *handler = events[i].data.ptr;
+
+          if (handler->removed)
+            continue;
+
+          /* Consume the timer expirations before running the callback.  */
+          if (handler->timer)
+            {
+              uint64_t expirations;
+              ssize_t r;
+
+              r = TEMP_FAILURE_RETRY (read (handler->fd, &expirations, sizeof (expirations)));
+              if (UNLIKELY (r < 0))
+                {
+                  if (errno == EAGAIN)
+                    continue;
+                  return crun_make_error (err, errno, "read from timerfd");
+                }
+            }
+
+          ret = handler->cb (loop, handler->fd, handler->arg, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+        }
+    }
+
+  return loop->exit_code;
+}
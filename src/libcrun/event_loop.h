@@ -0,0 +1,65 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <config.h>
+#include <stdbool.h>
+#include "error.h"
+
+/* A small epoll based event loop.  Each registered fd has its own
+   callback, so that new sources of events can be added to a monitor
+   process without changing the loop itself.  */
+typedef struct libcrun_event_loop_s libcrun_event_loop_t;
+
+/* Called when FD is readable.  A negative return value stops the loop
+   with an error.  */
+typedef int (*libcrun_event_loop_cb) (libcrun_event_loop_t *loop, int fd, void *arg, libcrun_error_t *err);
+
+LIBCRUN_PUBLIC int libcrun_event_loop_new (libcrun_event_loop_t **loop, libcrun_error_t *err);
+LIBCRUN_PUBLIC void libcrun_event_loop_free (libcrun_event_loop_t *loop);
+
+/* Watch FD for input.  With EDGE_TRIGGERED the callback is invoked only
+   when new data arrives.  The fd is not owned by the loop.  */
+LIBCRUN_PUBLIC int libcrun_event_loop_add (libcrun_event_loop_t *loop, int fd, bool edge_triggered,
+                                           libcrun_event_loop_cb cb, void *arg, libcrun_error_t *err);
+LIBCRUN_PUBLIC int libcrun_event_loop_remove (libcrun_event_loop_t *loop, int fd, libcrun_error_t *err);
+
+/* Invoke CB every INTERVAL_MS milliseconds, or only once if REPEAT is
+   false.  The timer fd is owned by the loop and is returned on success,
+   so that it can be passed to libcrun_event_loop_remove.  */
+LIBCRUN_PUBLIC int libcrun_event_loop_add_timer (libcrun_event_loop_t *loop, int interval_ms, bool repeat,
+                                                 libcrun_event_loop_cb cb, void *arg, libcrun_error_t *err);
+
+/* Make libcrun_event_loop_run return EXIT_CODE once the current
+   callback completes.  */
+LIBCRUN_PUBLIC void libcrun_event_loop_stop (libcrun_event_loop_t *loop, int exit_code);
+
+/* Dispatch the events until libcrun_event_loop_stop is called or a
+   callback fails.  It returns the exit code passed to
+   libcrun_event_loop_stop, or a negative value on errors.  */
+LIBCRUN_PUBLIC int libcrun_event_loop_run (libcrun_event_loop_t *loop, libcrun_error_t *err);
+
+static inline void
+cleanup_event_loopp (libcrun_event_loop_t **loop)
+{
+  libcrun_event_loop_free (*loop);
+}
+#define cleanup_event_loop __attribute__ ((cleanup (cleanup_event_loopp)))
+
+#endif
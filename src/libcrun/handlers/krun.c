@@ -0,0 +1,162 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <config.h>
+#include "../custom-handler.h"
+#include "../container.h"
+#include "../utils.h"
+#include "../linux.h"
+#include <sched.h>
+#include <unistd.h>
+#include <error.h>
+
+#ifdef HAVE_DLOPEN
+#  include <dlfcn.h>
+#endif
+
+#ifdef HAVE_LIBKRUN
+#  include <libkrun.h>
+#endif
+
+#if HAVE_DLOPEN && HAVE_LIBKRUN
+/* The libkrun symbols are resolved and the context is created while the
+   container is set up, the VM is configured and booted by the exec
+   function.  */
+struct krun_config_s
+{
+  void *handle;
+  int32_t ctx_id;
+  int (*krun_start_enter) (uint32_t ctx_id);
+  int32_t (*krun_set_vm_config) (uint32_t ctx_id, uint8_t num_vcpus, uint32_t ram_mib);
+  int32_t (*krun_set_workdir) (uint32_t ctx_id, const char *workdir_path);
+  int32_t (*krun_set_exec) (uint32_t ctx_id, const char *exec_path, char *const argv[], char *const envp[]);
+};
+
+static int
+libkrun_exec (void *container, void *cookie, const char *pathname, char *const argv[])
+{
+  runtime_spec_schema_config_schema *def = ((libcrun_container_t *) container)->container_def;
+  struct krun_config_s *kconf = cookie;
+  uint32_t num_vcpus, ram_mib;
+  cpu_set_t set;
+  int32_t ret;
+
+  /* If sched_getaffinity fails, default to 1 vcpu.  */
+  num_vcpus = 1;
+  /* If no memory limit is specified, default to 2G.  */
+  ram_mib = 2 * 1024;
+
+  if (def && def->linux && def->linux->resources && def->linux->resources->memory
+      && def->linux->resources->memory->limit_present)
+    ram_mib = def->linux->resources->memory->limit / (1024 * 1024);
+
+  /* The affinity is read here, once the process is in the final cgroup.  */
+  CPU_ZERO (&set);
+  if (sched_getaffinity (getpid (), sizeof (set), &set) == 0)
+    num_vcpus = CPU_COUNT (&set);
+
+  ret = kconf->krun_set_vm_config (kconf->ctx_id, num_vcpus, ram_mib);
+  if (UNLIKELY (ret < 0))
+    error (EXIT_FAILURE, -ret, "could not set krun vm configuration");
+
+  if (kconf->krun_set_workdir && def && def->process && def->process->cwd)
+    {
+      ret = kconf->krun_set_workdir (kconf->ctx_id, def->process->cwd);
+      if (UNLIKELY (ret < 0))
+        error (EXIT_FAILURE, -ret, "could not set krun working directory");
+    }
+
+  ret = kconf->krun_set_exec (kconf->ctx_id, pathname, &argv[1], NULL);
+  if (UNLIKELY (ret < 0))
+    error (EXIT_FAILURE, -ret, "could not set krun executable");
+
+  return kconf->krun_start_enter (kconf->ctx_id);
+}
+
+static int
+libkrun_load (void **cookie, libcrun_error_t *err)
+{
+  int32_t (*krun_create_ctx) ();
+  int32_t (*krun_set_root) (uint32_t ctx_id, const char *root_path);
+  struct krun_config_s *kconf;
+  void *handle;
+  int32_t ret;
+
+  handle = dlopen ("libkrun.so", RTLD_NOW);
+  if (handle == NULL)
+    return crun_make_error (err, 0, "could not load `libkrun.so`: %s", dlerror ());
+
+  kconf = xmalloc0 (sizeof (*kconf));
+  kconf->handle = handle;
+  krun_create_ctx = dlsym (handle, "krun_create_ctx");
+  krun_set_root = dlsym (handle, "krun_set_root");
+  kconf->krun_start_enter = dlsym (handle, "krun_start_enter");
+  kconf->krun_set_vm_config = dlsym (handle, "krun_set_vm_config");
+  kconf->krun_set_workdir = dlsym (handle, "krun_set_workdir");
+  kconf->krun_set_exec = dlsym (handle, "krun_set_exec");
+  if (krun_create_ctx == NULL || krun_set_root == NULL || kconf->krun_start_enter == NULL
+      || kconf->krun_set_vm_config == NULL || kconf->krun_set_exec == NULL)
+    {
+      free (kconf);
+      dlclose (handle);
+      return crun_make_error (err, 0, "could not find symbol in `libkrun.so`");
+    }
+
+  /* The root is the container rootfs once pivot_root is done.  */
+  kconf->ctx_id = krun_create_ctx ();
+  if (UNLIKELY (kconf->ctx_id < 0))
+    {
+      ret = kconf->ctx_id;
+      free (kconf);
+      dlclose (handle);
+      return crun_make_error (err, -ret, "could not create krun context");
+    }
+
+  ret = krun_set_root (kconf->ctx_id, "/");
+  if (UNLIKELY (ret < 0))
+    {
+      free (kconf);
+      dlclose (handle);
+      return crun_make_error (err, -ret, "could not set krun root");
+    }
+
+  *cookie = kconf;
+  return 0;
+}
+
+static int
+libkrun_configure_container (void *cookie arg_unused, enum handler_configure_phase phase,
+                             libcrun_container_t *container, libcrun_error_t *err)
+{
+  /* The VM needs access to /dev/kvm.  */
+  if (phase == HANDLER_CONFIGURE_AFTER_MOUNTS)
+    return libcrun_create_kvm_device (container, err);
+
+  return 0;
+}
+
+struct custom_handler_s handler_libkrun = {
+  .name = "krun",
+  .feature_string = "LIBKRUN",
+  .load = libkrun_load,
+  .exec_func = libkrun_exec,
+  .configure_container = libkrun_configure_container,
+};
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <config.h>
+#include "../custom-handler.h"
+#include "../container.h"
+#include "../utils.h"
+#include <unistd.h>
+#include <error.h>
+
+#ifdef HAVE_DLOPEN
+#  include <dlfcn.h>
+#endif
+
+#ifdef HAVE_WASMEDGE
+#  include <wasmedge/wasmedge.h>
+#endif
+
+#if HAVE_DLOPEN && HAVE_WASMEDGE
+
+/* Run the WebAssembly module in process.args[0] with WasmEdge, directly in
+   the container init process.  The module sees the container rootfs as its
+   root directory through WASI.  */
+
+struct wasmedge_s
+{
+  void *handle;
+  WasmEdge_ConfigureContext *(*configure_create) (void);
+  void (*configure_add_host_registration) (WasmEdge_ConfigureContext *cxt, enum WasmEdge_HostRegistration host);
+  WasmEdge_VMContext *(*vm_create) (const WasmEdge_ConfigureContext *conf_cxt, WasmEdge_StoreContext *store_cxt);
+  WasmEdge_ImportObjectContext *(*vm_get_import_module_context) (WasmEdge_VMContext *cxt,
+                                                                 const enum WasmEdge_HostRegistration reg);
+  void (*import_object_init_wasi) (WasmEdge_ImportObjectContext *cxt, const char *const *args, const uint32_t arg_len,
+                                   const char *const *envs, const uint32_t env_len, const char *const *dirs,
+                                   const uint32_t dir_len, const char *const *preopens, const uint32_t preopen_len);
+  uint32_t (*import_object_wasi_get_exit_code) (WasmEdge_ImportObjectContext *cxt);
+  WasmEdge_Result (*vm_run_wasm_from_file) (WasmEdge_VMContext *cxt, const char *path, const WasmEdge_String func_name,
+                                            const WasmEdge_Value *params, const uint32_t param_len,
+                                            WasmEdge_Value *returns, const uint32_t return_len);
+  WasmEdge_String (*string_create_by_cstring) (const char *str);
+  bool (*result_ok) (const WasmEdge_Result res);
+  const char *(*result_get_message) (const WasmEdge_Result res);
+};
+
+static int
+wasmedge_exec (void *container arg_unused, void *cookie, const char *pathname, char *const argv[])
+{
+  struct wasmedge_s *w = cookie;
+  const char *dirs[] = { "/:/" };
+  WasmEdge_ImportObjectContext *wasi;
+  WasmEdge_ConfigureContext *conf;
+  WasmEdge_VMContext *vm;
+  WasmEdge_Result result;
+  size_t argc, envc;
+
+  for (argc = 0; argv[argc]; argc++)
+    ;
+  for (envc = 0; environ[envc]; envc++)
+    ;
+
+  conf = w->configure_create ();
+  if (UNLIKELY (conf == NULL))
+    error (EXIT_FAILURE, 0, "could not create wasmedge configuration");
+
+  w->configure_add_host_registration (conf, WasmEdge_HostRegistration_Wasi);
+
+  vm = w->vm_create (conf, NULL);
+  if (UNLIKELY (vm == NULL))
+    error (EXIT_FAILURE, 0, "could not create wasmedge vm");
+
+  wasi = w->vm_get_import_module_context (vm, WasmEdge_HostRegistration_Wasi);
+  if (UNLIKELY (wasi == NULL))
+    error (EXIT_FAILURE, 0, "could not get the wasmedge wasi module");
+
+  w->import_object_init_wasi (wasi, (const char *const *) argv, argc, (const char *const *) environ, envc, dirs, 1,
+                              NULL, 0);
+
+  result = w->vm_run_wasm_from_file (vm, pathname, w->string_create_by_cstring ("_start"), NULL, 0, NULL, 0);
+  if (UNLIKELY (! w->result_ok (result)))
+    error (EXIT_FAILURE, 0, "could not run `%s`: %s", pathname, w->result_get_message (result));
+
+  exit (w->import_object_wasi_get_exit_code (wasi));
+}
+
+static int
+wasmedge_load (void **cookie, libcrun_error_t *err)
+{
+  struct wasmedge_s *w;
+  void *handle;
+
+  handle = dlopen ("libwasmedge_c.so", RTLD_NOW);
+  if (handle == NULL)
+    return crun_make_error (err, 0, "could not load `libwasmedge_c.so`: %s", dlerror ());
+
+  w = xmalloc0 (sizeof (*w));
+  w->handle = handle;
+  w->configure_create = dlsym (handle, "WasmEdge_ConfigureCreate");
+  w->configure_add_host_registration = dlsym (handle, "WasmEdge_ConfigureAddHostRegistration");
+  w->vm_create = dlsym (handle, "WasmEdge_VMCreate");
+  w->vm_get_import_module_context = dlsym (handle, "WasmEdge_VMGetImportModuleContext");
+  w->import_object_init_wasi = dlsym (handle, "WasmEdge_ImportObjectInitWASI");
+  w->import_object_wasi_get_exit_code = dlsym (handle, "WasmEdge_ImportObjectWASIGetExitCode");
+  w->vm_run_wasm_from_file = dlsym (handle, "WasmEdge_VMRunWasmFromFile");
+  w->string_create_by_cstring = dlsym (handle, "WasmEdge_StringCreateByCString");
+  w->result_ok = dlsym (handle, "WasmEdge_ResultOK");
+  w->result_get_message = dlsym (handle, "WasmEdge_ResultGetMessage");
+  if (w->configure_create == NULL || w->configure_add_host_registration == NULL || w->vm_create == NULL
+      || w->vm_get_import_module_context == NULL || w->import_object_init_wasi == NULL
+      || w->import_object_wasi_get_exit_code == NULL || w->vm_run_wasm_from_file == NULL
+      || w->string_create_by_cstring == NULL || w->result_ok == NULL || w->result_get_message == NULL)
+    {
+      free (w);
+      dlclose (handle);
+      return crun_make_error (err, 0, "could not find symbol in `libwasmedge_c.so`");
+    }
+
+  *cookie = w;
+  return 0;
+}
+
+struct custom_handler_s handler_wasmedge = {
+  .name = "wasmedge",
+  .feature_string = "WASM:wasmedge",
+  .load = wasmedge_load,
+  .exec_func = wasmedge_exec,
+};
+
+#endif
@@ -0,0 +1,319 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <config.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_DLOPEN
+#  include <dlfcn.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
+#include "utils.h"
+#include "hook_plugin.h"
+
+/* A hook is run in process when its path is a shared object and the
+   plugins are enabled with the run.oci.hooks.plugins annotation.  */
+bool
+libcrun_hook_is_plugin (const char *path)
+{
+  size_t len = strlen (path);
+
+  return len > 3 && strcmp (path + len - 3, ".so") == 0;
+}
+
+#ifdef HAVE_DLOPEN
+static char **
+dup_strv (char **v)
+{
+  size_t i, len = 0;
+  char **ret;
+
+  if (v == NULL)
+    return NULL;
+
+  while (v[len])
+    len++;
+
+  ret = xmalloc ((len + 1) * sizeof (char *));
+  for (i = 0; i < len; i++)
+    ret[i] = xstrdup (v[i]);
+  ret[len] = NULL;
+  return ret;
+}
+
+static void
+free_strv (char **v)
+{
+  size_t i;
+
+  if (v == NULL)
+    return;
+
+  for (i = 0; v[i]; i++)
+    free (v[i]);
+  free (v);
+}
+
+/* How long to wait for a plugin to be cancelled once its timeout expired.  */
+#  define HOOK_PLUGIN_CANCEL_TIMEOUT 1
+
+/* A call to a plugin.  It owns a copy of the data passed to the plugin and
+   the plugin handle, as a call that cannot be cancelled in time is
+   abandoned while it still runs.  */
+struct hook_plugin_call_s
+{
+  void *handle;
+  run_oci_hook_run_cb run_cb;
+  struct run_oci_hook_state_s state;
+  char **args;
+  char **env;
+  int ret;
+
+#  ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool done;
+  bool abandoned;
+#  endif
+};
+
+static struct hook_plugin_call_s *
+make_call (void *handle, run_oci_hook_run_cb run_cb, struct run_oci_hook_state_s *state, char **args, char **env)
+{
+  struct hook_plugin_call_s *call = xmalloc0 (sizeof (*call));
+#  ifdef HAVE_PTHREAD
+  pthread_condattr_t attr;
+#  endif
+
+  call->handle = handle;
+  call->run_cb = run_cb;
+  call->state = *state;
+  call->state.id = state->id ? xstrdup (state->id) : NULL;
+  call->state.status = state->status ? xstrdup (state->status) : NULL;
+  call->state.bundle = state->bundle ? xstrdup (state->bundle) : NULL;
+  if (state->state)
+    {
+      char *copy = xmalloc (state->state_len + 1);
+
+      memcpy (copy, state->state, state->state_len);
+      copy[state->state_len] = '\0';
+      call->state.state = copy;
+    }
+  call->args = dup_strv (args);
+  call->env = dup_strv (env);
+#  ifdef HAVE_PTHREAD
+  pthread_mutex_init (&call->lock, NULL);
+  /* The deadlines must not move with the wall clock.  */
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&call->cond, &attr);
+  pthread_condattr_destroy (&attr);
+#  endif
+  return call;
+}
+
+/* Release CALL and unload its plugin.  */
+static void
+free_call (struct hook_plugin_call_s *call)
+{
+  free ((char *) call->state.id);
+  free ((char *) call->state.status);
+  free ((char *) call->state.bundle);
+  free ((char *) call->state.state);
+  free_strv (call->args);
+  free_strv (call->env);
+#  ifdef HAVE_PTHREAD
+  pthread_mutex_destroy (&call->lock);
+  pthread_cond_destroy (&call->cond);
+#  endif
+  dlclose (call->handle);
+  free (call);
+}
+
+#  ifdef HAVE_PTHREAD
+/* Called when the plugin returns or when its thread is cancelled.  */
+static void
+hook_plugin_thread_done (void *arg)
+{
+  struct hook_plugin_call_s *call = arg;
+  bool abandoned;
+
+  pthread_mutex_lock (&call->lock);
+  call->done = true;
+  abandoned = call->abandoned;
+  pthread_cond_signal (&call->cond);
+  pthread_mutex_unlock (&call->lock);
+
+  if (abandoned)
+    free_call (call);
+}
+
+static void *
+hook_plugin_thread (void *arg)
+{
+  struct hook_plugin_call_s *call = arg;
+
+  pthread_cleanup_push (hook_plugin_thread_done, call);
+  call->ret = call->run_cb (&call->state, sizeof (call->state), call->args, call->env);
+  pthread_cleanup_pop (1);
+  return NULL;
+}
+
+/* Wait until CALL is done or DEADLINE expires.  Returns true if it is done.
+   It must be called with the call lock held.  */
+static bool
+wait_call_until (struct hook_plugin_call_s *call, const struct timespec *deadline)
+{
+  while (! call->done)
+    {
+      if (pthread_cond_timedwait (&call->cond, &call->lock, deadline) == ETIMEDOUT)
+        break;
+    }
+  return call->done;
+}
+
+/* Run CALL in a thread and wait at most TIMEOUT seconds for it.  If it
+   expires, the thread is cancelled; a plugin that does not reach a
+   cancellation point in time is abandoned, and its thread releases CALL
+   once the plugin returns.  Returns 1 if the call completed, 0 if it timed
+   out and CALL was released.  */
+static int
+run_call_with_timeout (struct hook_plugin_call_s *call, int timeout, libcrun_error_t *err)
+{
+  struct timespec deadline;
+  pthread_t thread;
+  bool done;
+  int ret;
+
+  ret = pthread_create (&thread, NULL, hook_plugin_thread, call);
+  if (UNLIKELY (ret != 0))
+    return crun_make_error (err, ret, "pthread_create");
+
+  clock_gettime (CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout;
+
+  pthread_mutex_lock (&call->lock);
+  done = wait_call_until (call, &deadline);
+  pthread_mutex_unlock (&call->lock);
+
+  if (done)
+    {
+      pthread_join (thread, NULL);
+      return 1;
+    }
+
+  pthread_cancel (thread);
+
+  deadline.tv_sec += HOOK_PLUGIN_CANCEL_TIMEOUT;
+
+  pthread_mutex_lock (&call->lock);
+  done = wait_call_until (call, &deadline);
+  if (! done)
+    call->abandoned = true;
+  pthread_mutex_unlock (&call->lock);
+
+  if (done)
+    {
+      pthread_join (thread, NULL);
+      free_call (call);
+    }
+  else
+    {
+      libcrun_warning ("the hook plugin could not be cancelled, it keeps running");
+      pthread_detach (thread);
+    }
+
+  return 0;
+}
+#  endif
+#endif
+
+/* Run the hook plugin at PATH with the hook ARGS and ENV.  With a TIMEOUT,
+   the plugin runs in a worker thread, that is cancelled if the timeout
+   expires.  Returns 0 on success, a positive exit code if the hook failed,
+   a negative value on errors.  */
+int
+libcrun_run_hook_plugin (const char *path, char **args, char **env, int timeout,
+                         struct run_oci_hook_state_s *state, libcrun_error_t *err)
+{
+#ifdef HAVE_DLOPEN
+  struct hook_plugin_call_s *call;
+  run_oci_hook_version_cb version_cb;
+  run_oci_hook_run_cb run_cb;
+  void *handle;
+  int ret;
+
+  /* Do not accept relative paths, as for the seccomp notify plugins.  */
+  if (strchr (path, '/') && path[0] != '/')
+    return crun_make_error (err, 0, "invalid relative plugin path: `%s`", path);
+
+  handle = dlopen (path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL)
+    return crun_make_error (err, 0, "cannot load `%s`: %s", path, dlerror ());
+
+  version_cb = (run_oci_hook_version_cb) dlsym (handle, "run_oci_hook_version");
+  if (version_cb != NULL && version_cb () != 1)
+    {
+      dlclose (handle);
+      return crun_make_error (err, ENOTSUP, "invalid version supported by the plugin `%s`", path);
+    }
+
+  run_cb = (run_oci_hook_run_cb) dlsym (handle, "run_oci_hook_run");
+  if (run_cb == NULL)
+    {
+      dlclose (handle);
+      return crun_make_error (err, ENOTSUP, "plugin `%s` doesn't export `run_oci_hook_run`", path);
+    }
+
+  call = make_call (handle, run_cb, state, args, env);
+
+#  ifdef HAVE_PTHREAD
+  if (timeout > 0)
+    {
+      ret = run_call_with_timeout (call, timeout, err);
+      if (UNLIKELY (ret < 0))
+        {
+          free_call (call);
+          return ret;
+        }
+      if (ret == 0)
+        return crun_make_error (err, 0, "timeout expired for `%s`", path);
+    }
+  else
+#  endif
+    call->ret = run_cb (&call->state, sizeof (call->state), call->args, call->env);
+
+  ret = call->ret;
+  free_call (call);
+  return ret < 0 ? -ret : ret;
+#else
+  (void) path;
+  (void) args;
+  (void) env;
+  (void) timeout;
+  (void) state;
+  return crun_make_error (err, ENOTSUP, "hook plugins are not supported");
+#endif
+}
@@ -0,0 +1,31 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOOK_PLUGIN_H
+#define HOOK_PLUGIN_H
+
+#include <config.h>
+#include <stdbool.h>
+#include "error.h"
+#include "hook_plugin_api.h"
+
+bool libcrun_hook_is_plugin (const char *path);
+
+int libcrun_run_hook_plugin (const char *path, char **args, char **env, int timeout,
+                             struct run_oci_hook_state_s *state, libcrun_error_t *err);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOOK_PLUGIN_API_H
+#define HOOK_PLUGIN_API_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* The state of the container passed to a hook plugin.  It has the same
+   information the hook executables get on stdin.  */
+struct run_oci_hook_state_s
+{
+  const char *id;
+  /* "creating", "created", "running" or "stopped".  */
+  const char *status;
+  pid_t pid;
+  const char *bundle;
+  /* The state JSON, as it is written to the stdin of the hook executables.  */
+  const char *state;
+  size_t state_len;
+  /* Where the hook executables get their stdout and stderr, or -1.  */
+  int out_fd;
+  int err_fd;
+};
+
+/* Run the hook.  ARGS and ENV are the args and env of the hook in the
+   configuration, NULL terminated; ARGS can be NULL.  SIZE_STATE is
+   sizeof (struct run_oci_hook_state_s) in crun, new fields are
+   appended at the end.  It MUST be defined.  It returns 0 on success,
+   any other value is treated as the exit code of a failed hook.  If the
+   hook has a timeout, the function runs in a separate thread.  */
+typedef int (*run_oci_hook_run_cb) (struct run_oci_hook_state_s *state, size_t size_state, char **args,
+                                    char **env);
+
+/* Retrieve the API version used by the plugin.  It MUST return 1.  */
+typedef int (*run_oci_hook_version_cb) ();
+
+#endif
@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mount.h>
+#include <sys/file.h>
 #ifdef HAVE_FSCONFIG_CMD_CREATE
 #  include <linux/mount.h>
 #endif
@@ -45,10 +46,13 @@
 #include "cgroup.h"
 #include "status.h"
 #include "criu.h"
+#include "trace.h"
+#include "metrics.h"
 #include <sys/socket.h>
 #include <libgen.h>
 #include <sys/wait.h>
 #include <sys/vfs.h>
+#include <linux/magic.h>
 #include <limits.h>
 #include <inttypes.h>
 #include <sys/personality.h>
@@ -101,11 +105,18 @@ struct private_data_s
 
   const char *rootfs;
   int rootfsfd;
+  /* Valid only during libcrun_set_mounts.  */
+  struct crun_rootfs_resolver_s *resolver;
   int procfsfd;
   int mqueuefsfd;
   size_t rootfs_len;
   int notify_socket_tree_fd;
 
+  /* Idmapped mounts created by the parent process, indexed as the
+     mounts in the configuration.  */
+  int *idmapped_mounts_fds;
+  int idmapped_rootfs_fd;
+
   /* Used to save stdin, stdout, stderr during checkpointing to descriptors.json
    * and needed during restore. */
   char *external_descriptors;
@@ -129,6 +140,7 @@ get_private_data (struct libcrun_container_s *container)
       p->procfsfd = -1;
       p->mqueuefsfd = -1;
       p->notify_socket_tree_fd = -1;
+      p->idmapped_rootfs_fd = -1;
     }
   return container->private_data;
 }
@@ -262,6 +274,22 @@ syscall_open_tree (int dfd, const char *pathname, unsigned int flags)
 #endif
 }
 
+static int
+syscall_mount_setattr (int dfd, const char *path, unsigned int flags, void *attr, size_t size)
+{
+#if defined __NR_mount_setattr
+  return (int) syscall (__NR_mount_setattr, dfd, path, flags, attr, size);
+#else
+  (void) dfd;
+  (void) path;
+  (void) flags;
+  (void) attr;
+  (void) size;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 static int
 syscall_keyctl_join (const char *name)
 {
@@ -282,6 +310,48 @@ syscall_pidfd_open (pid_t pid, unsigned int flags)
 #endif
 }
 
+/* Layout of struct clone_args up to the cgroup field, not available
+   with older kernel headers.  */
+struct clone3_args_s
+{
+  uint64_t flags;
+  uint64_t pidfd;
+  uint64_t child_tid;
+  uint64_t parent_tid;
+  uint64_t exit_signal;
+  uint64_t stack;
+  uint64_t stack_size;
+  uint64_t tls;
+  uint64_t set_tid;
+  uint64_t set_tid_size;
+  uint64_t cgroup;
+};
+
+#ifndef CLONE_INTO_CGROUP
+#  define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+/* Like fork, but the child process is created with the namespaces in FLAGS
+   and directly in the cgroup CGROUP_FD.  */
+static pid_t
+syscall_clone_into_cgroup (uint64_t flags, int cgroup_fd)
+{
+#if defined __NR_clone3
+  struct clone3_args_s args = {
+    .flags = flags | CLONE_INTO_CGROUP,
+    .exit_signal = SIGCHLD,
+    .cgroup = cgroup_fd,
+  };
+
+  return (pid_t) syscall (__NR_clone3, &args, sizeof (args));
+#else
+  (void) flags;
+  (void) cgroup_fd;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 static int
 syscall_pidfd_send_signal (int pidfd, int sig, siginfo_t *info, unsigned int flags)
 {
@@ -368,7 +438,8 @@ struct propagation_flags_s
 
 enum
 {
-  OPTION_TMPCOPYUP = 1
+  OPTION_TMPCOPYUP = 1,
+  OPTION_IDMAP = 2,
 };
 
 static struct propagation_flags_s propagation_flags[] = { { "defaults", 0, 0, 0 },
@@ -406,6 +477,7 @@ static struct propagation_flags_s propagation_flags[] = { { "defaults", 0, 0, 0
                                                           { "runbindable", 0, MS_REC | MS_UNBINDABLE, 0 },
 
                                                           { "tmpcopyup", 0, 0, OPTION_TMPCOPYUP },
+                                                          { "idmap", 0, 0, OPTION_IDMAP },
 
                                                           { NULL, 0, 0, 0 } };
 
@@ -433,19 +505,18 @@ get_mount_flags (const char *name, int current_flags, int *found, unsigned long
 }
 
 static unsigned long
-get_mount_flags_or_option (const char *name, int current_flags, unsigned long *extra_flags, char **option)
+get_mount_flags_or_option (struct crun_arena_s *arena, const char *name, int current_flags, unsigned long *extra_flags,
+                           char **option)
 {
   int found;
-  cleanup_free char *prev = NULL;
   unsigned long flags = get_mount_flags (name, current_flags, &found, extra_flags);
   if (found)
     return flags;
 
-  prev = *option;
   if (*option && **option)
-    xasprintf (option, "%s,%s", *option, name);
+    *option = crun_arena_sprintf (arena, "%s,%s", *option, name);
   else
-    *option = xstrdup (name);
+    *option = crun_arena_strdup (arena, name);
 
   return 0;
 }
@@ -556,17 +627,40 @@ cleanup:
   return ret;
 }
 
+/* Open PATH under the rootfs, using the cached directories while the mounts are set up.  */
+static int
+open_rootfs_path (libcrun_container_t *container, const char *path, int flags, libcrun_error_t *err)
+{
+  struct private_data_s *private_data = get_private_data (container);
+
+  if (private_data->resolver)
+    return crun_rootfs_resolver_open (private_data->resolver, path, flags, 0, err);
+
+  return safe_openat (private_data->rootfsfd, private_data->rootfs, private_data->rootfs_len, path, flags, 0, err);
+}
+
+static int
+create_and_open_rootfs_path (libcrun_container_t *container, bool dir, const char *path, int mode,
+                             libcrun_error_t *err)
+{
+  struct private_data_s *private_data = get_private_data (container);
+
+  if (private_data->resolver)
+    return crun_rootfs_resolver_create_and_open_ref (private_data->resolver, dir, path, mode, err);
+
+  return crun_safe_create_and_open_ref_at (dir, private_data->rootfsfd, private_data->rootfs,
+                                           private_data->rootfs_len, path, mode, err);
+}
+
 static int
 open_mount_target (libcrun_container_t *container, const char *target_rel, libcrun_error_t *err)
 {
-  const char *rootfs = get_private_data (container)->rootfs;
-  size_t rootfs_len = get_private_data (container)->rootfs_len;
   int rootfsfd = get_private_data (container)->rootfsfd;
 
   if (rootfsfd < 0)
     return crun_make_error (err, 0, "invalid rootfs state");
 
-  return safe_openat (rootfsfd, rootfs, rootfs_len, target_rel, O_PATH | O_CLOEXEC, 0, err);
+  return open_rootfs_path (container, target_rel, O_PATH | O_CLOEXEC, err);
 }
 
 /* Attempt to open a mount of the specified type.  */
@@ -614,6 +708,121 @@ fs_move_mount_to (int fd, int dirfd, const char *name)
 #endif
 }
 
+#ifdef HAVE_MOUNT_SETATTR
+static struct
+{
+  unsigned long ms_flag;
+  uint64_t attr;
+} mount_attr_flags[] = { { MS_RDONLY, MOUNT_ATTR_RDONLY },
+                         { MS_NOSUID, MOUNT_ATTR_NOSUID },
+                         { MS_NODEV, MOUNT_ATTR_NODEV },
+                         { MS_NOEXEC, MOUNT_ATTR_NOEXEC },
+                         { 0, 0 } };
+
+/* Flags that mount_setattr can change on a bind mount.  */
+#  define MOUNT_SETATTR_SUPPORTED_FLAGS                                                                          \
+    (MS_BIND | MS_REC | MS_RDONLY | MS_NOSUID | MS_NODEV | MS_NOEXEC | MS_NOATIME | MS_NODIRATIME | MS_RELATIME \
+     | MS_STRICTATIME | MS_SHARED | MS_PRIVATE | MS_SLAVE | MS_UNBINDABLE)
+#endif
+
+/* Create a detached copy of SOURCE with open_tree and set its flags with
+   mount_setattr, as a single bind mount followed by a remount would do.
+   If SKIP_RDONLY is set, MS_RDONLY is not applied.  If USERNS_FD is not
+   negative, the mount is idmapped with the mappings of that user namespace.
+   Returns the O_PATH fd for the detached mount, or -1 with errno set if the
+   new mount API cannot be used.  */
+static int
+open_bind_mount_tree (const char *source, unsigned long mountflags, bool skip_rdonly, int userns_fd)
+{
+#ifdef HAVE_MOUNT_SETATTR
+  unsigned long propagation = mountflags & (MS_SHARED | MS_PRIVATE | MS_SLAVE | MS_UNBINDABLE);
+  bool rec = (mountflags & MS_REC) != 0;
+  struct mount_attr attr = {
+    0,
+  };
+  cleanup_close int fd = -1;
+  size_t i;
+  int ret;
+
+  if (mountflags & ~MOUNT_SETATTR_SUPPORTED_FLAGS)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  fd = syscall_open_tree (AT_FDCWD, source, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | (rec ? AT_RECURSIVE : 0));
+  if (fd < 0)
+    return -1;
+
+  /* The propagation is applied to the whole tree when MS_REC is used,
+     while other flags change only the top mount, as for a remount.  */
+  if (propagation && rec)
+    {
+      attr.propagation = propagation;
+      ret = syscall_mount_setattr (fd, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr, sizeof (attr));
+      if (ret < 0)
+        return -1;
+      memset (&attr, 0, sizeof (attr));
+    }
+  else
+    attr.propagation = propagation;
+
+  /* The idmap can be set only once, and before the mount is attached.  */
+  if (userns_fd >= 0)
+    {
+      struct mount_attr idmap_attr = {
+        0,
+      };
+
+      idmap_attr.attr_set = MOUNT_ATTR_IDMAP;
+      idmap_attr.userns_fd = userns_fd;
+      ret = syscall_mount_setattr (fd, "", AT_EMPTY_PATH | (rec ? AT_RECURSIVE : 0), &idmap_attr,
+                                   sizeof (idmap_attr));
+      if (ret < 0)
+        return -1;
+    }
+
+  /* Like a remount, set exactly the flags that were specified.  */
+  for (i = 0; mount_attr_flags[i].ms_flag; i++)
+    {
+      if (skip_rdonly && mount_attr_flags[i].ms_flag == MS_RDONLY)
+        continue;
+      if (mountflags & mount_attr_flags[i].ms_flag)
+        attr.attr_set |= mount_attr_flags[i].attr;
+      else
+        attr.attr_clr |= mount_attr_flags[i].attr;
+    }
+
+  /* The access time settings are kept unless specified.  */
+  if (mountflags & (MS_NOATIME | MS_NODIRATIME | MS_RELATIME | MS_STRICTATIME))
+    {
+      attr.attr_clr |= MOUNT_ATTR__ATIME | MOUNT_ATTR_NODIRATIME;
+      if (mountflags & MS_NOATIME)
+        attr.attr_set |= MOUNT_ATTR_NOATIME;
+      else if (mountflags & MS_STRICTATIME)
+        attr.attr_set |= MOUNT_ATTR_STRICTATIME;
+      else
+        attr.attr_set |= MOUNT_ATTR_RELATIME;
+      if (mountflags & MS_NODIRATIME)
+        attr.attr_set |= MOUNT_ATTR_NODIRATIME;
+    }
+
+  ret = syscall_mount_setattr (fd, "", AT_EMPTY_PATH, &attr, sizeof (attr));
+  if (ret < 0)
+    return -1;
+
+  return get_and_reset (&fd);
+#else
+  (void) source;
+  (void) mountflags;
+  (void) skip_rdonly;
+  (void) userns_fd;
+  (void) syscall_mount_setattr;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 enum
 {
   /* Do not apply any label to the mount.  */
@@ -763,6 +972,215 @@ do_mount (libcrun_container_t *container, const char *source, int targetfd,
   return ret;
 }
 
+/* Attach the detached mount FD, as returned by open_bind_mount_tree, on
+   TARGETFD.  FD is always consumed.  If DEFER_RDONLY is set, the read-only
+   flag is applied later by finalize_mounts.  */
+static int
+attach_bind_mount_tree (libcrun_container_t *container, int fd, int targetfd, const char *target,
+                        unsigned long mountflags, bool defer_rdonly)
+{
+  cleanup_close int mfd = fd;
+  int ret;
+
+  ret = fs_move_mount_to (mfd, targetfd, NULL);
+  if (ret < 0)
+    return ret;
+
+  if (defer_rdonly && (mountflags & MS_RDONLY))
+    {
+      unsigned long remount_flags = MS_REMOUNT | MS_BIND | (mountflags & ~ALL_PROPAGATIONS);
+      struct remount_s *r;
+
+      /* MFD now refers to the attached mount.  The remount owns it.  */
+      r = make_remount (get_and_reset (&mfd), target, remount_flags, NULL, get_private_data (container)->remounts);
+      get_private_data (container)->remounts = r;
+    }
+
+  return 0;
+}
+
+/* Bind mount SOURCE on TARGETFD with the new mount API.  The mount is
+   configured before it is attached, so unlike do_mount there is no need to
+   reopen the target and to remount it.  When DEFER_RDONLY is set, the
+   read-only flag is applied later by finalize_mounts, as other mounts are
+   created below TARGET.  Returns 1 if the mount was done, 0 if the caller
+   must fall back to do_mount.  */
+static int
+do_bind_mount_tree (libcrun_container_t *container, const char *source, int targetfd, const char *target,
+                    unsigned long mountflags, bool defer_rdonly)
+{
+  int fd;
+
+  fd = open_bind_mount_tree (source, mountflags, defer_rdonly, -1);
+  if (fd < 0)
+    return 0;
+
+  /* Nothing is attached if it fails, so do_mount can still be used.  */
+  return attach_bind_mount_tree (container, fd, targetfd, target, mountflags, defer_rdonly) == 0 ? 1 : 0;
+}
+
+/* Whether the read-only flag for the INDEX-th mount must be applied after
+   all the other mounts, because something is mounted or created below it.  */
+static bool
+must_defer_rdonly (runtime_spec_schema_config_schema *def, size_t index)
+{
+  const char *managed[] = { "dev", "proc", "sys", "run", NULL };
+  const char *dest = consume_slashes (def->mounts[index]->destination);
+  size_t len = strlen (dest);
+  size_t i;
+
+  while (len > 0 && dest[len - 1] == '/')
+    len--;
+
+  if (len == 0 || strstr (dest, "//") || strstr (dest, ".."))
+    return true;
+
+  /* These directories are populated by crun itself.  */
+  for (i = 0; managed[i]; i++)
+    if (strncmp (dest, managed[i], strlen (managed[i])) == 0
+        && (dest[strlen (managed[i])] == '/' || dest[strlen (managed[i])] == '\0'))
+      return true;
+
+  for (i = index + 1; i < def->mounts_len; i++)
+    {
+      const char *other = consume_slashes (def->mounts[i]->destination);
+
+      if (strncmp (other, dest, len) == 0 && other[len] == '/')
+        return true;
+    }
+
+  return false;
+}
+
+/* Whether the INDEX-th mount is a bind mount with the idmap option.  FLAGS
+   is set to its mount flags.  */
+static bool
+mount_needs_idmap (runtime_spec_schema_config_schema *def, size_t index, unsigned long *flags)
+{
+  runtime_spec_schema_defs_mount *mnt = def->mounts[index];
+  unsigned long extra_flags = 0;
+  size_t i;
+
+  *flags = 0;
+  for (i = 0; i < mnt->options_len; i++)
+    *flags |= get_mount_flags (mnt->options[i], *flags, NULL, &extra_flags);
+
+  return (extra_flags & OPTION_IDMAP) && (*flags & MS_BIND) && mnt->source;
+}
+
+static bool
+rootfs_needs_idmap (libcrun_container_t *container)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+
+  return def->root && def->root->path && find_annotation (container, "run.oci.idmap_rootfs") != NULL;
+}
+
+/* Create the idmapped mounts with the user namespace of PID, or with
+   USERNS if it is a valid descriptor, and send them on SYNC_SOCKET_HOST,
+   in the order receive_idmapped_mounts expects them.
+   They are created here as the container process, once in its user
+   namespace, has no privileges on the host mounts.  */
+static int
+send_idmapped_mounts (libcrun_container_t *container, pid_t pid, int userns, int sync_socket_host,
+                      libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+  cleanup_close int userns_fd = -1;
+  bool needed = rootfs_needs_idmap (container);
+  unsigned long flags;
+  char path[64];
+  size_t i;
+  int ret;
+
+  for (i = 0; ! needed && i < def->mounts_len; i++)
+    needed = mount_needs_idmap (def, i, &flags);
+
+  if (! needed)
+    return 0;
+
+  if (userns >= 0)
+    userns_fd = fcntl (userns, F_DUPFD_CLOEXEC, 0);
+  else
+    {
+      sprintf (path, "/proc/%d/ns/user", pid);
+      userns_fd = open (path, O_RDONLY | O_CLOEXEC);
+    }
+  if (UNLIKELY (userns_fd < 0))
+    return crun_make_error (err, errno, "open the user namespace of `%d`", pid);
+
+  if (rootfs_needs_idmap (container))
+    {
+      cleanup_close int fd = -1;
+
+      fd = open_bind_mount_tree (def->root->path, MS_BIND | MS_REC | MS_PRIVATE, false, userns_fd);
+      if (UNLIKELY (fd < 0))
+        return crun_make_error (err, errno, "create idmapped mount for `%s`", def->root->path);
+
+      ret = send_fd_to_socket (sync_socket_host, fd, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  for (i = 0; i < def->mounts_len; i++)
+    {
+      cleanup_close int fd = -1;
+
+      if (! mount_needs_idmap (def, i, &flags))
+        continue;
+
+      fd = open_bind_mount_tree (def->mounts[i]->source, flags, must_defer_rdonly (def, i), userns_fd);
+      if (UNLIKELY (fd < 0))
+        return crun_make_error (err, errno, "create idmapped mount for `%s`", def->mounts[i]->source);
+
+      ret = send_fd_to_socket (sync_socket_host, fd, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  return 0;
+}
+
+static int
+receive_idmapped_mounts (libcrun_container_t *container, int sync_socket_container, libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+  struct private_data_s *private_data = get_private_data (container);
+  unsigned long flags;
+  size_t i, j;
+  int ret;
+
+  if (rootfs_needs_idmap (container))
+    {
+      ret = receive_fd_from_socket (sync_socket_container, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      private_data->idmapped_rootfs_fd = ret;
+    }
+
+  for (i = 0; i < def->mounts_len; i++)
+    {
+      if (! mount_needs_idmap (def, i, &flags))
+        continue;
+
+      if (private_data->idmapped_mounts_fds == NULL)
+        {
+          private_data->idmapped_mounts_fds = xmalloc (sizeof (int) * def->mounts_len);
+          for (j = 0; j < def->mounts_len; j++)
+            private_data->idmapped_mounts_fds[j] = -1;
+        }
+
+      ret = receive_fd_from_socket (sync_socket_container, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      private_data->idmapped_mounts_fds[i] = ret;
+    }
+
+  return 0;
+}
+
 static int
 do_mount_cgroup_v2 (libcrun_container_t *container, int targetfd, const char *target, unsigned long mountflags,
                     libcrun_error_t *err)
@@ -1029,6 +1447,38 @@ relative_path_under_dev (const char *path)
   return NULL;
 }
 
+/* Bind mount the device SOURCE on TARGETFD with open_tree and move_mount.
+   Only the propagation is changed, so the flags locked by the host mount
+   are kept without the remount that do_mount attempts.  Returns 1 if the
+   mount was done, 0 if the caller must fall back to do_mount.  */
+static int
+bind_mount_dev (const char *source, int targetfd)
+{
+#ifdef HAVE_MOUNT_SETATTR
+  struct mount_attr attr = {
+    0,
+  };
+  cleanup_close int fd = -1;
+  int ret;
+
+  fd = syscall_open_tree (AT_FDCWD, source, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+  if (fd < 0)
+    return 0;
+
+  attr.propagation = MS_PRIVATE;
+  ret = syscall_mount_setattr (fd, "", AT_EMPTY_PATH, &attr, sizeof (attr));
+  if (ret < 0)
+    return 0;
+
+  ret = fs_move_mount_to (fd, targetfd, NULL);
+  return ret == 0 ? 1 : 0;
+#else
+  (void) source;
+  (void) targetfd;
+  return 0;
+#endif
+}
+
 static int
 create_dev (libcrun_container_t *container, int devfd, struct device_s *device, bool binds, bool ensure_parent_dir,
             libcrun_error_t *err)
@@ -1038,7 +1488,6 @@ create_dev (libcrun_container_t *container, int devfd, struct device_s *device,
   mode_t type = (device->type[0] == 'b') ? S_IFBLK : ((device->type[0] == 'p') ? S_IFIFO : S_IFCHR);
   const char *fullname = device->path;
   cleanup_close int fd = -1;
-  int rootfsfd = get_private_data (container)->rootfsfd;
   const char *rootfs = get_private_data (container)->rootfs;
   size_t rootfs_len = get_private_data (container)->rootfs_len;
   const char *rel_dev = relative_path_under_dev (device->path);
@@ -1063,11 +1512,14 @@ create_dev (libcrun_container_t *container, int devfd, struct device_s *device,
         {
           const char *rel_path = consume_slashes (device->path);
 
-          fd = crun_safe_create_and_open_ref_at (false, rootfsfd, rootfs, rootfs_len, rel_path, 0700, err);
+          fd = create_and_open_rootfs_path (container, false, rel_path, 0700, err);
           if (UNLIKELY (fd < 0))
             return fd;
         }
 
+      if (bind_mount_dev (fullname, fd))
+        return 0;
+
       ret = do_mount (container, fullname, fd, device->path, NULL, MS_BIND | MS_PRIVATE, NULL, LABEL_MOUNT, err);
       if (UNLIKELY (ret < 0))
         return ret;
@@ -1119,14 +1571,12 @@ create_dev (libcrun_container_t *container, int devfd, struct device_s *device,
           *tmp = '\0';
           basename = tmp + 1;
 
-          dirfd = safe_openat (rootfsfd, rootfs, rootfs_len, dirname,
-                               O_DIRECTORY | O_PATH | O_CLOEXEC, 0, err);
+          dirfd = open_rootfs_path (container, dirname, O_DIRECTORY | O_PATH | O_CLOEXEC, err);
           if (dirfd < 0 && ensure_parent_dir)
             {
               crun_error_release (err);
 
-              dirfd = crun_safe_create_and_open_ref_at (true, rootfsfd, rootfs,
-                                                        rootfs_len, dirname, 0755, err);
+              dirfd = create_and_open_rootfs_path (container, true, dirname, 0755, err);
             }
           if (UNLIKELY (dirfd < 0))
             return dirfd;
@@ -1208,6 +1658,15 @@ create_missing_devs (libcrun_container_t *container, bool binds, libcrun_error_t
 
   for (it = needed_devs; it->path; it++)
     {
+      bool configured = false;
+
+      /* Skip the devices already created from the configuration, with binds
+         they would be mounted a second time.  */
+      for (i = 0; ! configured && i < def->linux->devices_len; i++)
+        configured = strcmp (def->linux->devices[i]->path, it->path) == 0;
+      if (configured)
+        continue;
+
       /* make sure the parent directory exists only on the first iteration.  */
       ret = create_dev (container, devfd, it, binds, it == needed_devs, err);
       if (UNLIKELY (ret < 0))
@@ -1254,38 +1713,150 @@ create_missing_devs (libcrun_container_t *container, bool binds, libcrun_error_t
   return 0;
 }
 
+/* Mask the directory PATHFD with an empty read-only tmpfs.  The first call
+   creates the tmpfs and keeps the attached mount in *TMPFS_FD, the next ones
+   attach a clone of it, so all the masked directories share a single
+   superblock.  Returns 1 if the mount was done, 0 if the caller must fall
+   back to do_mount.  */
 static int
-do_masked_or_readonly_path (libcrun_container_t *container, const char *rel_path, bool readonly,
-                            libcrun_error_t *err)
+mask_dir_with_shared_tmpfs (libcrun_container_t *container, int pathfd, int *tmpfs_fd)
 {
-  size_t rootfs_len = get_private_data (container)->rootfs_len;
-  const char *rootfs = get_private_data (container)->rootfs;
-  int rootfsfd = get_private_data (container)->rootfsfd;
-  cleanup_close int pathfd = -1;
+#if defined HAVE_FSCONFIG_CMD_CREATE && defined HAVE_MOUNT_SETATTR
+  runtime_spec_schema_config_schema *def = container->container_def;
+  const char *label = def->linux ? def->linux->mount_label : NULL;
+  cleanup_close int fsfd = -1;
+  cleanup_close int fd = -1;
+  libcrun_error_t tmp_err = NULL;
   int ret;
-  mode_t mode;
 
-  if (rel_path[0] == '/')
-    rel_path++;
-
-  pathfd = safe_openat (rootfsfd, rootfs, rootfs_len, rel_path, O_PATH | O_CLOEXEC, 0, err);
-  if (UNLIKELY (pathfd < 0))
+  if (*tmpfs_fd >= 0)
     {
-      if (errno != ENOENT && errno != EACCES)
-        return crun_make_error (err, errno, "open `%s`", rel_path);
+      fd = syscall_open_tree (*tmpfs_fd, "", OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_EMPTY_PATH);
+      if (fd < 0)
+        return 0;
 
-      crun_error_release (err);
-      return 0;
+      return fs_move_mount_to (fd, pathfd, NULL) == 0 ? 1 : 0;
     }
 
-  if (readonly)
+  /* The label is used only if SELinux is enabled, as for do_mount.  */
+  if (label)
     {
-      char source_buffer[64];
-      sprintf (source_buffer, "/proc/self/fd/%d", pathfd);
+      cleanup_free char *data = NULL;
 
-      ret = do_mount (container, source_buffer, pathfd, rel_path, NULL, MS_BIND | MS_PRIVATE | MS_RDONLY | MS_REC, NULL,
-                      LABEL_NONE, err);
-      if (UNLIKELY (ret < 0))
+      ret = add_selinux_mount_label (&data, NULL, label, &tmp_err);
+      if (ret < 0)
+        {
+          crun_error_release (&tmp_err);
+          return 0;
+        }
+      if (data == NULL)
+        label = NULL;
+    }
+
+  fsfd = syscall_fsopen ("tmpfs", FSOPEN_CLOEXEC);
+  if (fsfd < 0)
+    return 0;
+
+  ret = syscall_fsconfig (fsfd, FSCONFIG_SET_STRING, "size", "0k", 0);
+  if (ret == 0 && label)
+    ret = syscall_fsconfig (fsfd, FSCONFIG_SET_STRING, "context", label, 0);
+  if (ret == 0)
+    ret = syscall_fsconfig (fsfd, FSCONFIG_CMD_CREATE, NULL, NULL, 0);
+  if (ret < 0)
+    return 0;
+
+  fd = syscall_fsmount (fsfd, FSMOUNT_CLOEXEC, MOUNT_ATTR_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  ret = fs_move_mount_to (fd, pathfd, NULL);
+  if (ret < 0)
+    return 0;
+
+  /* A detached mount cannot be cloned, the attached one can.  */
+  *tmpfs_fd = get_and_reset (&fd);
+  return 1;
+#else
+  (void) container;
+  (void) pathfd;
+  (void) tmpfs_fd;
+  return 0;
+#endif
+}
+
+/* Mask the file PATHFD with a clone of /dev/null, that is opened once in
+   *NULL_FD.  Returns 1 if the mount was done, 0 if the caller must fall
+   back to do_mount.  */
+static int
+mask_file_with_dev_null (int pathfd, int *null_fd)
+{
+#ifdef HAVE_MOUNT_SETATTR
+  struct mount_attr attr = {
+    0,
+  };
+  cleanup_close int fd = -1;
+  int ret;
+
+  if (*null_fd < 0)
+    {
+      *null_fd = open ("/dev/null", O_PATH | O_CLOEXEC);
+      if (*null_fd < 0)
+        return 0;
+    }
+
+  fd = syscall_open_tree (*null_fd, "", OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_EMPTY_PATH);
+  if (fd < 0)
+    return 0;
+
+  attr.propagation = MS_UNBINDABLE;
+  ret = syscall_mount_setattr (fd, "", AT_EMPTY_PATH, &attr, sizeof (attr));
+  if (ret < 0)
+    return 0;
+
+  return fs_move_mount_to (fd, pathfd, NULL) == 0 ? 1 : 0;
+#else
+  (void) pathfd;
+  (void) null_fd;
+  return 0;
+#endif
+}
+
+static int
+do_masked_or_readonly_path (libcrun_container_t *container, const char *rel_path, bool readonly, int *tmpfs_fd,
+                            int *null_fd, libcrun_error_t *err)
+{
+  size_t rootfs_len = get_private_data (container)->rootfs_len;
+  const char *rootfs = get_private_data (container)->rootfs;
+  int rootfsfd = get_private_data (container)->rootfsfd;
+  cleanup_close int pathfd = -1;
+  int ret;
+  mode_t mode;
+
+  if (rel_path[0] == '/')
+    rel_path++;
+
+  pathfd = safe_openat (rootfsfd, rootfs, rootfs_len, rel_path, O_PATH | O_CLOEXEC, 0, err);
+  if (UNLIKELY (pathfd < 0))
+    {
+      if (errno != ENOENT && errno != EACCES)
+        return crun_make_error (err, errno, "open `%s`", rel_path);
+
+      crun_error_release (err);
+      return 0;
+    }
+
+  if (readonly)
+    {
+      unsigned long flags = MS_BIND | MS_PRIVATE | MS_RDONLY | MS_REC;
+      char source_buffer[64];
+      sprintf (source_buffer, "/proc/self/fd/%d", pathfd);
+
+      /* Set read-only when it is created, without a remount.  */
+      if (do_bind_mount_tree (container, source_buffer, pathfd, rel_path, flags, false))
+        return 0;
+
+      ret = do_mount (container, source_buffer, pathfd, rel_path, NULL, flags, NULL, LABEL_NONE, err);
+      if (UNLIKELY (ret < 0))
         return ret;
     }
   else
@@ -1295,10 +1866,20 @@ do_masked_or_readonly_path (libcrun_container_t *container, const char *rel_path
         return ret;
 
       if ((mode & S_IFMT) == S_IFDIR)
-        ret = do_mount (container, "tmpfs", pathfd, rel_path, "tmpfs", MS_RDONLY, "size=0k", LABEL_MOUNT, err);
+        {
+          if (mask_dir_with_shared_tmpfs (container, pathfd, tmpfs_fd))
+            return 0;
+
+          ret = do_mount (container, "tmpfs", pathfd, rel_path, "tmpfs", MS_RDONLY, "size=0k", LABEL_MOUNT, err);
+        }
       else
-        ret = do_mount (container, "/dev/null", pathfd, rel_path, NULL, MS_BIND | MS_UNBINDABLE | MS_REC, NULL,
-                        LABEL_MOUNT, err);
+        {
+          if (mask_file_with_dev_null (pathfd, null_fd))
+            return 0;
+
+          ret = do_mount (container, "/dev/null", pathfd, rel_path, NULL, MS_BIND | MS_UNBINDABLE | MS_REC, NULL,
+                          LABEL_MOUNT, err);
+        }
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -1311,16 +1892,20 @@ do_masked_and_readonly_paths (libcrun_container_t *container, libcrun_error_t *e
   size_t i;
   int ret;
   runtime_spec_schema_config_schema *def = container->container_def;
+  /* Shared by all the masked paths.  */
+  cleanup_close int tmpfs_fd = -1;
+  cleanup_close int null_fd = -1;
 
   for (i = 0; i < def->linux->masked_paths_len; i++)
     {
-      ret = do_masked_or_readonly_path (container, def->linux->masked_paths[i], false, err);
+      ret = do_masked_or_readonly_path (container, def->linux->masked_paths[i], false, &tmpfs_fd, &null_fd, err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
   for (i = 0; i < def->linux->readonly_paths_len; i++)
     {
-      ret = do_masked_or_readonly_path (container, def->linux->readonly_paths[i], true, err);
+      ret = do_masked_or_readonly_path (container, def->linux->readonly_paths[i], true, &tmpfs_fd, &null_fd,
+                                        err);
       if (UNLIKELY (ret < 0))
         return ret;
     }
@@ -1376,23 +1961,23 @@ do_pivot (libcrun_container_t *container, const char *rootfs, libcrun_error_t *e
 }
 
 static int
-get_default_flags (libcrun_container_t *container, const char *destination, char **data)
+get_default_flags (libcrun_container_t *container, struct crun_arena_s *arena, const char *destination, char **data)
 {
   if (strcmp (destination, "/proc") == 0)
     return 0;
   if (strcmp (destination, "/dev/cgroup") == 0 || strcmp (destination, "/sys/fs/cgroup") == 0)
     {
-      *data = xstrdup ("none,name=");
+      *data = crun_arena_strdup (arena, "none,name=");
       return MS_NOEXEC | MS_NOSUID | MS_STRICTATIME;
     }
   if (strcmp (destination, "/dev") == 0)
     {
-      *data = xstrdup ("mode=755");
+      *data = crun_arena_strdup (arena, "mode=755");
       return MS_NOEXEC | MS_STRICTATIME;
     }
   if (strcmp (destination, "/dev/shm") == 0)
     {
-      *data = xstrdup ("mode=1777,size=65536k");
+      *data = crun_arena_strdup (arena, "mode=1777,size=65536k");
       return MS_NOEXEC | MS_NOSUID | MS_NODEV;
     }
   if (strcmp (destination, "/dev/mqueue") == 0)
@@ -1400,9 +1985,9 @@ get_default_flags (libcrun_container_t *container, const char *destination, char
   if (strcmp (destination, "/dev/pts") == 0)
     {
       if (container->host_uid == 0)
-        *data = xstrdup ("newinstance,ptmxmode=0666,mode=620,gid=5");
+        *data = crun_arena_strdup (arena, "newinstance,ptmxmode=0666,mode=620,gid=5");
       else
-        *data = xstrdup ("newinstance,ptmxmode=0666,mode=620");
+        *data = crun_arena_strdup (arena, "newinstance,ptmxmode=0666,mode=620");
       return MS_NOEXEC | MS_NOSUID;
     }
   if (strcmp (destination, "/sys") == 0)
@@ -1412,24 +1997,15 @@ get_default_flags (libcrun_container_t *container, const char *destination, char
 }
 
 static char *
-append_mode_if_missing (char *data, const char *mode)
+append_mode_if_missing (struct crun_arena_s *arena, char *data, const char *mode)
 {
-  char *new_data;
-  bool append;
-
   if (data != NULL && strstr (data, "mode="))
     return data;
 
-  append = data != NULL && data[0] != '\0';
-
-  if (append)
-    xasprintf (&new_data, "%s,%s", data, mode);
-  else
-    new_data = xstrdup (mode);
-
-  free (data);
+  if (data != NULL && data[0] != '\0')
+    return crun_arena_sprintf (arena, "%s,%s", data, mode);
 
-  return new_data;
+  return crun_arena_strdup (arena, mode);
 }
 
 static int
@@ -1438,7 +2014,6 @@ do_mounts (libcrun_container_t *container, int rootfsfd, const char *rootfs, lib
   size_t i, j;
   int ret;
   runtime_spec_schema_config_schema *def = container->container_def;
-  size_t rootfs_len = get_private_data (container)->rootfs_len;
   const char *systemd_cgroup_v1 = find_annotation (container, "run.oci.systemd.force_cgroup_v1");
   struct
   {
@@ -1451,7 +2026,10 @@ do_mounts (libcrun_container_t *container, int rootfsfd, const char *rootfs, lib
   for (i = 0; i < def->mounts_len; i++)
     {
       const char *target = consume_slashes (def->mounts[i]->destination);
-      cleanup_free char *data = NULL;
+      /* Scratch memory for the mount options, released after each mount.  */
+      char scratch[1024] __attribute__ ((aligned (8)));
+      cleanup_arena struct crun_arena_s arena;
+      char *data = NULL;
       char *type;
       char *source;
       unsigned long flags = 0;
@@ -1462,16 +2040,18 @@ do_mounts (libcrun_container_t *container, int rootfsfd, const char *rootfs, lib
       bool mounted = false;
       bool is_sysfs_or_proc;
 
+      crun_arena_init (&arena, scratch, sizeof (scratch));
+
       type = def->mounts[i]->type;
 
       if (def->mounts[i]->options == NULL)
-        flags = get_default_flags (container, def->mounts[i]->destination, &data);
+        flags = get_default_flags (container, &arena, def->mounts[i]->destination, &data);
       else
         {
           size_t j;
 
           for (j = 0; j < def->mounts[i]->options_len; j++)
-            flags |= get_mount_flags_or_option (def->mounts[i]->options[j], flags, &extra_flags, &data);
+            flags |= get_mount_flags_or_option (&arena, def->mounts[i]->options[j], flags, &extra_flags, &data);
         }
 
       if (type == NULL && (flags & MS_BIND) == 0)
@@ -1492,7 +2072,7 @@ do_mounts (libcrun_container_t *container, int rootfsfd, const char *rootfs, lib
           if (UNLIKELY (is_dir < 0))
             return is_dir;
 
-          data = append_mode_if_missing (data, "mode=1755");
+          data = append_mode_if_missing (&arena, data, "mode=1755");
         }
 
       if (is_sysfs_or_proc)
@@ -1525,14 +2105,35 @@ do_mounts (libcrun_container_t *container, int rootfsfd, const char *rootfs, lib
       else
         {
           /* Make sure any other directory/file is created and take a O_PATH reference to it.  */
-          ret = crun_safe_create_and_open_ref_at (is_dir, rootfsfd, rootfs, rootfs_len, target,
-                                                  is_dir ? 01755 : 0755, err);
+          ret = create_and_open_rootfs_path (container, is_dir, target, is_dir ? 01755 : 0755, err);
           if (UNLIKELY (ret < 0))
             return ret;
 
           targetfd = ret;
         }
 
+      /* The target is going to be covered by the mount, drop it from the cache.  */
+      if (get_private_data (container)->resolver)
+        crun_rootfs_resolver_invalidate (get_private_data (container)->resolver, target);
+
+      if (extra_flags & OPTION_IDMAP)
+        {
+          int *idmapped_fds = get_private_data (container)->idmapped_mounts_fds;
+
+          if ((flags & MS_BIND) == 0 || def->mounts[i]->source == NULL)
+            return crun_make_error (err, 0, "idmap can be used only with bind mounts");
+
+          if (idmapped_fds == NULL || idmapped_fds[i] < 0)
+            return crun_make_error (err, 0, "idmap for `%s` requires a new user namespace", def->mounts[i]->destination);
+
+          ret = attach_bind_mount_tree (container, get_and_reset (&idmapped_fds[i]), targetfd, target, flags,
+                                        must_defer_rdonly (def, i));
+          if (UNLIKELY (ret < 0))
+            return crun_make_error (err, errno, "move idmapped mount to `/%s`", target);
+
+          continue;
+        }
+
       if (extra_flags & OPTION_TMPCOPYUP)
         {
           if (strcmp (type, "tmpfs") != 0)
@@ -1595,16 +2196,23 @@ do_mounts (libcrun_container_t *container, int rootfsfd, const char *rootfs, lib
           else if (strcmp (type, "mqueue") == 0)
             label_how = LABEL_XATTR;
 
-          ret = do_mount (container, source, targetfd, target, type, flags, data, label_how, err);
-          if (UNLIKELY (ret < 0))
-            return ret;
+          /* The label is ignored for bind mounts.  */
+          if ((flags & MS_BIND) && copy_from_fd < 0)
+            mounted = do_bind_mount_tree (container, source, targetfd, target, flags, must_defer_rdonly (def, i));
+
+          if (! mounted)
+            {
+              ret = do_mount (container, source, targetfd, target, type, flags, data, label_how, err);
+              if (UNLIKELY (ret < 0))
+                return ret;
+            }
         }
 
       if (copy_from_fd >= 0)
         {
           int destfd, tmpfd;
 
-          destfd = safe_openat (rootfsfd, rootfs, rootfs_len, target, O_DIRECTORY, 0, err);
+          destfd = open_rootfs_path (container, target, O_DIRECTORY, err);
           if (UNLIKELY (destfd < 0))
             return crun_make_error (err, errno, "open target to write for tmpcopyup");
 
@@ -1807,9 +2415,31 @@ do_finalize_notify_socket (libcrun_container_t *container, libcrun_error_t *err)
 static int
 make_parent_mount_private (const char *rootfs, libcrun_error_t *err)
 {
-  cleanup_free char *tmp = xstrdup (rootfs);
+  cleanup_free char *tmp = NULL;
   char *it;
 
+  /* Look up the mount point containing the rootfs, so that a single mount
+     call is needed.  If it fails for any reason, find it by trying each
+     parent directory in turn.  */
+  if (rootfs[0] == '/')
+    {
+      cleanup_free char *mountinfo = NULL;
+      libcrun_error_t tmp_err = NULL;
+      char *mount_point;
+      int ret;
+
+      ret = read_all_file ("/proc/self/mountinfo", &mountinfo, NULL, &tmp_err);
+      if (UNLIKELY (ret < 0))
+        crun_error_release (&tmp_err);
+      else
+        {
+          mount_point = find_mountinfo_mount_point (mountinfo, rootfs);
+          if (mount_point && mount (NULL, mount_point, NULL, MS_PRIVATE, NULL) == 0)
+            return 0;
+        }
+    }
+
+  tmp = xstrdup (rootfs);
   for (;;)
     {
       int ret;
@@ -1881,6 +2511,171 @@ libcrun_create_kvm_device (libcrun_container_t *container, libcrun_error_t *err)
   return 0;
 }
 
+static bool
+rootfs_from_layers_p (libcrun_container_t *container)
+{
+  return find_annotation (container, "run.oci.rootfs.lowerdir") != NULL
+         || find_annotation (container, "run.oci.rootfs.composefs") != NULL;
+}
+
+#ifdef HAVE_FSCONFIG_CMD_CREATE
+static int
+fsconfig_set_string (int fsfd, const char *key, const char *value, libcrun_error_t *err)
+{
+  int ret;
+
+  ret = syscall_fsconfig (fsfd, FSCONFIG_SET_STRING, key, value, 0);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fsconfig `%s=%s`", key, value);
+
+  return 0;
+}
+
+/* Mount the composefs IMAGE, an EROFS image with the metadata of the
+   rootfs, and return the detached mount.  */
+static int
+open_composefs_image (const char *image, libcrun_error_t *err)
+{
+  cleanup_close int fsfd = -1;
+  int ret;
+
+  fsfd = syscall_fsopen ("erofs", FSOPEN_CLOEXEC);
+  if (UNLIKELY (fsfd < 0))
+    return crun_make_error (err, errno, "fsopen `erofs`");
+
+  ret = fsconfig_set_string (fsfd, "source", image, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = syscall_fsconfig (fsfd, FSCONFIG_CMD_CREATE, NULL, NULL, 0);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "mount composefs image `%s`", image);
+
+  ret = syscall_fsmount (fsfd, FSMOUNT_CLOEXEC, MOUNT_ATTR_RDONLY);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fsmount composefs image `%s`", image);
+
+  return ret;
+}
+#endif
+
+/* Assemble the rootfs with an overlay of the layers specified in the
+   annotations:
+
+   run.oci.rootfs.lowerdir: the read-only layers, separated by ':' and
+                            starting from the top one.
+   run.oci.rootfs.composefs: a composefs image, used as the lowest layer.
+   run.oci.rootfs.composefs.objects: the directory with the files referred
+                                     by the composefs image.
+   run.oci.rootfs.upperdir, run.oci.rootfs.workdir: the writeable layer.
+                                                    If not specified,
+                                                    the rootfs is read-only.
+
+   The overlay is created as a detached mount and moved to ROOTFS.  */
+static int
+mount_rootfs_layers (libcrun_container_t *container, const char *rootfs, libcrun_error_t *err)
+{
+#ifdef HAVE_FSCONFIG_CMD_CREATE
+  const char *lowerdir = find_annotation (container, "run.oci.rootfs.lowerdir");
+  const char *upperdir = find_annotation (container, "run.oci.rootfs.upperdir");
+  const char *workdir = find_annotation (container, "run.oci.rootfs.workdir");
+  const char *composefs = find_annotation (container, "run.oci.rootfs.composefs");
+  const char *objects = find_annotation (container, "run.oci.rootfs.composefs.objects");
+  cleanup_close int composefs_fd = -1;
+  cleanup_close int fsfd = -1;
+  cleanup_close int fd = -1;
+  int ret;
+
+  if ((upperdir == NULL) != (workdir == NULL))
+    return crun_make_error (err, 0, "`run.oci.rootfs.upperdir` and `run.oci.rootfs.workdir` must be used together");
+
+  if (composefs && objects == NULL)
+    return crun_make_error (err, 0, "`run.oci.rootfs.composefs` requires `run.oci.rootfs.composefs.objects`");
+
+  fsfd = syscall_fsopen ("overlay", FSOPEN_CLOEXEC);
+  if (UNLIKELY (fsfd < 0))
+    return crun_make_error (err, errno, "fsopen `overlay`");
+
+  if (composefs == NULL)
+    {
+      ret = fsconfig_set_string (fsfd, "lowerdir", lowerdir, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+  else
+    {
+      cleanup_free char *composefs_path = NULL;
+
+      /* The layers must be appended one at a time, the layer for the
+         composefs image is a detached mount and it has only a path
+         through /proc/self/fd.  */
+      if (lowerdir)
+        {
+          cleanup_free char *lowerdirs = xstrdup (lowerdir);
+          char *saveptr = NULL;
+          char *it;
+
+          for (it = strtok_r (lowerdirs, ":", &saveptr); it; it = strtok_r (NULL, ":", &saveptr))
+            {
+              ret = fsconfig_set_string (fsfd, "lowerdir+", it, err);
+              if (UNLIKELY (ret < 0))
+                return ret;
+            }
+        }
+
+      composefs_fd = open_composefs_image (composefs, err);
+      if (UNLIKELY (composefs_fd < 0))
+        return composefs_fd;
+
+      xasprintf (&composefs_path, "/proc/self/fd/%d", composefs_fd);
+      ret = fsconfig_set_string (fsfd, "lowerdir+", composefs_path, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = fsconfig_set_string (fsfd, "datadir+", objects, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = fsconfig_set_string (fsfd, "metacopy", "on", err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = fsconfig_set_string (fsfd, "redirect_dir", "on", err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  if (upperdir)
+    {
+      ret = fsconfig_set_string (fsfd, "upperdir", upperdir, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      ret = fsconfig_set_string (fsfd, "workdir", workdir, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  ret = syscall_fsconfig (fsfd, FSCONFIG_CMD_CREATE, NULL, NULL, 0);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "create the overlay for the rootfs");
+
+  fd = syscall_fsmount (fsfd, FSMOUNT_CLOEXEC, upperdir ? 0 : MOUNT_ATTR_RDONLY);
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "fsmount the overlay for the rootfs");
+
+  ret = fs_move_mount_to (fd, AT_FDCWD, rootfs);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "move the overlay to `%s`", rootfs);
+
+  return 0;
+#else
+  (void) container;
+  (void) rootfs;
+  return crun_make_error (err, ENOTSUP, "assembling the rootfs from layers requires the new mount API");
+#endif
+}
+
 int
 libcrun_set_mounts (libcrun_container_t *container, const char *rootfs, set_mounts_cb_t cb, void *cb_data, libcrun_error_t *err)
 {
@@ -1888,8 +2683,11 @@ libcrun_set_mounts (libcrun_container_t *container, const char *rootfs, set_moun
   int ret = 0, is_user_ns = 0;
   unsigned long rootfs_propagation = 0;
   cleanup_close int rootfsfd_cleanup = -1;
+  cleanup_rootfs_resolver struct crun_rootfs_resolver_s resolver;
   runtime_spec_schema_config_schema *def = container->container_def;
 
+  crun_rootfs_resolver_init (&resolver, -1, NULL, 0);
+
   if (rootfs == NULL || def->mounts == NULL)
     return 0;
 
@@ -1911,11 +2709,38 @@ libcrun_set_mounts (libcrun_container_t *container, const char *rootfs, set_moun
       if (UNLIKELY (ret < 0))
         return ret;
 
-      ret = do_mount (container, rootfs, -1, rootfs, NULL, MS_BIND | MS_REC | MS_PRIVATE, NULL, LABEL_MOUNT, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      if (rootfs_from_layers_p (container))
+        {
+          if (UNLIKELY (get_private_data (container)->idmapped_rootfs_fd >= 0))
+            return crun_make_error (err, 0, "an idmapped rootfs cannot be assembled from layers");
+
+          ret = mount_rootfs_layers (container, rootfs, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+        }
+      else if (get_private_data (container)->idmapped_rootfs_fd >= 0)
+        {
+          cleanup_close int fd = get_and_reset (&(get_private_data (container)->idmapped_rootfs_fd));
+
+          ret = fs_move_mount_to (fd, AT_FDCWD, rootfs);
+          if (UNLIKELY (ret < 0))
+            return crun_make_error (err, errno, "move idmapped mount to `%s`", rootfs);
+        }
+      else
+        {
+          ret = do_mount (container, rootfs, -1, rootfs, NULL, MS_BIND | MS_REC | MS_PRIVATE, NULL, LABEL_MOUNT,
+                          err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+        }
     }
 
+  if (UNLIKELY (get_private_data (container)->idmapped_rootfs_fd >= 0))
+    return crun_make_error (err, 0, "an idmapped rootfs requires a new mount namespace");
+
+  if (UNLIKELY ((get_private_data (container)->unshare_flags & CLONE_NEWNS) == 0 && rootfs_from_layers_p (container)))
+    return crun_make_error (err, 0, "a rootfs assembled from layers requires a new mount namespace");
+
   if (rootfs == NULL)
     rootfsfd = AT_FDCWD;
   else
@@ -1929,6 +2754,9 @@ libcrun_set_mounts (libcrun_container_t *container, const char *rootfs, set_moun
   get_private_data (container)->rootfsfd = rootfsfd;
   get_private_data (container)->rootfs_len = rootfs ? strlen (rootfs) : 0;
 
+  crun_rootfs_resolver_init (&resolver, rootfsfd, rootfs, get_private_data (container)->rootfs_len);
+  get_private_data (container)->resolver = &resolver;
+
   if (def->root->readonly)
     {
       struct remount_s *r;
@@ -1966,6 +2794,10 @@ libcrun_set_mounts (libcrun_container_t *container, const char *rootfs, set_moun
         return ret;
     }
 
+  /* The masked paths are mounted on top of arbitrary paths, stop caching directories here.  */
+  get_private_data (container)->resolver = NULL;
+  crun_rootfs_resolver_release (&resolver);
+
   /* Notify the callback after all the mounts are ready but before making them read-only.  */
   if (cb)
     {
@@ -2095,18 +2927,23 @@ libcrun_reopen_dev_null (libcrun_error_t *err)
   return 0;
 }
 
-static int
-uidgidmap_helper (char *helper, pid_t pid, char *map_file, libcrun_error_t *err)
+/* Start HELPER to write MAP_FILE for PID and return its pid.  MAP_FILE is
+   not modified, so it can still be written directly if HELPER fails.  */
+static pid_t
+uidgidmap_helper_start (char *helper, pid_t pid, const char *map_file, libcrun_error_t *err)
 {
 #define MAX_ARGS 20
+  cleanup_free char *map = xstrdup (map_file);
   char pid_fmt[16];
   char *args[MAX_ARGS + 1];
   char *next;
   size_t nargs = 0;
+  pid_t helper_pid;
+
   args[nargs++] = helper;
   sprintf (pid_fmt, "%d", pid);
   args[nargs++] = pid_fmt;
-  next = map_file;
+  next = map;
   while (nargs < MAX_ARGS)
     {
       char *p = strsep (&next, " \n");
@@ -2116,28 +2953,71 @@ uidgidmap_helper (char *helper, pid_t pid, char *map_file, libcrun_error_t *err)
     }
   args[nargs++] = NULL;
 
-  return run_process (args, err) ? -1 : 0;
-}
+  helper_pid = fork ();
+  if (UNLIKELY (helper_pid < 0))
+    return crun_make_error (err, errno, "fork");
 
-static int
-newgidmap (pid_t pid, char *map_file, libcrun_error_t *err)
-{
-  return uidgidmap_helper ("/usr/bin/newgidmap", pid, map_file, err);
+  if (helper_pid == 0)
+    {
+      execvp (args[0], args);
+      _exit (EXIT_FAILURE);
+    }
+
+  return helper_pid;
 }
 
 static int
-newuidmap (pid_t pid, char *map_file, libcrun_error_t *err)
+uidgidmap_helper_wait (pid_t helper_pid, libcrun_error_t *err)
 {
-  return uidgidmap_helper ("/usr/bin/newuidmap", pid, map_file, err);
+  int ret, status;
+
+  ret = TEMP_FAILURE_RETRY (waitpid (helper_pid, &status, 0));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "waitpid");
+
+  return (WIFEXITED (status) && WEXITSTATUS (status) == 0) ? 0 : -1;
 }
 
-static int
-deny_setgroups (libcrun_container_t *container, pid_t pid, libcrun_error_t *err)
+/* Whether MAP can be written to the uid_map (IS_UID) or gid_map file
+   without the help of newuidmap or newgidmap.  */
+static bool
+can_write_id_map_directly (libcrun_container_t *container, const char *map, bool is_uid)
 {
-  int ret;
-  cleanup_free char *groups_file = NULL;
+  uint32_t container_id, host_id, size;
+  int n = 0;
 
-  xasprintf (&groups_file, "/proc/%d/setgroups", pid);
+  if (container->host_uid == 0)
+    return true;
+
+#ifdef HAVE_CAP
+  {
+    struct __user_cap_header_struct hdr = { _LINUX_CAPABILITY_VERSION_3, 0 };
+    struct __user_cap_data_struct data[2] = { { 0 } };
+
+    /* Both CAP_SETUID and CAP_SETGID are in the first 32 bits.  */
+    if (capget (&hdr, data) == 0 && (data[0].effective & (1U << (is_uid ? CAP_SETUID : CAP_SETGID))))
+      return true;
+  }
+#endif
+
+  /* An unprivileged user can map its own uid, but its own gid only once
+     setgroups is denied, which is done only as a fallback.  */
+  if (! is_uid)
+    return false;
+
+  if (sscanf (map, "%" SCNu32 " %" SCNu32 " %" SCNu32 "\n%n", &container_id, &host_id, &size, &n) != 3)
+    return false;
+
+  return map[n] == '\0' && host_id == container->host_uid && size == 1;
+}
+
+static int
+deny_setgroups (libcrun_container_t *container, pid_t pid, libcrun_error_t *err)
+{
+  int ret;
+  cleanup_free char *groups_file = NULL;
+
+  xasprintf (&groups_file, "/proc/%d/setgroups", pid);
   ret = write_file (groups_file, "deny", 4, err);
   if (ret >= 0)
     get_private_data (container)->deny_setgroups = true;
@@ -2222,33 +3102,42 @@ libcrun_set_usernamespace (libcrun_container_t *container, pid_t pid, libcrun_er
 {
 #define MAPPING_FMT_SIZE ("%" PRIu32 " %" PRIu32 " %" PRIu32 "\n")
 #define MAPPING_FMT_1 ("%" PRIu32 " %" PRIu32 " 1\n")
-  cleanup_free char *uid_map_file = NULL;
-  cleanup_free char *gid_map_file = NULL;
-  cleanup_free char *uid_map = NULL;
-  cleanup_free char *gid_map = NULL;
+  char scratch[1024] __attribute__ ((aligned (8)));
+  cleanup_arena struct crun_arena_s arena;
+  char *uid_map_file = NULL;
+  char *gid_map_file = NULL;
+  char *uid_map = NULL;
+  char *gid_map = NULL;
   int uid_map_len, gid_map_len;
+  pid_t uid_helper = -1, gid_helper = -1;
+  int uid_ret = 0, gid_ret = 0;
+  bool direct_uid, direct_gid;
   int ret = 0;
   runtime_spec_schema_config_schema *def = container->container_def;
 
+  crun_arena_init (&arena, scratch, sizeof (scratch));
+
   if ((get_private_data (container)->unshare_flags & CLONE_NEWUSER) == 0)
     return 0;
 
   if (! def->linux->uid_mappings_len)
     {
-      uid_map_len = format_default_id_mapping (&uid_map, container->container_uid, container->host_uid, 1);
+      uid_map_len = format_default_id_mapping (&arena, &uid_map, container->container_uid, container->host_uid, 1);
       if (uid_map == NULL)
         {
           if (container->host_uid)
-            uid_map_len = xasprintf (&uid_map, MAPPING_FMT_1, 0, container->host_uid);
+            uid_map = crun_arena_sprintf (&arena, MAPPING_FMT_1, 0, container->host_uid);
           else
-            uid_map_len = xasprintf (&uid_map, MAPPING_FMT_SIZE, 0, container->host_uid, container->container_uid + 1);
+            uid_map = crun_arena_sprintf (&arena, MAPPING_FMT_SIZE, 0, container->host_uid,
+                                          container->container_uid + 1);
+          uid_map_len = strlen (uid_map);
         }
     }
   else
     {
       size_t written = 0, s;
       char buffer[64];
-      uid_map = xmalloc (sizeof (buffer) * def->linux->uid_mappings_len + 1);
+      uid_map = crun_arena_alloc (&arena, sizeof (buffer) * def->linux->uid_mappings_len + 1);
       for (s = 0; s < def->linux->uid_mappings_len; s++)
         {
           size_t len;
@@ -2264,20 +3153,22 @@ libcrun_set_usernamespace (libcrun_container_t *container, pid_t pid, libcrun_er
 
   if (! def->linux->gid_mappings_len)
     {
-      gid_map_len = format_default_id_mapping (&gid_map, container->container_gid, container->host_uid, 0);
+      gid_map_len = format_default_id_mapping (&arena, &gid_map, container->container_gid, container->host_uid, 0);
       if (gid_map == NULL)
         {
           if (container->host_gid)
-            gid_map_len = xasprintf (&gid_map, MAPPING_FMT_1, container->container_gid, container->host_gid);
+            gid_map = crun_arena_sprintf (&arena, MAPPING_FMT_1, container->container_gid, container->host_gid);
           else
-            gid_map_len = xasprintf (&gid_map, MAPPING_FMT_SIZE, 0, container->host_gid, container->container_gid + 1);
+            gid_map = crun_arena_sprintf (&arena, MAPPING_FMT_SIZE, 0, container->host_gid,
+                                          container->container_gid + 1);
+          gid_map_len = strlen (gid_map);
         }
     }
   else
     {
       size_t written = 0, s;
       char buffer[64];
-      gid_map = xmalloc (sizeof (buffer) * def->linux->gid_mappings_len + 1);
+      gid_map = crun_arena_alloc (&arena, sizeof (buffer) * def->linux->gid_mappings_len + 1);
       for (s = 0; s < def->linux->gid_mappings_len; s++)
         {
           size_t len;
@@ -2291,9 +3182,44 @@ libcrun_set_usernamespace (libcrun_container_t *container, pid_t pid, libcrun_er
       gid_map_len = written;
     }
 
-  if (container->host_uid)
-    ret = newgidmap (pid, gid_map, err);
-  if (container->host_uid == 0 || ret < 0)
+  /* Decide up front which maps need the setuid helpers, and run them at
+     the same time.  */
+  direct_gid = can_write_id_map_directly (container, gid_map, false);
+  direct_uid = can_write_id_map_directly (container, uid_map, true);
+
+  if (! direct_gid)
+    {
+      gid_helper = uidgidmap_helper_start ("/usr/bin/newgidmap", pid, gid_map, err);
+      if (gid_helper < 0)
+        {
+          crun_error_release (err);
+          gid_ret = -1;
+        }
+    }
+  if (! direct_uid)
+    {
+      uid_helper = uidgidmap_helper_start ("/usr/bin/newuidmap", pid, uid_map, err);
+      if (uid_helper < 0)
+        {
+          crun_error_release (err);
+          uid_ret = -1;
+        }
+    }
+
+  /* A failed helper is not an error, the map is written directly below.  */
+  if (gid_helper > 0)
+    {
+      gid_ret = uidgidmap_helper_wait (gid_helper, err);
+      crun_error_release (err);
+    }
+  if (uid_helper > 0)
+    {
+      uid_ret = uidgidmap_helper_wait (uid_helper, err);
+      crun_error_release (err);
+    }
+
+  ret = gid_ret;
+  if (direct_gid || ret < 0)
     {
       if (ret < 0)
         {
@@ -2302,7 +3228,7 @@ libcrun_set_usernamespace (libcrun_container_t *container, pid_t pid, libcrun_er
           crun_error_release (err);
         }
 
-      xasprintf (&gid_map_file, "/proc/%d/gid_map", pid);
+      gid_map_file = crun_arena_sprintf (&arena, "/proc/%d/gid_map", pid);
       ret = write_file (gid_map_file, gid_map, gid_map_len, err);
       if (ret < 0 && ! def->linux->gid_mappings_len)
         {
@@ -2321,9 +3247,8 @@ libcrun_set_usernamespace (libcrun_container_t *container, pid_t pid, libcrun_er
   if (UNLIKELY (ret < 0))
     return ret;
 
-  if (container->host_uid)
-    ret = newuidmap (pid, uid_map, err);
-  if (container->host_uid == 0 || ret < 0)
+  ret = uid_ret;
+  if (direct_uid || ret < 0)
     {
       if (ret < 0)
         {
@@ -2332,7 +3257,7 @@ libcrun_set_usernamespace (libcrun_container_t *container, pid_t pid, libcrun_er
           crun_error_release (err);
         }
 
-      xasprintf (&uid_map_file, "/proc/%d/uid_map", pid);
+      uid_map_file = crun_arena_sprintf (&arena, "/proc/%d/uid_map", pid);
       ret = write_file (uid_map_file, uid_map, uid_map_len, err);
       if (ret < 0 && ! def->linux->uid_mappings_len)
         {
@@ -2387,6 +3312,11 @@ libcrun_init_caps (libcrun_error_t *err)
   cleanup_close int fd = -1;
   int ret;
   char buffer[16];
+
+  /* Already initialized.  */
+  if (cap_last_cap > 0)
+    return 0;
+
   fd = open ("/proc/sys/kernel/cap_last_cap", O_RDONLY);
   if (fd < 0)
     return crun_make_error (err, errno, "open /proc/sys/kernel/cap_last_cap");
@@ -2614,44 +3544,203 @@ libcrun_set_oom (libcrun_container_t *container, libcrun_error_t *err)
   return 0;
 }
 
-int
-libcrun_set_sysctl_from_schema (runtime_spec_schema_config_schema *def, libcrun_error_t *err)
+/* The sysctls that are namespaced, and the namespace that must be
+   created for the container to set them.  An entry ending with '.'
+   matches every key with that prefix.  */
+static const struct
+{
+  const char *name;
+  int namespace;
+  const char *namespace_name;
+} namespaced_sysctls[] = {
+  { "kernel.domainname", CLONE_NEWUTS, "uts" },
+  { "kernel.hostname", CLONE_NEWUTS, "uts" },
+  { "kernel.msgmax", CLONE_NEWIPC, "ipc" },
+  { "kernel.msgmnb", CLONE_NEWIPC, "ipc" },
+  { "kernel.msgmni", CLONE_NEWIPC, "ipc" },
+  { "kernel.sem", CLONE_NEWIPC, "ipc" },
+  { "kernel.shm_rmid_forced", CLONE_NEWIPC, "ipc" },
+  { "kernel.shmall", CLONE_NEWIPC, "ipc" },
+  { "kernel.shmmax", CLONE_NEWIPC, "ipc" },
+  { "kernel.shmmni", CLONE_NEWIPC, "ipc" },
+  { "fs.mqueue.", CLONE_NEWIPC, "ipc" },
+  { "net.", CLONE_NEWNET, "network" },
+  { NULL, 0, NULL },
+};
+
+/* Check that the sysctl NAME can be set with the new NAMESPACES.  The table
+   above is only a fast path for the known keys: any other key is accepted
+   if it exists under PROCSYSFD, and the kernel decides whether the
+   container can write it.  */
+static int
+validate_sysctl (int procsysfd, const char *name, int namespaces, libcrun_error_t *err)
+{
+  cleanup_free char *path = xstrdup (name);
+  char *it;
+  size_t i;
+
+  for (i = 0; namespaced_sysctls[i].name; i++)
+    {
+      const char *entry = namespaced_sysctls[i].name;
+      size_t len = strlen (entry);
+      bool match;
+
+      if (entry[len - 1] == '.')
+        match = strncmp (name, entry, len) == 0;
+      else
+        match = strcmp (name, entry) == 0;
+
+      if (! match)
+        continue;
+
+      if ((namespaces & namespaced_sysctls[i].namespace) == 0)
+        return crun_make_error (err, 0, "the sysctl `%s` requires a new %s namespace", name,
+                                namespaced_sysctls[i].namespace_name);
+      return 0;
+    }
+
+  for (it = path; *it; it++)
+    if (*it == '.')
+      *it = '/';
+
+  if (UNLIKELY (faccessat (procsysfd, path, F_OK, 0) < 0))
+    return crun_make_error (err, errno, "the sysctl `%s` cannot be accessed", name);
+
+  return 0;
+}
+
+#define SYSCTL_MAX_CACHED_DIRS 8
+
+struct sysctl_dirs_s
+{
+  int procsysfd;
+  size_t len;
+  struct
+  {
+    char *path;
+    int fd;
+  } dirs[SYSCTL_MAX_CACHED_DIRS];
+};
+
+static void
+cleanup_sysctl_dirsp (struct sysctl_dirs_s *dirs)
+{
+  size_t i;
+
+  for (i = 0; i < dirs->len; i++)
+    {
+      free (dirs->dirs[i].path);
+      close (dirs->dirs[i].fd);
+    }
+  if (dirs->procsysfd >= 0)
+    close (dirs->procsysfd);
+}
+#define cleanup_sysctl_dirs __attribute__ ((cleanup (cleanup_sysctl_dirsp)))
+
+/* Return a fd for the directory DIR under /proc/sys.  The sysctls of a
+   container are usually under few directories, e.g. net/ipv4 and
+   net/core, so each of them is opened only once.  If the cache is full
+   the fd for /proc/sys is used and the caller opens the full path.  */
+static int
+get_sysctl_dir (struct sysctl_dirs_s *dirs, const char *dir, bool *cached)
+{
+  size_t i;
+  int fd;
+
+  *cached = false;
+  for (i = 0; i < dirs->len; i++)
+    if (strcmp (dirs->dirs[i].path, dir) == 0)
+      {
+        *cached = true;
+        return dirs->dirs[i].fd;
+      }
+
+  if (dirs->len == SYSCTL_MAX_CACHED_DIRS)
+    return dirs->procsysfd;
+
+  fd = openat (dirs->procsysfd, dir, O_DIRECTORY | O_PATH | O_CLOEXEC);
+  if (fd < 0)
+    return dirs->procsysfd;
+
+  dirs->dirs[dirs->len].path = xstrdup (dir);
+  dirs->dirs[dirs->len].fd = fd;
+  dirs->len++;
+  *cached = true;
+  return fd;
+}
+
+static int
+set_sysctls (runtime_spec_schema_config_schema *def, int namespaces, libcrun_error_t *err)
 {
+  cleanup_sysctl_dirs struct sysctl_dirs_s dirs = {
+    .procsysfd = -1,
+  };
   size_t i;
-  cleanup_close int dirfd = -1;
+  int ret;
 
-  if (! def->linux || ! def->linux->sysctl)
+  if (! def->linux || ! def->linux->sysctl || def->linux->sysctl->len == 0)
     return 0;
 
-  dirfd = open ("/proc/sys", O_DIRECTORY | O_RDONLY);
-  if (UNLIKELY (dirfd < 0))
+  dirs.procsysfd = open ("/proc/sys", O_DIRECTORY | O_PATH | O_CLOEXEC);
+  if (UNLIKELY (dirs.procsysfd < 0))
     return crun_make_error (err, errno, "open /proc/sys");
 
+  /* Validate all the entries before writing any of them.  */
+  if (namespaces >= 0)
+    for (i = 0; i < def->linux->sysctl->len; i++)
+      {
+        ret = validate_sysctl (dirs.procsysfd, def->linux->sysctl->keys[i], namespaces, err);
+        if (UNLIKELY (ret < 0))
+          return ret;
+      }
+
   for (i = 0; i < def->linux->sysctl->len; i++)
     {
       cleanup_free char *name = xstrdup (def->linux->sysctl->keys[i]);
+      const char *value = def->linux->sysctl->values[i];
       cleanup_close int fd = -1;
-      int ret;
+      const char *file = name;
+      int dirfd;
       char *it;
+
       for (it = name; *it; it++)
         if (*it == '.')
           *it = '/';
 
-      fd = openat (dirfd, name, O_WRONLY);
+      dirfd = dirs.procsysfd;
+      it = strrchr (name, '/');
+      if (it)
+        {
+          bool cached;
+
+          *it = '\0';
+          dirfd = get_sysctl_dir (&dirs, name, &cached);
+          *it = '/';
+          if (cached)
+            file = it + 1;
+        }
+
+      fd = openat (dirfd, file, O_WRONLY | O_CLOEXEC);
       if (UNLIKELY (fd < 0))
         return crun_make_error (err, errno, "open /proc/sys/%s", name);
 
-      ret = TEMP_FAILURE_RETRY (write (fd, def->linux->sysctl->values[i], strlen (def->linux->sysctl->values[i])));
+      ret = TEMP_FAILURE_RETRY (write (fd, value, strlen (value)));
       if (UNLIKELY (ret < 0))
         return crun_make_error (err, errno, "write to /proc/sys/%s", name);
     }
   return 0;
 }
 
+int
+libcrun_set_sysctl_from_schema (runtime_spec_schema_config_schema *def, libcrun_error_t *err)
+{
+  return set_sysctls (def, -1, err);
+}
+
 int
 libcrun_set_sysctl (libcrun_container_t *container, libcrun_error_t *err)
 {
-  return libcrun_set_sysctl_from_schema (container->container_def, err);
+  return set_sysctls (container->container_def, get_private_data (container)->unshare_flags, err);
 }
 
 static uid_t
@@ -2906,6 +3995,47 @@ expect_success_from_sync_socket (int sync_fd, libcrun_error_t *err)
   return crun_error_wrap (err, "read from sync socket");
 }
 
+/* The status byte and the new PID are sent in a single message.  The
+   message is written by the process that forked, while the new process
+   writes to the same socket, so the new process must wait for the
+   acknowledgement before it sends anything else.  */
+static int
+send_pid_to_sync_socket (int sync_fd, pid_t pid)
+{
+  char msg[1 + sizeof (pid_t)];
+
+  msg[0] = 0;
+  memcpy (msg + 1, &pid, sizeof (pid));
+  return TEMP_FAILURE_RETRY (write (sync_fd, msg, sizeof (msg)));
+}
+
+static int
+expect_pid_from_sync_socket (int sync_fd, pid_t *pid, libcrun_error_t *err)
+{
+  cleanup_free char *err_str = NULL;
+  char msg[1 + sizeof (pid_t)];
+  int err_code;
+  int ret;
+
+  ret = TEMP_FAILURE_RETRY (read (sync_fd, msg, sizeof (msg)));
+  if (UNLIKELY (ret < 1))
+    return crun_make_error (err, errno, "read pid from sync socket");
+
+  if (msg[0] != 0)
+    {
+      if (read_error_from_sync_socket (sync_fd, &err_code, &err_str))
+        return crun_make_error (err, err_code, "%s", err_str);
+
+      return crun_error_wrap (err, "read from sync socket");
+    }
+
+  if (UNLIKELY (ret != sizeof (msg)))
+    return crun_make_error (err, 0, "read pid from sync socket");
+
+  memcpy (pid, msg + 1, sizeof (*pid));
+  return 0;
+}
+
 static int
 join_namespaces (runtime_spec_schema_config_schema *def, int *namespaces_to_join, int n_namespaces_to_join,
                  int *namespaces_to_join_index, bool ignore_join_errors, libcrun_error_t *err)
@@ -2995,6 +4125,13 @@ struct init_status_s
   /* Index in fd[] for the timens that must be joined before any
      other namespace.  */
   int idx_timens_to_join_immediately;
+
+  /* The userns at fd[userns_index] comes from the pool.  */
+  bool userns_from_pool;
+  /* The pool entry for the ID mappings of the container, and
+     the mappings it must have.  */
+  char *userns_pool_path;
+  char *userns_pool_maps;
 };
 
 void
@@ -3004,6 +4141,9 @@ cleanup_free_init_statusp (struct init_status_s *ns)
 
   for (i = 0; i < ns->fd_len; i++)
     TEMP_FAILURE_RETRY (close (ns->fd[i]));
+
+  free (ns->userns_pool_path);
+  free (ns->userns_pool_maps);
 }
 
 static int
@@ -3026,6 +4166,9 @@ configure_init_status (struct init_status_s *ns, libcrun_container_t *container,
   ns->userns_index_origin = -1;
   ns->idx_pidns_to_join_immediately = -1;
   ns->idx_timens_to_join_immediately = -1;
+  ns->userns_from_pool = false;
+  ns->userns_pool_path = NULL;
+  ns->userns_pool_maps = NULL;
 
   for (i = 0; i < def->linux->namespaces_len; i++)
     {
@@ -3072,134 +4215,439 @@ configure_init_status (struct init_status_s *ns, libcrun_container_t *container,
   return 0;
 }
 
-/* Detect if root is available in the container.  */
-static bool
-root_mapped_in_container_p (runtime_spec_schema_defs_id_mapping **mappings, size_t len)
+#ifndef NS_GET_NSTYPE
+#  define NS_GET_NSTYPE _IO (0xb7, 0x3)
+#endif
+
+static char *
+format_userns_pool_maps (runtime_spec_schema_config_schema *def)
 {
-  size_t i;
+  size_t i, written = 0;
+  char *maps;
 
-  for (i = 0; i < len; i++)
-    if (mappings[i]->container_id == 0)
-      return true;
+  maps = xmalloc (64 * (def->linux->uid_mappings_len + def->linux->gid_mappings_len) + 16);
 
-  return false;
+  written += sprintf (maps + written, "uid\n");
+  for (i = 0; i < def->linux->uid_mappings_len; i++)
+    written += sprintf (maps + written, "%" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+                        def->linux->uid_mappings[i]->container_id, def->linux->uid_mappings[i]->host_id,
+                        def->linux->uid_mappings[i]->size);
+
+  written += sprintf (maps + written, "gid\n");
+  for (i = 0; i < def->linux->gid_mappings_len; i++)
+    written += sprintf (maps + written, "%" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+                        def->linux->gid_mappings[i]->container_id, def->linux->gid_mappings[i]->host_id,
+                        def->linux->gid_mappings[i]->size);
+
+  return maps;
 }
 
+/* Lock the pool directory DIR.  The lock is held until the returned fd is
+   closed.  */
 static int
-set_id_init (libcrun_container_t *container, libcrun_error_t *err)
+userns_pool_lock (const char *dir, libcrun_error_t *err)
 {
-  runtime_spec_schema_config_schema *def = container->container_def;
-  uid_t uid = 0;
-  gid_t gid = 0;
+  cleanup_close int fd = -1;
   int ret;
 
-  if (def->process && def->process->user && def->linux)
-    {
-      /*
-        If it is running in a user namespace and root is not mapped
-        use the UID/GID specified for running the container.
-      */
-      bool root_mapped = false;
+  fd = open (dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "open `%s`", dir);
 
-      if (def->linux->uid_mappings_len != 0)
-        {
-          root_mapped = root_mapped_in_container_p (def->linux->uid_mappings, def->linux->uid_mappings_len);
-          if (! root_mapped)
-            uid = def->process->user->uid;
-        }
+  ret = TEMP_FAILURE_RETRY (flock (fd, LOCK_EX));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "flock `%s`", dir);
 
-      if (def->linux->gid_mappings_len != 0)
-        {
-          root_mapped = root_mapped_in_container_p (def->linux->gid_mappings, def->linux->gid_mappings_len);
-          if (! root_mapped)
-            gid = def->process->user->gid;
-        }
-    }
+  return get_and_reset (&fd);
+}
 
-  ret = setresuid (uid, uid, uid);
-  if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "setresuid to %d", uid);
+/* Record that the container ID uses the pool entry at PATH.  Each user of
+   an entry has a file named after its id in the PATH.refs directory.  */
+static int
+userns_pool_add_ref (const char *path, const char *id, libcrun_error_t *err)
+{
+  cleanup_free char *refs = NULL;
+  cleanup_free char *ref = NULL;
+  cleanup_close int fd = -1;
 
-  ret = setresgid (gid, gid, gid);
-  if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "setresgid to %d", gid);
+  xasprintf (&refs, "%s.refs", path);
+  if (UNLIKELY (mkdir (refs, 0700) < 0 && errno != EEXIST))
+    return crun_make_error (err, errno, "mkdir `%s`", refs);
+
+  xasprintf (&ref, "%s/%s", refs, id);
+  fd = open (ref, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "open `%s`", ref);
 
   return 0;
 }
 
+/* Look for a user namespace with the same ID mappings as the container in
+   the pool at $STATE_ROOT/.userns, enabled by the run.oci.userns_pool
+   annotation.  Each entry is a file where the user namespace of a previous
+   container is bind mounted, named after a hash of the mappings, and a
+   .map file with the mappings themselves.  When an entry is found, the
+   user namespace is joined instead of creating a new one and writing its
+   ID mappings.  Otherwise the path for the entry is recorded, so that the
+   user namespace created for the container is added to the pool.
+   The pool requires root, as the bind mount is done on the host.  */
 static int
-init_container (libcrun_container_t *container, int sync_socket_container, struct init_status_s *init_status,
-                libcrun_error_t *err)
+userns_pool_lookup (libcrun_container_t *container, struct init_status_s *ns, libcrun_error_t *err)
 {
   runtime_spec_schema_config_schema *def = container->container_def;
-  cleanup_close int mqueuefsfd = -1;
-  cleanup_close int procfsfd = -1;
-  pid_t pid_container = 0;
-  size_t i;
+  cleanup_free char *map_path = NULL;
+  cleanup_free char *stored = NULL;
+  cleanup_free char *dir = NULL;
+  cleanup_close int lock_fd = -1;
+  cleanup_close int fd = -1;
+  const char *annotation;
+  uint64_t hash = 14695981039346656037ULL;
+  char key[32];
+  size_t i, len;
+  int origin = -1;
   int ret;
-  const char success = 0;
 
-  if (init_status->idx_pidns_to_join_immediately >= 0 || init_status->idx_timens_to_join_immediately >= 0)
-    {
-      pid_t new_pid;
+  annotation = find_annotation (container, "run.oci.userns_pool");
+  if (annotation == NULL || strcmp (annotation, "true") != 0)
+    return 0;
 
-      if (init_status->idx_pidns_to_join_immediately >= 0)
-        {
-          ret = setns (init_status->fd[init_status->idx_pidns_to_join_immediately], CLONE_NEWPID);
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "cannot setns to target pidns");
+  if (container->host_uid || (ns->namespaces_to_unshare & CLONE_NEWUSER) == 0 || ns->fd_len >= MAX_NAMESPACES
+      || def->linux->uid_mappings_len == 0 || def->linux->gid_mappings_len == 0)
+    return 0;
 
-          close_and_reset (&init_status->fd[init_status->idx_pidns_to_join_immediately]);
-        }
+  for (i = 0; i < def->linux->namespaces_len; i++)
+    if (def->linux->namespaces[i]->path == NULL
+        && libcrun_find_namespace (def->linux->namespaces[i]->type) == CLONE_NEWUSER)
+      origin = i;
+  if (origin < 0)
+    return 0;
 
-      if (init_status->idx_timens_to_join_immediately >= 0)
-        {
-          ret = setns (init_status->fd[init_status->idx_timens_to_join_immediately], CLONE_NEWTIME);
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "cannot setns to target timens");
+  dir = libcrun_get_state_directory (container->context->state_root, ".userns");
+  if (UNLIKELY (dir == NULL))
+    return crun_make_error (err, 0, "cannot get the user namespaces pool directory");
 
-          close_and_reset (&init_status->fd[init_status->idx_timens_to_join_immediately]);
-        }
+  ret = crun_ensure_directory (dir, 0700, false, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-      new_pid = fork ();
-      if (UNLIKELY (new_pid < 0))
-        return crun_make_error (err, errno, "fork");
+  ns->userns_pool_maps = format_userns_pool_maps (def);
 
-      if (new_pid)
-        {
-          /* Report the new PID to the parent and exit immediately.  */
-          ret = TEMP_FAILURE_RETRY (write (sync_socket_container, &success, 1));
-          if (UNLIKELY (ret < 0))
-            kill (new_pid, SIGKILL);
+  /* FNV-1a.  */
+  for (i = 0; ns->userns_pool_maps[i]; i++)
+    hash = (hash ^ (unsigned char) ns->userns_pool_maps[i]) * 1099511628211ULL;
+  sprintf (key, "%016" PRIx64, hash);
 
-          ret = TEMP_FAILURE_RETRY (write (sync_socket_container, &new_pid, sizeof (new_pid)));
-          if (UNLIKELY (ret < 0))
-            kill (new_pid, SIGKILL);
+  ret = append_paths (&ns->userns_pool_path, err, dir, key, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
 
-          _exit (0);
-        }
+  /* The entry must not be removed before the reference is added.  */
+  lock_fd = userns_pool_lock (dir, err);
+  if (UNLIKELY (lock_fd < 0))
+    return lock_fd;
 
-      /* In the new processs.  Wait for the parent to receive the new PID.  */
-      ret = expect_success_from_sync_socket (sync_socket_container, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+  fd = open (ns->userns_pool_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      if (errno == ENOENT)
+        return 0;
+      return crun_make_error (err, errno, "open `%s`", ns->userns_pool_path);
     }
 
-  ret = libcrun_set_oom (container, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  /* Until the user namespace is bind mounted, the entry is a regular file.  */
+  if (ioctl (fd, NS_GET_NSTYPE) != CLONE_NEWUSER)
+    return 0;
 
-  if (init_status->fd_len > 0)
+  xasprintf (&map_path, "%s.map", ns->userns_pool_path);
+  ret = read_all_file (map_path, &stored, &len, err);
+  if (UNLIKELY (ret < 0))
     {
-      ret = join_namespaces (def, init_status->fd, init_status->fd_len, init_status->index, true, err);
-      if (UNLIKELY (ret < 0))
-        return ret;
+      crun_error_release (err);
+      return 0;
     }
 
-  /* If the container needs to join an existing PID namespace, take a reference to it
-     before creating a new user namespace, as we could lose the access to the existing
-     namespace.  */
-  if ((init_status->all_namespaces & CLONE_NEWUSER) && (init_status->join_pidns || init_status->join_ipcns))
+  if (len != strlen (ns->userns_pool_maps) || memcmp (stored, ns->userns_pool_maps, len) != 0)
+    return 0;
+
+  ret = userns_pool_add_ref (ns->userns_pool_path, container->context->id, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ns->userns_from_pool = true;
+  ns->namespaces_to_unshare &= ~CLONE_NEWUSER;
+  ns->userns_index = ns->fd_len;
+  ns->userns_index_origin = origin;
+  ns->fd[ns->fd_len] = fd;
+  ns->index[ns->fd_len] = origin;
+  ns->value[ns->fd_len] = CLONE_NEWUSER;
+  ns->fd_len++;
+  ns->fd[ns->fd_len] = -1;
+  fd = -1;
+
+  return 0;
+}
+
+/* Add the user namespace of PID, with its ID mappings already written, to
+   the pool, with a reference for CONTAINER.  If another container added the
+   same entry first, leave it to that one.  Errors are not fatal, the
+   container can run anyway.  */
+static void
+userns_pool_store (libcrun_container_t *container, struct init_status_s *ns, pid_t pid)
+{
+  cleanup_free char *map_path = NULL;
+  cleanup_free char *dir = NULL;
+  cleanup_close int lock_fd = -1;
+  libcrun_error_t tmp_err = NULL;
+  char ns_path[64];
+  int ret;
+
+  dir = libcrun_get_state_directory (container->context->state_root, ".userns");
+  if (UNLIKELY (dir == NULL))
+    return;
+
+  lock_fd = userns_pool_lock (dir, &tmp_err);
+  if (UNLIKELY (lock_fd < 0))
+    goto fail_warn;
+
+  ret = open (ns->userns_pool_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (ret < 0)
+    return;
+  close (ret);
+
+  xasprintf (&map_path, "%s.map", ns->userns_pool_path);
+  ret = write_file (map_path, ns->userns_pool_maps, strlen (ns->userns_pool_maps), &tmp_err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  sprintf (ns_path, "/proc/%d/ns/user", pid);
+  ret = mount (ns_path, ns->userns_pool_path, NULL, MS_BIND, NULL);
+  if (UNLIKELY (ret < 0))
+    {
+      crun_make_error (&tmp_err, errno, "bind mount `%s` to `%s`", ns_path, ns->userns_pool_path);
+      goto fail;
+    }
+
+  ret = userns_pool_add_ref (ns->userns_pool_path, container->context->id, &tmp_err);
+  if (UNLIKELY (ret < 0))
+    {
+      umount2 (ns->userns_pool_path, MNT_DETACH);
+      goto fail;
+    }
+
+  return;
+
+fail:
+  unlink (map_path);
+  unlink (ns->userns_pool_path);
+fail_warn:
+  libcrun_warning ("cannot add the user namespace to the pool: %s", tmp_err->msg);
+  crun_error_release (&tmp_err);
+}
+
+/* Drop the reference of the container ID to its entry in the user
+   namespaces pool under STATE_ROOT, if any.  The entries without any
+   reference left are unmounted and removed.  */
+int
+libcrun_userns_pool_release (const char *state_root, const char *id, libcrun_error_t *err)
+{
+  cleanup_free char *dir = NULL;
+  cleanup_close int lock_fd = -1;
+  cleanup_dir DIR *pool = NULL;
+  struct dirent *de;
+
+  dir = libcrun_get_state_directory (state_root, ".userns");
+  if (UNLIKELY (dir == NULL))
+    return crun_make_error (err, 0, "cannot get the user namespaces pool directory");
+
+  lock_fd = userns_pool_lock (dir, err);
+  if (UNLIKELY (lock_fd < 0))
+    {
+      if (crun_error_get_errno (err) != ENOENT)
+        return lock_fd;
+      crun_error_release (err);
+      return 0;
+    }
+
+  pool = fdopendir (dup (lock_fd));
+  if (UNLIKELY (pool == NULL))
+    return crun_make_error (err, errno, "opendir `%s`", dir);
+
+  for (de = readdir (pool); de; de = readdir (pool))
+    {
+      cleanup_free char *entry = NULL;
+      cleanup_free char *path = NULL;
+      cleanup_close int refs_fd = -1;
+      cleanup_dir DIR *refs = NULL;
+      struct dirent *it;
+      bool in_use = false;
+      size_t len;
+
+      len = strlen (de->d_name);
+      if (len <= 5 || strcmp (de->d_name + len - 5, ".refs") != 0)
+        continue;
+
+      refs_fd = openat (dirfd (pool), de->d_name, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+      if (refs_fd < 0)
+        continue;
+
+      if (unlinkat (refs_fd, id, 0) < 0)
+        continue;
+
+      refs = fdopendir (get_and_reset (&refs_fd));
+      if (UNLIKELY (refs == NULL))
+        return crun_make_error (err, errno, "opendir `%s/%s`", dir, de->d_name);
+
+      for (it = readdir (refs); it; it = readdir (refs))
+        if (strcmp (it->d_name, ".") != 0 && strcmp (it->d_name, "..") != 0)
+          {
+            in_use = true;
+            break;
+          }
+
+      if (in_use)
+        continue;
+
+      entry = xstrdup (de->d_name);
+      entry[len - 5] = '\0';
+      xasprintf (&path, "%s/%s", dir, entry);
+
+      if (UNLIKELY (umount2 (path, MNT_DETACH) < 0 && errno != EINVAL && errno != ENOENT))
+        return crun_make_error (err, errno, "umount `%s`", path);
+
+      unlinkat (dirfd (pool), entry, 0);
+      free (path);
+      xasprintf (&path, "%s.map", entry);
+      unlinkat (dirfd (pool), path, 0);
+      unlinkat (dirfd (pool), de->d_name, AT_REMOVEDIR);
+    }
+
+  return 0;
+}
+
+/* Detect if root is available in the container.  */
+static bool
+root_mapped_in_container_p (runtime_spec_schema_defs_id_mapping **mappings, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    if (mappings[i]->container_id == 0)
+      return true;
+
+  return false;
+}
+
+static int
+set_id_init (libcrun_container_t *container, libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+  uid_t uid = 0;
+  gid_t gid = 0;
+  int ret;
+
+  if (def->process && def->process->user && def->linux)
+    {
+      /*
+        If it is running in a user namespace and root is not mapped
+        use the UID/GID specified for running the container.
+      */
+      bool root_mapped = false;
+
+      if (def->linux->uid_mappings_len != 0)
+        {
+          root_mapped = root_mapped_in_container_p (def->linux->uid_mappings, def->linux->uid_mappings_len);
+          if (! root_mapped)
+            uid = def->process->user->uid;
+        }
+
+      if (def->linux->gid_mappings_len != 0)
+        {
+          root_mapped = root_mapped_in_container_p (def->linux->gid_mappings, def->linux->gid_mappings_len);
+          if (! root_mapped)
+            gid = def->process->user->gid;
+        }
+    }
+
+  ret = setresuid (uid, uid, uid);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "setresuid to %d", uid);
+
+  ret = setresgid (gid, gid, gid);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "setresgid to %d", gid);
+
+  return 0;
+}
+
+static int
+init_container (libcrun_container_t *container, int sync_socket_container, struct init_status_s *init_status,
+                libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+  cleanup_close int mqueuefsfd = -1;
+  cleanup_close int procfsfd = -1;
+  pid_t pid_container = 0;
+  size_t i;
+  int ret;
+  const char success = 0;
+
+  if (init_status->idx_pidns_to_join_immediately >= 0 || init_status->idx_timens_to_join_immediately >= 0)
+    {
+      pid_t new_pid;
+
+      if (init_status->idx_pidns_to_join_immediately >= 0)
+        {
+          ret = setns (init_status->fd[init_status->idx_pidns_to_join_immediately], CLONE_NEWPID);
+          if (UNLIKELY (ret < 0))
+            return crun_make_error (err, errno, "cannot setns to target pidns");
+
+          close_and_reset (&init_status->fd[init_status->idx_pidns_to_join_immediately]);
+        }
+
+      if (init_status->idx_timens_to_join_immediately >= 0)
+        {
+          ret = setns (init_status->fd[init_status->idx_timens_to_join_immediately], CLONE_NEWTIME);
+          if (UNLIKELY (ret < 0))
+            return crun_make_error (err, errno, "cannot setns to target timens");
+
+          close_and_reset (&init_status->fd[init_status->idx_timens_to_join_immediately]);
+        }
+
+      new_pid = fork ();
+      if (UNLIKELY (new_pid < 0))
+        return crun_make_error (err, errno, "fork");
+
+      if (new_pid)
+        {
+          /* Report the new PID to the parent and exit immediately.  */
+          ret = send_pid_to_sync_socket (sync_socket_container, new_pid);
+          if (UNLIKELY (ret < 0))
+            kill (new_pid, SIGKILL);
+
+          _exit (0);
+        }
+
+      /* In the new processs.  Wait for the parent to receive the new PID.  */
+      ret = expect_success_from_sync_socket (sync_socket_container, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  ret = libcrun_set_oom (container, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (init_status->fd_len > 0)
+    {
+      ret = join_namespaces (def, init_status->fd, init_status->fd_len, init_status->index, true, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  /* If the container needs to join an existing PID namespace, take a reference to it
+     before creating a new user namespace, as we could lose the access to the existing
+     namespace.  */
+  if ((init_status->all_namespaces & CLONE_NEWUSER) && (init_status->join_pidns || init_status->join_ipcns))
     {
       for (i = 0; i < def->mounts_len; i++)
         {
@@ -3235,14 +4683,29 @@ init_container (libcrun_container_t *container, int sync_socket_container, struc
           ret = TEMP_FAILURE_RETRY (read (sync_socket_container, &tmp, 1));
           if (UNLIKELY (ret < 0))
             return crun_make_error (err, errno, "read from sync socket");
+
+          ret = receive_idmapped_mounts (container, sync_socket_container, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
         }
       else
         {
+          /* The user namespace from the pool has the same mappings that would
+             be written for a new one, so the idmapped mounts can use it too.  */
+          if (init_status->userns_from_pool)
+            {
+              ret = receive_idmapped_mounts (container, sync_socket_container, err);
+              if (UNLIKELY (ret < 0))
+                return ret;
+            }
+
           /* If we need to join another user namespace, do it immediately before creating any other namespace. */
           ret = setns (init_status->fd[init_status->userns_index], CLONE_NEWUSER);
           if (UNLIKELY (ret < 0))
             return crun_make_error (err, errno, "cannot setns `%s`",
-                                    def->linux->namespaces[init_status->userns_index_origin]->path);
+                                    init_status->userns_from_pool
+                                        ? init_status->userns_pool_path
+                                        : def->linux->namespaces[init_status->userns_index_origin]->path);
         }
 
       ret = set_id_init (container, err);
@@ -3283,13 +4746,12 @@ init_container (libcrun_container_t *container, int sync_socket_container, struc
       /* Report back the new PID.  */
       if (pid_container)
         {
-          ret = TEMP_FAILURE_RETRY (write (sync_socket_container, &success, 1));
+          ret = send_pid_to_sync_socket (sync_socket_container, pid_container);
           if (UNLIKELY (ret < 0))
-            return ret;
-
-          ret = TEMP_FAILURE_RETRY (write (sync_socket_container, &pid_container, sizeof (pid_container)));
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "write to sync socket");
+            {
+              kill (pid_container, SIGKILL);
+              return crun_make_error (err, errno, "write to sync socket");
+            }
 
           _exit (EXIT_SUCCESS);
         }
@@ -3311,7 +4773,7 @@ init_container (libcrun_container_t *container, int sync_socket_container, struc
 
 pid_t
 libcrun_run_linux_container (libcrun_container_t *container, container_entrypoint_t entrypoint, void *args,
-                             int *sync_socket_out, libcrun_error_t *err)
+                             int cgroup_dirfd, bool *in_cgroup, int *sync_socket_out, libcrun_error_t *err)
 {
   __attribute__ ((cleanup (cleanup_free_init_statusp))) struct init_status_s init_status;
   runtime_spec_schema_config_schema *def = container->container_def;
@@ -3355,6 +4817,10 @@ libcrun_run_linux_container (libcrun_container_t *container, container_entrypoin
 
   get_uid_gid_from_def (container->container_def, &container->container_uid, &container->container_gid);
 
+  ret = userns_pool_lookup (container, &init_status, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
   /* This must be done before we enter a user namespace.  */
   if (def->process)
     {
@@ -3419,7 +4885,17 @@ libcrun_run_linux_container (libcrun_container_t *container, container_entrypoin
       first_clone_args = init_status.namespaces_to_unshare & ~(CLONE_NEWTIME | CLONE_NEWCGROUP);
     }
 
-  pid = syscall_clone (first_clone_args | SIGCHLD, NULL);
+  /* If the cgroup was already created, create the process directly there instead of
+     moving it later.  Fallback to clone if the kernel does not support it.  */
+  pid = -1;
+  *in_cgroup = false;
+  if (cgroup_dirfd >= 0)
+    {
+      pid = syscall_clone_into_cgroup (first_clone_args, cgroup_dirfd);
+      *in_cgroup = pid >= 0;
+    }
+  if (pid < 0)
+    pid = syscall_clone (first_clone_args | SIGCHLD, NULL);
   if (UNLIKELY (pid < 0))
     return crun_make_error (err, errno, "clone");
 
@@ -3448,14 +4924,10 @@ libcrun_run_linux_container (libcrun_container_t *container, container_entrypoin
         {
           pid_t new_pid = 0;
 
-          ret = expect_success_from_sync_socket (sync_socket_host, err);
+          ret = expect_pid_from_sync_socket (sync_socket_host, &new_pid, err);
           if (UNLIKELY (ret < 0))
             return ret;
 
-          ret = TEMP_FAILURE_RETRY (read (sync_socket_host, &new_pid, sizeof (new_pid)));
-          if (UNLIKELY (ret != sizeof (new_pid)))
-            return crun_make_error (err, errno, "read pid from sync socket");
-
           /* Cleanup the first process.  */
           ret = TEMP_FAILURE_RETRY (waitpid (pid, NULL, 0));
 
@@ -3463,7 +4935,7 @@ libcrun_run_linux_container (libcrun_container_t *container, container_entrypoin
 
           ret = TEMP_FAILURE_RETRY (write (sync_socket_host, &success, 1));
           if (UNLIKELY (ret < 0))
-            return ret;
+            return crun_make_error (err, errno, "write to sync socket");
         }
 
       if (init_status.delayed_userns_create)
@@ -3475,30 +4947,43 @@ libcrun_run_linux_container (libcrun_container_t *container, container_entrypoin
 
       if ((init_status.all_namespaces & CLONE_NEWUSER) && init_status.userns_index < 0)
         {
+          uint64_t trace_start = libcrun_trace_begin ();
+
           ret = libcrun_set_usernamespace (container, pid, err);
           if (UNLIKELY (ret < 0))
             return ret;
+          libcrun_trace_end ("set-usernamespace", trace_start);
+
+          if (init_status.userns_pool_path)
+            userns_pool_store (container, &init_status, pid);
 
           ret = TEMP_FAILURE_RETRY (write (sync_socket_host, "1", 1));
           if (UNLIKELY (ret < 0))
             return crun_make_error (err, errno, "write to sync socket");
+
+          ret = send_idmapped_mounts (container, pid, -1, sync_socket_host, err);
+          if (UNLIKELY (ret < 0))
+            return ret;
+        }
+      else if (init_status.userns_from_pool)
+        {
+          ret = send_idmapped_mounts (container, pid, init_status.fd[init_status.userns_index], sync_socket_host,
+                                      err);
+          if (UNLIKELY (ret < 0))
+            return ret;
         }
 
       if (init_status.must_fork)
         {
           pid_t grandchild = 0;
 
-          ret = expect_success_from_sync_socket (sync_socket_host, err);
+          ret = expect_pid_from_sync_socket (sync_socket_host, &grandchild, err);
           if (UNLIKELY (ret < 0))
             return ret;
 
-          ret = TEMP_FAILURE_RETRY (read (sync_socket_host, &grandchild, sizeof (grandchild)));
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "read pid from sync socket");
-
           ret = TEMP_FAILURE_RETRY (write (sync_socket_host, &success, 1));
           if (UNLIKELY (ret < 0))
-            return ret;
+            return crun_make_error (err, errno, "write to sync socket");
 
           /* Cleanup the first process.  */
           waitpid (pid, NULL, 0);
@@ -3556,8 +5041,8 @@ libcrun_run_linux_container (libcrun_container_t *container, container_entrypoin
 }
 
 static int
-join_process_parent_helper (pid_t child_pid, int sync_socket_fd, libcrun_container_status_t *status, int *terminal_fd,
-                            libcrun_error_t *err)
+join_process_parent_helper (pid_t child_pid, int sync_socket_fd, libcrun_container_status_t *status,
+                            bool in_cgroup, int *terminal_fd, libcrun_error_t *err)
 {
   int ret, pid_status;
   char res;
@@ -3584,9 +5069,16 @@ join_process_parent_helper (pid_t child_pid, int sync_socket_fd, libcrun_contain
   if (UNLIKELY (ret < 0))
     return crun_make_error (err, errno, "waitpid for exec child pid");
 
-  ret = libcrun_move_process_to_cgroup (pid, status->pid, status->cgroup_path, err);
-  if (UNLIKELY (ret < 0))
-    return ret;
+  /* If the child was created in the container cgroup, the grandchild is
+     already there.  */
+  if (in_cgroup)
+    ret = 0;
+  else
+    {
+      ret = libcrun_move_process_to_cgroup (pid, status->pid, status->cgroup_path, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
 
   /* The write unblocks the grandchild process so it can run once we setup
      the cgroups.  */
@@ -3613,6 +5105,51 @@ join_process_parent_helper (pid_t child_pid, int sync_socket_fd, libcrun_contain
   return pid;
 }
 
+/* Join all the namespaces of the container with a single setns on a
+   pidfd.  Like the loop on /proc/PID/ns/ used otherwise, join every
+   namespace of the init that differs from ours, not only the ones listed
+   in the configuration.  It fails atomically, so if it is not supported
+   the namespaces can still be joined one by one.  */
+static bool
+join_namespaces_from_pidfd (pid_t pid_to_join)
+{
+  cleanup_close int pidfd = -1;
+  int flags = 0;
+  size_t i;
+
+  for (i = 0; namespaces[i].ns_file; i++)
+    {
+      cleanup_free char *ns_join = NULL;
+      cleanup_free char *ns_self = NULL;
+      struct stat st_join, st_self;
+
+      xasprintf (&ns_join, "/proc/%d/ns/%s", pid_to_join, namespaces[i].ns_file);
+      xasprintf (&ns_self, "/proc/self/ns/%s", namespaces[i].ns_file);
+      if (stat (ns_join, &st_join) < 0)
+        {
+          /* If the namespace doesn't exist, just ignore it.  */
+          if (errno == ENOENT)
+            continue;
+          return false;
+        }
+      if (stat (ns_self, &st_self) < 0)
+        return false;
+
+      /* setns fails with EINVAL on the user namespace we are already in.  */
+      if (st_join.st_dev != st_self.st_dev || st_join.st_ino != st_self.st_ino)
+        flags |= namespaces[i].value;
+    }
+
+  if (flags == 0)
+    return false;
+
+  pidfd = syscall_pidfd_open (pid_to_join, 0);
+  if (pidfd < 0)
+    return false;
+
+  return setns (pidfd, flags) == 0;
+}
+
 int
 libcrun_join_process (libcrun_container_t *container, pid_t pid_to_join, libcrun_container_status_t *status, int detach,
                       int *terminal_fd, libcrun_error_t *err)
@@ -3629,6 +5166,8 @@ libcrun_join_process (libcrun_container_t *container, pid_t pid_to_join, libcrun
   runtime_spec_schema_config_schema *def = container->container_def;
   size_t i;
   cleanup_close int sync_fd = -1;
+  cleanup_close int cgroup_fd = -1;
+  bool in_cgroup = false;
 
   if (! detach)
     {
@@ -3641,7 +5180,22 @@ libcrun_join_process (libcrun_container_t *container, pid_t pid_to_join, libcrun
   if (UNLIKELY (ret < 0))
     return crun_make_error (err, errno, "error creating socketpair");
 
-  pid = fork ();
+  /* Try to create the child directly in the container cgroup, so that it
+     doesn't need to be moved there later.  On any error fall back to
+     writing to cgroup.procs.  */
+  ret = libcrun_open_init_cgroup (status->pid, status->cgroup_path, &cgroup_fd, err);
+  if (UNLIKELY (ret < 0))
+    crun_error_release (err);
+
+  pid = -1;
+  if (cgroup_fd >= 0)
+    {
+      pid = syscall_clone_into_cgroup (0, cgroup_fd);
+      in_cgroup = pid >= 0;
+      close_and_reset (&cgroup_fd);
+    }
+  if (pid < 0)
+    pid = fork ();
   if (UNLIKELY (pid < 0))
     {
       crun_make_error (err, errno, "fork");
@@ -3651,7 +5205,7 @@ libcrun_join_process (libcrun_container_t *container, pid_t pid_to_join, libcrun
     {
       close_and_reset (&sync_socket_fd[1]);
       sync_fd = sync_socket_fd[0];
-      return join_process_parent_helper (pid, sync_fd, status, terminal_fd, err);
+      return join_process_parent_helper (pid, sync_fd, status, in_cgroup, terminal_fd, err);
     }
 
   close_and_reset (&sync_socket_fd[0]);
@@ -3663,6 +5217,9 @@ libcrun_join_process (libcrun_container_t *container, pid_t pid_to_join, libcrun
       goto exit;
     }
 
+  if (join_namespaces_from_pidfd (pid_to_join))
+    goto namespaces_joined;
+
   for (i = 0; namespaces[i].ns_file; i++)
     {
       cleanup_free char *ns_join = NULL;
@@ -3726,6 +5283,7 @@ libcrun_join_process (libcrun_container_t *container, pid_t pid_to_join, libcrun
   for (i = 0; namespaces[i].ns_file; i++)
     close_and_reset (&fds[i]);
 
+namespaces_joined:
   if (setsid () < 0)
     {
       crun_make_error (err, errno, "setsid");
@@ -3882,6 +5440,103 @@ libcrun_set_personality (runtime_spec_schema_defs_linux_personality *p, libcrun_
   return 0;
 }
 
+static bool
+is_proc_subpath (const char *path)
+{
+  return has_prefix (path, "/proc/");
+}
+
+/* Mask or make read-only PATH under the /proc of a container forked from
+   a template.  It runs after pivot_root, so the paths are absolute.  */
+static int
+template_instance_mask_proc_path (const char *path, bool readonly, const char *mount_label, libcrun_error_t *err)
+{
+  const unsigned long proc_flags = MS_NOSUID | MS_NODEV | MS_NOEXEC;
+  cleanup_free char *options = NULL;
+  struct stat st;
+  int ret;
+
+  if (stat (path, &st) < 0)
+    {
+      if (errno == ENOENT || errno == EACCES)
+        return 0;
+      return crun_make_error (err, errno, "stat `%s`", path);
+    }
+
+  if (readonly)
+    {
+      ret = mount (path, path, NULL, MS_BIND | MS_REC, NULL);
+      if (LIKELY (ret == 0))
+        ret = mount (NULL, path, NULL, MS_BIND | MS_REMOUNT | MS_RDONLY | proc_flags, NULL);
+    }
+  else if (S_ISDIR (st.st_mode))
+    {
+      if (mount_label)
+        xasprintf (&options, "size=0k,context=\"%s\"", mount_label);
+      ret = mount ("tmpfs", path, "tmpfs", MS_RDONLY, options ? options : "size=0k");
+    }
+  else
+    ret = mount ("/dev/null", path, NULL, MS_BIND, NULL);
+
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "mount `%s`", path);
+  return 0;
+}
+
+/* Mount a new /proc for the PID namespace of a container forked from a
+   template.  The masked and read-only paths under the old /proc are
+   unmounted first: in a user namespace the kernel mounts a new procfs
+   only if an existing one is fully visible.  They are applied again on
+   the new /proc.  */
+int
+libcrun_template_instance_mount_proc (libcrun_container_t *container, libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+  const char *mount_label = def->linux ? def->linux->mount_label : NULL;
+  struct statfs sfs;
+  size_t i, j;
+  int ret;
+
+  if (statfs ("/proc", &sfs) < 0 || sfs.f_type != PROC_SUPER_MAGIC)
+    return 0;
+
+  if (def->linux)
+    {
+      for (i = def->linux->readonly_paths_len; i > 0; i--)
+        if (is_proc_subpath (def->linux->readonly_paths[i - 1]))
+          for (j = 0; j < 8 && umount2 (def->linux->readonly_paths[i - 1], MNT_DETACH) == 0; j++)
+            ;
+      for (i = def->linux->masked_paths_len; i > 0; i--)
+        if (is_proc_subpath (def->linux->masked_paths[i - 1]))
+          for (j = 0; j < 8 && umount2 (def->linux->masked_paths[i - 1], MNT_DETACH) == 0; j++)
+            ;
+    }
+
+  ret = mount ("proc", "/proc", "proc", MS_NOSUID | MS_NODEV | MS_NOEXEC, NULL);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "mount `/proc`");
+
+  if (def->linux == NULL)
+    return 0;
+
+  for (i = 0; i < def->linux->masked_paths_len; i++)
+    if (is_proc_subpath (def->linux->masked_paths[i]))
+      {
+        ret = template_instance_mask_proc_path (def->linux->masked_paths[i], false, mount_label, err);
+        if (UNLIKELY (ret < 0))
+          return ret;
+      }
+  for (i = 0; i < def->linux->readonly_paths_len; i++)
+    if (is_proc_subpath (def->linux->readonly_paths[i]))
+      {
+        ret = template_instance_mask_proc_path (def->linux->readonly_paths[i], true, mount_label, err);
+        if (UNLIKELY (ret < 0))
+          return ret;
+      }
+
+  return 0;
+}
+
 int
 libcrun_configure_network (libcrun_container_t *container, libcrun_error_t *err)
 {
@@ -3952,18 +5607,25 @@ libcrun_container_restore_linux (libcrun_container_status_t *status, libcrun_con
   return 0;
 }
 
+/* Send SIGNAL to the container init process.  If PIDFD_OUT is not NULL, it
+   is set to the pidfd used to send the signal, or to -1 if pidfds are not
+   supported, so that the caller can wait for the process to exit.  */
 int
-libcrun_kill_linux (libcrun_container_status_t *status, int signal, libcrun_error_t *err)
+libcrun_kill_linux_with_pidfd (libcrun_container_status_t *status, int signal, int *pidfd_out, libcrun_error_t *err)
 {
   int ret;
   cleanup_close int pidfd = -1;
 
+  if (pidfd_out)
+    *pidfd_out = -1;
+
   pidfd = syscall_pidfd_open (status->pid, 0);
   if (UNLIKELY (pidfd < 0))
     {
       /* If pidfd_open is not supported, fallback to kill.  */
       if (errno == ENOSYS)
         {
+          libcrun_metrics_count (LIBCRUN_METRIC_PIDFD_FALLBACK);
           ret = kill (status->pid, signal);
           if (UNLIKELY (ret < 0))
             return crun_make_error (err, errno, "kill container");
@@ -3987,9 +5649,18 @@ libcrun_kill_linux (libcrun_container_status_t *status, int signal, libcrun_erro
   if (UNLIKELY (ret < 0))
     return crun_make_error (err, errno, "send signal to pidfd");
 
+  if (pidfd_out)
+    *pidfd_out = get_and_reset (&pidfd);
+
   return 0;
 }
 
+int
+libcrun_kill_linux (libcrun_container_status_t *status, int signal, libcrun_error_t *err)
+{
+  return libcrun_kill_linux_with_pidfd (status, signal, NULL, err);
+}
+
 /*
    Used when creating an intermediate user namespace.
    If the container is running with a single UID/GID mapped, and specifies
@@ -4101,3 +5772,281 @@ libcrun_create_final_userns (libcrun_container_t *container, libcrun_error_t *er
 
   return 0;
 }
+
+#ifndef MPOL_PREFERRED
+#  define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_BIND
+#  define MPOL_BIND 2
+#endif
+
+#define MAX_NUMA_NODES LIBCRUN_MAX_NUMA_NODES
+#define BITS_PER_ULONG (8 * sizeof (unsigned long))
+
+/* Parse a list in the cpuset format, e.g. "0-3,8,10-11", into MASK.  */
+static int
+parse_range_list (const char *list, unsigned long *mask, size_t max, libcrun_error_t *err)
+{
+  const char *it = list;
+
+  while (*it)
+    {
+      unsigned long start, end;
+      char *endptr;
+
+      errno = 0;
+      start = end = strtoul (it, &endptr, 10);
+      if (endptr == it || errno)
+        return crun_make_error (err, EINVAL, "invalid range list `%s`", list);
+
+      if (*endptr == '-')
+        {
+          it = endptr + 1;
+          end = strtoul (it, &endptr, 10);
+          if (endptr == it || errno || end < start)
+            return crun_make_error (err, EINVAL, "invalid range list `%s`", list);
+        }
+
+      if (end >= max)
+        return crun_make_error (err, EINVAL, "value out of range in `%s`", list);
+
+      for (; start <= end; start++)
+        mask[start / BITS_PER_ULONG] |= 1UL << (start % BITS_PER_ULONG);
+
+      if (*endptr == ',')
+        endptr++;
+      else if (*endptr != '\0')
+        return crun_make_error (err, EINVAL, "invalid range list `%s`", list);
+      it = endptr;
+    }
+  return 0;
+}
+
+/* Find the NUMA nodes that contain any of the CPUS.  */
+static int
+get_numa_nodes_for_cpus (const unsigned long *cpus, size_t cpus_len, unsigned long *nodes, libcrun_error_t *err)
+{
+  unsigned long online[MAX_NUMA_NODES / BITS_PER_ULONG] = {
+    0,
+  };
+  cleanup_free char *online_list = NULL;
+  libcrun_error_t tmp_err = NULL;
+  size_t node, i, len;
+  int ret;
+
+  /* The node numbers can have holes, e.g. "0-1,4", so look only at the
+     nodes that are listed as online.  */
+  ret = read_all_file ("/sys/devices/system/node/online", &online_list, &len, &tmp_err);
+  if (ret < 0)
+    {
+      /* No NUMA information.  */
+      crun_error_release (&tmp_err);
+      return 0;
+    }
+  while (len > 0 && online_list[len - 1] == '\n')
+    online_list[--len] = '\0';
+
+  ret = parse_range_list (online_list, online, MAX_NUMA_NODES, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  for (node = 0; node < MAX_NUMA_NODES; node++)
+    {
+      unsigned long node_cpus[CPU_SETSIZE / BITS_PER_ULONG] = {
+        0,
+      };
+      cleanup_free char *cpulist = NULL;
+      cleanup_free char *path = NULL;
+
+      if (! (online[node / BITS_PER_ULONG] & (1UL << (node % BITS_PER_ULONG))))
+        continue;
+
+      xasprintf (&path, "/sys/devices/system/node/node%zu/cpulist", node);
+      ret = read_all_file (path, &cpulist, &len, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      while (len > 0 && cpulist[len - 1] == '\n')
+        cpulist[--len] = '\0';
+
+      ret = parse_range_list (cpulist, node_cpus, CPU_SETSIZE, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      for (i = 0; i < cpus_len; i++)
+        if (node_cpus[i] & cpus[i])
+          {
+            nodes[node / BITS_PER_ULONG] |= 1UL << (node % BITS_PER_ULONG);
+            break;
+          }
+    }
+  return 0;
+}
+
+/* Compute the placement requested with the run.oci.numa_placement
+   annotation from the container's cpuset.  The annotation value is the
+   memory policy: "bind" to allocate only from the container's nodes, or
+   "preferred" to prefer the first of them.  It reads /sys, so it must run
+   before the process joins the container mount namespace.  */
+int
+libcrun_get_numa_placement (libcrun_container_t *container, struct libcrun_numa_placement_s *placement,
+                            libcrun_error_t *err)
+{
+  runtime_spec_schema_config_schema *def = container->container_def;
+  unsigned long cpus[CPU_SETSIZE / BITS_PER_ULONG] = {
+    0,
+  };
+  const char *annotation;
+  const char *cpus_list = NULL, *mems_list = NULL;
+  size_t i;
+  int ret;
+
+  memset (placement, 0, sizeof (*placement));
+
+  annotation = find_annotation (container, "run.oci.numa_placement");
+  if (annotation == NULL)
+    return 0;
+
+  if (strcmp (annotation, "bind") == 0)
+    placement->mode = MPOL_BIND;
+  else if (strcmp (annotation, "preferred") == 0)
+    placement->mode = MPOL_PREFERRED;
+  else
+    return crun_make_error (err, EINVAL, "invalid value for `run.oci.numa_placement`: `%s`", annotation);
+
+  if (def->linux && def->linux->resources && def->linux->resources->cpu)
+    {
+      cpus_list = def->linux->resources->cpu->cpus;
+      mems_list = def->linux->resources->cpu->mems;
+    }
+
+  if (cpus_list && cpus_list[0])
+    {
+      ret = parse_range_list (cpus_list, cpus, CPU_SETSIZE, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      CPU_ZERO (&placement->cpus);
+      for (i = 0; i < CPU_SETSIZE; i++)
+        if (cpus[i / BITS_PER_ULONG] & (1UL << (i % BITS_PER_ULONG)))
+          CPU_SET (i, &placement->cpus);
+      placement->set_cpus = true;
+    }
+
+  if (mems_list && mems_list[0])
+    ret = parse_range_list (mems_list, placement->nodes, MAX_NUMA_NODES, err);
+  else if (cpus_list && cpus_list[0])
+    ret = get_numa_nodes_for_cpus (cpus, CPU_SETSIZE / BITS_PER_ULONG, placement->nodes, err);
+  else
+    return 0;
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (placement->mode == MPOL_PREFERRED)
+    {
+      /* Keep only the first node.  */
+      for (i = 0; i < MAX_NUMA_NODES / BITS_PER_ULONG; i++)
+        if (placement->nodes[i])
+          {
+            placement->nodes[i] &= -placement->nodes[i];
+            memset (&placement->nodes[i + 1], 0, (MAX_NUMA_NODES / BITS_PER_ULONG - i - 1) * sizeof (unsigned long));
+            break;
+          }
+    }
+
+  /* No NUMA information.  */
+  for (i = 0; i < MAX_NUMA_NODES / BITS_PER_ULONG; i++)
+    if (placement->nodes[i])
+      {
+        placement->set_nodes = true;
+        break;
+      }
+
+  return 0;
+}
+
+/* Move the current process to the CPUs and memory nodes computed by
+   libcrun_get_numa_placement.  It must be called only from the container
+   process, never from crun itself.  */
+int
+libcrun_apply_numa_placement (const struct libcrun_numa_placement_s *placement, libcrun_error_t *err)
+{
+  int ret;
+
+  if (placement->set_cpus)
+    {
+      ret = sched_setaffinity (0, sizeof (placement->cpus), &placement->cpus);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "sched_setaffinity");
+    }
+
+  if (placement->set_nodes)
+    {
+      ret = syscall (__NR_set_mempolicy, placement->mode, placement->nodes, MAX_NUMA_NODES + 1);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "set_mempolicy");
+    }
+
+  return 0;
+}
+
+/* Apply the run.oci.numa_placement annotation to the current process, and so
+   to the processes it creates from now on.  */
+int
+libcrun_set_numa_placement (libcrun_container_t *container, libcrun_error_t *err)
+{
+  struct libcrun_numa_placement_s placement;
+  int ret;
+
+  ret = libcrun_get_numa_placement (container, &placement, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return libcrun_apply_numa_placement (&placement, err);
+}
+
+#ifndef PR_SET_THP_DISABLE
+#  define PR_SET_THP_DISABLE 41
+#endif
+#ifndef PR_SET_MEMORY_MERGE
+#  define PR_SET_MEMORY_MERGE 67
+#endif
+
+static int
+set_memory_policy_prctl (libcrun_container_t *container, const char *name, int option, bool invert,
+                         libcrun_error_t *err)
+{
+  const char *annotation;
+  int value, ret;
+
+  annotation = find_annotation (container, name);
+  if (annotation == NULL)
+    return 0;
+
+  if (strcmp (annotation, "enable") == 0)
+    value = 1;
+  else if (strcmp (annotation, "disable") == 0)
+    value = 0;
+  else
+    return crun_make_error (err, EINVAL, "invalid value for `%s`: `%s`", name, annotation);
+
+  ret = prctl (option, invert ? ! value : value, 0, 0, 0);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "set `%s` to `%s`", name, annotation);
+
+  return 0;
+}
+
+/* Set the transparent hugepages and KSM policy of the current process from
+   the run.oci.thp and run.oci.ksm annotations.  Both are inherited by the
+   children of the process and preserved across execve.  */
+int
+libcrun_set_memory_policy (libcrun_container_t *container, libcrun_error_t *err)
+{
+  int ret;
+
+  ret = set_memory_policy_prctl (container, "run.oci.thp", PR_SET_THP_DISABLE, true, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return set_memory_policy_prctl (container, "run.oci.ksm", PR_SET_MEMORY_MERGE, false, err);
+}
@@ -23,16 +23,28 @@
 #include "error.h"
 #include <errno.h>
 #include <argp.h>
+#include <sched.h>
 #include <runtime_spec_schema_config_schema.h>
 #include "container.h"
 #include "status.h"
 
+#define LIBCRUN_MAX_NUMA_NODES 1024
+
+struct libcrun_numa_placement_s
+{
+  int mode;
+  bool set_cpus;
+  bool set_nodes;
+  cpu_set_t cpus;
+  unsigned long nodes[LIBCRUN_MAX_NUMA_NODES / (8 * sizeof (unsigned long))];
+};
+
 typedef int (*container_entrypoint_t) (void *args, char *notify_socket, int sync_socket, libcrun_error_t *err);
 
 typedef int (*set_mounts_cb_t) (void *args, libcrun_error_t *err);
 
 pid_t libcrun_run_linux_container (libcrun_container_t *container, container_entrypoint_t entrypoint, void *args,
-                                   int *sync_socket_out, libcrun_error_t *err);
+                                   int cgroup_dirfd, bool *in_cgroup, int *sync_socket_out, libcrun_error_t *err);
 int get_notify_fd (libcrun_context_t *context, libcrun_container_t *container, int *notify_socket_out,
                    libcrun_error_t *err);
 int libcrun_set_mounts (libcrun_container_t *container, const char *rootfs, set_mounts_cb_t cb, void *cb_data, libcrun_error_t *err);
@@ -40,6 +52,7 @@ int libcrun_init_caps (libcrun_error_t *err);
 int libcrun_do_pivot_root (libcrun_container_t *container, bool no_pivot, const char *rootfs, libcrun_error_t *err);
 int libcrun_reopen_dev_null (libcrun_error_t *err);
 int libcrun_set_usernamespace (libcrun_container_t *container, pid_t pid, libcrun_error_t *err);
+int libcrun_userns_pool_release (const char *state_root, const char *id, libcrun_error_t *err);
 int libcrun_set_caps (runtime_spec_schema_config_schema_process_capabilities *capabilities, uid_t uid, gid_t gid,
                       int no_new_privileges, libcrun_error_t *err);
 int libcrun_set_rlimits (runtime_spec_schema_config_schema_process_rlimits_element **rlimits, size_t len,
@@ -61,6 +74,7 @@ int libcrun_container_unpause_linux (libcrun_container_status_t *status, libcrun
 int libcrun_container_enter_cgroup_ns (libcrun_container_t *container, libcrun_error_t *err);
 int libcrun_set_personality (runtime_spec_schema_defs_linux_personality *p, libcrun_error_t *err);
 int libcrun_configure_network (libcrun_container_t *container, libcrun_error_t *err);
+int libcrun_template_instance_mount_proc (libcrun_container_t *container, libcrun_error_t *err);
 
 int libcrun_container_checkpoint_linux (libcrun_container_status_t *status, libcrun_container_t *container,
                                         libcrun_checkpoint_restore_t *cr_options, libcrun_error_t *err);
@@ -74,6 +88,13 @@ int libcrun_container_setgroups (libcrun_container_t *container,
                                  runtime_spec_schema_config_schema_process *process,
                                  libcrun_error_t *err);
 int libcrun_kill_linux (libcrun_container_status_t *status, int signal, libcrun_error_t *err);
+int libcrun_kill_linux_with_pidfd (libcrun_container_status_t *status, int signal, int *pidfd_out,
+                                   libcrun_error_t *err);
 int libcrun_create_final_userns (libcrun_container_t *container, libcrun_error_t *err);
 int libcrun_create_kvm_device (libcrun_container_t *container, libcrun_error_t *err);
+int libcrun_set_numa_placement (libcrun_container_t *container, libcrun_error_t *err);
+int libcrun_get_numa_placement (libcrun_container_t *container, struct libcrun_numa_placement_s *placement,
+                                libcrun_error_t *err);
+int libcrun_apply_numa_placement (const struct libcrun_numa_placement_s *placement, libcrun_error_t *err);
+int libcrun_set_memory_policy (libcrun_container_t *container, libcrun_error_t *err);
 #endif
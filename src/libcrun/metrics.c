@@ -0,0 +1,324 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <config.h>
+#include "metrics.h"
+#include "trace.h"
+#include "status.h"
+#include "utils.h"
+#include <string.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* "crunmet" and the version of the layout.  The file must be removed
+   when the layout changes.  */
+#define METRICS_MAGIC 0x6372756e6d657401ULL
+
+#define METRICS_FILE ".metrics"
+#define METRICS_NAME_LEN 32
+#define METRICS_MAX_COUNTERS 16
+#define METRICS_MAX_HISTOGRAMS 64
+
+/* The last bucket has no upper bound, the others are doubling from
+   64us, up to ~33s.  */
+#define METRICS_BUCKETS 21
+#define METRICS_BUCKET_BASE_NS 64000ULL
+
+enum
+{
+  METRICS_KIND_OPERATION = 1,
+  METRICS_KIND_PHASE = 2,
+};
+
+struct metrics_histogram_s
+{
+  /* Hash of the kind and the name, 0 when the slot is free.  */
+  uint64_t key;
+  /* Set once kind and name are written.  */
+  uint32_t ready;
+  uint32_t kind;
+  char name[METRICS_NAME_LEN];
+  uint64_t failures;
+  uint64_t sum_ns;
+  uint64_t buckets[METRICS_BUCKETS];
+};
+
+struct metrics_segment_s
+{
+  uint64_t magic;
+  uint64_t counters[METRICS_MAX_COUNTERS];
+  struct metrics_histogram_s histograms[METRICS_MAX_HISTOGRAMS];
+};
+
+static const char *counter_names[LIBCRUN_METRICS_COUNTERS] = {
+  [LIBCRUN_METRIC_OPENAT2_FALLBACK] = "openat2",
+  [LIBCRUN_METRIC_COPY_FILE_RANGE_FALLBACK] = "copy_file_range",
+  [LIBCRUN_METRIC_PIDFD_FALLBACK] = "pidfd",
+};
+
+static struct metrics_segment_s *metrics;
+
+static char *
+get_metrics_path (const char *state_root, libcrun_error_t *err)
+{
+  char *path = libcrun_get_state_directory (state_root, METRICS_FILE);
+  if (UNLIKELY (path == NULL))
+    crun_make_error (err, 0, "cannot get the state directory");
+  return path;
+}
+
+int
+libcrun_metrics_open (const char *state_root, libcrun_error_t *err)
+{
+  cleanup_free char *path = NULL;
+  cleanup_close int fd = -1;
+  struct metrics_segment_s *segment;
+  uint64_t magic = 0;
+  struct stat st;
+  int ret;
+
+  path = get_metrics_path (state_root, err);
+  if (UNLIKELY (path == NULL))
+    return -1;
+
+  fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "open `%s`", path);
+
+  ret = fstat (fd, &st);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fstat `%s`", path);
+
+  /* Concurrent processes extend it to the same size, and the new space
+     reads as zeros.  */
+  if (st.st_size < (off_t) sizeof (struct metrics_segment_s))
+    {
+      ret = ftruncate (fd, sizeof (struct metrics_segment_s));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "ftruncate `%s`", path);
+    }
+
+  segment = mmap (NULL, sizeof (struct metrics_segment_s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (UNLIKELY (segment == MAP_FAILED))
+    return crun_make_error (err, errno, "mmap `%s`", path);
+
+  if (! __atomic_compare_exchange_n (&segment->magic, &magic, METRICS_MAGIC, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)
+      && magic != METRICS_MAGIC)
+    {
+      munmap (segment, sizeof (struct metrics_segment_s));
+      return crun_make_error (err, 0, "unsupported metrics format in `%s`", path);
+    }
+
+  metrics = segment;
+
+  /* The phases are measured by the tracing hooks.  */
+  libcrun_trace_active = true;
+  return 0;
+}
+
+void
+libcrun_metrics_count (int counter)
+{
+  if (metrics == NULL || counter < 0 || counter >= LIBCRUN_METRICS_COUNTERS)
+    return;
+
+  __atomic_fetch_add (&metrics->counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t
+histogram_key (int kind, const char *name)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const char *it;
+
+  /* FNV-1a.  */
+  hash = (hash ^ kind) * 0x100000001b3ULL;
+  for (it = name; *it; it++)
+    hash = (hash ^ (unsigned char) *it) * 0x100000001b3ULL;
+
+  /* 0 marks a free slot.  */
+  return hash ? hash : 1;
+}
+
+/* Find the slot for KIND and NAME, or claim a free one.  Slots are never
+   released, so a key found once stays valid.  */
+static struct metrics_histogram_s *
+get_histogram (int kind, const char *name)
+{
+  uint64_t key = histogram_key (kind, name);
+  size_t i, start = key % METRICS_MAX_HISTOGRAMS;
+
+  for (i = 0; i < METRICS_MAX_HISTOGRAMS; i++)
+    {
+      struct metrics_histogram_s *h = &metrics->histograms[(start + i) % METRICS_MAX_HISTOGRAMS];
+      uint64_t current = __atomic_load_n (&h->key, __ATOMIC_ACQUIRE);
+
+      if (current == 0)
+        {
+          if (__atomic_compare_exchange_n (&h->key, &current, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+              h->kind = kind;
+              strncpy (h->name, name, METRICS_NAME_LEN - 1);
+              __atomic_store_n (&h->ready, 1, __ATOMIC_RELEASE);
+              return h;
+            }
+        }
+      if (current == key)
+        return h;
+    }
+
+  /* The table is full, drop the value.  */
+  return NULL;
+}
+
+static void
+observe (int kind, const char *name, uint64_t duration_ns, bool failed)
+{
+  struct metrics_histogram_s *h;
+  size_t bucket;
+
+  if (metrics == NULL)
+    return;
+
+  h = get_histogram (kind, name);
+  if (h == NULL)
+    return;
+
+  for (bucket = 0; bucket < METRICS_BUCKETS - 1; bucket++)
+    if (duration_ns <= METRICS_BUCKET_BASE_NS << bucket)
+      break;
+
+  __atomic_fetch_add (&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&h->sum_ns, duration_ns, __ATOMIC_RELAXED);
+  if (failed)
+    __atomic_fetch_add (&h->failures, 1, __ATOMIC_RELAXED);
+}
+
+void
+libcrun_metrics_observe_operation (const char *name, uint64_t duration_ns, bool failed)
+{
+  observe (METRICS_KIND_OPERATION, name, duration_ns, failed);
+}
+
+void
+libcrun_metrics_observe_phase (const char *name, uint64_t duration_ns)
+{
+  observe (METRICS_KIND_PHASE, name, duration_ns, false);
+}
+
+static void
+write_histograms (FILE *out, const struct metrics_segment_s *segment, int kind, const char *metric, const char *label)
+{
+  size_t i, j;
+
+  fprintf (out, "# TYPE %s histogram\n", metric);
+  for (i = 0; i < METRICS_MAX_HISTOGRAMS; i++)
+    {
+      const struct metrics_histogram_s *h = &segment->histograms[i];
+      uint64_t total = 0;
+
+      if (! __atomic_load_n (&h->ready, __ATOMIC_ACQUIRE) || h->kind != (uint32_t) kind)
+        continue;
+
+      /* The buckets are not read atomically as a whole, so derive the
+         count from them to keep the output consistent.  */
+      for (j = 0; j < METRICS_BUCKETS; j++)
+        {
+          total += __atomic_load_n (&h->buckets[j], __ATOMIC_RELAXED);
+          if (j < METRICS_BUCKETS - 1)
+            fprintf (out, "%s_bucket{%s=\"%.*s\",le=\"%g\"} %" PRIu64 "\n", metric, label, METRICS_NAME_LEN,
+                     h->name, (METRICS_BUCKET_BASE_NS << j) / 1e9, total);
+        }
+      fprintf (out, "%s_bucket{%s=\"%.*s\",le=\"+Inf\"} %" PRIu64 "\n", metric, label, METRICS_NAME_LEN, h->name,
+               total);
+      fprintf (out, "%s_sum{%s=\"%.*s\"} %.9f\n", metric, label, METRICS_NAME_LEN, h->name,
+               __atomic_load_n (&h->sum_ns, __ATOMIC_RELAXED) / 1e9);
+      fprintf (out, "%s_count{%s=\"%.*s\"} %" PRIu64 "\n", metric, label, METRICS_NAME_LEN, h->name, total);
+    }
+}
+
+int
+libcrun_metrics_write (const char *state_root, FILE *out, libcrun_error_t *err)
+{
+  cleanup_free char *path = NULL;
+  cleanup_close int fd = -1;
+  struct metrics_segment_s *segment;
+  struct stat st;
+  size_t i;
+  int ret;
+
+  path = get_metrics_path (state_root, err);
+  if (UNLIKELY (path == NULL))
+    return -1;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (UNLIKELY (fd < 0))
+    {
+      /* Nothing was recorded yet.  */
+      if (errno == ENOENT)
+        return 0;
+      return crun_make_error (err, errno, "open `%s`", path);
+    }
+
+  ret = fstat (fd, &st);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fstat `%s`", path);
+
+  if (st.st_size < (off_t) sizeof (struct metrics_segment_s))
+    return crun_make_error (err, 0, "invalid metrics file `%s`", path);
+
+  segment = mmap (NULL, sizeof (struct metrics_segment_s), PROT_READ, MAP_SHARED, fd, 0);
+  if (UNLIKELY (segment == MAP_FAILED))
+    return crun_make_error (err, errno, "mmap `%s`", path);
+
+  if (__atomic_load_n (&segment->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC)
+    {
+      munmap (segment, sizeof (struct metrics_segment_s));
+      return crun_make_error (err, 0, "unsupported metrics format in `%s`", path);
+    }
+
+  write_histograms (out, segment, METRICS_KIND_OPERATION, "crun_operation_duration_seconds", "operation");
+
+  fprintf (out, "# TYPE crun_operation_failures_total counter\n");
+  for (i = 0; i < METRICS_MAX_HISTOGRAMS; i++)
+    {
+      const struct metrics_histogram_s *h = &segment->histograms[i];
+
+      if (! __atomic_load_n (&h->ready, __ATOMIC_ACQUIRE) || h->kind != METRICS_KIND_OPERATION)
+        continue;
+      fprintf (out, "crun_operation_failures_total{operation=\"%.*s\"} %" PRIu64 "\n", METRICS_NAME_LEN, h->name,
+               __atomic_load_n (&h->failures, __ATOMIC_RELAXED));
+    }
+
+  write_histograms (out, segment, METRICS_KIND_PHASE, "crun_phase_duration_seconds", "phase");
+
+  fprintf (out, "# TYPE crun_fallbacks_total counter\n");
+  for (i = 0; i < LIBCRUN_METRICS_COUNTERS; i++)
+    fprintf (out, "crun_fallbacks_total{fallback=\"%s\"} %" PRIu64 "\n", counter_names[i],
+             __atomic_load_n (&segment->counters[i], __ATOMIC_RELAXED));
+
+  munmap (segment, sizeof (struct metrics_segment_s));
+
+  if (UNLIKELY (ferror (out)))
+    return crun_make_error (err, errno, "write metrics");
+  return 0;
+}
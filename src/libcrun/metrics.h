@@ -0,0 +1,55 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBCRUN_METRICS_H
+#define LIBCRUN_METRICS_H
+
+#include <config.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "error.h"
+
+/* Runtime metrics shared by all the crun processes using the same state
+   root.  The counters and the latency histograms live in a file under the
+   state root that every process maps and updates with atomic operations,
+   so no locking is needed.  When metrics are not enabled, the functions
+   below do nothing.  */
+
+enum
+{
+  LIBCRUN_METRIC_OPENAT2_FALLBACK = 0,
+  LIBCRUN_METRIC_COPY_FILE_RANGE_FALLBACK,
+  LIBCRUN_METRIC_PIDFD_FALLBACK,
+  LIBCRUN_METRICS_COUNTERS,
+};
+
+/* Map the metrics of STATE_ROOT, creating them if needed.  */
+LIBCRUN_PUBLIC int libcrun_metrics_open (const char *state_root, libcrun_error_t *err);
+
+void libcrun_metrics_count (int counter);
+
+/* Record that the command NAME took DURATION_NS.  */
+LIBCRUN_PUBLIC void libcrun_metrics_observe_operation (const char *name, uint64_t duration_ns, bool failed);
+
+/* Record that the setup phase NAME took DURATION_NS.  */
+void libcrun_metrics_observe_phase (const char *name, uint64_t duration_ns);
+
+/* Write the metrics of STATE_ROOT to OUT in the Prometheus text format.  */
+LIBCRUN_PUBLIC int libcrun_metrics_write (const char *state_root, FILE *out, libcrun_error_t *err);
+
+#endif
@@ -20,6 +20,7 @@
 
 #include <config.h>
 #include "seccomp.h"
+#include "seccomp_notify.h"
 #include "linux.h"
 #include "utils.h"
 #include <string.h>
@@ -34,6 +35,8 @@
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/utsname.h>
+#include <inttypes.h>
 
 #ifdef HAVE_SECCOMP
 #  include <seccomp.h>
@@ -245,6 +248,29 @@ libcrun_apply_seccomp (int infd, int listener_receiver_fd, const char *receiver_
 #endif
 }
 
+const char *
+libcrun_seccomp_negate_operator (const char *op)
+{
+  static const char *pairs[][2] = {
+    { "SCMP_CMP_EQ", "SCMP_CMP_NE" },
+    { "SCMP_CMP_LT", "SCMP_CMP_GE" },
+    { "SCMP_CMP_LE", "SCMP_CMP_GT" },
+  };
+  size_t i;
+
+  if (op == NULL)
+    return NULL;
+
+  for (i = 0; i < sizeof (pairs) / sizeof (pairs[0]); i++)
+    {
+      if (strcmp (op, pairs[i][0]) == 0)
+        return pairs[i][1];
+      if (strcmp (op, pairs[i][1]) == 0)
+        return pairs[i][0];
+    }
+  return NULL;
+}
+
 static bool
 seccomp_action_supports_errno (const char *action)
 {
@@ -252,8 +278,344 @@ seccomp_action_supports_errno (const char *action)
          || strcmp (action, "SCMP_ACT_TRACE") == 0;
 }
 
+#ifdef HAVE_SECCOMP
+/* Syscalls handled by the seccomp notify plugins.  */
+struct notify_filters_s
+{
+  bool enabled;
+  struct run_oci_seccomp_notify_filter_s *filters;
+  size_t n_filters;
+};
+
+static void
+cleanup_notify_filtersp (void *p)
+{
+  struct notify_filters_s *f = p;
+
+  libcrun_free_seccomp_notify_filters (f->filters, f->n_filters);
+}
+#  define cleanup_notify_filters __attribute__ ((cleanup (cleanup_notify_filtersp)))
+
+/* If the notifications are handled by the plugins and all of them declare
+   the syscalls they handle, only those are notified.  */
+static int
+get_notify_filters (libcrun_container_t *container, runtime_spec_schema_config_linux_seccomp *seccomp,
+                    struct notify_filters_s *out, libcrun_error_t *err)
+{
+  const char *plugins;
+  int ret;
+
+  plugins = find_annotation (container, "run.oci.seccomp.plugins");
+  if (plugins == NULL)
+    return 0;
+
+  /* The listener is sent to another process, that might want everything.  */
+  if (seccomp->listener_path || find_annotation (container, "run.oci.seccomp.receiver")
+      || getenv ("RUN_OCI_SECCOMP_RECEIVER"))
+    return 0;
+
+  ret = libcrun_get_seccomp_notify_plugins_filters (plugins, &out->filters, &out->n_filters, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  out->enabled = ret > 0;
+  return 0;
+}
+
+#  ifdef SCMP_ACT_NOTIFY
+static int
+make_notify_arg_cmp (struct run_oci_seccomp_notify_filter_s *filter, size_t k, const char *op,
+                     struct scmp_arg_cmp *arg_cmp, libcrun_error_t *err)
+{
+  arg_cmp->arg = filter->args[k].index;
+  arg_cmp->op = get_seccomp_operator (op, err);
+  if (arg_cmp->op == 0)
+    return crun_make_error (err, 0, "get_seccomp_operator");
+  arg_cmp->datum_a = filter->args[k].value;
+  arg_cmp->datum_b = filter->args[k].value_two;
+  return 0;
+}
+
+/* Add the rules for SYSCALL, that the profile wants to notify, restricted
+   to what the plugins handle.  The calls that no plugin handles get ENOTSUP
+   right away, which is what the plugins would answer.  When the calls not
+   matching the conditions of the plugins cannot be expressed as a single
+   rule, the whole syscall is notified as the profile asks.  */
+static int
+add_notify_rules (scmp_filter_ctx ctx, int syscall, uint32_t default_action, struct notify_filters_s *notify_filters,
+                  libcrun_error_t *err)
+{
+  struct run_oci_seccomp_notify_filter_s *match = NULL;
+  struct scmp_arg_cmp arg_cmp[RUN_OCI_SECCOMP_NOTIFY_MAX_ARGS];
+  const char *negated_op = NULL;
+  size_t i, k, found = 0;
+  int ret;
+
+  for (i = 0; i < notify_filters->n_filters; i++)
+    {
+      struct run_oci_seccomp_notify_filter_s *filter = &notify_filters->filters[i];
+
+      if (seccomp_syscall_resolve_name (filter->name) != syscall)
+        continue;
+
+      match = filter;
+      found++;
+      if (filter->n_args == 0)
+        {
+          ret = seccomp_rule_add (ctx, SCMP_ACT_NOTIFY, syscall, 0);
+          if (UNLIKELY (ret < 0))
+            return crun_make_error (err, -ret, "seccomp_rule_add `%s`", filter->name);
+          return 0;
+        }
+    }
+
+  if (found == 0)
+    {
+      if (SCMP_ACT_ERRNO (ENOTSUP) == default_action)
+        return 0;
+
+      ret = seccomp_rule_add (ctx, SCMP_ACT_ERRNO (ENOTSUP), syscall, 0);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, -ret, "seccomp_rule_add");
+      return 0;
+    }
+
+  /* A single condition can be negated, so that the other calls get ENOTSUP
+     instead of the default action of the profile.  */
+  if (found == 1 && match->n_args == 1)
+    negated_op = libcrun_seccomp_negate_operator (match->args[0].op);
+
+  if (negated_op == NULL)
+    {
+      ret = seccomp_rule_add (ctx, SCMP_ACT_NOTIFY, syscall, 0);
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, -ret, "seccomp_rule_add `%s`", match->name);
+      return 0;
+    }
+
+  for (k = 0; k < match->n_args; k++)
+    {
+      ret = make_notify_arg_cmp (match, k, match->args[k].op, &arg_cmp[k], err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  ret = seccomp_rule_add_array (ctx, SCMP_ACT_NOTIFY, syscall, k, arg_cmp);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, -ret, "seccomp_rule_add_array `%s`", match->name);
+
+  if (SCMP_ACT_ERRNO (ENOTSUP) == default_action)
+    return 0;
+
+  ret = make_notify_arg_cmp (match, 0, negated_op, &arg_cmp[0], err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = seccomp_rule_add_array (ctx, SCMP_ACT_ERRNO (ENOTSUP), syscall, 1, arg_cmp);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, -ret, "seccomp_rule_add_array `%s`", match->name);
+
+  return 0;
+}
+#  endif
+
+static void
+write_cache_key_string (FILE *f, const char *s)
+{
+  if (s == NULL)
+    {
+      fputs ("-;", f);
+      return;
+    }
+  fprintf (f, "%zu:%s;", strlen (s), s);
+}
+
+/* Build the string that identifies a compiled program.  Only the fields that
+   end up in the exported BPF are considered: the flags and the listener
+   settings are used when the filter is loaded, so they are ignored.  */
+static char *
+get_seccomp_cache_key (runtime_spec_schema_config_linux_seccomp *seccomp, unsigned int options,
+                       struct notify_filters_s *notify_filters, size_t *len)
+{
+  const struct scmp_version *version = seccomp_version ();
+  char *key = NULL;
+  struct utsname uts;
+  size_t i, j;
+  FILE *f;
+
+  f = open_memstream (&key, len);
+  if (UNLIKELY (f == NULL))
+    OOM ();
+
+  fprintf (f, "crun-seccomp-cache-3;");
+  if (version)
+    fprintf (f, "libseccomp=%u.%u.%u;", version->major, version->minor, version->micro);
+  if (uname (&uts) == 0)
+    {
+      write_cache_key_string (f, uts.release);
+      write_cache_key_string (f, uts.machine);
+    }
+  fprintf (f, "options=%u;", options);
+
+  write_cache_key_string (f, seccomp->default_action);
+  if (seccomp->default_errno_ret_present)
+    fprintf (f, "errno=%u;", seccomp->default_errno_ret);
+
+  fprintf (f, "arches=%zu;", seccomp->architectures_len);
+  for (i = 0; i < seccomp->architectures_len; i++)
+    write_cache_key_string (f, seccomp->architectures[i]);
+
+  fprintf (f, "syscalls=%zu;", seccomp->syscalls_len);
+  for (i = 0; i < seccomp->syscalls_len; i++)
+    {
+      runtime_spec_schema_defs_linux_syscall *s = seccomp->syscalls[i];
+
+      write_cache_key_string (f, s->action);
+      if (s->errno_ret_present)
+        fprintf (f, "errno=%u;", s->errno_ret);
+
+      fprintf (f, "names=%zu;", s->names_len);
+      for (j = 0; j < s->names_len; j++)
+        write_cache_key_string (f, s->names[j]);
+
+      if (s->args == NULL)
+        fprintf (f, "noargs;");
+      else
+        {
+          fprintf (f, "args=%zu;", s->args_len);
+          for (j = 0; j < s->args_len; j++)
+            {
+              fprintf (f, "%u,%" PRIu64 ",%" PRIu64 ",", s->args[j]->index, (uint64_t) s->args[j]->value,
+                       (uint64_t) s->args[j]->value_two);
+              write_cache_key_string (f, s->args[j]->op);
+            }
+        }
+    }
+
+  if (notify_filters->enabled)
+    {
+      fprintf (f, "notify=%zu;", notify_filters->n_filters);
+      for (i = 0; i < notify_filters->n_filters; i++)
+        {
+          struct run_oci_seccomp_notify_filter_s *filter = &notify_filters->filters[i];
+
+          write_cache_key_string (f, filter->name);
+          fprintf (f, "args=%zu;", filter->n_args);
+          for (j = 0; j < filter->n_args; j++)
+            {
+              fprintf (f, "%u,%" PRIu64 ",%" PRIu64 ",", filter->args[j].index, filter->args[j].value,
+                       filter->args[j].value_two);
+              write_cache_key_string (f, filter->args[j].op);
+            }
+        }
+    }
+
+  if (UNLIKELY (fclose (f) != 0))
+    OOM ();
+
+  return key;
+}
+
+static uint64_t
+hash_seccomp_cache_key (const char *key, size_t len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      h ^= (unsigned char) key[i];
+      h *= 1099511628211ULL;
+    }
+  return h;
+}
+
+/* Copy the cached program to OUTFD.  The cache file starts with the NUL
+   terminated key, so a hash collision is detected and treated as a miss.
+   Returns 1 on a cache hit and 0 on a miss.  */
+static int
+copy_seccomp_from_cache (const char *cache_file, const char *key, size_t key_len, int outfd, libcrun_error_t *err)
+{
+  cleanup_free char *content = NULL;
+  size_t len = 0;
+  ssize_t ret;
+
+  ret = read_all_file (cache_file, &content, &len, err);
+  if (ret < 0)
+    {
+      crun_error_release (err);
+      return 0;
+    }
+
+  if (len <= key_len + 1 || memcmp (content, key, key_len + 1) != 0)
+    return 0;
+
+  len -= key_len + 1;
+  if (len % sizeof (struct sock_filter) != 0)
+    return 0;
+
+  ret = safe_write (outfd, content + key_len + 1, (ssize_t) len);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "write to seccomp fd");
+
+  return 1;
+}
+
+/* Store the program in the cache.  Failures are not fatal, the next container
+   using the same profile will just compile it again.  */
+static void
+store_seccomp_in_cache (scmp_filter_ctx ctx, const char *cache_file, const char *key, size_t key_len)
+{
+  cleanup_free char *tmp_file = NULL;
+  cleanup_close int fd = -1;
+  int ret;
+
+  xasprintf (&tmp_file, "%s.%d.tmp", cache_file, getpid ());
+
+  fd = TEMP_FAILURE_RETRY (open (tmp_file, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+  if (UNLIKELY (fd < 0))
+    return;
+
+  ret = safe_write (fd, key, (ssize_t) key_len + 1);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  ret = seccomp_export_bpf (ctx, fd);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  ret = rename (tmp_file, cache_file);
+  if (LIKELY (ret == 0))
+    return;
+
+fail:
+  unlink (tmp_file);
+}
+#endif
+
+#ifdef HAVE_SECCOMP
+/* Tune the layout of the filter, the order of the rules in the profile
+   is not relevant for the result.  Failures are not fatal, an older
+   libseccomp just produces the default layout.  The syscall priorities
+   are not set: they are ignored by libseccomp with the binary tree.  */
+static void
+optimize_seccomp_filter (scmp_filter_ctx ctx, unsigned int options)
+{
+  if (options & LIBCRUN_SECCOMP_SKIP_OPTIMIZE)
+    return;
+
+#  if (SCMP_VER_MAJOR > 2) || (SCMP_VER_MAJOR == 2 && SCMP_VER_MINOR >= 5)
+  /* A binary tree for the syscall numbers, instead of a linear list.  */
+  seccomp_attr_set (ctx, SCMP_FLTATR_CTL_OPTIMIZE, 2);
+#  else
+  (void) ctx;
+#  endif
+}
+#endif
+
 int
-libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned int options, libcrun_error_t *err)
+libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned int options, const char *cache_dir,
+                          libcrun_error_t *err)
 {
 #ifdef HAVE_SECCOMP
   runtime_spec_schema_config_linux_seccomp *seccomp;
@@ -262,6 +624,10 @@ libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned in
   cleanup_seccomp scmp_filter_ctx ctx = NULL;
   int action, default_action, default_errno_value = EPERM;
   const char *def_action = NULL;
+  cleanup_free char *cache_key = NULL;
+  cleanup_free char *cache_file = NULL;
+  cleanup_notify_filters struct notify_filters_s notify_filters = {};
+  size_t cache_key_len = 0;
 
   if (container == NULL || container->container_def == NULL || container->container_def->linux == NULL)
     return 0;
@@ -274,6 +640,22 @@ libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned in
   if (prctl (PR_GET_SECCOMP, 0, 0, 0, 0) < 0)
     return crun_make_error (err, errno, "prctl");
 
+  ret = get_notify_filters (container, seccomp, &notify_filters, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (cache_dir && outfd >= 0)
+    {
+      cache_key = get_seccomp_cache_key (seccomp, options, &notify_filters, &cache_key_len);
+      xasprintf (&cache_file, "%s/%016" PRIx64 ".bpf", cache_dir, hash_seccomp_cache_key (cache_key, cache_key_len));
+
+      ret = copy_seccomp_from_cache (cache_file, cache_key, cache_key_len, outfd, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+      if (ret > 0)
+        return 0;
+    }
+
   def_action = seccomp->default_action;
   if (def_action == NULL)
     return crun_make_error (err, 0, "seccomp misses the default action");
@@ -319,6 +701,8 @@ libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned in
         return crun_make_error (err, -ret, "seccomp adding architecture");
     }
 
+  optimize_seccomp_filter (ctx, options);
+
   for (i = 0; i < seccomp->syscalls_len; i++)
     {
       size_t j;
@@ -351,6 +735,16 @@ libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned in
               continue;
             }
 
+#  ifdef SCMP_ACT_NOTIFY
+          if (notify_filters.enabled && action == (int) SCMP_ACT_NOTIFY && seccomp->syscalls[i]->args == NULL)
+            {
+              ret = add_notify_rules (ctx, syscall, default_action, &notify_filters, err);
+              if (UNLIKELY (ret < 0))
+                return ret;
+              continue;
+            }
+#  endif
+
           if (seccomp->syscalls[i]->args == NULL)
             {
               ret = seccomp_rule_add (ctx, action, syscall, 0);
@@ -418,6 +812,9 @@ libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned in
       ret = seccomp_export_bpf (ctx, outfd);
       if (UNLIKELY (ret < 0))
         return crun_make_error (err, -ret, "seccomp_export_bpf");
+
+      if (cache_file)
+        store_seccomp_in_cache (ctx, cache_file, cache_key, cache_key_len);
     }
 
   return 0;
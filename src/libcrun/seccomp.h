@@ -29,10 +29,16 @@
 enum
 {
   LIBCRUN_SECCOMP_FAIL_UNKNOWN_SYSCALL = 1 << 0,
+  LIBCRUN_SECCOMP_SKIP_OPTIMIZE = 1 << 1,
 };
 
-int libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned int options, libcrun_error_t *err);
+int libcrun_generate_seccomp (libcrun_container_t *container, int outfd, unsigned int options, const char *cache_dir,
+                              libcrun_error_t *err);
 int libcrun_apply_seccomp (int infd, int listener_receiver_fd, const char *receiver_fd_payload,
                            size_t receiver_fd_payload_len, char **flags, size_t flags_len, libcrun_error_t *err);
 
+/* Return the operator that matches the values OP does not match, or NULL
+   if there is none, e.g. for SCMP_CMP_MASKED_EQ.  */
+const char *libcrun_seccomp_negate_operator (const char *op);
+
 #endif
@@ -29,6 +29,10 @@
 #  include <dlfcn.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
 #include "utils.h"
 #include "seccomp_notify.h"
 
@@ -45,6 +49,14 @@ struct plugin
 #endif
 };
 
+#define SECCOMP_NOTIFY_WORKERS 4
+
+struct seccomp_notify_request_s
+{
+  struct seccomp_notify_request_s *next;
+  void *sreq;
+};
+
 struct seccomp_notify_context_s
 {
   struct plugin *plugins;
@@ -55,6 +67,22 @@ struct seccomp_notify_context_s
   struct seccomp_notif *sreq;
   struct seccomp_notif_sizes sizes;
 #endif
+
+#ifdef HAVE_PTHREAD
+  /* Set when all the plugins are thread safe.  The requests are then
+     received by the main loop and queued for the workers.  */
+  bool thread_safe;
+  int seccomp_fd;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t workers[SECCOMP_NOTIFY_WORKERS];
+  size_t n_workers;
+  struct seccomp_notify_request_s *queue_head;
+  struct seccomp_notify_request_s *queue_tail;
+  bool stop;
+  /* First error reported by a worker, returned to the main loop.  */
+  int worker_errno;
+#endif
 };
 
 void
@@ -101,10 +129,18 @@ libcrun_load_seccomp_notify_plugins (struct seccomp_notify_context_s **out, cons
 
   ctx->plugins = xmalloc0 (sizeof (struct plugin) * (ctx->n_plugins + 1));
 
+#  ifdef HAVE_PTHREAD
+  ctx->thread_safe = true;
+  ctx->seccomp_fd = -1;
+  pthread_mutex_init (&ctx->lock, NULL);
+  pthread_cond_init (&ctx->cond, NULL);
+#  endif
+
   b = xstrdup (plugins);
   for (s = 0, it = strtok_r (b, ":", &saveptr); it; s++, it = strtok_r (NULL, ":", &saveptr))
     {
       run_oci_seccomp_notify_plugin_version_cb version_cb;
+      run_oci_seccomp_notify_plugin_flags_cb flags_cb;
       run_oci_seccomp_notify_start_cb start_cb;
       void *opq = NULL;
 
@@ -127,6 +163,14 @@ libcrun_load_seccomp_notify_plugins (struct seccomp_notify_context_s **out, cons
             return crun_make_error (err, ENOTSUP, "invalid version supported by the plugin `%s`", it);
         }
 
+      flags_cb = (run_oci_seccomp_notify_plugin_flags_cb) dlsym (ctx->plugins[s].handle, "run_oci_seccomp_notify_flags");
+#  ifdef HAVE_PTHREAD
+      if (flags_cb == NULL || (flags_cb () & RUN_OCI_SECCOMP_NOTIFY_FLAG_THREAD_SAFE) == 0)
+        ctx->thread_safe = false;
+#  else
+      (void) flags_cb;
+#  endif
+
       ctx->plugins[s].handle_request_cb = (run_oci_seccomp_notify_handle_request_cb) dlsym (
           ctx->plugins[s].handle, "run_oci_seccomp_notify_handle_request");
       if (ctx->plugins[s].handle_request_cb == NULL)
@@ -157,23 +201,17 @@ libcrun_load_seccomp_notify_plugins (struct seccomp_notify_context_s **out, cons
 #endif
 }
 
-LIBCRUN_PUBLIC int
-libcrun_seccomp_notify_plugins (struct seccomp_notify_context_s *ctx, int seccomp_fd, libcrun_error_t *err)
-{
 #if HAVE_DLOPEN && HAVE_SECCOMP_GET_NOTIF_SIZES && HAVE_SECCOMP
+/* Pass the request SREQ through the plugins, and send the response unless
+   a plugin takes care of it.  */
+static int
+handle_request (struct seccomp_notify_context_s *ctx, struct seccomp_notif *sreq, struct seccomp_notif_resp *sresp,
+                int seccomp_fd, libcrun_error_t *err)
+{
   size_t i;
   int ret;
 
-  memset (ctx->sreq, 0, ctx->sizes.seccomp_notif);
-  memset (ctx->sresp, 0, ctx->sizes.seccomp_notif_resp);
-
-  ret = ioctl (seccomp_fd, SECCOMP_IOCTL_NOTIF_RECV, ctx->sreq);
-  if (UNLIKELY (ret < 0))
-    {
-      if (errno == ENOENT)
-        return 0;
-      return crun_make_error (err, errno, "ioctl");
-    }
+  memset (sresp, 0, ctx->sizes.seccomp_notif_resp);
 
   for (i = 0; i < ctx->n_plugins; i++)
     {
@@ -182,8 +220,8 @@ libcrun_seccomp_notify_plugins (struct seccomp_notify_context_s *ctx, int seccom
           int handled = 0;
           int ret;
 
-          ret = ctx->plugins[i].handle_request_cb (ctx->plugins[i].opaque, &ctx->sizes, ctx->sreq, ctx->sresp,
-                                                   seccomp_fd, &handled);
+          ret = ctx->plugins[i].handle_request_cb (ctx->plugins[i].opaque, &ctx->sizes, sreq, sresp, seccomp_fd,
+                                                   &handled);
           if (UNLIKELY (ret != 0))
             return crun_make_error (err, -ret, "error handling seccomp notify request");
 
@@ -200,7 +238,7 @@ libcrun_seccomp_notify_plugins (struct seccomp_notify_context_s *ctx, int seccom
               return 0;
 
             case RUN_OCI_SECCOMP_NOTIFY_HANDLE_SEND_RESPONSE_AND_CONTINUE:
-              ctx->sresp->flags |= SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+              sresp->flags |= SECCOMP_USER_NOTIF_FLAG_CONTINUE;
               goto send_resp;
 
             default:
@@ -210,12 +248,12 @@ libcrun_seccomp_notify_plugins (struct seccomp_notify_context_s *ctx, int seccom
     }
 
   /* No plugin could handle the request.  */
-  ctx->sresp->error = -ENOTSUP;
-  ctx->sresp->flags = 0;
+  sresp->error = -ENOTSUP;
+  sresp->flags = 0;
 
 send_resp:
-  ctx->sresp->id = ctx->sreq->id;
-  ret = ioctl (seccomp_fd, SECCOMP_IOCTL_NOTIF_SEND, ctx->sresp);
+  sresp->id = sreq->id;
+  ret = ioctl (seccomp_fd, SECCOMP_IOCTL_NOTIF_SEND, sresp);
   if (UNLIKELY (ret < 0))
     {
       if (errno == ENOENT)
@@ -223,6 +261,170 @@ send_resp:
       return crun_make_error (err, errno, "ioctl");
     }
   return 0;
+}
+
+#  ifdef HAVE_PTHREAD
+static void *
+seccomp_notify_worker (void *arg)
+{
+  struct seccomp_notify_context_s *ctx = arg;
+  cleanup_free struct seccomp_notif_resp *sresp = xmalloc (ctx->sizes.seccomp_notif_resp);
+
+  for (;;)
+    {
+      struct seccomp_notify_request_s *req;
+      libcrun_error_t tmp_err = NULL;
+      int ret;
+
+      pthread_mutex_lock (&ctx->lock);
+      while (ctx->queue_head == NULL && ! ctx->stop)
+        pthread_cond_wait (&ctx->cond, &ctx->lock);
+
+      req = ctx->queue_head;
+      if (req == NULL)
+        {
+          pthread_mutex_unlock (&ctx->lock);
+          break;
+        }
+      ctx->queue_head = req->next;
+      if (ctx->queue_head == NULL)
+        ctx->queue_tail = NULL;
+      pthread_mutex_unlock (&ctx->lock);
+
+      ret = handle_request (ctx, req->sreq, sresp, ctx->seccomp_fd, &tmp_err);
+      if (UNLIKELY (ret < 0))
+        {
+          pthread_mutex_lock (&ctx->lock);
+          if (ctx->worker_errno == 0)
+            ctx->worker_errno = crun_error_get_errno (&tmp_err);
+          if (ctx->worker_errno == 0)
+            ctx->worker_errno = EIO;
+          pthread_mutex_unlock (&ctx->lock);
+          crun_error_release (&tmp_err);
+        }
+
+      free (req->sreq);
+      free (req);
+    }
+
+  return NULL;
+}
+
+static int
+start_workers (struct seccomp_notify_context_s *ctx, int seccomp_fd, libcrun_error_t *err)
+{
+  size_t i;
+  int ret;
+
+  ctx->seccomp_fd = seccomp_fd;
+  for (i = 0; i < SECCOMP_NOTIFY_WORKERS; i++)
+    {
+      ret = pthread_create (&ctx->workers[i], NULL, seccomp_notify_worker, ctx);
+      if (UNLIKELY (ret != 0))
+        {
+          if (ctx->n_workers > 0)
+            break;
+          return crun_make_error (err, ret, "create seccomp notify worker");
+        }
+      ctx->n_workers++;
+    }
+  return 0;
+}
+
+static void
+stop_workers (struct seccomp_notify_context_s *ctx)
+{
+  struct seccomp_notify_request_s *it, *next;
+  size_t i;
+
+  pthread_mutex_lock (&ctx->lock);
+  ctx->stop = true;
+  pthread_cond_broadcast (&ctx->cond);
+  pthread_mutex_unlock (&ctx->lock);
+
+  for (i = 0; i < ctx->n_workers; i++)
+    pthread_join (ctx->workers[i], NULL);
+  ctx->n_workers = 0;
+
+  for (it = ctx->queue_head; it; it = next)
+    {
+      next = it->next;
+      free (it->sreq);
+      free (it);
+    }
+  ctx->queue_head = ctx->queue_tail = NULL;
+}
+
+static int
+queue_request (struct seccomp_notify_context_s *ctx, int seccomp_fd, libcrun_error_t *err)
+{
+  struct seccomp_notify_request_s *req;
+  int worker_errno;
+  int ret;
+
+  if (ctx->n_workers == 0)
+    {
+      ret = start_workers (ctx, seccomp_fd, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+    }
+
+  req = xmalloc0 (sizeof (*req));
+  req->sreq = xmalloc0 (ctx->sizes.seccomp_notif);
+
+  ret = ioctl (seccomp_fd, SECCOMP_IOCTL_NOTIF_RECV, req->sreq);
+  if (UNLIKELY (ret < 0))
+    {
+      int saved_errno = errno;
+
+      free (req->sreq);
+      free (req);
+      if (saved_errno == ENOENT)
+        return 0;
+      return crun_make_error (err, saved_errno, "ioctl");
+    }
+
+  pthread_mutex_lock (&ctx->lock);
+  worker_errno = ctx->worker_errno;
+  if (ctx->queue_tail)
+    ctx->queue_tail->next = req;
+  else
+    ctx->queue_head = req;
+  ctx->queue_tail = req;
+  pthread_cond_signal (&ctx->cond);
+  pthread_mutex_unlock (&ctx->lock);
+
+  if (UNLIKELY (worker_errno != 0))
+    return crun_make_error (err, worker_errno, "error handling seccomp notify request");
+
+  return 0;
+}
+#  endif
+#endif
+
+LIBCRUN_PUBLIC int
+libcrun_seccomp_notify_plugins (struct seccomp_notify_context_s *ctx, int seccomp_fd, libcrun_error_t *err)
+{
+#if HAVE_DLOPEN && HAVE_SECCOMP_GET_NOTIF_SIZES && HAVE_SECCOMP
+  int ret;
+
+#  ifdef HAVE_PTHREAD
+  /* A slow plugin doesn't block the other requests.  */
+  if (ctx->thread_safe)
+    return queue_request (ctx, seccomp_fd, err);
+#  endif
+
+  memset (ctx->sreq, 0, ctx->sizes.seccomp_notif);
+
+  ret = ioctl (seccomp_fd, SECCOMP_IOCTL_NOTIF_RECV, ctx->sreq);
+  if (UNLIKELY (ret < 0))
+    {
+      if (errno == ENOENT)
+        return 0;
+      return crun_make_error (err, errno, "ioctl");
+    }
+
+  return handle_request (ctx, ctx->sreq, ctx->sresp, seccomp_fd, err);
 #else
   (void) ctx;
   (void) seccomp_fd;
@@ -240,6 +442,16 @@ libcrun_free_seccomp_notify_plugins (struct seccomp_notify_context_s *ctx, libcr
   if (ctx == NULL)
     return crun_make_error (err, EINVAL, "invalid seccomp notify context");
 
+#  ifdef HAVE_PTHREAD
+  /* The plugins cannot be stopped while a worker is still using them.  */
+  if (ctx->plugins)
+    {
+      stop_workers (ctx);
+      pthread_cond_destroy (&ctx->cond);
+      pthread_mutex_destroy (&ctx->lock);
+    }
+#  endif
+
   free (ctx->sreq);
   free (ctx->sresp);
 
@@ -263,3 +475,138 @@ libcrun_free_seccomp_notify_plugins (struct seccomp_notify_context_s *ctx, libcr
   return crun_make_error (err, ENOTSUP, "seccomp notify support not available");
 #endif
 }
+
+int
+libcrun_check_seccomp_notify_filter (const struct run_oci_seccomp_notify_filter_s *filter, libcrun_error_t *err)
+{
+  size_t i;
+
+  if (filter->name == NULL)
+    return crun_make_error (err, 0, "seccomp notify filter without a syscall name");
+
+  /* Dropping conditions would notify more calls than the plugin asked for.  */
+  if (filter->n_args > RUN_OCI_SECCOMP_NOTIFY_MAX_ARGS)
+    return crun_make_error (err, 0, "too many argument conditions for `%s`: %zu, the maximum is %d", filter->name,
+                            filter->n_args, RUN_OCI_SECCOMP_NOTIFY_MAX_ARGS);
+
+  for (i = 0; i < filter->n_args; i++)
+    {
+      if (filter->args[i].index >= 6)
+        return crun_make_error (err, 0, "invalid seccomp index %u for `%s`", filter->args[i].index, filter->name);
+      if (filter->args[i].op == NULL)
+        return crun_make_error (err, 0, "missing seccomp operator for `%s`", filter->name);
+    }
+  return 0;
+}
+
+static void
+copy_seccomp_notify_filter (struct run_oci_seccomp_notify_filter_s *dst,
+                            const struct run_oci_seccomp_notify_filter_s *src)
+{
+  size_t i;
+
+  dst->name = xstrdup (src->name);
+  dst->n_args = src->n_args;
+  for (i = 0; i < src->n_args; i++)
+    {
+      dst->args[i] = src->args[i];
+      dst->args[i].op = xstrdup (src->args[i].op);
+    }
+}
+
+void
+libcrun_free_seccomp_notify_filters (struct run_oci_seccomp_notify_filter_s *filters, size_t n_filters)
+{
+  size_t i, j;
+
+  for (i = 0; i < n_filters; i++)
+    {
+      free ((char *) filters[i].name);
+      for (j = 0; j < filters[i].n_args && j < RUN_OCI_SECCOMP_NOTIFY_MAX_ARGS; j++)
+        free ((char *) filters[i].args[j].op);
+    }
+  free (filters);
+}
+
+/* Collect the syscalls handled by the PLUGINS.  It returns 1 and fills
+   *FILTERS if every plugin declares them, and 0 if at least one plugin
+   wants all the notifications.  */
+int
+libcrun_get_seccomp_notify_plugins_filters (const char *plugins, struct run_oci_seccomp_notify_filter_s **filters,
+                                            size_t *n_filters, libcrun_error_t *err)
+{
+#if HAVE_DLOPEN && HAVE_SECCOMP_GET_NOTIF_SIZES && HAVE_SECCOMP
+  struct run_oci_seccomp_notify_filter_s *ret_filters = NULL;
+  cleanup_free char *b = xstrdup (plugins);
+  size_t ret_n_filters = 0;
+  char *it, *saveptr;
+
+  *filters = NULL;
+  *n_filters = 0;
+
+  for (it = strtok_r (b, ":", &saveptr); it; it = strtok_r (NULL, ":", &saveptr))
+    {
+      run_oci_seccomp_notify_plugin_filters_cb filters_cb;
+      const struct run_oci_seccomp_notify_filter_s *plugin_filters = NULL;
+      size_t plugin_n_filters = 0, i;
+      void *handle;
+      int ret;
+
+      if (strchr (it, '/') && it[0] != '/')
+        {
+          libcrun_free_seccomp_notify_filters (ret_filters, ret_n_filters);
+          return crun_make_error (err, 0, "invalid relative plugin path: `%s`", it);
+        }
+
+      handle = dlopen (it, RTLD_NOW | RTLD_LOCAL);
+      if (handle == NULL)
+        {
+          libcrun_free_seccomp_notify_filters (ret_filters, ret_n_filters);
+          return crun_make_error (err, 0, "cannot load `%s`: %s", it, dlerror ());
+        }
+
+      filters_cb = (run_oci_seccomp_notify_plugin_filters_cb) dlsym (handle, "run_oci_seccomp_notify_filters");
+      if (filters_cb == NULL)
+        {
+          dlclose (handle);
+          libcrun_free_seccomp_notify_filters (ret_filters, ret_n_filters);
+          return 0;
+        }
+
+      ret = filters_cb (&plugin_filters, &plugin_n_filters);
+      if (UNLIKELY (ret != 0))
+        {
+          dlclose (handle);
+          libcrun_free_seccomp_notify_filters (ret_filters, ret_n_filters);
+          return crun_make_error (err, -ret, "error reading the filters of `%s`", it);
+        }
+
+      for (i = 0; i < plugin_n_filters; i++)
+        {
+          ret = libcrun_check_seccomp_notify_filter (&plugin_filters[i], err);
+          if (UNLIKELY (ret < 0))
+            {
+              dlclose (handle);
+              libcrun_free_seccomp_notify_filters (ret_filters, ret_n_filters);
+              return crun_error_wrap (err, "invalid filter in `%s`", it);
+            }
+        }
+
+      ret_filters = xrealloc (ret_filters, sizeof (*ret_filters) * (ret_n_filters + plugin_n_filters + 1));
+      for (i = 0; i < plugin_n_filters; i++)
+        copy_seccomp_notify_filter (&ret_filters[ret_n_filters++], &plugin_filters[i]);
+
+      dlclose (handle);
+    }
+
+  *filters = ret_filters;
+  *n_filters = ret_n_filters;
+  return 1;
+#else
+  (void) plugins;
+  (void) err;
+  *filters = NULL;
+  *n_filters = 0;
+  return 0;
+#endif
+}
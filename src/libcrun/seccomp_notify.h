@@ -35,6 +35,13 @@ LIBCRUN_PUBLIC int libcrun_seccomp_notify_plugins (struct seccomp_notify_context
                                                    libcrun_error_t *err);
 LIBCRUN_PUBLIC int libcrun_free_seccomp_notify_plugins (struct seccomp_notify_context_s *ctx, libcrun_error_t *err);
 
+int libcrun_get_seccomp_notify_plugins_filters (const char *plugins, struct run_oci_seccomp_notify_filter_s **filters,
+                                                size_t *n_filters, libcrun_error_t *err);
+void libcrun_free_seccomp_notify_filters (struct run_oci_seccomp_notify_filter_s *filters, size_t n_filters);
+
+/* Refuse a filter that cannot be turned into seccomp rules as it is.  */
+int libcrun_check_seccomp_notify_filter (const struct run_oci_seccomp_notify_filter_s *filter, libcrun_error_t *err);
+
 #define cleanup_seccomp_notify_context __attribute__ ((cleanup (cleanup_seccomp_notify_pluginsp)))
 void cleanup_seccomp_notify_pluginsp (void *p);
 
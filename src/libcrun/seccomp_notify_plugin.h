@@ -18,6 +18,8 @@
 #ifndef SECCOMP_NOTIFY_PLUGINPLUGIN_H
 
 #  include <linux/seccomp.h>
+#  include <stddef.h>
+#  include <stdint.h>
 
 struct libcrun_load_seccomp_notify_conf_s
 {
@@ -36,6 +38,30 @@ struct libcrun_load_seccomp_notify_conf_s
 /* Specify SECCOMP_USER_NOTIF_FLAG_CONTINUE in the flags.  */
 #  define RUN_OCI_SECCOMP_NOTIFY_HANDLE_SEND_RESPONSE_AND_CONTINUE 3
 
+/* The plugin can handle requests concurrently from different threads.  */
+#  define RUN_OCI_SECCOMP_NOTIFY_FLAG_THREAD_SAFE (1 << 0)
+
+#  define RUN_OCI_SECCOMP_NOTIFY_MAX_ARGS 6
+
+/* A condition on a syscall argument, with the same meaning as in the OCI
+   seccomp configuration.  OP is the name of the operator, e.g. "SCMP_CMP_EQ".  */
+struct run_oci_seccomp_notify_arg_s
+{
+  unsigned int index;
+  const char *op;
+  uint64_t value;
+  uint64_t value_two;
+};
+
+/* A syscall the plugin wants to be notified of.  With N_ARGS > 0, only the
+   calls that match all the conditions are notified.  */
+struct run_oci_seccomp_notify_filter_s
+{
+  const char *name;
+  size_t n_args;
+  struct run_oci_seccomp_notify_arg_s args[RUN_OCI_SECCOMP_NOTIFY_MAX_ARGS];
+};
+
 #  ifndef SECCOMP_NOTIFY_SKIP_TYPEDEF
 
 /* Configure the plugin.  Return an opaque pointer that will be used for successive calls.  */
@@ -59,6 +85,21 @@ typedef int (*run_oci_seccomp_notify_stop_cb) (void *opaque);
 /* Retrieve the API version used by the plugin.  It MUST return 1. */
 typedef int (*run_oci_seccomp_notify_plugin_version_cb) ();
 
+/* Retrieve the RUN_OCI_SECCOMP_NOTIFY_FLAG_* flags for the plugin.  It is optional.
+   If all the plugins are RUN_OCI_SECCOMP_NOTIFY_FLAG_THREAD_SAFE, the requests are
+   handled by a pool of threads and handle_request can be called concurrently.  */
+typedef int (*run_oci_seccomp_notify_plugin_flags_cb) ();
+
+/* Retrieve the syscalls the plugin handles.  It is optional.  The data must be
+   valid until the plugin is unloaded.  If all the plugins define it, only
+   the syscalls that at least one plugin handles are notified, the others
+   fail with ENOTSUP in the kernel.  The calls not matching the argument
+   conditions fail with ENOTSUP in the kernel only if the syscall has a
+   single condition that can be negated, otherwise they are notified too.
+   N_ARGS must not be greater than RUN_OCI_SECCOMP_NOTIFY_MAX_ARGS.  */
+typedef int (*run_oci_seccomp_notify_plugin_filters_cb) (const struct run_oci_seccomp_notify_filter_s **filters,
+                                                         size_t *n_filters);
+
 #  endif
 
 #endif
@@ -24,10 +24,17 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <yajl/yajl_tree.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/file.h>
 #include <dirent.h>
 #include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
 
 #define YAJL_STR(x) ((const unsigned char *) (x))
 
@@ -107,11 +114,15 @@ get_state_directory_status_file (const char *state_root, const char *id)
 static int
 read_pid_stat (pid_t pid, struct pid_stat *st, libcrun_error_t *err)
 {
-  cleanup_free char *buffer = NULL;
+  /* The stat file is a single line of bounded length, read it at once
+     without any allocation.  */
+  char buffer[2048];
   cleanup_close int fd = -1;
+  ssize_t len;
   char pid_stat_file[64];
-  char *it, *s;
-  int i, ret;
+  const char *it;
+  char *s;
+  uint64_t starttime;
 
   sprintf (pid_stat_file, "/proc/%d/stat", pid);
 
@@ -127,25 +138,25 @@ read_pid_stat (pid_t pid, struct pid_stat *st, libcrun_error_t *err)
       return crun_make_error (err, errno, "open state file %s", pid_stat_file);
     }
 
-  ret = read_all_fd (fd, pid_stat_file, &buffer, NULL, err);
-  if (ret < 0)
+  len = TEMP_FAILURE_RETRY (read (fd, buffer, sizeof (buffer) - 1));
+  if (len < 0)
     {
       st->starttime = 0;
       st->state = 'X';
       /* The process already exited.  */
-      libcrun_error_release (err);
       return 0;
     }
+  buffer[len] = '\0';
 
-  s = NULL;
-
-  /* Skip the first two arguments.  */
-  for (it = buffer; it; it = strchr (it + 1, ')'))
-    s = it + 1;
-
+  /* Skip the first two arguments.  The command name can contain any
+     character, so look for the last ')'.  */
+  s = memrchr (buffer, ')', len);
   if (s)
-    while (*s == ' ')
+    {
       s++;
+      while (*s == ' ')
+        s++;
+    }
 
   if (s == NULL || *s == '\0')
     return crun_make_error (err, 0, "could not read process state");
@@ -153,26 +164,774 @@ read_pid_stat (pid_t pid, struct pid_stat *st, libcrun_error_t *err)
   st->state = *s;
 
   /* Seek to the starttime argument.  */
-  for (it = s + 1, i = 0; i < 19 && it != NULL; i++, it = strchr (it, ' ') + 1)
-    ;
-
-  if (it == NULL || i != 19)
+  it = skip_fields (s, ' ', 19);
+  if (it == NULL)
     return crun_make_error (err, 0, "could not read process start time");
 
-  errno = 0;
-  st->starttime = strtoull (it, NULL, 10);
-  if (errno != 0)
-    return crun_make_error (err, errno, "parse process start time");
+  if (parse_uint64 (it, &starttime) == NULL)
+    return crun_make_error (err, 0, "parse process start time");
+  st->starttime = starttime;
+
+  return 0;
+}
+
+/* The status index is an append-only file in the run directory that
+   mirrors the status file of every container, so that listing the
+   containers reads a single file instead of opening and parsing one
+   status file per container.
+
+   The file starts with a struct status_index_header_s, followed by a
+   sequence of records.  Each record is a struct status_index_record_s
+   followed by the NUL terminated strings listed in STATUS_INDEX_FIELDS,
+   padded to a multiple of 8 bytes.  The last record for an id wins, and
+   a STATUS_INDEX_DEL record removes it.
+
+   The header is followed by a struct status_index_stamp_s, which records
+   the mtime, link count and size of the run directory after the last
+   change made by a writer.  The index is only a cache: it is trusted only
+   when the stamp matches the run directory exactly, as creating or
+   removing a container directory changes them.  The link count catches
+   the changes that happen within the granularity of the timestamps.
+   Otherwise the index is ignored by readers and rebuilt from the status
+   files by the next writer.  */
+
+#define STATUS_INDEX_FILE ".index"
+#define STATUS_INDEX_TMP_FILE ".index.tmp"
+#define STATUS_INDEX_LOCK_FILE ".index.lock"
+#define STATUS_INDEX_MAGIC 0x78646e69
+#define STATUS_INDEX_VERSION 2
+/* Do not compact the index before it reaches this size.  */
+#define STATUS_INDEX_COMPACT_MIN_SIZE (256 * 1024)
+
+enum
+{
+  STATUS_INDEX_ADD = 1,
+  STATUS_INDEX_DEL,
+};
+
+enum
+{
+  STATUS_INDEX_ID = 0,
+  STATUS_INDEX_CGROUP_PATH,
+  STATUS_INDEX_SCOPE,
+  STATUS_INDEX_ROOTFS,
+  STATUS_INDEX_BUNDLE,
+  STATUS_INDEX_CREATED,
+  STATUS_INDEX_OWNER,
+  STATUS_INDEX_EXTERNAL_DESCRIPTORS,
+  STATUS_INDEX_FIELDS,
+};
+
+struct status_index_header_s
+{
+  uint32_t magic;
+  uint32_t version;
+  /* Size of the file when it was last rewritten.  */
+  uint64_t base_size;
+};
+
+struct status_index_stamp_s
+{
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t nlink;
+  uint64_t size;
+};
+
+struct status_index_record_s
+{
+  /* Length of the record, including this header and the padding.  */
+  uint32_t len;
+  uint8_t op;
+  uint8_t systemd_cgroup;
+  uint8_t detached;
+  uint8_t pad;
+  int32_t pid;
+  int32_t start_fd;
+  uint64_t process_start_time;
+};
+
+struct status_index_entry_s
+{
+  const struct status_index_record_s *record;
+  const char *fields[STATUS_INDEX_FIELDS];
+  size_t seq;
+};
+
+static char *
+status_index_make_record (int op, const char *id, libcrun_container_status_t *status, size_t *len)
+{
+  const char *fields[STATUS_INDEX_FIELDS] = {
+    NULL,
+  };
+  struct status_index_record_s *record;
+  size_t i, size, offset;
+  size_t lens[STATUS_INDEX_FIELDS];
+  char *buffer;
+
+  fields[STATUS_INDEX_ID] = id;
+  if (status)
+    {
+      fields[STATUS_INDEX_CGROUP_PATH] = status->cgroup_path;
+      fields[STATUS_INDEX_SCOPE] = status->scope;
+      fields[STATUS_INDEX_ROOTFS] = status->rootfs;
+      fields[STATUS_INDEX_BUNDLE] = status->bundle;
+      fields[STATUS_INDEX_CREATED] = status->created;
+      fields[STATUS_INDEX_OWNER] = status->owner;
+      fields[STATUS_INDEX_EXTERNAL_DESCRIPTORS] = status->external_descriptors;
+    }
+
+  size = sizeof (struct status_index_record_s);
+  for (i = 0; i < STATUS_INDEX_FIELDS; i++)
+    {
+      lens[i] = fields[i] ? strlen (fields[i]) : 0;
+      size += lens[i] + 1;
+    }
+  size = (size + 7) & ~((size_t) 7);
+
+  buffer = xmalloc0 (size);
+  record = (struct status_index_record_s *) buffer;
+  record->len = size;
+  record->op = op;
+  if (status)
+    {
+      record->systemd_cgroup = status->systemd_cgroup ? 1 : 0;
+      record->detached = status->detached ? 1 : 0;
+      record->pid = status->pid;
+      record->start_fd = status->start_fd;
+      record->process_start_time = status->process_start_time;
+    }
+
+  offset = sizeof (struct status_index_record_s);
+  for (i = 0; i < STATUS_INDEX_FIELDS; i++)
+    {
+      if (lens[i])
+        memcpy (buffer + offset, fields[i], lens[i]);
+      offset += lens[i] + 1;
+    }
+
+  *len = size;
+  return buffer;
+}
+
+static int
+compare_status_index_entries (const void *a, const void *b)
+{
+  const struct status_index_entry_s *ea = a;
+  const struct status_index_entry_s *eb = b;
+  int r;
+
+  r = strcmp (ea->fields[STATUS_INDEX_ID], eb->fields[STATUS_INDEX_ID]);
+  if (r)
+    return r;
+  return ea->seq < eb->seq ? -1 : 1;
+}
+
+/* Parse the record at the beginning of DATA.  The fields of ENTRY point
+   into DATA.  Returns the length of the record, or 0 if it is not valid.  */
+static size_t
+status_index_parse_record (const char *data, size_t len, struct status_index_entry_s *entry)
+{
+  const struct status_index_record_s *record = (const struct status_index_record_s *) data;
+  const char *it, *end;
+  size_t i;
+
+  if (len < sizeof (*record) || record->len < sizeof (*record) || record->len > len || record->len % 8)
+    return 0;
+
+  entry->record = record;
+
+  it = (const char *) (record + 1);
+  end = data + record->len;
+  for (i = 0; i < STATUS_INDEX_FIELDS; i++)
+    {
+      const char *nul = memchr (it, '\0', end - it);
+      if (UNLIKELY (nul == NULL))
+        return 0;
+      entry->fields[i] = it;
+      it = nul + 1;
+    }
+
+  return record->len;
+}
+
+static void
+status_index_entry_to_status (const struct status_index_entry_s *entry, libcrun_container_status_t *status)
+{
+  const struct status_index_record_s *record = entry->record;
+  const char *const *fields = entry->fields;
+
+  status->pid = record->pid;
+  status->start_fd = record->start_fd;
+  status->process_start_time = record->process_start_time;
+  status->systemd_cgroup = record->systemd_cgroup;
+  status->detached = record->detached;
+  status->cgroup_path = xstrdup (fields[STATUS_INDEX_CGROUP_PATH]);
+  status->scope = xstrdup (fields[STATUS_INDEX_SCOPE]);
+  status->rootfs = xstrdup (fields[STATUS_INDEX_ROOTFS]);
+  status->bundle = xstrdup (fields[STATUS_INDEX_BUNDLE]);
+  status->created = xstrdup (fields[STATUS_INDEX_CREATED]);
+  status->owner = xstrdup (fields[STATUS_INDEX_OWNER]);
+  status->external_descriptors = xstrdup (fields[STATUS_INDEX_EXTERNAL_DESCRIPTORS]);
+}
+
+/* Replay the records in DATA and store in OUT the live entry for each
+   container.  The entries point into DATA.  */
+static int
+status_index_replay (const char *data, size_t len, struct status_index_entry_s **out, size_t *out_len,
+                     libcrun_error_t *err)
+{
+  cleanup_free struct status_index_entry_s *entries = NULL;
+  const struct status_index_header_s *header;
+  size_t n_entries = 0, allocated = 0;
+  size_t offset, i, j;
+
+  header = (const struct status_index_header_s *) data;
+  if (len < sizeof (*header) + sizeof (struct status_index_stamp_s) || header->magic != STATUS_INDEX_MAGIC
+      || header->version != STATUS_INDEX_VERSION)
+    return crun_make_error (err, 0, "invalid status index header");
+
+  offset = sizeof (*header) + sizeof (struct status_index_stamp_s);
+  while (offset < len)
+    {
+      size_t record_len;
+
+      if (n_entries == allocated)
+        {
+          allocated = allocated ? allocated * 2 : 64;
+          entries = xrealloc (entries, allocated * sizeof (*entries));
+        }
+
+      record_len = status_index_parse_record (data + offset, len - offset, &entries[n_entries]);
+      if (UNLIKELY (record_len == 0))
+        return crun_make_error (err, 0, "invalid record in the status index at offset %zu", offset);
+
+      entries[n_entries].seq = n_entries;
+      n_entries++;
+      offset += record_len;
+    }
+
+  if (n_entries)
+    qsort (entries, n_entries, sizeof (*entries), compare_status_index_entries);
+
+  /* Keep only the last record for each id, and drop the deleted ones.  */
+  for (i = 0, j = 0; i < n_entries; i++)
+    {
+      if (i + 1 < n_entries
+          && strcmp (entries[i].fields[STATUS_INDEX_ID], entries[i + 1].fields[STATUS_INDEX_ID]) == 0)
+        continue;
+      if (entries[i].record->op != STATUS_INDEX_ADD)
+        continue;
+      entries[j++] = entries[i];
+    }
+
+  *out = entries;
+  entries = NULL;
+  *out_len = j;
+  return 0;
+}
+
+static void
+status_index_make_stamp (const struct stat *st, struct status_index_stamp_s *stamp)
+{
+  stamp->mtime_sec = st->st_mtim.tv_sec;
+  stamp->mtime_nsec = st->st_mtim.tv_nsec;
+  stamp->nlink = st->st_nlink;
+  stamp->size = st->st_size;
+}
+
+static bool
+status_index_is_fresh (int rundir_fd, int index_fd)
+{
+  struct status_index_stamp_s stamp, current;
+  struct stat st;
+  ssize_t r;
+
+  if (fstat (rundir_fd, &st) < 0)
+    return false;
+
+  r = TEMP_FAILURE_RETRY (pread (index_fd, &stamp, sizeof (stamp), sizeof (struct status_index_header_s)));
+  if (r != (ssize_t) sizeof (stamp))
+    return false;
+
+  status_index_make_stamp (&st, &current);
+  return memcmp (&stamp, &current, sizeof (stamp)) == 0;
+}
+
+/* Record the current state of the run directory in the index, once the
+   caller is done changing it.  */
+static int
+status_index_update_stamp (int rundir_fd, libcrun_error_t *err)
+{
+  struct status_index_stamp_s stamp;
+  cleanup_close int fd = -1;
+  struct stat st;
+  ssize_t r;
+
+  /* Not O_APPEND, as pwrite(2) ignores the offset on such files.  */
+  fd = TEMP_FAILURE_RETRY (openat (rundir_fd, STATUS_INDEX_FILE, O_WRONLY | O_CLOEXEC));
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "open `%s`", STATUS_INDEX_FILE);
+
+  if (UNLIKELY (fstat (rundir_fd, &st) < 0))
+    return crun_make_error (err, errno, "fstat run directory");
+
+  status_index_make_stamp (&st, &stamp);
+  r = TEMP_FAILURE_RETRY (pwrite (fd, &stamp, sizeof (stamp), sizeof (struct status_index_header_s)));
+  if (UNLIKELY (r != (ssize_t) sizeof (stamp)))
+    return crun_make_error (err, r < 0 ? errno : EIO, "write `%s`", STATUS_INDEX_FILE);
+
+  return 0;
+}
+
+static int
+status_index_lock (int rundir_fd, int operation, libcrun_error_t *err)
+{
+  cleanup_close int fd = -1;
+  int ret;
+
+  fd = TEMP_FAILURE_RETRY (openat (rundir_fd, STATUS_INDEX_LOCK_FILE, O_CREAT | O_RDWR | O_CLOEXEC, 0600));
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "open `%s`", STATUS_INDEX_LOCK_FILE);
+
+  ret = TEMP_FAILURE_RETRY (flock (fd, operation));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "flock `%s`", STATUS_INDEX_LOCK_FILE);
+
+  ret = fd;
+  fd = -1;
+  return ret;
+}
+
+/* Write a new index with BUFFERS records and atomically replace the old one.  */
+static int
+status_index_rewrite (int rundir_fd, char **buffers, size_t *lens, size_t n, libcrun_error_t *err)
+{
+  struct status_index_header_s header = {
+    .magic = STATUS_INDEX_MAGIC,
+    .version = STATUS_INDEX_VERSION,
+  };
+  struct status_index_stamp_s stamp = {};
+  cleanup_close int fd = -1;
+  size_t i, size;
+  int ret;
+
+  fd = TEMP_FAILURE_RETRY (openat (rundir_fd, STATUS_INDEX_TMP_FILE, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600));
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "open `%s`", STATUS_INDEX_TMP_FILE);
+
+  size = sizeof (header) + sizeof (stamp);
+  for (i = 0; i < n; i++)
+    size += lens[i];
+  header.base_size = size;
+
+  ret = safe_write (fd, &header, sizeof (header));
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  /* The stamp is written once the file is in place.  */
+  ret = safe_write (fd, &stamp, sizeof (stamp));
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  for (i = 0; i < n; i++)
+    {
+      ret = safe_write (fd, buffers[i], lens[i]);
+      if (UNLIKELY (ret < 0))
+        goto fail;
+    }
+
+  ret = renameat (rundir_fd, STATUS_INDEX_TMP_FILE, rundir_fd, STATUS_INDEX_FILE);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  /* The rename changed the run directory, record its new state.  */
+  return status_index_update_stamp (rundir_fd, err);
+
+fail:
+  ret = crun_make_error (err, errno, "write `%s`", STATUS_INDEX_TMP_FILE);
+  unlinkat (rundir_fd, STATUS_INDEX_TMP_FILE, 0);
+  return ret;
+}
+
+static int get_containers_list_from_directory (libcrun_container_list_t **ret, const char *path,
+                                               libcrun_error_t *err);
+
+/* Recreate the index from the status files.  */
+static int
+status_index_rebuild (const char *state_root, int rundir_fd, libcrun_error_t *err)
+{
+  cleanup_container_list libcrun_container_list_t *list = NULL;
+  cleanup_free char *path = get_run_directory (state_root);
+  libcrun_container_list_t *it;
+  char **buffers = NULL;
+  size_t *lens = NULL;
+  size_t i, n = 0;
+  int ret;
+
+  ret = get_containers_list_from_directory (&list, path, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  for (it = list; it; it = it->next)
+    n++;
+
+  buffers = xmalloc0 (sizeof (char *) * (n + 1));
+  lens = xmalloc0 (sizeof (size_t) * (n + 1));
+
+  for (i = 0, it = list; it; it = it->next)
+    {
+      cleanup_container_status libcrun_container_status_t status = {
+        0,
+      };
+      libcrun_error_t tmp_err = NULL;
+
+      /* Containers with an unreadable status file are left out, the
+         directory scan reports them.  */
+      ret = libcrun_read_container_status (&status, state_root, it->name, &tmp_err);
+      if (UNLIKELY (ret < 0))
+        {
+          crun_error_release (&tmp_err);
+          continue;
+        }
+
+      buffers[i] = status_index_make_record (STATUS_INDEX_ADD, it->name, &status, &lens[i]);
+      i++;
+    }
+
+  ret = status_index_rewrite (rundir_fd, buffers, lens, i, err);
+
+  for (n = 0; n < i; n++)
+    free (buffers[n]);
+  free (buffers);
+  free (lens);
+  return ret;
+}
+
+/* Drop the superseded records once the index has doubled in size since it
+   was last rewritten.  */
+static int
+status_index_maybe_compact (int rundir_fd, int index_fd, libcrun_error_t *err)
+{
+  cleanup_free struct status_index_entry_s *entries = NULL;
+  const struct status_index_header_s *header;
+  cleanup_free char *data = NULL;
+  char **buffers = NULL;
+  size_t *lens = NULL;
+  size_t len, n, i;
+  struct stat st;
+  int ret;
+
+  ret = fstat (index_fd, &st);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fstat `%s`", STATUS_INDEX_FILE);
+
+  if (st.st_size < STATUS_INDEX_COMPACT_MIN_SIZE)
+    return 0;
+
+  if (UNLIKELY (lseek (index_fd, 0, SEEK_SET) < 0))
+    return crun_make_error (err, errno, "lseek `%s`", STATUS_INDEX_FILE);
+
+  ret = read_all_fd (index_fd, STATUS_INDEX_FILE, &data, &len, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  header = (const struct status_index_header_s *) data;
+  if (len >= sizeof (*header) && len < 2 * header->base_size)
+    return 0;
+
+  ret = status_index_replay (data, len, &entries, &n, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  buffers = xmalloc0 (sizeof (char *) * (n + 1));
+  lens = xmalloc0 (sizeof (size_t) * (n + 1));
+  for (i = 0; i < n; i++)
+    {
+      buffers[i] = (char *) entries[i].record;
+      lens[i] = entries[i].record->len;
+    }
+
+  ret = status_index_rewrite (rundir_fd, buffers, lens, n, err);
+
+  free (buffers);
+  free (lens);
+  return ret;
+}
+
+/* Append a record for the container ID to the index: an addition if STATUS
+   is not NULL, otherwise a removal.  */
+static int
+status_index_append (int rundir_fd, const char *id, libcrun_container_status_t *status, libcrun_error_t *err)
+{
+  struct status_index_header_s header = {
+    .magic = STATUS_INDEX_MAGIC,
+    .version = STATUS_INDEX_VERSION,
+  };
+  struct status_index_stamp_s stamp = {};
+  cleanup_free char *record = NULL;
+  cleanup_close int fd = -1;
+  size_t len;
+  struct stat st;
+  int ret;
+
+  fd = TEMP_FAILURE_RETRY (openat (rundir_fd, STATUS_INDEX_FILE, O_RDWR | O_APPEND | O_CLOEXEC));
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "open `%s`", STATUS_INDEX_FILE);
+
+  ret = fstat (fd, &st);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fstat `%s`", STATUS_INDEX_FILE);
+
+  if (st.st_size == 0)
+    {
+      header.base_size = sizeof (header) + sizeof (stamp);
+      ret = safe_write (fd, &header, sizeof (header));
+      if (LIKELY (ret >= 0))
+        ret = safe_write (fd, &stamp, sizeof (stamp));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "write `%s`", STATUS_INDEX_FILE);
+    }
+
+  record = status_index_make_record (status ? STATUS_INDEX_ADD : STATUS_INDEX_DEL, id, status, &len);
+  ret = safe_write (fd, record, len);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "write `%s`", STATUS_INDEX_FILE);
+
+  ret = status_index_update_stamp (rundir_fd, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  return status_index_maybe_compact (rundir_fd, fd, err);
+}
+
+/* Take the index lock and check whether the index is up to date, before
+   the caller changes the run directory.  Returns the lock fd, or -1 if the
+   index cannot be maintained.  */
+static int
+status_index_begin (int rundir_fd, bool *fresh)
+{
+  cleanup_close int index_fd = -1;
+  libcrun_error_t err = NULL;
+  int lock_fd;
+
+  *fresh = false;
+
+  lock_fd = status_index_lock (rundir_fd, LOCK_EX, &err);
+  if (UNLIKELY (lock_fd < 0))
+    {
+      crun_error_release (&err);
+      return -1;
+    }
+
+  index_fd = TEMP_FAILURE_RETRY (openat (rundir_fd, STATUS_INDEX_FILE, O_RDONLY | O_CLOEXEC));
+  if (index_fd >= 0)
+    *fresh = status_index_is_fresh (rundir_fd, index_fd);
+
+  return lock_fd;
+}
+
+/* Update the index after a change to the container ID.  STATUS is NULL
+   when the container was deleted, and FRESH is the value returned by
+   status_index_begin.  Errors are not fatal: on failures the index is
+   removed and it is recreated later from the status files.  */
+static void
+status_index_end (const char *state_root, int rundir_fd, bool fresh, const char *id,
+                  libcrun_container_status_t *status)
+{
+  libcrun_error_t err = NULL;
+  int ret;
+
+  if (fresh)
+    ret = status_index_append (rundir_fd, id, status, &err);
+  else
+    ret = status_index_rebuild (state_root, rundir_fd, &err);
+  if (UNLIKELY (ret < 0))
+    {
+      unlinkat (rundir_fd, STATUS_INDEX_FILE, 0);
+      crun_error_release (&err);
+    }
+}
+
+/* Read the list of containers from the index.  Returns 1 on success, 0 if
+   the index is not usable and the run directory must be scanned.  */
+static int
+read_status_index (const char *path, libcrun_container_list_t **ret)
+{
+  cleanup_free struct status_index_entry_s *entries = NULL;
+  libcrun_container_list_t *list = NULL;
+  cleanup_close int rundir_fd = -1;
+  cleanup_close int lock_fd = -1;
+  cleanup_close int fd = -1;
+  cleanup_free char *data = NULL;
+  libcrun_error_t err = NULL;
+  size_t len, n, i;
+  int r;
+
+  rundir_fd = TEMP_FAILURE_RETRY (open (path, O_DIRECTORY | O_RDONLY | O_CLOEXEC));
+  if (UNLIKELY (rundir_fd < 0))
+    return 0;
+
+  fd = TEMP_FAILURE_RETRY (openat (rundir_fd, STATUS_INDEX_FILE, O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return 0;
+
+  lock_fd = status_index_lock (rundir_fd, LOCK_SH, &err);
+  if (UNLIKELY (lock_fd < 0))
+    goto fail;
+
+  /* The index could have been replaced before the lock was taken.  */
+  close_and_reset (&fd);
+  fd = TEMP_FAILURE_RETRY (openat (rundir_fd, STATUS_INDEX_FILE, O_RDONLY | O_CLOEXEC));
+  if (fd < 0 || ! status_index_is_fresh (rundir_fd, fd))
+    return 0;
+
+  r = read_all_fd (fd, STATUS_INDEX_FILE, &data, &len, &err);
+  if (UNLIKELY (r < 0))
+    goto fail;
+
+  r = status_index_replay (data, len, &entries, &n, &err);
+  if (UNLIKELY (r < 0))
+    goto fail;
+
+  for (i = 0; i < n; i++)
+    {
+      libcrun_container_list_t *next;
+      libcrun_container_status_t *status;
+
+      status = xmalloc0 (sizeof (*status));
+      status_index_entry_to_status (&entries[i], status);
+
+      next = xmalloc0 (sizeof (*next));
+      next->name = xstrdup (entries[i].fields[STATUS_INDEX_ID]);
+      next->status = status;
+      next->next = list;
+      list = next;
+    }
+
+  *ret = list;
+  return 1;
+
+fail:
+  crun_error_release (&err);
+  return 0;
+}
+
+/* The binary status file stores the same information as the JSON status
+   file, as a struct status_index_header_s followed by a single status
+   index record, so that it can be read with a single pread and no parsing.
+   The JSON status file is still written, for compatibility with older
+   versions, and it is used when the binary file is missing or invalid.  */
+
+#define STATUS_BINARY_MAGIC 0x74617473
+#define STATUS_BINARY_VERSION 1
+/* Size of the buffer used to read the binary status file in one go.  */
+#define STATUS_BINARY_READ_SIZE 4096
+
+static int
+write_binary_status_file (const char *file, const char *id, libcrun_container_status_t *status,
+                          libcrun_error_t *err)
+{
+  struct status_index_header_s *header;
+  cleanup_free char *file_tmp = NULL;
+  cleanup_free char *record = NULL;
+  cleanup_free char *buffer = NULL;
+  cleanup_close int fd = -1;
+  size_t len;
+  int ret;
+
+  record = status_index_make_record (STATUS_INDEX_ADD, id, status, &len);
+
+  buffer = xmalloc (sizeof (*header) + len);
+  header = (struct status_index_header_s *) buffer;
+  header->magic = STATUS_BINARY_MAGIC;
+  header->version = STATUS_BINARY_VERSION;
+  header->base_size = sizeof (*header) + len;
+  memcpy (buffer + sizeof (*header), record, len);
+
+  xasprintf (&file_tmp, "%s.tmp", file);
+  fd = TEMP_FAILURE_RETRY (open (file_tmp, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0700));
+  if (UNLIKELY (fd < 0))
+    return crun_make_error (err, errno, "cannot open binary status file");
+
+  ret = safe_write (fd, buffer, sizeof (*header) + len);
+  if (UNLIKELY (ret < 0))
+    {
+      ret = crun_make_error (err, errno, "cannot write binary status file");
+      unlink (file_tmp);
+      return ret;
+    }
+
+  if (UNLIKELY (rename (file_tmp, file) < 0))
+    {
+      ret = crun_make_error (err, errno, "cannot rename binary status file");
+      unlink (file_tmp);
+      return ret;
+    }
 
   return 0;
 }
 
+/* Returns 1 if STATUS was read from the binary status file, 0 if the JSON
+   status file must be used instead.  */
+static int
+read_binary_status_file (libcrun_container_status_t *status, const char *file, const char *id)
+{
+  const struct status_index_header_s *header;
+  struct status_index_entry_s entry;
+  cleanup_free char *allocated = NULL;
+  char buffer[STATUS_BINARY_READ_SIZE] __attribute__ ((aligned (8)));
+  cleanup_close int fd = -1;
+  const char *data = buffer;
+  ssize_t len;
+
+  fd = TEMP_FAILURE_RETRY (open (file, O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return 0;
+
+  len = TEMP_FAILURE_RETRY (pread (fd, buffer, sizeof (buffer), 0));
+  if (UNLIKELY (len < 0))
+    return 0;
+
+  /* The file might not fit in the buffer, read it all.  */
+  if ((size_t) len == sizeof (buffer))
+    {
+      libcrun_error_t err = NULL;
+      size_t size;
+      int ret;
+
+      ret = read_all_fd (fd, file, &allocated, &size, &err);
+      if (UNLIKELY (ret < 0))
+        {
+          crun_error_release (&err);
+          return 0;
+        }
+      data = allocated;
+      len = size;
+    }
+
+  header = (const struct status_index_header_s *) data;
+  if ((size_t) len < sizeof (*header) || header->magic != STATUS_BINARY_MAGIC
+      || header->version != STATUS_BINARY_VERSION || header->base_size != (size_t) len)
+    return 0;
+
+  if (status_index_parse_record (data + sizeof (*header), len - sizeof (*header), &entry) == 0)
+    return 0;
+
+  if (entry.record->op != STATUS_INDEX_ADD || strcmp (entry.fields[STATUS_INDEX_ID], id) != 0)
+    return 0;
+
+  status_index_entry_to_status (&entry, status);
+  return 1;
+}
+
 int
 libcrun_write_container_status (const char *state_root, const char *id, libcrun_container_status_t *status,
                                 libcrun_error_t *err)
 {
   int r, ret;
   cleanup_free char *file = get_state_directory_status_file (state_root, id);
+  cleanup_free char *binary_file = NULL;
   cleanup_free char *file_tmp = NULL;
   size_t len;
   cleanup_close int fd_write = -1;
@@ -293,6 +1052,17 @@ libcrun_write_container_status (const char *state_root, const char *id, libcrun_
   if (UNLIKELY (r != yajl_gen_status_ok))
     goto yajl_error;
 
+  if (status->start_fd > 0)
+    {
+      r = yajl_gen_string (gen, YAJL_STR ("start-fd"), strlen ("start-fd"));
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
+
+      r = yajl_gen_integer (gen, status->start_fd);
+      if (UNLIKELY (r != yajl_gen_status_ok))
+        goto yajl_error;
+    }
+
   r = yajl_gen_map_close (gen);
   if (UNLIKELY (r != yajl_gen_status_ok))
     goto yajl_error;
@@ -309,12 +1079,42 @@ libcrun_write_container_status (const char *state_root, const char *id, libcrun_
 
   close_and_reset (&fd_write);
 
+  /* Remove the old binary status file before the JSON file is replaced, so
+     that it cannot be read once it is stale.  Until the new one is written,
+     or if writing it fails, the readers fall back to the JSON file.  */
+  xasprintf (&binary_file, "%s.bin", file);
+  if (UNLIKELY (unlink (binary_file) < 0 && errno != ENOENT))
+    {
+      ret = crun_make_error (err, errno, "cannot remove binary status file");
+      goto exit;
+    }
+
   if (UNLIKELY (rename (file_tmp, file) < 0))
     {
       ret = crun_make_error (err, errno, "cannot rename status file");
       goto exit;
     }
 
+  {
+    libcrun_error_t tmp_err = NULL;
+
+    if (UNLIKELY (write_binary_status_file (binary_file, id, status, &tmp_err) < 0))
+      crun_error_release (&tmp_err);
+  }
+
+  {
+    cleanup_free char *dir = get_run_directory (state_root);
+    cleanup_close int rundir_fd = -1;
+    cleanup_close int lock_fd = -1;
+    bool fresh;
+
+    rundir_fd = TEMP_FAILURE_RETRY (open (dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC));
+    if (LIKELY (rundir_fd >= 0))
+      lock_fd = status_index_begin (rundir_fd, &fresh);
+    if (LIKELY (lock_fd >= 0))
+      status_index_end (state_root, rundir_fd, fresh, id, status);
+  }
+
 exit:
   if (gen)
     yajl_gen_free (gen);
@@ -336,8 +1136,13 @@ libcrun_read_container_status (libcrun_container_status_t *status, const char *s
   char err_buffer[256];
   int ret;
   cleanup_free char *file = get_state_directory_status_file (state_root, id);
+  cleanup_free char *binary_file = NULL;
   yajl_val tree, tmp;
 
+  xasprintf (&binary_file, "%s.bin", file);
+  if (read_binary_status_file (status, binary_file, id))
+    return 0;
+
   ret = read_all_file (file, &buffer, NULL, err);
   if (UNLIKELY (ret < 0))
     return ret;
@@ -407,6 +1212,11 @@ libcrun_read_container_status (libcrun_container_status_t *status, const char *s
     const char *detached[] = { "detached", NULL };
     status->detached = YAJL_IS_TRUE (yajl_tree_get (tree, detached, yajl_t_true));
   }
+  {
+    const char *start_fd[] = { "start-fd", NULL };
+    tmp = yajl_tree_get (tree, start_fd, yajl_t_number);
+    status->start_fd = tmp ? strtol (YAJL_GET_NUMBER (tmp), NULL, 10) : 0;
+  }
   {
     const char *external[] = { "external_descriptors", NULL };
     const unsigned char *buf = NULL;
@@ -465,12 +1275,56 @@ libcrun_status_check_directories (const char *state_root, const char *id, libcru
   if (ret)
     return crun_make_error (err, 0, "container `%s` already exists", id);
 
-  if (UNLIKELY (mkdir (dir, 0700) < 0))
-    return crun_make_error (err, 0, "cannot create state directory for `%s`", id);
+  {
+    cleanup_close int rundir_fd = -1;
+    cleanup_close int lock_fd = -1;
+    bool fresh = false;
+
+    rundir_fd = TEMP_FAILURE_RETRY (open (run_directory, O_DIRECTORY | O_RDONLY | O_CLOEXEC));
+    if (LIKELY (rundir_fd >= 0))
+      lock_fd = status_index_begin (rundir_fd, &fresh);
+
+    if (UNLIKELY (mkdir (dir, 0700) < 0))
+      return crun_make_error (err, 0, "cannot create state directory for `%s`", id);
+
+    /* The new directory has no status file yet, so the index is still
+       accurate: only make sure it is not considered stale.  */
+    if (fresh)
+      {
+        libcrun_error_t tmp_err = NULL;
+
+        if (UNLIKELY (status_index_update_stamp (rundir_fd, &tmp_err) < 0))
+          {
+            crun_error_release (&tmp_err);
+            unlinkat (rundir_fd, STATUS_INDEX_FILE, 0);
+          }
+      }
+  }
 
   return 0;
 }
 
+int
+libcrun_get_cache_directory (const char *state_root, const char *name, char **out, libcrun_error_t *err)
+{
+  cleanup_free char *run_directory = get_run_directory (state_root);
+  cleanup_free char *path = NULL;
+  int ret;
+
+  /* The leading dot hides the directory from libcrun_get_containers_list.  */
+  ret = append_paths (&path, err, run_directory, ".cache", name, NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  ret = crun_ensure_directory (path, 0700, false, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  *out = path;
+  path = NULL;
+  return 0;
+}
+
 static int
 rmdirfd (const char *namedir, int fd, libcrun_error_t *err)
 {
@@ -521,8 +1375,10 @@ libcrun_container_delete_status (const char *state_root, const char *id, libcrun
 {
   int ret;
   cleanup_close int rundir_dfd = -1;
+  cleanup_close int lock_fd = -1;
   cleanup_close int dfd = -1;
   cleanup_free char *dir = NULL;
+  bool fresh;
 
   dir = get_run_directory (state_root);
   if (UNLIKELY (dir == NULL))
@@ -532,6 +1388,8 @@ libcrun_container_delete_status (const char *state_root, const char *id, libcrun
   if (UNLIKELY (rundir_dfd < 0))
     return crun_make_error (err, errno, "cannot open run directory `%s`", dir);
 
+  lock_fd = status_index_begin (rundir_dfd, &fresh);
+
   dfd = openat (rundir_dfd, id, O_DIRECTORY | O_RDONLY);
   if (UNLIKELY (dfd < 0))
     return crun_make_error (err, errno, "cannot open directory '%s/%s'", dir, id);
@@ -542,13 +1400,25 @@ libcrun_container_delete_status (const char *state_root, const char *id, libcrun
   dfd = -1;
 
   if (UNLIKELY (ret < 0))
-    return ret;
+    goto fail;
 
   ret = unlinkat (rundir_dfd, id, AT_REMOVEDIR);
   if (UNLIKELY (ret < 0))
-    return crun_make_error (err, errno, "cannot rm state directory `%s/%s`", dir, id);
+    {
+      ret = crun_make_error (err, errno, "cannot rm state directory `%s/%s`", dir, id);
+      goto fail;
+    }
+
+  if (LIKELY (lock_fd >= 0))
+    status_index_end (state_root, rundir_dfd, fresh, id, NULL);
 
   return 0;
+
+fail:
+  /* The status file could be gone already, do not keep an index that lists it.  */
+  if (lock_fd >= 0)
+    unlinkat (rundir_dfd, STATUS_INDEX_FILE, 0);
+  return ret;
 }
 
 void
@@ -565,12 +1435,11 @@ libcrun_free_container_status (libcrun_container_status_t *status)
   free (status->owner);
 }
 
-int
-libcrun_get_containers_list (libcrun_container_list_t **ret, const char *state_root, libcrun_error_t *err)
+static int
+get_containers_list_from_directory (libcrun_container_list_t **ret, const char *path, libcrun_error_t *err)
 {
   struct dirent *next;
   cleanup_container_list libcrun_container_list_t *tmp = NULL;
-  cleanup_free char *path = get_run_directory (state_root);
   cleanup_dir DIR *dir = NULL;
 
   *ret = NULL;
@@ -594,15 +1463,12 @@ libcrun_get_containers_list (libcrun_container_list_t **ret, const char *state_r
 
       exists = crun_path_exists (status_file, err);
       if (exists < 0)
-        {
-          libcrun_free_containers_list (tmp);
-          return exists;
-        }
+        return exists;
 
       if (! exists)
         continue;
 
-      next_container = xmalloc (sizeof (libcrun_container_list_t));
+      next_container = xmalloc0 (sizeof (libcrun_container_list_t));
       next_container->name = xstrdup (next->d_name);
       next_container->next = tmp;
       tmp = next_container;
@@ -612,6 +1478,17 @@ libcrun_get_containers_list (libcrun_container_list_t **ret, const char *state_r
   return 0;
 }
 
+int
+libcrun_get_containers_list (libcrun_container_list_t **ret, const char *state_root, libcrun_error_t *err)
+{
+  cleanup_free char *path = get_run_directory (state_root);
+
+  if (read_status_index (path, ret))
+    return 0;
+
+  return get_containers_list_from_directory (ret, path, err);
+}
+
 void
 libcrun_free_containers_list (libcrun_container_list_t *list)
 {
@@ -620,6 +1497,11 @@ libcrun_free_containers_list (libcrun_container_list_t *list)
     {
       next = list->next;
       free (list->name);
+      if (list->status)
+        {
+          libcrun_free_container_status (list->status);
+          free (list->status);
+        }
       free (list);
       list = next;
     }
@@ -641,6 +1523,11 @@ libcrun_check_pid_valid (libcrun_container_status_t *status, libcrun_error_t *er
   if (! status->process_start_time)
     return 1;
 
+  /* A process that doesn't exist anymore needs no further checks, this
+     saves reading /proc for stopped containers.  */
+  if (kill (status->pid, 0) < 0 && errno == ESRCH)
+    return 0;
+
   ret = read_pid_stat (status->pid, &st, err);
   if (UNLIKELY (ret < 0))
     return ret;
@@ -731,3 +1618,316 @@ libcrun_status_has_read_exec_fifo (const char *state_root, const char *id, libcr
 
   return crun_path_exists (fifo_path, err);
 }
+
+static int
+syscall_pidfd_open (pid_t pid, unsigned int flags)
+{
+#if defined __NR_pidfd_open
+  return (int) syscall (__NR_pidfd_open, pid, flags);
+#else
+  (void) pid;
+  (void) flags;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static int
+syscall_pidfd_getfd (int pidfd, int targetfd, unsigned int flags)
+{
+#if defined __NR_pidfd_getfd
+  return (int) syscall (__NR_pidfd_getfd, pidfd, targetfd, flags);
+#else
+  (void) pidfd;
+  (void) targetfd;
+  (void) flags;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/* Create the eventfd the container process waits on, together with the
+   exec fifo, before it runs the user process.  Returns -1 if it is not
+   supported, in that case only the exec fifo is used.  */
+int
+libcrun_status_create_start_event (void)
+{
+  int fd;
+
+  fd = eventfd (0, EFD_CLOEXEC);
+  if (UNLIKELY (fd < 0))
+    return -1;
+
+  /* 0 is used in the status file for no start event, and the stdio of the
+     container process replaces the fds 0, 1 and 2.  */
+  if (UNLIKELY (fd < 3))
+    {
+      int new_fd = fcntl (fd, F_DUPFD_CLOEXEC, 3);
+      close (fd);
+      return new_fd;
+    }
+  return fd;
+}
+
+/* Start the container through its start event.  The start event fd is
+   copied from the container process with pidfd_getfd(2), so there is no
+   need to open the exec fifo.  The exec fifo is still deleted, so that
+   the container is not reported as created anymore and that it cannot be
+   started twice.  Returns 1 if the container was started, 0 if the exec
+   fifo must be used instead.  */
+int
+libcrun_status_write_start_event (libcrun_container_status_t *status, const char *state_root, const char *id,
+                                  libcrun_error_t *err)
+{
+  cleanup_free char *state_dir = NULL;
+  cleanup_free char *fifo_path = NULL;
+  cleanup_close int pidfd = -1;
+  cleanup_close int fd = -1;
+  char fd_path[64];
+  char link[64];
+  ssize_t link_len;
+  uint64_t value = 1;
+  int ret;
+
+  if (status->start_fd <= 0)
+    return 0;
+
+  /* Once the container is started the fifo is gone, and the workload can
+     have reused the fd number of the start event.  */
+  state_dir = libcrun_get_state_directory (state_root, id);
+  ret = append_paths (&fifo_path, err, state_dir, "exec.fifo", NULL);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  if (access (fifo_path, F_OK) < 0)
+    return 0;
+
+  pidfd = syscall_pidfd_open (status->pid, 0);
+  if (UNLIKELY (pidfd < 0))
+    return 0;
+
+  /* It can fail with EPERM if the container process is not dumpable.  */
+  fd = syscall_pidfd_getfd (pidfd, status->start_fd, 0);
+  if (UNLIKELY (fd < 0))
+    return 0;
+
+  /* Never write to anything else than the start eventfd.  */
+  sprintf (fd_path, "/proc/self/fd/%d", fd);
+  link_len = readlink (fd_path, link, sizeof (link) - 1);
+  if (link_len < 0)
+    return 0;
+  link[link_len] = '\0';
+  if (strcmp (link, "anon_inode:[eventfd]") != 0)
+    return 0;
+
+  /* Delete the fifo only once the container is started, otherwise a failed
+     write would leave a container that cannot be started anymore.  */
+  ret = TEMP_FAILURE_RETRY (write (fd, &value, sizeof (value)));
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "write to the start event");
+
+  ret = unlink (fifo_path);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "unlink `%s`", fifo_path);
+
+  return 1;
+}
+
+struct process_info_reader_s
+{
+  int procfd;
+  libcrun_process_info_t *info;
+  size_t len;
+  size_t next;
+  long clock_ticks;
+  uint64_t boot_time;
+};
+
+static int
+read_proc_file (int dirfd, const char *name, struct crun_read_buffer_s *buffer)
+{
+  libcrun_error_t tmp_err = NULL;
+  cleanup_close int fd = -1;
+  int ret;
+
+  fd = TEMP_FAILURE_RETRY (openat (dirfd, name, O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return -1;
+
+  ret = read_all_fd_buffer (fd, name, buffer, NULL, &tmp_err);
+  if (UNLIKELY (ret < 0))
+    crun_error_release (&tmp_err);
+  return ret;
+}
+
+/* Fill INFO from the stat and status files of the process.  The state is
+   left to 0 if the process exited in the meanwhile.  */
+static void
+read_process_info (struct process_info_reader_s *reader, struct crun_read_buffer_s *buffer,
+                   libcrun_process_info_t *info)
+{
+  cleanup_close int piddirfd = -1;
+  char pid_str[16];
+  char *start, *end, *it;
+  uint64_t values[20];
+  size_t len;
+  int i;
+
+  sprintf (pid_str, "%d", info->pid);
+  piddirfd = TEMP_FAILURE_RETRY (openat (reader->procfd, pid_str, O_DIRECTORY | O_PATH | O_CLOEXEC));
+  if (piddirfd < 0)
+    return;
+
+  if (read_proc_file (piddirfd, "stat", buffer) < 0)
+    return;
+
+  /* The command name is between the parens and it can contain any
+     character, also a ')'.  */
+  start = strchr (buffer->data, '(');
+  end = strrchr (buffer->data, ')');
+  if (start == NULL || end == NULL || end < start || end[1] != ' ')
+    return;
+
+  len = end - start - 1;
+  if (len >= sizeof (info->comm))
+    len = sizeof (info->comm) - 1;
+  memcpy (info->comm, start + 1, len);
+  info->comm[len] = '\0';
+
+  /* VALUES[0] is the state, the other fields are numbers.  */
+  it = end + 2;
+  for (i = 0; i < 20; i++)
+    {
+      if (i == 0)
+        {
+          values[0] = *it;
+          it = strchr (it, ' ');
+        }
+      else
+        values[i] = strtoull (it, &it, 10);
+
+      if (it == NULL || *it != ' ')
+        break;
+      it++;
+    }
+  if (i < 19)
+    return;
+
+  info->cpu_time = (values[11] + values[12]) * 1000000 / reader->clock_ticks;
+  info->threads = values[17];
+  info->start_time = reader->boot_time + values[19] / reader->clock_ticks;
+
+  if (read_proc_file (piddirfd, "status", buffer) == 0)
+    {
+      it = strstr (buffer->data, "\nVmRSS:");
+      if (it)
+        info->rss = strtoull (it + sizeof ("\nVmRSS:") - 1, NULL, 10) * 1024;
+    }
+
+  info->state = (char) values[0];
+}
+
+static void *
+process_info_worker (void *arg)
+{
+  struct process_info_reader_s *reader = arg;
+  cleanup_read_buffer struct crun_read_buffer_s buffer = {
+    NULL,
+  };
+
+  for (;;)
+    {
+      size_t i = __atomic_fetch_add (&reader->next, 1, __ATOMIC_RELAXED);
+      if (i >= reader->len)
+        break;
+
+      read_process_info (reader, &buffer, &reader->info[i]);
+    }
+
+  return NULL;
+}
+
+static uint64_t
+get_boot_time ()
+{
+  cleanup_free char *content = NULL;
+  libcrun_error_t tmp_err = NULL;
+  char *it;
+  int ret;
+
+  ret = read_all_file ("/proc/stat", &content, NULL, &tmp_err);
+  if (UNLIKELY (ret < 0))
+    {
+      crun_error_release (&tmp_err);
+      return 0;
+    }
+
+  it = strstr (content, "\nbtime ");
+  if (it == NULL)
+    return 0;
+
+  return strtoull (it + sizeof ("\nbtime ") - 1, NULL, 10);
+}
+
+/* Use threads only for many processes, the thread creation is not worth
+   it otherwise.  */
+#define PROCESS_INFO_PARALLEL_MIN 256
+#define PROCESS_INFO_MAX_WORKERS 4
+
+/* Read the details of the N_PIDS processes in PIDS into INFO, that must
+   have space for N_PIDS entries.  The /proc files of each process are
+   opened through a directory fd and read in a buffer that is reused for
+   all the processes handled by the same worker.  */
+int
+libcrun_read_processes_info (const pid_t *pids, size_t n_pids, libcrun_process_info_t *info, libcrun_error_t *err)
+{
+  cleanup_close int procfd = -1;
+  struct process_info_reader_s reader;
+  size_t i;
+#ifdef HAVE_PTHREAD
+  pthread_t threads[PROCESS_INFO_MAX_WORKERS];
+  size_t n_threads = 0;
+#endif
+
+  procfd = open ("/proc", O_DIRECTORY | O_PATH | O_CLOEXEC);
+  if (UNLIKELY (procfd < 0))
+    return crun_make_error (err, errno, "open `/proc`");
+
+  memset (info, 0, sizeof (*info) * n_pids);
+  for (i = 0; i < n_pids; i++)
+    info[i].pid = pids[i];
+
+  memset (&reader, 0, sizeof (reader));
+  reader.procfd = procfd;
+  reader.info = info;
+  reader.len = n_pids;
+  reader.clock_ticks = sysconf (_SC_CLK_TCK);
+  if (reader.clock_ticks <= 0)
+    reader.clock_ticks = 100;
+  reader.boot_time = get_boot_time ();
+
+#ifdef HAVE_PTHREAD
+  if (n_pids >= PROCESS_INFO_PARALLEL_MIN)
+    {
+      long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      size_t n_workers = cpus > PROCESS_INFO_MAX_WORKERS ? PROCESS_INFO_MAX_WORKERS : (cpus > 1 ? cpus : 1);
+
+      /* The calling thread is a worker too.  */
+      for (i = 1; i < n_workers; i++)
+        {
+          if (pthread_create (&threads[n_threads], NULL, process_info_worker, &reader) != 0)
+            break;
+          n_threads++;
+        }
+    }
+#endif
+
+  process_info_worker (&reader);
+
+#ifdef HAVE_PTHREAD
+  for (i = 0; i < n_threads; i++)
+    pthread_join (threads[i], NULL);
+#endif
+
+  return 0;
+}
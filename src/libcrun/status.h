@@ -24,13 +24,6 @@
 #include "error.h"
 #include "container.h"
 
-struct libcrun_container_list_s
-{
-  struct libcrun_container_list_s *next;
-  char *name;
-};
-typedef struct libcrun_container_list_s libcrun_container_list_t;
-
 struct libcrun_container_status_s
 {
   pid_t pid;
@@ -44,9 +37,21 @@ struct libcrun_container_status_s
   int detached;
   char *external_descriptors;
   char *owner;
+  /* Number of the start event fd in the container process, 0 if the
+     container can be started only through the exec fifo.  */
+  int start_fd;
 };
 typedef struct libcrun_container_status_s libcrun_container_status_t;
 
+struct libcrun_container_list_s
+{
+  struct libcrun_container_list_s *next;
+  char *name;
+  /* The status of the container when it was read from the index, NULL otherwise.  */
+  libcrun_container_status_t *status;
+};
+typedef struct libcrun_container_list_s libcrun_container_list_t;
+
 LIBCRUN_PUBLIC void libcrun_free_container_status (libcrun_container_status_t *status);
 LIBCRUN_PUBLIC int libcrun_write_container_status (const char *state_root, const char *id,
                                                    libcrun_container_status_t *status, libcrun_error_t *err);
@@ -59,10 +64,33 @@ LIBCRUN_PUBLIC int libcrun_container_delete_status (const char *state_root, cons
 LIBCRUN_PUBLIC int libcrun_get_containers_list (libcrun_container_list_t **ret, const char *state_root,
                                                 libcrun_error_t *err);
 
+struct libcrun_process_info_s
+{
+  pid_t pid;
+  /* The state as reported by /proc, or 0 if the process exited.  */
+  char state;
+  char comm[64];
+  uint64_t threads;
+  /* Resident memory in bytes.  */
+  uint64_t rss;
+  /* User and system time in microseconds.  */
+  uint64_t cpu_time;
+  /* Seconds since the epoch.  */
+  uint64_t start_time;
+};
+typedef struct libcrun_process_info_s libcrun_process_info_t;
+
+LIBCRUN_PUBLIC int libcrun_read_processes_info (const pid_t *pids, size_t n_pids, libcrun_process_info_t *info,
+                                                libcrun_error_t *err);
+
 int libcrun_status_check_directories (const char *state_root, const char *id, libcrun_error_t *err);
+int libcrun_get_cache_directory (const char *state_root, const char *name, char **out, libcrun_error_t *err);
 int libcrun_status_create_exec_fifo (const char *state_root, const char *id, libcrun_error_t *err);
 int libcrun_status_write_exec_fifo (const char *state_root, const char *id, libcrun_error_t *err);
 int libcrun_status_has_read_exec_fifo (const char *state_root, const char *id, libcrun_error_t *err);
+int libcrun_status_create_start_event (void);
+int libcrun_status_write_start_event (libcrun_container_status_t *status, const char *state_root, const char *id,
+                                      libcrun_error_t *err);
 int libcrun_check_pid_valid (libcrun_container_status_t *status, libcrun_error_t *err);
 
 static inline void
@@ -23,12 +23,14 @@
 #include <config.h>
 #include "linux.h"
 #include "utils.h"
+#include "terminal.h"
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <termios.h>
+#include <sys/stat.h>
 
 struct terminal_status_s
 {
@@ -164,3 +166,221 @@ libcrun_terminal_setup_size (int fd, unsigned short rows, unsigned short cols, l
     return crun_make_error (err, errno, "ioctl TIOCSWINSZ");
   return 0;
 }
+
+#define CONSOLE_RELAY_PIPE_SIZE (1024 * 1024)
+#define CONSOLE_RELAY_CHUNK (256 * 1024)
+
+struct libcrun_console_relay_s
+{
+  int master_fd;
+  int log_fd;
+  char *log_path;
+  size_t max_size;
+  size_t written;
+  int pipe_fds[2];
+  bool no_splice;
+};
+
+static int
+console_relay_open_log (struct libcrun_console_relay_s *relay, libcrun_error_t *err)
+{
+  struct stat st;
+  off_t off;
+  int ret;
+
+  /* splice(2) refuses to write to O_APPEND files, so seek to the end
+     instead.  */
+  relay->log_fd = open (relay->log_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+  if (UNLIKELY (relay->log_fd < 0))
+    return crun_make_error (err, errno, "open `%s`", relay->log_path);
+
+  ret = fstat (relay->log_fd, &st);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "fstat `%s`", relay->log_path);
+
+  off = lseek (relay->log_fd, 0, SEEK_END);
+  if (UNLIKELY (off < 0))
+    return crun_make_error (err, errno, "lseek `%s`", relay->log_path);
+
+  relay->written = st.st_size;
+  return 0;
+}
+
+static void
+console_relay_rotate (struct libcrun_console_relay_s *relay)
+{
+  cleanup_free char *old_path = NULL;
+  cleanup_close int old_fd = -1;
+  libcrun_error_t tmp_err = NULL;
+  int ret;
+
+  if (relay->max_size == 0 || relay->written < relay->max_size)
+    return;
+
+  /* The current log stays open until the new one is ready, so that if
+     the rotation fails the output keeps going to the current log and it
+     is tried again after other MAX_SIZE bytes.  */
+  xasprintf (&old_path, "%s.1", relay->log_path);
+  ret = rename (relay->log_path, old_path);
+  if (UNLIKELY (ret < 0))
+    {
+      libcrun_warning ("cannot rotate the console log `%s`: %s", relay->log_path, strerror (errno));
+      relay->written = 0;
+      return;
+    }
+
+  old_fd = relay->log_fd;
+  relay->log_fd = -1;
+  ret = console_relay_open_log (relay, &tmp_err);
+  if (UNLIKELY (ret < 0))
+    {
+      libcrun_warning ("cannot rotate the console log `%s`: %s", relay->log_path, tmp_err->msg);
+      crun_error_release (&tmp_err);
+      if (relay->log_fd >= 0)
+        close (relay->log_fd);
+      relay->log_fd = old_fd;
+      old_fd = -1;
+      relay->written = 0;
+    }
+}
+
+/* Relay the output of the pty MASTER_FD to LOG_PATH.  When MAX_SIZE is
+   not 0, the log is rotated to LOG_PATH.1 once it grows past MAX_SIZE
+   bytes.  The data is moved with splice(2) through a pipe, so it is not
+   copied to user space.  The caller keeps the ownership of MASTER_FD.  */
+int
+libcrun_console_relay_new (int master_fd, const char *log_path, size_t max_size, libcrun_console_relay_t **out,
+                           libcrun_error_t *err)
+{
+  cleanup_free struct libcrun_console_relay_s *relay = NULL;
+  int ret;
+
+  relay = xmalloc0 (sizeof (*relay));
+  relay->master_fd = master_fd;
+  relay->max_size = max_size;
+  relay->log_fd = relay->pipe_fds[0] = relay->pipe_fds[1] = -1;
+  relay->log_path = xstrdup (log_path);
+
+  ret = console_relay_open_log (relay, err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  ret = pipe2 (relay->pipe_fds, O_CLOEXEC | O_NONBLOCK);
+  if (UNLIKELY (ret < 0))
+    {
+      ret = crun_make_error (err, errno, "pipe2");
+      goto fail;
+    }
+
+  /* A larger pipe means fewer wakeups for chatty containers, it is fine
+     if the limit does not allow it.  */
+  (void) fcntl (relay->pipe_fds[1], F_SETPIPE_SZ, CONSOLE_RELAY_PIPE_SIZE);
+
+  ret = set_blocking_fd (master_fd, 0, err);
+  if (UNLIKELY (ret < 0))
+    goto fail;
+
+  *out = relay;
+  relay = NULL;
+  return 0;
+
+fail:
+  if (relay->log_fd >= 0)
+    close (relay->log_fd);
+  if (relay->pipe_fds[0] >= 0)
+    close (relay->pipe_fds[0]);
+  if (relay->pipe_fds[1] >= 0)
+    close (relay->pipe_fds[1]);
+  free (relay->log_path);
+  return ret;
+}
+
+static int
+console_relay_write_all (int fd, const char *buffer, size_t len, libcrun_error_t *err)
+{
+  while (len > 0)
+    {
+      ssize_t r = TEMP_FAILURE_RETRY (write (fd, buffer, len));
+      if (UNLIKELY (r < 0))
+        return crun_make_error (err, errno, "write to console log");
+      buffer += r;
+      len -= r;
+    }
+  return 0;
+}
+
+/* Fallback for kernels where the pty does not support splice.  */
+static int
+console_relay_copy (struct libcrun_console_relay_s *relay, libcrun_error_t *err)
+{
+  cleanup_free char *buffer = xmalloc (CONSOLE_RELAY_CHUNK);
+  int ret;
+
+  for (;;)
+    {
+      ssize_t r = TEMP_FAILURE_RETRY (read (relay->master_fd, buffer, CONSOLE_RELAY_CHUNK));
+      if (r == 0 || (r < 0 && (errno == EAGAIN || errno == EIO)))
+        return 0;
+      if (UNLIKELY (r < 0))
+        return crun_make_error (err, errno, "read from terminal");
+
+      ret = console_relay_write_all (relay->log_fd, buffer, r, err);
+      if (UNLIKELY (ret < 0))
+        return ret;
+
+      relay->written += r;
+      console_relay_rotate (relay);
+    }
+}
+
+/* Move all the data currently available on the pty to the log.  */
+int
+libcrun_console_relay_pump (libcrun_console_relay_t *relay, libcrun_error_t *err)
+{
+  if (relay->no_splice)
+    return console_relay_copy (relay, err);
+
+  for (;;)
+    {
+      ssize_t in, out;
+
+      in = TEMP_FAILURE_RETRY (splice (relay->master_fd, NULL, relay->pipe_fds[1], NULL, CONSOLE_RELAY_CHUNK,
+                                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+      if (in == 0 || (in < 0 && (errno == EAGAIN || errno == EIO)))
+        return 0;
+      if (in < 0 && errno == EINVAL)
+        {
+          relay->no_splice = true;
+          return console_relay_copy (relay, err);
+        }
+      if (UNLIKELY (in < 0))
+        return crun_make_error (err, errno, "splice from terminal");
+
+      while (in > 0)
+        {
+          out = TEMP_FAILURE_RETRY (splice (relay->pipe_fds[0], NULL, relay->log_fd, NULL, in, SPLICE_F_MOVE));
+          if (UNLIKELY (out < 0))
+            return crun_make_error (err, errno, "splice to console log");
+          in -= out;
+          relay->written += out;
+        }
+
+      console_relay_rotate (relay);
+    }
+}
+
+void
+libcrun_console_relay_free (libcrun_console_relay_t *relay)
+{
+  if (relay == NULL)
+    return;
+
+  if (relay->log_fd >= 0)
+    close (relay->log_fd);
+  if (relay->pipe_fds[0] >= 0)
+    close (relay->pipe_fds[0]);
+  if (relay->pipe_fds[1] >= 0)
+    close (relay->pipe_fds[1]);
+  free (relay->log_path);
+  free (relay);
+}
@@ -33,4 +33,18 @@ int libcrun_setup_terminal_ptmx (int fd, void **current_status, libcrun_error_t
 
 int libcrun_terminal_setup_size (int fd, unsigned short rows, unsigned short cols, libcrun_error_t *err);
 
+typedef struct libcrun_console_relay_s libcrun_console_relay_t;
+
+int libcrun_console_relay_new (int master_fd, const char *log_path, size_t max_size, libcrun_console_relay_t **relay,
+                               libcrun_error_t *err);
+int libcrun_console_relay_pump (libcrun_console_relay_t *relay, libcrun_error_t *err);
+void libcrun_console_relay_free (libcrun_console_relay_t *relay);
+
+static inline void
+cleanup_console_relayp (libcrun_console_relay_t **relay)
+{
+  libcrun_console_relay_free (*relay);
+}
+#define cleanup_console_relay __attribute__ ((cleanup (cleanup_console_relayp)))
+
 #endif
@@ -0,0 +1,165 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <config.h>
+#include "trace.h"
+#include "metrics.h"
+#include "utils.h"
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#define TRACE_MAX_EVENTS 128
+
+bool libcrun_trace_active;
+
+/* libcrun_trace_active is also set when only the metrics need the phase
+   durations, then the events are not recorded.  */
+static bool trace_record_events;
+
+static struct libcrun_trace_event_s trace_events[TRACE_MAX_EVENTS];
+static size_t trace_events_len;
+static int trace_track = LIBCRUN_TRACE_TRACK_RUNTIME;
+
+uint64_t
+libcrun_trace_now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+libcrun_trace_enable ()
+{
+  libcrun_trace_active = true;
+  trace_record_events = true;
+}
+
+void
+libcrun_trace_end (const char *name, uint64_t start)
+{
+  struct libcrun_trace_event_s *ev;
+  uint64_t end;
+
+  if (start == 0)
+    return;
+
+  end = libcrun_trace_now ();
+  libcrun_metrics_observe_phase (name, end - start);
+
+  if (! trace_record_events || trace_events_len == TRACE_MAX_EVENTS)
+    return;
+
+  ev = &trace_events[trace_events_len++];
+  ev->start_ns = start;
+  ev->end_ns = end;
+  ev->track = trace_track;
+  strncpy (ev->name, name, sizeof (ev->name) - 1);
+  ev->name[sizeof (ev->name) - 1] = '\0';
+}
+
+void
+libcrun_trace_reset (int track)
+{
+  trace_events_len = 0;
+  trace_track = track;
+}
+
+size_t
+libcrun_trace_get_events (const struct libcrun_trace_event_s **events)
+{
+  *events = trace_events;
+  return trace_events_len;
+}
+
+void
+libcrun_trace_import (const struct libcrun_trace_event_s *events, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n && trace_events_len < TRACE_MAX_EVENTS; i++)
+    {
+      trace_events[trace_events_len] = events[i];
+      trace_events[trace_events_len].name[LIBCRUN_TRACE_NAME_LEN - 1] = '\0';
+      trace_events_len++;
+    }
+}
+
+static void
+trace_log_summary (uint64_t origin, uint64_t last)
+{
+  char summary[1024];
+  size_t len = 0;
+  size_t i;
+
+  len = snprintf (summary, sizeof (summary), "trace: total %.3fms", (last - origin) / 1e6);
+  for (i = 0; i < trace_events_len && len < sizeof (summary); i++)
+    len += snprintf (summary + len, sizeof (summary) - len, ", %s%s %.3fms",
+                     trace_events[i].track == LIBCRUN_TRACE_TRACK_INIT ? "init:" : "", trace_events[i].name,
+                     (trace_events[i].end_ns - trace_events[i].start_ns) / 1e6);
+
+  libcrun_warning ("%s", summary);
+}
+
+int
+libcrun_trace_write (const char *path, libcrun_error_t *err)
+{
+  cleanup_file FILE *f = NULL;
+  uint64_t origin = UINT64_MAX, last = 0;
+  pid_t pid = getpid ();
+  size_t i;
+
+  if (! libcrun_trace_active || trace_events_len == 0)
+    return 0;
+
+  for (i = 0; i < trace_events_len; i++)
+    {
+      if (trace_events[i].start_ns < origin)
+        origin = trace_events[i].start_ns;
+      if (trace_events[i].end_ns > last)
+        last = trace_events[i].end_ns;
+    }
+
+  trace_log_summary (origin, last);
+
+  if (path == NULL || path[0] == '\0')
+    return 0;
+
+  f = fopen (path, "we");
+  if (UNLIKELY (f == NULL))
+    return crun_make_error (err, errno, "open `%s`", path);
+
+  fprintf (f, "{\"traceEvents\":[\n");
+  fprintf (f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"crun\"}},\n",
+           pid, LIBCRUN_TRACE_TRACK_RUNTIME);
+  fprintf (f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"container init\"}}",
+           pid, LIBCRUN_TRACE_TRACK_INIT);
+  for (i = 0; i < trace_events_len; i++)
+    fprintf (f, ",\n{\"name\":\"%s\",\"cat\":\"crun\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+             trace_events[i].name, (trace_events[i].start_ns - origin) / 1e3,
+             (trace_events[i].end_ns - trace_events[i].start_ns) / 1e3, pid, trace_events[i].track);
+  fprintf (f, "\n]}\n");
+
+  if (UNLIKELY (ferror (f)))
+    return crun_make_error (err, errno, "write `%s`", path);
+
+  return 0;
+}
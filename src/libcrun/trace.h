@@ -0,0 +1,76 @@
+/*
+ * crun - OCI runtime written in C
+ *
+ * Copyright (C) 2021 Giuseppe Scrivano <giuseppe@scrivano.org>
+ * crun is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * crun is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with crun.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <config.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "error.h"
+
+/* Lightweight tracing of the container setup phases.  When tracing is
+   not enabled, libcrun_trace_begin returns 0 after testing a flag and
+   libcrun_trace_end does nothing.  */
+
+#define LIBCRUN_TRACE_NAME_LEN 32
+
+enum
+{
+  LIBCRUN_TRACE_TRACK_RUNTIME = 1,
+  LIBCRUN_TRACE_TRACK_INIT = 2,
+};
+
+struct libcrun_trace_event_s
+{
+  uint64_t start_ns;
+  uint64_t end_ns;
+  int32_t track;
+  char name[LIBCRUN_TRACE_NAME_LEN];
+};
+
+extern bool libcrun_trace_active;
+
+uint64_t libcrun_trace_now ();
+
+static inline uint64_t
+libcrun_trace_begin ()
+{
+  if (__builtin_expect (! libcrun_trace_active, 1))
+    return 0;
+  return libcrun_trace_now ();
+}
+
+/* Record the phase NAME, started at START.  */
+void libcrun_trace_end (const char *name, uint64_t start);
+
+/* Drop the recorded events and record the next ones on TRACK.  Used by
+   the container init, that inherits the events of its parent.  */
+void libcrun_trace_reset (int track);
+
+size_t libcrun_trace_get_events (const struct libcrun_trace_event_s **events);
+
+void libcrun_trace_import (const struct libcrun_trace_event_s *events, size_t n);
+
+LIBCRUN_PUBLIC void libcrun_trace_enable ();
+
+/* Write the recorded events to PATH in the Chrome trace event format, and
+   log a one line summary.  */
+LIBCRUN_PUBLIC int libcrun_trace_write (const char *path, libcrun_error_t *err);
+
+#endif
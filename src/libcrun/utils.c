@@ -19,6 +19,7 @@
 #define _GNU_SOURCE
 #include <config.h>
 #include "utils.h"
+#include "metrics.h"
 #include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
@@ -28,7 +29,6 @@
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/signalfd.h>
-#include <sys/epoll.h>
 #include <sys/syscall.h>
 #include <sys/wait.h>
 #include <pwd.h>
@@ -44,6 +44,14 @@
 #ifdef HAVE_LINUX_OPENAT2_H
 #  include <linux/openat2.h>
 #endif
+#ifdef HAVE_LINUX_IO_URING_H
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#endif
+#include <sys/ioctl.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
 
 #ifndef CLOSE_RANGE_CLOEXEC
 #  define CLOSE_RANGE_CLOEXEC (1U << 2)
@@ -51,12 +59,24 @@
 #ifndef RESOLVE_IN_ROOT
 #  define RESOLVE_IN_ROOT 0x10
 #endif
+#ifndef RESOLVE_NO_MAGICLINKS
+#  define RESOLVE_NO_MAGICLINKS 0x02
+#endif
+#ifndef RESOLVE_NO_SYMLINKS
+#  define RESOLVE_NO_SYMLINKS 0x04
+#endif
+#ifndef RESOLVE_BENEATH
+#  define RESOLVE_BENEATH 0x08
+#endif
 #ifndef __NR_close_range
 #  define __NR_close_range 436
 #endif
 #ifndef __NR_openat2
 #  define __NR_openat2 437
 #endif
+#ifndef FICLONE
+#  define FICLONE _IOW (0x94, 9, int)
+#endif
 
 #define MAX_READLINKS 32
 
@@ -108,6 +128,103 @@ xasprintf (char **str, const char *fmt, ...)
   return ret;
 }
 
+void
+crun_arena_init (struct crun_arena_s *arena, void *buffer, size_t size)
+{
+  struct crun_arena_chunk_s *chunk = buffer;
+
+  arena->chunks = NULL;
+  if (buffer == NULL || size <= sizeof (*chunk))
+    return;
+
+  chunk->next = NULL;
+  chunk->size = size - sizeof (*chunk);
+  chunk->used = 0;
+  chunk->owned = false;
+  arena->chunks = chunk;
+}
+
+void
+crun_arena_release (struct crun_arena_s *arena)
+{
+  struct crun_arena_chunk_s *chunk, *next;
+
+  for (chunk = arena->chunks; chunk; chunk = next)
+    {
+      next = chunk->next;
+      if (chunk->owned)
+        free (chunk);
+    }
+  arena->chunks = NULL;
+}
+
+#define ARENA_MIN_CHUNK_SIZE 4096
+#define ARENA_ALIGNMENT (sizeof (void *))
+
+void *
+crun_arena_alloc (struct crun_arena_s *arena, size_t size)
+{
+  struct crun_arena_chunk_s *chunk = arena->chunks;
+  size_t offset;
+
+  if (chunk)
+    {
+      offset = (chunk->used + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+      if (offset + size <= chunk->size)
+        {
+          chunk->used = offset + size;
+          return chunk->data + offset;
+        }
+    }
+
+  /* Grow geometrically, so that the number of chunks stays small also
+     when the arena is used for many allocations.  */
+  {
+    size_t chunk_size = chunk && chunk->size > ARENA_MIN_CHUNK_SIZE / 2 ? chunk->size * 2 : ARENA_MIN_CHUNK_SIZE;
+
+    while (chunk_size < size)
+      chunk_size *= 2;
+
+    chunk = xmalloc (sizeof (*chunk) + chunk_size);
+    chunk->next = arena->chunks;
+    chunk->size = chunk_size;
+    chunk->used = size;
+    chunk->owned = true;
+    arena->chunks = chunk;
+  }
+  return chunk->data;
+}
+
+char *
+crun_arena_strdup (struct crun_arena_s *arena, const char *str)
+{
+  size_t len = strlen (str) + 1;
+
+  return memcpy (crun_arena_alloc (arena, len), str, len);
+}
+
+char *
+crun_arena_sprintf (struct crun_arena_s *arena, const char *fmt, ...)
+{
+  va_list args_list;
+  char *ret;
+  int len;
+
+  va_start (args_list, fmt);
+  len = vsnprintf (NULL, 0, fmt, args_list);
+  va_end (args_list);
+  if (UNLIKELY (len < 0))
+    OOM ();
+
+  ret = crun_arena_alloc (arena, len + 1);
+
+  va_start (args_list, fmt);
+  vsnprintf (ret, len + 1, fmt, args_list);
+  va_end (args_list);
+
+  return ret;
+}
+
 int
 write_file_at (int dirfd, const char *name, const void *data, size_t len, libcrun_error_t *err)
 {
@@ -147,6 +264,304 @@ write_file (const char *name, const void *data, size_t len, libcrun_error_t *err
   return write_file_with_flags (name, O_CREAT, data, len, err);
 }
 
+void
+crun_write_batch_add (struct crun_write_batch_s *batch, int dirfd, const char *path, const void *data, size_t len)
+{
+  struct crun_write_batch_entry_s *entry;
+
+  if (batch->len == batch->allocated)
+    {
+      batch->allocated = batch->allocated ? batch->allocated * 2 : 8;
+      batch->entries = xrealloc (batch->entries, batch->allocated * sizeof (*batch->entries));
+    }
+
+  entry = &batch->entries[batch->len++];
+  entry->dirfd = dirfd;
+  entry->path = path;
+  entry->data = data;
+  entry->len = len;
+  entry->fd = -1;
+  entry->written = false;
+}
+
+void
+crun_write_batch_release (struct crun_write_batch_s *batch)
+{
+  size_t i;
+
+  for (i = 0; i < batch->len; i++)
+    if (batch->entries[i].fd >= 0)
+      close (batch->entries[i].fd);
+  free (batch->entries);
+  memset (batch, 0, sizeof (*batch));
+}
+
+#if defined HAVE_LINUX_IO_URING_H && defined __NR_io_uring_setup && defined __NR_io_uring_enter
+
+/* Entries handled with one submission.  Each entry uses two SQEs, the
+   write and the linked close.  */
+#  define WRITE_BATCH_RING_CHUNK 32
+/* Setting up the ring costs a few syscalls, use it only when it saves
+   more than that.  */
+#  define WRITE_BATCH_RING_MIN 4
+
+struct write_batch_ring_s
+{
+  int fd;
+  void *ring;
+  size_t ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned queued;
+};
+
+static void
+write_batch_ring_release (struct write_batch_ring_s *ring)
+{
+  if (ring->sqes)
+    munmap (ring->sqes, ring->sqes_size);
+  if (ring->ring)
+    munmap (ring->ring, ring->ring_size);
+  if (ring->fd >= 0)
+    close (ring->fd);
+}
+
+/* Returns 0 if the ring is ready, -1 if io_uring cannot be used.  */
+static int
+write_batch_ring_init (struct write_batch_ring_s *ring)
+{
+  struct io_uring_params params;
+  size_t sq_size, cq_size;
+  char *base;
+  void *sqes;
+
+  memset (ring, 0, sizeof (*ring));
+  memset (&params, 0, sizeof (params));
+
+  /* ENOSYS, or blocked by seccomp or by the kernel.io_uring_disabled sysctl.  */
+  ring->fd = (int) syscall (__NR_io_uring_setup, WRITE_BATCH_RING_CHUNK * 2, &params);
+  if (ring->fd < 0)
+    return -1;
+
+  /* The requests must run with the credentials and the namespaces of the
+     current task, which is guaranteed only with the native workers.  */
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_NATIVE_WORKERS) == 0)
+    {
+      write_batch_ring_release (ring);
+      return -1;
+    }
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+  ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+  ring->ring = mmap (NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                     IORING_OFF_SQ_RING);
+  if (ring->ring == MAP_FAILED)
+    {
+      ring->ring = NULL;
+      write_batch_ring_release (ring);
+      return -1;
+    }
+
+  ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+  sqes = mmap (NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    {
+      write_batch_ring_release (ring);
+      return -1;
+    }
+  ring->sqes = sqes;
+
+  base = ring->ring;
+  ring->sq_tail = (unsigned *) (base + params.sq_off.tail);
+  ring->sq_mask = (unsigned *) (base + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (base + params.sq_off.array);
+  ring->cq_head = (unsigned *) (base + params.cq_off.head);
+  ring->cq_tail = (unsigned *) (base + params.cq_off.tail);
+  ring->cq_mask = (unsigned *) (base + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (base + params.cq_off.cqes);
+  return 0;
+}
+
+static struct io_uring_sqe *
+write_batch_ring_get_sqe (struct write_batch_ring_s *ring)
+{
+  unsigned tail = *ring->sq_tail + ring->queued;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  ring->sq_array[index] = index;
+  ring->queued++;
+  memset (sqe, 0, sizeof (*sqe));
+  return sqe;
+}
+
+/* Submit the queued SQEs and wait for all their completions, calling
+   COMPLETE for each of them.  Returns -1 if the submission failed.  */
+static int
+write_batch_ring_run (struct write_batch_ring_s *ring, struct crun_write_batch_s *batch,
+                      void (*complete) (struct crun_write_batch_s *batch, uint64_t user_data, int res))
+{
+  unsigned to_submit = ring->queued, pending = ring->queued;
+  int ret;
+
+  if (pending == 0)
+    return 0;
+
+  __atomic_store_n (ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+  ring->queued = 0;
+
+  while (pending > 0)
+    {
+      unsigned head, tail;
+
+      ret = (int) syscall (__NR_io_uring_enter, ring->fd, to_submit, pending, IORING_ENTER_GETEVENTS, NULL, 0);
+      if (ret < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      to_submit -= (unsigned) ret < to_submit ? (unsigned) ret : to_submit;
+
+      head = *ring->cq_head;
+      tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail && pending > 0; head++, pending--)
+        {
+          struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+          complete (batch, cqe->user_data, cqe->res);
+        }
+      __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+  return 0;
+}
+
+static void
+write_batch_open_complete (struct crun_write_batch_s *batch, uint64_t user_data, int res)
+{
+  if (res >= 0)
+    batch->entries[user_data].fd = res;
+}
+
+static void
+write_batch_write_complete (struct crun_write_batch_s *batch, uint64_t user_data, int res)
+{
+  struct crun_write_batch_entry_s *entry = &batch->entries[user_data >> 1];
+
+  /* The close.  If the write failed, it is cancelled and the fd is closed
+     by crun_write_batch_release.  */
+  if (user_data & 1)
+    {
+      if (res >= 0)
+        entry->fd = -1;
+      return;
+    }
+
+  if (res >= 0 && (size_t) res == entry->len)
+    entry->written = true;
+}
+
+static size_t
+write_batch_uring (struct crun_write_batch_s *batch)
+{
+  struct write_batch_ring_s ring;
+  size_t start, end, i, done = 0;
+  int ret;
+
+  if (batch->len < WRITE_BATCH_RING_MIN)
+    return 0;
+
+  if (write_batch_ring_init (&ring) < 0)
+    return 0;
+
+  for (start = 0; start < batch->len; start = end)
+    {
+      struct io_uring_sqe *sqe;
+
+      end = start + WRITE_BATCH_RING_CHUNK;
+      if (end > batch->len)
+        end = batch->len;
+
+      /* The opens do not change anything, they can run in any order.  */
+      for (i = start; i < end; i++)
+        {
+          struct crun_write_batch_entry_s *entry = &batch->entries[i];
+
+          sqe = write_batch_ring_get_sqe (&ring);
+          sqe->opcode = IORING_OP_OPENAT;
+          sqe->fd = entry->dirfd;
+          sqe->addr = (uint64_t) (uintptr_t) entry->path;
+          sqe->open_flags = O_WRONLY | O_CLOEXEC;
+          sqe->user_data = i;
+        }
+      if (write_batch_ring_run (&ring, batch, write_batch_open_complete) < 0)
+        break;
+
+      /* The writes are linked in a single chain, so that they are done in
+         order and a failure cancels all the writes after it.  Stop the chain
+         at the first file that could not be opened.  */
+      sqe = NULL;
+      for (i = start; i < end && batch->entries[i].fd >= 0; i++)
+        {
+          struct crun_write_batch_entry_s *entry = &batch->entries[i];
+
+          sqe = write_batch_ring_get_sqe (&ring);
+          sqe->opcode = IORING_OP_WRITE;
+          sqe->flags = IOSQE_IO_LINK;
+          sqe->fd = entry->fd;
+          sqe->addr = (uint64_t) (uintptr_t) entry->data;
+          sqe->len = entry->len;
+          sqe->user_data = i << 1;
+
+          sqe = write_batch_ring_get_sqe (&ring);
+          sqe->opcode = IORING_OP_CLOSE;
+          sqe->flags = IOSQE_IO_LINK;
+          sqe->fd = entry->fd;
+          sqe->user_data = (i << 1) | 1;
+        }
+      if (sqe && sqe->opcode == IORING_OP_CLOSE)
+        sqe->flags = 0;
+      ret = write_batch_ring_run (&ring, batch, write_batch_write_complete);
+
+      while (done < end && batch->entries[done].written)
+        done++;
+      if (ret < 0 || done < end)
+        break;
+    }
+
+  write_batch_ring_release (&ring);
+  return done;
+}
+#else
+static size_t
+write_batch_uring (struct crun_write_batch_s *batch arg_unused)
+{
+  return 0;
+}
+#endif
+
+/* Write the entries in BATCH to existing files, in order, through io_uring
+   when it is available.  Returns the number of leading entries that were
+   written, the caller must write the others one by one.  An entry is
+   never written after one that failed, and an entry that was written is
+   never part of the returned rest, so each write is done at most once.
+
+   The io_uring requests run on worker threads of the calling process, so
+   this must not be used by a process that later creates or joins a user
+   namespace, such as the container init.  */
+size_t
+crun_write_batch_flush (struct crun_write_batch_s *batch)
+{
+  return write_batch_uring (batch);
+}
+
 int
 detach_process ()
 {
@@ -336,13 +751,15 @@ close_and_replace (int *oldfd, int newfd)
 /* Defined in chroot_realpath.c  */
 char *chroot_realpath (const char *chroot, const char *path, char resolved_path[]);
 
+/* Cleared the first time openat2 fails with ENOSYS.  */
+static bool openat2_supported = true;
+
 int
 safe_openat (int dirfd, const char *rootfs, size_t rootfs_len, const char *path, int flags, int mode,
              libcrun_error_t *err)
 {
   int ret;
   cleanup_close int fd = -1;
-  static bool openat2_supported = true;
   const char *path_in_chroot;
   char buffer[PATH_MAX];
 
@@ -362,6 +779,7 @@ safe_openat (int dirfd, const char *rootfs, size_t rootfs_len, const char *path,
     }
 
 fallback:
+  libcrun_metrics_count (LIBCRUN_METRIC_OPENAT2_FALLBACK);
   path_in_chroot = chroot_realpath (rootfs, path, buffer);
   if (path_in_chroot == NULL)
     return crun_make_error (err, errno, "cannot resolve `%s` under rootfs", path);
@@ -499,9 +917,19 @@ crun_safe_ensure_at (bool do_open, bool dir, int dirfd, const char *dirpath,
             return crun_make_error (err, errno, "mkdir `%s`", cur);
         }
 
-      cwd = safe_openat (dirfd, dirpath, dirpath_len, npath, O_CLOEXEC | O_PATH, 0, err);
-      if (UNLIKELY (cwd < 0))
-        return cwd;
+      /* CWD is already resolved under the root, so a directory that is not a
+         symlink can be opened directly from it.  Resolve again the full path
+         only when it is a symlink.  */
+      ret = -1;
+      if (strcmp (cur, "..") != 0)
+        ret = openat (cwd, cur, O_CLOEXEC | O_PATH | O_NOFOLLOW | O_DIRECTORY);
+      cwd = ret;
+      if (cwd < 0)
+        {
+          cwd = safe_openat (dirfd, dirpath, dirpath_len, npath, O_CLOEXEC | O_PATH, 0, err);
+          if (UNLIKELY (cwd < 0))
+            return cwd;
+        }
 
       close_and_replace (&wd_cleanup, cwd);
 
@@ -540,6 +968,183 @@ crun_safe_create_and_open_ref_at (bool dir, int dirfd, const char *dirpath, size
   return crun_safe_ensure_at (true, dir, dirfd, dirpath, dirpath_len, path, mode, MAX_READLINKS, err);
 }
 
+void
+crun_rootfs_resolver_init (struct crun_rootfs_resolver_s *r, int rootfsfd, const char *rootfs, size_t rootfs_len)
+{
+  memset (r, 0, sizeof (*r));
+  r->rootfsfd = rootfsfd;
+  r->rootfs = rootfs;
+  r->rootfs_len = rootfs_len;
+}
+
+void
+crun_rootfs_resolver_release (struct crun_rootfs_resolver_s *r)
+{
+  size_t i;
+
+  for (i = 0; i < r->entries_len; i++)
+    {
+      TEMP_FAILURE_RETRY (close (r->entries[i].fd));
+      free (r->entries[i].name);
+    }
+  r->entries_len = 0;
+}
+
+/* Length of the first component of PATH, or 0 if PATH has a single component.  */
+static size_t
+first_component_len (const char *path)
+{
+  const char *it = strchr (path, '/');
+
+  if (it == NULL || consume_slashes (it)[0] == '\0')
+    return 0;
+  return it - path;
+}
+
+static void
+rootfs_resolver_drop (struct crun_rootfs_resolver_s *r, size_t i)
+{
+  TEMP_FAILURE_RETRY (close (r->entries[i].fd));
+  free (r->entries[i].name);
+  r->entries[i] = r->entries[--r->entries_len];
+}
+
+/* Drop the cached entries that a mount on PATH hides.  PATH is resolved in
+   the rootfs, so that an entry reached through a symlink, or a PATH that
+   is a symlink to a cached directory, is dropped as well.  A mount on the
+   rootfs itself hides all of them.  */
+void
+crun_rootfs_resolver_invalidate (struct crun_rootfs_resolver_s *r, const char *path)
+{
+  libcrun_error_t tmp_err = NULL;
+  cleanup_close int fd = -1;
+  struct stat target, st;
+  size_t len, i;
+
+  if (r->entries_len == 0)
+    return;
+
+  path = consume_slashes (path);
+  len = strlen (path);
+  while (len > 0 && path[len - 1] == '/')
+    len--;
+
+  for (i = 0; i < r->entries_len; i++)
+    if (len == 0 || (strlen (r->entries[i].name) == len && memcmp (r->entries[i].name, path, len) == 0))
+      rootfs_resolver_drop (r, i--);
+
+  if (r->entries_len == 0)
+    return;
+
+  fd = safe_openat (r->rootfsfd, r->rootfs, r->rootfs_len, path, O_PATH | O_CLOEXEC, 0, &tmp_err);
+  if (UNLIKELY (fd < 0) || UNLIKELY (fstat (fd, &target) < 0))
+    {
+      /* It cannot be checked, do not keep anything.  */
+      crun_error_release (&tmp_err);
+      crun_rootfs_resolver_release (r);
+      return;
+    }
+
+  if (fstat (r->rootfsfd, &st) == 0 && st.st_dev == target.st_dev && st.st_ino == target.st_ino)
+    {
+      crun_rootfs_resolver_release (r);
+      return;
+    }
+
+  for (i = 0; i < r->entries_len; i++)
+    if (fstat (r->entries[i].fd, &st) < 0 || (st.st_dev == target.st_dev && st.st_ino == target.st_ino))
+      rootfs_resolver_drop (r, i--);
+}
+
+static bool
+has_dotdot_component (const char *path)
+{
+  const char *it;
+
+  for (it = path; (it = strstr (it, "..")) != NULL; it += 2)
+    if ((it == path || it[-1] == '/') && (it[2] == '\0' || it[2] == '/'))
+      return true;
+  return false;
+}
+
+static int
+rootfs_resolver_get_dirfd (struct crun_rootfs_resolver_s *r, const char *name, size_t len, libcrun_error_t *err)
+{
+  cleanup_free char *dir = NULL;
+  int fd;
+  size_t i;
+
+  for (i = 0; i < r->entries_len; i++)
+    if (strlen (r->entries[i].name) == len && memcmp (r->entries[i].name, name, len) == 0)
+      return r->entries[i].fd;
+
+  if (r->entries_len == ROOTFS_RESOLVER_MAX_ENTRIES)
+    return -1;
+
+  dir = strndup (name, len);
+  if (UNLIKELY (dir == NULL))
+    OOM ();
+  fd = safe_openat (r->rootfsfd, r->rootfs, r->rootfs_len, dir, O_PATH | O_DIRECTORY | O_CLOEXEC, 0, err);
+  if (fd < 0)
+    {
+      crun_error_release (err);
+      return -1;
+    }
+
+  r->entries[r->entries_len].fd = fd;
+  r->entries[r->entries_len].name = dir;
+  dir = NULL;
+  r->entries_len++;
+  return fd;
+}
+
+/* Same as safe_openat on the rootfs, but when PATH has more components the
+   first one is opened once and kept, and the rest is resolved from there.
+   The rest must not contain any symlink or "..", as they must be resolved
+   from the rootfs; in that case fallback to safe_openat.  */
+int
+crun_rootfs_resolver_open (struct crun_rootfs_resolver_s *r, const char *path, int flags, int mode,
+                           libcrun_error_t *err)
+{
+  const char *rel = consume_slashes (path);
+  size_t len;
+  int dirfd;
+  int ret;
+
+  len = first_component_len (rel);
+  if (! openat2_supported || len == 0 || has_dotdot_component (rel))
+    goto fallback;
+
+  dirfd = rootfs_resolver_get_dirfd (r, rel, len, err);
+  if (dirfd < 0)
+    goto fallback;
+
+  ret = syscall_openat2 (dirfd, consume_slashes (rel + len), flags, mode,
+                         RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS);
+  if (LIKELY (ret >= 0))
+    return ret;
+
+  if (errno == ENOENT || errno == ENOTDIR)
+    return crun_make_error (err, errno, "openat2 `%s`", path);
+
+fallback:
+  return safe_openat (r->rootfsfd, r->rootfs, r->rootfs_len, path, flags, mode, err);
+}
+
+int
+crun_rootfs_resolver_create_and_open_ref (struct crun_rootfs_resolver_s *r, bool dir, const char *path, int mode,
+                                          libcrun_error_t *err)
+{
+  int fd;
+
+  fd = crun_rootfs_resolver_open (r, path, O_PATH | O_CLOEXEC, 0, err);
+  if (LIKELY (fd >= 0))
+    return fd;
+
+  crun_error_release (err);
+  return crun_safe_ensure_at (true, dir, r->rootfsfd, r->rootfs, r->rootfs_len, path, mode, MAX_READLINKS, err);
+}
+
 int
 crun_safe_ensure_directory_at (int dirfd, const char *dirpath, size_t dirpath_len, const char *path, int mode,
                                libcrun_error_t *err)
@@ -812,46 +1417,77 @@ set_apparmor_profile (const char *profile, libcrun_error_t *err)
   return 0;
 }
 
+/* Read the whole content of FD in BUFFER, that is grown as needed and is
+   always NUL terminated.  The buffer keeps its memory when the read fails,
+   it must be released by the caller.  */
 int
-read_all_fd (int fd, const char *description, char **out, size_t *len, libcrun_error_t *err)
+read_all_fd_buffer (int fd, const char *description, struct crun_read_buffer_s *buffer, size_t *len,
+                    libcrun_error_t *err)
 {
-  int ret;
-  size_t nread, allocated;
+  size_t nread, needed;
   off_t size = 0;
-  cleanup_free char *buf = NULL;
+  int ret;
 
   ret = get_file_size (fd, &size);
   if (UNLIKELY (ret < 0))
     return crun_make_error (err, errno, "error stat'ing file `%s`", description);
 
-  /* NUL terminate the buffer.  */
-  allocated = size;
-  if (size == 0)
-    allocated = 4096;
-  buf = xmalloc (allocated + 1);
-  nread = 0;
-  while ((size && nread < (size_t) size) || size == 0)
+  /* Files on procfs and cgroupfs report a size of 0.  */
+  needed = (size > 0 ? (size_t) size : 4096) + 1;
+  if (buffer->allocated < needed)
     {
-      ret = TEMP_FAILURE_RETRY (read (fd, buf + nread, allocated - nread));
-      if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "error reading from file `%s`", description);
+      buffer->data = xrealloc (buffer->data, needed);
+      buffer->allocated = needed;
+    }
 
-      if (ret == 0)
+  nread = 0;
+  for (;;)
+    {
+      /* Double the size so that the cost of copying the data is linear
+         in the file size.  */
+      if (nread == buffer->allocated - 1)
+        {
+          buffer->allocated *= 2;
+          buffer->data = xrealloc (buffer->data, buffer->allocated);
+        }
+
+      ret = TEMP_FAILURE_RETRY (read (fd, buffer->data + nread, buffer->allocated - 1 - nread));
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "error reading from file `%s`", description);
+
+      if (ret == 0)
         break;
 
       nread += ret;
 
-      allocated += 4096;
-      buf = xrealloc (buf, allocated + 1);
+      if (size > 0 && nread >= (size_t) size)
+        break;
     }
-  buf[nread] = '\0';
-  *out = buf;
-  buf = NULL;
+  buffer->data[nread] = '\0';
   if (len)
     *len = nread;
   return 0;
 }
 
+int
+read_all_fd (int fd, const char *description, char **out, size_t *len, libcrun_error_t *err)
+{
+  struct crun_read_buffer_s buffer = {
+    NULL,
+  };
+  int ret;
+
+  ret = read_all_fd_buffer (fd, description, &buffer, len, err);
+  if (UNLIKELY (ret < 0))
+    {
+      free (buffer.data);
+      return ret;
+    }
+
+  *out = buffer.data;
+  return 0;
+}
+
 int
 read_all_file_at (int dirfd, const char *path, char **out, size_t *len, libcrun_error_t *err)
 {
@@ -1044,38 +1680,39 @@ create_signalfd (sigset_t *mask, libcrun_error_t *err)
   return ret;
 }
 
-int
-epoll_helper (int *fds, int *levelfds, libcrun_error_t *err)
+#define BUFFER_SIZE (64 * 1024)
+
+/* The pairs of file descriptors where splice(2) failed with EINVAL, so that
+   it is not probed again on every wakeup.  A stale entry, after a file
+   descriptor is reused, only costs the read/write fallback.  */
+#define SPLICE_UNSUPPORTED_MAX 4
+static struct
 {
-  struct epoll_event ev;
-  cleanup_close int epollfd = -1;
-  int ret;
+  int src;
+  int dst;
+} splice_unsupported[SPLICE_UNSUPPORTED_MAX];
+static size_t splice_unsupported_len;
+static size_t splice_unsupported_next;
 
-  int *it;
-  epollfd = epoll_create1 (0);
-  if (UNLIKELY (epollfd < 0))
-    return crun_make_error (err, errno, "epoll_create1");
+static bool
+splice_is_unsupported (int src, int dst)
+{
+  size_t i;
 
-  for (it = fds; *it >= 0; it++)
-    {
-      ev.events = EPOLLIN;
-      ev.data.fd = *it;
-      ret = epoll_ctl (epollfd, EPOLL_CTL_ADD, *it, &ev);
-      if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "epoll_ctl add '%d'", *it);
-    }
-  for (it = levelfds; *it >= 0; it++)
-    {
-      ev.events = EPOLLIN | EPOLLET;
-      ev.data.fd = *it;
-      ret = epoll_ctl (epollfd, EPOLL_CTL_ADD, *it, &ev);
-      if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "epoll_ctl add '%d'", *it);
-    }
+  for (i = 0; i < splice_unsupported_len; i++)
+    if (splice_unsupported[i].src == src && splice_unsupported[i].dst == dst)
+      return true;
+  return false;
+}
 
-  ret = epollfd;
-  epollfd = -1;
-  return ret;
+static void
+splice_set_unsupported (int src, int dst)
+{
+  splice_unsupported[splice_unsupported_next].src = src;
+  splice_unsupported[splice_unsupported_next].dst = dst;
+  splice_unsupported_next = (splice_unsupported_next + 1) % SPLICE_UNSUPPORTED_MAX;
+  if (splice_unsupported_len < SPLICE_UNSUPPORTED_MAX)
+    splice_unsupported_len++;
 }
 
 int
@@ -1088,10 +1725,31 @@ copy_from_fd_to_fd (int src, int dst, int consume, libcrun_error_t *err)
       cleanup_free char *buffer = NULL;
       ssize_t remaining;
 
+      /* When one of the two ends is a pipe, move the data in the kernel.  */
+      if (! splice_is_unsupported (src, dst))
+        {
+          nread = TEMP_FAILURE_RETRY (splice (src, NULL, dst, NULL, BUFFER_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+          if (nread >= 0)
+            continue;
+          if (errno == EIO)
+            return 0;
+          if (errno == EINVAL)
+            splice_set_unsupported (src, dst);
+          /* EAGAIN is returned both when SRC is empty and when DST is a
+             full pipe.  In the second case the data must not be left on
+             SRC, as an edge triggered SRC would never be notified again,
+             so let the read/write path below tell the two apart.  */
+          else if (UNLIKELY (errno != EAGAIN))
+            return crun_make_error (err, errno, "splice");
+        }
+
 #ifdef HAVE_COPY_FILE_RANGE
       nread = copy_file_range (src, NULL, dst, NULL, 0, 0);
       if (nread < 0 && (errno == EINVAL || errno == EXDEV))
-        goto fallback;
+        {
+          libcrun_metrics_count (LIBCRUN_METRIC_COPY_FILE_RANGE_FALLBACK);
+          goto fallback;
+        }
       if (consume && nread < 0 && errno == EAGAIN)
         return 0;
       if (nread < 0 && errno == EIO)
@@ -1101,8 +1759,6 @@ copy_from_fd_to_fd (int src, int dst, int consume, libcrun_error_t *err)
 
     fallback:
 #endif
-#define BUFFER_SIZE 4096
-
       buffer = xmalloc (BUFFER_SIZE);
       nread = TEMP_FAILURE_RETRY (read (src, buffer, BUFFER_SIZE));
       if (consume && nread < 0 && errno == EAGAIN)
@@ -1115,7 +1771,7 @@ copy_from_fd_to_fd (int src, int dst, int consume, libcrun_error_t *err)
       remaining = nread;
       while (remaining)
         {
-          ret = TEMP_FAILURE_RETRY (write (dst, buffer, nread));
+          ret = TEMP_FAILURE_RETRY (write (dst, buffer + nread - remaining, remaining));
           if (UNLIKELY (ret < 0))
             return crun_make_error (err, errno, "write");
           remaining -= ret;
@@ -1268,9 +1924,57 @@ exit:
   return 0;
 }
 
+/* The last lookup in /etc/subuid and /etc/subgid.  It is valid as long as
+   the file is not changed.  */
+static struct subid_cache_s
+{
+  bool valid;
+  uid_t id;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  off_t size;
+  int ret;
+  uint32_t from;
+  uint32_t len;
+} subid_cache[2];
+
+static int getsubidrange_uncached (uid_t id, int is_uid, uint32_t *from, uint32_t *len);
+
 /*if subuid or subgid exist, take the first range for the user */
 static int
 getsubidrange (uid_t id, int is_uid, uint32_t *from, uint32_t *len)
+{
+  struct subid_cache_s *c = &subid_cache[is_uid ? 1 : 0];
+  struct stat st;
+  int ret;
+
+  if (stat (is_uid ? "/etc/subuid" : "/etc/subgid", &st) < 0)
+    return -1;
+
+  if (! (c->valid && c->id == id && c->dev == st.st_dev && c->ino == st.st_ino && c->size == st.st_size
+         && c->mtime.tv_sec == st.st_mtim.tv_sec && c->mtime.tv_nsec == st.st_mtim.tv_nsec))
+    {
+      ret = getsubidrange_uncached (id, is_uid, &c->from, &c->len);
+      c->valid = true;
+      c->id = id;
+      c->dev = st.st_dev;
+      c->ino = st.st_ino;
+      c->size = st.st_size;
+      c->mtime = st.st_mtim;
+      c->ret = ret < 0 ? -1 : 0;
+    }
+
+  if (c->ret < 0)
+    return -1;
+
+  *from = c->from;
+  *len = c->len;
+  return 0;
+}
+
+static int
+getsubidrange_uncached (uid_t id, int is_uid, uint32_t *from, uint32_t *len)
 {
   cleanup_file FILE *input = NULL;
   cleanup_free char *lineptr = NULL;
@@ -1341,10 +2045,10 @@ getsubidrange (uid_t id, int is_uid, uint32_t *from, uint32_t *len)
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
 size_t
-format_default_id_mapping (char **ret, uid_t container_id, uid_t host_id, int is_uid)
+format_default_id_mapping (struct crun_arena_s *arena, char **ret, uid_t container_id, uid_t host_id, int is_uid)
 {
   uint32_t from, available;
-  cleanup_free char *buffer = NULL;
+  char *buffer;
   size_t written = 0;
 
   *ret = NULL;
@@ -1353,7 +2057,7 @@ format_default_id_mapping (char **ret, uid_t container_id, uid_t host_id, int is
     return 0;
 
   /* More than enough space for all the mappings.  */
-  buffer = xmalloc (15 * 5 * 3);
+  buffer = crun_arena_alloc (arena, 15 * 5 * 3);
 
   if (container_id > 0)
     {
@@ -1371,21 +2075,65 @@ format_default_id_mapping (char **ret, uid_t container_id, uid_t host_id, int is
     written += sprintf (buffer + written, "%d %d %d\n", container_id + 1, from, available);
 
   *ret = buffer;
-  buffer = NULL;
   return written;
 }
 
-/* will leave SIGCHLD blocked if TIMEOUT is used.  */
-int
-run_process_with_stdin_timeout_envp (char *path, char **args, const char *cwd, int timeout, char **envp, char *stdin,
-                                     size_t stdin_len, int out_fd, int err_fd, libcrun_error_t *err)
+/* Executed in the child process, it never returns.  */
+static void
+exec_process_with_stdin (char *path, char **args, const char *cwd, char **envp, int pipe_r, int pipe_w, int out_fd,
+                         int err_fd)
 {
-  int stdin_pipe[2];
-  pid_t pid;
+  char *tmp_args[] = { path, NULL };
+  libcrun_error_t tmp_err = NULL;
+  int dev_null_fd = -1;
   int ret;
+
+  ret = mark_for_close_fds_ge_than (3, &tmp_err);
+  if (UNLIKELY (ret < 0))
+    libcrun_fail_with_error (tmp_err->status, "%s", tmp_err->msg);
+
+  if (out_fd < 0 || err_fd < 0)
+    {
+      dev_null_fd = open ("/dev/null", O_WRONLY);
+      if (UNLIKELY (dev_null_fd < 0))
+        _exit (EXIT_FAILURE);
+    }
+
+  TEMP_FAILURE_RETRY (close (pipe_w));
+  dup2 (pipe_r, 0);
+  TEMP_FAILURE_RETRY (close (pipe_r));
+
+  dup2 (out_fd >= 0 ? out_fd : dev_null_fd, 1);
+  dup2 (err_fd >= 0 ? err_fd : dev_null_fd, 2);
+
+  if (dev_null_fd >= 0)
+    TEMP_FAILURE_RETRY (close (dev_null_fd));
+  if (out_fd >= 0)
+    TEMP_FAILURE_RETRY (close (out_fd));
+  if (err_fd >= 0)
+    TEMP_FAILURE_RETRY (close (err_fd));
+
+  if (args == NULL)
+    args = tmp_args;
+
+  if (cwd && chdir (cwd) < 0)
+    _exit (EXIT_FAILURE);
+
+  execvpe (path, args, envp);
+  _exit (EXIT_FAILURE);
+}
+
+/* Start PATH and write STDIN to its stdin.  It returns the pid of the new
+   process.  */
+static pid_t
+spawn_process_with_stdin (char *path, char **args, const char *cwd, char **envp, char *stdin, size_t stdin_len,
+                          int out_fd, int err_fd, libcrun_error_t *err)
+{
   cleanup_close int pipe_r = -1;
   cleanup_close int pipe_w = -1;
-  sigset_t mask;
+  int stdin_pipe[2];
+  pid_t pid;
+  int ret;
 
   ret = pipe (stdin_pipe);
   if (UNLIKELY (ret < 0))
@@ -1393,6 +2141,49 @@ run_process_with_stdin_timeout_envp (char *path, char **args, const char *cwd, i
   pipe_r = stdin_pipe[0];
   pipe_w = stdin_pipe[1];
 
+  pid = fork ();
+  if (UNLIKELY (pid < 0))
+    return crun_make_error (err, errno, "fork");
+
+  if (pid == 0)
+    exec_process_with_stdin (path, args, cwd, envp, pipe_r, pipe_w, out_fd, err_fd);
+
+  close_and_reset (&pipe_r);
+
+  ret = TEMP_FAILURE_RETRY (write (pipe_w, stdin, stdin_len));
+  if (UNLIKELY (ret < 0))
+    {
+      int saved_errno = errno;
+
+      kill (pid, SIGKILL);
+      TEMP_FAILURE_RETRY (waitpid (pid, NULL, 0));
+      return crun_make_error (err, saved_errno, "writing to pipe");
+    }
+
+  return pid;
+}
+
+static int
+get_exit_code (int status)
+{
+  if (WIFEXITED (status))
+    return WEXITSTATUS (status);
+  if (WIFSIGNALED (status))
+    return 127 + WTERMSIG (status);
+  return -1;
+}
+
+/* will leave SIGCHLD blocked if TIMEOUT is used.  */
+int
+run_process_with_stdin_timeout_envp (char *path, char **args, const char *cwd, int timeout, char **envp, char *stdin,
+                                     size_t stdin_len, int out_fd, int err_fd, libcrun_error_t *err)
+{
+  pid_t pid;
+  int ret;
+  sigset_t mask;
+  int r, status;
+
+  sigemptyset (&mask);
   if (timeout > 0)
     {
       sigaddset (&mask, SIGCHLD);
@@ -1401,96 +2192,157 @@ run_process_with_stdin_timeout_envp (char *path, char **args, const char *cwd, i
         return crun_make_error (err, errno, "sigprocmask");
     }
 
-  pid = fork ();
+  pid = spawn_process_with_stdin (path, args, cwd, envp, stdin, stdin_len, out_fd, err_fd, err);
   if (UNLIKELY (pid < 0))
-    return crun_make_error (err, errno, "fork");
+    return pid;
 
-  if (pid)
+  if (timeout)
     {
-      int r, status;
+      time_t start = time (NULL);
+      time_t now;
+      for (now = start; now - start < timeout; now = time (NULL))
+        {
+          siginfo_t info;
+          int elapsed = now - start;
+          struct timespec ts_timeout = { .tv_sec = timeout - elapsed, .tv_nsec = 0 };
 
-      close_and_reset (&pipe_r);
+          ret = sigtimedwait (&mask, &info, &ts_timeout);
+          if (UNLIKELY (ret < 0 && errno != EAGAIN))
+            return crun_make_error (err, errno, "sigtimedwait");
 
-      ret = TEMP_FAILURE_RETRY (write (pipe_w, stdin, stdin_len));
-      if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "writing to pipe");
+          if (info.si_signo == SIGCHLD && info.si_pid == pid)
+            goto read_waitpid;
 
-      close_and_reset (&pipe_w);
+          if (ret < 0 && errno == EAGAIN)
+            goto timeout;
+        }
+    timeout:
+      kill (pid, SIGKILL);
+      return crun_make_error (err, 0, "timeout expired for `%s`", path);
+    }
 
-      if (timeout)
-        {
-          time_t start = time (NULL);
-          time_t now;
-          for (now = start; now - start < timeout; now = time (NULL))
-            {
-              siginfo_t info;
-              int elapsed = now - start;
-              struct timespec ts_timeout = { .tv_sec = timeout - elapsed, .tv_nsec = 0 };
+read_waitpid:
+  r = TEMP_FAILURE_RETRY (waitpid (pid, &status, 0));
+  if (r < 0)
+    return crun_make_error (err, errno, "waitpid");
+  return get_exit_code (status);
+}
+
+/* Run the N_PROCS processes in PROCS concurrently, all with the same STDIN.
+   Each timeout is counted from the moment the first process is started,
+   and the process is killed when it expires.  It returns once all of them
+   have exited.  */
+int
+run_processes_with_stdin_timeout_envp (struct run_process_s *procs, size_t n_procs, const char *cwd, char *stdin,
+                                       size_t stdin_len, int out_fd, int err_fd, libcrun_error_t *err)
+{
+  cleanup_free pid_t *pids = xmalloc0 (sizeof (pid_t) * (n_procs + 1));
+  sigset_t mask, oldmask;
+  struct timespec start;
+  size_t i, running = 0;
+  int ret;
 
-              ret = sigtimedwait (&mask, &info, &ts_timeout);
-              if (UNLIKELY (ret < 0 && errno != EAGAIN))
-                return crun_make_error (err, errno, "sigtimedwait");
+  sigemptyset (&mask);
+  sigaddset (&mask, SIGCHLD);
+  ret = sigprocmask (SIG_BLOCK, &mask, &oldmask);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "sigprocmask");
 
-              if (info.si_signo == SIGCHLD && info.si_pid == pid)
-                goto read_waitpid;
+  clock_gettime (CLOCK_MONOTONIC, &start);
 
-              if (ret < 0 && errno == EAGAIN)
-                goto timeout;
+  for (i = 0; i < n_procs; i++)
+    {
+      procs[i].exit_code = -1;
+      procs[i].timed_out = false;
+
+      pids[i] = spawn_process_with_stdin (procs[i].path, procs[i].args, cwd, procs[i].envp, stdin, stdin_len, out_fd,
+                                          err_fd, err);
+      if (UNLIKELY (pids[i] < 0))
+        {
+          size_t j;
+
+          for (j = 0; j < i; j++)
+            {
+              kill (pids[j], SIGKILL);
+              TEMP_FAILURE_RETRY (waitpid (pids[j], NULL, 0));
             }
-        timeout:
-          kill (pid, SIGKILL);
-          return crun_make_error (err, 0, "timeout expired for `%s`", path);
+          sigprocmask (SIG_SETMASK, &oldmask, NULL);
+          return -1;
         }
-
-    read_waitpid:
-      r = TEMP_FAILURE_RETRY (waitpid (pid, &status, 0));
-      if (r < 0)
-        return crun_make_error (err, errno, "waitpid");
-      if (WIFEXITED (status))
-        return WEXITSTATUS (status);
-      if (WIFSIGNALED (status))
-        return 127 + WTERMSIG (status);
+      running++;
     }
-  else
+
+  while (running > 0)
     {
-      char *tmp_args[] = { path, NULL };
-      int dev_null_fd = -1;
+      struct timespec now, ts_timeout;
+      long next_deadline_ms = -1;
+      long elapsed_ms;
+      siginfo_t info;
+
+      /* SIGCHLD is blocked, so a child exiting after this check interrupts
+         sigtimedwait below.  */
+      for (i = 0; i < n_procs; i++)
+        {
+          int status;
 
-      ret = mark_for_close_fds_ge_than (3, err);
-      if (UNLIKELY (ret < 0))
-        libcrun_fail_with_error ((*err)->status, "%s", (*err)->msg);
+          if (pids[i] <= 0)
+            continue;
 
-      if (out_fd < 0 || err_fd < 0)
-        {
-          dev_null_fd = open ("/dev/null", O_WRONLY);
-          if (UNLIKELY (dev_null_fd < 0))
-            _exit (EXIT_FAILURE);
+          ret = TEMP_FAILURE_RETRY (waitpid (pids[i], &status, WNOHANG));
+          if (ret == 0)
+            continue;
+
+          if (ret > 0)
+            procs[i].exit_code = get_exit_code (status);
+          pids[i] = 0;
+          running--;
         }
 
-      TEMP_FAILURE_RETRY (close (pipe_w));
-      dup2 (pipe_r, 0);
-      TEMP_FAILURE_RETRY (close (pipe_r));
+      if (running == 0)
+        break;
 
-      dup2 (out_fd >= 0 ? out_fd : dev_null_fd, 1);
-      dup2 (err_fd >= 0 ? err_fd : dev_null_fd, 2);
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      elapsed_ms = (now.tv_sec - start.tv_sec) * 1000L + (now.tv_nsec - start.tv_nsec) / 1000000L;
 
-      if (dev_null_fd >= 0)
-        TEMP_FAILURE_RETRY (close (dev_null_fd));
-      if (out_fd >= 0)
-        TEMP_FAILURE_RETRY (close (out_fd));
-      if (err_fd >= 0)
-        TEMP_FAILURE_RETRY (close (err_fd));
+      for (i = 0; i < n_procs; i++)
+        {
+          long remaining;
 
-      if (args == NULL)
-        args = tmp_args;
+          if (pids[i] <= 0 || procs[i].timeout <= 0 || procs[i].timed_out)
+            continue;
 
-      if (cwd && chdir (cwd) < 0)
-        _exit (EXIT_FAILURE);
+          remaining = procs[i].timeout * 1000L - elapsed_ms;
+          if (remaining <= 0)
+            {
+              kill (pids[i], SIGKILL);
+              procs[i].timed_out = true;
+              continue;
+            }
+          if (next_deadline_ms < 0 || remaining < next_deadline_ms)
+            next_deadline_ms = remaining;
+        }
+
+      ts_timeout.tv_sec = next_deadline_ms / 1000;
+      ts_timeout.tv_nsec = (next_deadline_ms % 1000) * 1000000L;
 
-      execvpe (path, args, envp);
-      _exit (EXIT_FAILURE);
+      ret = sigtimedwait (&mask, &info, next_deadline_ms >= 0 ? &ts_timeout : NULL);
+      if (UNLIKELY (ret < 0 && errno != EAGAIN && errno != EINTR))
+        {
+          int saved_errno = errno;
+
+          for (i = 0; i < n_procs; i++)
+            if (pids[i] > 0)
+              {
+                kill (pids[i], SIGKILL);
+                TEMP_FAILURE_RETRY (waitpid (pids[i], NULL, 0));
+              }
+          sigprocmask (SIG_SETMASK, &oldmask, NULL);
+          return crun_make_error (err, saved_errno, "sigtimedwait");
+        }
     }
-  return -1;
+
+  sigprocmask (SIG_SETMASK, &oldmask, NULL);
+  return 0;
 }
 
 int
@@ -1594,6 +2446,146 @@ has_prefix (const char *str, const char *prefix)
   return strlen (str) >= prefix_len && memcmp (str, prefix, prefix_len) == 0;
 }
 
+/* Decode in place the octal escapes, e.g. \040 for a space, used by the
+   kernel in the fields of mountinfo.  Returns the new length.  */
+static size_t
+unescape_mountinfo_field (char *field)
+{
+  char *r, *w;
+
+  for (r = w = field; *r;)
+    {
+      if (r[0] == '\\' && r[1] >= '0' && r[1] <= '3' && r[2] >= '0' && r[2] <= '7' && r[3] >= '0' && r[3] <= '7')
+        {
+          *w++ = (char) (((r[1] - '0') << 6) | ((r[2] - '0') << 3) | (r[3] - '0'));
+          r += 4;
+        }
+      else
+        *w++ = *r++;
+    }
+  *w = '\0';
+  return w - field;
+}
+
+/* Find the mount point that contains the absolute path PATH in CONTENT,
+   the content of a mountinfo file: the longest mount point that is a
+   prefix of PATH, or the last one listed if more are mounted there.
+   CONTENT is modified in place and the result points into it.  */
+char *
+find_mountinfo_mount_point (char *content, const char *path)
+{
+  char *saveptr = NULL, *line, *best = NULL;
+  size_t best_len = 0;
+
+  for (line = strtok_r (content, "\n", &saveptr); line; line = strtok_r (NULL, "\n", &saveptr))
+    {
+      char *mount_point = line, *end;
+      size_t len;
+      int i;
+
+      /* The mount point is the fifth field.  */
+      for (i = 0; i < 4 && mount_point; i++)
+        {
+          mount_point = strchr (mount_point, ' ');
+          if (mount_point)
+            mount_point++;
+        }
+      if (mount_point == NULL)
+        continue;
+
+      end = strchr (mount_point, ' ');
+      if (end)
+        *end = '\0';
+
+      len = unescape_mountinfo_field (mount_point);
+
+      /* "/" contains everything.  */
+      if (len == 1 && mount_point[0] == '/')
+        len = 0;
+
+      if (strncmp (path, mount_point, len) != 0 || (path[len] != '/' && path[len] != '\0'))
+        continue;
+
+      if (best == NULL || len >= best_len)
+        {
+          best = mount_point;
+          best_len = len;
+        }
+    }
+
+  return best;
+}
+
+char *
+consume_field (char **cursor, char delim)
+{
+  char *start = *cursor;
+  char *end;
+
+  if (start == NULL || *start == '\0')
+    return NULL;
+
+  end = strchrnul (start, delim);
+  if (*end == '\0')
+    *cursor = end;
+  else
+    {
+      *end = '\0';
+      *cursor = end + 1;
+    }
+  return start;
+}
+
+const char *
+skip_fields (const char *s, char delim, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      s = strchr (s, delim);
+      if (s == NULL)
+        return NULL;
+      s++;
+    }
+  return s;
+}
+
+const char *
+parse_uint64 (const char *s, uint64_t *value)
+{
+  uint64_t v = 0;
+
+  if (*s < '0' || *s > '9')
+    return NULL;
+
+  for (; *s >= '0' && *s <= '9'; s++)
+    {
+      unsigned int digit = *s - '0';
+
+      if (UNLIKELY (v > (UINT64_MAX - digit) / 10))
+        return NULL;
+      v = v * 10 + digit;
+    }
+
+  *value = v;
+  return s;
+}
+
+size_t
+count_chars (const char *s, size_t len, char c)
+{
+  const char *end = s + len;
+  size_t n = 0;
+
+  for (s = memchr (s, c, len); s; s = memchr (s, c, end - s))
+    {
+      n++;
+      s++;
+    }
+  return n;
+}
+
 static int
 check_access (const char *path)
 {
@@ -1820,12 +2812,273 @@ fallback:
   return ret;
 }
 
-int
-copy_recursive_fd_to_fd (int srcdirfd, int dfd, const char *srcname, const char *destname, libcrun_error_t *err)
+/* Shared by all the files copied by a single copy_recursive_fd_to_fd call.
+   A method is disabled the first time the file system does not support it,
+   so it is not attempted again for every file.  */
+struct copy_state_s
+{
+  bool no_ficlone;
+  bool no_copy_file_range;
+};
+
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+static int
+copy_file_data (int srcfd, int destfd, off_t size, struct copy_state_s *state, const char *name,
+                libcrun_error_t *err)
+{
+  cleanup_free char *buffer = NULL;
+  ssize_t nread;
+
+  if (size > 0 && ! __atomic_load_n (&state->no_ficlone, __ATOMIC_RELAXED))
+    {
+      if (ioctl (destfd, FICLONE, srcfd) == 0)
+        return 0;
+
+      if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV || errno == EINVAL || errno == ENOSYS)
+        __atomic_store_n (&state->no_ficlone, true, __ATOMIC_RELAXED);
+    }
+
+#ifdef HAVE_COPY_FILE_RANGE
+  /* A size of 0 might be a file that does not report its size, then
+     copy it with read and write.  */
+  if (size > 0 && ! __atomic_load_n (&state->no_copy_file_range, __ATOMIC_RELAXED))
+    {
+      off_t copied = 0;
+
+      while (copied < size)
+        {
+          ssize_t n = copy_file_range (srcfd, NULL, destfd, NULL, size - copied, 0);
+          if (n < 0 && copied == 0
+              && (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP))
+            {
+              __atomic_store_n (&state->no_copy_file_range, true, __ATOMIC_RELAXED);
+              libcrun_metrics_count (LIBCRUN_METRIC_COPY_FILE_RANGE_FALLBACK);
+              goto fallback;
+            }
+          if (UNLIKELY (n < 0))
+            return crun_make_error (err, errno, "copy_file_range `%s`", name);
+          if (n == 0)
+            return 0;
+          copied += n;
+        }
+      return 0;
+    }
+
+fallback:
+#endif
+  buffer = xmalloc (COPY_BUFFER_SIZE);
+  for (;;)
+    {
+      nread = TEMP_FAILURE_RETRY (read (srcfd, buffer, COPY_BUFFER_SIZE));
+      if (UNLIKELY (nread < 0))
+        return crun_make_error (err, errno, "read `%s`", name);
+      if (nread == 0)
+        return 0;
+
+      if (UNLIKELY (safe_write (destfd, buffer, nread) < 0))
+        return crun_make_error (err, errno, "write `%s`", name);
+    }
+}
+
+static int
+copy_rec_set_owner_and_mode (int destdirfd, const char *name, const char *destname, mode_t mode, uid_t uid,
+                             gid_t gid, libcrun_error_t *err)
+{
+  int ret;
+
+  ret = fchownat (destdirfd, name, uid, gid, AT_SYMLINK_NOFOLLOW);
+  if (UNLIKELY (ret < 0))
+    return crun_make_error (err, errno, "chown `%s/%s`", destname, name);
+
+    /*
+     * ALLPERMS is not defined by POSIX
+     */
+#ifndef ALLPERMS
+#  define ALLPERMS (S_ISUID | S_ISGID | S_ISVTX | S_IRWXU | S_IRWXG | S_IRWXO)
+#endif
+
+  ret = fchmodat (destdirfd, name, mode & ALLPERMS, AT_SYMLINK_NOFOLLOW);
+  if (UNLIKELY (ret < 0))
+    {
+      if (errno == ENOTSUP)
+        {
+          char proc_path[32];
+          cleanup_close int fd = -1;
+
+          fd = openat (destdirfd, name, O_PATH | O_NOFOLLOW);
+          if (UNLIKELY (fd < 0))
+            return crun_make_error (err, errno, "open `%s/%s`", destname, name);
+
+          sprintf (proc_path, "/proc/self/fd/%d", fd);
+          ret = chmod (proc_path, mode & ALLPERMS);
+        }
+
+      if (UNLIKELY (ret < 0))
+        return crun_make_error (err, errno, "chmod `%s/%s`", destname, name);
+    }
+
+  return 0;
+}
+
+struct copy_file_entry_s
+{
+  char *name;
+  mode_t mode;
+  off_t size;
+  uid_t uid;
+  gid_t gid;
+};
+
+/* The regular files in a directory.  They are copied after the directory is
+   read, by a few threads if there are enough of them.  */
+struct copy_files_s
+{
+  int srcdirfd;
+  int destdirfd;
+  const char *srcname;
+  const char *destname;
+  struct copy_state_s *state;
+  struct copy_file_entry_s *entries;
+  size_t len;
+  size_t next;
+  bool failed;
+};
+
+static int
+copy_file_entry (struct copy_files_s *files, struct copy_file_entry_s *entry, libcrun_error_t *err)
+{
+  cleanup_close int srcfd = -1;
+  cleanup_close int destfd = -1;
+  int ret;
+
+  srcfd = openat (files->srcdirfd, entry->name, O_NONBLOCK | O_RDONLY | O_CLOEXEC);
+  if (UNLIKELY (srcfd < 0))
+    return crun_make_error (err, errno, "open `%s/%s`", files->srcname, entry->name);
+
+  destfd = openat (files->destdirfd, entry->name, O_RDWR | O_CREAT | O_CLOEXEC, 0777);
+  if (UNLIKELY (destfd < 0))
+    return crun_make_error (err, errno, "open `%s/%s`", files->destname, entry->name);
+
+  ret = copy_file_data (srcfd, destfd, entry->size, files->state, entry->name, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+#ifdef HAVE_FGETXATTR
+  ret = (int) copy_xattr (srcfd, destfd, entry->name, entry->name, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+#endif
+
+  return copy_rec_set_owner_and_mode (files->destdirfd, entry->name, files->destname, entry->mode, entry->uid,
+                                      entry->gid, err);
+}
+
+struct copy_worker_s
+{
+  struct copy_files_s *files;
+  libcrun_error_t err;
+  int ret;
+};
+
+static void *
+copy_files_worker (void *arg)
+{
+  struct copy_worker_s *worker = arg;
+  struct copy_files_s *files = worker->files;
+
+  while (! __atomic_load_n (&files->failed, __ATOMIC_RELAXED))
+    {
+      size_t i = __atomic_fetch_add (&files->next, 1, __ATOMIC_RELAXED);
+      if (i >= files->len)
+        break;
+
+      worker->ret = copy_file_entry (files, &files->entries[i], &worker->err);
+      if (UNLIKELY (worker->ret < 0))
+        {
+          __atomic_store_n (&files->failed, true, __ATOMIC_RELAXED);
+          break;
+        }
+    }
+
+  return NULL;
+}
+
+/* Use threads only for directories with many files, the thread creation
+   is not worth it otherwise.  */
+#define COPY_PARALLEL_MIN_FILES 16
+#define COPY_MAX_WORKERS 4
+
+static int
+copy_files (struct copy_files_s *files, libcrun_error_t *err)
+{
+  struct copy_worker_s workers[COPY_MAX_WORKERS];
+  size_t n_workers = 1;
+  size_t i;
+  int ret = 0;
+#ifdef HAVE_PTHREAD
+  pthread_t threads[COPY_MAX_WORKERS];
+  size_t n_threads = 0;
+#endif
+
+  memset (workers, 0, sizeof (workers));
+  for (i = 0; i < COPY_MAX_WORKERS; i++)
+    workers[i].files = files;
+
+#ifdef HAVE_PTHREAD
+  if (files->len >= COPY_PARALLEL_MIN_FILES)
+    {
+      long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+      n_workers = cpus > COPY_MAX_WORKERS ? COPY_MAX_WORKERS : (cpus > 1 ? cpus : 1);
+
+      /* The calling thread is a worker too.  If a thread cannot be created,
+         run with the ones that are available.  */
+      for (i = 1; i < n_workers; i++)
+        {
+          if (pthread_create (&threads[n_threads], NULL, copy_files_worker, &workers[i]) != 0)
+            break;
+          n_threads++;
+        }
+      n_workers = n_threads + 1;
+    }
+#endif
+
+  copy_files_worker (&workers[0]);
+
+#ifdef HAVE_PTHREAD
+  for (i = 0; i < n_threads; i++)
+    pthread_join (threads[i], NULL);
+#endif
+
+  /* Report the first error and drop the others.  */
+  for (i = 0; i < n_workers; i++)
+    {
+      if (workers[i].ret < 0 && ret == 0)
+        {
+          ret = workers[i].ret;
+          *err = workers[i].err;
+          workers[i].err = NULL;
+        }
+      crun_error_release (&workers[i].err);
+    }
+
+  return ret;
+}
+
+static int
+copy_recursive_fd_to_fd_internal (int srcdirfd, int dfd, const char *srcname, const char *destname,
+                                  struct copy_state_s *state, libcrun_error_t *err)
 {
   cleanup_close int destdirfd = dfd;
   cleanup_dir DIR *dsrcfd = NULL;
+  struct copy_files_s files = {
+    0,
+  };
+  size_t allocated = 0;
   struct dirent *de;
+  size_t i;
+  int ret = 0;
 
   dsrcfd = fdopendir (srcdirfd);
   if (UNLIKELY (dsrcfd == NULL))
@@ -1834,6 +3087,12 @@ copy_recursive_fd_to_fd (int srcdirfd, int dfd, const char *srcname, const char
       return crun_make_error (err, errno, "cannot open directory `%s`", destname);
     }
 
+  files.srcdirfd = dirfd (dsrcfd);
+  files.destdirfd = destdirfd;
+  files.srcname = srcname;
+  files.destname = destname;
+  files.state = state;
+
   for (de = readdir (dsrcfd); de; de = readdir (dsrcfd))
     {
       cleanup_close int srcfd = -1;
@@ -1841,7 +3100,6 @@ copy_recursive_fd_to_fd (int srcdirfd, int dfd, const char *srcname, const char
       cleanup_free char *target_buf = NULL;
       ssize_t buf_size;
       ssize_t size;
-      int ret;
       mode_t mode;
       off_t st_size;
       dev_t rdev;
@@ -1853,56 +3111,60 @@ copy_recursive_fd_to_fd (int srcdirfd, int dfd, const char *srcname, const char
 
       ret = copy_rec_stat_file_at (dirfd (dsrcfd), de->d_name, &mode, &st_size, &rdev, &uid, &gid);
       if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "stat `%s/%s`", srcname, de->d_name);
+        {
+          ret = crun_make_error (err, errno, "stat `%s/%s`", srcname, de->d_name);
+          goto exit;
+        }
 
       switch (mode & S_IFMT)
         {
         case S_IFREG:
-          srcfd = openat (dirfd (dsrcfd), de->d_name, O_NONBLOCK | O_RDONLY);
-          if (UNLIKELY (srcfd < 0))
-            return crun_make_error (err, errno, "open `%s/%s`", srcname, de->d_name);
-
-          destfd = openat (destdirfd, de->d_name, O_RDWR | O_CREAT, 0777);
-          if (UNLIKELY (destfd < 0))
-            return crun_make_error (err, errno, "open `%s/%s`", destname, de->d_name);
-
-          ret = copy_from_fd_to_fd (srcfd, destfd, 0, err);
-          if (UNLIKELY (ret < 0))
-            return ret;
-
-#ifdef HAVE_FGETXATTR
-          ret = (int) copy_xattr (srcfd, destfd, de->d_name, de->d_name, err);
-          if (UNLIKELY (ret < 0))
-            return ret;
-#endif
-
-          TEMP_FAILURE_RETRY (close (destfd));
-          destfd = -1;
-          break;
+          /* Copied with the other files once the directory is read.  */
+          if (files.len == allocated)
+            {
+              allocated = allocated ? allocated * 2 : 16;
+              files.entries = xrealloc (files.entries, allocated * sizeof (*files.entries));
+            }
+          files.entries[files.len].name = xstrdup (de->d_name);
+          files.entries[files.len].mode = mode;
+          files.entries[files.len].size = st_size;
+          files.entries[files.len].uid = uid;
+          files.entries[files.len].gid = gid;
+          files.len++;
+          continue;
 
         case S_IFDIR:
           ret = mkdirat (destdirfd, de->d_name, mode);
           if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "mkdir `%s/%s`", destname, de->d_name);
+            {
+              ret = crun_make_error (err, errno, "mkdir `%s/%s`", destname, de->d_name);
+              goto exit;
+            }
 
-          srcfd = openat (dirfd (dsrcfd), de->d_name, O_DIRECTORY);
+          srcfd = openat (dirfd (dsrcfd), de->d_name, O_DIRECTORY | O_CLOEXEC);
           if (UNLIKELY (srcfd < 0))
-            return crun_make_error (err, errno, "open directory `%s/%s`", srcname, de->d_name);
+            {
+              ret = crun_make_error (err, errno, "open directory `%s/%s`", srcname, de->d_name);
+              goto exit;
+            }
 
-          destfd = openat (destdirfd, de->d_name, O_DIRECTORY);
+          destfd = openat (destdirfd, de->d_name, O_DIRECTORY | O_CLOEXEC);
           if (UNLIKELY (destfd < 0))
-            return crun_make_error (err, errno, "open directory `%s/%s`", srcname, de->d_name);
+            {
+              ret = crun_make_error (err, errno, "open directory `%s/%s`", srcname, de->d_name);
+              goto exit;
+            }
 
 #ifdef HAVE_FGETXATTR
           ret = (int) copy_xattr (srcfd, destfd, de->d_name, de->d_name, err);
           if (UNLIKELY (ret < 0))
-            return ret;
+            goto exit;
 #endif
 
-          ret = copy_recursive_fd_to_fd (srcfd, destfd, de->d_name, de->d_name, err);
+          ret = copy_recursive_fd_to_fd_internal (srcfd, destfd, de->d_name, de->d_name, state, err);
           srcfd = destfd = -1;
           if (UNLIKELY (ret < 0))
-            return ret;
+            goto exit;
           break;
 
         case S_IFLNK:
@@ -1917,12 +3179,18 @@ copy_recursive_fd_to_fd (int srcdirfd, int dfd, const char *srcname, const char
 
               size = readlinkat (dirfd (dsrcfd), de->d_name, target_buf, buf_size);
               if (UNLIKELY (size < 0))
-                return crun_make_error (err, errno, "readlink `%s/%s`", srcname, de->d_name);
+                {
+                  ret = crun_make_error (err, errno, "readlink `%s/%s`", srcname, de->d_name);
+                  goto exit;
+                }
           } while (size == buf_size);
 
           ret = symlinkat (target_buf, destdirfd, de->d_name);
           if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "create symlink `%s/%s`", destname, de->d_name);
+            {
+              ret = crun_make_error (err, errno, "create symlink `%s/%s`", destname, de->d_name);
+              goto exit;
+            }
           break;
 
         case S_IFBLK:
@@ -1931,43 +3199,38 @@ copy_recursive_fd_to_fd (int srcdirfd, int dfd, const char *srcname, const char
         case S_IFSOCK:
           ret = mknodat (destdirfd, de->d_name, mode, rdev);
           if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "create special file `%s/%s`", destname, de->d_name);
+            {
+              ret = crun_make_error (err, errno, "create special file `%s/%s`", destname, de->d_name);
+              goto exit;
+            }
           break;
         }
 
-      ret = fchownat (destdirfd, de->d_name, uid, gid, AT_SYMLINK_NOFOLLOW);
+      ret = copy_rec_set_owner_and_mode (destdirfd, de->d_name, destname, mode, uid, gid, err);
       if (UNLIKELY (ret < 0))
-        return crun_make_error (err, errno, "chown `%s/%s`", destname, de->d_name);
-
-        /*
-         * ALLPERMS is not defined by POSIX
-         */
-#ifndef ALLPERMS
-#  define ALLPERMS (S_ISUID | S_ISGID | S_ISVTX | S_IRWXU | S_IRWXG | S_IRWXO)
-#endif
+        goto exit;
+    }
 
-      ret = fchmodat (destdirfd, de->d_name, mode & ALLPERMS, AT_SYMLINK_NOFOLLOW);
-      if (UNLIKELY (ret < 0))
-        {
-          if (errno == ENOTSUP)
-            {
-              char proc_path[32];
-              cleanup_close int fd = -1;
+  ret = 0;
+  if (files.len > 0)
+    ret = copy_files (&files, err);
 
-              fd = openat (destdirfd, de->d_name, O_PATH | O_NOFOLLOW);
-              if (UNLIKELY (fd < 0))
-                return crun_make_error (err, errno, "open `%s/%s`", destname, de->d_name);
+exit:
+  for (i = 0; i < files.len; i++)
+    free (files.entries[i].name);
+  free (files.entries);
 
-              sprintf (proc_path, "/proc/self/fd/%d", fd);
-              ret = chmod (proc_path, mode & ALLPERMS);
-            }
+  return ret;
+}
 
-          if (UNLIKELY (ret < 0))
-            return crun_make_error (err, errno, "chmod `%s/%s`", destname, de->d_name);
-        }
-    }
+int
+copy_recursive_fd_to_fd (int srcdirfd, int dfd, const char *srcname, const char *destname, libcrun_error_t *err)
+{
+  struct copy_state_s state = {
+    false,
+  };
 
-  return 0;
+  return copy_recursive_fd_to_fd_internal (srcdirfd, dfd, srcname, destname, &state, err);
 }
 
 const char *
@@ -2010,8 +3273,8 @@ safe_write (int fd, const void *buf, ssize_t count)
   return written;
 }
 
-int
-append_paths (char **out, libcrun_error_t *err, ...)
+static int
+vappend_paths (struct crun_arena_s *arena, char **out, libcrun_error_t *err, va_list ap)
 {
   const size_t MAX_PARTS = 32;
   const char *parts[MAX_PARTS];
@@ -2019,10 +3282,8 @@ append_paths (char **out, libcrun_error_t *err, ...)
   size_t total_len = 0;
   size_t n_parts = 0;
   size_t copied = 0;
-  va_list ap;
   size_t i;
 
-  va_start (ap, err);
   for (;;)
     {
       const char *part;
@@ -2033,10 +3294,7 @@ append_paths (char **out, libcrun_error_t *err, ...)
         break;
 
       if (n_parts == MAX_PARTS)
-        {
-          va_end (ap);
-          return crun_make_error (err, EINVAL, "too many paths specified");
-        }
+        return crun_make_error (err, EINVAL, "too many paths specified");
 
       if (n_parts == 0)
         {
@@ -2063,13 +3321,12 @@ append_paths (char **out, libcrun_error_t *err, ...)
 
       n_parts++;
     }
-  va_end (ap);
 
   total_len = n_parts + 1;
   for (i = 0; i < n_parts; i++)
     total_len += sizes[i];
 
-  *out = xmalloc (total_len);
+  *out = arena ? crun_arena_alloc (arena, total_len) : xmalloc (total_len);
 
   copied = 0;
   for (i = 0; i < n_parts; i++)
@@ -2090,6 +3347,30 @@ append_paths (char **out, libcrun_error_t *err, ...)
   return 0;
 }
 
+int
+append_paths (char **out, libcrun_error_t *err, ...)
+{
+  va_list ap;
+  int ret;
+
+  va_start (ap, err);
+  ret = vappend_paths (NULL, out, err, ap);
+  va_end (ap);
+  return ret;
+}
+
+int
+crun_arena_append_paths (struct crun_arena_s *arena, char **out, libcrun_error_t *err, ...)
+{
+  va_list ap;
+  int ret;
+
+  va_start (ap, err);
+  ret = vappend_paths (arena, out, err, ap);
+  va_end (ap);
+  return ret;
+}
+
 /* Adapted from mailutils 0.6.91 (distributed under LGPL 2.0+)  */
 static int
 b64_input (char c)
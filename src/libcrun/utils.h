@@ -169,6 +169,39 @@ consume_slashes (const char *t)
 
 int xasprintf (char **str, const char *fmt, ...);
 
+/* A bump allocator for the scratch strings of a single operation.  The
+   memory is released all at once by crun_arena_release, the single
+   allocations are never freed.  The first chunk can be provided by the
+   caller, usually on the stack, so that short operations do not touch
+   the heap at all.  */
+struct crun_arena_chunk_s
+{
+  struct crun_arena_chunk_s *next;
+  size_t size;
+  size_t used;
+  bool owned;
+  char data[] __attribute__ ((aligned (sizeof (void *))));
+};
+
+struct crun_arena_s
+{
+  struct crun_arena_chunk_s *chunks;
+};
+
+void crun_arena_init (struct crun_arena_s *arena, void *buffer, size_t size);
+void crun_arena_release (struct crun_arena_s *arena);
+void *crun_arena_alloc (struct crun_arena_s *arena, size_t size);
+char *crun_arena_strdup (struct crun_arena_s *arena, const char *str);
+char *crun_arena_sprintf (struct crun_arena_s *arena, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+int crun_arena_append_paths (struct crun_arena_s *arena, char **out, libcrun_error_t *err, ...);
+
+static inline void
+cleanup_arenap (struct crun_arena_s *arena)
+{
+  crun_arena_release (arena);
+}
+#define cleanup_arena __attribute__ ((cleanup (cleanup_arenap)))
+
 int crun_path_exists (const char *path, libcrun_error_t *err);
 
 int write_file_with_flags (const char *name, int flags, const void *data, size_t len, libcrun_error_t *err);
@@ -177,6 +210,37 @@ int write_file (const char *name, const void *data, size_t len, libcrun_error_t
 
 int write_file_at (int dirfd, const char *name, const void *data, size_t len, libcrun_error_t *err);
 
+/* Writes to existing files, like cgroupfs knobs, that are submitted
+   together by crun_write_batch_flush.  PATH and DATA are not copied.  */
+struct crun_write_batch_entry_s
+{
+  int dirfd;
+  const char *path;
+  const void *data;
+  size_t len;
+  int fd;
+  bool written;
+};
+
+struct crun_write_batch_s
+{
+  struct crun_write_batch_entry_s *entries;
+  size_t len;
+  size_t allocated;
+};
+
+void crun_write_batch_add (struct crun_write_batch_s *batch, int dirfd, const char *path, const void *data,
+                           size_t len);
+size_t crun_write_batch_flush (struct crun_write_batch_s *batch);
+void crun_write_batch_release (struct crun_write_batch_s *batch);
+
+static inline void
+cleanup_write_batchp (struct crun_write_batch_s *batch)
+{
+  crun_write_batch_release (batch);
+}
+#define cleanup_write_batch __attribute__ ((cleanup (cleanup_write_batchp)))
+
 int crun_ensure_directory (const char *path, int mode, bool nofollow, libcrun_error_t *err);
 
 int crun_ensure_file (const char *path, int mode, bool nofollow, libcrun_error_t *err);
@@ -190,6 +254,46 @@ int crun_safe_create_and_open_ref_at (bool dir, int dirfd, const char *dirpath,
 int crun_safe_ensure_directory_at (int dirfd, const char *dirpath, size_t dirpath_len, const char *path, int mode,
                                    libcrun_error_t *err);
 
+#define ROOTFS_RESOLVER_MAX_ENTRIES 16
+
+/* Open paths under a rootfs, keeping a fd to the top level directories
+   that were already looked up, e.g. /dev, /proc or the parent directory of
+   the volumes.  The cached entries must be invalidated when something is
+   mounted on them.  */
+struct crun_rootfs_resolver_s
+{
+  int rootfsfd;
+  const char *rootfs;
+  size_t rootfs_len;
+
+  size_t entries_len;
+  struct
+  {
+    char *name;
+    int fd;
+  } entries[ROOTFS_RESOLVER_MAX_ENTRIES];
+};
+
+void crun_rootfs_resolver_init (struct crun_rootfs_resolver_s *r, int rootfsfd, const char *rootfs, size_t rootfs_len);
+
+void crun_rootfs_resolver_release (struct crun_rootfs_resolver_s *r);
+
+void crun_rootfs_resolver_invalidate (struct crun_rootfs_resolver_s *r, const char *path);
+
+int crun_rootfs_resolver_open (struct crun_rootfs_resolver_s *r, const char *path, int flags, int mode,
+                               libcrun_error_t *err);
+
+int crun_rootfs_resolver_create_and_open_ref (struct crun_rootfs_resolver_s *r, bool dir, const char *path, int mode,
+                                              libcrun_error_t *err);
+
+static inline void
+cleanup_rootfs_resolverp (struct crun_rootfs_resolver_s *r)
+{
+  crun_rootfs_resolver_release (r);
+}
+
+#define cleanup_rootfs_resolver __attribute__ ((cleanup (cleanup_rootfs_resolverp)))
+
 int crun_safe_ensure_file_at (int dirfd, const char *dirpath, size_t dirpath_len, const char *path, int mode,
                               libcrun_error_t *err);
 
@@ -211,6 +315,25 @@ int set_apparmor_profile (const char *profile, libcrun_error_t *err);
 
 int read_all_fd (int fd, const char *description, char **out, size_t *len, libcrun_error_t *err);
 
+/* A buffer owned by the caller that is reused by several reads, so that
+   reading many files costs an allocation only when a file is bigger than
+   any of the previous ones.  */
+struct crun_read_buffer_s
+{
+  char *data;
+  size_t allocated;
+};
+
+static inline void
+cleanup_read_bufferp (struct crun_read_buffer_s *buffer)
+{
+  free (buffer->data);
+}
+#define cleanup_read_buffer __attribute__ ((cleanup (cleanup_read_bufferp)))
+
+int read_all_fd_buffer (int fd, const char *description, struct crun_read_buffer_s *buffer, size_t *len,
+                        libcrun_error_t *err);
+
 int read_all_file (const char *path, char **out, size_t *len, libcrun_error_t *err);
 
 int read_all_file_at (int dirfd, const char *path, char **out, size_t *len, libcrun_error_t *err);
@@ -229,17 +352,32 @@ int receive_fd_from_socket (int from, libcrun_error_t *err);
 
 int create_signalfd (sigset_t *mask, libcrun_error_t *err);
 
-int epoll_helper (int *fds, int *levelfds, libcrun_error_t *err);
 
 int copy_from_fd_to_fd (int src, int dst, int consume, libcrun_error_t *err);
 
 int run_process (char **args, libcrun_error_t *err);
 
-size_t format_default_id_mapping (char **ret, uid_t container_id, uid_t host_id, int is_uid);
+size_t format_default_id_mapping (struct crun_arena_s *arena, char **ret, uid_t container_id, uid_t host_id,
+                                  int is_uid);
 
 int run_process_with_stdin_timeout_envp (char *path, char **args, const char *cwd, int timeout, char **envp,
                                          char *stdin, size_t stdin_len, int out_fd, int err_fd, libcrun_error_t *err);
 
+struct run_process_s
+{
+  char *path;
+  char **args;
+  char **envp;
+  int timeout;
+
+  /* Set by run_processes_with_stdin_timeout_envp.  */
+  int exit_code;
+  bool timed_out;
+};
+
+int run_processes_with_stdin_timeout_envp (struct run_process_s *procs, size_t n_procs, const char *cwd, char *stdin,
+                                           size_t stdin_len, int out_fd, int err_fd, libcrun_error_t *err);
+
 int mark_for_close_fds_ge_than (int n, libcrun_error_t *err);
 
 void get_current_timestamp (char *out);
@@ -250,6 +388,35 @@ int parse_json_file (yajl_val *out, const char *jsondata, struct parser_context
 
 int has_prefix (const char *str, const char *prefix);
 
+char *find_mountinfo_mount_point (char *content, const char *path);
+
+/* Helpers to parse the files from procfs and cgroupfs in place, without
+   copying the data.  They work on NUL-terminated buffers and look for the
+   separators with the string functions of the C library, that scan more
+   than a byte at a time.  */
+
+/* Terminate the next field of *CURSOR separated by DELIM and return it, then
+   advance *CURSOR past the separator.  Return NULL at the end of the buffer.  */
+char *consume_field (char **cursor, char delim);
+
+static inline char *
+consume_line (char **cursor)
+{
+  return consume_field (cursor, '\n');
+}
+
+/* Return the position after the first N fields of S separated by DELIM, or
+   NULL if there are fewer fields.  */
+const char *skip_fields (const char *s, char delim, size_t n);
+
+/* Parse the decimal number at the beginning of S.  Return the position after
+   its last digit, or NULL if S does not start with a digit or the value does
+   not fit in 64 bits.  */
+const char *parse_uint64 (const char *s, uint64_t *value);
+
+/* Count the occurrences of C in the LEN bytes at S.  */
+size_t count_chars (const char *s, size_t len, char c);
+
 const char *find_executable (const char *executable_path, const char *cwd);
 
 int copy_recursive_fd_to_fd (int srcfd, int destfd, const char *srcname, const char *destname, libcrun_error_t *err);
@@ -142,23 +142,31 @@ crun_command_list (struct crun_global_arguments *global_args, int argc, char **a
     }
   for (it = list; it; it = it->next)
     {
-      libcrun_container_status_t status;
+      libcrun_container_status_t read_status = {
+        0,
+      };
+      libcrun_container_status_t *status = it->status;
 
-      ret = libcrun_read_container_status (&status, crun_context.state_root, it->name, err);
-      if (UNLIKELY (ret < 0))
+      /* The status is already known when the list comes from the index.  */
+      if (status == NULL)
         {
-          libcrun_error_write_warning_and_release (stderr, &err);
-          continue;
+          ret = libcrun_read_container_status (&read_status, crun_context.state_root, it->name, err);
+          if (UNLIKELY (ret < 0))
+            {
+              libcrun_error_write_warning_and_release (stderr, &err);
+              continue;
+            }
+          status = &read_status;
         }
       if (list_options.quiet && list_options.format == LIST_TABLE)
         printf ("%s\n", it->name);
       else
         {
           int running = 0;
-          int pid = status.pid;
+          int pid = status->pid;
           const char *container_status = NULL;
 
-          ret = libcrun_get_container_state_string (it->name, &status, crun_context.state_root, &container_status,
+          ret = libcrun_get_container_state_string (it->name, status, crun_context.state_root, &container_status,
                                                     &running, err);
           if (UNLIKELY (ret < 0))
             {
@@ -180,21 +188,21 @@ crun_command_list (struct crun_global_arguments *global_args, int argc, char **a
               yajl_gen_string (gen, YAJL_STR ("status"), strlen ("status"));
               yajl_gen_string (gen, YAJL_STR (container_status), strlen (container_status));
               yajl_gen_string (gen, YAJL_STR ("bundle"), strlen ("bundle"));
-              yajl_gen_string (gen, YAJL_STR (status.bundle), strlen (status.bundle));
+              yajl_gen_string (gen, YAJL_STR (status->bundle), strlen (status->bundle));
               yajl_gen_string (gen, YAJL_STR ("created"), strlen ("created"));
-              yajl_gen_string (gen, YAJL_STR (status.created), strlen (status.created));
+              yajl_gen_string (gen, YAJL_STR (status->created), strlen (status->created));
               yajl_gen_string (gen, YAJL_STR ("owner"), strlen ("owner"));
-              yajl_gen_string (gen, YAJL_STR (status.owner), strlen (status.owner));
+              yajl_gen_string (gen, YAJL_STR (status->owner), strlen (status->owner));
               yajl_gen_map_close (gen);
               break;
 
             case LIST_TABLE:
-              printf ("%-*s%-10d%-8s %-39s %-30s %s\n", max_length, it->name, pid, container_status, status.bundle, status.created, status.owner);
+              printf ("%-*s%-10d%-8s %-39s %-30s %s\n", max_length, it->name, pid, container_status, status->bundle, status->created, status->owner);
               break;
             }
         }
 
-      libcrun_free_container_status (&status);
+      libcrun_free_container_status (&read_status);
     }
   if (list_options.format == LIST_JSON)
     {
@@ -23,6 +23,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <inttypes.h>
 
 #include "crun.h"
 #include "libcrun/container.h"
@@ -38,12 +40,14 @@ enum
   OPTION_PID_FILE,
   OPTION_NO_SUBREAPER,
   OPTION_NO_NEW_KEYRING,
-  OPTION_PRESERVE_FDS
+  OPTION_PRESERVE_FDS,
+  OPTION_DETAILS
 };
 
 struct ps_options_s
 {
   int format;
+  bool details;
 };
 
 enum
@@ -55,6 +59,7 @@ enum
 static struct ps_options_s ps_options;
 
 static struct argp_option options[] = { { "format", 'f', "FORMAT", 0, "select the output format", 0 },
+                                        { "details", OPTION_DETAILS, 0, 0, "show the details of each process", 0 },
                                         {
                                             0,
                                         } };
@@ -75,6 +80,10 @@ parse_opt (int key, char *arg, struct argp_state *state arg_unused)
         error (EXIT_FAILURE, 0, "invalid format `%s`", arg);
       break;
 
+    case OPTION_DETAILS:
+      ps_options.details = true;
+      break;
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -82,6 +91,81 @@ parse_opt (int key, char *arg, struct argp_state *state arg_unused)
   return 0;
 }
 
+static void
+print_json_string (const char *str)
+{
+  const unsigned char *it;
+
+  putchar ('"');
+  for (it = (const unsigned char *) str; *it; it++)
+    {
+      if (*it == '"' || *it == '\\')
+        printf ("\\%c", *it);
+      else if (*it < 0x20)
+        printf ("\\u%04x", *it);
+      else
+        putchar (*it);
+    }
+  putchar ('"');
+}
+
+static int
+print_processes_details (pid_t *pids, libcrun_error_t *err)
+{
+  cleanup_free libcrun_process_info_t *info = NULL;
+  bool first = true;
+  size_t i, n_pids;
+  int ret;
+
+  for (n_pids = 0; pids[n_pids]; n_pids++)
+    ;
+
+  info = xmalloc (sizeof (*info) * (n_pids + 1));
+  ret = libcrun_read_processes_info (pids, n_pids, info, err);
+  if (UNLIKELY (ret < 0))
+    return ret;
+
+  switch (ps_options.format)
+    {
+    case PS_JSON:
+      printf ("[\n");
+      for (i = 0; i < n_pids; i++)
+        {
+          /* The process exited.  */
+          if (info[i].state == 0)
+            continue;
+
+          printf ("%s  {\"pid\":%d,\"comm\":", first ? "" : ",\n", info[i].pid);
+          print_json_string (info[i].comm);
+          printf (",\"state\":\"%c\",\"threads\":%" PRIu64 ",\"rss\":%" PRIu64 ",\"cpu_time\":%" PRIu64
+                  ",\"start_time\":%" PRIu64 "}",
+                  info[i].state, info[i].threads, info[i].rss, info[i].cpu_time, info[i].start_time);
+          first = false;
+        }
+      printf ("%s]\n", first ? "" : "\n");
+      break;
+
+    case PS_TABLE:
+      printf ("%-10s %-16s %-5s %-7s %-12s %-12s %s\n", "PID", "COMMAND", "STATE", "THREADS", "RSS", "TIME",
+              "STARTED");
+      for (i = 0; i < n_pids; i++)
+        {
+          uint64_t seconds = info[i].cpu_time / 1000000;
+
+          if (info[i].state == 0)
+            continue;
+
+          printf ("%-10d %-16s %-5c %-7" PRIu64 " %-12" PRIu64 " %02" PRIu64 ":%02" PRIu64 ":%02" PRIu64 "     %" PRIu64
+                  "\n",
+                  info[i].pid, info[i].comm, info[i].state, info[i].threads, info[i].rss, seconds / 3600,
+                  (seconds / 60) % 60, seconds % 60, info[i].start_time);
+        }
+      break;
+    }
+
+  return 0;
+}
+
 static struct argp run_argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
 
 int
@@ -122,6 +206,14 @@ crun_command_ps (struct crun_global_arguments *global_args, int argc, char **arg
       return ret;
     }
 
+  if (ps_options.details)
+    {
+      ret = print_processes_details (pids, err);
+      if (UNLIKELY (ret < 0))
+        libcrun_error_write_warning_and_release (stderr, &err);
+      return ret;
+    }
+
   switch (ps_options.format)
     {
     case PS_JSON:
@@ -41,6 +41,8 @@ enum
   OPTION_EXT_UNIX_SK,
   OPTION_PID_FILE,
   OPTION_CONSOLE_SOCKET,
+  OPTION_LAZY_PAGES,
+  OPTION_ARCHIVE,
 };
 
 static char doc[] = "OCI runtime";
@@ -62,11 +64,13 @@ static struct argp_option options[]
         { "pid-file", OPTION_PID_FILE, "FILE", 0, "where to write the PID of the container", 0 },
         { "console-socket", OPTION_CONSOLE_SOCKET, "SOCKET", 0,
           "path to a socket that will receive the master end of the tty", 0 },
+        { "lazy-pages", OPTION_LAZY_PAGES, 0, 0, "restore the memory pages on demand", 0 },
+        { "archive", OPTION_ARCHIVE, "FILE", 0, "read the criu image files from an archive", 0 },
         {
             0,
         } };
 
-static char args_doc[] = "restore CONTAINER";
+static char args_doc[] = "restore CONTAINER [CONTAINER...]";
 
 static error_t
 parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
@@ -108,6 +112,14 @@ parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
       cr_options.console_socket = argp_mandatory_argument (arg, state);
       break;
 
+    case OPTION_LAZY_PAGES:
+      cr_options.lazy_pages = true;
+      break;
+
+    case OPTION_ARCHIVE:
+      cr_options.archive_path = argp_mandatory_argument (arg, state);
+      break;
+
     case OPTION_PID_FILE:
       crun_context.pid_file = argp_mandatory_argument (arg, state);
       break;
@@ -130,7 +142,7 @@ crun_command_restore (struct crun_global_arguments *global_args, int argc, char
   int ret;
 
   argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, &cr_options);
-  crun_assert_n_args (argc - first_arg, 1, 2);
+  crun_assert_n_args (argc - first_arg, 1, -1);
 
   /* Make sure the bundle is an absolute path.  */
 
@@ -171,5 +183,11 @@ crun_command_restore (struct crun_global_arguments *global_args, int argc, char
     }
 
   crun_context.bundle = bundle;
+
+  /* The bundle of each container is the directory named as its ID.  */
+  if (argc - first_arg > 1)
+    return libcrun_container_restore_many (&crun_context, (const char **) argv + first_arg, argc - first_arg,
+                                           &cr_options, err);
+
   return libcrun_container_restore (&crun_context, argv[first_arg], &cr_options, err);
 }
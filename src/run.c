@@ -37,7 +37,9 @@ enum
   OPTION_NO_SUBREAPER,
   OPTION_NO_NEW_KEYRING,
   OPTION_PRESERVE_FDS,
-  OPTION_NO_PIVOT
+  OPTION_NO_PIVOT,
+  OPTION_CONSOLE_LOG,
+  OPTION_CONSOLE_LOG_SIZE
 };
 
 static const char *bundle = NULL;
@@ -50,6 +52,8 @@ static struct argp_option options[]
         { "detach", 'd', 0, 0, "detach from the parent", 0 },
         { "console-socket", OPTION_CONSOLE_SOCKET, "SOCKET", 0,
           "path to a socket that will receive the ptmx end of the tty", 0 },
+        { "console-log", OPTION_CONSOLE_LOG, "FILE", 0, "write the output of the tty to FILE", 0 },
+        { "console-log-size", OPTION_CONSOLE_LOG_SIZE, "SIZE", 0, "rotate the console log after SIZE bytes", 0 },
         { "preserve-fds", OPTION_PRESERVE_FDS, "N", 0, "pass additional FDs to the container", 0 },
         { "pid-file", OPTION_PID_FILE, "FILE", 0, "where to write the PID of the container", 0 },
         { "no-subreaper", OPTION_NO_SUBREAPER, 0, 0, "do not create a subreaper process", 0 },
@@ -84,6 +88,14 @@ parse_opt (int key, char *arg, struct argp_state *state)
       crun_context.console_socket = argp_mandatory_argument (arg, state);
       break;
 
+    case OPTION_CONSOLE_LOG:
+      crun_context.console_log = argp_mandatory_argument (arg, state);
+      break;
+
+    case OPTION_CONSOLE_LOG_SIZE:
+      crun_context.console_log_size = strtoull (argp_mandatory_argument (arg, state), NULL, 10);
+      break;
+
     case OPTION_PRESERVE_FDS:
       crun_context.preserve_fds = strtoll (argp_mandatory_argument (arg, state), NULL, 10);
       break;
@@ -131,6 +143,9 @@ crun_command_run (struct crun_global_arguments *global_args, int argc, char **ar
   argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, &crun_context);
   crun_assert_n_args (argc - first_arg, 1, 1);
 
+  if (crun_context.console_log && (crun_context.detach || crun_context.console_socket))
+    libcrun_fail_with_error (0, "--console-log cannot be used with --detach or --console-socket");
+
   /* Make sure the config is an absolute path before changing the directory.  */
   if ((strcmp ("config.json", config_file) != 0))
     {
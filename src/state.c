@@ -41,22 +41,31 @@ enum
 
 struct state_options_s
 {
+  bool all;
 };
 
 static struct state_options_s state_options;
 
-static struct argp_option options[] = { {
-    0,
-} };
+static struct argp_option options[]
+    = { { "all", 'a', 0, 0, "print the state of all the containers as a JSON array", 0 },
+        {
+            0,
+        } };
 
-static char args_doc[] = "state CONTAINER";
+static char args_doc[] = "state [--all] CONTAINER";
 
 static error_t
 parse_opt (int key, char *arg arg_unused, struct argp_state *state arg_unused)
 {
   switch (key)
     {
+    case 'a':
+      state_options.all = true;
+      break;
+
     case ARGP_KEY_NO_ARGS:
+      if (state_options.all)
+        break;
       libcrun_fail_with_error (0, "please specify a ID for the container");
 
     default:
@@ -77,11 +86,17 @@ crun_command_state (struct crun_global_arguments *global_args, int argc, char **
   };
 
   argp_parse (&run_argp, argc, argv, ARGP_IN_ORDER, &first_arg, &state_options);
-  crun_assert_n_args (argc - first_arg, 1, 1);
+  if (state_options.all)
+    crun_assert_n_args (argc - first_arg, 0, 0);
+  else
+    crun_assert_n_args (argc - first_arg, 1, 1);
 
   ret = init_libcrun_context (&crun_context, argv[first_arg], global_args, err);
   if (UNLIKELY (ret < 0))
     return ret;
 
+  if (state_options.all)
+    return libcrun_container_state_all (&crun_context, stdout, err);
+
   return libcrun_container_state (&crun_context, argv[first_arg], stdout, err);
 }
@@ -0,0 +1,234 @@
+#!/bin/env python3
+# crun - OCI runtime written in C
+#
+# Copyright (C) 2017, 2018, 2019 Giuseppe Scrivano <giuseppe@scrivano.org>
+# crun is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# crun is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with crun.  If not, see <http://www.gnu.org/licenses/>.
+
+# Measure the latency of the create, start, exec and delete phases of the
+# container lifecycle, and the throughput under concurrency, for several
+# configurations.  Run it from the build directory with "make bench", or
+# set OCI_RUNTIME and INIT to the crun and init binaries to use.
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from tests_utils import base_config, add_all_namespaces, get_crun_path, is_rootless
+
+PHASES = ["create", "start", "exec", "delete"]
+
+# Syscalls denied by the seccomp configuration.  They are not used by the
+# init binary, the only goal is to have a filter of a realistic size.
+SECCOMP_DENIED = ["acct", "add_key", "bpf", "clock_adjtime", "clock_settime", "create_module",
+                  "delete_module", "finit_module", "get_kernel_syms", "get_mempolicy", "init_module",
+                  "ioperm", "iopl", "kcmp", "kexec_file_load", "kexec_load", "keyctl", "lookup_dcookie",
+                  "mbind", "move_pages", "name_to_handle_at", "nfsservctl", "open_by_handle_at",
+                  "perf_event_open", "personality", "pivot_root", "process_vm_readv",
+                  "process_vm_writev", "ptrace", "query_module", "quotactl", "reboot", "request_key",
+                  "set_mempolicy", "setns", "settimeofday", "stime", "swapoff", "swapon", "sysfs",
+                  "_sysctl", "umount", "umount2", "unshare", "uselib", "userfaultfd", "ustat", "vm86",
+                  "vm86old"]
+
+def get_cgroup_mode():
+    out = subprocess.check_output(["stat", "-f", "-c", "%T", "/sys/fs/cgroup"]).decode().strip()
+    if out == "cgroup2fs":
+        return "v2"
+    if os.path.exists("/sys/fs/cgroup/unified"):
+        return "hybrid"
+    return "v1"
+
+def has_systemd():
+    return os.path.exists("/run/systemd/system")
+
+def config_seccomp(conf):
+    conf['linux']['seccomp'] = {
+        "defaultAction": "SCMP_ACT_ALLOW",
+        "architectures": ["SCMP_ARCH_X86_64", "SCMP_ARCH_X86", "SCMP_ARCH_AARCH64"],
+        "syscalls": [{"names": SECCOMP_DENIED, "action": "SCMP_ACT_ERRNO"}]
+    }
+
+def config_userns(conf):
+    add_all_namespaces(conf, userns=True)
+    if is_rootless():
+        uid, gid = os.getuid(), os.getgid()
+        conf['linux']['uidMappings'] = [{"containerID": 0, "hostID": uid, "size": 1}]
+        conf['linux']['gidMappings'] = [{"containerID": 0, "hostID": gid, "size": 1}]
+    else:
+        conf['linux']['uidMappings'] = [{"containerID": 0, "hostID": 0, "size": 65536}]
+        conf['linux']['gidMappings'] = [{"containerID": 0, "hostID": 0, "size": 65536}]
+
+def config_mounts(n):
+    def configure(conf):
+        for i in range(n):
+            conf['mounts'].append({"destination": "/mnt/%d" % i, "type": "tmpfs", "source": "tmpfs",
+                                   "options": ["nosuid", "nodev", "size=1m"]})
+    return configure
+
+# Each configuration is (name, function to change the config, extra global
+# arguments for crun, whether it can run in this environment).
+def get_configurations():
+    rootless = is_rootless()
+    return [
+        ("default", None, [], True),
+        ("seccomp", config_seccomp, [], True),
+        ("userns", config_userns, [], True),
+        ("mounts-16", config_mounts(16), [], True),
+        ("mounts-128", config_mounts(128), [], True),
+        ("systemd", None, ["--systemd-cgroup"], has_systemd() and not rootless),
+    ]
+
+def prepare_bundle(directory, conf, configure):
+    rootfs = os.path.join(directory, "rootfs")
+    for i in ["proc", "sys", "dev", "mnt"]:
+        os.makedirs(os.path.join(rootfs, i))
+    shutil.copy2(os.getenv("INIT") or "tests/init", os.path.join(rootfs, "init"))
+
+    if configure:
+        configure(conf)
+    for m in conf['mounts']:
+        if m['destination'].startswith("/mnt/"):
+            os.makedirs(os.path.join(rootfs, m['destination'][1:]), exist_ok=True)
+
+    conf['process']['args'] = ['/init', 'pause']
+    if not any(i['type'] == 'user' for i in conf['linux']['namespaces']):
+        add_all_namespaces(conf, userns=is_rootless())
+        if is_rootless():
+            config_userns(conf)
+    with open(os.path.join(directory, "config.json"), "w") as f:
+        json.dump(conf, f)
+
+def run_cycle(crun, global_args, bundle, cid):
+    def crun_cmd(args):
+        subprocess.check_call([crun] + global_args + args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    timings = {}
+    start = time.monotonic()
+    crun_cmd(["create", "--bundle", bundle, cid])
+    t = time.monotonic()
+    timings["create"] = t - start
+    try:
+        crun_cmd(["start", cid])
+        timings["start"] = time.monotonic() - t
+        t = time.monotonic()
+        crun_cmd(["exec", cid, "/init", "true"])
+        timings["exec"] = time.monotonic() - t
+    finally:
+        t = time.monotonic()
+        crun_cmd(["delete", "-f", cid])
+        timings["delete"] = time.monotonic() - t
+    timings["total"] = time.monotonic() - start
+    return timings
+
+def percentile(values, p):
+    if len(values) == 0:
+        return 0
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100.0
+    lower = int(k)
+    upper = min(lower + 1, len(values) - 1)
+    return values[lower] + (values[upper] - values[lower]) * (k - lower)
+
+def run_benchmark(crun, name, configure, extra_args, iterations, concurrency, workdir):
+    bundle = os.path.join(workdir, name)
+    os.makedirs(bundle)
+    prepare_bundle(bundle, base_config(), configure)
+    global_args = ["--root", os.path.join(workdir, "state")] + extra_args
+
+    # Warm up the caches so that the first measured cycle is not an outlier.
+    run_cycle(crun, global_args, bundle, "bench-%s-warmup" % name)
+
+    results = []
+    failures = []
+    lock = threading.Lock()
+
+    def worker(i):
+        try:
+            r = run_cycle(crun, global_args, bundle, "bench-%s-%d" % (name, i))
+            with lock:
+                results.append(r)
+        except subprocess.CalledProcessError as e:
+            with lock:
+                failures.append(str(e))
+
+    start = time.monotonic()
+    with ThreadPoolExecutor(max_workers=concurrency) as executor:
+        list(executor.map(worker, range(iterations)))
+    elapsed = time.monotonic() - start
+
+    report = {"config": name, "concurrency": concurrency, "iterations": len(results),
+              "failures": len(failures), "throughput": len(results) / elapsed if elapsed else 0,
+              "phases": {}}
+    for phase in PHASES + ["total"]:
+        values = [r[phase] * 1000 for r in results if phase in r]
+        report["phases"][phase] = {"p50": percentile(values, 50), "p90": percentile(values, 90),
+                                    "p99": percentile(values, 99)}
+    return report
+
+def print_report(report):
+    print("%-12s c=%-3d n=%-4d failed=%-3d %7.1f containers/s" % (report["config"], report["concurrency"],
+                                                                   report["iterations"], report["failures"],
+                                                                   report["throughput"]))
+    for phase in PHASES + ["total"]:
+        p = report["phases"][phase]
+        print("    %-8s p50 %8.2f ms  p90 %8.2f ms  p99 %8.2f ms" % (phase, p["p50"], p["p90"], p["p99"]))
+
+def main():
+    parser = argparse.ArgumentParser(description="crun lifecycle benchmark")
+    parser.add_argument("--iterations", type=int, default=50, help="cycles for each configuration")
+    parser.add_argument("--concurrency", default="1,4", help="comma separated list of concurrency levels")
+    parser.add_argument("--configs", default=None, help="comma separated list of configurations to run")
+    parser.add_argument("--json", action="store_true", help="print the results as JSON")
+    args = parser.parse_args()
+
+    crun = get_crun_path()
+    selected = args.configs.split(",") if args.configs else None
+    levels = [int(i) for i in args.concurrency.split(",")]
+
+    environment = {"cgroup": get_cgroup_mode(), "rootless": is_rootless(),
+                   "version": subprocess.check_output([crun, "--version"]).decode().split("\n")[0]}
+    reports = []
+    workdir = tempfile.mkdtemp(prefix="crun-bench-")
+    try:
+        for name, configure, extra_args, available in get_configurations():
+            if selected is not None and name not in selected:
+                continue
+            if not available:
+                sys.stderr.write("skipping %s, not supported in this environment\n" % name)
+                continue
+            for level in levels:
+                report = run_benchmark(crun, name, configure, extra_args, args.iterations, level,
+                                       os.path.join(workdir, "%s-%d" % (name, level)))
+                reports.append(report)
+                if not args.json:
+                    print_report(report)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    if args.json:
+        print(json.dumps({"environment": environment, "results": reports}, indent=2))
+    else:
+        print("cgroup %s, rootless %s, %s" % (environment["cgroup"], environment["rootless"], environment["version"]))
+
+    return 1 if any(r["failures"] for r in reports) else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -85,8 +85,177 @@ def test_cr1():
 
     return 0
 
+def test_cr_pre_dump():
+    if is_rootless():
+        return 77
+    if 'CRIU' not in get_crun_feature_string():
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf, userns=True)
+    # User namespace support not working yet for checkpoint/restore
+    conf['linux']['namespaces'].remove({'type':'user'})
+    cid = None
+    cr_dir = os.path.join(get_tests_root(), 'checkpoint-pre-dump')
+    pre_dump_dir = os.path.join(cr_dir, 'pre-dump')
+    dump_dir = os.path.join(cr_dir, 'dump')
+    try:
+        proc, cid = run_and_get_output(conf, all_dev_null=True, use_popen=True, detach=True)
+        for i in range(50):
+            try:
+                s = json.loads(run_crun_command(["state", cid]))
+                break
+            except Exception as e:
+                time.sleep(0.1)
+
+        os.makedirs(cr_dir)
+        try:
+            run_crun_command(["checkpoint", "--pre-dump", "--image-path=%s" % pre_dump_dir, cid])
+        except subprocess.CalledProcessError:
+            # pre-dump not supported by CRIU or by the kernel
+            return 77
+
+        # The container must still be running after a pre-dump.
+        s = json.loads(run_crun_command(["state", cid]))
+        if s['status'] != "running":
+            return -1
+
+        run_crun_command(["checkpoint", "--image-path=%s" % dump_dir, "--parent-path=../pre-dump", cid])
+
+        bundle = os.path.join(
+            get_tests_root(),
+            cid.split('-')[1]
+        )
+
+        run_crun_command([
+            "restore",
+            "-d",
+            "--image-path=%s" % dump_dir,
+            "--bundle=%s" % bundle,
+            cid
+        ])
+
+        s = json.loads(run_crun_command(["state", cid]))
+        if s['status'] != "running":
+            return -1
+
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+        shutil.rmtree(cr_dir, ignore_errors=True)
+
+    return 0
+
+def test_cr_archive():
+    if is_rootless():
+        return 77
+    if 'CRIU' not in get_crun_feature_string():
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf, userns=True)
+    # User namespace support not working yet for checkpoint/restore
+    conf['linux']['namespaces'].remove({'type':'user'})
+    cid = None
+    cr_dir = os.path.join(get_tests_root(), 'checkpoint-archive')
+    archive = os.path.join(get_tests_root(), 'checkpoint.tar')
+    try:
+        proc, cid = run_and_get_output(conf, all_dev_null=True, use_popen=True, detach=True)
+        for i in range(50):
+            try:
+                s = json.loads(run_crun_command(["state", cid]))
+                break
+            except Exception as e:
+                time.sleep(0.1)
+
+        run_crun_command(["checkpoint", "--image-path=%s" % cr_dir, "--archive=%s" % archive, cid])
+
+        # The restore must only depend on the archive.
+        shutil.rmtree(cr_dir)
+
+        bundle = os.path.join(
+            get_tests_root(),
+            cid.split('-')[1]
+        )
+
+        run_crun_command([
+            "restore",
+            "-d",
+            "--image-path=%s" % cr_dir,
+            "--archive=%s" % archive,
+            "--bundle=%s" % bundle,
+            cid
+        ])
+
+        s = json.loads(run_crun_command(["state", cid]))
+        if s['status'] != "running":
+            return -1
+
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+        shutil.rmtree(cr_dir, ignore_errors=True)
+        if os.path.exists(archive):
+            os.unlink(archive)
+
+    return 0
+
+def test_cr_many():
+    if is_rootless():
+        return 77
+    if 'CRIU' not in get_crun_feature_string():
+        return 77
+    cids = []
+    cr_dir = os.path.join(get_tests_root(), 'checkpoint-many')
+    bundles = os.path.join(get_tests_root(), 'bundles-many')
+    try:
+        os.makedirs(bundles)
+        for i in range(2):
+            conf = base_config()
+            conf['process']['args'] = ['/init', 'pause']
+            add_all_namespaces(conf)
+            proc, cid = run_and_get_output(conf, all_dev_null=True, use_popen=True, detach=True)
+            cids.append(cid)
+            # The bundle of each container is looked up by its ID.
+            os.symlink(os.path.join(get_tests_root(), cid.split('-')[1]), os.path.join(bundles, cid))
+
+        for cid in cids:
+            for i in range(50):
+                try:
+                    s = json.loads(run_crun_command(["state", cid]))
+                    break
+                except Exception as e:
+                    time.sleep(0.1)
+
+        run_crun_command(["checkpoint", "--image-path=%s" % cr_dir] + cids)
+
+        for cid in cids:
+            if not os.path.exists(os.path.join(cr_dir, cid)):
+                return -1
+
+        run_crun_command(["restore", "--image-path=%s" % cr_dir, "--bundle=%s" % bundles] + cids)
+
+        for cid in cids:
+            s = json.loads(run_crun_command(["state", cid]))
+            if s['status'] != "running":
+                return -1
+
+    finally:
+        for cid in cids:
+            try:
+                run_crun_command(["delete", "-f", cid])
+            except:
+                pass
+        shutil.rmtree(cr_dir, ignore_errors=True)
+        shutil.rmtree(bundles, ignore_errors=True)
+
+    return 0
+
 all_tests = {
     "checkpoint-restore" : test_cr1,
+    "checkpoint-pre-dump-restore" : test_cr_pre_dump,
+    "checkpoint-archive-restore" : test_cr_archive,
+    "checkpoint-restore-many" : test_cr_many,
 }
 
 if __name__ == "__main__":
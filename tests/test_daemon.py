@@ -0,0 +1,158 @@
+#!/bin/env python3
+# crun - OCI runtime written in C
+#
+# Copyright (C) 2017, 2018, 2019 Giuseppe Scrivano <giuseppe@scrivano.org>
+# crun is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# crun is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with crun.  If not, see <http://www.gnu.org/licenses/>.
+
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+from tests_utils import *
+
+def daemon_request(path, cwd, args):
+    payload = b"".join([i.encode() + b"\0" for i in [cwd] + args])
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.connect(path)
+        with open(os.devnull, "r+") as devnull:
+            fds = [devnull.fileno()] * 3
+            sock.sendmsg([struct.pack("=I", len(payload))],
+                         [(socket.SOL_SOCKET, socket.SCM_RIGHTS, struct.pack("=3i", *fds))])
+        sock.sendall(payload)
+        data = b""
+        while len(data) < 4:
+            chunk = sock.recv(4 - len(data))
+            if not chunk:
+                return -1
+            data += chunk
+        return struct.unpack("=i", data)[0]
+    finally:
+        sock.close()
+
+def test_daemon_spec():
+    path = os.path.join(get_tests_root(), "daemon.sock")
+    daemon = subprocess.Popen([get_crun_path(), "daemon", path])
+    try:
+        for i in range(50):
+            if os.path.exists(path):
+                break
+            time.sleep(0.1)
+
+        workdir = tempfile.mkdtemp(dir=get_tests_root())
+        if daemon_request(path, workdir, ["spec"]) != 0:
+            print("crun spec failed", file=sys.stderr)
+            return -1
+        if not os.path.exists(os.path.join(workdir, "config.json")):
+            print("config.json not created", file=sys.stderr)
+            return -1
+
+        # the file exists now, so the second request must fail.
+        if daemon_request(path, workdir, ["spec"]) == 0:
+            print("crun spec did not fail", file=sys.stderr)
+            return -1
+        return 0
+    finally:
+        daemon.kill()
+        daemon.wait()
+
+def test_daemon_other_user():
+    path = os.path.join(get_tests_root(), "daemon-other-user.sock")
+    daemon = subprocess.Popen([get_crun_path(), "daemon", path])
+    try:
+        for i in range(50):
+            if os.path.exists(path):
+                break
+            time.sleep(0.1)
+
+        if os.stat(path).st_mode & 0o077:
+            print("the socket is accessible by other users", file=sys.stderr)
+            return -1
+
+        if is_rootless():
+            return 0
+
+        # Open the socket to everybody, the daemon must still refuse the request.
+        os.chmod(path, 0o777)
+        workdir = tempfile.mkdtemp(dir=get_tests_root())
+        os.chmod(workdir, 0o777)
+        pid = os.fork()
+        if pid == 0:
+            try:
+                os.setgid(65534)
+                os.setuid(65534)
+                os._exit(0 if daemon_request(path, workdir, ["spec"]) == 0 else 1)
+            except Exception:
+                os._exit(1)
+        _, status = os.waitpid(pid, 0)
+        if os.WEXITSTATUS(status) == 0 or os.path.exists(os.path.join(workdir, "config.json")):
+            print("the request from another user was served", file=sys.stderr)
+            return -1
+        return 0
+    finally:
+        daemon.kill()
+        daemon.wait()
+
+def test_daemon_in_use():
+    path = os.path.join(get_tests_root(), "daemon-in-use.sock")
+    daemon = subprocess.Popen([get_crun_path(), "daemon", path])
+    try:
+        for i in range(50):
+            if os.path.exists(path):
+                break
+            time.sleep(0.1)
+
+        # the socket of a running daemon must not be taken over
+        second = subprocess.run([get_crun_path(), "daemon", path], stdout=subprocess.PIPE,
+                                stderr=subprocess.STDOUT, timeout=10)
+        if second.returncode == 0 or b"another daemon" not in second.stdout:
+            print("the second daemon did not fail: %s" % second.stdout, file=sys.stderr)
+            return -1
+
+        workdir = tempfile.mkdtemp(dir=get_tests_root())
+        if daemon_request(path, workdir, ["spec"]) != 0:
+            print("the first daemon does not serve requests anymore", file=sys.stderr)
+            return -1
+    finally:
+        daemon.kill()
+        daemon.wait()
+
+    # the socket of the killed daemon is stale and it is replaced
+    daemon = subprocess.Popen([get_crun_path(), "daemon", path])
+    try:
+        workdir = tempfile.mkdtemp(dir=get_tests_root())
+        for i in range(50):
+            try:
+                if daemon_request(path, workdir, ["spec"]) == 0:
+                    return 0
+            except OSError:
+                pass
+            time.sleep(0.1)
+        print("the stale socket was not replaced", file=sys.stderr)
+        return -1
+    finally:
+        daemon.kill()
+        daemon.wait()
+
+all_tests = {
+    "daemon-spec" : test_daemon_spec,
+    "daemon-other-user" : test_daemon_other_user,
+    "daemon-in-use" : test_daemon_in_use,
+}
+
+if __name__ == "__main__":
+    tests_main(all_tests)
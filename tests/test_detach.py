@@ -42,8 +42,110 @@ def test_detach():
         run_crun_command(["delete", "-f", container_id])
     return 0
 
+def test_list():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf)
+
+    out, container_id = run_and_get_output(conf, detach=True, hide_stderr=True)
+    if out != "":
+        return -1
+    try:
+        # the second listing is served by the status index
+        for i in range(2):
+            containers = json.loads(run_crun_command(["list", "--format", "json"]))
+            found = [c for c in containers if c['id'] == container_id]
+            if len(found) != 1 or found[0]['status'] != "running":
+                return -1
+    finally:
+        run_crun_command(["delete", "-f", container_id])
+
+    containers = json.loads(run_crun_command(["list", "--format", "json"]))
+    if any(c['id'] == container_id for c in containers):
+        return -1
+    return 0
+
+def test_state_all():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf)
+
+    out, container_id = run_and_get_output(conf, detach=True, hide_stderr=True)
+    if out != "":
+        return -1
+    try:
+        states = json.loads(run_crun_command(["state", "--all"]))
+        found = [s for s in states if s['id'] == container_id]
+        if len(found) != 1:
+            return -1
+        state = json.loads(run_crun_command(["state", container_id]))
+        if found[0] != state:
+            return -1
+    finally:
+        run_crun_command(["delete", "-f", container_id])
+    return 0
+
+def test_kill_all():
+    if is_rootless():
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf)
+
+    out, container_id = run_and_get_output(conf, detach=True, hide_stderr=True)
+    if out != "":
+        return -1
+    try:
+        run_crun_command(["kill", "--all", container_id, "KILL"])
+        for i in range(50):
+            state = json.loads(run_crun_command(["state", container_id]))
+            if state['status'] == "stopped":
+                return 0
+            time.sleep(0.1)
+        return -1
+    finally:
+        run_crun_command(["delete", "-f", container_id])
+
+def test_delete_many():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf)
+
+    ids = []
+    try:
+        for i in range(3):
+            out, container_id = run_and_get_output(conf, detach=True, hide_stderr=True)
+            if out != "":
+                return -1
+            ids.append(container_id)
+
+        # Without --force, running containers are not deleted.
+        try:
+            run_crun_command(["delete"] + ids)
+        except subprocess.CalledProcessError:
+            pass
+        else:
+            return -1
+        containers = json.loads(run_crun_command(["list", "--format", "json"]))
+        if len([c for c in containers if c['id'] in ids]) != len(ids):
+            return -1
+
+        run_crun_command(["delete", "-f"] + ids)
+        containers = json.loads(run_crun_command(["list", "--format", "json"]))
+        if any(c['id'] in ids for c in containers):
+            return -1
+        ids = []
+    finally:
+        for container_id in ids:
+            run_crun_command(["delete", "-f", container_id])
+    return 0
+
 all_tests = {
     "test-detach" : test_detach,
+    "test-list" : test_list,
+    "test-state-all" : test_state_all,
+    "test-kill-all" : test_kill_all,
+    "test-delete-many" : test_delete_many,
 }
 
 if __name__ == "__main__":
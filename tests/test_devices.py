@@ -113,11 +113,99 @@ def test_allow_access():
         return -1
     return 0
 
+def list_bpf_cache():
+    try:
+        return set(os.listdir("/sys/fs/bpf/crun"))
+    except:
+        return set()
+
+def test_device_programs_cache():
+    if is_rootless() or not os.path.exists("/sys/fs/cgroup/cgroup.controllers"):
+        return 77
+
+    before = list_bpf_cache()
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['process']['args'] = ['/init', 'pause']
+    conf['linux']['resources'] = {"devices": [{"allow": False, "access": "rwm"},
+                                              {"allow": True, "type": "c", "major": 1, "minor": 3, "access": "rw"}]}
+    ids = []
+    try:
+        for i in range(2):
+            _, container_id = run_and_get_output(conf, detach=True, hide_stderr=True)
+            ids.append(container_id)
+
+        # Containers with the same rules share the cached program, if any.
+        if len(list_bpf_cache() - before) > 1:
+            return -1
+    finally:
+        for container_id in ids:
+            run_crun_command(["delete", "-f", container_id])
+
+    # The programs are not cached anymore once no cgroup uses them.
+    if list_bpf_cache() - before:
+        sys.stderr.write("leftover cached programs: %s\n" % (list_bpf_cache() - before))
+        return -1
+    return 0
+
+def test_update_device_map_grow():
+    if is_rootless() or not os.path.exists("/sys/fs/cgroup/cgroup.controllers"):
+        return 77
+
+    try:
+        os.stat("/dev/fuse")
+    except:
+        return 77
+
+    def rules(major, count):
+        return [{"allow": True, "type": "c", "major": major, "minor": i, "access": "rw"} for i in range(count)]
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['process']['args'] = ['/init', 'pause']
+    # With the default devices these rules fit in the smallest map; the new
+    # rules fit too, but not together with the old ones.
+    conf['linux']['resources'] = {"devices": [{"allow": False, "access": "rwm"}] + rules(240, 18)}
+    dev = {
+	"destination": "/dev",
+	"type": "bind",
+	"source": "/dev",
+	"options": [
+            "rbind",
+	    "rw"
+	]
+    }
+    conf['mounts'].append(dev)
+    temp_dir = tempfile.mkdtemp(dir=get_tests_root())
+    container_id = None
+    try:
+        _, container_id = run_and_get_output(conf, detach=True, hide_stderr=True)
+
+        devices = [{"allow": False, "access": "rwm"}] + rules(241, 49)
+        devices.append({"allow": True, "type": "c", "major": 10, "minor": 229, "access": "rw"})
+        res_file = os.path.join(temp_dir, "resources")
+        with open(res_file, 'w') as f:
+            json.dump({"devices": devices}, f)
+
+        run_crun_command(["update", "-r", res_file, container_id])
+
+        # The new rules are in place.
+        run_crun_command(["exec", container_id, "/init", "open", "/dev/fuse"])
+    except Exception as e:
+        sys.stderr.write("%s\n" % e)
+        return -1
+    finally:
+        if container_id is not None:
+            run_crun_command(["delete", "-f", container_id])
+        shutil.rmtree(temp_dir)
+    return 0
 
 all_tests = {
     "deny-devices" : test_deny_devices,
     "allow-device" : test_allow_device,
     "allow-access" : test_allow_access,
+    "device-programs-cache" : test_device_programs_cache,
+    "update-device-map-grow" : test_update_device_map_grow,
 }
 
 if __name__ == "__main__":
@@ -102,11 +102,94 @@ def test_exec_additional_gids():
         shutil.rmtree(tempdir)
     return 0
 
+def get_descendants(pid):
+    children = {}
+    for i in os.listdir("/proc"):
+        if not i.isdigit():
+            continue
+        try:
+            with open(os.path.join("/proc", i, "stat")) as f:
+                stat = f.read()
+        except Exception:
+            continue
+        ppid = int(stat[stat.rindex(')') + 2:].split()[1])
+        children.setdefault(ppid, []).append(int(i))
+    ret = []
+    pending = [pid]
+    while pending:
+        for c in children.get(pending.pop(), []):
+            ret.append(c)
+            pending.append(c)
+    return ret
+
+def get_cmdline(pid):
+    try:
+        with open("/proc/%d/cmdline" % pid, "rb") as f:
+            return f.read()
+    except Exception:
+        return b""
+
+def test_exec_server():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    conf['annotations'] = {'run.oci.exec_server': 'true'}
+    add_all_namespaces(conf)
+    proc = None
+    exec_proc = None
+    cid = None
+    try:
+        proc, cid = run_and_get_output(conf, command='run', use_popen=True)
+        init_pid = None
+        for i in range(50):
+            try:
+                s = json.loads(run_crun_command(["state", cid]))
+                if s['status'] == "running":
+                    init_pid = s['pid']
+                    break
+            except Exception:
+                pass
+            time.sleep(0.1)
+
+        out = run_crun_command(["exec", cid, "/init", "echo", "foo"])
+        if "foo" not in out:
+            return -1
+        try:
+            run_crun_command(["exec", cid, "/not.here"])
+            return -1
+        except subprocess.CalledProcessError:
+            pass
+
+        # The process must be forked by the monitor, not by a new crun
+        # process joining the container.
+        exec_proc = subprocess.Popen([get_crun_path(), "exec", cid, "/init", "pause"],
+                                     stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        for i in range(50):
+            served = [p for p in get_descendants(proc.pid)
+                      if p != init_pid and get_cmdline(p) == b"/init\0pause\0"]
+            if served:
+                break
+            time.sleep(0.1)
+        else:
+            sys.stderr.write("the exec request was not served by the monitor\n")
+            return -1
+        if get_descendants(exec_proc.pid):
+            sys.stderr.write("crun exec created a process\n")
+            return -1
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+        if proc is not None:
+            proc.wait()
+        if exec_proc is not None:
+            exec_proc.wait()
+    return 0
+
 all_tests = {
     "exec" : test_exec,
     "exec-not-exists" : test_exec_not_exists,
     "exec-detach-not-exists" : test_exec_detach_not_exists,
     "exec-detach-additional-gids" : test_exec_additional_gids,
+    "exec-server" : test_exec_server,
 }
 
 if __name__ == "__main__":
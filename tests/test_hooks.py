@@ -43,9 +43,143 @@ def test_success_prestart():
         return -1
     return 0
 
+def test_parallel_prestart():
+    conf = base_config()
+    conf['annotations'] = {"run.oci.hooks.parallel" : "1"}
+    conf['hooks'] = {"prestart" : [{"path" : "/bin/true"}, {"path" : "/bin/false"}, {"path" : "/bin/true"}]}
+    add_all_namespaces(conf)
+    try:
+        out, _ = run_and_get_output(conf, hide_stderr=True)
+    except:
+        pass
+    else:
+        return -1
+
+    conf['hooks'] = {"prestart" : [{"path" : "/bin/true"}, {"path" : "/bin/true"}]}
+    try:
+        out, _ = run_and_get_output(conf)
+    except:
+        return -1
+    return 0
+
+def test_hook_so_without_plugins():
+    hook = os.path.join(get_tests_root(), "hook.so")
+    marker = os.path.join(get_tests_root(), "hook-executed")
+    with open(hook, "w") as f:
+        f.write("#!/bin/sh\ntouch %s\n" % marker)
+    os.chmod(hook, 0o755)
+
+    conf = base_config()
+    conf['hooks'] = {"prestart" : [{"path" : hook}]}
+    add_all_namespaces(conf)
+    try:
+        run_and_get_output(conf)
+    except:
+        return -1
+    # Without run.oci.hooks.plugins the hook must be executed.
+    if not os.path.exists(marker):
+        return -1
+    return 0
+
+def test_hook_plugin():
+    cc = shutil.which("cc")
+    if cc is None:
+        return 77
+    source = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "contrib", "hook-plugin-example", "log.c")
+    plugin = os.path.join(get_tests_root(), "log.so")
+    log = os.path.join(get_tests_root(), "hooks.log")
+    try:
+        subprocess.check_call([cc, "-fPIC", "-shared", "-o", plugin, source])
+    except:
+        return 77
+
+    conf = base_config()
+    conf['annotations'] = {"run.oci.hooks.plugins" : "1"}
+    conf['hooks'] = {"prestart" : [{"path" : plugin, "args" : ["log.so", log]}],
+                     "poststop" : [{"path" : plugin, "args" : ["log.so", log], "timeout" : 10}]}
+    add_all_namespaces(conf)
+    try:
+        _, cid = run_and_get_output(conf)
+    except:
+        return -1
+    with open(log) as f:
+        lines = f.readlines()
+    if len(lines) != 2 or not all(l.startswith(cid + " ") for l in lines):
+        sys.stderr.write("unexpected plugin log: %s\n" % lines)
+        return -1
+    return 0
+
+def test_prestart_seccomp():
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['linux']['seccomp'] = {
+        'defaultAction': 'SCMP_ACT_ALLOW',
+        'syscalls': [
+            {
+                'names': ['getcwd'],
+                'action': 'SCMP_ACT_ERRNO',
+            },
+        ],
+    }
+    conf['process']['args'] = ['/init', 'cwd']
+    # the init waits for the hooks only when there are some, in both
+    # cases it must wait for the seccomp profile
+    for hooks in [{}, {"prestart" : [{"path" : "/bin/true"}]}, {"createRuntime" : [{"path" : "/bin/true"}]}]:
+        conf['hooks'] = hooks
+        try:
+            run_and_get_output(conf, hide_stderr=True)
+            sys.stderr.write("getcwd was not blocked with the hooks %s\n" % hooks)
+            return -1
+        except subprocess.CalledProcessError:
+            pass
+    return 0
+
+def test_lifecycle_hooks_from_state():
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['process']['args'] = ['/init', 'pause']
+    poststart = os.path.join(get_tests_root(), "poststart-%d" % os.getpid())
+    poststop = os.path.join(get_tests_root(), "poststop-%d" % os.getpid())
+    # start and delete build only the sections they need from the
+    # config.json in the state directory
+    conf['hooks'] = {
+        "poststart" : [{"path" : "/bin/sh", "args" : ["sh", "-c", "touch %s" % poststart]}],
+        "poststop" : [{"path" : "/bin/sh", "args" : ["sh", "-c", "touch %s" % poststop]}],
+    }
+    conf['annotations'] = {"org.example.test" : "lifecycle"}
+    conf['linux']['seccomp'] = {
+        'defaultAction': 'SCMP_ACT_ALLOW',
+        'syscalls': [{'names': ['getcwd'], 'action': 'SCMP_ACT_ERRNO'}],
+    }
+    cid = None
+    try:
+        _, cid = run_and_get_output(conf, command='create')
+        run_crun_command(["start", cid])
+        if not os.path.exists(poststart):
+            sys.stderr.write("the poststart hook did not run\n")
+            return -1
+        state = json.loads(run_crun_command(["state", cid]))
+        if state['status'] != "running" or state['annotations'].get("org.example.test") != "lifecycle":
+            sys.stderr.write("unexpected state %s\n" % state)
+            return -1
+        run_crun_command(["delete", "-f", cid])
+        cid = None
+        if not os.path.exists(poststop):
+            sys.stderr.write("the poststop hook did not run\n")
+            return -1
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+    return 0
+
 all_tests = {
     "test-fail-prestart" : test_fail_prestart,
     "test-success-prestart" : test_success_prestart,
+    "test-parallel-prestart" : test_parallel_prestart,
+    "test-hook-so-without-plugins" : test_hook_so_without_plugins,
+    "test-hook-plugin" : test_hook_plugin,
+    "test-prestart-seccomp" : test_prestart_seccomp,
+    "test-lifecycle-hooks-from-state" : test_lifecycle_hooks_from_state,
 }
 
 if __name__ == "__main__":
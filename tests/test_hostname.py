@@ -33,8 +33,56 @@ def test_hostname():
         return -1
     return 0
     
+def test_sysctl_hostname():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'gethostname']
+    conf['linux']['sysctl'] = {"kernel.hostname" : "barmachine"}
+    conf['hostname'] = ""
+    add_all_namespaces(conf)
+    out, _ = run_and_get_output(conf)
+    if "barmachine" not in out:
+        return -1
+    return 0
+
+def test_sysctl_requires_namespace():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'true']
+    conf['linux']['sysctl'] = {"kernel.hostname" : "barmachine"}
+    conf['hostname'] = ""
+    conf['linux']['namespaces'] = [i for i in conf['linux']['namespaces'] if i['type'] != 'uts']
+    try:
+        run_and_get_output(conf)
+    except Exception:
+        return 0
+    return -1
+
+def test_sysctl_not_in_table():
+    # kernel.shm_next_id is namespaced but not in the built-in table.
+    if is_rootless() or not os.path.exists("/proc/sys/kernel/shm_next_id"):
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'cat', '/proc/sys/kernel/shm_next_id']
+    conf['linux']['sysctl'] = {"kernel.shm_next_id" : "10"}
+    add_all_namespaces(conf)
+    try:
+        out, _ = run_and_get_output(conf)
+    except Exception:
+        return -1
+    if "10" not in out:
+        return -1
+
+    conf['linux']['sysctl'] = {"kernel.does_not_exist" : "1"}
+    try:
+        run_and_get_output(conf, hide_stderr=True)
+    except Exception:
+        return 0
+    return -1
+
 all_tests = {
     "hostname" : test_hostname,
+    "sysctl-hostname" : test_sysctl_hostname,
+    "sysctl-requires-namespace" : test_sysctl_requires_namespace,
+    "sysctl-not-in-table" : test_sysctl_not_in_table,
 }
 
 if __name__ == "__main__":
@@ -172,6 +172,87 @@ def test_mount_dev():
         return -1
     return 0
 
+def test_mount_tmpcopyup():
+    conf = base_config()
+    # /sbin/init is a copy of /init, so the copied up file must be complete to run.
+    conf['process']['args'] = ['/sbin/init', 'echo', 'hello']
+    add_all_namespaces(conf)
+    mount_opt = {"destination": "/sbin", "type": "tmpfs", "source": "tmpfs", "options": ["tmpcopyup"]}
+    conf['mounts'].append(mount_opt)
+    out, _ = run_and_get_output(conf, hide_stderr=True)
+    if "hello" in out:
+        return 0
+    return -1
+
+def test_mount_idmap():
+    if is_rootless():
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'cat', '/proc/self/mountinfo']
+    add_all_namespaces(conf, userns=True)
+    mappings = [
+        {
+            "containerID": 0,
+            "hostID": 8000,
+            "size": 1000,
+        },
+    ]
+    conf['linux']['uidMappings'] = mappings
+    conf['linux']['gidMappings'] = mappings
+    mount_opt = {"destination": "/var/dir", "type": "bind", "source": get_tests_root(), "options": ["bind", "rprivate", "idmap"]}
+    conf['mounts'].append(mount_opt)
+    # the rootfs is not chowned, it is usable only through the idmapped mount
+    conf['annotations'] = {"run.oci.idmap_rootfs": "true"}
+    try:
+        out, _ = run_and_get_output(conf)
+    except Exception as e:
+        # The kernel or the file system might not support idmapped mounts.
+        if "idmapped" in str(getattr(e, "output", b"")):
+            return 77
+        return -1
+    with tempfile.NamedTemporaryFile(mode='w', delete=True) as f:
+        f.write(out)
+        f.flush()
+        t = libmount.Table(f.name)
+        for target in ['/', '/var/dir']:
+            m = t.find_target(target)
+            if "idmapped" not in m.vfs_options:
+                return -1
+    return 0
+
+def test_mount_rootfs_layers():
+    if is_rootless():
+        return 77
+    layers = tempfile.mkdtemp(dir=get_tests_root())
+    try:
+        lower = os.path.join(layers, "lower")
+        for i in ["proc", "sys", "dev"]:
+            os.makedirs(os.path.join(lower, i))
+        os.makedirs(os.path.join(layers, "upper"))
+        os.makedirs(os.path.join(layers, "work"))
+        shutil.copy2(os.getenv("INIT") or "tests/init", os.path.join(lower, "init"))
+        with open(os.path.join(lower, "layer-file"), "w") as f:
+            f.write("from-lower-layer")
+
+        conf = base_config()
+        conf['process']['args'] = ['/init', 'cat', '/layer-file']
+        conf['annotations'] = {"run.oci.rootfs.lowerdir": lower,
+                               "run.oci.rootfs.upperdir": os.path.join(layers, "upper"),
+                               "run.oci.rootfs.workdir": os.path.join(layers, "work")}
+        add_all_namespaces(conf)
+        try:
+            out, _ = run_and_get_output(conf)
+        except Exception as e:
+            # The kernel might not support the new mount API for overlay.
+            if "overlay" in str(getattr(e, "output", b"")):
+                return 77
+            return -1
+        if "from-lower-layer" not in out:
+            return -1
+        return 0
+    finally:
+        shutil.rmtree(layers, ignore_errors=True)
+
 all_tests = {
     "test-mount-ro" : test_mount_ro,
     "test-mount-rw" : test_mount_rw,
@@ -187,6 +268,9 @@ all_tests = {
     "test-mount-symlink-not-existing" : test_mount_symlink_not_existing,
     "test-mount-dev" : test_mount_dev,
     "test-mount-nodev" : test_mount_nodev,
+    "test-mount-tmpcopyup" : test_mount_tmpcopyup,
+    "test-mount-idmap" : test_mount_idmap,
+    "test-mount-rootfs-layers" : test_mount_rootfs_layers,
 }
 
 if __name__ == "__main__":
@@ -45,9 +45,61 @@ def test_pid_user():
         return 0
     return -1
 
+def add_userns(conf):
+    mappings = [
+        {
+            "containerID": 0,
+            "hostID": 1,
+            "size": 1,
+        },
+        {
+            "containerID": 1,
+            "hostID": 0,
+            "size": 1,
+        }
+    ]
+    conf['linux']['namespaces'].append({"type" : "user"})
+    conf['linux']['uidMappings'] = mappings
+    conf['linux']['gidMappings'] = mappings
+
+def test_pid_userns_fork():
+    if is_rootless():
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'cat', '/proc/self/status']
+    add_all_namespaces(conf)
+    # the PID namespace is created after the user namespace, so the
+    # namespace setup forks and reports the new PID to crun
+    add_userns(conf)
+    out, _ = run_and_get_output(conf)
+    pid = parse_proc_status(out)['Pid']
+    if pid == "1":
+        return 0
+    return -1
+
+def test_pid_userns_fork_error():
+    if is_rootless():
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/does-not-exist']
+    add_all_namespaces(conf)
+    add_userns(conf)
+    # an error from the new process must not be read in place of its PID
+    try:
+        run_and_get_output(conf)
+    except subprocess.CalledProcessError as e:
+        out = e.output.decode()
+        if "does-not-exist" in out:
+            return 0
+        sys.stderr.write("unexpected error: %s\n" % out)
+        return -1
+    return -1
+
 all_tests = {
     "pid" : test_pid,
     "pid-user" : test_pid_user,
+    "pid-userns-fork" : test_pid_userns_fork,
+    "pid-userns-fork-error" : test_pid_userns_fork_error,
 }
 
 if __name__ == "__main__":
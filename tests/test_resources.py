@@ -20,6 +20,7 @@ import json
 import subprocess
 import os
 import shutil
+import select
 import sys
 from tests_utils import *
 
@@ -160,6 +161,250 @@ def test_resources_unified():
             run_crun_command(["delete", "-f", cid])
     return 0
 
+def test_events_stats():
+    if is_rootless():
+        return 77
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['process']['args'] = ['/init', 'pause']
+    conf['linux']['resources'] = {"pids" : {"limit" : 1024}}
+
+    cid = None
+    try:
+        _, cid = run_and_get_output(conf, command='run', detach=True)
+        out = run_crun_command(["events", "--stats", cid])
+        stats = json.loads(out.splitlines()[0])
+        if stats['type'] != "stats" or stats['id'] != cid:
+            sys.stderr.write("invalid stats %s\n" % out)
+            return -1
+        if stats['data']['pids']['current'] < 1:
+            sys.stderr.write("invalid pids count %s\n" % out)
+            return -1
+        if stats['data']['memory']['usage'] == 0:
+            sys.stderr.write("invalid memory usage %s\n" % out)
+            return -1
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+    return 0
+
+
+def test_events_exit():
+    if is_rootless():
+        return 77
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['process']['args'] = ['/init', 'pause']
+
+    cid = None
+    events = None
+    try:
+        _, cid = run_and_get_output(conf, command='run', detach=True)
+        events = subprocess.Popen([get_crun_path(), "events", "--interval=3600", cid], stdout=subprocess.PIPE)
+        # The first line has the stats for the container.
+        stats = json.loads(events.stdout.readline())
+        if stats['type'] != "stats":
+            return -1
+        run_crun_command(["kill", cid, "9"])
+        for i in range(10):
+            ready, _, _ = select.select([events.stdout], [], [], 10)
+            if not ready:
+                return -1
+            event = json.loads(events.stdout.readline())
+            if event['type'] == "exit" and event['id'] == cid:
+                return 0
+        return -1
+    finally:
+        if events is not None:
+            events.kill()
+            events.wait()
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+    return 0
+
+def test_pause_many():
+    if is_rootless():
+        return 77
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['process']['args'] = ['/init', 'pause']
+
+    cids = []
+    try:
+        for i in range(2):
+            _, cid = run_and_get_output(conf, command='run', detach=True)
+            cids.append(cid)
+        run_crun_command(["pause"] + cids)
+        for cid in cids:
+            state = json.loads(run_crun_command(["state", cid]))
+            if state['status'] != "paused":
+                sys.stderr.write("container %s not paused: %s\n" % (cid, state['status']))
+                return -1
+        run_crun_command(["resume"] + cids)
+        for cid in cids:
+            state = json.loads(run_crun_command(["state", cid]))
+            if state['status'] != "running":
+                sys.stderr.write("container %s not resumed: %s\n" % (cid, state['status']))
+                return -1
+    finally:
+        for cid in cids:
+            run_crun_command(["delete", "-f", cid])
+    return 0
+
+def test_thp_disable():
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['annotations'] = {"run.oci.thp": "disable"}
+    conf['process']['args'] = ['/init', 'cat', '/proc/self/status']
+
+    out, _ = run_and_get_output(conf)
+    # THP_enabled is reported only by recent kernels.
+    if "THP_enabled" not in out:
+        return 77
+    if "THP_enabled:\t0" not in out:
+        sys.stderr.write("THP is not disabled: %s\n" % out)
+        return -1
+    return 0
+
+def test_clone_into_cgroup():
+    if not is_cgroup_v2_unified() or is_rootless():
+        return 77
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    cgroup = "/crun-test-clone-into-cgroup-%d" % os.getpid()
+    conf['linux']['cgroupsPath'] = cgroup
+    conf['process']['args'] = ['/init', 'cat', '/proc/self/cgroup']
+
+    # with cgroupfs the process is created directly in its cgroup
+    out, _ = run_and_get_output(conf, global_args=["--cgroup-manager=cgroupfs"])
+    if "0::%s\n" % cgroup not in out:
+        sys.stderr.write("the process is not in %s: %s\n" % (cgroup, out))
+        return -1
+    if os.path.exists("/sys/fs/cgroup" + cgroup):
+        sys.stderr.write("the cgroup %s was not removed\n" % cgroup)
+        return -1
+    return 0
+
+def test_clone_into_cgroup_cleanup():
+    if not is_cgroup_v2_unified() or is_rootless():
+        return 77
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    cgroup = "/crun-test-clone-into-cgroup-cleanup-%d" % os.getpid()
+    conf['linux']['cgroupsPath'] = cgroup
+    conf['process']['args'] = ['/init', 'true']
+    # the process cannot be created once the cgroup exists
+    for ns in conf['linux']['namespaces']:
+        if ns['type'] == 'network':
+            ns['path'] = '/does/not/exist'
+
+    try:
+        _, cid = run_and_get_output(conf, command='create', hide_stderr=True,
+                                    global_args=["--cgroup-manager=cgroupfs"])
+        run_crun_command(["--cgroup-manager=cgroupfs", "delete", "-f", cid])
+        sys.stderr.write("the container was created\n")
+        return -1
+    except subprocess.CalledProcessError:
+        pass
+    if os.path.exists("/sys/fs/cgroup" + cgroup):
+        sys.stderr.write("the cgroup %s was not removed\n" % cgroup)
+        os.rmdir("/sys/fs/cgroup" + cgroup)
+        return -1
+    return 0
+
+def test_delete_nested_cgroups():
+    if not is_cgroup_v2_unified() or is_rootless():
+        return 77
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    cgroup = "/sys/fs/cgroup/crun-test-delete-nested-%d" % os.getpid()
+    conf['linux']['cgroupsPath'] = os.path.basename(cgroup)
+    conf['process']['args'] = ['/init', 'pause']
+    manager = "--cgroup-manager=cgroupfs"
+    pid_file = os.path.join(get_tests_root(), "delete-nested.pid")
+
+    cid = None
+    try:
+        _, cid = run_and_get_output(conf, command='run', detach=True, global_args=[manager])
+        # a process in a nested cgroup keeps the tree busy until it is killed
+        os.makedirs(os.path.join(cgroup, "a", "b"))
+        os.makedirs(os.path.join(cgroup, "c"))
+        run_crun_command([manager, "exec", "--detach", "--pid-file", pid_file, cid, "/init", "pause"])
+        with open(pid_file) as f:
+            pid = int(f.read())
+        with open(os.path.join(cgroup, "a", "b", "cgroup.procs"), "w") as f:
+            f.write(str(pid))
+        run_crun_command([manager, "delete", "-f", cid])
+        cid = None
+        if os.path.exists(cgroup):
+            sys.stderr.write("the cgroup %s was not removed\n" % cgroup)
+            return -1
+        try:
+            with open("/proc/%d/stat" % pid) as f:
+                # a zombie waiting to be reaped by its new parent is fine
+                if f.read().rsplit(")", 1)[1].split()[0] != "Z":
+                    sys.stderr.write("the process %d in the nested cgroup is still running\n" % pid)
+                    return -1
+        except FileNotFoundError:
+            pass
+    finally:
+        if cid is not None:
+            run_crun_command([manager, "delete", "-f", cid])
+    return 0
+
+def test_numa_placement():
+    if is_rootless() or not os.path.exists("/proc/self/numa_maps"):
+        return 77
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['annotations'] = {"run.oci.numa_placement": "bind"}
+    conf['linux']['resources'] = {"cpu" : {"cpus" : "0", "mems" : "0"}}
+    conf['process']['args'] = ['/init', 'cat', '/proc/self/numa_maps']
+
+    out, _ = run_and_get_output(conf)
+    if "bind:0" not in out:
+        sys.stderr.write("the memory policy is not set: %s\n" % out)
+        return -1
+
+    # crun itself keeps its own placement
+    with open("/proc/self/status") as f:
+        expected = parse_proc_status(f.read())['Cpus_allowed_list']
+    conf['process']['args'] = ['/init', 'pause']
+    cid = None
+    proc = None
+    try:
+        proc, cid = run_and_get_output(conf, use_popen=True)
+        for i in range(50):
+            try:
+                state = json.loads(run_crun_command(["state", cid]))
+                if state['status'] == "running":
+                    break
+            except Exception:
+                pass
+            time.sleep(0.1)
+        with open("/proc/%d/status" % proc.pid) as f:
+            current = parse_proc_status(f.read())['Cpus_allowed_list']
+        if current != expected:
+            sys.stderr.write("the affinity of crun changed from %s to %s\n" % (expected, current))
+            return -1
+
+        out = run_crun_command(["exec", cid, "/init", "cat", "/proc/self/status"])
+        if parse_proc_status(out)['Cpus_allowed_list'] != "0":
+            sys.stderr.write("the exec process is not placed: %s\n" % out)
+            return -1
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+        if proc is not None:
+            proc.wait()
+    return 0
 
 
 all_tests = {
@@ -168,6 +413,14 @@ all_tests = {
     "resources-unified" : test_resources_unified,
     "resources-unified-invalid-controller" : test_resources_unified_invalid_controller,
     "resources-unified-invalid-key" : test_resources_unified_invalid_key,
+    "events-stats" : test_events_stats,
+    "events-exit" : test_events_exit,
+    "pause-many" : test_pause_many,
+    "thp-disable" : test_thp_disable,
+    "clone-into-cgroup" : test_clone_into_cgroup,
+    "clone-into-cgroup-cleanup" : test_clone_into_cgroup_cleanup,
+    "delete-nested-cgroups" : test_delete_nested_cgroups,
+    "numa-placement" : test_numa_placement,
 }
 
 if __name__ == "__main__":
@@ -95,8 +95,150 @@ def test_seccomp_listener():
 
     return -1
 
+def test_seccomp_cache():
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['linux']['seccomp'] = {
+        'defaultAction': 'SCMP_ACT_ALLOW',
+        'syscalls': [
+            {
+                'names': ['getcwd'],
+                'action': 'SCMP_ACT_ERRNO',
+            },
+        ],
+    }
+    conf['process']['args'] = ['/init', 'cwd']
+
+    # use a state root of our own to find the cache
+    runtime_dir = os.path.join(get_tests_root(), "seccomp-cache")
+    os.makedirs(runtime_dir)
+    env = dict(os.environ, XDG_RUNTIME_DIR=runtime_dir)
+    cache_dir = os.path.join(runtime_dir, "crun", ".cache", "seccomp")
+
+    def stat_cache():
+        if not os.path.isdir(cache_dir):
+            return {}
+        return {f: (os.stat(os.path.join(cache_dir, f)).st_ino, os.stat(os.path.join(cache_dir, f)).st_mtime_ns)
+                for f in os.listdir(cache_dir) if f.endswith(".bpf")}
+
+    # the second run uses the program stored in the cache by the first one,
+    # the last one skips the cache.
+    cached = None
+    for annotations in [{}, {}, {'run.oci.seccomp_cache': '0'}]:
+        conf['annotations'] = annotations
+        try:
+            run_and_get_output(conf, hide_stderr=True, env=env)
+            print("getcwd was not blocked", file=sys.stderr)
+            return 1
+        except subprocess.CalledProcessError:
+            pass
+        files = stat_cache()
+        if cached is None:
+            if len(files) != 1:
+                print("expected one program in the cache, found %s" % list(files), file=sys.stderr)
+                return 1
+            cached = files
+        elif files != cached:
+            print("the cached program was not reused: %s != %s" % (files, cached), file=sys.stderr)
+            return 1
+    return 0
+
+def test_seccomp_optimize():
+    conf = base_config()
+    add_all_namespaces(conf)
+    # enough rules for the binary tree to matter, none used by the init
+    # except getcwd
+    names = ['acct', 'add_key', 'bpf', 'delete_module', 'finit_module', 'init_module', 'ioperm', 'iopl',
+             'kexec_file_load', 'kexec_load', 'keyctl', 'lookup_dcookie', 'mbind', 'move_pages',
+             'name_to_handle_at', 'open_by_handle_at', 'perf_event_open', 'pivot_root', 'process_vm_readv',
+             'process_vm_writev', 'ptrace', 'quotactl', 'reboot', 'request_key', 'set_mempolicy', 'swapoff',
+             'swapon', 'syslog', 'umount2', 'unshare', 'userfaultfd']
+    conf['linux']['seccomp'] = {
+        'defaultAction': 'SCMP_ACT_ALLOW',
+        'syscalls': [{'names': [name], 'action': 'SCMP_ACT_ERRNO'} for name in names + ['getcwd']],
+    }
+
+    # the profile behaves the same with the binary tree and without it
+    for annotations in [{'run.oci.seccomp_cache': '0'},
+                        {'run.oci.seccomp_cache': '0', 'run.oci.seccomp_optimize': '0'}]:
+        conf['annotations'] = annotations
+        conf['process']['args'] = ['/init', 'true']
+        try:
+            run_and_get_output(conf, hide_stderr=True)
+        except subprocess.CalledProcessError as e:
+            print("the container failed with %s: %s" % (annotations, e.output), file=sys.stderr)
+            return 1
+        conf['process']['args'] = ['/init', 'cwd']
+        try:
+            run_and_get_output(conf, hide_stderr=True)
+            print("getcwd was not blocked with %s" % annotations, file=sys.stderr)
+            return 1
+        except subprocess.CalledProcessError:
+            pass
+    return 0
+
+THREAD_SAFE_PLUGIN = """
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <linux/seccomp.h>
+
+/* Fail with ENOSPC when the request is handled by a worker thread.  */
+int run_oci_seccomp_notify_flags () { return 1; }
+int run_oci_seccomp_notify_plugin_version () { return 1; }
+int run_oci_seccomp_notify_start (void **opaque, void *conf, size_t size) { return 0; }
+int run_oci_seccomp_notify_stop (void *opaque) { return 0; }
+int
+run_oci_seccomp_notify_handle_request (void *opaque, void *sizes, struct seccomp_notif *sreq,
+                                       struct seccomp_notif_resp *sresp, int seccomp_fd, int *handled)
+{
+  sresp->id = sreq->id;
+  sresp->error = gettid () != getpid () ? -ENOSPC : -EPERM;
+  *handled = 1;
+  return 0;
+}
+"""
+
+def test_seccomp_notify_thread_safe_plugin():
+    if 'SECCOMP' not in get_crun_feature_string() or shutil.which("cc") is None:
+        return 77
+
+    source = os.path.join(get_tests_root(), "thread-safe-plugin.c")
+    plugin = os.path.join(get_tests_root(), "thread-safe-plugin.so")
+    with open(source, "w") as f:
+        f.write(THREAD_SAFE_PLUGIN)
+    subprocess.check_call(["cc", "-shared", "-fPIC", "-o", plugin, source])
+
+    conf = base_config()
+    add_all_namespaces(conf)
+    conf['annotations'] = {'run.oci.seccomp.plugins': plugin}
+    conf['linux']['seccomp'] = {
+        'defaultAction': 'SCMP_ACT_ALLOW',
+        'syscalls': [
+            {
+                'names': ['access', 'faccessat', 'faccessat2'],
+                'action': 'SCMP_ACT_NOTIFY',
+            },
+        ],
+    }
+    conf['process']['args'] = ['/init', 'access', '/init']
+    try:
+        out, _ = run_and_get_output(conf)
+        print("access was not blocked: %s" % out, file=sys.stderr)
+        return 1
+    except subprocess.CalledProcessError as e:
+        out = e.output.decode()
+    if "No space left on device" not in out:
+        print("the request was not handled by a worker: %s" % out, file=sys.stderr)
+        return 1
+    return 0
+
 all_tests = {
     "seccomp-listener" : test_seccomp_listener,
+    "seccomp-cache" : test_seccomp_cache,
+    "seccomp-optimize" : test_seccomp_optimize,
+    "seccomp-notify-thread-safe-plugin" : test_seccomp_notify_thread_safe_plugin,
 }
 
 if __name__ == "__main__":
@@ -88,6 +88,35 @@ def test_start():
             run_crun_command(["delete", "-f", cid])
     return 0
 
+def test_start_twice():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf)
+    cid = None
+    try:
+        proc, cid = run_and_get_output(conf, command='create', use_popen=True, hide_stderr=True)
+        for i in range(50):
+            try:
+                s = run_crun_command(["state", cid])
+                break
+            except Exception as e:
+                time.sleep(0.1)
+
+        run_crun_command(["start", cid])
+        # the second start must fail without touching the running workload
+        try:
+            subprocess.check_output([get_crun_path(), "start", cid], stderr=subprocess.STDOUT, close_fds=False)
+            return -1
+        except subprocess.CalledProcessError:
+            pass
+        state = json.loads(run_crun_command(["state", cid]))
+        if state['status'] != "running":
+            return -1
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+    return 0
+
 def test_start_override_config():
     conf = base_config()
     conf['process']['args'] = ['/init', 'echo', 'hello']
@@ -229,9 +258,331 @@ def test_empty_home():
         return -1
     return 0
 
+def test_trace():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'true']
+    add_all_namespaces(conf)
+    trace_file = os.path.join(get_tests_root(), "trace-%d.json" % os.getpid())
+    env = dict(os.environ)
+    env["CRUN_TRACE"] = trace_file
+    try:
+        run_and_get_output(conf, env=env)
+        with open(trace_file) as f:
+            events = json.load(f)["traceEvents"]
+        names = [i["name"] for i in events if i["ph"] == "X"]
+        # "mounts" is recorded by the container init and sent to crun.
+        for i in ["load-config", "create-process", "mounts"]:
+            if i not in names:
+                sys.stderr.write("%s not found in the trace\n" % i)
+                return -1
+    except Exception as e:
+        sys.stderr.write("%s\n" % e)
+        return -1
+    finally:
+        if os.path.exists(trace_file):
+            os.unlink(trace_file)
+    return 0
+
+def run_and_get_trace(conf):
+    trace_file = os.path.join(get_tests_root(), "trace-%d.json" % os.getpid())
+    env = dict(os.environ)
+    env["CRUN_TRACE"] = trace_file
+    try:
+        run_and_get_output(conf, env=env)
+        with open(trace_file) as f:
+            events = json.load(f)["traceEvents"]
+        return {i["name"]: i for i in events if i["ph"] == "X"}
+    finally:
+        if os.path.exists(trace_file):
+            os.unlink(trace_file)
+
+def trace_seccomp_config():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'true']
+    add_all_namespaces(conf)
+    conf['hooks'] = {"prestart" : [{"path" : "/bin/true"}]}
+    conf['linux']['seccomp'] = {
+        'defaultAction': 'SCMP_ACT_ALLOW',
+        'syscalls': [
+            {
+                'names': ['getcwd'],
+                'action': 'SCMP_ACT_ERRNO',
+            },
+        ],
+    }
+    return conf
+
+def test_trace_overlap():
+    conf = trace_seccomp_config()
+    conf['linux']['sysctl'] = {"kernel.hostname" : "overlap"}
+    try:
+        spans = run_and_get_trace(conf)
+        for i in ["sysctl", "mounts", "seccomp"]:
+            if i not in spans:
+                sys.stderr.write("%s not found in the trace\n" % i)
+                return -1
+        mounts_end = spans["mounts"]["ts"] + spans["mounts"]["dur"]
+        # the sysctls are applied before the container waits for its cgroup
+        if spans["sysctl"]["ts"] + spans["sysctl"]["dur"] > spans["mounts"]["ts"]:
+            sys.stderr.write("the sysctls were applied after the mounts started\n")
+            return -1
+        # the profile is generated during the mounts also with prestart hooks
+        if spans["seccomp"]["ts"] >= mounts_end:
+            sys.stderr.write("the seccomp profile was generated after the mounts\n")
+            return -1
+    except Exception as e:
+        sys.stderr.write("%s\n" % e)
+        return -1
+    return 0
+
+def test_trace_seccomp_span():
+    conf = trace_seccomp_config()
+    try:
+        spans = run_and_get_trace(conf)
+        for i in ["seccomp", "wait-init-1"]:
+            if i not in spans:
+                sys.stderr.write("%s not found in the trace\n" % i)
+                return -1
+        # the profile is generated in a thread started before crun waits
+        # for the container to run the hooks
+        if spans["seccomp"]["ts"] >= spans["wait-init-1"]["ts"]:
+            sys.stderr.write("the seccomp span starts at %s, after the wait at %s\n" %
+                             (spans["seccomp"]["ts"], spans["wait-init-1"]["ts"]))
+            return -1
+    except Exception as e:
+        sys.stderr.write("%s\n" % e)
+        return -1
+    return 0
+
+def test_metrics():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'true']
+    add_all_namespaces(conf)
+    env = dict(os.environ)
+    env["CRUN_METRICS"] = "1"
+    try:
+        run_and_get_output(conf, env=env)
+        out = run_crun_command(["metrics"])
+        # "mounts" is recorded by the container init, in the same segment.
+        for i in ['crun_operation_duration_seconds_count{operation="run"}',
+                  'crun_phase_duration_seconds_count{phase="mounts"}']:
+            if i not in out:
+                sys.stderr.write("%s not found in the metrics\n" % i)
+                return -1
+    except Exception as e:
+        sys.stderr.write("%s\n" % e)
+        return -1
+    return 0
+
+def run_from_template(conf, expected):
+    crun = get_crun_path()
+    template = None
+    cid = "test-template-instance-%d" % os.getpid()
+    created = False
+    out_file = os.path.join(get_tests_root(), "template-instance.out")
+    content = ""
+    try:
+        # The configuration has no capabilities, so the instance must
+        # create its namespaces before they are dropped.
+        _, template = run_and_get_output(conf, command='create', use_popen=True)
+        for i in range(50):
+            try:
+                run_crun_command(["state", template])
+                break
+            except Exception:
+                time.sleep(0.1)
+        with open(out_file, "w") as out:
+            subprocess.check_call([crun, "create", "--from-template", template, "--hostname", "instance", cid],
+                                  stdout=out, stderr=out, close_fds=False)
+        created = True
+        run_crun_command(["start", cid])
+        for i in range(50):
+            with open(out_file) as f:
+                content = f.read()
+            if expected(content):
+                return 0
+            time.sleep(0.1)
+        sys.stderr.write("unexpected output from the instance: %s\n" % content)
+        return -1
+    except Exception as e:
+        sys.stderr.write("%s\n" % e)
+        return -1
+    finally:
+        if created:
+            run_crun_command(["delete", "-f", cid])
+        if template is not None:
+            run_crun_command(["delete", "-f", template])
+
+def test_template():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'gethostname']
+    conf['annotations'] = {'run.oci.template': 'true'}
+    conf['hostname'] = 'template'
+    add_all_namespaces(conf)
+    return run_from_template(conf, lambda out: "instance" in out)
+
+def test_template_proc():
+    conf = base_config()
+    # /proc must show the PID namespace of the instance, where it is PID 1
+    conf['process']['args'] = ['/init', 'cat', '/proc/self/stat']
+    conf['annotations'] = {'run.oci.template': 'true'}
+    add_all_namespaces(conf)
+    return run_from_template(conf, lambda out: out.split(" ")[0] == "1")
+
+def test_template_writable_rootfs():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'true']
+    conf['annotations'] = {'run.oci.template': 'true'}
+    conf['root']['readonly'] = False
+    add_all_namespaces(conf)
+    try:
+        _, cid = run_and_get_output(conf, command='create', hide_stderr=True)
+    except subprocess.CalledProcessError:
+        return 0
+    run_crun_command(["delete", "-f", cid])
+    return -1
+
+def test_create_batch():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf)
+    crun = get_crun_path()
+    cid = None
+    good = "test-batch-good-%d" % os.getpid()
+    bad = "test-batch-bad-%d" % os.getpid()
+    batch_file = os.path.join(get_tests_root(), "batch.json")
+    try:
+        _, cid = run_and_get_output(conf, command='create')
+        bundle = json.loads(run_crun_command(["state", cid]))['bundle']
+        with open(batch_file, "w") as f:
+            json.dump([{"id": good, "bundle": bundle},
+                       {"id": bad, "bundle": "does/not/exist"}], f)
+        p = subprocess.run([crun, "create", "--batch", batch_file], stdout=subprocess.PIPE,
+                           stderr=subprocess.DEVNULL, close_fds=False)
+        if p.returncode == 0:
+            sys.stderr.write("the batch with a bad entry succeeded\n")
+            return -1
+        results = {i['id']: i for i in json.loads(p.stdout.decode())}
+        if not results[good]['created']:
+            sys.stderr.write("the good entry was not created: %s\n" % results[good])
+            return -1
+        if results[bad]['created'] or "realpath" not in results[bad].get('error', ''):
+            sys.stderr.write("unexpected result for the bad entry: %s\n" % results[bad])
+            return -1
+        run_crun_command(["state", good])
+    except Exception as e:
+        sys.stderr.write("%s\n" % e)
+        return -1
+    finally:
+        for i in [cid, good]:
+            if i is not None:
+                try:
+                    run_crun_command(["delete", "-f", i])
+                except Exception:
+                    pass
+    return 0
+
+def test_listen_not_socket():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'true']
+    add_all_namespaces(conf)
+    path = os.path.join(get_tests_root(), "listen-not-socket")
+    with open(path, "w") as f:
+        f.write("data")
+    cid = None
+    try:
+        try:
+            _, cid = run_and_get_output(conf, command='create', extra_args=['--listen', path])
+            return -1
+        except subprocess.CalledProcessError as e:
+            if "not a socket" not in e.output.decode():
+                return -1
+        # The file must not be replaced.
+        with open(path) as f:
+            if f.read() != "data":
+                return -1
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+        os.unlink(path)
+    return 0
+
+def test_listen_stale_socket():
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf)
+    path = os.path.join(get_tests_root(), "listen-stale-socket")
+    stale = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    stale.bind(path)
+    stale.close()
+    cid = None
+    try:
+        _, cid = run_and_get_output(conf, command='create', extra_args=['--listen', path])
+        client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        client.connect(path)
+        try:
+            for i in range(50):
+                state = json.loads(run_crun_command(["state", cid]))
+                if state['status'] == "running":
+                    return 0
+                time.sleep(0.1)
+        finally:
+            client.close()
+        return -1
+    finally:
+        if cid is not None:
+            run_crun_command(["delete", "-f", cid])
+        if os.path.exists(path):
+            os.unlink(path)
+
+def get_monitor_rss(annotations):
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    if annotations:
+        conf['annotations'] = annotations
+    add_all_namespaces(conf)
+    proc, cid = run_and_get_output(conf, command='run', use_popen=True, hide_stderr=True)
+    try:
+        for i in range(50):
+            try:
+                s = json.loads(run_crun_command(["state", cid]))
+                if s['status'] == "running":
+                    break
+            except Exception:
+                pass
+            time.sleep(0.1)
+        else:
+            return None
+        # give the monitor the time to enter its event loop
+        time.sleep(0.5)
+        with open("/proc/%d/status" % proc.pid) as f:
+            for line in f.readlines():
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1])
+        return None
+    finally:
+        run_crun_command(["kill", cid, "KILL"])
+        proc.wait()
+        run_crun_command(["delete", "-f", cid])
+
+def test_light_monitor():
+    # MADV_PAGEOUT was added in Linux 5.4
+    release = os.uname().release.split(".")
+    if (int(release[0]), int(release[1].split("-")[0])) < (5, 4):
+        return 77
+    normal = get_monitor_rss(None)
+    light = get_monitor_rss({"run.oci.light_monitor": "true"})
+    if normal is None or light is None:
+        return -1
+    if light < normal:
+        return 0
+    sys.stderr.write("monitor RSS: %d kB, with light_monitor: %d kB\n" % (normal, light))
+    return -1
+
 all_tests = {
     "start" : test_start,
     "start-override-config" : test_start_override_config,
+    "start-twice" : test_start_twice,
     "run-twice" : test_run_twice,
     "sd-notify" : test_sd_notify,
     "sd-notify-file" : test_sd_notify_file,
@@ -241,6 +592,17 @@ all_tests = {
     "test-cwd-relative-subdir": test_cwd_relative_subdir,
     "test-cwd-absolute": test_cwd_absolute,
     "empty-home": test_empty_home,
+    "trace": test_trace,
+    "trace-overlap": test_trace_overlap,
+    "trace-seccomp-span": test_trace_seccomp_span,
+    "metrics": test_metrics,
+    "template": test_template,
+    "template-proc": test_template_proc,
+    "template-writable-rootfs": test_template_writable_rootfs,
+    "create-batch": test_create_batch,
+    "listen-not-socket": test_listen_not_socket,
+    "listen-stale-socket": test_listen_stale_socket,
+    "light-monitor": test_light_monitor,
 }
 
 if __name__ == "__main__":
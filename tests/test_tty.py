@@ -58,11 +58,59 @@ def test_tty_and_detach():
             return 0
     return -1
     
+def test_console_log():
+    if os.isatty(1) == False:
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'echo', 'hello from the console']
+    conf['process']['terminal'] = True
+    add_all_namespaces(conf)
+    log = os.path.join(get_tests_root(), "console.log")
+    try:
+        out, _ = run_and_get_output(conf, extra_args=['--console-log', log])
+        if "hello from the console" in out:
+            return -1
+        with open(log) as f:
+            if "hello from the console" not in f.read():
+                return -1
+    finally:
+        if os.path.exists(log):
+            os.unlink(log)
+    return 0
+
+def test_console_log_rotate():
+    if os.isatty(1) == False:
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'cat', '/proc/self/mountinfo']
+    conf['process']['terminal'] = True
+    add_all_namespaces(conf)
+    log = os.path.join(get_tests_root(), "console-rotate.log")
+    try:
+        run_and_get_output(conf, extra_args=['--console-log', log, '--console-log-size', '16'])
+        # The output is longer than the limit, so the log was rotated.
+        if not os.path.exists(log + ".1"):
+            return -1
+        data = ""
+        for i in [log + ".1", log]:
+            if os.path.exists(i):
+                with open(i) as f:
+                    data += f.read()
+        if "proc" not in data:
+            return -1
+    finally:
+        for i in [log, log + ".1"]:
+            if os.path.exists(i):
+                os.unlink(i)
+    return 0
+
 all_tests = {
     "test-stdin-tty" : test_stdin_tty,
     "test-stdout-tty" : test_stdout_tty,
     "test-stderr-tty" : test_stderr_tty,
     "test-detach-tty" : test_tty_and_detach,
+    "test-console-log" : test_console_log,
+    "test-console-log-rotate" : test_console_log_rotate,
 }
 
 if __name__ == "__main__":
@@ -120,12 +120,55 @@ def test_keep_groups():
         return -1
     return 0
 
+def userns_pool_mounts():
+    with open("/proc/self/mountinfo") as f:
+        return [l for l in f.readlines() if "/.userns/" in l]
+
+def test_userns_pool():
+    if is_rootless():
+        return 77
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    conf['annotations'] = {"run.oci.userns_pool" : "true"}
+    add_all_namespaces(conf)
+    mapping = [{"containerID": 0, "hostID": 12345000, "size": 1000}]
+    conf['linux']['uidMappings'] = mapping
+    conf['linux']['gidMappings'] = mapping
+
+    before = len(userns_pool_mounts())
+    ids = []
+    try:
+        userns = []
+        for i in range(2):
+            _, container_id = run_and_get_output(conf, detach=True, hide_stderr=True)
+            ids.append(container_id)
+            state = json.loads(run_crun_command(["state", container_id]))
+            userns.append(os.readlink("/proc/%d/ns/user" % state['pid']))
+
+        # The second container joins the user namespace of the first one.
+        if userns[0] != userns[1] or len(userns_pool_mounts()) != before + 1:
+            return -1
+
+        # The entry is kept while a container uses it.
+        run_crun_command(["delete", "-f", ids.pop(0)])
+        if len(userns_pool_mounts()) != before + 1:
+            return -1
+
+        run_crun_command(["delete", "-f", ids.pop(0)])
+        if len(userns_pool_mounts()) != before:
+            return -1
+    finally:
+        for container_id in ids:
+            run_crun_command(["delete", "-f", container_id])
+    return 0
+
 all_tests = {
     "uid" : test_uid,
     "gid" : test_gid,
     "userns-full-mapping" : test_userns_full_mapping,
     "no-groups" : test_no_groups,
     "keep-groups" : test_keep_groups,
+    "userns-pool" : test_userns_pool,
 }
 
 if __name__ == "__main__":
@@ -53,9 +53,67 @@ def test_update():
         shutil.rmtree(temp_dir)
     return 1
 
+def get_memory_limit_file(pid):
+    unified = os.path.exists("/sys/fs/cgroup/cgroup.controllers")
+    with open("/proc/%s/cgroup" % pid) as f:
+        for line in f.readlines():
+            _, controllers, path = line.strip().split(":", 2)
+            if unified and controllers == "":
+                return "/sys/fs/cgroup%s/memory.max" % path
+            if not unified and "memory" in controllers.split(","):
+                return "/sys/fs/cgroup/memory%s/memory.limit_in_bytes" % path
+    return None
+
+def test_update_same_value():
+    if is_rootless():
+        return 77
+    strace = shutil.which("strace")
+    if strace is None:
+        return 77
+
+    conf = base_config()
+    conf['process']['args'] = ['/init', 'pause']
+    add_all_namespaces(conf)
+
+    temp_dir = tempfile.mkdtemp(dir=get_tests_root())
+    out, container_id = run_and_get_output(conf, detach=True)
+    try:
+        state = json.loads(run_crun_command(["state", container_id]))
+        p = get_memory_limit_file(state['pid'])
+        if p is None or not os.path.exists(p):
+            return 77
+        knob = os.path.basename(p)
+
+        res_file = os.path.join(temp_dir, "resources")
+        with open(res_file, 'w') as f:
+            f.write('{"memory": {"limit": 2002944}}')
+
+        # the first update writes the knob, the second one finds the value
+        # already set and must not write it again
+        writes = []
+        for i in range(2):
+            log = os.path.join(temp_dir, "strace-%d" % i)
+            subprocess.check_call([strace, "-f", "-y", "-e", "trace=write", "-o", log,
+                                   get_crun_path(), "update", "-r", res_file, container_id],
+                                  close_fds=False)
+            with open(log) as f:
+                writes.append(len([l for l in f.readlines() if "%s>" % knob in l]))
+            with open(p) as f:
+                if int(f.read()) != 2002944:
+                    return -1
+
+        if writes[0] > 0 and writes[1] == 0:
+            return 0
+        sys.stderr.write("writes to %s with strace: %s\n" % (knob, writes))
+    finally:
+        run_crun_command(["delete", "-f", container_id])
+        shutil.rmtree(temp_dir)
+    return -1
+
 
 all_tests = {
     "test-update" : test_update,
+    "test-update-same-value" : test_update_same_value,
 }
 
 if __name__ == "__main__":
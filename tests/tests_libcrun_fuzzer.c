@@ -154,7 +154,7 @@ generate_seccomp (uint8_t *buf, size_t len)
   if (outfd < 0)
     return 0;
 
-  libcrun_generate_seccomp (container, outfd, 0, &err);
+  libcrun_generate_seccomp (container, outfd, 0, NULL, &err);
   crun_error_release (&err);
   return 0;
 }
@@ -311,6 +311,7 @@ run_one_container (uint8_t *buf, size_t len, bool detach)
   ctx.detach = detach;
   ctx.config_file_content = conf;
   ctx.fifo_exec_wait_fd = -1;
+  ctx.start_event_fd = -1;
 
   libcrun_container_run (&ctx, container, LIBCRUN_RUN_OPTIONS_PREFORK, &err);
   crun_error_release (&err);
@@ -19,9 +19,15 @@
 #include <libcrun/error.h>
 #include <libcrun/utils.h>
 #include <libcrun/cgroup.h>
+#include <libcrun/event_loop.h>
+#include <libcrun/seccomp.h>
+#include <libcrun/seccomp_notify.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 
 typedef int (*test)();
 
@@ -369,6 +375,344 @@ test_parse_sd_array ()
 }
 #endif
 
+static int
+event_loop_read_cb (libcrun_event_loop_t *loop, int fd, void *arg, libcrun_error_t *err)
+{
+  int *count = arg;
+  char buffer[16];
+
+  if (read (fd, buffer, sizeof (buffer)) != 1 || buffer[0] != 'x')
+    return crun_make_error (err, 0, "unexpected data");
+  (*count)++;
+  return 0;
+}
+
+static int
+event_loop_timer_cb (libcrun_event_loop_t *loop, int fd, void *arg, libcrun_error_t *err)
+{
+  int *count = arg;
+
+  libcrun_event_loop_stop (loop, *count == 1 ? 42 : -1);
+  return 0;
+}
+
+static int
+test_event_loop ()
+{
+  cleanup_event_loop libcrun_event_loop_t *loop = NULL;
+  libcrun_error_t err = NULL;
+  cleanup_close int fd0 = -1;
+  cleanup_close int fd1 = -1;
+  int count = 0;
+  int fds[2];
+  int ret;
+
+  ret = create_socket_pair (fds, &err);
+  if (ret < 0)
+    return -1;
+  fd0 = fds[0];
+  fd1 = fds[1];
+
+  ret = libcrun_event_loop_new (&loop, &err);
+  if (ret < 0)
+    return -1;
+
+  ret = libcrun_event_loop_add (loop, fd1, false, event_loop_read_cb, &count, &err);
+  if (ret < 0)
+    return -1;
+
+  ret = libcrun_event_loop_add_timer (loop, 100, false, event_loop_timer_cb, &count, &err);
+  if (ret < 0)
+    return -1;
+
+  if (write (fd0, "x", 1) != 1)
+    return -1;
+
+  ret = libcrun_event_loop_run (loop, &err);
+  if (ret != 42)
+    return -1;
+
+  ret = libcrun_event_loop_remove (loop, fd1, &err);
+  if (ret < 0)
+    return -1;
+
+  ret = libcrun_event_loop_remove (loop, fd1, &err);
+  if (ret >= 0)
+    return -1;
+  crun_error_release (&err);
+
+  return 0;
+}
+
+static int
+test_rootfs_resolver ()
+{
+  struct crun_rootfs_resolver_s resolver;
+  libcrun_error_t err = NULL;
+  char root[] = "tests/resolver-XXXXXX";
+  cleanup_free char *rootfs = NULL;
+  cleanup_close int rootfsfd = -1;
+  struct stat st_link, st_file;
+  int failed = 1;
+  int fd;
+
+  if (mkdtemp (root) == NULL)
+    return -1;
+
+  rootfs = realpath (root, NULL);
+  if (rootfs == NULL)
+    goto exit;
+  rootfsfd = open (rootfs, O_PATH | O_CLOEXEC);
+  if (rootfsfd < 0)
+    goto exit;
+
+  if (mkdirat (rootfsfd, "a", 0700) < 0 || mkdirat (rootfsfd, "b", 0700) < 0
+      || symlinkat ("/b", rootfsfd, "a/l") < 0 || symlinkat ("/b", rootfsfd, "v") < 0)
+    goto exit;
+  fd = openat (rootfsfd, "b/c", O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+  if (fd < 0)
+    goto exit;
+  close (fd);
+
+  crun_rootfs_resolver_init (&resolver, rootfsfd, rootfs, strlen (rootfs));
+
+  /* The symlink must be resolved under the rootfs, not under the cached "a".  */
+  fd = crun_rootfs_resolver_open (&resolver, "/a/l/c", O_PATH | O_CLOEXEC, 0, &err);
+  if (fd < 0)
+    goto release;
+  if (fstat (fd, &st_link) < 0 || fstatat (rootfsfd, "b/c", &st_file, 0) < 0 || st_link.st_ino != st_file.st_ino)
+    {
+      close (fd);
+      goto release;
+    }
+  close (fd);
+
+  fd = crun_rootfs_resolver_open (&resolver, "a/missing", O_PATH | O_CLOEXEC, 0, &err);
+  if (fd >= 0)
+    {
+      close (fd);
+      goto release;
+    }
+  crun_error_release (&err);
+
+  fd = crun_rootfs_resolver_create_and_open_ref (&resolver, true, "a/d/e", 0700, &err);
+  if (fd < 0)
+    goto release;
+  close (fd);
+
+  crun_rootfs_resolver_invalidate (&resolver, "/a/");
+  if (resolver.entries_len != 0)
+    goto release;
+
+  /* "v" is a symlink to "b": a mount on "b" must drop the "v" entry, and a
+     mount on "v" the "b" entry.  */
+  fd = crun_rootfs_resolver_open (&resolver, "/v/c", O_PATH | O_CLOEXEC, 0, &err);
+  if (fd < 0)
+    goto release;
+  close (fd);
+  crun_rootfs_resolver_invalidate (&resolver, "/b");
+  if (resolver.entries_len != 0)
+    goto release;
+
+  fd = crun_rootfs_resolver_open (&resolver, "/b/c", O_PATH | O_CLOEXEC, 0, &err);
+  if (fd < 0)
+    goto release;
+  close (fd);
+  crun_rootfs_resolver_invalidate (&resolver, "/v");
+  if (resolver.entries_len != 0)
+    goto release;
+
+  failed = 0;
+
+release:
+  crun_rootfs_resolver_release (&resolver);
+exit:
+  if (rootfsfd >= 0)
+    {
+      unlinkat (rootfsfd, "a/d/e", AT_REMOVEDIR);
+      unlinkat (rootfsfd, "a/d", AT_REMOVEDIR);
+      unlinkat (rootfsfd, "a/l", 0);
+      unlinkat (rootfsfd, "v", 0);
+      unlinkat (rootfsfd, "b/c", 0);
+      unlinkat (rootfsfd, "a", AT_REMOVEDIR);
+      unlinkat (rootfsfd, "b", AT_REMOVEDIR);
+    }
+  rmdir (root);
+  if (err)
+    crun_error_release (&err);
+  return failed ? -1 : 0;
+}
+
+static int
+test_read_all_fd_buffer ()
+{
+  cleanup_read_buffer struct crun_read_buffer_s buffer = {
+    NULL,
+  };
+  libcrun_error_t err = NULL;
+  char data[10000];
+  size_t allocated;
+  size_t i, len;
+  int p[2];
+  int ret;
+
+  memset (data, 'a', sizeof (data));
+
+  /* A pipe reports a size of 0 like the files on procfs, so the buffer
+     must grow while reading.  */
+  for (i = 0; i < 2; i++)
+    {
+      size_t size = i == 0 ? sizeof (data) : 10;
+
+      if (pipe (p) < 0)
+        return -1;
+      ret = write (p[1], data, size);
+      close (p[1]);
+      if (ret != (int) size)
+        {
+          close (p[0]);
+          return -1;
+        }
+
+      if (i == 1)
+        allocated = buffer.allocated;
+
+      ret = read_all_fd_buffer (p[0], "pipe", &buffer, &len, &err);
+      close (p[0]);
+      if (ret < 0)
+        {
+          crun_error_release (&err);
+          return -1;
+        }
+
+      if (len != size || buffer.data[len] != '\0' || memcmp (buffer.data, data, size) != 0)
+        return -1;
+
+      /* A smaller file must reuse the memory already allocated.  */
+      if (i == 1 && buffer.allocated != allocated)
+        return -1;
+    }
+
+  return 0;
+}
+
+static int
+test_arena ()
+{
+  char buffer[256] __attribute__ ((aligned (8)));
+  cleanup_arena struct crun_arena_s arena;
+  libcrun_error_t err = NULL;
+  char *path = NULL;
+  char *str;
+  int i, ret;
+
+  crun_arena_init (&arena, buffer, sizeof (buffer));
+
+  /* The first allocations come from the buffer provided by the caller.  */
+  str = crun_arena_strdup (&arena, "foo");
+  if (str < buffer || str >= buffer + sizeof (buffer) || strcmp (str, "foo") != 0)
+    return -1;
+
+  /* Then the arena grows on the heap.  */
+  for (i = 0; i < 1000; i++)
+    {
+      str = crun_arena_sprintf (&arena, "%d-%s", i, "bar");
+      if (((uintptr_t) str) % sizeof (void *) || atoi (str) != i || strcmp (strchr (str, '-'), "-bar") != 0)
+        return -1;
+    }
+
+  str = crun_arena_alloc (&arena, 100000);
+  memset (str, 0, 100000);
+
+  ret = crun_arena_append_paths (&arena, &path, &err, "//a/", "/b//", "c", NULL);
+  if (ret < 0)
+    {
+      crun_error_release (&err);
+      return -1;
+    }
+  if (strcmp (path, "/a/b/c") != 0)
+    return -1;
+
+  return 0;
+}
+
+static int
+test_write_batch ()
+{
+  char root[] = "tests/write-batch-XXXXXX";
+  libcrun_error_t err = NULL;
+  cleanup_close int dirfd = -1;
+  char names[100][16], values[100][32];
+  size_t done;
+  int i, ret, failed = 1;
+
+  if (mkdtemp (root) == NULL)
+    return -1;
+
+  dirfd = open (root, O_DIRECTORY | O_CLOEXEC);
+  if (dirfd < 0)
+    goto exit;
+
+  /* Enough entries to use more than one ring submission.  */
+  {
+    cleanup_write_batch struct crun_write_batch_s batch = {};
+
+    for (i = 0; i < 100; i++)
+      {
+        sprintf (names[i], "%d", i);
+        ret = write_file_at (dirfd, names[i], "", 0, &err);
+        if (ret < 0)
+          goto exit;
+
+        sprintf (values[i], "value-%d", i);
+        crun_write_batch_add (&batch, dirfd, names[i], values[i], strlen (values[i]));
+      }
+
+    /* The entries that were not written are left to the caller.  */
+    done = crun_write_batch_flush (&batch);
+    for (i = done; i < 100; i++)
+      {
+        ret = write_file_at (dirfd, names[i], values[i], strlen (values[i]), &err);
+        if (ret < 0)
+          goto exit;
+      }
+  }
+
+  for (i = 0; i < 100; i++)
+    {
+      cleanup_free char *content = NULL;
+      cleanup_free char *path = NULL;
+
+      xasprintf (&path, "%s/%d", root, i);
+      ret = read_all_file (path, &content, NULL, &err);
+      if (ret < 0 || strcmp (content, values[i]) != 0)
+        goto exit;
+    }
+
+  /* Nothing after a missing file is written.  */
+  {
+    cleanup_write_batch struct crun_write_batch_s batch = {};
+
+    for (i = 0; i < 10; i++)
+      crun_write_batch_add (&batch, dirfd, i == 5 ? "missing" : names[i], "x", 1);
+    done = crun_write_batch_flush (&batch);
+    if (done > 5)
+      goto exit;
+  }
+
+  failed = 0;
+
+exit:
+  crun_error_release (&err);
+  for (i = 0; i < 100; i++)
+    {
+      sprintf (names[i], "%d", i);
+      unlinkat (dirfd, names[i], 0);
+    }
+  rmdir (root);
+  return failed ? -1 : 0;
+}
+
 static void
 run_and_print_test_result (const char *name, int id, test t)
 {
@@ -383,11 +727,134 @@ run_and_print_test_result (const char *name, int id, test t)
 
 #define RUN_TEST(T) do {run_and_print_test_result (#T, id++, T);} while (0)
 
+static int
+test_find_mountinfo_mount_point ()
+{
+  const char *mountinfo = "22 1 0:21 / / rw,relatime shared:1 - ext4 /dev/sda1 rw\n"
+                          "23 22 0:22 / /home rw,relatime shared:2 - ext4 /dev/sda2 rw\n"
+                          "24 23 0:23 / /home/my\\040bundles rw shared:3 - tmpfs tmpfs rw\n"
+                          "25 22 0:24 / /ho rw shared:4 - tmpfs tmpfs rw\n";
+  const struct
+  {
+    const char *path;
+    const char *mount_point;
+  } cases[] = {
+    { "/home/user/rootfs", "/home" },
+    { "/home/my bundles/ctr/rootfs", "/home/my bundles" },
+    { "/home", "/home" },
+    { "/hom/rootfs", "/" },
+    { "/home/my bundlesx/rootfs", "/home" },
+    { "/ho/rootfs", "/ho" },
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof (cases) / sizeof (cases[0]); i++)
+    {
+      cleanup_free char *content = xstrdup (mountinfo);
+      const char *found = find_mountinfo_mount_point (content, cases[i].path);
+
+      if (found == NULL || strcmp (found, cases[i].mount_point) != 0)
+        return -1;
+    }
+
+  return 0;
+}
+
+static int
+test_parse_helpers ()
+{
+  cleanup_free char *content = xstrdup ("12\n\n345\n18446744073709551615\n18446744073709551616\nx");
+  const char *expected[] = { "12", "", "345", "18446744073709551615", "18446744073709551616", "x" };
+  cleanup_free char *fields = xstrdup ("0::/user.slice");
+  const char *stat = "R 1 2 3 4";
+  char *cursor = content;
+  uint64_t value;
+  size_t i;
+  char *it;
+
+  if (count_chars (content, strlen (content), '\n') != 5)
+    return -1;
+
+  for (i = 0, it = consume_line (&cursor); it; i++, it = consume_line (&cursor))
+    if (i >= sizeof (expected) / sizeof (expected[0]) || strcmp (it, expected[i]) != 0)
+      return -1;
+  if (i != sizeof (expected) / sizeof (expected[0]))
+    return -1;
+
+  if (parse_uint64 ("345 ", &value) == NULL || value != 345)
+    return -1;
+  if (parse_uint64 ("18446744073709551615", &value) == NULL || value != UINT64_MAX)
+    return -1;
+  if (parse_uint64 ("18446744073709551616", &value) != NULL)
+    return -1;
+  if (parse_uint64 ("x", &value) != NULL || parse_uint64 ("", &value) != NULL)
+    return -1;
+
+  cursor = fields;
+  if (strcmp (consume_field (&cursor, ':'), "0") != 0 || strcmp (consume_field (&cursor, ':'), "") != 0
+      || strcmp (cursor, "/user.slice") != 0)
+    return -1;
+
+  if (skip_fields (stat, ' ', 4) == NULL || strcmp (skip_fields (stat, ' ', 4), "4") != 0)
+    return -1;
+  if (skip_fields (stat, ' ', 5) != NULL)
+    return -1;
+
+  return 0;
+}
+
+static int
+test_seccomp_notify_filters ()
+{
+  struct run_oci_seccomp_notify_filter_s filter = {
+    .name = "openat",
+    .n_args = 1,
+    .args = { { .index = 2, .op = "SCMP_CMP_EQ", .value = 1 } },
+  };
+  libcrun_error_t err = NULL;
+  const char *op;
+
+  if (libcrun_check_seccomp_notify_filter (&filter, &err) < 0)
+    {
+      crun_error_release (&err);
+      return -1;
+    }
+
+  /* The conditions must not be truncated.  */
+  filter.n_args = RUN_OCI_SECCOMP_NOTIFY_MAX_ARGS + 1;
+  if (libcrun_check_seccomp_notify_filter (&filter, &err) == 0)
+    return -1;
+  crun_error_release (&err);
+
+  filter.n_args = 1;
+  filter.args[0].index = 6;
+  if (libcrun_check_seccomp_notify_filter (&filter, &err) == 0)
+    return -1;
+  crun_error_release (&err);
+
+  /* The calls not matching a single condition get a rule of their own.  */
+  op = libcrun_seccomp_negate_operator ("SCMP_CMP_EQ");
+  if (op == NULL || strcmp (op, "SCMP_CMP_NE") != 0)
+    return -1;
+  op = libcrun_seccomp_negate_operator ("SCMP_CMP_GT");
+  if (op == NULL || strcmp (op, "SCMP_CMP_LE") != 0)
+    return -1;
+  op = libcrun_seccomp_negate_operator ("SCMP_CMP_GE");
+  if (op == NULL || strcmp (op, "SCMP_CMP_LT") != 0)
+    return -1;
+
+  /* Otherwise the whole syscall is notified.  */
+  if (libcrun_seccomp_negate_operator ("SCMP_CMP_MASKED_EQ") != NULL)
+    return -1;
+
+  return 0;
+}
+
 int
 main ()
 {
   int id = 1;
-  printf ("1..7\n");
+  printf ("1..15\n");
   RUN_TEST (test_crun_path_exists);
   RUN_TEST (test_write_read_file);
   RUN_TEST (test_run_process);
@@ -395,6 +862,14 @@ main ()
   RUN_TEST (test_socket_pair);
   RUN_TEST (test_send_receive_fd);
   RUN_TEST (test_append_paths);
+  RUN_TEST (test_event_loop);
+  RUN_TEST (test_rootfs_resolver);
+  RUN_TEST (test_read_all_fd_buffer);
+  RUN_TEST (test_arena);
+  RUN_TEST (test_find_mountinfo_mount_point);
+  RUN_TEST (test_parse_helpers);
+  RUN_TEST (test_seccomp_notify_filters);
+  RUN_TEST (test_write_batch);
 #ifdef HAVE_SYSTEMD
   RUN_TEST (test_parse_sd_array);
 #endif
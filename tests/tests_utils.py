@@ -193,7 +193,7 @@ def get_crun_path():
 def run_and_get_output(config, detach=False, preserve_fds=None, pid_file=None,
                        command='run', env=None, use_popen=False, hide_stderr=False,
                        all_dev_null=False, id_container=None, relative_config_path="config.json",
-                       chown_rootfs_to=None):
+                       chown_rootfs_to=None, extra_args=None, global_args=None):
 
     # Some tests require that the container user, which might not be the
     # same user as the person running the tests, is able to resolve the full path
@@ -244,7 +244,10 @@ def run_and_get_output(config, detach=False, preserve_fds=None, pid_file=None,
     pid_file_arg = ['--pid-file', pid_file] if pid_file else []
     relative_config_path = ['--config', relative_config_path] if relative_config_path else []
 
-    args = [crun, command] + relative_config_path + preserve_fds_arg + detach_arg + pid_file_arg + [id_container]
+    extra_args = extra_args or []
+    global_args = global_args or []
+
+    args = [crun] + global_args + [command] + relative_config_path + preserve_fds_arg + detach_arg + pid_file_arg + extra_args + [id_container]
 
     stderr = subprocess.STDOUT
     if hide_stderr: